@@ -6,14 +6,27 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
 #include <cstdlib>
 #include <cstring>
 #include <fstream>
+#include <functional>
+#include <future>
 #include <iomanip>
+#include <memory>
 #include <mutex>
+#include <numeric>
+#include <random>
+#include <sstream>
 #include <string>
 #include <vector>
 
+#include <sys/stat.h>
+
 #include <flashlight/flashlight.h>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
@@ -23,7 +36,12 @@
 #include "common/Transforms.h"
 #include "criterion/criterion.h"
 #include "data/Featurize.h"
+#include "libraries/common/BlockingQueue.h"
 #include "libraries/common/Dictionary.h"
+#include "libraries/common/Numa.h"
+#include "libraries/common/TaskScheduler.h"
+#include "libraries/decoder/BiasingTrie.h"
+#include "libraries/decoder/GraphDecoder.h"
 #include "libraries/decoder/LexiconDecoder.h"
 #include "libraries/decoder/LexiconFreeDecoder.h"
 #include "libraries/decoder/LexiconFreeSeq2SeqDecoder.h"
@@ -36,6 +54,219 @@
 
 using namespace w2l;
 
+namespace {
+
+// A sample streamed from the emission producers to the decoder threads
+struct EmissionSample {
+  std::vector<float> emission;
+  SparseEmissions sparseEmission; // Instead of `emission` with --emission_topk
+  // Instead of `emission`, mapped from an emission file which stores it as is
+  const uint16_t* halfEmission = nullptr;
+  std::vector<std::string> wordTarget;
+  std::vector<int> tokenTarget;
+  std::string sampleId;
+  int T;
+  int N;
+  double duration; // Of the audio in seconds, 0 if unknown
+};
+
+/* Decode `sample` in the form in which its emission was read */
+std::vector<DecodeResult> decodeSample(
+    Decoder& decoder,
+    const EmissionSample& sample) {
+  if (sample.halfEmission) {
+    return decoder.decodeHalf(sample.halfEmission, sample.T, sample.N);
+  }
+  if (FLAGS_emission_topk > 0) {
+    return decoder.decodeSparse(sample.sparseEmission);
+  }
+  return decoder.decode(sample.emission.data(), sample.T, sample.N);
+}
+
+/**
+ * Sparsify an N x T emission on its device (see SparseEmissions), so that only
+ * the `K` best tokens of each frame and the `blank` token (if >= 0) are copied
+ * to the host.
+ */
+SparseEmissions topkEmissions(const af::array& emission, int K, int blank) {
+  const int N = emission.dims(0);
+  const int T = emission.dims(1);
+  K = std::min(K, N);
+  af::array values, indices;
+  af::topk(values, indices, emission, K, 0, AF_TOPK_MAX);
+  auto scores = afToVector<float>(values);
+  auto tokens = afToVector<int>(indices.as(s32));
+  std::vector<float> blankScores;
+  if (blank >= 0) {
+    blankScores = afToVector<float>(emission.row(blank));
+  }
+
+  SparseEmissions sparse;
+  sparse.N = N;
+  std::vector<int> order(K);
+  std::vector<int> frameTokens;
+  std::vector<float> frameScores;
+  for (int t = 0; t < T; t++) {
+    const int* topTokens = tokens.data() + t * K;
+    const float* topScores = scores.data() + t * K;
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](int l, int r) {
+      return topScores[l] > topScores[r] ||
+          (topScores[l] == topScores[r] && topTokens[l] < topTokens[r]);
+    });
+    frameTokens.clear();
+    frameScores.clear();
+    for (int i : order) {
+      frameTokens.push_back(topTokens[i]);
+      frameScores.push_back(topScores[i]);
+    }
+    float floor = K > 0 ? frameScores.back() : kNegativeInfinity;
+    if (blank >= 0 &&
+        std::find(frameTokens.begin(), frameTokens.end(), blank) ==
+            frameTokens.end()) {
+      frameTokens.push_back(blank);
+      frameScores.push_back(blankScores[t]);
+    }
+    sparse.addFrame(
+        frameTokens.data(), frameScores.data(), frameTokens.size(), floor);
+  }
+  return sparse;
+}
+
+/* Values of a comma-separated list, or `defaultValue` if it is empty */
+std::vector<float> parseSweepValues(
+    const std::string& list,
+    float defaultValue) {
+  std::vector<float> values;
+  for (const auto& value : split(',', list, true)) {
+    values.push_back(std::stof(value));
+  }
+  if (values.empty()) {
+    values.push_back(defaultValue);
+  }
+  return values;
+}
+
+/**
+ * The decoder options of the sweep set by the --sweep_* flags, none if no
+ * value is listed. They are the grid of the listed values of the LM weight,
+ * word score, silence score and beam threshold, or with --sweep_random,
+ * options drawn uniformly within the ranges of the listed values.
+ */
+std::vector<DecoderOptions> sweepDecoderOptions(const DecoderOptions& base) {
+  if (FLAGS_sweep_lmweight.empty() && FLAGS_sweep_wordscore.empty() &&
+      FLAGS_sweep_silscore.empty() && FLAGS_sweep_beamthreshold.empty()) {
+    return {};
+  }
+  std::vector<std::vector<float>> values{
+      parseSweepValues(FLAGS_sweep_lmweight, base.lmWeight),
+      parseSweepValues(FLAGS_sweep_wordscore, base.wordScore),
+      parseSweepValues(FLAGS_sweep_silscore, base.silScore),
+      parseSweepValues(FLAGS_sweep_beamthreshold, base.beamThreshold)};
+  auto makeOptions = [&base](const std::vector<float>& config) {
+    DecoderOptions opt = base;
+    opt.lmWeight = config[0];
+    opt.wordScore = config[1];
+    opt.silScore = config[2];
+    opt.beamThreshold = config[3];
+    return opt;
+  };
+
+  std::vector<DecoderOptions> opts;
+  std::vector<float> config(values.size());
+  if (FLAGS_sweep_random > 0) {
+    std::mt19937 rng(FLAGS_seed);
+    for (int i = 0; i < FLAGS_sweep_random; i++) {
+      for (int j = 0; j < values.size(); j++) {
+        auto range = std::minmax_element(values[j].begin(), values[j].end());
+        config[j] = std::uniform_real_distribution<float>(
+            *range.first, *range.second)(rng);
+      }
+      opts.push_back(makeOptions(config));
+    }
+    return opts;
+  }
+  std::vector<int> position(values.size(), 0);
+  int j = 0;
+  while (j < values.size()) {
+    for (int k = 0; k < values.size(); k++) {
+      config[k] = values[k][position[k]];
+    }
+    opts.push_back(makeOptions(config));
+    // Next point of the grid, the first value changing fastest
+    for (j = 0; j < values.size() && ++position[j] == values[j].size(); j++) {
+      position[j] = 0;
+    }
+  }
+  return opts;
+}
+
+/* Logs the wall time of a phase of the startup when it goes out of scope */
+class StartupPhase {
+ public:
+  explicit StartupPhase(std::string name)
+      : name_(std::move(name)), start_(std::chrono::steady_clock::now()) {}
+
+  ~StartupPhase() {
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start_;
+    LOG(INFO) << "[Startup] " << name_ << ": " << std::fixed
+              << std::setprecision(2) << elapsed.count() << " s";
+  }
+
+ private:
+  std::string name_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+/* Nearest-rank percentile `p` in [0, 100] of `values` */
+double percentile(std::vector<double> values, double p) {
+  if (values.empty()) {
+    return 0;
+  }
+  std::sort(values.begin(), values.end());
+  int rank = std::ceil(p / 100 * values.size());
+  return values[std::max(rank, 1) - 1];
+}
+
+/**
+ * Fingerprint of what the compiled trie is built from: the lexicon, the
+ * tokens and their packing, the smearing mode and, for the word decoder, the
+ * LM file whose unigram scores are stored in it.
+ */
+std::string trieFingerprint(
+    const LexiconMap& lexicon,
+    const Dictionary& tokenDict) {
+  std::ostringstream key;
+  for (int i = 0; i < tokenDict.indexSize(); ++i) {
+    key << tokenDict.getEntry(i) << "\n";
+  }
+  key << FLAGS_wordseparator << " " << FLAGS_replabel << " "
+      << FLAGS_smearing << "\n";
+  // Independent of the order of the lexicon
+  uint64_t lexiconHash = 0;
+  for (const auto& entry : lexicon) {
+    std::string spellings = entry.first;
+    for (const auto& spelling : entry.second) {
+      spellings += "\t";
+      for (const auto& token : spelling) {
+        spellings += token + " ";
+      }
+    }
+    lexiconHash += std::stoull(hashKey(spellings), nullptr, 16);
+  }
+  key << lexicon.size() << " " << lexiconHash << "\n";
+  if (FLAGS_decodertype == "wrd") {
+    struct stat info = {};
+    stat(FLAGS_lm.c_str(), &info);
+    key << FLAGS_lmtype << " " << FLAGS_lm << " " << info.st_size << " "
+        << info.st_mtime << "\n";
+  }
+  return hashKey(key.str());
+}
+
+} // namespace
+
 int main(int argc, char** argv) {
   google::InitGoogleLogging(argv[0]);
   google::InstallFailureSignalHandler();
@@ -50,6 +281,12 @@ int main(int argc, char** argv) {
   }
 
   /* ===================== Parse Options ===================== */
+  // Each phase of the startup logs its time. The independent ones run
+  // concurrently: the acoustic model and the emissions, then the LM and the
+  // trie (the trie waiting for the LM only if it stores word scores) along
+  // with the indexing of the dataset.
+  auto startup = fl::cpp::make_unique<StartupPhase>("total");
+  auto parsing = fl::cpp::make_unique<StartupPhase>("flag parsing");
   LOG(INFO) << "Parsing command line flags";
   gflags::ParseCommandLineFlags(&argc, &argv, false);
   auto flagsfile = FLAGS_flagsfile;
@@ -66,22 +303,41 @@ int main(int argc, char** argv) {
   }
 
   EmissionSet emissionSet;
+  std::unique_ptr<EmissionFileReader> emissionFile;
   std::shared_ptr<fl::Module> network;
   std::shared_ptr<SequenceCriterion> criterion;
   std::unordered_map<std::string, std::string> cfg;
 
+  parsing.reset();
+
   /* Using existing emissions */
-  if (!FLAGS_emission_dir.empty()) {
+  auto emissionsRead = std::async(std::launch::async, [&]() {
+    if (FLAGS_emission_dir.empty()) {
+      return;
+    }
+    StartupPhase phase("emission load");
     std::string cleanedTestPath = cleanFilepath(FLAGS_test);
-    std::string loadPath =
-        pathsConcat(FLAGS_emission_dir, cleanedTestPath + ".bin");
-    LOG(INFO) << "[Serialization] Loading file: " << loadPath;
-    W2lSerializer::load(loadPath, emissionSet);
-    gflags::ReadFlagsFromString(emissionSet.gflags, gflags::GetArgv0(), true);
-  }
+    std::string mmapPath =
+        pathsConcat(FLAGS_emission_dir, cleanedTestPath + ".emissions");
+    if (fileExists(EmissionFileReader::indexPath(mmapPath))) {
+      // Only the index is read, the emissions are paged in by the producer
+      LOG(INFO) << "[Serialization] Mapping file: " << mmapPath;
+      emissionFile = fl::cpp::make_unique<EmissionFileReader>(mmapPath);
+      emissionSet = emissionFile->meta();
+    } else {
+      std::string loadPath =
+          pathsConcat(FLAGS_emission_dir, cleanedTestPath + ".bin");
+      LOG(INFO) << "[Serialization] Loading file: " << loadPath;
+      W2lSerializer::load(loadPath, emissionSet);
+    }
+  });
 
   /* Using acoustic model */
-  if (!FLAGS_am.empty()) {
+  auto amRead = std::async(std::launch::async, [&]() {
+    if (FLAGS_am.empty()) {
+      return;
+    }
+    StartupPhase phase("AM load");
     LOG(INFO) << "[Network] Reading acoustic model from " << FLAGS_am;
     af::setDevice(0);
     W2lSerializer::load(FLAGS_am, cfg, network, criterion);
@@ -92,7 +348,17 @@ int main(int argc, char** argv) {
       LOG(INFO) << "[Criterion] " << criterion->prettyString();
     }
     LOG(INFO) << "[Network] Number of params: " << numTotalParams(network);
+  });
 
+  // The flags of the emissions, then of the acoustic model, are applied in
+  // this order whichever is read first
+  emissionsRead.get();
+  amRead.get();
+  parsing = fl::cpp::make_unique<StartupPhase>("flags of the models");
+  if (!FLAGS_emission_dir.empty()) {
+    gflags::ReadFlagsFromString(emissionSet.gflags, gflags::GetArgv0(), true);
+  }
+  if (!FLAGS_am.empty()) {
     auto flags = cfg.find(kGflags);
     if (flags == cfg.end()) {
       LOG(FATAL) << "[Network] Invalid config loaded from " << FLAGS_am;
@@ -112,8 +378,17 @@ int main(int argc, char** argv) {
   // Only Copy any values from deprecated flags to new flags when deprecated
   // flags are present and corresponding new flags aren't
   w2l::handleDeprecatedFlags();
+  w2l::TaskScheduler::configure(FLAGS_cputhreads, FLAGS_pinthreads);
 
   LOG(INFO) << "Gflags after parsing \n" << serializeGflags("; ");
+  parsing.reset();
+
+  auto amQuantization = parseQuantizationType(FLAGS_amquantize);
+  if (network && amQuantization != QuantizationType::NONE) {
+    StartupPhase phase("AM quantization");
+    network = quantizeForInference(network, amQuantization);
+    LOG(INFO) << "[Network] Quantized " << network->prettyString();
+  }
 
   /* ===================== Create Dictionary ===================== */
   auto dictPath = pathsConcat(FLAGS_tokensdir, FLAGS_tokens);
@@ -132,6 +407,7 @@ int main(int argc, char** argv) {
   if (FLAGS_eostoken) {
     tokenDict.addEntry(kEosToken);
   }
+  tokenDict.freeze();
 
   int numClasses = tokenDict.indexSize();
   LOG(INFO) << "Number of classes (network): " << numClasses;
@@ -139,93 +415,511 @@ int main(int argc, char** argv) {
   Dictionary wordDict;
   LexiconMap lexicon;
   if (!FLAGS_lexicon.empty()) {
+    StartupPhase phase("lexicon load");
     lexicon = loadWords(FLAGS_lexicon, FLAGS_maxword);
     wordDict = createWordDict(lexicon);
+    wordDict.freeze();
     LOG(INFO) << "Number of words: " << wordDict.indexSize();
   }
 
   DictionaryMap dicts = {{kTargetIdx, tokenDict}, {kWordIdx, wordDict}};
 
-  /* ===================== Create Dataset ===================== */
-  if (FLAGS_emission_dir.empty()) {
-    // Load dataset
-    int worldRank = 0;
-    int worldSize = 1;
-    auto ds =
-        createDataset(FLAGS_test, dicts, lexicon, 1, worldRank, worldSize);
-
-    ds->shuffle(3);
-    LOG(INFO) << "[Serialization] Running forward pass ...";
-
-    int cnt = 0;
-    for (auto& sample : *ds) {
-      auto rawEmission =
-          network->forward({fl::input(sample[kInputIdx])}).front();
-      int N = rawEmission.dims(0);
-      int T = rawEmission.dims(1);
-
-      auto emission = afToVector<float>(rawEmission);
-      auto tokenTarget = afToVector<int>(sample[kTargetIdx]);
-      auto wordTarget = afToVector<int>(sample[kWordIdx]);
-
-      // TODO: we will reform the w2l dataset so that the loaded word targets
-      // are strings already
-      std::vector<std::string> wordTargetStr;
-      if (FLAGS_uselexicon) {
-        wordTargetStr = wrdIdx2Wrd(wordTarget, wordDict);
-      } else {
-        auto letterTarget = tknTarget2Ltr(tokenTarget, tokenDict);
-        wordTargetStr = tkn2Wrd(letterTarget);
+  /* ===================== Build LM & Trie ===================== */
+  // Prepare criterion
+  CriterionType criterionType = CriterionType::ASG;
+  if (FLAGS_criterion == kCtcCriterion) {
+    criterionType = CriterionType::CTC;
+  } else if (FLAGS_criterion == kSeq2SeqCriterion) {
+    criterionType = CriterionType::S2S;
+  } else if (FLAGS_criterion != kAsgCriterion) {
+    LOG(FATAL) << "[Decoder] Invalid model type: " << FLAGS_criterion;
+  }
+
+  // With a search graph, the LM is composed with the lexicon ahead of time
+  const bool useGraph = !FLAGS_search_graph.empty();
+  if (useGraph &&
+      (FLAGS_decodertype != "wrd" || criterionType == CriterionType::S2S)) {
+    LOG(FATAL) << "[Decoder] --search_graph requires --decodertype=wrd and "
+               << "the ASG or CTC criterion";
+  }
+
+  // Build Language Model
+  int unkWordIdx = -1;
+
+  Dictionary usrDict = tokenDict;
+  if (!FLAGS_lm.empty() && FLAGS_decodertype == "wrd") {
+    usrDict = wordDict;
+    unkWordIdx = wordDict.getIndex(kUnkToken);
+  }
+
+  ConvLMCacheType convLmCacheType = ConvLMCacheType::FP32;
+  if (FLAGS_lm_cache_precision == "fp16") {
+    convLmCacheType = ConvLMCacheType::FP16;
+  } else if (FLAGS_lm_cache_precision == "int8") {
+    convLmCacheType = ConvLMCacheType::INT8;
+  } else if (FLAGS_lm_cache_precision != "fp32") {
+    LOG(FATAL) << "[LM constructing] Invalid LM cache precision: "
+               << FLAGS_lm_cache_precision;
+  }
+
+  // With --decoder_numa, the decoder threads are bound to the NUMA nodes in
+  // turn and read the KenLM and the trie from their node, or interleaved
+  if (FLAGS_decoder_numa != "none" && FLAGS_decoder_numa != "replicate" &&
+      FLAGS_decoder_numa != "interleave") {
+    LOG(FATAL) << "[Decoder] Invalid NUMA placement: " << FLAGS_decoder_numa;
+  }
+  const bool numaReplicate = FLAGS_decoder_numa == "replicate";
+  const bool numaInterleave = FLAGS_decoder_numa == "interleave";
+  const auto numaNodeIds =
+      FLAGS_decoder_numa == "none" ? std::vector<int>{0} : numaNodes();
+  HugePages trieHugePages = HugePages::NONE;
+  if (FLAGS_decoder_hugepages == "transparent") {
+    trieHugePages = HugePages::TRANSPARENT;
+  } else if (FLAGS_decoder_hugepages == "explicit") {
+    trieHugePages = HugePages::EXPLICIT;
+  } else if (FLAGS_decoder_hugepages != "none") {
+    LOG(FATAL) << "[Decoder] Invalid huge pages: " << FLAGS_decoder_hugepages;
+  }
+
+  std::shared_ptr<LM> lm = std::make_shared<ZeroLM>();
+  // Tokens of the histories scored by the ConvLM, its receptive field
+  int convLmHistory = 49;
+  const bool replicateKenLm = numaReplicate && FLAGS_lmtype == "kenlm" &&
+      !FLAGS_lm.empty() && !useGraph;
+
+  auto lmBuilt = std::async(std::launch::async, [&]() {
+    if (FLAGS_lm.empty() || useGraph) {
+      return;
+    }
+    StartupPhase phase("LM load");
+    if (FLAGS_lmtype == "kenlm") {
+      KenLMLoadMethod loadMethod = KenLMLoadMethod::POPULATE;
+      if (FLAGS_lm_load_method == "lazy") {
+        loadMethod = KenLMLoadMethod::LAZY;
+      } else if (FLAGS_lm_load_method == "read") {
+        loadMethod = KenLMLoadMethod::READ;
+      } else if (FLAGS_lm_load_method != "populate") {
+        LOG(FATAL) << "[LM constructing] Invalid LM load method: "
+                   << FLAGS_lm_load_method;
+      }
+      // The pages of a mapped file are shared by all the NUMA nodes
+      if (replicateKenLm && loadMethod != KenLMLoadMethod::READ) {
+        LOG(INFO) << "[LM constructing] Reading the LM, to replicate it";
+        loadMethod = KenLMLoadMethod::READ;
+      }
+      // The copy of the first NUMA node, or interleaved over the nodes
+      std::unique_ptr<NumaNodeBinding> numaBinding;
+      std::unique_ptr<NumaInterleaving> numaInterleaving;
+      if (numaReplicate) {
+        numaBinding.reset(new NumaNodeBinding(numaNodeIds[0]));
+      } else if (numaInterleave) {
+        numaInterleaving.reset(new NumaInterleaving());
+      }
+      // One KenLM is shared by all the decoder threads (of a NUMA node)
+      lm = std::make_shared<KenLM>(
+          FLAGS_lm, usrDict, FLAGS_lm_cache_size, loadMethod);
+      if (!lm) {
+        LOG(FATAL) << "[LM constructing] Failed to load LM: " << FLAGS_lm;
+      }
+    } else if (FLAGS_lmtype == "convlm") {
+      af::setDevice(0);
+      LOG(INFO) << "[ConvLM]: Loading LM from " << FLAGS_lm;
+      std::shared_ptr<fl::Module> convLmModel;
+      W2lSerializer::load(FLAGS_lm, convLmModel);
+      convLmModel->eval();
+      convLmHistory = convLmHistorySize(convLmModel, convLmHistory);
+      LOG(INFO) << "[ConvLM]: History of " << convLmHistory << " tokens";
+
+      auto getConvLmScoreFunc = FLAGS_lm_incremental_cache > 0
+          ? buildIncrementalConvLmScoreFunction(
+                convLmModel, FLAGS_lm_incremental_cache)
+          : buildGetConvLmScoreFunction(convLmModel);
+      if (FLAGS_lm_async) {
+        // The forward may run on a worker thread: pin it to the LM's device
+        getConvLmScoreFunc = [getConvLmScoreFunc](
+                                 const std::vector<int>& inputs,
+                                 const std::vector<int>& lastTokenPositions,
+                                 int sampleSize,
+                                 int batchSize) {
+          af::setDevice(0);
+          return getConvLmScoreFunc(
+              inputs, lastTokenPositions, sampleSize, batchSize);
+        };
+      }
+      auto convLm = std::make_shared<ConvLM>(
+          getConvLmScoreFunc,
+          FLAGS_lm_vocab,
+          usrDict,
+          FLAGS_lm_memory,
+          FLAGS_beamsize,
+          convLmHistory,
+          FLAGS_lm_async,
+          convLmCacheType);
+      if (FLAGS_lm_shortlist > 0) {
+        auto getCandidateScoreFunc =
+            buildCandidateConvLmScoreFunction(convLmModel);
+        convLm->setCandidateScoring(
+            [getCandidateScoreFunc](
+                const std::vector<int>& inputs,
+                const std::vector<int>& lastTokenPositions,
+                const std::vector<std::vector<int>>& candidates,
+                int shortlistSize,
+                int sampleSize,
+                int batchSize) {
+              af::setDevice(0);
+              return getCandidateScoreFunc(
+                  inputs,
+                  lastTokenPositions,
+                  candidates,
+                  shortlistSize,
+                  sampleSize,
+                  batchSize);
+            },
+            FLAGS_lm_shortlist);
+      }
+      lm = convLm;
+    } else {
+      LOG(FATAL) << "[LM constructing] Invalid LM Type: " << FLAGS_lmtype;
+    }
+    LOG(INFO) << "[Decoder] LM constructed.\n";
+  });
+  auto lmReady = lmBuilt.share();
+
+  // Build Trie
+  int blankIdx =
+      FLAGS_criterion == kCtcCriterion ? tokenDict.getIndex(kBlankToken) : -1;
+  int silIdx = tokenDict.getIndex(FLAGS_wordseparator);
+  std::shared_ptr<Trie> trie = nullptr;
+  FlatTriePtr flatTrie = nullptr;
+  bool useLexicon = FLAGS_decodertype == "wrd" || FLAGS_uselexicon;
+  SearchGraphPtr searchGraph = nullptr;
+  // The trie, or with --search_graph the search graph, is compiled once for
+  // all the decoder threads
+  auto trieBuilt = std::async(std::launch::async, [&]() {
+    if (!useLexicon && !useGraph) {
+      return;
+    }
+    // The words are scored by the LM in the trie of the word decoders
+    if (FLAGS_decodertype == "wrd") {
+      lmReady.get();
+    }
+    StartupPhase phase("trie build");
+    std::string fingerprint;
+    if (useLexicon && criterionType != CriterionType::S2S &&
+        !FLAGS_trie.empty()) {
+      fingerprint = trieFingerprint(lexicon, tokenDict);
+    }
+    if (!fingerprint.empty() && fileExists(FLAGS_trie)) {
+      // A stale or corrupted file is built again
+      try {
+        auto savedTrie = FlatTrie::load(FLAGS_trie);
+        if (savedTrie->fingerprint() == fingerprint) {
+          flatTrie = savedTrie;
+          LOG(INFO) << "[Decoder] Trie loaded from " << FLAGS_trie << " with "
+                    << flatTrie->nNodes() << " nodes.\n";
+        } else {
+          LOG(INFO) << "[Decoder] Trie in " << FLAGS_trie
+                    << " built from another lexicon, tokens, smearing or LM";
+        }
+      } catch (const std::exception& ex) {
+        LOG(WARNING) << "[Decoder] Cannot load the trie: " << ex.what();
+      }
+    }
+    if (!flatTrie && useLexicon && !useGraph) {
+      trie = std::make_shared<Trie>(tokenDict.indexSize(), silIdx);
+      LMStatePtr startState;
+      if (FLAGS_decodertype == "wrd") {
+        startState = lm->start(false);
       }
 
-      emissionSet.emissions.emplace_back(emission);
-      emissionSet.wordTargets.emplace_back(wordTargetStr);
-      emissionSet.tokenTargets.emplace_back(tokenTarget);
-      emissionSet.emissionT.emplace_back(T);
-      emissionSet.emissionN = N;
+      // Map the spellings in parallel, the dictionaries being frozen, and
+      // plant them in the order of the words
+      std::vector<const LexiconMap::value_type*> words;
+      words.reserve(lexicon.size());
+      for (const auto& it : lexicon) {
+        words.push_back(&it);
+      }
+      std::vector<std::vector<std::vector<int>>> spellings(words.size());
+#pragma omp parallel for schedule(dynamic, 1024)
+      for (int64_t i = 0; i < words.size(); ++i) {
+        for (const auto& tokens : words[i]->second) {
+          spellings[i].push_back(tkn2Idx(tokens, tokenDict, FLAGS_replabel));
+        }
+      }
+      for (size_t i = 0; i < words.size(); ++i) {
+        int usrIdx = wordDict.getIndex(words[i]->first);
+        float score = -1;
+        if (FLAGS_decodertype == "wrd") {
+          LMStatePtr dummyState;
+          std::tie(dummyState, score) = lm->score(startState, usrIdx);
+        }
+        for (const auto& tokensTensor : spellings[i]) {
+          trie->insert(tokensTensor, usrIdx, score);
+        }
+      }
+      LOG(INFO) << "[Decoder] Trie planted.\n";
 
-      // while decoding we use batchsize 1 and hence ds only has 1 sampleid
-      emissionSet.sampleIds.emplace_back(
-          readSampleIds(sample[kSampleIdx]).front());
+      // Smearing
+      SmearingMode smear_mode = SmearingMode::NONE;
+      if (FLAGS_smearing == "logadd") {
+        smear_mode = SmearingMode::LOGADD;
+      } else if (FLAGS_smearing == "max") {
+        smear_mode = SmearingMode::MAX;
+      } else if (FLAGS_smearing != "none") {
+        LOG(FATAL) << "[Decoder] Invalid smearing mode: " << FLAGS_smearing;
+      }
+      trie->smear(smear_mode);
+      LOG(INFO) << "[Decoder] Trie smeared.\n";
 
-      ++cnt;
-      if (cnt == FLAGS_maxload) {
-        break;
+      // Compile the trie once for all the lexicon decoder threads
+      if (criterionType != CriterionType::S2S) {
+        flatTrie = std::make_shared<FlatTrie>(*trie);
+        LOG(INFO) << "[Decoder] Trie compiled with " << flatTrie->nNodes()
+                  << " nodes.\n";
+        if (!FLAGS_trie.empty()) {
+          flatTrie->save(FLAGS_trie, fingerprint);
+          LOG(INFO) << "[Decoder] Trie saved to " << FLAGS_trie;
+        }
       }
     }
+
+    if (useGraph && fileExists(FLAGS_search_graph)) {
+      searchGraph = SearchGraph::load(FLAGS_search_graph);
+      LOG(INFO) << "[Decoder] Search graph loaded from " << FLAGS_search_graph
+                << " with " << searchGraph->nNodes() << " nodes.\n";
+    } else if (useGraph) {
+      std::vector<std::string> words(wordDict.indexSize());
+      std::vector<std::vector<std::vector<int>>> spellings(
+          wordDict.indexSize());
+      for (const auto& it : lexicon) {
+        int usrIdx = wordDict.getIndex(it.first);
+        words[usrIdx] = it.first;
+        for (const auto& tokens : it.second) {
+          spellings[usrIdx].push_back(
+              tkn2Idx(tokens, tokenDict, FLAGS_replabel));
+        }
+      }
+      searchGraph = SearchGraph::compile(FLAGS_lm, words, spellings);
+      LOG(INFO) << "[Decoder] Search graph compiled with "
+                << searchGraph->nNodes() << " nodes, " << searchGraph->nArcs()
+                << " arcs and " << searchGraph->nRoots() << " LM contexts.\n";
+      searchGraph->save(FLAGS_search_graph);
+      LOG(INFO) << "[Decoder] Search graph saved to " << FLAGS_search_graph;
+    }
+  });
+
+  /* ===================== Create Dataset ===================== */
+  // Emissions are either read from the emission set or computed by
+  // `nthread_am` acoustic model workers, one per GPU, each forwarding its own
+  // shard of the dataset. Both stream through a bounded queue to the decoder
+  // threads, so decoding starts with the first forwarded sample.
+  int nSample = 0;
+  std::vector<std::shared_ptr<W2lDataset>> amDatasets;
+  if (FLAGS_emission_dir.empty()) {
+    if (FLAGS_nthread_am < 1 || FLAGS_nthread_am > af::getDeviceCount()) {
+      LOG(FATAL) << "FLAGS_nthread_am should be between 1 and the number of "
+                 << "visible GPUs";
+    }
+    // Batches of samples of similar durations with --am_batchframes, or single
+    // samples. The packing flag of the training doesn't apply.
+    FLAGS_batchframes = FLAGS_am_batchframes;
+    if (FLAGS_am_chunk_ms > 0 && FLAGS_am_batchframes > 0) {
+      LOG(FATAL) << "--am_chunk_ms forwards the samples one at a time, it "
+                 << "can't be used with --am_batchframes";
+    }
+    StartupPhase phase("dataset index");
+    for (int i = 0; i < FLAGS_nthread_am; i++) {
+      auto ds =
+          createDataset(FLAGS_test, dicts, lexicon, 1, i, FLAGS_nthread_am);
+      ds->shuffle(3);
+      nSample += ds->numSamples();
+      amDatasets.push_back(ds);
+    }
     if (FLAGS_criterion == kAsgCriterion) {
       emissionSet.transition = afToVector<float>(criterion->param(0).array());
     }
+  } else {
+    nSample = emissionSet.emissionT.size();
   }
-
-  int nSample = emissionSet.emissions.size();
   nSample = FLAGS_maxload > 0 ? std::min(nSample, FLAGS_maxload) : nSample;
-  int nSamplePerThread =
-      std::ceil(nSample / static_cast<float>(FLAGS_nthread_decoder));
-  LOG(INFO) << "[Dataset] Number of samples per thread: " << nSamplePerThread;
-
-  network.reset(); // AM is only used in running forward pass. So we will free
-                   // the space of it on GPU or memory. network.use_count() will
-                   // be 0 after this call.
-  af::deviceGC();
+  LOG(INFO) << "[Dataset] Number of samples: " << nSample;
+
+  BlockingQueue<EmissionSample> emissionQueue(FLAGS_emission_queue_size);
+  if (FLAGS_emission_topk > 0 && FLAGS_criterion == kSeq2SeqCriterion) {
+    LOG(FATAL) << "--emission_topk is not supported by seq2seq decoders";
+  }
+  // Kept in the sparse emissions for the blank transitions of CTC
+  const int emissionBlank =
+      FLAGS_criterion == kCtcCriterion ? tokenDict.getIndex(kBlankToken) : -1;
+  std::atomic<int> nRunningProducers(0);
+  std::atomic<int> nQueuedSamples(0);
+
+  auto runAm = [&](int wid) {
+    af::setDevice(wid);
+    std::shared_ptr<fl::Module> localNetwork = network;
+    if (wid != 0) {
+      std::shared_ptr<SequenceCriterion> dummyCriterion;
+      std::unordered_map<std::string, std::string> dummyCfg;
+      W2lSerializer::load(FLAGS_am, dummyCfg, localNetwork, dummyCriterion);
+      localNetwork = quantizeForInference(localNetwork, amQuantization);
+      localNetwork->eval();
+    }
+    if (wid == 0) {
+      LOG(INFO) << "[Serialization] Running forward pass ...";
+    }
+
+    auto& ds = amDatasets[wid];
+    int tokenPadIdx =
+        FLAGS_eostoken ? tokenDict.getIndex(kEosToken) : kTargetPadValue;
+    bool stop = false;
+    for (int64_t idx = 0; idx < ds->size() && !stop; ++idx) {
+      auto batch = ds->get(idx);
+      auto batchEmission = chunkedForward(
+          *localNetwork,
+          batch[kInputIdx],
+          msToInputFrames(FLAGS_am_chunk_ms),
+          msToInputFrames(FLAGS_am_chunk_overlap_ms),
+          FLAGS_am_chunk_batch);
+      auto durations = ds->getSampleDurations(idx);
+      auto rawEmissions = unpadEmissions(batchEmission, durations);
+      auto tokenTargets = readBatchTargets(batch[kTargetIdx], tokenPadIdx);
+      auto wordTargets = readBatchTargets(batch[kWordIdx]);
+      auto sampleIds = readSampleIds(batch[kSampleIdx]);
+      // Features have one frame per stride, raw audio one per sample
+      auto inputFrames = batch[kInputIdx].dims(0);
+      double batchDuration = (FLAGS_pow || FLAGS_mfsc || FLAGS_mfcc)
+          ? inputFrames * FLAGS_framestridems / 1000.0
+          : static_cast<double>(inputFrames) / FLAGS_samplerate;
+      double maxDuration = durations.empty()
+          ? 0
+          : *std::max_element(durations.begin(), durations.end());
+
+      for (int b = 0; b < rawEmissions.size(); ++b) {
+        if (nQueuedSamples++ >= nSample) {
+          stop = true;
+          break;
+        }
+        const auto& rawEmission = rawEmissions[b];
+        EmissionSample emission;
+        emission.N = rawEmission.dims(0);
+        emission.T = rawEmission.dims(1);
+        emission.duration = maxDuration > 0
+            ? batchDuration * durations[b] / maxDuration
+            : batchDuration;
+        if (FLAGS_emission_topk > 0) {
+          emission.sparseEmission =
+              topkEmissions(rawEmission, FLAGS_emission_topk, emissionBlank);
+        } else {
+          emission.emission = afToVector<float>(rawEmission);
+        }
+        emission.tokenTarget = std::move(tokenTargets[b]);
+        auto& wordTarget = wordTargets[b];
+
+        // TODO: we will reform the w2l dataset so that the loaded word targets
+        // are strings already
+        auto letterTarget = tknTarget2Ltr(emission.tokenTarget, tokenDict);
+        if (FLAGS_uselexicon) {
+          // The word targets of a batch are padded with <unk>: a target has
+          // as many words as its tokens
+          if (rawEmissions.size() > 1) {
+            wordTarget.resize(
+                std::min(wordTarget.size(), tkn2Wrd(letterTarget).size()));
+          }
+          emission.wordTarget = wrdIdx2Wrd(wordTarget, wordDict);
+        } else {
+          emission.wordTarget = tkn2Wrd(letterTarget);
+        }
+        emission.sampleId = std::move(sampleIds[b]);
+
+        if (!emissionQueue.push(std::move(emission))) {
+          stop = true;
+          break;
+        }
+      }
+    }
+
+    // AM is only used in running forward pass. So we will free the space of
+    // it on GPU or memory.
+    localNetwork.reset();
+    if (wid == 0) {
+      network.reset();
+    }
+    af::deviceGC();
+  };
+
+  auto readEmissions = [&]() {
+    // Hand out the longest emissions first: decoding time grows with T, so
+    // the short ones left at the end even out the finishing times of threads
+    std::vector<int> order(nSample);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+      return emissionSet.emissionT[a] > emissionSet.emissionT[b];
+    });
+    for (int s : order) {
+      EmissionSample emission;
+      bool sparse = FLAGS_emission_topk > 0;
+      // Decoded as stored, without a full-precision copy
+      bool asStored = emissionFile && sparse == (emissionFile->topK() > 0);
+      if (asStored) {
+        if (sparse) {
+          emission.sparseEmission = emissionFile->sparseEmission(s);
+        } else {
+          emission.halfEmission = emissionFile->halfEmission(s);
+        }
+      } else {
+        emission.emission = emissionFile
+            ? emissionFile->emission(s)
+            : std::move(emissionSet.emissions[s]);
+      }
+      emission.wordTarget = std::move(emissionSet.wordTargets[s]);
+      emission.tokenTarget = std::move(emissionSet.tokenTargets[s]);
+      emission.sampleId = std::move(emissionSet.sampleIds[s]);
+      emission.T = emissionSet.emissionT[s];
+      emission.N = emissionSet.emissionN;
+      emission.duration = emission.T * FLAGS_emission_frame_ms / 1000;
+      if (sparse && !asStored) {
+        emission.sparseEmission = sparsifyEmissions(
+            emission.emission.data(),
+            emission.T,
+            emission.N,
+            FLAGS_emission_topk,
+            emissionBlank);
+        emission.emission = std::vector<float>();
+      }
+      if (!emissionQueue.push(std::move(emission))) {
+        break;
+      }
+    }
+  };
+
+  auto runProducer = [&](int wid) {
+    try {
+      if (amDatasets.empty()) {
+        readEmissions();
+      } else {
+        runAm(wid);
+      }
+    } catch (const std::exception& exc) {
+      LOG(FATAL) << "Exception in emission producer " << wid << "\n"
+                 << exc.what();
+    }
+    // The last producer lets the decoder threads drain the queue and stop
+    if (--nRunningProducers == 0) {
+      emissionQueue.close();
+    }
+  };
+
   /* ===================== Decode ===================== */
   // Prepare counters
-  std::vector<double> sliceWer(FLAGS_nthread_decoder);
-  std::vector<double> sliceLer(FLAGS_nthread_decoder);
-  std::vector<int> sliceNumWords(FLAGS_nthread_decoder, 0);
-  std::vector<int> sliceNumTokens(FLAGS_nthread_decoder, 0);
+  std::vector<ErrorRateMeter> sliceWer(FLAGS_nthread_decoder);
+  std::vector<ErrorRateMeter> sliceLer(FLAGS_nthread_decoder);
   std::vector<int> sliceNumSamples(FLAGS_nthread_decoder, 0);
   std::vector<double> sliceTime(FLAGS_nthread_decoder, 0);
-
-  // Prepare criterion
-  CriterionType criterionType = CriterionType::ASG;
-  if (FLAGS_criterion == kCtcCriterion) {
-    criterionType = CriterionType::CTC;
-  } else if (FLAGS_criterion == kSeq2SeqCriterion) {
-    criterionType = CriterionType::S2S;
-  } else if (FLAGS_criterion != kAsgCriterion) {
-    LOG(FATAL) << "[Decoder] Invalid model type: " << FLAGS_criterion;
-  }
+  // Per sample, with --decoder_stats
+  std::vector<std::vector<double>> sliceLatency(FLAGS_nthread_decoder);
+  std::vector<std::vector<double>> sliceRtf(FLAGS_nthread_decoder);
+  std::vector<DecoderStats> sliceStats(FLAGS_nthread_decoder);
+  std::atomic<int> nDecodedSamples(0);
 
   const auto& transition = emissionSet.transition;
 
@@ -241,6 +935,27 @@ int main(int argc, char** argv) {
       static_cast<float>(FLAGS_eosscore),
       FLAGS_logadd,
       criterionType);
+  decoderOpt.targetCandidates = FLAGS_beamtargetcandidates;
+  decoderOpt.stepTimeBudget = static_cast<float>(FLAGS_beamtimebudget);
+  decoderOpt.blankSkipThreshold = static_cast<float>(FLAGS_blankskipthreshold);
+  decoderOpt.lmLookaheadWords = FLAGS_lm_lookahead_words;
+  decoderOpt.lmLookaheadCacheSize = FLAGS_lm_lookahead_cache;
+  decoderOpt.expandThreads = FLAGS_decoder_expand_threads;
+  if (FLAGS_s2s_early_stopping == "bound") {
+    decoderOpt.earlyStopping = EarlyStopping::BOUND;
+  } else if (FLAGS_s2s_early_stopping == "heuristic") {
+    decoderOpt.earlyStopping = EarlyStopping::HEURISTIC;
+  } else if (FLAGS_s2s_early_stopping != "none") {
+    LOG(FATAL) << "[Decoder] Invalid early stopping: "
+               << FLAGS_s2s_early_stopping;
+  }
+  decoderOpt.lengthNormalization =
+      static_cast<float>(FLAGS_s2s_length_normalization);
+
+  // With --sweep_*, the emissions are kept and decoded with each option set
+  auto sweepOpts = sweepDecoderOptions(decoderOpt);
+  const bool sweep = !sweepOpts.empty();
+  std::vector<EmissionSample> sweepSamples;
 
   // Prepare log writer
   std::mutex hypMutex, refMutex, logMutex;
@@ -277,93 +992,206 @@ int main(int argc, char** argv) {
     logStream << logStr;
   };
 
-  // Build Language Model
-  int unkWordIdx = -1;
+  // Rethrows the errors of the LM and the trie
+  lmReady.get();
+  trieBuilt.get();
 
-  Dictionary usrDict = tokenDict;
-  if (!FLAGS_lm.empty() && FLAGS_decodertype == "wrd") {
-    usrDict = wordDict;
-    unkWordIdx = wordDict.getIndex(kUnkToken);
+  // The copies of the KenLM and of the trie read by the decoder threads of
+  // each NUMA node. Each copy is made by a thread bound to its node, or
+  // interleaving its pages, so that they are allocated there.
+  std::vector<std::shared_ptr<LM>> nodeLms(numaNodeIds.size(), lm);
+  std::vector<FlatTriePtr> nodeTries(numaNodeIds.size(), flatTrie);
+  if (flatTrie && (numaReplicate || numaInterleave ||
+                   trieHugePages != HugePages::NONE)) {
+    StartupPhase phase("NUMA placement");
+    size_t nCopies = numaReplicate ? numaNodeIds.size() : 1;
+    for (size_t i = 0; i < nCopies; ++i) {
+      std::async(std::launch::async, [&, i]() {
+        std::unique_ptr<NumaNodeBinding> numaBinding;
+        std::unique_ptr<NumaInterleaving> numaInterleaving;
+        if (numaReplicate) {
+          numaBinding.reset(new NumaNodeBinding(numaNodeIds[i]));
+        } else if (numaInterleave) {
+          numaInterleaving.reset(new NumaInterleaving());
+        }
+        nodeTries[i] = flatTrie->clone(trieHugePages);
+      }).get();
+    }
+    for (size_t i = nCopies; i < numaNodeIds.size(); ++i) {
+      nodeTries[i] = nodeTries[0];
+    }
+    flatTrie = nodeTries[0];
   }
-
-  std::shared_ptr<LM> lm = std::make_shared<ZeroLM>();
-  if (!FLAGS_lm.empty()) {
-    if (FLAGS_lmtype == "kenlm") {
-      lm = std::make_shared<KenLM>(FLAGS_lm, usrDict);
-      if (!lm) {
-        LOG(FATAL) << "[LM constructing] Failed to load LM: " << FLAGS_lm;
-      }
-    } else if (FLAGS_lmtype == "convlm") {
-      af::setDevice(0);
-      LOG(INFO) << "[ConvLM]: Loading LM from " << FLAGS_lm;
-      std::shared_ptr<fl::Module> convLmModel;
-      W2lSerializer::load(FLAGS_lm, convLmModel);
-      convLmModel->eval();
-
-      auto getConvLmScoreFunc = buildGetConvLmScoreFunction(convLmModel);
-      lm = std::make_shared<ConvLM>(
-          getConvLmScoreFunc,
-          FLAGS_lm_vocab,
-          usrDict,
-          FLAGS_lm_memory,
-          FLAGS_beamsize);
-    } else {
-      LOG(FATAL) << "[LM constructing] Invalid LM Type: " << FLAGS_lmtype;
+  if (replicateKenLm) {
+    StartupPhase phase("LM replication");
+    for (size_t i = 1; i < numaNodeIds.size(); ++i) {
+      std::async(std::launch::async, [&, i]() {
+        NumaNodeBinding numaBinding(numaNodeIds[i]);
+        nodeLms[i] = std::make_shared<KenLM>(
+            FLAGS_lm,
+            usrDict,
+            FLAGS_lm_cache_size,
+            KenLMLoadMethod::READ,
+            i /* replica */);
+      }).get();
     }
   }
-  LOG(INFO) << "[Decoder] LM constructed.\n";
 
-  // Build Trie
-  int blankIdx =
-      FLAGS_criterion == kCtcCriterion ? tokenDict.getIndex(kBlankToken) : -1;
-  int silIdx = tokenDict.getIndex(FLAGS_wordseparator);
-  std::shared_ptr<Trie> trie = nullptr;
-  if (FLAGS_decodertype == "wrd" || FLAGS_uselexicon) {
-    trie = std::make_shared<Trie>(tokenDict.indexSize(), silIdx);
-    auto startState = lm->start(false);
-
-    for (auto& it : lexicon) {
-      const std::string& word = it.first;
-      int usrIdx = wordDict.getIndex(word);
-      float score = -1;
-      if (FLAGS_decodertype == "wrd") {
-        LMStatePtr dummyState;
-        std::tie(dummyState, score) = lm->score(startState, usrIdx);
+  // Phrases boosted by the lexicon decoders, one per line after their bonus
+  std::shared_ptr<BiasingTrie> biasing = nullptr;
+  if (!FLAGS_bias_phrases.empty() && FLAGS_decodertype == "wrd" &&
+      criterionType != CriterionType::S2S && !useGraph) {
+    biasing = std::make_shared<BiasingTrie>();
+    std::ifstream phrasesStream(FLAGS_bias_phrases);
+    if (!phrasesStream) {
+      LOG(FATAL) << "[Decoder] Cannot read " << FLAGS_bias_phrases;
+    }
+    std::string line;
+    int nPhrases = 0;
+    while (std::getline(phrasesStream, line)) {
+      auto fields = splitOnWhitespace(line, true);
+      if (fields.size() < 2) {
+        continue;
       }
-      for (auto& tokens : it.second) {
-        auto tokensTensor = tkn2Idx(tokens, tokenDict, FLAGS_replabel);
-        trie->insert(tokensTensor, usrIdx, score);
+      std::vector<int> phrase;
+      for (int i = 1; i < fields.size(); i++) {
+        if (!wordDict.contains(fields[i])) {
+          LOG(WARNING) << "[Decoder] Phrase skipped, not in the lexicon: "
+                       << line;
+          phrase.clear();
+          break;
+        }
+        phrase.push_back(wordDict.getIndex(fields[i]));
+      }
+      if (!phrase.empty()) {
+        biasing->insert(phrase, std::stof(fields[0]));
+        ++nPhrases;
       }
     }
-    LOG(INFO) << "[Decoder] Trie planted.\n";
+    LOG(INFO) << "[Decoder] " << nPhrases << " phrases boosted from "
+              << FLAGS_bias_phrases;
+  }
 
-    // Smearing
-    SmearingMode smear_mode = SmearingMode::NONE;
-    if (FLAGS_smearing == "logadd") {
-      smear_mode = SmearingMode::LOGADD;
-    } else if (FLAGS_smearing == "max") {
-      smear_mode = SmearingMode::MAX;
-    } else if (FLAGS_smearing != "none") {
-      LOG(FATAL) << "[Decoder] Invalid smearing mode: " << FLAGS_smearing;
+  // Letters and words of a hypothesis
+  auto readPrediction = [&](const DecodeResult& result,
+                            std::vector<std::string>& letterPrediction,
+                            std::vector<std::string>& wordPrediction) {
+    letterPrediction = tknPrediction2Ltr(result.tokens, tokenDict);
+    if (FLAGS_uselexicon) {
+      wordPrediction = wrdIdx2Wrd(
+          validateIdx(result.words, wordDict.getIndex(kUnkToken)), wordDict);
+    } else {
+      wordPrediction = tkn2Wrd(letterPrediction);
     }
-    trie->smear(smear_mode);
-    LOG(INFO) << "[Decoder] Trie smeared.\n";
-  }
+  };
+
+  /*
+   * Sweep: the configurations are decoded in rounds of successive halving.
+   * Round r decodes the samples [sweepBegin, sweepEnd) with each of the
+   * configurations still in the sweep, whose WER accumulate over the rounds,
+   * then the worst half of the configurations is eliminated. The samples of a
+   * round double those of the previous one, the last round decoding them all.
+   */
+  const int nSweepRounds = std::max(FLAGS_sweep_halving, 1);
+  auto sweepRoundEnd = [&](int round) {
+    int64_t shift = std::min(nSweepRounds - 1 - round, 62);
+    return std::max<int64_t>(
+        1, (static_cast<int64_t>(sweepSamples.size()) + (1LL << shift) - 1) >>
+            shift);
+  };
+  std::vector<ErrorRateMeter> sweepWer(sweepOpts.size());
+  std::vector<int> sweepConfigs(sweepOpts.size());
+  std::iota(sweepConfigs.begin(), sweepConfigs.end(), 0);
+  std::mutex sweepMutex;
+  std::condition_variable sweepCv;
+  int sweepRound = 0, nSweepWaiting = 0;
+  int64_t sweepBegin = 0, sweepEnd = 0;
+  std::atomic<int64_t> sweepNext(0);
+
+  auto endSweepRound = [&](int round) {
+    std::stable_sort(
+        sweepConfigs.begin(), sweepConfigs.end(), [&](int a, int b) {
+          return sweepWer[a].value() < sweepWer[b].value();
+        });
+    std::stringstream buffer;
+    buffer << "[Sweep] Round " << round + 1 << "/" << nSweepRounds << " on "
+           << sweepEnd << " samples:\n";
+    for (int c : sweepConfigs) {
+      const auto& opt = sweepOpts[c];
+      buffer << "  lmweight: " << opt.lmWeight
+             << ", wordscore: " << opt.wordScore
+             << ", silscore: " << opt.silScore
+             << ", beamthreshold: " << opt.beamThreshold
+             << " -- WER: " << sweepWer[c].value() << "\n";
+    }
+    LOG(INFO) << buffer.str();
+    if (!FLAGS_sclite.empty()) {
+      writeLog(buffer.str());
+    }
+    if (round + 1 < nSweepRounds) {
+      sweepConfigs.resize((sweepConfigs.size() + 1) / 2);
+      sweepBegin = sweepEnd;
+      sweepEnd = sweepRoundEnd(round + 1);
+      sweepNext = 0;
+    }
+  };
+
+  // Decoding thread of the sweep, sharing the rounds with the other threads
+  auto runSweep =
+      [&](const std::function<std::unique_ptr<Decoder>(const DecoderOptions&)>&
+              makeDecoder) {
+        std::unique_ptr<Decoder> decoder;
+        int decoderConfig = -1;
+        std::vector<std::string> letterPrediction, wordPrediction;
+        for (int round = 0; round < nSweepRounds; round++) {
+          // (configuration, sample) pairs, the threads sharing configurations
+          const int64_t nSamples = sweepEnd - sweepBegin;
+          const int64_t nItems = nSamples * sweepConfigs.size();
+          for (int64_t i = sweepNext++; i < nItems; i = sweepNext++) {
+            int config = sweepConfigs[i / nSamples];
+            const auto& sample = sweepSamples[sweepBegin + i % nSamples];
+            if (config != decoderConfig) {
+              decoder = makeDecoder(sweepOpts[config]);
+              decoderConfig = config;
+            }
+            auto results = decodeSample(*decoder, sample);
+            readPrediction(results[0], letterPrediction, wordPrediction);
+            std::lock_guard<std::mutex> lock(sweepMutex);
+            sweepWer[config].add(wordPrediction, sample.wordTarget);
+          }
+
+          // The last thread done with the round ends it
+          std::unique_lock<std::mutex> lock(sweepMutex);
+          if (++nSweepWaiting == FLAGS_nthread_decoder) {
+            endSweepRound(round);
+            nSweepWaiting = 0;
+            ++sweepRound;
+            sweepCv.notify_all();
+          } else {
+            sweepCv.wait(lock, [&]() { return sweepRound > round; });
+          }
+        }
+      };
 
   // Decoding
-  auto runDecoder = [&](int tid, int start, int end) {
+  auto runDecoder = [&](int tid) {
     try {
-      // Note: These 2 GPU-dependent models should be placed on different cards
-      // for different threads and nthread_decoder should not be greater than
-      // the number of GPUs.
+      // With --decoder_numa, the thread is bound to a NUMA node in turn and
+      // reads the copies of the KenLM and of the trie of the node
+      int numaNode = tid % numaNodeIds.size();
+      std::unique_ptr<NumaNodeBinding> numaBinding;
+      if (numaReplicate || numaInterleave) {
+        numaBinding.reset(new NumaNodeBinding(numaNodeIds[numaNode]));
+      }
+      FlatTriePtr localTrie = nodeTries[numaNode];
+
+      // Note: These 2 GPU-dependent models are copied for each thread, the
+      // threads being spread round-robin over the visible GPUs.
       std::shared_ptr<SequenceCriterion> localCriterion = criterion;
-      std::shared_ptr<LM> localLm = lm;
+      std::shared_ptr<LM> localLm = nodeLms[numaNode];
+      int device = tid % af::getDeviceCount();
       if (FLAGS_lmtype == "convlm" || criterionType == CriterionType::S2S) {
-        if (tid >= af::getDeviceCount()) {
-          LOG(FATAL)
-              << "FLAGS_nthread_decoder exceeds the number of visible GPUs";
-        }
-        af::setDevice(tid);
+        af::setDevice(device);
       }
 
       // Make a copy for non-main threads.
@@ -374,13 +1202,53 @@ int main(int argc, char** argv) {
           W2lSerializer::load(FLAGS_lm, convLmModel);
           convLmModel->eval();
 
-          auto getConvLmScoreFunc = buildGetConvLmScoreFunction(convLmModel);
-          localLm = std::make_shared<ConvLM>(
+          auto getConvLmScoreFunc = FLAGS_lm_incremental_cache > 0
+              ? buildIncrementalConvLmScoreFunction(
+                    convLmModel, FLAGS_lm_incremental_cache)
+              : buildGetConvLmScoreFunction(convLmModel);
+          if (FLAGS_lm_async) {
+            getConvLmScoreFunc = [getConvLmScoreFunc, device](
+                                     const std::vector<int>& inputs,
+                                     const std::vector<int>& lastTokenPositions,
+                                     int sampleSize,
+                                     int batchSize) {
+              af::setDevice(device);
+              return getConvLmScoreFunc(
+                  inputs, lastTokenPositions, sampleSize, batchSize);
+            };
+          }
+          auto convLm = std::make_shared<ConvLM>(
               getConvLmScoreFunc,
               FLAGS_lm_vocab,
               usrDict,
               FLAGS_lm_memory,
-              FLAGS_beamsize);
+              FLAGS_beamsize,
+              convLmHistory,
+              FLAGS_lm_async,
+              convLmCacheType);
+          if (FLAGS_lm_shortlist > 0) {
+            auto getCandidateScoreFunc =
+                buildCandidateConvLmScoreFunction(convLmModel);
+            convLm->setCandidateScoring(
+                [getCandidateScoreFunc, device](
+                    const std::vector<int>& inputs,
+                    const std::vector<int>& lastTokenPositions,
+                    const std::vector<std::vector<int>>& candidates,
+                    int shortlistSize,
+                    int sampleSize,
+                    int batchSize) {
+                  af::setDevice(device);
+                  return getCandidateScoreFunc(
+                      inputs,
+                      lastTokenPositions,
+                      candidates,
+                      shortlistSize,
+                      sampleSize,
+                      batchSize);
+                },
+                FLAGS_lm_shortlist);
+          }
+          localLm = convLm;
         }
 
         if (criterionType == CriterionType::S2S) {
@@ -392,120 +1260,151 @@ int main(int argc, char** argv) {
       }
 
       // Build Decoder
-      std::unique_ptr<Decoder> decoder;
-      if (criterionType == CriterionType::S2S) {
-        auto amUpdateFunc = buildAmUpdateFunction(localCriterion);
-        int eosIdx = tokenDict.getIndex(kEosToken);
+      auto makeDecoder = [&](const DecoderOptions& opt) {
+        std::unique_ptr<Decoder> decoder;
+        if (criterionType == CriterionType::S2S) {
+          auto amUpdateFunc = buildAmUpdateFunction(localCriterion);
+          int eosIdx = tokenDict.getIndex(kEosToken);
 
-        if (FLAGS_decodertype == "wrd") {
-          decoder.reset(new LexiconSeq2SeqDecoder(
-              decoderOpt,
-              trie,
-              localLm,
-              eosIdx,
-              amUpdateFunc,
-              FLAGS_maxdecoderoutputlen,
-              false));
-          LOG(INFO)
-              << "[Decoder] LexiconSeq2Seq decoder with word-LM loaded in thread: "
-              << tid;
-        } else if (FLAGS_decodertype == "tkn") {
-          if (FLAGS_uselexicon) {
+          if (FLAGS_decodertype == "wrd") {
             decoder.reset(new LexiconSeq2SeqDecoder(
-                decoderOpt,
+                opt,
                 trie,
                 localLm,
                 eosIdx,
                 amUpdateFunc,
                 FLAGS_maxdecoderoutputlen,
-                true));
-            LOG(INFO)
-                << "[Decoder] LexiconSeq2Seq decoder with token-LM loaded in thread: "
+                false));
+            LOG_IF(INFO, !sweep)
+                << "[Decoder] LexiconSeq2Seq decoder with word-LM loaded in thread: "
                 << tid;
+          } else if (FLAGS_decodertype == "tkn") {
+            if (FLAGS_uselexicon) {
+              decoder.reset(new LexiconSeq2SeqDecoder(
+                  opt,
+                  trie,
+                  localLm,
+                  eosIdx,
+                  amUpdateFunc,
+                  FLAGS_maxdecoderoutputlen,
+                  true));
+              LOG_IF(INFO, !sweep)
+                  << "[Decoder] LexiconSeq2Seq decoder with token-LM loaded in thread: "
+                  << tid;
+            } else {
+              decoder.reset(new LexiconFreeSeq2SeqDecoder(
+                  opt,
+                  localLm,
+                  eosIdx,
+                  amUpdateFunc,
+                  FLAGS_maxdecoderoutputlen));
+              LOG_IF(INFO, !sweep)
+                  << "[Decoder] LexiconFreeSeq2Seq decoder with token-LM loaded in thread: "
+                  << tid;
+            }
           } else {
-            decoder.reset(new LexiconFreeSeq2SeqDecoder(
-                decoderOpt,
-                localLm,
-                eosIdx,
-                amUpdateFunc,
-                FLAGS_maxdecoderoutputlen));
-            LOG(INFO)
-                << "[Decoder] LexiconFreeSeq2Seq decoder with token-LM loaded in thread: "
-                << tid;
+            LOG(FATAL) << "Unsupported decoder type: " << FLAGS_decodertype;
           }
         } else {
-          LOG(FATAL) << "Unsupported decoder type: " << FLAGS_decodertype;
-        }
-      } else {
-        if (FLAGS_decodertype == "wrd") {
-          decoder.reset(new LexiconDecoder(
-              decoderOpt,
-              trie,
-              localLm,
-              silIdx,
-              blankIdx,
-              unkWordIdx,
-              transition,
-              false));
-          LOG(INFO)
-              << "[Decoder] Lexicon decoder with word-LM loaded in thread: "
-              << tid;
-        } else if (FLAGS_decodertype == "tkn") {
-          if (FLAGS_uselexicon) {
-            decoder.reset(new LexiconDecoder(
-                decoderOpt,
-                trie,
+          if (FLAGS_decodertype == "wrd" && searchGraph) {
+            decoder.reset(new GraphDecoder(
+                opt, searchGraph, silIdx, blankIdx, transition));
+            LOG_IF(INFO, !sweep)
+                << "[Decoder] Graph decoder loaded in thread: " << tid;
+          } else if (FLAGS_decodertype == "wrd") {
+            auto lexiconDecoder = new LexiconDecoder(
+                opt,
+                localTrie,
                 localLm,
                 silIdx,
                 blankIdx,
                 unkWordIdx,
                 transition,
-                true));
-            LOG(INFO)
-                << "[Decoder] Lexicon decoder with token-LM loaded in thread: "
+                false);
+            lexiconDecoder->setBiasing(biasing);
+            decoder.reset(lexiconDecoder);
+            LOG_IF(INFO, !sweep)
+                << "[Decoder] Lexicon decoder with word-LM loaded in thread: "
                 << tid;
+          } else if (FLAGS_decodertype == "tkn") {
+            if (FLAGS_uselexicon) {
+              decoder.reset(new LexiconDecoder(
+                  opt,
+                  localTrie,
+                  localLm,
+                  silIdx,
+                  blankIdx,
+                  unkWordIdx,
+                  transition,
+                  true));
+              LOG_IF(INFO, !sweep)
+                  << "[Decoder] Lexicon decoder with token-LM loaded in thread: "
+                  << tid;
+            } else {
+              decoder.reset(new LexiconFreeDecoder(
+                  opt, localLm, silIdx, blankIdx, transition));
+              LOG_IF(INFO, !sweep)
+                  << "[Decoder] Lexicon-free decoder with token-LM loaded in thread: "
+                  << tid;
+            }
           } else {
-            decoder.reset(new LexiconFreeDecoder(
-                decoderOpt, localLm, silIdx, blankIdx, transition));
-            LOG(INFO)
-                << "[Decoder] Lexicon-free decoder with token-LM loaded in thread: "
-                << tid;
+            LOG(FATAL) << "Unsupported decoder type: " << FLAGS_decodertype;
           }
-        } else {
-          LOG(FATAL) << "Unsupported decoder type: " << FLAGS_decodertype;
         }
+        return decoder;
+      };
+      if (sweep) {
+        runSweep(makeDecoder);
+        return;
       }
+      auto decoder = makeDecoder(decoderOpt);
 
       // Get data and run decoder
       TestMeters meters;
-      int sliceSize = end - start;
-      meters.timer.resume();
-      for (int s = start; s < end; s++) {
-        auto emission = emissionSet.emissions[s];
-        auto wordTarget = emissionSet.wordTargets[s];
-        auto tokenTarget = emissionSet.tokenTargets[s];
-        auto sampleId = emissionSet.sampleIds[s];
-        auto T = emissionSet.emissionT[s];
-        auto N = emissionSet.emissionN;
+      EmissionSample sample;
+      while (emissionQueue.pop(sample)) {
+        meters.timer.resume();
+        const auto& wordTarget = sample.wordTarget;
+        const auto& tokenTarget = sample.tokenTarget;
+        const auto& sampleId = sample.sampleId;
 
         // DecodeResult
-        auto results = decoder->decode(emission.data(), T, N);
+        auto decodeStart = std::chrono::steady_clock::now();
+        auto results = decodeSample(*decoder, sample);
+        if (FLAGS_decoder_stats) {
+          double latency = std::chrono::duration<double>(
+                               std::chrono::steady_clock::now() - decodeStart)
+                               .count();
+          const auto& stats = decoder->stats();
+          sliceStats[tid] += stats;
+          sliceLatency[tid].push_back(latency);
+          double frames = std::max<int64_t>(stats.frames, 1);
+          std::stringstream buffer;
+          buffer << "[Decoder stats] sample: " << sampleId
+                 << ", frames: " << stats.frames << ", time: " << latency * 1000
+                 << "ms";
+          if (sample.duration > 0) {
+            sliceRtf[tid].push_back(latency / sample.duration);
+            buffer << ", RTF: " << latency / sample.duration;
+          }
+          buffer << ", candidates/frame: " << stats.candidates / frames
+                 << " (merged: " << stats.merged / frames
+                 << ", pruned: " << stats.pruned() / frames
+                 << "), LM queries: " << stats.lmQueries
+                 << " (cache hits: " << stats.lmCacheHits
+                 << "), trie expansions: " << stats.trieExpansions
+                 << ", peak hypothesis memory: "
+                 << stats.peakHypothesisBytes / 1024 << "KB";
+          LOG(INFO) << buffer.str();
+          if (!FLAGS_sclite.empty()) {
+            writeLog(buffer.str() + "\n");
+          }
+        }
 
         // Cleanup predictions
-        auto& rawWordPrediction = results[0].words;
-        auto& rawTokenPrediction = results[0].tokens;
-
         auto letterTarget = tknTarget2Ltr(tokenTarget, tokenDict);
-        auto letterPrediction =
-            tknPrediction2Ltr(rawTokenPrediction, tokenDict);
-        std::vector<std::string> wordPrediction;
-        if (FLAGS_uselexicon) {
-          rawWordPrediction =
-              validateIdx(rawWordPrediction, wordDict.getIndex(kUnkToken));
-          wordPrediction = wrdIdx2Wrd(rawWordPrediction, wordDict);
-        } else {
-          wordPrediction = tkn2Wrd(letterPrediction);
-        }
+        std::vector<std::string> letterPrediction, wordPrediction;
+        readPrediction(results[0], letterPrediction, wordPrediction);
 
         // Update meters & print out predictions
         meters.werSlice.add(wordPrediction, wordTarget);
@@ -533,12 +1432,12 @@ int main(int argc, char** argv) {
             buffer << "|p|: " << join(" ", letterPrediction) << std::endl;
           }
           buffer << "[sample: " << sampleId
-                 << ", WER: " << meters.wer.value()[0]
-                 << "\%, LER: " << meters.ler.value()[0]
-                 << "\%, slice WER: " << meters.werSlice.value()[0]
-                 << "\%, slice LER: " << meters.lerSlice.value()[0]
-                 << "\%, progress (slice " << tid
-                 << "): " << static_cast<float>(s - start + 1) / sliceSize * 100
+                 << ", WER: " << meters.wer.value()
+                 << "\%, LER: " << meters.ler.value()
+                 << "\%, slice WER: " << meters.werSlice.value()
+                 << "\%, slice LER: " << meters.lerSlice.value()
+                 << "\%, progress: "
+                 << static_cast<float>(++nDecodedSamples) / nSample * 100
                  << "\%]" << std::endl;
 
           std::cout << buffer.str();
@@ -548,14 +1447,14 @@ int main(int argc, char** argv) {
         }
 
         // Update conters
-        sliceNumWords[tid] += wordTarget.size();
-        sliceNumTokens[tid] += letterTarget.size();
-      }
-      meters.timer.stop();
-      sliceWer[tid] = meters.werSlice.value()[0];
-      sliceLer[tid] = meters.lerSlice.value()[0];
-      sliceNumSamples[tid] = sliceSize;
-      sliceTime[tid] = meters.timer.value();
+        ++sliceNumSamples[tid];
+        meters.timer.stop();
+      }
+      if (sliceNumSamples[tid] > 0) {
+        sliceWer[tid] = meters.werSlice;
+        sliceLer[tid] = meters.lerSlice;
+        sliceTime[tid] = meters.timer.value();
+      }
     } catch (const std::exception& exc) {
       LOG(FATAL) << "Exception in thread " << tid << "\n" << exc.what();
     }
@@ -563,41 +1462,89 @@ int main(int argc, char** argv) {
 
   /* Spread threades */
   auto startThreads = [&]() {
+    if (FLAGS_nthread_decoder < 1) {
+      LOG(FATAL) << "Invalid nthread_decoder";
+    }
+    int nProducers = amDatasets.empty() ? 1 : amDatasets.size();
+    nRunningProducers = nProducers;
+    fl::ThreadPool producerPool(nProducers);
+    for (int i = 0; i < nProducers; i++) {
+      producerPool.enqueue(runProducer, i);
+    }
+
+    if (sweep) {
+      // Shuffled, so that the samples of the first rounds are representative
+      EmissionSample sample;
+      while (emissionQueue.pop(sample)) {
+        sweepSamples.push_back(std::move(sample));
+      }
+      if (sweepSamples.empty()) {
+        LOG(FATAL) << "[Sweep] No sample to decode";
+      }
+      std::shuffle(
+          sweepSamples.begin(), sweepSamples.end(), std::mt19937(FLAGS_seed));
+      sweepEnd = sweepRoundEnd(0);
+      LOG(INFO) << "[Sweep] " << sweepOpts.size() << " configurations, "
+                << sweepSamples.size() << " samples, " << nSweepRounds
+                << " rounds";
+    }
+
     if (FLAGS_nthread_decoder == 1) {
-      runDecoder(0, 0, nSample);
-    } else if (FLAGS_nthread_decoder > 1) {
+      runDecoder(0);
+    } else {
       fl::ThreadPool threadPool(FLAGS_nthread_decoder);
       for (int i = 0; i < FLAGS_nthread_decoder; i++) {
-        int start = i * nSamplePerThread;
-        if (start >= nSample) {
-          break;
-        }
-        int end = std::min((i + 1) * nSamplePerThread, nSample);
-        threadPool.enqueue(runDecoder, i, start, end);
+        threadPool.enqueue(runDecoder, i);
       }
-    } else {
-      LOG(FATAL) << "Invalid nthread_decoder";
     }
   };
+  startup.reset();
   auto timer = fl::TimeMeter();
   timer.resume();
   startThreads();
   timer.stop();
 
+  if (sweep) {
+    const auto& best = sweepOpts[sweepConfigs[0]];
+    std::stringstream buffer;
+    buffer << "------\n[Sweep " << FLAGS_test << " in " << timer.value()
+           << "s] best: --lmweight=" << best.lmWeight
+           << " --wordscore=" << best.wordScore
+           << " --silscore=" << best.silScore
+           << " --beamthreshold=" << best.beamThreshold
+           << " -- WER: " << sweepWer[sweepConfigs[0]].value() << std::endl;
+    LOG(INFO) << buffer.str();
+    if (!FLAGS_sclite.empty()) {
+      writeLog(buffer.str());
+      hypStream.close();
+      refStream.close();
+      logStream.close();
+    }
+    return 0;
+  }
+
   /* Compute statistics */
-  int totalTokens = 0, totalWords = 0, totalSamples = 0;
+  int totalSamples = 0;
   for (int i = 0; i < FLAGS_nthread_decoder; i++) {
-    totalTokens += sliceNumTokens[i];
-    totalWords += sliceNumWords[i];
     totalSamples += sliceNumSamples[i];
   }
-  double totalWer = 0, totalLer = 0, totalTime = 0;
+  ErrorRateMeter werMeter, lerMeter;
+  double totalTime = 0;
   for (int i = 0; i < FLAGS_nthread_decoder; i++) {
-    totalWer += sliceWer[i] * sliceNumWords[i] / totalWords;
-    totalLer += sliceLer[i] * sliceNumTokens[i] / totalTokens;
+    werMeter.add(sliceWer[i]);
+    lerMeter.add(sliceLer[i]);
     totalTime += sliceTime[i];
+    LOG(INFO) << "[Decoder] Thread " << i << " decoded " << sliceNumSamples[i]
+              << " samples in " << sliceTime[i] << "s";
   }
+  // With AM workers, a long wait of the decoders means idle decoder threads
+  // and a long wait of the producers idle GPUs
+  LOG(INFO) << "[Pipeline] Emission producers blocked on a full queue for "
+            << emissionQueue.pushWaitSeconds()
+            << "s, decoder threads waited on an empty queue for "
+            << emissionQueue.popWaitSeconds() << "s";
 
+  double totalWer = werMeter.value(), totalLer = lerMeter.value();
   std::stringstream buffer;
   buffer << "------\n";
   buffer << "[Decode " << FLAGS_test << " (" << totalSamples << " samples) in "
@@ -605,6 +1552,32 @@ int main(int argc, char** argv) {
          << totalTime / totalSamples
          << "s/sample) -- WER: " << std::setprecision(6) << totalWer
          << ", LER: " << totalLer << "]" << std::endl;
+  if (FLAGS_decoder_stats) {
+    std::vector<double> latency, rtf;
+    DecoderStats stats;
+    for (int i = 0; i < FLAGS_nthread_decoder; i++) {
+      latency.insert(
+          latency.end(), sliceLatency[i].begin(), sliceLatency[i].end());
+      rtf.insert(rtf.end(), sliceRtf[i].begin(), sliceRtf[i].end());
+      stats += sliceStats[i];
+    }
+    double frames = std::max<int64_t>(stats.frames, 1);
+    buffer << "[Decoder stats] latency p50/p95/p99: "
+           << percentile(latency, 50) * 1000 << "/"
+           << percentile(latency, 95) * 1000 << "/"
+           << percentile(latency, 99) * 1000 << "ms";
+    if (!rtf.empty()) {
+      buffer << ", RTF p50/p95/p99: " << percentile(rtf, 50) << "/"
+             << percentile(rtf, 95) << "/" << percentile(rtf, 99);
+    }
+    buffer << ", candidates/frame: " << stats.candidates / frames
+           << " (merged: " << stats.merged / frames
+           << ", pruned: " << stats.pruned() / frames
+           << "), LM cache hits: "
+           << 100.0 * stats.lmCacheHits / std::max<int64_t>(stats.lmQueries, 1)
+           << "%, peak hypothesis memory: "
+           << stats.peakHypothesisBytes / 1024 << "KB" << std::endl;
+  }
   LOG(INFO) << buffer.str();
   if (!FLAGS_sclite.empty()) {
     writeLog(buffer.str());
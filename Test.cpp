@@ -8,6 +8,7 @@
 
 #include <stdlib.h>
 #include <fstream>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -20,6 +21,8 @@
 #include "common/Transforms.h"
 #include "criterion/criterion.h"
 #include "libraries/common/Dictionary.h"
+#include "libraries/common/TaskScheduler.h"
+#include "libraries/criterion/cpu/CriterionUtils.h"
 #include "module/module.h"
 #include "runtime/runtime.h"
 
@@ -55,6 +58,9 @@ int main(int argc, char** argv) {
   W2lSerializer::load(FLAGS_am, cfg, network, criterion);
   network->eval();
   criterion->eval();
+  auto ctc =
+      std::dynamic_pointer_cast<ConnectionistTemporalClassificationCriterion>(
+          criterion);
 
   LOG(INFO) << "[Network] " << network->prettyString();
   LOG(INFO) << "[Criterion] " << criterion->prettyString();
@@ -79,6 +85,15 @@ int main(int argc, char** argv) {
 
   LOG(INFO) << "Gflags after parsing \n" << serializeGflags("; ");
 
+  auto amQuantization = parseQuantizationType(FLAGS_amquantize);
+  if (amQuantization != QuantizationType::NONE) {
+    network = quantizeForInference(network, amQuantization);
+    LOG(INFO) << "[Network] Quantized " << network->prettyString();
+  }
+
+  w2l::cpu::setNumThreads(FLAGS_criterionthreads);
+  w2l::TaskScheduler::configure(FLAGS_cputhreads, FLAGS_pinthreads);
+
   /* ===================== Create Dictionary ===================== */
   auto dictPath = pathsConcat(FLAGS_tokensdir, FLAGS_tokens);
   if (dictPath.empty() || !fileExists(dictPath)) {
@@ -96,6 +111,7 @@ int main(int argc, char** argv) {
   if (FLAGS_eostoken) {
     tokenDict.addEntry(kEosToken);
   }
+  tokenDict.freeze();
 
   int numClasses = tokenDict.indexSize();
   LOG(INFO) << "Number of classes (network): " << numClasses;
@@ -105,6 +121,7 @@ int main(int argc, char** argv) {
   if (!FLAGS_lexicon.empty()) {
     lexicon = loadWords(FLAGS_lexicon, FLAGS_maxword);
     wordDict = createWordDict(lexicon);
+    wordDict.freeze();
     LOG(INFO) << "Number of words: " << wordDict.indexSize();
   }
 
@@ -114,10 +131,17 @@ int main(int argc, char** argv) {
   // Load dataset
   int worldRank = 0;
   int worldSize = 1;
+  // Batches of samples of similar durations with --am_batchframes, or single
+  // samples. The packing flag of the training doesn't apply.
+  FLAGS_batchframes = FLAGS_am_batchframes;
+  if (FLAGS_am_chunk_ms > 0 && FLAGS_am_batchframes > 0) {
+    LOG(FATAL) << "--am_chunk_ms forwards the samples one at a time, it "
+               << "can't be used with --am_batchframes";
+  }
   auto ds = createDataset(FLAGS_test, dicts, lexicon, 1, worldRank, worldSize);
 
   ds->shuffle(3);
-  int nSamples = ds->size();
+  int nSamples = ds->numSamples();
   if (FLAGS_maxload > 0) {
     nSamples = std::min(nSamples, FLAGS_maxload);
   }
@@ -142,74 +166,118 @@ int main(int argc, char** argv) {
 
   TestMeters meters;
   EmissionSet emissionSet;
+  std::string cleanedTestPath = cleanFilepath(FLAGS_test);
+  std::string emissionFilePath =
+      pathsConcat(FLAGS_emission_dir, cleanedTestPath + ".emissions");
+  std::unique_ptr<EmissionFileWriter> emissionFile;
+  if (FLAGS_emission_mmap) {
+    // Kept in the top-k emissions for the blank transitions of CTC
+    int blank = FLAGS_criterion == kCtcCriterion
+        ? tokenDict.getIndex(kBlankToken)
+        : -1;
+    emissionFile = fl::cpp::make_unique<EmissionFileWriter>(
+        emissionFilePath, FLAGS_emission_topk, blank);
+  }
   meters.timer.resume();
   int cnt = 0;
-  for (auto& sample : *ds) {
-    auto rawEmission = network->forward({fl::input(sample[kInputIdx])}).front();
-    auto emission = afToVector<float>(rawEmission);
-    auto tokenTarget = afToVector<int>(sample[kTargetIdx]);
-    auto wordTarget = afToVector<int>(sample[kWordIdx]);
-    auto sampleId = readSampleIds(sample[kSampleIdx]).front();
-
-    auto letterTarget = tknTarget2Ltr(tokenTarget, tokenDict);
-    std::vector<std::string> wordTargetStr;
-    if (FLAGS_uselexicon) {
-      wordTargetStr = wrdIdx2Wrd(wordTarget, wordDict);
-    } else {
-      wordTargetStr = tkn2Wrd(letterTarget);
-    }
-
-    // Tokens
-    auto tokenPrediction =
-        afToVector<int>(criterion->viterbiPath(rawEmission.array()));
-    auto letterPrediction = tknPrediction2Ltr(tokenPrediction, tokenDict);
-
-    meters.lerSlice.add(letterPrediction, letterTarget);
-
-    // Words
-    std::vector<std::string> wrdPredictionStr = tkn2Wrd(letterPrediction);
-    meters.werSlice.add(wrdPredictionStr, wordTargetStr);
-
-    if (!FLAGS_sclite.empty()) {
-      refStream << join(" ", wordTargetStr) + " (" + sampleId + ")"
-                << std::endl;
-      hypStream << join(" ", wrdPredictionStr) + " (" + sampleId + ")"
-                << std::endl;
-    }
-
-    if (FLAGS_show) {
-      meters.ler.reset();
-      meters.wer.reset();
-      meters.ler.add(letterPrediction, letterTarget);
-      meters.wer.add(wrdPredictionStr, wordTargetStr);
-
-      std::cout << "|T|: " << join(" ", letterTarget) << std::endl;
-      std::cout << "|P|: " << join(" ", letterPrediction) << std::endl;
-      std::cout << "[sample: " << sampleId << ", WER: " << meters.wer.value()[0]
-                << "\%, LER: " << meters.ler.value()[0]
-                << "\%, total WER: " << meters.werSlice.value()[0]
-                << "\%, total LER: " << meters.lerSlice.value()[0]
-                << "\%, progress: " << static_cast<float>(cnt) / nSamples * 100
-                << "\%]" << std::endl;
-    }
-
-    /* Save emission and targets */
-    int N = rawEmission.dims(0);
-    int T = rawEmission.dims(1);
-    emissionSet.emissions.emplace_back(emission);
-    emissionSet.tokenTargets.emplace_back(tokenTarget);
-    emissionSet.wordTargets.emplace_back(wordTargetStr);
-
-    // while testing we use batchsize 1 and hence ds only has 1 sampleid
-    emissionSet.sampleIds.emplace_back(
-        readSampleIds(sample[kSampleIdx]).front());
-
-    emissionSet.emissionT.emplace_back(T);
-    emissionSet.emissionN = N;
-
-    ++cnt;
-    if (cnt == FLAGS_maxload) {
-      break;
+  int tokenPadIdx =
+      FLAGS_eostoken ? tokenDict.getIndex(kEosToken) : kTargetPadValue;
+  for (int64_t idx = 0; idx < ds->size() && cnt < nSamples; ++idx) {
+    auto batch = ds->get(idx);
+    auto batchEmission = chunkedForward(
+        *network,
+        batch[kInputIdx],
+        msToInputFrames(FLAGS_am_chunk_ms),
+        msToInputFrames(FLAGS_am_chunk_overlap_ms),
+        FLAGS_am_chunk_batch);
+    auto rawEmissions =
+        unpadEmissions(batchEmission, ds->getSampleDurations(idx));
+    auto tokenTargets = readBatchTargets(batch[kTargetIdx], tokenPadIdx);
+    auto wordTargets = readBatchTargets(batch[kWordIdx]);
+    auto sampleIds = readSampleIds(batch[kSampleIdx]);
+
+    for (int b = 0; b < rawEmissions.size() && cnt < nSamples; ++b) {
+      const auto& rawEmission = rawEmissions[b];
+      auto emission = afToVector<float>(rawEmission);
+      const auto& tokenTarget = tokenTargets[b];
+      auto& wordTarget = wordTargets[b];
+      const auto& sampleId = sampleIds[b];
+
+      auto letterTarget = tknTarget2Ltr(tokenTarget, tokenDict);
+      std::vector<std::string> wordTargetStr;
+      if (FLAGS_uselexicon) {
+        // The word targets of a batch are padded with <unk>: a target has as
+        // many words as its tokens
+        if (rawEmissions.size() > 1) {
+          wordTarget.resize(
+              std::min(wordTarget.size(), tkn2Wrd(letterTarget).size()));
+        }
+        wordTargetStr = wrdIdx2Wrd(wordTarget, wordDict);
+      } else {
+        wordTargetStr = tkn2Wrd(letterTarget);
+      }
+
+      // Tokens
+      // With --ctcgreedypath, the CTC transcripts are collapsed on the device
+      // already
+      std::vector<std::string> letterPrediction;
+      if (FLAGS_ctcgreedypath && ctc &&
+          tokenDict.getIndex(kBlankToken) == rawEmission.dims(0) - 1) {
+        auto tokenPrediction = ctc->greedyPath(rawEmission).front();
+        letterPrediction = tknTarget2Ltr(tokenPrediction, tokenDict);
+      } else {
+        auto tokenPrediction = criterion->batchViterbiPath(rawEmission).front();
+        letterPrediction = tknPrediction2Ltr(tokenPrediction, tokenDict);
+      }
+
+      meters.lerSlice.add(letterPrediction, letterTarget);
+
+      // Words
+      std::vector<std::string> wrdPredictionStr = tkn2Wrd(letterPrediction);
+      meters.werSlice.add(wrdPredictionStr, wordTargetStr);
+
+      if (!FLAGS_sclite.empty()) {
+        refStream << join(" ", wordTargetStr) + " (" + sampleId + ")"
+                  << std::endl;
+        hypStream << join(" ", wrdPredictionStr) + " (" + sampleId + ")"
+                  << std::endl;
+      }
+
+      if (FLAGS_show) {
+        meters.ler.reset();
+        meters.wer.reset();
+        meters.ler.add(letterPrediction, letterTarget);
+        meters.wer.add(wrdPredictionStr, wordTargetStr);
+
+        std::cout << "|T|: " << join(" ", letterTarget) << std::endl;
+        std::cout << "|P|: " << join(" ", letterPrediction) << std::endl;
+        std::cout << "[sample: " << sampleId
+                  << ", WER: " << meters.wer.value()
+                  << "\%, LER: " << meters.ler.value()
+                  << "\%, total WER: " << meters.werSlice.value()
+                  << "\%, total LER: " << meters.lerSlice.value()
+                  << "\%, progress: "
+                  << static_cast<float>(cnt) / nSamples * 100 << "\%]"
+                  << std::endl;
+      }
+
+      /* Save emission and targets */
+      int N = rawEmission.dims(0);
+      int T = rawEmission.dims(1);
+      if (emissionFile) {
+        emissionFile->add(std::move(emission), N);
+      } else {
+        emissionSet.emissions.emplace_back(emission);
+      }
+      emissionSet.tokenTargets.emplace_back(tokenTarget);
+      emissionSet.wordTargets.emplace_back(wordTargetStr);
+
+      emissionSet.sampleIds.emplace_back(sampleId);
+
+      emissionSet.emissionT.emplace_back(T);
+      emissionSet.emissionN = N;
+
+      ++cnt;
     }
   }
   if (FLAGS_criterion == kAsgCriterion) {
@@ -218,12 +286,16 @@ int main(int argc, char** argv) {
   emissionSet.gflags = serializeGflags();
 
   meters.timer.stop();
-  std::cout << "---\n[total WER: " << meters.werSlice.value()[0]
-            << "\%, total LER: " << meters.lerSlice.value()[0]
+  std::cout << "---\n[total WER: " << meters.werSlice.value()
+            << "\%, total LER: " << meters.lerSlice.value()
             << "\%, time: " << meters.timer.value() << "s]" << std::endl;
 
   /* ====== Serialize emission and targets for decoding ====== */
-  std::string cleanedTestPath = cleanFilepath(FLAGS_test);
+  if (emissionFile) {
+    LOG(INFO) << "[Serialization] Saving the index of " << emissionFilePath;
+    emissionFile->finish(emissionSet);
+    return 0;
+  }
   std::string savePath =
       pathsConcat(FLAGS_emission_dir, cleanedTestPath + ".bin");
   LOG(INFO) << "[Serialization] Saving into file: " << savePath;
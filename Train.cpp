@@ -6,8 +6,15 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <algorithm>
+#include <chrono>
 #include <cstdlib>
+#include <deque>
 #include <fstream>
+#include <functional>
+#include <future>
+#include <memory>
+#include <numeric>
 #include <random>
 #include <string>
 #include <vector>
@@ -24,6 +31,8 @@
 #include "criterion/criterion.h"
 #include "data/Featurize.h"
 #include "libraries/common/Dictionary.h"
+#include "libraries/common/TaskScheduler.h"
+#include "libraries/criterion/cpu/CriterionUtils.h"
 #include "module/module.h"
 #include "runtime/runtime.h"
 
@@ -62,7 +71,11 @@ int main(int argc, char** argv) {
     runPath = newRunPath(FLAGS_rundir, FLAGS_runname, FLAGS_tag);
   } else if (runStatus == kContinueMode) {
     runPath = argv[2];
-    while (fileExists(getRunFile("model_last.bin", runIdx, runPath))) {
+    auto lastModelExists = [&]() {
+      auto path = getRunFile("model_last.bin", runIdx, runPath);
+      return fileExists(path) || dirExists(path);
+    };
+    while (lastModelExists()) {
       ++runIdx;
     }
     reloadPath = getRunFile("model_last.bin", runIdx - 1, runPath);
@@ -126,12 +139,41 @@ int main(int argc, char** argv) {
   af::setMemStepSize(FLAGS_memstepsize);
   af::setSeed(FLAGS_seed);
   af::setFFTPlanCacheSize(FLAGS_fftcachesize);
+  w2l::cpu::setNumThreads(FLAGS_criterionthreads);
+  w2l::TaskScheduler::configure(FLAGS_cputhreads, FLAGS_pinthreads);
 
   std::shared_ptr<fl::Reducer> reducer = nullptr;
   if (FLAGS_enable_distributed) {
     initDistributed(FLAGS_world_rank, FLAGS_world_size, FLAGS_rndv_filepath);
-    reducer = std::make_shared<fl::CoalescingReducer>(
-        1.0 / fl::getWorldSize(), true, true);
+    auto compression = parseGradientCompression(FLAGS_reducer_compression);
+    if (FLAGS_reducer_bucket_kb == 0 &&
+        compression == GradientCompression::NONE &&
+        !FLAGS_reducer_hierarchical) {
+      reducer = std::make_shared<fl::CoalescingReducer>(
+          1.0 / fl::getWorldSize(), true, true);
+    } else {
+      size_t bucketBytes = FLAGS_reducer_bucket_kb > 0
+          ? FLAGS_reducer_bucket_kb << 10
+          : measureBucketBytes();
+      LOG_MASTER(INFO) << "Reducing the gradients in buckets of "
+                       << (bucketBytes >> 10) << " KB with compression "
+                       << FLAGS_reducer_compression;
+      std::shared_ptr<HierarchicalAllReduce> hierarchical;
+      if (FLAGS_reducer_hierarchical) {
+        hierarchical = std::make_shared<HierarchicalAllReduce>();
+        LOG_MASTER(INFO) << "All-reducing hierarchically over "
+                         << hierarchical->nNodes() << " nodes of "
+                         << hierarchical->localSize() << " processes";
+      }
+      reducer = std::make_shared<BucketedReducer>(
+          1.0 / fl::getWorldSize(), bucketBytes, compression, hierarchical);
+    }
+  }
+
+  // Mixed-precision training, the network is converted when it's created
+  std::shared_ptr<DynamicLossScaler> lossScaler;
+  if (FLAGS_amp) {
+    lossScaler = std::make_shared<DynamicLossScaler>();
   }
 
   int worldRank = fl::getWorldRank();
@@ -182,6 +224,7 @@ int main(int argc, char** argv) {
   if (FLAGS_eostoken) {
     tokenDict.addEntry(kEosToken);
   }
+  tokenDict.freeze();
 
   int numClasses = tokenDict.indexSize();
   LOG(INFO) << "Number of classes (network): " << numClasses;
@@ -191,11 +234,96 @@ int main(int argc, char** argv) {
   if (!FLAGS_lexicon.empty()) {
     lexicon = loadWords(FLAGS_lexicon, FLAGS_maxword);
     wordDict = createWordDict(lexicon);
+    wordDict.freeze();
     LOG(INFO) << "Number of words: " << wordDict.indexSize();
   }
 
   DictionaryMap dicts = {{kTargetIdx, tokenDict}, {kWordIdx, wordDict}};
 
+  // With --synthetic_samples, the training loop runs on random batches
+  // generated on the device, so that its throughput isn't bound by the data
+  auto createTrainDataset = [&]() {
+    if (FLAGS_synthetic_samples > 0) {
+      return createSyntheticDataset(
+          dicts, FLAGS_batchsize, worldRank, worldSize);
+    }
+    auto ds = FLAGS_stream_buffer > 0
+        ? createStreamingDataset(
+              FLAGS_train,
+              dicts,
+              lexicon,
+              FLAGS_batchsize,
+              worldRank,
+              worldSize)
+        : createDataset(
+              FLAGS_train,
+              dicts,
+              lexicon,
+              FLAGS_batchsize,
+              worldRank,
+              worldSize);
+    if (!FLAGS_specaug_cpu.empty()) {
+      ds->setSpecAugment(std::make_shared<SpecAugmentStage>(
+          SpecAugmentStage::fromString(FLAGS_specaug_cpu)));
+    }
+    if (!FLAGS_speedperturb.empty()) {
+      ds->setSpeedPerturb(
+          std::make_shared<SpeedPerturbStage>(SpeedPerturbStage::fromString(
+              FLAGS_speedperturb, FLAGS_samplerate, FLAGS_channels)));
+    }
+    return ds;
+  };
+
+  // Seconds of audio of the batch `idx` of `ds`, whose input is `input`: the
+  // lengths of its samples if the dataset records them, else its padded size
+  auto batchAudioSec = [](const W2lDataset& ds,
+                          int64_t idx,
+                          const af::array& input) {
+    auto durations = ds.getSampleDurations(idx);
+    if (!durations.empty()) {
+      return std::accumulate(durations.begin(), durations.end(), 0.0) /
+          1000.0;
+    }
+    double size = input.dims(0) * input.dims(3);
+    if (FLAGS_pow || FLAGS_mfcc || FLAGS_mfsc) {
+      return size * FLAGS_framestridems / 1000.0;
+    }
+    return size / FLAGS_samplerate;
+  };
+  auto logThroughput = [](const std::string& what,
+                          int64_t numSamples,
+                          double audioSec,
+                          double sec) {
+    sec = std::max(sec, 1e-9);
+    LOG_MASTER(INFO) << what << " throughput - " << numSamples / sec
+                     << " samples/s, " << audioSec / 3600.0 / sec
+                     << " audio-hours/s per GPU";
+  };
+
+  /* ===================== Data Pipeline Only ===================== */
+  // The batches are loaded, featurized and copied to the device as they are
+  // when training, without any model to wait for
+  if (FLAGS_datapipeline_only) {
+    auto ds = createTrainDataset();
+    ds->shuffle(FLAGS_seed);
+    int64_t numSamples = 0;
+    double audioSec = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int64_t i = 0; i < ds->size(); ++i) {
+      auto sample = ds->get(i);
+      af::eval(sample[kInputIdx], sample[kTargetIdx]);
+      af::sync();
+      numSamples += sample[kInputIdx].dims(3);
+      audioSec += batchAudioSec(*ds, i, sample[kInputIdx]);
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    LOG_MASTER(INFO) << "Data pipeline prefetching - "
+                     << ds->prefetchStats().toString();
+    logThroughput("Data pipeline", numSamples, audioSec, elapsed.count());
+    return 0;
+  }
+
   /* =========== Create Network & Optimizers / Reload Snapshot ============ */
   std::shared_ptr<fl::Module> network;
   std::shared_ptr<SequenceCriterion> criterion;
@@ -209,18 +337,39 @@ int main(int argc, char** argv) {
     auto numFeatures = getSpeechFeatureSize();
     // Encoder network, works on audio
     network = createW2lSeqModule(archfile, numFeatures, numClasses);
+    if (FLAGS_amp) {
+      network = toMixedPrecision(network);
+    }
 
     if (FLAGS_criterion == kCtcCriterion) {
       criterion = std::make_shared<CTCLoss>(scalemode);
     } else if (FLAGS_criterion == kAsgCriterion) {
-      criterion =
-          std::make_shared<ASGLoss>(numClasses, scalemode, FLAGS_transdiag);
+      criterion = std::make_shared<ASGLoss>(
+          numClasses, scalemode, FLAGS_transdiag, FLAGS_transtopk);
     } else if (FLAGS_criterion == kSeq2SeqCriterion) {
       criterion = std::make_shared<Seq2SeqCriterion>(
           buildSeq2Seq(numClasses, tokenDict.getIndex(kEosToken)));
     } else {
       LOG(FATAL) << "unimplemented criterion";
     }
+  } else if (FLAGS_enable_distributed && FLAGS_peer_restore) {
+    // The first process reads the checkpoint and sends it to the others, so
+    // that a restart doesn't read it from the storage once per process
+    std::unordered_map<std::string, std::string> cfg; // unused
+    std::string snapshot;
+    if (isMaster) {
+      W2lSerializer::load(
+          reloadPath, cfg, network, criterion, netoptim, critoptim);
+      snapshot = *W2lSerializer::snapshot(
+          cfg, network, criterion, netoptim, critoptim);
+    }
+    snapshot = broadcastBytes(snapshot, 0);
+    if (!isMaster) {
+      W2lSerializer::loadSnapshot(
+          snapshot, cfg, network, criterion, netoptim, critoptim);
+    }
+    LOG_MASTER(INFO) << "Sent " << snapshot.size() << " bytes of "
+                     << reloadPath << " to the other processes";
   } else {
     std::unordered_map<std::string, std::string> cfg; // unused
     W2lSerializer::load(
@@ -228,6 +377,21 @@ int main(int argc, char** argv) {
   }
   LOG_MASTER(INFO) << "[Network] " << network->prettyString();
   LOG_MASTER(INFO) << "[Network Params: " << numTotalParams(network) << "]";
+  if (isMaster && !FLAGS_profilemodules.empty()) {
+    auto shape = split(',', FLAGS_profilemodules);
+    if (shape.size() != 2) {
+      LOG(FATAL) << "--profilemodules should be T,B, not "
+                 << FLAGS_profilemodules;
+    }
+    auto profiles = profileModule(
+        network,
+        af::dim4(
+            std::stoll(shape[0]),
+            getSpeechFeatureSize(),
+            FLAGS_channels,
+            std::stoll(shape[1])));
+    LOG(INFO) << "[Network Profile]\n" << profileTable(profiles);
+  }
   LOG_MASTER(INFO) << "[Criterion] " << criterion->prettyString();
 
   if (runStatus == kTrainMode || runStatus == kForkMode) {
@@ -236,6 +400,24 @@ int main(int argc, char** argv) {
     critoptim =
         initOptimizer({criterion}, FLAGS_critoptim, FLAGS_lrcrit, 0.0, 0.0);
   }
+  // With --shardoptim, each process saves the states it owns next to the
+  // checkpoints
+  auto optimizerShards = [&](const std::string& filename) {
+    std::vector<std::pair<std::string, std::shared_ptr<ShardedOptimizer>>> res;
+    for (auto& opt : {std::make_pair(".netoptim", netoptim),
+                      std::make_pair(".critoptim", critoptim)}) {
+      auto sharded = std::dynamic_pointer_cast<ShardedOptimizer>(opt.second);
+      if (sharded) {
+        res.emplace_back(filename + opt.first, sharded);
+      }
+    }
+    return res;
+  };
+  if (runStatus == kContinueMode) {
+    for (auto& shard : optimizerShards(reloadPath)) {
+      shard.second->loadShard(shard.first);
+    }
+  }
   LOG_MASTER(INFO) << "[Network Optimizer] " << netoptim->prettyString();
   LOG_MASTER(INFO) << "[Criterion Optimizer] " << critoptim->prettyString();
 
@@ -245,6 +427,9 @@ int main(int argc, char** argv) {
   std::shared_ptr<LinSegCriterion> linseg;
   std::shared_ptr<fl::FirstOrderOptimizer> linNetoptim;
   std::shared_ptr<fl::FirstOrderOptimizer> linCritoptim;
+  if (FLAGS_accumulate_steps < 1) {
+    LOG(FATAL) << "accumulate_steps must be positive";
+  }
   if (FLAGS_linseg > startEpoch) {
     if (FLAGS_criterion != kAsgCriterion) {
       LOG(FATAL) << "linseg may only be used with ASG criterion";
@@ -305,6 +490,23 @@ int main(int argc, char** argv) {
     ar(CEREAL_NVP(config));
   }
 
+  /* ===================== Tracing ===================== */
+  std::string tracePath;
+  if (FLAGS_trace) {
+    // Every rank writes its trace, possibly while the master creates the run
+    // directory
+    try {
+      dirCreate(runPath);
+    } catch (const std::exception&) {
+      if (!dirExists(runPath)) {
+        throw;
+      }
+    }
+    tracePath =
+        getRunFile(format("trace_rank%d.json", worldRank), runIdx, runPath);
+  }
+  Tracer tracer(tracePath, worldRank, FLAGS_trace_sync);
+
   auto logStatus =
       [&perfFile, &logFile, isMaster](
           TrainMeters& mtrs, int64_t epoch, double lr, double lrcrit) {
@@ -320,42 +522,88 @@ int main(int argc, char** argv) {
         }
       };
 
-  auto saveModels = [&](int iter) {
+  // Saves with `save` the models better than ever on a valid set of `mtrs`
+  auto saveBestModels =
+      [&](TrainMeters& mtrs,
+          const std::function<void(const std::string&)>& save) {
+        for (const auto& v : validminerrs) {
+          double verr = mtrs.valid[v.first].wrdEdit.value()[0];
+          if (verr < validminerrs[v.first]) {
+            validminerrs[v.first] = verr;
+            std::string cleaned_v = cleanFilepath(v.first);
+            save(getRunFile("model_" + cleaned_v + ".bin", runIdx, runPath));
+          }
+        }
+      };
+
+  AsyncCheckpointWriter checkpointWriter;
+  auto saveModels = [&](int iter, bool saveBest) {
+    for (auto& shard :
+         optimizerShards(getRunFile("model_last.bin", runIdx, runPath))) {
+      shard.second->saveShard(shard.first);
+    }
     if (isMaster) {
       // Save last epoch
       config[kEpoch] = std::to_string(iter);
 
-      std::string filename;
+      // With --async_checkpoint, the models are serialized once in host
+      // memory and the files are written in the background
+      std::shared_ptr<const std::string> snapshot;
+      auto save = [&](const std::string& filename) {
+        if (FLAGS_sharded_checkpoint) {
+          W2lSerializer::saveSharded(
+              filename, config, network, criterion, netoptim, critoptim);
+          return;
+        }
+        if (!FLAGS_async_checkpoint) {
+          W2lSerializer::save(
+              filename, config, network, criterion, netoptim, critoptim);
+          return;
+        }
+        if (!snapshot) {
+          snapshot = W2lSerializer::snapshot(
+              config, network, criterion, netoptim, critoptim);
+        }
+        checkpointWriter.write(filename, snapshot);
+      };
+
       if (FLAGS_itersave) {
-        filename =
-            getRunFile(format("model_iter_%03d.bin", iter), runIdx, runPath);
-        W2lSerializer::save(
-            filename, config, network, criterion, netoptim, critoptim);
+        save(getRunFile(format("model_iter_%03d.bin", iter), runIdx, runPath));
       }
 
       // save last model
-      filename = getRunFile("model_last.bin", runIdx, runPath);
-      W2lSerializer::save(
-          filename, config, network, criterion, netoptim, critoptim);
-
-      // save if better than ever for one valid
-      for (const auto& v : validminerrs) {
-        double verr = meters.valid[v.first].wrdEdit.value()[0];
-        if (verr < validminerrs[v.first]) {
-          validminerrs[v.first] = verr;
-          std::string cleaned_v = cleanFilepath(v.first);
-          std::string vfname =
-              getRunFile("model_" + cleaned_v + ".bin", runIdx, runPath);
-          W2lSerializer::save(
-              vfname, config, network, criterion, netoptim, critoptim);
-        }
+      save(getRunFile("model_last.bin", runIdx, runPath));
+
+      if (saveBest) {
+        saveBestModels(meters, save);
       }
     }
   };
 
   /* ===================== Create Dataset ===================== */
-  auto trainds = createDataset(
-      FLAGS_train, dicts, lexicon, FLAGS_batchsize, worldRank, worldSize);
+  // With --autobatchframes, the batches are sized to the memory left by the
+  // models, on the process with the least of it
+  if (FLAGS_autobatchframes) {
+    double batchFrames = probeBatchFrames(
+        *network, *criterion, getSpeechFeatureSize(), numClasses);
+    if (FLAGS_enable_distributed) {
+      af::array allFrames = af::constant(0, worldSize, f64);
+      allFrames(worldRank) = batchFrames;
+      fl::allReduce(allFrames);
+      batchFrames = af::min<double>(allFrames);
+    }
+    if (batchFrames <= 0) {
+      LOG(FATAL) << "Not enough device memory for batches of 1000 frames";
+    }
+    if (FLAGS_batchframes > 0) {
+      batchFrames = std::min(batchFrames, FLAGS_batchframes);
+    }
+    FLAGS_batchframes = batchFrames;
+    LOG_MASTER(INFO) << "Batches of at most " << FLAGS_batchframes
+                     << " frames";
+  }
+
+  auto trainds = createTrainDataset();
 
   if (FLAGS_noresample) {
     LOG_MASTER(INFO) << "Shuffling trainset";
@@ -363,34 +611,47 @@ int main(int argc, char** argv) {
   }
 
   std::map<std::string, std::shared_ptr<W2lDataset>> validds;
+  // The validation batches are the same every epoch
+  auto validCache = FLAGS_validcache_mb > 0
+      ? std::make_shared<BatchCache>(FLAGS_validcache_mb << 20)
+      : nullptr;
   for (const auto& s : validTagSets) {
     validds[s.first] = createDataset(
         s.second, dicts, lexicon, FLAGS_batchsize, worldRank, worldSize);
+    validds[s.first]->setBatchCache(validCache);
   }
 
   /* ===================== Hooks ===================== */
-  auto evalOutput = [&dicts, &criterion](
-                        const af::array& op,
-                        const af::array& target,
-                        DatasetMeters& mtr) {
-    auto batchsz = op.dims(2);
-    for (int b = 0; b < batchsz; ++b) {
-      auto tgt = target(af::span, b);
-      auto viterbipath =
-          afToVector<int>(criterion->viterbiPath(op(af::span, af::span, b)));
-      auto tgtraw = afToVector<int>(tgt);
+  if (dicts.find(kTargetIdx) == dicts.end()) {
+    LOG(FATAL) << "Dictionary not provided for target: " << kTargetIdx;
+  }
+  const auto& tgtDict = dicts.find(kTargetIdx)->second;
+  // With --ctcgreedypath, the CTC transcripts are collapsed on the device
+  // already, so that they are remapped as the targets are.
+  auto ctc =
+      std::dynamic_pointer_cast<ConnectionistTemporalClassificationCriterion>(
+          criterion);
+  bool collapsed = FLAGS_ctcgreedypath && ctc &&
+      tgtDict.getIndex(kBlankToken) == numClasses - 1;
+
+  // Adds the edit distances of the decoded `paths` of a batch to `mtr`
+  auto addEdits = [&tgtDict, collapsed](
+                      const std::vector<std::vector<int>>& paths,
+                      const std::vector<int>& tgtvec,
+                      DatasetMeters& mtr) {
+    auto tgtsz = paths.empty() ? 0 : tgtvec.size() / paths.size();
+    for (size_t b = 0; b < paths.size(); ++b) {
+      const auto& viterbipath = paths[b];
+      std::vector<int> tgtraw(
+          tgtvec.begin() + b * tgtsz, tgtvec.begin() + (b + 1) * tgtsz);
 
       // Remove `-1`s appended to the target for batching (if any)
       auto labellen = getTargetSize(tgtraw.data(), tgtraw.size());
       tgtraw.resize(labellen);
 
       // remap actual, predicted targets for evaluating edit distance error
-      if (dicts.find(kTargetIdx) == dicts.end()) {
-        LOG(FATAL) << "Dictionary not provided for target: " << kTargetIdx;
-      }
-      auto tgtDict = dicts.find(kTargetIdx)->second;
-
-      auto ltrPred = tknPrediction2Ltr(viterbipath, tgtDict);
+      auto ltrPred = collapsed ? tknTarget2Ltr(viterbipath, tgtDict)
+                               : tknPrediction2Ltr(viterbipath, tgtDict);
       auto ltrTgt = tknTarget2Ltr(tgtraw, tgtDict);
 
       auto wrdPred = tkn2Wrd(ltrPred);
@@ -401,6 +662,65 @@ int main(int argc, char** argv) {
     }
   };
 
+  // The paths of the batch are decoded together and copied in one transfer
+  auto evalOutput = [&addEdits, collapsed](
+                        const af::array& op,
+                        const af::array& target,
+                        SequenceCriterion& crit,
+                        DatasetMeters& mtr) {
+    auto viterbipaths = collapsed
+        ? dynamic_cast<ConnectionistTemporalClassificationCriterion&>(crit)
+              .greedyPath(op)
+        : crit.batchViterbiPath(op);
+    addEdits(viterbipaths, afToVector<int>(target), mtr);
+  };
+
+  // With --traineval_async, the sampled training batches are evaluated on a
+  // thread of their own: the loop only queues the computation of their paths
+  // on the device, and the thread copies them and computes the edit
+  // distances, so that the loop doesn't wait for them. The Seq2Seq paths are
+  // decoded on the host, so are still evaluated by the loop.
+  bool asyncTrainEval = FLAGS_traineval_async &&
+      !std::dynamic_pointer_cast<Seq2SeqCriterion>(criterion);
+  TaskScheduler trainEvalThread(1, false);
+  std::deque<std::future<void>> trainEvals;
+  // Waits for the pending evaluations, before the train meters are read
+  auto waitTrainEvals = [&trainEvals]() {
+    while (!trainEvals.empty()) {
+      auto pending = std::move(trainEvals.front());
+      trainEvals.pop_front();
+      pending.get();
+    }
+  };
+  auto evalTrainOutput = [&](const af::array& op, const af::array& target) {
+    if (!asyncTrainEval) {
+      evalOutput(op, target, *criterion, meters.train);
+      return;
+    }
+    // The paths are padded with -1, which the Viterbi paths never are
+    auto paths = collapsed ? ctcGreedyPath(op) : criterion->viterbiPath(op);
+    // Few batches are pending, so are their paths on the device
+    constexpr int kMaxPendingEvals = 4;
+    while (trainEvals.size() >= kMaxPendingEvals) {
+      auto pending = std::move(trainEvals.front());
+      trainEvals.pop_front();
+      pending.get();
+    }
+    int device = af::getDevice();
+    trainEvals.push_back(
+        trainEvalThread.async([&addEdits, &meters, paths, target, device]() {
+          af::setDevice(device);
+          auto pathVec = afToVector<int>(paths.as(s32));
+          int T = paths.dims(0);
+          std::vector<std::vector<int>> viterbipaths(paths.dims(1));
+          for (size_t b = 0; b < viterbipaths.size(); ++b) {
+            auto begin = pathVec.begin() + b * T;
+            viterbipaths[b].assign(begin, std::find(begin, begin + T, -1));
+          }
+          addEdits(viterbipaths, afToVector<int>(target), meters.train);
+        }));
+  };
+
   auto test = [&evalOutput](
                   std::shared_ptr<fl::Module> ntwrk,
                   std::shared_ptr<SequenceCriterion> crit,
@@ -418,10 +738,78 @@ int main(int argc, char** argv) {
           crit->forward({output, fl::Variable(sample[kTargetIdx], false)})
               .front();
       mtrs.loss.add(loss.array());
-      evalOutput(output.array(), sample[kTargetIdx], mtrs);
+      evalOutput(output.array(), sample[kTargetIdx], *crit, mtrs);
     }
   };
 
+  // With --validasync, a report only starts the validation, on copies of the
+  // models and on a thread of its own, and training goes on. Its status is
+  // logged, and the models better than ever on a valid set are saved, once it
+  // is done: at the next report, or at the end of the training phase. The
+  // models validated are snapshotted in host memory, so that the best models
+  // are saved as they were validated.
+  struct PendingValidation {
+    TrainMeters meters; // of the report
+    int64_t epoch;
+    double lr, lrcrit;
+    std::shared_ptr<const std::string> checkpoint; // on the master
+    std::future<void> done;
+  };
+  std::unique_ptr<PendingValidation> pendingValidation;
+  TaskScheduler validThread(1, false);
+  auto finishValidation = [&]() {
+    if (!pendingValidation) {
+      return;
+    }
+    auto pending = std::move(pendingValidation);
+    pending->done.get();
+    try {
+      logStatus(pending->meters, pending->epoch, pending->lr, pending->lrcrit);
+    } catch (const std::exception& ex) {
+      LOG(ERROR) << "Error while writing logs: " << ex.what();
+    }
+    if (isMaster) {
+      try {
+        saveBestModels(pending->meters, [&](const std::string& filename) {
+          checkpointWriter.write(filename, pending->checkpoint);
+        });
+      } catch (const std::exception& ex) {
+        LOG(FATAL) << "Error while saving models: " << ex.what();
+      }
+    }
+  };
+  auto startValidation = [&](std::shared_ptr<fl::Module> ntwrk,
+                             std::shared_ptr<SequenceCriterion> crit,
+                             int64_t epoch,
+                             double lr,
+                             double lrcrit) {
+    finishValidation();
+    auto pending = std::unique_ptr<PendingValidation>(new PendingValidation());
+    pending->meters = meters;
+    pending->epoch = epoch;
+    pending->lr = lr;
+    pending->lrcrit = lrcrit;
+    if (isMaster && !validminerrs.empty()) {
+      config[kEpoch] = std::to_string(epoch);
+      pending->checkpoint = W2lSerializer::snapshot(
+          config, network, criterion, netoptim, critoptim);
+    }
+    auto models = W2lSerializer::snapshot(ntwrk, crit);
+    auto mtrs = &pending->meters;
+    int device = af::getDevice();
+    pending->done =
+        validThread.async([&test, &validds, models, mtrs, device]() {
+          af::setDevice(device);
+          std::shared_ptr<fl::Module> ntwrkCopy;
+          std::shared_ptr<SequenceCriterion> critCopy;
+          W2lSerializer::loadSnapshot(*models, ntwrkCopy, critCopy);
+          for (auto& vds : validds) {
+            test(ntwrkCopy, critCopy, vds.second, mtrs->valid[vds.first]);
+          }
+        });
+    pendingValidation = std::move(pending);
+  };
+
   auto trainEvalIds =
       getTrainEvalIds(trainds->size(), FLAGS_pcttraineval, FLAGS_seed);
 
@@ -429,11 +817,18 @@ int main(int argc, char** argv) {
                 &test,
                 &logStatus,
                 &saveModels,
-                &evalOutput,
+                &startValidation,
+                &finishValidation,
+                &evalTrainOutput,
+                &waitTrainEvals,
                 &validds,
                 &trainEvalIds,
                 &startEpoch,
-                reducer](
+                &tracer,
+                &batchAudioSec,
+                &logThroughput,
+                reducer,
+                lossScaler](
                    std::shared_ptr<fl::Module> ntwrk,
                    std::shared_ptr<SequenceCriterion> crit,
                    std::shared_ptr<W2lDataset> trainset,
@@ -443,11 +838,54 @@ int main(int argc, char** argv) {
                    double initcritlr,
                    bool clampCrit,
                    int nepochs) {
-    if (reducer) {
+    // With gradient accumulation, the gradients are only reduced once the
+    // last batch of a step is done. So are they with --oomsplit, a batch
+    // being possibly backwarded again in parts.
+    bool reduceInBackward = FLAGS_accumulate_steps == 1 && !FLAGS_oomsplit;
+    if (reducer && reduceInBackward) {
       fl::distributeModuleGrads(ntwrk, reducer);
       fl::distributeModuleGrads(crit, reducer);
     }
 
+    // With --oomsplit, a batch which runs out of memory is forwarded and
+    // backwarded again in 2, 4... parts. It may have added part of its
+    // gradients, so the gradients of the step start over.
+    auto backwardInParts = [&](const std::vector<af::array>& sample) {
+      int64_t batchSize = sample[kInputIdx].dims(3);
+      for (int nParts = 2;; nParts *= 2) {
+        LOG(WARNING) << "Out of memory, splitting a batch of " << batchSize
+                     << " samples in " << std::min<int64_t>(nParts, batchSize)
+                     << " parts - "
+                     << join(",", readSampleIds(sample[kSampleIdx]));
+        netopt->zeroGrad();
+        critopt->zeroGrad();
+        af::deviceGC();
+        try {
+          std::vector<af::array> losses;
+          for (const auto& part : splitBatch(sample, nParts)) {
+            auto output = ntwrk->forward({fl::input(part[kInputIdx])}).front();
+            auto loss =
+                crit->forward({output, fl::noGrad(part[kTargetIdx])}).front();
+            if (lossScaler) {
+              (loss * lossScaler->scale()).backward();
+            } else {
+              loss.backward();
+            }
+            losses.push_back(loss.array());
+          }
+          for (const auto& loss : losses) {
+            meters.train.loss.add(loss);
+          }
+          return;
+        } catch (const af::exception& ex) {
+          if (ex.err() != AF_ERR_NO_MEM || nParts >= batchSize) {
+            throw;
+          }
+        }
+      }
+    };
+
+    waitTrainEvals();
     meters.train.loss.reset();
     meters.train.tknEdit.reset();
     meters.train.wrdEdit.reset();
@@ -462,6 +900,7 @@ int main(int argc, char** argv) {
       meters.fwdtimer.reset();
       meters.critfwdtimer.reset();
       meters.bwdtimer.reset();
+      meters.commtimer.reset();
       meters.optimtimer.reset();
       meters.timer.reset();
     };
@@ -472,22 +911,28 @@ int main(int argc, char** argv) {
       meters.fwdtimer.stop();
       meters.critfwdtimer.stop();
       meters.bwdtimer.stop();
+      meters.commtimer.stop();
       meters.optimtimer.stop();
+      waitTrainEvals();
 
-      // valid
-      for (auto& vds : validds) {
-        test(ntwrk, crit, vds.second, meters.valid[vds.first]);
-      }
+      if (FLAGS_validasync) {
+        startValidation(ntwrk, crit, epoch, lr, lrcrit);
+      } else {
+        // valid
+        for (auto& vds : validds) {
+          test(ntwrk, crit, vds.second, meters.valid[vds.first]);
+        }
 
-      // print status
-      try {
-        logStatus(meters, epoch, lr, lrcrit);
-      } catch (const std::exception& ex) {
-        LOG(ERROR) << "Error while writing logs: " << ex.what();
+        // print status
+        try {
+          logStatus(meters, epoch, lr, lrcrit);
+        } catch (const std::exception& ex) {
+          LOG(ERROR) << "Error while writing logs: " << ex.what();
+        }
       }
-      // save last and best models
+      // save last and best models (the best ones once validated)
       try {
-        saveModels(epoch);
+        saveModels(epoch, !FLAGS_validasync);
       } catch (const std::exception& ex) {
         LOG(FATAL) << "Error while saving models: " << ex.what();
       }
@@ -499,6 +944,18 @@ int main(int argc, char** argv) {
 
     int64_t curEpoch = startEpoch;
     int64_t sampleIdx = 0;
+    // Batches whose gradients are accumulated for the next step, and batches
+    // since the last report
+    int64_t accumulated = 0;
+    int64_t sinceReport = 0;
+    // Updates done, for the LR warmup (estimated from the epoch if continued)
+    int64_t nUpdates = startEpoch *
+        ((trainset->size() + FLAGS_accumulate_steps - 1) /
+         FLAGS_accumulate_steps);
+    std::unique_ptr<DataEcho> dataEcho;
+    if (FLAGS_dataecho > 1) {
+      dataEcho = fl::cpp::make_unique<DataEcho>(FLAGS_dataecho);
+    }
     while (curEpoch < nepochs) {
       double lrScale = 1;
       if (FLAGS_lrcosine) {
@@ -524,97 +981,246 @@ int main(int argc, char** argv) {
       meters.sampletimer.resume();
       meters.runtime.resume();
       meters.timer.resume();
+      tracer.begin("data");
       LOG_MASTER(INFO) << "Epoch " << curEpoch << " started!";
+      int64_t epochBatches = 0;
+      // Throughput of the epoch, the validations aside
+      int64_t epochSamples = 0;
+      double epochAudioSec = 0;
+      std::chrono::duration<double> epochValidation(0);
+      auto epochStart = std::chrono::steady_clock::now();
+      auto dataStart = epochStart;
       for (auto& sample : *trainset) {
         // meters
         ++sampleIdx;
+        ++epochBatches;
         af::sync();
-        meters.timer.incUnit();
+        tracer.end();
         meters.sampletimer.stopAndIncUnit();
         meters.stats.add(sample[kInputIdx], sample[kTargetIdx]);
+        epochSamples += sample[kInputIdx].dims(3);
+        epochAudioSec +=
+            batchAudioSec(*trainset, epochBatches - 1, sample[kInputIdx]);
         if (af::anyTrue<bool>(af::isNaN(sample[kInputIdx])) ||
             af::anyTrue<bool>(af::isNaN(sample[kTargetIdx]))) {
           LOG(FATAL) << "Sample has NaN values - "
                      << join(",", readSampleIds(sample[kSampleIdx]));
         }
+        auto computeStart = std::chrono::steady_clock::now();
+        std::chrono::duration<double> waited = computeStart - dataStart;
+        auto validationBefore = epochValidation;
+
+        // With --dataecho, each echo of the batch is a step of its own
+        int64_t echoes = dataEcho ? dataEcho->factor() : 1;
+        for (int64_t echo = 0; echo < echoes; ++echo) {
+          ++sinceReport;
+          meters.timer.incUnit();
+
+          // The gradients of --accumulate_steps batches (or of the rest of the
+          // epoch) are accumulated before each step
+          if (accumulated == 0) {
+            netopt->zeroGrad();
+            critopt->zeroGrad();
+          }
+          ++accumulated;
+          bool isStep = accumulated == FLAGS_accumulate_steps ||
+              (epochBatches == trainset->size() && echo == echoes - 1);
+
+          int tracerDepth = tracer.depth();
+          try {
+            // forward
+            meters.fwdtimer.resume();
+            auto output =
+                tracedForward(*ntwrk, {fl::input(sample[kInputIdx])}, tracer)
+                    .front();
+            af::sync();
+            meters.critfwdtimer.resume();
+            tracer.begin("criterion");
+            auto loss =
+                crit->forward({output, fl::noGrad(sample[kTargetIdx])}).front();
+            tracer.end();
+            af::sync();
+            meters.fwdtimer.stopAndIncUnit();
+            meters.critfwdtimer.stopAndIncUnit();
+
+            if (af::anyTrue<bool>(af::isNaN(loss.array()))) {
+              LOG(FATAL) << "Loss has NaN values. Samples - "
+                         << join(",", readSampleIds(sample[kSampleIdx]));
+            }
+            int64_t batchIdx = (sampleIdx - 1) % trainset->size();
+            int64_t globalBatchIdx = trainset->getGlobalBatchIdx(batchIdx);
+            if (echo == 0 &&
+                trainEvalIds.find(globalBatchIdx) != trainEvalIds.end()) {
+              evalTrainOutput(output.array(), sample[kTargetIdx]);
+            }
+
+            // backward
+            meters.bwdtimer.resume();
+            tracer.begin("backward");
+            if (lossScaler) {
+              (loss * lossScaler->scale()).backward();
+            } else {
+              loss.backward();
+            }
+            tracer.end();
+            meters.train.loss.add(loss.array());
+          } catch (const af::exception& ex) {
+            if (!FLAGS_oomsplit || ex.err() != AF_ERR_NO_MEM) {
+              throw;
+            }
+            while (tracer.depth() > tracerDepth) {
+              tracer.end();
+            }
+            meters.fwdtimer.stop();
+            meters.critfwdtimer.stop();
+            meters.bwdtimer.resume();
+            if (accumulated > 1) {
+              LOG(WARNING) << "Dropping the gradients of " << accumulated - 1
+                           << " accumulated batches";
+              accumulated = 1;
+            }
+            backwardInParts(sample);
+          }
+          if (reducer && isStep) {
+            // Time left to wait for the reduction once the backward is done
+            meters.commtimer.resume();
+            tracer.begin("allreduce");
+            if (!reduceInBackward) {
+              // Not reduced by the backward: add the accumulated gradients,
+              // last layers first
+              auto params = ntwrk->params();
+              auto critparams = crit->params();
+              params.insert(params.end(), critparams.begin(), critparams.end());
+              for (auto it = params.rbegin(); it != params.rend(); ++it) {
+                if (it->isGradAvailable()) {
+                  reducer->add(it->grad());
+                }
+              }
+            }
+            reducer->finalize();
+            tracer.end();
+            af::sync();
+            meters.commtimer.stopAndIncUnit();
+          }
+          af::sync();
+          meters.bwdtimer.stopAndIncUnit();
+          if (!isStep) {
+            continue;
+          }
 
-        // forward
-        meters.fwdtimer.resume();
-        auto output = ntwrk->forward({fl::input(sample[kInputIdx])}).front();
-        af::sync();
-        meters.critfwdtimer.resume();
-        auto loss =
-            crit->forward({output, fl::noGrad(sample[kTargetIdx])}).front();
-        af::sync();
-        meters.fwdtimer.stopAndIncUnit();
-        meters.critfwdtimer.stopAndIncUnit();
-
-        if (af::anyTrue<bool>(af::isNaN(loss.array()))) {
-          LOG(FATAL) << "Loss has NaN values. Samples - "
-                     << join(",", readSampleIds(sample[kSampleIdx]));
-        }
-        meters.train.loss.add(loss.array());
-
-        int64_t batchIdx = (sampleIdx - 1) % trainset->size();
-        int64_t globalBatchIdx = trainset->getGlobalBatchIdx(batchIdx);
-        if (trainEvalIds.find(globalBatchIdx) != trainEvalIds.end()) {
-          evalOutput(output.array(), sample[kTargetIdx], meters.train);
-        }
-
-        // backward
-        meters.bwdtimer.resume();
-        netopt->zeroGrad();
-        critopt->zeroGrad();
-        loss.backward();
-        if (reducer) {
-          reducer->finalize();
-        }
-        af::sync();
-        meters.bwdtimer.stopAndIncUnit();
-
-        // optimizer
-        meters.optimtimer.resume();
-
-        // scale down gradients by batchsize
-        for (const auto& p : ntwrk->params()) {
-          p.grad() = p.grad() / FLAGS_batchsize;
-        }
-        for (const auto& p : crit->params()) {
-          p.grad() = p.grad() / FLAGS_batchsize;
-        }
+          // optimizer
+          meters.optimtimer.resume();
+          tracer.begin("optimizer");
 
-        // clamp gradients
-        if (FLAGS_maxgradnorm > 0) {
-          auto params = ntwrk->params();
-          if (clampCrit) {
+          // with --amp, unscale the gradients and skip the steps which overflow
+          bool finiteGrads = true;
+          if (lossScaler) {
+            auto params = ntwrk->params();
             auto critparams = crit->params();
             params.insert(params.end(), critparams.begin(), critparams.end());
+            finiteGrads = lossScaler->unscale(params);
+          }
+          if (finiteGrads) {
+            // scale down gradients by batchsize
+            for (const auto& p : ntwrk->params()) {
+              p.grad() = p.grad() / (FLAGS_batchsize * accumulated);
+            }
+            for (const auto& p : crit->params()) {
+              p.grad() = p.grad() / (FLAGS_batchsize * accumulated);
+            }
+
+            // clamp gradients
+            if (FLAGS_maxgradnorm > 0) {
+              auto params = ntwrk->params();
+              if (clampCrit) {
+                auto critparams = crit->params();
+                params.insert(
+                    params.end(), critparams.begin(), critparams.end());
+              }
+              fl::clipGradNorm(params, FLAGS_maxgradnorm);
+            }
+
+            // linear LR warmup over the first --warmup updates
+            if (nUpdates < FLAGS_warmup) {
+              double warmupScale = (nUpdates + 1.0) / FLAGS_warmup;
+              netopt->setLr(warmupScale * lrScale * initlr);
+              critopt->setLr(warmupScale * lrScale * initcritlr);
+            } else if (nUpdates == FLAGS_warmup && FLAGS_warmup > 0) {
+              netopt->setLr(lrScale * initlr);
+              critopt->setLr(lrScale * initcritlr);
+            }
+            ++nUpdates;
+
+            // update weights
+            critopt->step();
+            netopt->step();
+          }
+          accumulated = 0;
+          tracer.end();
+          af::sync();
+          meters.optimtimer.stopAndIncUnit();
+
+          if (FLAGS_reportiters > 0 && sinceReport >= FLAGS_reportiters) {
+            sinceReport = 0;
+            auto validationStart = std::chrono::steady_clock::now();
+            tracer.begin("validation");
+            runValAndSaveModel(curEpoch, netopt->getLr(), critopt->getLr());
+            tracer.end();
+            epochValidation +=
+                std::chrono::steady_clock::now() - validationStart;
+            tracer.flush();
+            resetTimeStatMeters();
+            ntwrk->train();
+            crit->train();
+            meters.runtime.resume();
+            meters.timer.resume();
           }
-          fl::clipGradNorm(params, FLAGS_maxgradnorm);
         }
 
-        // update weights
-        critopt->step();
-        netopt->step();
-        af::sync();
-        meters.optimtimer.stopAndIncUnit();
-        meters.sampletimer.resume();
-
-        if (FLAGS_reportiters > 0 && sampleIdx % FLAGS_reportiters == 0) {
-          runValAndSaveModel(curEpoch, netopt->getLr(), critopt->getLr());
-          resetTimeStatMeters();
-          ntwrk->train();
-          crit->train();
-          meters.sampletimer.resume();
-          meters.runtime.resume();
-          meters.timer.resume();
+        if (dataEcho) {
+          std::chrono::duration<double> computed =
+              std::chrono::steady_clock::now() - computeStart -
+              (epochValidation - validationBefore);
+          if (dataEcho->add(
+                  waited.count(),
+                  computed.count(),
+                  trainset->prefetchStats())) {
+            // The processes must take as many steps
+            if (FLAGS_enable_distributed) {
+              af::array factors = af::constant(0, fl::getWorldSize(), s64);
+              factors(fl::getWorldRank()) = dataEcho->factor();
+              fl::allReduce(factors);
+              dataEcho->setFactor(af::max<int64_t>(factors));
+            }
+            if (dataEcho->factor() != echoes) {
+              LOG_MASTER(INFO) << "Echoing each batch " << dataEcho->factor()
+                               << " times";
+            }
+          }
         }
+        meters.sampletimer.resume();
+        dataStart = std::chrono::steady_clock::now();
+        tracer.begin("data");
       }
+      tracer.end();
       af::sync();
+      LOG_MASTER(INFO) << "Epoch " << curEpoch << " data prefetching - "
+                       << trainset->prefetchStats().toString();
+      std::chrono::duration<double> epochTime =
+          std::chrono::steady_clock::now() - epochStart - epochValidation;
+      logThroughput(
+          "Epoch " + std::to_string(curEpoch),
+          epochSamples,
+          epochAudioSec,
+          epochTime.count());
       if (FLAGS_reportiters == 0) {
+        tracer.begin("validation");
         runValAndSaveModel(curEpoch, netopt->getLr(), critopt->getLr());
+        tracer.end();
+        tracer.flush();
       }
     }
+    finishValidation();
   };
 
   /* ===================== Train ===================== */
@@ -664,6 +1270,7 @@ int main(int argc, char** argv) {
       true /* clampCrit */,
       FLAGS_iter);
 
+  checkpointWriter.wait();
   LOG_MASTER(INFO) << "Finished training";
   return 0;
 }
@@ -15,6 +15,7 @@ from wav2letter.decoder import (
     KenLM,
     LexiconDecoder,
     SmearingMode,
+    StreamingSession,
     Trie,
 )
 
@@ -181,11 +182,12 @@ if __name__ == "__main__":
     #                transitiona matrix, is token-level lm)
     decoder = LexiconDecoder(opts, trie, lm, sil_idx, -1, unk_idx, transitions, False)
     # run decoding
-    # decoder.decode(emissions, Time, Ntokens)
+    # decoder.decode(emissions) with a T x N float32 array, read without a
+    # copy (or decoder.decode(emissions.ctypes.data, T, N) with a pointer)
     # result is a list of sorted hypothesis, 0-index is the best hypothesis
     # each hypothesis is a struct with "score" and "words" representation
     # in the hypothesis and the "tokens" representation
-    results = decoder.decode(emissions.ctypes.data, T, N)
+    results = decoder.decode(emissions.reshape(T, N))
 
     print(f"Decoding complete, obtained {len(results)} results")
     print("Showing top 5 results:")
@@ -202,3 +204,13 @@ if __name__ == "__main__":
     hyp_score_target = [-284.0998, -284.108, -284.119, -284.127, -284.296]
     for i in range(min(5, len(results))):
         assert_near(results[i].score, hyp_score_target[i], 1e-3)
+
+    # streaming: feed the emissions by chunks, each chunk returns the words
+    # which can not change any more, finish() returns the remaining ones
+    session = StreamingSession(decoder)
+    streamed = []
+    chunk = 100
+    for t in range(0, T, chunk):
+        streamed += session.feed(emissions.reshape(T, N)[t : t + chunk])
+    streamed += session.finish()
+    assert streamed == [w for w in results[0].words if w >= 0]
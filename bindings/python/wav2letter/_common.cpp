@@ -29,6 +29,14 @@ void Dictionary_addEntry_1(Dictionary& dict, const std::string& entry) {
   dict.addEntry(entry);
 }
 
+int Dictionary_getIndex(const Dictionary& dict, const std::string& entry) {
+  return dict.getIndex(entry);
+}
+
+bool Dictionary_contains(const Dictionary& dict, const std::string& entry) {
+  return dict.contains(entry);
+}
+
 } // namespace
 
 PYBIND11_MODULE(_common, m) {
@@ -41,8 +49,10 @@ PYBIND11_MODULE(_common, m) {
       .def("add_entry", &Dictionary_addEntry_1, "entry"_a)
       .def("get_entry", &Dictionary::getEntry, "idx"_a)
       .def("set_default_index", &Dictionary::setDefaultIndex, "idx"_a)
-      .def("get_index", &Dictionary::getIndex, "entry"_a)
-      .def("contains", &Dictionary::contains, "entry"_a)
+      .def("get_index", &Dictionary_getIndex, "entry"_a)
+      .def("contains", &Dictionary_contains, "entry"_a)
+      .def("freeze", &Dictionary::freeze)
+      .def("is_frozen", &Dictionary::isFrozen)
       .def("is_contiguous", &Dictionary::isContiguous)
       .def(
           "map_entries_to_indices",
@@ -54,7 +64,13 @@ PYBIND11_MODULE(_common, m) {
           "indices"_a);
 
   m.def("create_word_dict", &createWordDict, "lexicon"_a);
-  m.def("load_words", &loadWords, "filename"_a, "max_words"_a = -1);
+  // Parsed by several native threads, without the GIL
+  m.def(
+      "load_words",
+      &loadWords,
+      "filename"_a,
+      "max_words"_a = -1,
+      py::call_guard<py::gil_scoped_release>());
   m.def("tkn_to_idx", &tkn2Idx, "spelling"_a, "token_dict"_a, "max_reps"_a);
   m.def("pack_replabels", &packReplabels, "tokens"_a, "dict"_a, "max_reps"_a);
   m.def(
@@ -6,6 +6,8 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <string>
+
 #include <pybind11/pybind11.h>
 
 #include "libraries/criterion/cpu/ForceAlignmentCriterion.h"
@@ -21,18 +23,21 @@
 namespace py = pybind11;
 using namespace w2l;
 
+// The pointers are passed as bytes, converted to strings by pybind11 before
+// the GIL is released: the ops only touch C++ objects while they run
 template <class T>
-static T castBytes(const py::bytes& b) {
+static T castBytes(const std::string& s) {
   static_assert(
       std::is_standard_layout<T>::value,
       "types represented as bytes must be standard layout");
-  std::string s = b;
   if (s.size() != sizeof(T)) {
     throw std::runtime_error("wrong py::bytes size to represent object");
   }
   return *reinterpret_cast<const T*>(s.data());
 }
 
+using ReleaseGil = py::call_guard<py::gil_scoped_release>;
+
 using CpuFAC = cpu::ForceAlignmentCriterion<float>;
 using CpuFCC = cpu::FullConnectionCriterion<float>;
 using CpuViterbi = cpu::ViterbiPath<float>;
@@ -43,12 +48,12 @@ static void CpuFAC_forward(
     int N,
     int L,
     CriterionScaleMode scaleMode,
-    py::bytes input,
-    py::bytes target,
-    py::bytes targetSize,
-    py::bytes trans,
-    py::bytes loss,
-    py::bytes workspace) {
+    const std::string& input,
+    const std::string& target,
+    const std::string& targetSize,
+    const std::string& trans,
+    const std::string& loss,
+    const std::string& workspace) {
   CpuFAC::forward(
       B,
       T,
@@ -68,12 +73,12 @@ static void CpuFAC_backward(
     int T,
     int N,
     int L,
-    py::bytes target,
-    py::bytes targetSize,
-    py::bytes grad,
-    py::bytes inputGrad,
-    py::bytes transGrad,
-    py::bytes workspace) {
+    const std::string& target,
+    const std::string& targetSize,
+    const std::string& grad,
+    const std::string& inputGrad,
+    const std::string& transGrad,
+    const std::string& workspace) {
   CpuFAC::backward(
       B,
       T,
@@ -92,11 +97,11 @@ static void CpuFCC_forward(
     int T,
     int N,
     CriterionScaleMode scaleMode,
-    py::bytes input,
-    py::bytes targetSize,
-    py::bytes trans,
-    py::bytes loss,
-    py::bytes workspace) {
+    const std::string& input,
+    const std::string& targetSize,
+    const std::string& trans,
+    const std::string& loss,
+    const std::string& workspace) {
   CpuFCC::forward(
       B,
       T,
@@ -113,11 +118,11 @@ static void CpuFCC_backward(
     int B,
     int T,
     int N,
-    py::bytes trans,
-    py::bytes grad,
-    py::bytes inputGrad,
-    py::bytes transGrad,
-    py::bytes workspace) {
+    const std::string& trans,
+    const std::string& grad,
+    const std::string& inputGrad,
+    const std::string& transGrad,
+    const std::string& workspace) {
   CpuFCC::backward(
       B,
       T,
@@ -133,10 +138,10 @@ static void CpuViterbi_compute(
     int B,
     int T,
     int N,
-    py::bytes input,
-    py::bytes trans,
-    py::bytes path,
-    py::bytes workspace) {
+    const std::string& input,
+    const std::string& trans,
+    const std::string& path,
+    const std::string& workspace) {
   CpuViterbi::compute(
       B,
       T,
@@ -159,13 +164,13 @@ static void CudaFAC_forward(
     int N,
     int L,
     CriterionScaleMode scaleMode,
-    py::bytes input,
-    py::bytes target,
-    py::bytes targetSize,
-    py::bytes trans,
-    py::bytes loss,
-    py::bytes workspace,
-    py::bytes stream) {
+    const std::string& input,
+    const std::string& target,
+    const std::string& targetSize,
+    const std::string& trans,
+    const std::string& loss,
+    const std::string& workspace,
+    const std::string& stream) {
   CudaFAC::forward(
       B,
       T,
@@ -186,13 +191,13 @@ static void CudaFAC_backward(
     int T,
     int N,
     int L,
-    py::bytes target,
-    py::bytes targetSize,
-    py::bytes grad,
-    py::bytes inputGrad,
-    py::bytes transGrad,
-    py::bytes workspace,
-    py::bytes stream) {
+    const std::string& target,
+    const std::string& targetSize,
+    const std::string& grad,
+    const std::string& inputGrad,
+    const std::string& transGrad,
+    const std::string& workspace,
+    const std::string& stream) {
   CudaFAC::backward(
       B,
       T,
@@ -212,12 +217,12 @@ static void CudaFCC_forward(
     int T,
     int N,
     CriterionScaleMode scaleMode,
-    py::bytes input,
-    py::bytes targetSize,
-    py::bytes trans,
-    py::bytes loss,
-    py::bytes workspace,
-    py::bytes stream) {
+    const std::string& input,
+    const std::string& targetSize,
+    const std::string& trans,
+    const std::string& loss,
+    const std::string& workspace,
+    const std::string& stream) {
   CudaFCC::forward(
       B,
       T,
@@ -235,12 +240,12 @@ static void CudaFCC_backward(
     int B,
     int T,
     int N,
-    py::bytes trans,
-    py::bytes grad,
-    py::bytes inputGrad,
-    py::bytes transGrad,
-    py::bytes workspace,
-    py::bytes stream) {
+    const std::string& trans,
+    const std::string& grad,
+    const std::string& inputGrad,
+    const std::string& transGrad,
+    const std::string& workspace,
+    const std::string& stream) {
   CudaFCC::backward(
       B,
       T,
@@ -257,11 +262,11 @@ static void CudaViterbi_compute(
     int B,
     int T,
     int N,
-    py::bytes input,
-    py::bytes trans,
-    py::bytes path,
-    py::bytes workspace,
-    py::bytes stream) {
+    const std::string& input,
+    const std::string& trans,
+    const std::string& path,
+    const std::string& workspace,
+    const std::string& stream) {
   CudaViterbi::compute(
       B,
       T,
@@ -285,33 +290,33 @@ PYBIND11_MODULE(_criterion, m) {
 
   py::class_<CpuFAC>(m, "CpuForceAlignmentCriterion")
       .def("get_workspace_size", &CpuFAC::getWorkspaceSize)
-      .def("forward", &CpuFAC_forward)
-      .def("backward", &CpuFAC_backward);
+      .def("forward", &CpuFAC_forward, ReleaseGil())
+      .def("backward", &CpuFAC_backward, ReleaseGil());
 
   py::class_<CpuFCC>(m, "CpuFullConnectionCriterion")
       .def("get_workspace_size", &CpuFCC::getWorkspaceSize)
-      .def("forward", &CpuFCC_forward)
-      .def("backward", &CpuFCC_backward);
+      .def("forward", &CpuFCC_forward, ReleaseGil())
+      .def("backward", &CpuFCC_backward, ReleaseGil());
 
   py::class_<CpuViterbi>(m, "CpuViterbiPath")
       .def("get_workspace_size", &CpuViterbi::getWorkspaceSize)
-      .def("compute", &CpuViterbi_compute);
+      .def("compute", &CpuViterbi_compute, ReleaseGil());
 
 #ifdef W2L_LIBRARIES_USE_CUDA
   m.attr("sizeof_cuda_stream") = py::int_(sizeof(cudaStream_t));
 
   py::class_<CudaFAC>(m, "CudaForceAlignmentCriterion")
       .def("get_workspace_size", &CudaFAC::getWorkspaceSize)
-      .def("forward", &CudaFAC_forward)
-      .def("backward", &CudaFAC_backward);
+      .def("forward", &CudaFAC_forward, ReleaseGil())
+      .def("backward", &CudaFAC_backward, ReleaseGil());
 
   py::class_<CudaFCC>(m, "CudaFullConnectionCriterion")
       .def("get_workspace_size", &CudaFCC::getWorkspaceSize)
-      .def("forward", &CudaFCC_forward)
-      .def("backward", &CudaFCC_backward);
+      .def("forward", &CudaFCC_forward, ReleaseGil())
+      .def("backward", &CudaFCC_backward, ReleaseGil());
 
   py::class_<CudaViterbi>(m, "CudaViterbiPath")
       .def("get_workspace_size", &CudaViterbi::getWorkspaceSize)
-      .def("compute", &CudaViterbi_compute);
+      .def("compute", &CudaViterbi_compute, ReleaseGil());
 #endif // W2L_LIBRARIES_USE_CUDA
 }
@@ -6,9 +6,20 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <pybind11/numpy.h>
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 
+#include "libraries/common/WordUtils.h"
+#include "libraries/decoder/BiasingTrie.h"
 #include "libraries/decoder/LexiconDecoder.h"
 
 #ifdef W2L_LIBRARIES_USE_KENLM
@@ -96,6 +107,115 @@ class PyLM : public LM {
  *          return (outstate, -1)
  *```
  */
+/* A node of the state tree of an utterance, with the handle of the BatchLM */
+struct BatchLMState : LMState {
+  int64_t handle = 0;
+};
+
+/**
+ * A language model defined in Python with integer state handles, for custom
+ * (e.g. neural) LMs. The decoders gather the LM queries of a frame, which
+ * BatchLM answers with a single Python call on NumPy arrays, rather than one
+ * call per query as with LM. The handles are whatever the LM keeps its
+ * states by; the decoder tells hypotheses apart by their history, as for KenLM.
+ *
+ * ```python
+ * from wav2letter.decoder import BatchLM
+ * class MyBatchLM(BatchLM):
+ *     def __init__(self):
+ *         BatchLM.__init__(self)
+ *
+ *     def start_state(self, start_with_nothing):
+ *         return 0 # the handle of the start state
+ *
+ *     def score_batch(self, states, tokens):
+ *         # int64 and int32 arrays of the same length: the new states, and
+ *         # the scores of `tokens` after `states`
+ *         return (states + 1, -numpy.ones(len(states), dtype=numpy.float32))
+ *
+ *     def finish_state(self, state):
+ *         return (state + 1, -1.0)
+ * ```
+ */
+class BatchLM : public LM {
+ public:
+  LMStatePtr start(bool startWithNothing) override {
+    py::gil_scoped_acquire gil;
+    auto state = std::make_shared<BatchLMState>();
+    state->handle = method("start_state")(startWithNothing).cast<int64_t>();
+    return state;
+  }
+
+  std::pair<LMStatePtr, float> score(
+      const LMStatePtr& state,
+      const int usrTokenIdx) override {
+    std::vector<LMStatePtr> outStates;
+    std::vector<float> scores;
+    scoreBatch({state}, {usrTokenIdx}, outStates, scores);
+    return {outStates[0], scores[0]};
+  }
+
+  std::pair<LMStatePtr, float> finish(const LMStatePtr& state) override {
+    py::gil_scoped_acquire gil;
+    auto result = method("finish_state")(handle(state)).cast<py::tuple>();
+    auto outState = state->child<BatchLMState>(-1);
+    outState->handle = result[0].cast<int64_t>();
+    return {outState, result[1].cast<float>()};
+  }
+
+  void scoreBatch(
+      const std::vector<LMStatePtr>& states,
+      const std::vector<int>& usrTokenIdx,
+      std::vector<LMStatePtr>& outStates,
+      std::vector<float>& scores) override {
+    outStates.resize(states.size());
+    scores.resize(states.size());
+    if (states.empty()) {
+      return;
+    }
+    py::gil_scoped_acquire gil;
+    py::array_t<int64_t> handles(states.size());
+    py::array_t<int> tokens(states.size());
+    auto handlesData = handles.mutable_data();
+    for (size_t i = 0; i < states.size(); ++i) {
+      handlesData[i] = handle(states[i]);
+    }
+    std::copy(usrTokenIdx.begin(), usrTokenIdx.end(), tokens.mutable_data());
+
+    auto result = method("score_batch")(handles, tokens).cast<py::tuple>();
+    auto outHandles = result[0].cast<
+        py::array_t<int64_t, py::array::c_style | py::array::forcecast>>();
+    auto outScores = result[1].cast<
+        py::array_t<float, py::array::c_style | py::array::forcecast>>();
+    if (outHandles.size() != states.size() ||
+        outScores.size() != states.size()) {
+      throw std::runtime_error(
+          "BatchLM.score_batch must return a state and a score per query");
+    }
+    for (size_t i = 0; i < states.size(); ++i) {
+      auto outState = states[i]->child<BatchLMState>(usrTokenIdx[i]);
+      outState->handle = outHandles.data()[i];
+      outStates[i] = outState;
+      scores[i] = outScores.data()[i];
+    }
+  }
+
+ private:
+  static int64_t handle(const LMStatePtr& state) {
+    return static_cast<const BatchLMState*>(state.get())->handle;
+  }
+
+  /* The method `name` of the Python subclass */
+  py::function method(const char* name) const {
+    auto fn = py::get_overload(static_cast<const BatchLM*>(this), name);
+    if (!fn) {
+      throw std::runtime_error(
+          std::string("BatchLM subclasses must define ") + name);
+    }
+    return fn;
+  }
+};
+
 void LexiconDecoder_decodeStep(
     LexiconDecoder& decoder,
     uintptr_t emissions,
@@ -112,6 +232,207 @@ std::vector<DecodeResult> LexiconDecoder_decode(
   return decoder.decode(reinterpret_cast<const float*>(emissions), T, N);
 }
 
+// The T x N emissions of a NumPy array, read from its buffer. Contiguous
+// float32 arrays are not copied
+using EmissionsArray =
+    py::array_t<float, py::array::c_style | py::array::forcecast>;
+
+void checkEmissions(const EmissionsArray& emissions) {
+  if (emissions.ndim() != 2) {
+    throw std::invalid_argument("emissions must be a T x N array");
+  }
+}
+
+void LexiconDecoder_decodeStepArray(
+    LexiconDecoder& decoder,
+    const EmissionsArray& emissions) {
+  checkEmissions(emissions);
+  py::gil_scoped_release release;
+  decoder.decodeStep(
+      emissions.data(), emissions.shape(0), emissions.shape(1));
+}
+
+std::vector<DecodeResult> LexiconDecoder_decodeArray(
+    LexiconDecoder& decoder,
+    const EmissionsArray& emissions) {
+  checkEmissions(emissions);
+  py::gil_scoped_release release;
+  return decoder.decode(
+      emissions.data(), emissions.shape(0), emissions.shape(1));
+}
+
+/**
+ * Decodes the utterances on `numThreads` native threads, without the GIL.
+ * Each thread decodes with its own copy of `decoder`, which shares its trie
+ * and LM (a Python LM is called with the GIL, so it is not concurrent).
+ * Returns the hypotheses of each utterance, as decode() does.
+ */
+std::vector<std::vector<DecodeResult>> LexiconDecoder_decodeBatch(
+    const LexiconDecoder& decoder,
+    const std::vector<EmissionsArray>& emissions,
+    int numThreads) {
+  for (const auto& emission : emissions) {
+    checkEmissions(emission);
+  }
+  numThreads = std::max(
+      1, std::min<int>(numThreads, static_cast<int>(emissions.size())));
+  // Copied with the GIL: the copies hold references to Python objects
+  std::vector<LexiconDecoder> decoders(numThreads, decoder);
+  std::vector<std::vector<DecodeResult>> results(emissions.size());
+  std::vector<std::exception_ptr> errors(numThreads);
+  std::atomic<size_t> next(0);
+  {
+    py::gil_scoped_release release;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < numThreads; ++t) {
+      threads.emplace_back([&, t]() {
+        try {
+          for (size_t i = next++; i < emissions.size(); i = next++) {
+            results[i] = decoders[t].decode(
+                emissions[i].data(),
+                emissions[i].shape(0),
+                emissions[i].shape(1));
+          }
+        } catch (...) {
+          errors[t] = std::current_exception();
+          next = emissions.size();
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+  }
+  // Destroyed with the GIL too
+  decoders.clear();
+  for (const auto& error : errors) {
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+  return results;
+}
+
+/**
+ * Builds the smeared trie of the lexicon file `path` without going through
+ * Python: the lexicon is parsed by the parallel loader, and the words are
+ * scored by `lm` from its start state (word LM), or -1 without LM. Returns
+ * the trie and the dictionary of the words, as create_word_dict() would.
+ */
+std::pair<FlatTriePtr, Dictionary> buildTrie(
+    const std::string& path,
+    const Dictionary& tokenDict,
+    int silIdx,
+    const LMPtr& lm,
+    int maxReps,
+    SmearingMode smearing,
+    int maxWords) {
+  auto lexicon = loadWords(path, maxWords);
+  auto wordDict = createWordDict(lexicon);
+  Trie trie(tokenDict.indexSize(), silIdx);
+  LMStatePtr startState = lm ? lm->start(false) : nullptr;
+  for (const auto& entry : lexicon) {
+    int usrIdx = wordDict.getIndex(entry.first);
+    float score = -1;
+    if (lm) {
+      LMStatePtr dummyState;
+      std::tie(dummyState, score) = lm->score(startState, usrIdx);
+    }
+    for (const auto& tokens : entry.second) {
+      trie.insert(tkn2Idx(tokens, tokenDict, maxReps), usrIdx, score);
+    }
+  }
+  trie.smear(smearing);
+  return std::make_pair(std::make_shared<FlatTrie>(trie), wordDict);
+}
+
+/**
+ * A streaming utterance decoded by a LexiconDecoder, which shouldn't be used
+ * for anything else until `finish()` (it shares its LM state). Each chunk of
+ * emissions returns the words which became stable, and only the unstable
+ * frames are kept, so that the cost of a chunk doesn't depend on the length
+ * of the stream.
+ *
+ * ```python
+ * session = StreamingSession(decoder)
+ * for chunk in chunks:  # T' x N float32 arrays
+ *     emit(session.feed(chunk))  # word indices
+ *     show(session.partial().words)  # may still change
+ * emit(session.finish())
+ * ```
+ */
+class StreamingSession {
+ public:
+  explicit StreamingSession(LexiconDecoder& decoder) : decoder_(decoder) {
+    decoder_.setStableWordsCallback([this](const std::vector<int>& words) {
+      stableWords_.insert(stableWords_.end(), words.begin(), words.end());
+    });
+    decoder_.decodeBegin();
+  }
+
+  ~StreamingSession() {
+    if (!finished_) {
+      decoder_.setStableWordsCallback(nullptr);
+    }
+  }
+
+  StreamingSession(const StreamingSession&) = delete;
+  StreamingSession& operator=(const StreamingSession&) = delete;
+
+  /* Decodes the next frames, returns the words which became stable */
+  std::vector<int> feed(const EmissionsArray& emissions) {
+    checkEmissions(emissions);
+    checkRunning();
+    {
+      py::gil_scoped_release release;
+      decoder_.decodeStep(
+          emissions.data(), emissions.shape(0), emissions.shape(1));
+      decoder_.pruneStable();
+    }
+    return takeStableWords();
+  }
+
+  /* The best hypothesis after the stable words, one entry per frame */
+  DecodeResult partial() const {
+    return decoder_.getPartialHypothesis();
+  }
+
+  /* Ends the stream, returns the words not returned by feed() yet */
+  std::vector<int> finish() {
+    checkRunning();
+    {
+      py::gil_scoped_release release;
+      decoder_.decodeEnd();
+    }
+    finished_ = true;
+    decoder_.setStableWordsCallback(nullptr);
+    auto words = takeStableWords();
+    for (int word : decoder_.getPartialHypothesis().words) {
+      if (word >= 0) {
+        words.push_back(word);
+      }
+    }
+    return words;
+  }
+
+ private:
+  LexiconDecoder& decoder_;
+  std::vector<int> stableWords_;
+  bool finished_ = false;
+
+  void checkRunning() const {
+    if (finished_) {
+      throw std::logic_error("StreamingSession: the stream is finished");
+    }
+  }
+
+  std::vector<int> takeStableWords() {
+    std::vector<int> words;
+    words.swap(stableWords_);
+    return words;
+  }
+};
+
 } // namespace
 
 PYBIND11_MODULE(_decoder, m) {
@@ -133,7 +454,57 @@ PYBIND11_MODULE(_decoder, m) {
       .def("get_root", &Trie::getRoot)
       .def("insert", &Trie::insert, "indices"_a, "label"_a, "score"_a)
       .def("search", &Trie::search, "indices"_a)
-      .def("smear", &Trie::smear, "smear_mode"_a);
+      .def("smear", &Trie::smear, "smear_mode"_a)
+      .def("smear_path", &Trie::smearPath, "indices"_a, "smear_mode"_a)
+      .def("fork", &Trie::fork);
+
+  // The compiled trie read by the decoders: built from a Trie or by
+  // build_trie(), saved and memory-mapped back instantly by load()
+  py::class_<FlatTrieNode>(m, "FlatTrieNode")
+      .def_readonly("idx", &FlatTrieNode::idx)
+      .def_readonly("max_score", &FlatTrieNode::maxScore)
+      .def_readonly("n_children", &FlatTrieNode::nChildren)
+      .def_readonly("n_labels", &FlatTrieNode::nLabels);
+
+  py::class_<FlatTrie, FlatTriePtr>(m, "FlatTrie")
+      .def(py::init<const Trie&>(), "trie"_a)
+      .def_static(
+          "load",
+          &FlatTrie::load,
+          "path"_a,
+          py::call_guard<py::gil_scoped_release>())
+      .def(
+          "save",
+          &FlatTrie::save,
+          "path"_a,
+          "fingerprint"_a = "",
+          py::call_guard<py::gil_scoped_release>())
+      .def("fingerprint", &FlatTrie::fingerprint)
+      .def("n_nodes", &FlatTrie::nNodes)
+      .def("n_labels", &FlatTrie::nLabels)
+      .def(
+          "search",
+          &FlatTrie::search,
+          "indices"_a,
+          py::return_value_policy::reference_internal);
+
+  m.def(
+      "build_trie",
+      &buildTrie,
+      "lexicon_path"_a,
+      "token_dict"_a,
+      "sil_idx"_a,
+      "lm"_a = nullptr,
+      "max_reps"_a = 0,
+      "smearing"_a = SmearingMode::MAX,
+      "max_words"_a = -1,
+      py::call_guard<py::gil_scoped_release>());
+
+  py::class_<BiasingTrie, std::shared_ptr<BiasingTrie>>(m, "BiasingTrie")
+      .def(py::init<>())
+      .def("insert", &BiasingTrie::insert, "phrase"_a, "bonus"_a)
+      .def("next", &BiasingTrie::next, "state"_a, "word"_a)
+      .def("finish", &BiasingTrie::finish, "state"_a);
 
   py::class_<LM, LMPtr, PyLM>(m, "LM")
       .def(py::init<>())
@@ -147,18 +518,37 @@ PYBIND11_MODULE(_decoder, m) {
       .def("compare", &LMState::compare, "state"_a)
       .def("child", &LMState::child<LMState>, "usr_index"_a);
 
+  py::class_<BatchLM, LM, std::shared_ptr<BatchLM>>(m, "BatchLM")
+      .def(py::init<>());
+
 #ifdef W2L_LIBRARIES_USE_KENLM
+  py::enum_<KenLMLoadMethod>(m, "KenLMLoadMethod")
+      .value("LAZY", KenLMLoadMethod::LAZY)
+      .value("POPULATE", KenLMLoadMethod::POPULATE)
+      .value("READ", KenLMLoadMethod::READ);
+
   py::class_<KenLM, KenLMPtr, LM>(m, "KenLM")
       .def(
-          py::init<const std::string&, const Dictionary&>(),
+          py::init<
+              const std::string&,
+              const Dictionary&,
+              size_t,
+              KenLMLoadMethod>(),
           "path"_a,
-          "usr_token_dict"_a);
+          "usr_token_dict"_a,
+          "cache_size"_a = 0,
+          "load_method"_a = KenLMLoadMethod::POPULATE);
 #endif
 
   py::enum_<CriterionType>(m, "CriterionType")
       .value("ASG", CriterionType::ASG)
       .value("CTC", CriterionType::CTC);
 
+  py::enum_<EarlyStopping>(m, "EarlyStopping")
+      .value("NONE", EarlyStopping::NONE)
+      .value("BOUND", EarlyStopping::BOUND)
+      .value("HEURISTIC", EarlyStopping::HEURISTIC);
+
   py::class_<DecoderOptions>(m, "DecoderOptions")
       .def(
           py::init<
@@ -191,7 +581,18 @@ PYBIND11_MODULE(_decoder, m) {
       .def_readwrite("sil_score", &DecoderOptions::silScore)
       .def_readwrite("eos_score", &DecoderOptions::silScore)
       .def_readwrite("log_add", &DecoderOptions::logAdd)
-      .def_readwrite("criterion_type", &DecoderOptions::criterionType);
+      .def_readwrite("criterion_type", &DecoderOptions::criterionType)
+      .def_readwrite("target_candidates", &DecoderOptions::targetCandidates)
+      .def_readwrite("step_time_budget", &DecoderOptions::stepTimeBudget)
+      .def_readwrite(
+          "blank_skip_threshold", &DecoderOptions::blankSkipThreshold)
+      .def_readwrite("lm_lookahead_words", &DecoderOptions::lmLookaheadWords)
+      .def_readwrite(
+          "lm_lookahead_cache_size", &DecoderOptions::lmLookaheadCacheSize)
+      .def_readwrite("expand_threads", &DecoderOptions::expandThreads)
+      .def_readwrite("early_stopping", &DecoderOptions::earlyStopping)
+      .def_readwrite(
+          "length_normalization", &DecoderOptions::lengthNormalization);
 
   py::class_<DecodeResult>(m, "DecodeResult")
       .def(py::init<int>(), "length"_a)
@@ -199,7 +600,8 @@ PYBIND11_MODULE(_decoder, m) {
       .def_readwrite("words", &DecodeResult::words)
       .def_readwrite("tokens", &DecodeResult::tokens);
 
-  // NB: `decode` and `decodeStep` expect raw emissions pointers.
+  // NB: `decode` and `decodeStep` take a T x N NumPy array, or a raw
+  // emissions pointer with T and N. They run without the GIL.
   py::class_<LexiconDecoder>(m, "LexiconDecoder")
       .def(py::init<
            const DecoderOptions&,
@@ -210,19 +612,75 @@ PYBIND11_MODULE(_decoder, m) {
            const int,
            const std::vector<float>&,
            const bool>())
+      .def(py::init<
+           const DecoderOptions&,
+           const FlatTriePtr,
+           const LMPtr,
+           const int,
+           const int,
+           const int,
+           const std::vector<float>&,
+           const bool>())
       .def("decode_begin", &LexiconDecoder::decodeBegin)
+      .def("decode_step", &LexiconDecoder_decodeStepArray, "emissions"_a)
       .def(
           "decode_step",
           &LexiconDecoder_decodeStep,
           "emissions"_a,
           "T"_a,
-          "N"_a)
-      .def("decode_end", &LexiconDecoder::decodeEnd)
-      .def("decode", &LexiconDecoder_decode, "emissions"_a, "T"_a, "N"_a)
+          "N"_a,
+          py::call_guard<py::gil_scoped_release>())
+      .def(
+          "decode_end",
+          &LexiconDecoder::decodeEnd,
+          py::call_guard<py::gil_scoped_release>())
+      .def("decode", &LexiconDecoder_decodeArray, "emissions"_a)
+      .def(
+          "decode",
+          &LexiconDecoder_decode,
+          "emissions"_a,
+          "T"_a,
+          "N"_a,
+          py::call_guard<py::gil_scoped_release>())
+      .def(
+          "decode_batch",
+          &LexiconDecoder_decodeBatch,
+          "emissions"_a,
+          "num_threads"_a = 1)
+      .def(
+          "set_biasing",
+          [](LexiconDecoder& decoder, std::shared_ptr<BiasingTrie> biasing) {
+            decoder.setBiasing(biasing);
+          },
+          "biasing"_a)
+      .def("set_lexicon", &LexiconDecoder::setLexicon, "lexicon"_a)
+      .def(
+          "snapshot",
+          [](const LexiconDecoder& decoder) {
+            std::ostringstream out;
+            decoder.snapshot(out);
+            return py::bytes(out.str());
+          })
+      .def(
+          "restore",
+          [](LexiconDecoder& decoder, const std::string& snapshot) {
+            std::istringstream in(snapshot);
+            decoder.restore(in);
+          },
+          "snapshot"_a)
       .def("prune", &LexiconDecoder::prune, "look_back"_a = 0)
       .def(
           "get_best_hypothesis",
           &LexiconDecoder::getBestHypothesis,
           "look_back"_a = 0)
-      .def("get_all_final_hypothesis", &LexiconDecoder::getAllFinalHypothesis);
+      .def("get_all_final_hypothesis", &LexiconDecoder::getAllFinalHypothesis)
+      .def("get_partial_hypothesis", &LexiconDecoder::getPartialHypothesis)
+      .def("prune_stable", &LexiconDecoder::pruneStable);
+
+  py::class_<StreamingSession>(m, "StreamingSession")
+      .def(
+          py::init<LexiconDecoder&>(), "decoder"_a, py::keep_alive<1, 2>())
+      .def("feed", &StreamingSession::feed, "emissions"_a)
+      .def("partial", &StreamingSession::partial)
+      .def("finish", &StreamingSession::finish);
 }
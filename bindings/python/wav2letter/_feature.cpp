@@ -6,6 +6,9 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <algorithm>
+
+#include <pybind11/numpy.h>
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 
@@ -40,6 +43,97 @@ using PreEmphasis = w2l::PreEmphasis<float>;
 using TriFilterbank = w2l::TriFilterbank<float>;
 using Windowing = w2l::Windowing<float>;
 
+namespace {
+
+// Any array-like input, converted to contiguous floats only if it isn't
+using FloatArray =
+    py::array_t<float, py::array::c_style | py::array::forcecast>;
+// The arrays modified in place, which can't be converted copies: they are
+// float32 and contiguous already
+using MutableFloatArray = py::array_t<float, py::array::c_style>;
+
+/* The input of the C++ featurization, copied at once from the buffer */
+std::vector<float> toVector(const FloatArray& array) {
+  return std::vector<float>(array.data(), array.data() + array.size());
+}
+
+/* A NumPy array owning `values`, which are moved rather than copied */
+FloatArray toArray(std::vector<float>&& values) {
+  auto owned = new std::vector<float>(std::move(values));
+  py::capsule owner(owned, [](void* ptr) {
+    delete static_cast<std::vector<float>*>(ptr);
+  });
+  return FloatArray(owned->size(), owned->data(), owner);
+}
+
+/**
+ * The features computed by `fn` without the GIL, so that other Python threads
+ * run meanwhile. A featurizer object still computes one signal at a time
+ */
+template <class Fn>
+FloatArray withoutGil(Fn fn) {
+  std::vector<float> values;
+  {
+    py::gil_scoped_release release;
+    values = fn();
+  }
+  return toArray(std::move(values));
+}
+
+/* Applies `fn` to a copy of `array`, which is then written back */
+template <class Fn>
+void applyInPlace(MutableFloatArray& array, Fn fn) {
+  auto values = std::vector<float>(array.data(), array.data() + array.size());
+  {
+    py::gil_scoped_release release;
+    fn(values);
+  }
+  std::copy(values.begin(), values.end(), array.mutable_data());
+}
+
+/* The featurization of the classes applying a signal to features */
+template <class Featurizer>
+void defFeaturizer(py::class_<Featurizer>& cls) {
+  cls.def(
+         "apply",
+         [](Featurizer& self, const FloatArray& input) {
+           auto in = toVector(input);
+           return withoutGil([&]() { return self.apply(in); });
+         },
+         "input"_a)
+      .def(
+          "batch_apply",
+          [](Featurizer& self, const FloatArray& input, int64_t batchSz) {
+            auto in = toVector(input);
+            return withoutGil([&]() { return self.batchApply(in, batchSz); });
+          },
+          "input"_a,
+          "batch_sz"_a)
+      .def("output_size", &Featurizer::outputSize, "input_sz"_a)
+      .def("get_feature_params", &Featurizer::getFeatureParams);
+}
+
+/* apply() and apply_in_place() of the transforms keeping the input size */
+template <class Transform>
+void defTransform(py::class_<Transform>& cls) {
+  cls.def(
+         "apply",
+         [](Transform& self, const FloatArray& input) {
+           auto in = toVector(input);
+           return withoutGil([&]() { return self.apply(in); });
+         },
+         "input"_a)
+      .def(
+          "apply_in_place",
+          [](Transform& self, MutableFloatArray input) {
+            applyInPlace(
+                input, [&](std::vector<float>& v) { self.applyInPlace(v); });
+          },
+          "input"_a.noconvert());
+}
+
+} // namespace
+
 PYBIND11_MODULE(_feature, m) {
   py::enum_<WindowType>(m, "WindowType")
       .value("HAMMING", WindowType::HAMMING)
@@ -112,44 +206,64 @@ PYBIND11_MODULE(_feature, m) {
       .def_readwrite("use_power", &FeatureParams::usePower)
       .def_readwrite("use_energy", &FeatureParams::useEnergy)
       .def_readwrite("raw_energy", &FeatureParams::rawEnergy)
-      .def_readwrite("zero_mean_frame", &FeatureParams::zeroMeanFrame);
+      .def_readwrite("zero_mean_frame", &FeatureParams::zeroMeanFrame)
+      .def_readwrite("fast_log", &FeatureParams::fastLog);
 
-  py::class_<Ceplifter>(m, "Ceplifter")
-      .def(py::init<int64_t, int64_t>(), "num_filters"_a, "lifter_param"_a)
-      .def("apply", &Ceplifter::apply, "input"_a)
-      .def("apply_in_place", &Ceplifter::applyInPlace, "input"_a);
+  // The signals and features are NumPy arrays of floats; the features
+  // returned own their buffer, which is not copied
+  py::class_<Ceplifter> ceplifter(m, "Ceplifter");
+  ceplifter.def(
+      py::init<int64_t, int64_t>(), "num_filters"_a, "lifter_param"_a);
+  defTransform(ceplifter);
   py::class_<Dct>(m, "Dct")
       .def(py::init<int64_t, int64_t>(), "num_filters"_a, "num_ceps"_a)
-      .def("apply", &Dct::apply, "input"_a);
+      .def(
+          "apply",
+          [](Dct& self, const FloatArray& input) {
+            auto in = toVector(input);
+            return withoutGil([&]() { return self.apply(in); });
+          },
+          "input"_a);
   py::class_<Derivatives>(m, "Derivatives")
       .def(py::init<int64_t, int64_t>(), "delta_window"_a, "acc_window"_a)
-      .def("apply", &Derivatives::apply, "input"_a, "num_feat"_a);
+      .def(
+          "apply",
+          [](Derivatives& self, const FloatArray& input, int64_t numFeat) {
+            auto in = toVector(input);
+            return withoutGil([&]() { return self.apply(in, numFeat); });
+          },
+          "input"_a,
+          "num_feat"_a);
   py::class_<Dither>(m, "Dither")
       .def(py::init<float>(), "dither_val"_a)
-      .def("apply", &Dither::apply, "input"_a)
-      .def("apply_in_place", &Dither::applyInPlace, "input"_a);
-  py::class_<Mfcc>(m, "Mfcc")
-      .def(py::init<const FeatureParams&>(), "params"_a)
-      .def("apply", &Mfcc::apply, "input"_a)
-      .def("batch_apply", &Mfcc::batchApply, "input"_a, "batch_sz"_a)
-      .def("output_size", &Mfcc::outputSize, "input_sz"_a)
-      .def("get_feature_params", &Mfcc::getFeatureParams);
-  py::class_<Mfsc>(m, "Mfsc")
-      .def(py::init<const FeatureParams&>(), "params"_a)
-      .def("apply", &Mfsc::apply, "input"_a)
-      .def("batch_apply", &Mfsc::batchApply, "input"_a, "batch_sz"_a)
-      .def("output_size", &Mfsc::outputSize, "input_sz"_a)
-      .def("get_feature_params", &Mfsc::getFeatureParams);
-  py::class_<PowerSpectrum>(m, "PowerSpectrum")
-      .def(py::init<const FeatureParams&>(), "params"_a)
-      .def("apply", &PowerSpectrum::apply, "input"_a)
-      .def("batch_apply", &PowerSpectrum::batchApply, "input"_a, "batch_sz"_a)
-      .def("output_size", &PowerSpectrum::outputSize, "input_sz"_a)
-      .def("get_feature_params", &PowerSpectrum::getFeatureParams);
-  py::class_<PreEmphasis>(m, "PreEmphasis")
-      .def(py::init<float, int64_t>(), "alpha"_a, "N"_a)
-      .def("apply", &PreEmphasis::apply, "input"_a)
-      .def("apply_in_place", &PreEmphasis::applyInPlace, "input"_a);
+      .def(
+          "apply",
+          [](Dither& self, const FloatArray& input) {
+            auto in = toVector(input);
+            return withoutGil([&]() { return self.apply(in); });
+          },
+          "input"_a)
+      .def(
+          "apply_in_place",
+          [](Dither& self, MutableFloatArray input) {
+            auto data = input.mutable_data();
+            auto size = input.size();
+            py::gil_scoped_release release;
+            self.applyInPlace(data, size);
+          },
+          "input"_a.noconvert());
+  py::class_<Mfcc> mfcc(m, "Mfcc");
+  mfcc.def(py::init<const FeatureParams&>(), "params"_a);
+  defFeaturizer(mfcc);
+  py::class_<Mfsc> mfsc(m, "Mfsc");
+  mfsc.def(py::init<const FeatureParams&>(), "params"_a);
+  defFeaturizer(mfsc);
+  py::class_<PowerSpectrum> powerSpectrum(m, "PowerSpectrum");
+  powerSpectrum.def(py::init<const FeatureParams&>(), "params"_a);
+  defFeaturizer(powerSpectrum);
+  py::class_<PreEmphasis> preEmphasis(m, "PreEmphasis");
+  preEmphasis.def(py::init<float, int64_t>(), "alpha"_a, "N"_a);
+  defTransform(preEmphasis);
   py::class_<TriFilterbank>(m, "TriFilterbank")
       .def(
           py::init<
@@ -165,13 +279,39 @@ PYBIND11_MODULE(_feature, m) {
           "low_freq"_a = 0,
           "high_freq"_a = -1,
           "freq_scale"_a = FrequencyScale::MEL)
-      .def("apply", &TriFilterbank::apply, "input"_a, "mel_floor"_a = 0.0)
-      .def("filterbank", &TriFilterbank::filterbank);
-  py::class_<Windowing>(m, "Windowing")
-      .def(py::init<int64_t, WindowType>(), "N"_a, "window"_a)
-      .def("apply", &Windowing::apply, "input"_a)
-      .def("apply_in_place", &Windowing::applyInPlace, "input"_a);
-
-  m.def("frame_signal", w2l::frameSignal<float>, "input"_a, "params"_a);
-  m.def("cblas_gemm", w2l::cblasGemm<float>, "A"_a, "B"_a, "n"_a, "k"_a);
+      .def(
+          "apply",
+          [](TriFilterbank& self, const FloatArray& input, float melFloor) {
+            auto in = toVector(input);
+            return withoutGil([&]() { return self.apply(in, melFloor); });
+          },
+          "input"_a,
+          "mel_floor"_a = 0.0)
+      .def("filterbank", [](TriFilterbank& self) {
+        return toArray(self.filterbank());
+      });
+  py::class_<Windowing> windowing(m, "Windowing");
+  windowing.def(py::init<int64_t, WindowType>(), "N"_a, "window"_a);
+  defTransform(windowing);
+
+  m.def(
+      "frame_signal",
+      [](const FloatArray& input, const FeatureParams& params) {
+        auto in = toVector(input);
+        return withoutGil(
+            [&]() { return w2l::frameSignal<float>(in, params); });
+      },
+      "input"_a,
+      "params"_a);
+  m.def(
+      "cblas_gemm",
+      [](const FloatArray& A, const FloatArray& B, int n, int k) {
+        auto a = toVector(A);
+        auto b = toVector(B);
+        return withoutGil([&]() { return w2l::cblasGemm<float>(a, b, n, k); });
+      },
+      "A"_a,
+      "B"_a,
+      "n"_a,
+      "k"_a);
 }
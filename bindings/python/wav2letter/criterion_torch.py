@@ -12,8 +12,8 @@ def get_data_ptr_as_bytes(tensor):
     return struct.pack("P", tensor.data_ptr())
 
 
-def get_cuda_stream_as_bytes():
-    s = torch.cuda.current_stream().cuda_stream
+def get_cuda_stream_as_bytes(device=None):
+    s = torch.cuda.current_stream(device).cuda_stream
     return s.to_bytes(_C.sizeof_cuda_stream, byteorder=sys.byteorder)
 
 
@@ -27,13 +27,15 @@ def check_tensor(tensor, size, dtype, device):
 def run_direction(cls, device, direction, *args):
     """
     Select and run CPU/CUDA implementation of `forward()` or `backward()`.
-    If CUDA, create the right device context and also pass the CUDA stream.
+    If CUDA, create the right device context and also pass the CUDA stream:
+    the kernels are queued on the current stream of the device, as PyTorch ops
+    are, and the call returns without waiting for them.
     """
     device = torch.device(device)
     if device.type == "cuda":
         with torch.cuda.device(device):
             fn = getattr(cls.cuda_impl(), direction)
-            fn(*args, get_cuda_stream_as_bytes())
+            fn(*args, get_cuda_stream_as_bytes(device))
     elif device.type == "cpu":
         fn = getattr(cls.cpu_impl(), direction)
         fn(*args)
@@ -62,7 +64,9 @@ def run_get_workspace_size(cls, device, *args):
 def create_workspace(cls, device, *args):
     """
     Select and run CPU/CUDA implementation of `get_workspace_size()`,
-    then return a byte tensor of appropriate size.
+    then return a byte tensor of appropriate size. The tensor comes from the
+    caching allocator of PyTorch, on the current stream, so that workspaces
+    are reused across calls without cudaMalloc nor synchronization.
     """
     workspace_size = run_get_workspace_size(cls, device, *args)
     return torch.empty(workspace_size, dtype=torch.uint8, device=device)
@@ -315,3 +319,59 @@ class ASGLoss(nn.Module):
         ) - FACFunction.apply(
             input, target, target_size, self.transitions, self.scale_mode
         )
+
+    def viterbi(self, input):
+        """
+        Best path of each sample for the learned transitions, see ViterbiPath.
+        """
+        return ViterbiPath.compute(input, self.transitions.detach())
+
+
+class ViterbiPath:
+    """
+    Best paths of the ASG graph, computed on the current CUDA stream for CUDA
+    tensors, without autograd.
+    """
+
+    @staticmethod
+    def cuda_impl():
+        return _C.CudaViterbiPath
+
+    @staticmethod
+    def cpu_impl():
+        return _C.CpuViterbiPath
+
+    @classmethod
+    def compute(cls, input, transitions):
+        """
+        Parameters:
+        -----------
+        input: float torch.tensor of the size [Batch, Time, Ntokens]
+        transitions: float torch.tensor of size [Ntokens, Ntokens]
+
+        Returns an int torch.tensor of the size [Batch, Time] with the tokens
+        of the best path of each sample.
+        """
+        B = input.size(0)
+        T = input.size(1)
+        N = input.size(2)
+        device = input.device
+
+        input_float = check_tensor(input, [B, T, N], torch.float, device)
+        transitions_float = check_tensor(transitions, [N, N], torch.float, device)
+
+        path = torch.empty(B, T, dtype=torch.int, device=device)
+        workspace = create_workspace(cls, device, B, T, N)
+        run_direction(
+            cls,
+            device,
+            "compute",
+            B,
+            T,
+            N,
+            get_data_ptr_as_bytes(input_float),
+            get_data_ptr_as_bytes(transitions_float),
+            get_data_ptr_as_bytes(path),
+            get_data_ptr_as_bytes(workspace),
+        )
+        return path
@@ -6,9 +6,9 @@ printf "<fairseq_style>\n<pad>\n</s>\n<unk>\n" > "$MODEL_DST/decoder/convlm_mode
 cut -f1 -d " " "$MODEL_DST/decoder/fairseq_word_data/dict.txt" >> "$MODEL_DST/decoder/convlm_models/lm_wsj_convlm_word_14B.vocab"
 printf "<fairseq_style>\n<pad>\n</s>\n<unk>\n" > "$MODEL_DST/decoder/convlm_models/lm_wsj_convlm_char_20B.vocab"
 cut -f1 -d " " "$MODEL_DST/decoder/fairseq_char_data/dict.txt" >> "$MODEL_DST/decoder/convlm_models/lm_wsj_convlm_char_20B.vocab"
-python3 ../../utilities/convlm_serializer/save_pytorch_model.py "$MODEL_DST/decoder/convlm_models/word_14B/checkpoint_best.pt" "$MODEL_DST/decoder/convlm_models/lm_wsj_convlm_word_14B.weights"
-python3 ../../utilities/convlm_serializer/save_pytorch_model.py "$MODEL_DST/decoder/convlm_models/char_14B/checkpoint_best.pt" "$MODEL_DST/decoder/convlm_models/lm_wsj_convlm_char_14B.weights"
-python3 ../../utilities/convlm_serializer/save_pytorch_model.py "$MODEL_DST/decoder/convlm_models/char_20B/checkpoint_best.pt" "$MODEL_DST/decoder/convlm_models/lm_wsj_convlm_char_20B.weights"
+python3 ../../utilities/convlm_serializer/save_pytorch_model.py "$MODEL_DST/decoder/convlm_models/word_14B/checkpoint_best.pt" "$MODEL_DST/decoder/convlm_models/lm_wsj_convlm_word_14B.weights" binary
+python3 ../../utilities/convlm_serializer/save_pytorch_model.py "$MODEL_DST/decoder/convlm_models/char_14B/checkpoint_best.pt" "$MODEL_DST/decoder/convlm_models/lm_wsj_convlm_char_14B.weights" binary
+python3 ../../utilities/convlm_serializer/save_pytorch_model.py "$MODEL_DST/decoder/convlm_models/char_20B/checkpoint_best.pt" "$MODEL_DST/decoder/convlm_models/lm_wsj_convlm_char_20B.weights" binary
 "$WAV2LETTER/build/recipes/models/utilities/convlm_serializer/SerializeConvLM" \
   lm_wsj_convlm_word_14B.arch \
   "$MODEL_DST/decoder/convlm_models/lm_wsj_convlm_word_14B.weights" \
@@ -1,8 +1,14 @@
 #include "recipes/models/utilities/convlm_serializer/Utils.h"
+#include <cereal/archives/json.hpp>
+#include <cereal/types/string.hpp>
+#include <cereal/types/vector.hpp>
 #include <glog/logging.h>
 #include <module/module.h>
+#include <cstring>
 #include <fstream>
+#include <sstream>
 #include "common/Utils.h"
+#include "libraries/common/MemoryMappedFile.h"
 
 using fl::Variable;
 using std::dynamic_pointer_cast;
@@ -11,10 +17,125 @@ using std::shared_ptr;
 using std::string;
 using std::vector;
 
+namespace {
+
+// First bytes of a binary dump of save_pytorch_model.py
+const char kBinaryMagic[] = "W2LCLMB1";
+const size_t kBinaryMagicSize = sizeof(kBinaryMagic) - 1;
+
+// A tensor of the JSON header of a binary dump: C-ordered float32 elements,
+// little-endian, at `offset` bytes from the start of the file
+struct BinaryTensorInfo {
+  string name;
+  vector<int64_t> shape;
+  int64_t offset;
+
+  template <class Archive>
+  void serialize(Archive& ar) {
+    ar(CEREAL_NVP(name), CEREAL_NVP(shape), CEREAL_NVP(offset));
+  }
+};
+
+ConvLMParamState makeState(
+    const string& weightName,
+    const vector<int64_t>& shapes,
+    const float* data) {
+  int nDims = shapes.size();
+  auto parts = w2l::splitOnAnyOf(".", weightName, true);
+  LOG_IF(FATAL, parts.size() < 2)
+      << "Param name " << weightName
+      << " should be in format {prefix.}layerName.paramName";
+  vector<string> names = {w2l::join(".", parts.begin(), parts.end() - 2),
+                          *(parts.end() - 2),
+                          *(parts.end() - 1)};
+
+  LOG_IF(FATAL, names.size() != 3)
+      << "[LoadModelStates]: Error during parsing parameter name";
+
+  af::dim4 dimensions(1, 1, 1, 1);
+  // af has fortran-ordering (column-way)
+  // revert axis before loading c-ordered matrices (row-way)
+  vector<int> reordering = {0, 1, 2, 3};
+  LOG_IF(FATAL, nDims > 4) << "[loadModelStates]: Layer " << weightName
+                           << " has dimensions greater than 4. "
+                           << "This is not supported by ArrayFire";
+  for (int idx = nDims - 1; idx >= 0; idx--) {
+    dimensions[nDims - 1 - idx] = shapes[idx];
+    reordering[nDims - 1 - idx] = idx;
+  }
+  af::array weights = af::array(dimensions, data);
+  weights = reorder(
+      weights, reordering[0], reordering[1], reordering[2], reordering[3]);
+  return {names[0], names[1], names[2], weights};
+}
+
+bool isBinaryDump(const string& weightFile) {
+  std::ifstream infile(weightFile, std::ios::binary);
+  char magic[kBinaryMagicSize];
+  return infile.read(magic, kBinaryMagicSize) &&
+      std::memcmp(magic, kBinaryMagic, kBinaryMagicSize) == 0;
+}
+
+/**
+ * Binary dump: the magic, the size of the JSON header as a little-endian
+ * uint64, the header, then the tensors. The file is memory-mapped and each
+ * tensor is copied once from its pages into its array, with no parsing.
+ */
+vector<ConvLMParamState> loadBinaryModelStates(const string& weightFile) {
+  w2l::MemoryMappedFile file(weightFile);
+  const size_t headerStart = kBinaryMagicSize + sizeof(uint64_t);
+  LOG_IF(FATAL, file.size() < headerStart)
+      << "[LoadModelStates]: Truncated weight file " << weightFile;
+  uint64_t headerSize;
+  std::memcpy(&headerSize, file.data() + kBinaryMagicSize, sizeof(headerSize));
+  LOG_IF(FATAL, headerSize > file.size() - headerStart)
+      << "[LoadModelStates]: Truncated header in " << weightFile;
+
+  vector<BinaryTensorInfo> tensors;
+  {
+    std::istringstream header(string(file.data() + headerStart, headerSize));
+    cereal::JSONInputArchive ar(header);
+    ar(cereal::make_nvp("tensors", tensors));
+  }
+
+  vector<ConvLMParamState> states;
+  for (const auto& tensor : tensors) {
+    int64_t totalElements = 1;
+    string shape_str = "";
+    for (auto dim : tensor.shape) {
+      totalElements *= dim;
+      shape_str += std::to_string(dim) + " ";
+    }
+    LOG(INFO) << "[LoadModelStates]: Reading state " << tensor.name
+              << " with dims " << tensor.shape.size() << " and shape "
+              << shape_str;
+    LOG_IF(
+        FATAL,
+        tensor.offset < 0 ||
+            static_cast<uint64_t>(tensor.offset) < headerStart + headerSize ||
+            tensor.offset % sizeof(float) != 0 ||
+            totalElements * sizeof(float) > file.size() - tensor.offset)
+        << "[LoadModelStates]: State " << tensor.name
+        << " is out of the weight file";
+    states.push_back(makeState(
+        tensor.name,
+        tensor.shape,
+        reinterpret_cast<const float*>(file.data() + tensor.offset)));
+  }
+  // The arrays are copied before the file is unmapped
+  af::sync();
+  return states;
+}
+
+} // namespace
+
 vector<ConvLMParamState> loadModelStates(const string& weightFile) {
   LOG(INFO) << "[ConvLMSerializer]: Reading pytorch model of the ConvLM";
   LOG_IF(FATAL, !w2l::fileExists(weightFile))
       << "Path to weight file " << weightFile << " doesn't exist";
+  if (isBinaryDump(weightFile)) {
+    return loadBinaryModelStates(weightFile);
+  }
 
   vector<ConvLMParamState> states;
   std::ifstream infile(weightFile);
@@ -27,7 +148,7 @@ vector<ConvLMParamState> loadModelStates(const string& weightFile) {
     ss << line;
     ss >> weightName >> nDims;
 
-    vector<int> shapes(nDims);
+    vector<int64_t> shapes(nDims);
     string shape_str = "";
     for (int dim = 0; dim < nDims; dim++) {
       ss >> shapes[dim];
@@ -40,33 +161,7 @@ vector<ConvLMParamState> loadModelStates(const string& weightFile) {
     for (int index = 0; index < totalElements; index++) {
       ss >> data[index];
     }
-
-    auto parts = w2l::splitOnAnyOf(".", weightName, true);
-    LOG_IF(FATAL, parts.size() < 2)
-        << "Param name " << weightName
-        << " should be in format {prefix.}layerName.paramName";
-    vector<string> names = {w2l::join(".", parts.begin(), parts.end() - 2),
-                            *(parts.end() - 2),
-                            *(parts.end() - 1)};
-
-    LOG_IF(FATAL, names.size() != 3)
-        << "[LoadModelStates]: Error during parsing parameter name";
-
-    af::dim4 dimensions(1, 1, 1, 1);
-    // af has fortran-ordering (column-way)
-    // revert axis before loading c-ordered matrices (row-way)
-    vector<int> reordering = {0, 1, 2, 3};
-    LOG_IF(FATAL, nDims > 4) << "[loadModelStates]: Layer " << weightName
-                             << " has dimensions greater than 4. "
-                             << "This is not supported by ArrayFire";
-    for (int idx = nDims - 1; idx >= 0; idx--) {
-      dimensions[nDims - 1 - idx] = shapes[idx];
-      reordering[nDims - 1 - idx] = idx;
-    }
-    af::array weights = af::array(dimensions, data.data());
-    weights = reorder(
-        weights, reordering[0], reordering[1], reordering[2], reordering[3]);
-    states.push_back({names[0], names[1], names[2], weights});
+    states.push_back(makeState(weightName, shapes, data.data()));
   }
   infile.close();
 
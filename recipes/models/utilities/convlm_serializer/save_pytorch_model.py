@@ -1,16 +1,26 @@
 from __future__ import absolute_import, division, print_function, unicode_literals
+import json
+import struct
 import sys
 from collections import defaultdict
 
+import numpy as np
 import torch
 
 
-def convert(model_state, key, suffix=""):
-    string = ""
+# binary format read by loadModelStates: the magic, the size of the JSON
+# header (little-endian uint64), the header listing the name, shape and file
+# offset of each param, then the params as C-ordered little-endian float32
+BINARY_MAGIC = b"W2LCLMB1"
+BINARY_ALIGNMENT = 64
+
+
+def prepare(model_state, key, suffix=""):
+    """Returns the name, shape and values of a param as the loader expects them"""
     param = model_state[key]
 
     # param name
-    string += ".".join(key.split(".")[1:-1]) + suffix + "." + key.split(".")[-1] + " "
+    name = ".".join(key.split(".")[1:-1]) + suffix + "." + key.split(".")[-1]
     change_to_lin_layer = False
     if "conv" in key and len(param.shape) == 3:
         if ("weight_v" in key and param.shape[0] == 1) or (
@@ -19,50 +29,89 @@ def convert(model_state, key, suffix=""):
         ):
             change_to_lin_layer = True
     if change_to_lin_layer:
-        # param shapes
-        string += (
-            str(len(param.shape) - 1) + " " + " ".join(map(str, param.shape[1:][::-1]))
-        )
-        # param matrix
-        string += " " + " ".join(map(str, param.cpu().numpy()[0].T.flatten()))
+        return name, list(param.shape[1:][::-1]), param.cpu().numpy()[0].T
     else:
-        # param shapes
-        string += str(len(param.shape)) + " " + " ".join(map(str, param.shape))
-        # param matrix
-        string += " " + " ".join(map(str, param.cpu().numpy().flatten()))
+        return name, list(param.shape), param.cpu().numpy()
+
+
+def convert(name, shape, values):
+    # param name, param shapes, param matrix
+    string = name + " " + str(len(shape)) + " " + " ".join(map(str, shape))
+    string += " " + " ".join(map(str, values.flatten()))
     return string
 
 
-def save_model(pytorch_model_path, dst):
+def write_text(params, dst):
+    with open(dst, "w") as f:
+        for param in params:
+            f.write(convert(*param) + "\n")
+
+
+def write_binary(params, dst):
+    def align(offset):
+        return (offset + BINARY_ALIGNMENT - 1) // BINARY_ALIGNMENT * BINARY_ALIGNMENT
+
+    values = [np.ascontiguousarray(v, dtype="<f4") for _, _, v in params]
+    # the offsets depend on the header size: grow it until they fit
+    header_size = 0
+    while True:
+        offset = align(len(BINARY_MAGIC) + 8 + header_size)
+        tensors = []
+        for (name, shape, _), value in zip(params, values):
+            tensors.append({"name": name, "shape": shape, "offset": offset})
+            offset = align(offset + value.nbytes)
+        header = json.dumps({"tensors": tensors}).encode("utf-8")
+        if len(header) <= header_size:
+            break
+        header_size = len(header)
+    header += b" " * (header_size - len(header))
+
+    with open(dst, "wb") as f:
+        f.write(BINARY_MAGIC + struct.pack("<Q", header_size) + header)
+        for tensor, value in zip(tensors, values):
+            f.write(b"\0" * (tensor["offset"] - f.tell()))
+            f.write(value.tobytes())
+
+
+def save_model(pytorch_model_path, dst, binary=False):
     model_state = torch.load(pytorch_model_path)
     model_state = model_state["model"]
-    add_string = ""
+    params = []
+    pending = []
     prev_key = ""
 
-    with open(dst, "w") as f:
-        projections = defaultdict(list)
-        for key in model_state:
-            print("Process param", key)
-            if "version" in key:
-                print("Skip", key)
-                continue
-            if "projection" in key:
-                projections[key.split(".")[-2]].append(
-                    convert(model_state, key, "-projection")
-                )
-            else:
-                if prev_key != key.split(".")[2]:
-                    if add_string != "":
-                        f.write(add_string + "\n")
-                    add_string = ""
-                prev_key = key.split(".")[2]
-                if key.split(".")[2] in projections:
-                    add_string = "\n".join(projections[key.split(".")[2]])
-                f.write(convert(model_state, key) + "\n")
+    projections = defaultdict(list)
+    for key in model_state:
+        print("Process param", key)
+        if "version" in key:
+            print("Skip", key)
+            continue
+        if "projection" in key:
+            projections[key.split(".")[-2]].append(
+                prepare(model_state, key, "-projection")
+            )
+        else:
+            # projections of a layer follow its params
+            if prev_key != key.split(".")[2]:
+                params += pending
+                pending = []
+            prev_key = key.split(".")[2]
+            if key.split(".")[2] in projections:
+                pending = list(projections[key.split(".")[2]])
+            params.append(prepare(model_state, key))
+
+    if binary:
+        write_binary(params, dst)
+    else:
+        write_text(params, dst)
 
 
 if __name__ == "__main__":
-    print("Converting the model. Usage: save_pytorch_model.py [path/to/model] [dst]")
+    print(
+        "Converting the model. "
+        "Usage: save_pytorch_model.py [path/to/model] [dst] {text|binary}"
+    )
     path = sys.argv[1]
     dst = sys.argv[2]
-    save_model(path, dst)
+    binary = len(sys.argv) > 3 and sys.argv[3] == "binary"
+    save_model(path, dst, binary)
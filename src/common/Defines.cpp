@@ -21,6 +21,23 @@ DEFINE_string(train, "", "comma-separated list of training data");
 DEFINE_string(valid, "", "comma-separated list of valid data");
 DEFINE_string(test, "", "comma-separated list of test data");
 DEFINE_int64(batchsize, 1, "batch size (per process in distributed training)");
+DEFINE_double(
+    batchframes,
+    0,
+    "if > 0, pack the samples of similar durations in batches of at most this "
+    "many padded input frames (of framestridems) per process, instead of "
+    "batchsize samples");
+DEFINE_bool(
+    autobatchframes,
+    false,
+    "set batchframes (or lower it) at startup to the largest batches whose "
+    "forward and backward fit in the device memory");
+DEFINE_bool(
+    balancebatches,
+    false,
+    "in distributed training, deal the samples of each global batch of "
+    "batchsize samples per process so that the processes get similar total "
+    "input durations");
 DEFINE_string(input, "flac", "input feature");
 DEFINE_int64(samplerate, 16000, "sample rate (Hz)");
 DEFINE_int64(channels, 1, "number of input channels");
@@ -77,6 +94,29 @@ DEFINE_bool(lrcosine, false, "use cosine learning rate schedule");
 // LEARNING HYPER-PARAMETER OPTIONS
 DEFINE_int64(iter, 1000000, "number of iterations");
 DEFINE_bool(itersave, false, "save model at each iteration");
+DEFINE_int64(
+    accumulate_steps,
+    1,
+    "number of batches whose gradients are accumulated for each optimizer "
+    "step and all-reduce");
+DEFINE_bool(
+    oomsplit,
+    false,
+    "forward and backward a batch which runs out of device memory again in "
+    "2, 4... parts");
+DEFINE_bool(
+    async_checkpoint,
+    false,
+    "snapshot the models in host memory and write them in the background");
+DEFINE_bool(
+    amp,
+    false,
+    "mixed-precision training: fp16 convolution and linear layers with fp32 "
+    "master weights and dynamic loss scaling");
+DEFINE_bool(
+    sharded_checkpoint,
+    false,
+    "save the models as directories of a manifest and parallel-loaded shards");
 DEFINE_double(lr, 1.0, "learning rate");
 DEFINE_double(momentum, 0.0, "momentum factor");
 DEFINE_double(weightdecay, 0.0, "weight decay (L2 penalty)");
@@ -86,6 +126,7 @@ DEFINE_double(adambeta1, 0.9, "beta1 in the Adam optimizer");
 DEFINE_double(adambeta2, 0.999, "beta2 in the Adam optimizer");
 DEFINE_double(optimrho, 0.9, "rho in the optimizer");
 DEFINE_double(optimepsilon, 1e-8, "epsilon in the optimizer");
+DEFINE_double(larseta, 0.001, "trust coefficient in the LARS optimizer");
 
 // LR-SCHEDULER OPTIONS
 DEFINE_int64(
@@ -93,10 +134,22 @@ DEFINE_int64(
     1000000,
     "We multiply LR by gamma every stepsize epochs");
 DEFINE_double(gamma, 1.0, "the LR annealing multiplier");
+DEFINE_int64(
+    warmup,
+    0,
+    "number of updates over which the LR grows linearly to its value");
 
 // OPTIMIZER OPTIONS
 DEFINE_string(netoptim, kSGDoptimizer, "optimizer for the network");
 DEFINE_string(critoptim, kSGDoptimizer, "optimizer for the criterion");
+DEFINE_bool(
+    fuseoptim,
+    false,
+    "update all the parameters of an optimizer with one multi-tensor step");
+DEFINE_bool(
+    shardoptim,
+    false,
+    "partition the optimizer states across the processes (ZeRO-1)");
 
 // MFCC OPTIONS
 DEFINE_bool(mfcc, false, "use standard htk mfcc features as input");
@@ -106,7 +159,77 @@ DEFINE_bool(mfsc, false, "use standard mfsc features as input");
 DEFINE_double(melfloor, 1.0, "specify optional mel floor for mfcc/mfsc/pow");
 DEFINE_int64(filterbanks, 40, "Number of mel-filter bank channels");
 DEFINE_int64(devwin, 0, "Window length for delta and doubledelta derivatives");
+DEFINE_bool(
+    fastlog,
+    false,
+    "compute the log filterbank energies of mfcc/mfsc with a vectorized "
+    "approximation (within 1 ulp) instead of bit-exactly");
 DEFINE_int64(fftcachesize, 1, "number of cached cuFFT plans in GPU memory");
+DEFINE_bool(
+    device_features,
+    false,
+    "compute the -pow, -mfsc or -mfcc features of a batch on the device");
+DEFINE_string(
+    featurecache,
+    "",
+    "directory of an on-disk cache of the -pow, -mfsc or -mfcc features, "
+    "which are then only computed the first epoch; empty to disable");
+DEFINE_int64(
+    validcache_mb,
+    0,
+    "size of an in-memory cache of the featurized batches of the validation "
+    "sets, shared by the sets, which are then only read and decoded once, "
+    "in MB; 0 to disable");
+DEFINE_string(
+    dataindex,
+    "",
+    "directory, on a node-local file system such as /dev/shm, of the indices "
+    "of the list files, built by the first process of a node and memory "
+    "mapped by the others; empty to disable");
+DEFINE_int64(
+    stream_buffer,
+    0,
+    "if > 0, the training list files are read as an endless stream, each "
+    "process its shard, through a shuffle buffer of this many samples, "
+    "instead of being indexed and sorted before the first step");
+DEFINE_int64(
+    stream_bucket_batches,
+    64,
+    "--stream_buffer: number of batches of samples drawn from the buffer "
+    "together, sorted by size and cut into batches");
+DEFINE_int64(
+    stream_epoch_batches,
+    10000,
+    "--stream_buffer: number of batches of an epoch");
+DEFINE_int64(
+    objectstore_cache_mb,
+    1024,
+    "size of the cache of the audio and blobs read from http(s)://, s3:// "
+    "and gs:// URLs, in MB");
+DEFINE_int64(
+    objectstore_block_kb,
+    1024,
+    "size of the blocks read from the object stores, in KB");
+DEFINE_int32(
+    objectstore_readahead,
+    4,
+    "number of blocks prefetched after the ones read from an object store");
+DEFINE_int32(
+    objectstore_threads,
+    16,
+    "number of threads prefetching blocks from the object stores");
+DEFINE_string(
+    specaug_cpu,
+    "",
+    "SpecAugment policy applied to the training batches by the data threads, "
+    "as the arguments of the SAUG layer: 'tWarpW fMaskF nFMask tMaskT tMaskP "
+    "nTMask [globalMean]'; empty to disable");
+DEFINE_string(
+    speedperturb,
+    "",
+    "speed or tempo perturbation of the training audio by the data threads, "
+    "with a factor drawn for each sample by steps of 0.01: 'speed|tempo "
+    "minFactor maxFactor' (e.g. 'speed 0.9 1.1'); empty to disable");
 DEFINE_int64(
     framesizems,
     25,
@@ -124,6 +247,32 @@ DEFINE_string(archdir, "", "arch root directory");
 DEFINE_string(flagsfile, "", "File specifying gflags");
 DEFINE_string(runname, "", "name of current run");
 DEFINE_int64(nthread, 1, "specify number of threads for data parallelization");
+DEFINE_int64(
+    prefetchdepth,
+    0,
+    "number of batches loaded ahead of the training loop by the data threads, "
+    "nthread if 0");
+DEFINE_int64(
+    dataecho,
+    1,
+    "with more than 1, reuse each training batch up to this many times while "
+    "the training waits for the data threads (data echoing), as many as the "
+    "data loading is slower than the training");
+DEFINE_int64(
+    criterionthreads,
+    0,
+    "number of threads over which the CPU criterions split a batch, "
+    "the OpenMP default if 0");
+DEFINE_int64(
+    cputhreads,
+    0,
+    "number of worker threads of the task scheduler which runs the CPU work "
+    "of the process (batch loading, featurization), one per hardware thread "
+    "if 0");
+DEFINE_bool(
+    pinthreads,
+    false,
+    "bind each worker thread of the task scheduler to its own CPU");
 DEFINE_string(
     tag,
     "",
@@ -138,10 +287,58 @@ DEFINE_int64(
     0,
     "number of iterations after which we will run val and save model, \
     if 0 we only do this at end of epoch ");
+DEFINE_bool(
+    trace,
+    false,
+    "write a Chrome trace of the training loop of each rank to the run "
+    "directory");
+DEFINE_bool(
+    trace_sync,
+    true,
+    "synchronize the device at the end of each traced span");
+DEFINE_string(
+    profilemodules,
+    "",
+    "T,B: log the forward and backward times and the device memory of each "
+    "layer of the network on batches of B samples of T frames at startup");
 DEFINE_double(
     pcttraineval,
     100,
     "percentage of training set (by number of utts) to use for evaluation");
+DEFINE_bool(
+    traineval_async,
+    false,
+    "compute the edit distances of the training batches evaluated "
+    "(--pcttraineval) on a background thread, without syncing the loop");
+DEFINE_bool(
+    validasync,
+    false,
+    "validate on copies of the models on a background thread while training "
+    "goes on, the status of a report being logged once validated");
+DEFINE_int64(
+    synthetic_samples,
+    0,
+    "train on this many random samples generated on the device instead of "
+    "--train, to measure the throughput of the training loop alone");
+DEFINE_string(
+    synthetic_frames,
+    "500,1500",
+    "min,max number of frames of the --synthetic_samples, drawn uniformly");
+DEFINE_double(
+    synthetic_framespertoken,
+    8,
+    "number of frames per target token of the --synthetic_samples");
+DEFINE_bool(
+    datapipeline_only,
+    false,
+    "iterate over the training set for an epoch without any model, to "
+    "measure the throughput of the data pipeline alone, and exit");
+DEFINE_bool(
+    ctcgreedypath,
+    false,
+    "decode the CTC emissions of Test and of the evaluations of Train, whose "
+    "blank is the last class, with one kernel collapsing the repeats and "
+    "removing the blanks, instead of the argmax of each frame");
 
 // ARCHITECTURE OPTIONS
 DEFINE_string(arch, "default", "network architecture");
@@ -158,10 +355,56 @@ DEFINE_bool(uselexicon, true, "use lexicon in decoding");
 DEFINE_string(smearing, "none", "none, max or logadd");
 DEFINE_string(lmtype, "kenlm", "kenlm, convlm");
 DEFINE_string(lexicon, "", "path/to/lexicon.txt");
+DEFINE_string(
+    trie,
+    "",
+    "path/to/lexicon_trie.bin, compiled lexicon trie to memory-map (built again from the lexicon, the tokens, the lm and the smearing mode if missing or built from others)");
+DEFINE_string(
+    search_graph,
+    "",
+    "path/to/search.graph, word decoding with the lexicon composed ahead of "
+    "time with the ARPA --lm, memory-mapped (compiled from the lexicon and "
+    "the lm if missing), instead of querying the lm");
+DEFINE_string(
+    bias_phrases,
+    "",
+    "path/to/phrases.txt, phrases of lexicon words boosted by the lexicon "
+    "decoder, one per line after the bonus of each of their words");
 DEFINE_string(lm_vocab, "", "path/to/lm_vocab.txt");
 DEFINE_string(emission_dir, "", "path/to/emission_dir/");
+DEFINE_double(
+    am_batchframes,
+    0,
+    "if > 0, Test and Decode forward the acoustic model on batches of samples "
+    "of similar durations, of at most this many padded input frames, instead "
+    "of one sample at a time");
+DEFINE_double(
+    am_chunk_ms,
+    0,
+    "if > 0, Test and Decode forward the acoustic model on chunks of this "
+    "many ms of each input, for long recordings");
+DEFINE_double(
+    am_chunk_overlap_ms,
+    1000,
+    "context in ms on each side of the chunks of --am_chunk_ms, whose "
+    "emissions are dropped");
+DEFINE_int32(
+    am_chunk_batch,
+    8,
+    "number of chunks of --am_chunk_ms forwarded together");
+DEFINE_bool(
+    emission_mmap,
+    false,
+    "Test writes the emissions as they come to an indexed half-precision "
+    "file (only the --emission_topk best tokens of each frame if > 0), which "
+    "Decode memory-maps and decodes sample by sample in the stored precision "
+    "and format");
 DEFINE_string(lm, "", "path/to/language_model");
 DEFINE_string(am, "", "path/to/acoustic_model");
+DEFINE_string(
+    amquantize,
+    "none",
+    "store the acoustic model weights in fp16 or int8 once loaded: none, fp16, int8");
 DEFINE_string(sclite, "", "path/to/sclite to be written");
 DEFINE_string(decodertype, "wrd", "wrd, tkn");
 
@@ -174,16 +417,146 @@ DEFINE_double(
     "unknown word insertion score");
 DEFINE_double(eosscore, 0.0, "EOS insertion score");
 DEFINE_double(beamthreshold, 25, "beam score threshold");
+DEFINE_double(
+    beamtimebudget,
+    0,
+    "adaptive beam: time budget in ms for each decoder step (0 to disable)");
+DEFINE_double(
+    blankskipthreshold,
+    0,
+    "CTC: blank posterior above which a frame only extends blanks (0 to disable)");
+DEFINE_int32(
+    lm_lookahead_words,
+    0,
+    "word LM: score the partial words with the best LM score, in their "
+    "context, of the words they can become, for the lexicon nodes with at "
+    "most this many words below them (0 to use the smeared trie scores)");
+DEFINE_int32(
+    lm_lookahead_cache,
+    1 << 20,
+    "word LM: number of LM lookahead scores cached by each decoder thread");
+DEFINE_string(
+    s2s_early_stopping,
+    "none",
+    "seq2seq decoders: stop once the best complete hypothesis can not be "
+    "beaten, 'bound' (exact if the scores are log-probabilities), "
+    "'heuristic' (as if the other hypothesis ended right away) or 'none'");
+DEFINE_double(
+    s2s_length_normalization,
+    0,
+    "seq2seq decoders: rank the hypothesis by score / length^x");
+DEFINE_int32(
+    decoder_expand_threads,
+    1,
+    "lexicon decoder: number of tasks expanding the beam of each frame, for "
+    "the latency of a single stream (1 for a serial expansion)");
+DEFINE_string(
+    decoder_numa,
+    "none",
+    "placement of the decoder threads and of the KenLM and trie they read on "
+    "the NUMA nodes: none, replicate (threads bound to the nodes in turn, "
+    "each node with its own copy of the KenLM and the trie) or interleave "
+    "(threads bound likewise, the KenLM and the trie interleaved over the "
+    "nodes)");
+DEFINE_string(
+    decoder_hugepages,
+    "none",
+    "pages backing the compiled trie: none, transparent (madvise) or "
+    "explicit (MAP_HUGETLB, from the huge page pool)");
 
 DEFINE_int32(maxload, -1, "max number of testing examples.");
 DEFINE_int32(maxword, -1, "maximum number of words to use");
 DEFINE_int32(beamsize, 2500, "max overall beam size");
 DEFINE_int32(beamsizetoken, 250000, "max beam for token selection");
+DEFINE_int32(
+    beamtargetcandidates,
+    0,
+    "adaptive beam: number of candidates to aim at each decoder step (0 to disable)");
 DEFINE_int32(nthread_decoder, 1, "number of threads for decoding");
+DEFINE_int32(
+    nthread_am,
+    1,
+    "number of GPUs running the acoustic model forward pass while decoding");
+DEFINE_int32(
+    emission_queue_size,
+    100,
+    "max number of emissions waiting for a decoder thread");
+DEFINE_string(
+    sweep_lmweight,
+    "",
+    "sweep mode: comma-separated values of --lmweight to decode with, the "
+    "emissions, lexicon and LM being loaded once for all the configurations");
+DEFINE_string(
+    sweep_wordscore,
+    "",
+    "sweep mode: comma-separated values of --wordscore");
+DEFINE_string(
+    sweep_silscore,
+    "",
+    "sweep mode: comma-separated values of --silscore");
+DEFINE_string(
+    sweep_beamthreshold,
+    "",
+    "sweep mode: comma-separated values of --beamthreshold");
+DEFINE_int32(
+    sweep_random,
+    0,
+    "sweep mode: number of configurations drawn uniformly within the ranges "
+    "of the swept values, instead of their grid (0 for the grid)");
+DEFINE_int32(
+    sweep_halving,
+    1,
+    "sweep mode: number of rounds of successive halving, each round decoding "
+    "twice the samples of the previous one and keeping the best half of the "
+    "configurations (1 to decode all the samples with all of them)");
+DEFINE_int32(
+    emission_topk,
+    0,
+    "copy only the k best tokens of each emission frame (and the blank) from "
+    "the acoustic model to the decoders, the other tokens scoring the k-th "
+    "best score of the frame (0 to copy all the tokens)");
+DEFINE_bool(
+    decoder_stats,
+    false,
+    "log the decoder counters and real-time factor of each sample, and "
+    "latency percentiles at the end");
+DEFINE_double(
+    emission_frame_ms,
+    0,
+    "duration of an emission frame in ms, for the real-time factor of "
+    "emissions loaded from --emission_dir (0 if unknown)");
 DEFINE_int32(
     lm_memory,
     5000,
     "total memory size for batch during forward pass ");
+DEFINE_int32(
+    lm_cache_size,
+    0,
+    "number of KenLM lookups cached across decoder threads (0 to disable)");
+DEFINE_string(
+    lm_load_method,
+    "populate",
+    "how a KenLM binary is loaded: lazy, populate (prefaulted mmap), read");
+DEFINE_bool(
+    lm_async,
+    false,
+    "run the ConvLM forward of the beam in the background until the LM "
+    "scoring of the next frame, overlapping its token selection and trie "
+    "lookups");
+DEFINE_string(
+    lm_cache_precision,
+    "fp32",
+    "precision of the ConvLM cached distributions: fp32, fp16, int8");
+DEFINE_int32(
+    lm_incremental_cache,
+    0,
+    "number of histories whose ConvLM layer outputs are cached to forward "
+    "only the new token of their extensions (0 to forward whole histories)");
+DEFINE_int32(
+    lm_shortlist,
+    0,
+    "number of the first tokens of the ConvLM vocabulary scored for each "
+    "state, the others being scored when queried (0 for the whole vocabulary)");
 
 DEFINE_double(
     smoothingtemperature,
@@ -205,6 +578,11 @@ DEFINE_double(
     transdiag,
     0.0,
     "Initial value along diagonal of ASG transition matrix");
+DEFINE_int64(
+    transtopk,
+    0,
+    "If > 0, the ASG normalization only sums over the paths made of the "
+    "'transtopk' highest transitions into each token (0 = all)");
 
 // SEQ2SEQ OPTIONS
 DEFINE_int64(maxdecoderoutputlen, 200, "max decoder steps during inference");
@@ -230,6 +608,11 @@ DEFINE_int64(
     "Number of convolutional channels for location attention");
 DEFINE_int64(attnconvkernel, 0, "Kernel width for location attention");
 DEFINE_int64(numattnhead, 8, "number of heads for multihead attention");
+DEFINE_int64(
+    attnchunksize,
+    0,
+    "number of decoder steps whose multihead attention scores are computed at "
+    "a time, and recomputed by the backward pass (0 = all at once)");
 DEFINE_int64(leftWindowSize, 50, "left median window width");
 DEFINE_int64(rightWindowSize, 50, "right median window width");
 DEFINE_int64(
@@ -285,6 +668,27 @@ DEFINE_string(
     "",
     "Shared file path used for setting up rendezvous."
     "If empty, uses MPI to initialize.");
+DEFINE_int64(
+    reducer_bucket_kb,
+    0,
+    "size in KB of the gradient buckets all-reduced during the backward "
+    "(-1 to size them from the measured bandwidth, 0 to coalesce the "
+    "gradients with flashlight's reducer)");
+DEFINE_string(
+    reducer_compression,
+    "none",
+    "type in which the gradient buckets are all-reduced: none, fp16 (with "
+    "error feedback)");
+DEFINE_bool(
+    reducer_hierarchical,
+    false,
+    "all-reduce the gradient buckets in three steps: within the nodes, across "
+    "the nodes, then within the nodes again (CUDA backend built with NCCL)");
+DEFINE_bool(
+    peer_restore,
+    false,
+    "with `continue`, read the checkpoint on the first process only and send "
+    "it to the other processes over the network");
 
 // FB SPECIFIC
 DEFINE_string(target, "tkn", "target feature");
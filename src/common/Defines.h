@@ -91,6 +91,8 @@ constexpr const char* kSGDoptimizer = "sgd";
 constexpr const char* kAdamOptimizer = "adam";
 constexpr const char* kRMSPropOptimizer = "rmsprop";
 constexpr const char* kAdadeltaOptimizer = "adadelta";
+constexpr const char* kLambOptimizer = "lamb";
+constexpr const char* kLarsOptimizer = "lars";
 constexpr const char* kCtcCriterion = "ctc";
 constexpr const char* kAsgCriterion = "asg";
 constexpr const char* kSeq2SeqCriterion = "seq2seq";
@@ -107,6 +109,9 @@ DECLARE_string(train);
 DECLARE_string(valid);
 DECLARE_string(test);
 DECLARE_int64(batchsize);
+DECLARE_double(batchframes);
+DECLARE_bool(autobatchframes);
+DECLARE_bool(balancebatches);
 DECLARE_string(input);
 DECLARE_int64(samplerate);
 DECLARE_int64(channels);
@@ -142,6 +147,11 @@ DECLARE_bool(lrcosine);
 
 DECLARE_int64(iter);
 DECLARE_bool(itersave);
+DECLARE_int64(accumulate_steps);
+DECLARE_bool(oomsplit);
+DECLARE_bool(async_checkpoint);
+DECLARE_bool(sharded_checkpoint);
+DECLARE_bool(amp);
 DECLARE_double(lr);
 DECLARE_double(momentum);
 DECLARE_double(weightdecay);
@@ -152,15 +162,19 @@ DECLARE_double(adambeta1);
 DECLARE_double(adambeta2);
 DECLARE_double(optimrho);
 DECLARE_double(optimepsilon);
+DECLARE_double(larseta);
 
 /* ========== LR-SCHEDULER OPTIONS ========== */
 
 DECLARE_int64(stepsize);
 DECLARE_double(gamma);
+DECLARE_int64(warmup);
 
 /* ========== OPTIMIZER OPTIONS ========== */
 DECLARE_string(netoptim);
 DECLARE_string(critoptim);
+DECLARE_bool(fuseoptim);
+DECLARE_bool(shardoptim);
 
 /* ========== MFCC OPTIONS ========== */
 
@@ -169,9 +183,23 @@ DECLARE_bool(pow);
 DECLARE_int64(mfcccoeffs);
 DECLARE_bool(mfsc);
 DECLARE_double(melfloor);
+DECLARE_bool(fastlog);
 DECLARE_int64(filterbanks);
 DECLARE_int64(devwin);
 DECLARE_int64(fftcachesize);
+DECLARE_bool(device_features);
+DECLARE_string(featurecache);
+DECLARE_int64(validcache_mb);
+DECLARE_string(dataindex);
+DECLARE_int64(stream_buffer);
+DECLARE_int64(stream_bucket_batches);
+DECLARE_int64(stream_epoch_batches);
+DECLARE_int64(objectstore_cache_mb);
+DECLARE_int64(objectstore_block_kb);
+DECLARE_int32(objectstore_readahead);
+DECLARE_int32(objectstore_threads);
+DECLARE_string(specaug_cpu);
+DECLARE_string(speedperturb);
 DECLARE_int64(framesizems);
 DECLARE_int64(framestridems);
 
@@ -184,11 +212,26 @@ DECLARE_string(archdir);
 DECLARE_string(flagsfile);
 DECLARE_string(runname);
 DECLARE_int64(nthread);
+DECLARE_int64(prefetchdepth);
+DECLARE_int64(dataecho);
+DECLARE_int64(criterionthreads);
+DECLARE_int64(cputhreads);
+DECLARE_bool(pinthreads);
 DECLARE_string(tag);
 DECLARE_int64(seed);
 DECLARE_int64(memstepsize);
 DECLARE_int64(reportiters);
+DECLARE_bool(trace);
+DECLARE_bool(trace_sync);
+DECLARE_string(profilemodules);
 DECLARE_double(pcttraineval);
+DECLARE_bool(traineval_async);
+DECLARE_bool(validasync);
+DECLARE_int64(synthetic_samples);
+DECLARE_string(synthetic_frames);
+DECLARE_double(synthetic_framespertoken);
+DECLARE_bool(datapipeline_only);
+DECLARE_bool(ctcgreedypath);
 
 /* ========== ARCHITECTURE OPTIONS ========== */
 
@@ -206,10 +249,19 @@ DECLARE_bool(uselexicon);
 DECLARE_string(smearing);
 DECLARE_string(lmtype);
 DECLARE_string(lexicon);
+DECLARE_string(trie);
+DECLARE_string(search_graph);
+DECLARE_string(bias_phrases);
 DECLARE_string(lm_vocab);
 DECLARE_string(emission_dir);
+DECLARE_double(am_batchframes);
+DECLARE_double(am_chunk_ms);
+DECLARE_double(am_chunk_overlap_ms);
+DECLARE_int32(am_chunk_batch);
+DECLARE_bool(emission_mmap);
 DECLARE_string(lm);
 DECLARE_string(am);
+DECLARE_string(amquantize);
 DECLARE_string(sclite);
 DECLARE_string(decodertype);
 
@@ -219,13 +271,40 @@ DECLARE_double(silscore);
 DECLARE_double(unkscore);
 DECLARE_double(eosscore);
 DECLARE_double(beamthreshold);
+DECLARE_double(beamtimebudget);
+DECLARE_double(blankskipthreshold);
+DECLARE_int32(lm_lookahead_words);
+DECLARE_int32(lm_lookahead_cache);
+DECLARE_string(s2s_early_stopping);
+DECLARE_double(s2s_length_normalization);
+DECLARE_int32(decoder_expand_threads);
+DECLARE_string(decoder_numa);
+DECLARE_string(decoder_hugepages);
 
 DECLARE_int32(maxload);
 DECLARE_int32(maxword);
 DECLARE_int32(beamsize);
 DECLARE_int32(beamsizetoken);
+DECLARE_int32(beamtargetcandidates);
 DECLARE_int32(nthread_decoder);
+DECLARE_int32(nthread_am);
+DECLARE_int32(emission_queue_size);
+DECLARE_int32(emission_topk);
+DECLARE_string(sweep_lmweight);
+DECLARE_string(sweep_wordscore);
+DECLARE_string(sweep_silscore);
+DECLARE_string(sweep_beamthreshold);
+DECLARE_int32(sweep_random);
+DECLARE_int32(sweep_halving);
+DECLARE_bool(decoder_stats);
+DECLARE_double(emission_frame_ms);
 DECLARE_int32(lm_memory);
+DECLARE_int32(lm_cache_size);
+DECLARE_string(lm_load_method);
+DECLARE_bool(lm_async);
+DECLARE_string(lm_cache_precision);
+DECLARE_int32(lm_incremental_cache);
+DECLARE_int32(lm_shortlist);
 
 // Seq2Seq
 DECLARE_double(smoothingtemperature);
@@ -237,6 +316,7 @@ DECLARE_int64(linseg);
 DECLARE_double(linlr);
 DECLARE_double(linlrcrit);
 DECLARE_double(transdiag);
+DECLARE_int64(transtopk);
 
 /* ========== SEQ2SEQ OPTIONS ========== */
 
@@ -251,6 +331,7 @@ DECLARE_int64(attndim);
 DECLARE_int64(attnconvchannel);
 DECLARE_int64(attnconvkernel);
 DECLARE_int64(numattnhead);
+DECLARE_int64(attnchunksize);
 DECLARE_int64(leftWindowSize);
 DECLARE_int64(rightWindowSize);
 DECLARE_int64(maxsil);
@@ -272,6 +353,10 @@ DECLARE_bool(enable_distributed);
 DECLARE_int64(world_rank);
 DECLARE_int64(world_size);
 DECLARE_string(rndv_filepath);
+DECLARE_int64(reducer_bucket_kb);
+DECLARE_string(reducer_compression);
+DECLARE_bool(reducer_hierarchical);
+DECLARE_bool(peer_restore);
 
 /* ========== FB SPECIFIC ========== */
 DECLARE_string(target);
@@ -0,0 +1,272 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "common/TargetTokenizer.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <stdexcept>
+#include <tuple>
+
+#include "common/Defines.h"
+
+namespace w2l {
+
+namespace {
+
+std::vector<std::pair<std::string, int>> lexiconKeys(
+    const LexiconMap& lexicon) {
+  std::vector<std::pair<std::string, int>> keys;
+  keys.reserve(lexicon.size());
+  for (const auto& entry : lexicon) {
+    keys.emplace_back(entry.first, keys.size());
+  }
+  return keys;
+}
+
+std::vector<std::pair<std::string, int>> dictionaryKeys(
+    const Dictionary& dict,
+    bool fallback2Ltr) {
+  std::vector<std::pair<std::string, int>> keys;
+  if (!fallback2Ltr) {
+    return keys;
+  }
+  if (!dict.isContiguous()) {
+    throw std::invalid_argument(
+        "TargetTokenizer: the indices of the dictionary must be contiguous");
+  }
+  for (int idx = 0; idx < dict.indexSize(); ++idx) {
+    keys.emplace_back(dict.getEntry(idx), idx);
+  }
+  return keys;
+}
+
+/* Number of bytes of the UTF-8 character starting with `c`, -1 if invalid */
+int utf8Bytes(unsigned char c) {
+  if ((c & 0x80) == 0) {
+    return 1;
+  } else if ((c & 0xE0) == 0xC0) {
+    return 2;
+  } else if ((c & 0xF0) == 0xE0) {
+    return 3;
+  } else if ((c & 0xF8) == 0xF0) {
+    return 4;
+  }
+  return -1;
+}
+
+} // namespace
+
+TargetTokenizer::ByteTrie::ByteTrie(
+    std::vector<std::pair<std::string, int>> keys) {
+  std::sort(keys.begin(), keys.end());
+  // The nodes are laid out breadth first: a node is the keys [lo, hi), which
+  // share their first `depth` bytes, and its children are added together
+  std::deque<std::tuple<size_t, size_t, size_t>> queue;
+  queue.emplace_back(0, keys.size(), 0);
+  labels.push_back(0);
+  values.push_back(-1);
+  for (int node = 0; !queue.empty(); ++node) {
+    size_t lo, hi, depth;
+    std::tie(lo, hi, depth) = queue.front();
+    queue.pop_front();
+    if (lo < hi && keys[lo].first.size() == depth) {
+      values[node] = keys[lo++].second; // the keys are unique
+    }
+    childBegin.push_back(labels.size());
+    while (lo < hi) {
+      unsigned char byte = keys[lo].first[depth];
+      size_t end = lo + 1;
+      while (end < hi &&
+             static_cast<unsigned char>(keys[end].first[depth]) == byte) {
+        ++end;
+      }
+      labels.push_back(byte);
+      values.push_back(-1);
+      queue.emplace_back(lo, end, depth + 1);
+      lo = end;
+    }
+    childEnd.push_back(labels.size());
+  }
+}
+
+int TargetTokenizer::ByteTrie::child(int node, unsigned char byte) const {
+  auto begin = labels.begin() + childBegin[node];
+  auto end = labels.begin() + childEnd[node];
+  auto it = std::lower_bound(begin, end, byte);
+  return it != end && *it == byte ? it - labels.begin() : -1;
+}
+
+int TargetTokenizer::ByteTrie::find(const std::string& key) const {
+  int node = 0;
+  for (unsigned char byte : key) {
+    node = child(node, byte);
+    if (node < 0) {
+      return -1;
+    }
+  }
+  return values[node];
+}
+
+TargetTokenizer::TargetTokenizer(
+    const LexiconMap& lexicon,
+    const Dictionary& dict,
+    bool fallback2Ltr /* = false */,
+    bool skipUnk /* = false */)
+    : dict_(dict),
+      fallback2Ltr_(fallback2Ltr),
+      skipUnk_(skipUnk),
+      words_(lexiconKeys(lexicon)),
+      tokens_(dictionaryKeys(dict, fallback2Ltr)),
+      separator_(FLAGS_wordseparator),
+      separatorIdx_(
+          !separator_.empty() && dict.contains(separator_)
+              ? dict.getIndex(separator_)
+              : -1) {
+  // In the order of lexiconKeys()
+  firstSpelling_.push_back(0);
+  firstToken_.push_back(0);
+  for (const auto& entry : lexicon) {
+    for (const auto& spelling : entry.second) {
+      for (const auto& token : spelling) {
+        if (dict.contains(token)) {
+          spellingTokens_.push_back(dict.getIndex(token));
+        } else {
+          missingTokens_[spellingTokens_.size()] = token;
+          spellingTokens_.push_back(-1);
+        }
+      }
+      firstToken_.push_back(spellingTokens_.size());
+    }
+    firstSpelling_.push_back(firstToken_.size() - 1);
+  }
+}
+
+std::vector<int> TargetTokenizer::tokenize(
+    const std::vector<std::string>& words) const {
+  std::vector<int> res, target;
+  for (const auto& word : words) {
+    target.clear();
+    tokenizeWord(word, target);
+    if (target.empty()) {
+      continue;
+    }
+
+    // remove duplicate word separators in the beginning of each target token
+    if (!res.empty() && startsWithSeparator(target[0])) {
+      res.pop_back();
+    }
+    res.insert(res.end(), target.begin(), target.end());
+    if (!separator_.empty() && !endsWithSeparator(res.back())) {
+      res.push_back(
+          separatorIdx_ >= 0 ? separatorIdx_ : dict_.getIndex(separator_));
+    }
+  }
+
+  if (!res.empty() && separatorIdx_ >= 0 && res.back() == separatorIdx_) {
+    res.pop_back();
+  }
+  return res;
+}
+
+void TargetTokenizer::tokenizeWord(
+    const std::string& word,
+    std::vector<int>& target) const {
+  int w = words_.find(word);
+  if (w >= 0) {
+    int64_t s = firstSpelling_[w];
+    int64_t nSpellings = firstSpelling_[w + 1] - s;
+    if (nSpellings == 0) {
+      return;
+    }
+    if (nSpellings > 1 &&
+        FLAGS_sampletarget >
+            static_cast<float>(std::rand()) / static_cast<float>(RAND_MAX)) {
+      s += std::rand() % nSpellings;
+    }
+    for (int64_t t = firstToken_[s]; t < firstToken_[s + 1]; ++t) {
+      // The missing tokens are mapped as Dictionary does: to its default
+      // index, or to an error
+      target.push_back(
+          spellingTokens_[t] >= 0 ? spellingTokens_[t]
+                                  : dict_.getIndex(missingTokens_.at(t)));
+    }
+    return;
+  }
+
+  if (!fallback2Ltr_) {
+    if (!skipUnk_) {
+      throw std::invalid_argument("Unknown word in the lexicon: " + word);
+    }
+    std::cerr << "Skipping unknown word '" << word
+              << "' when generating target\n";
+    return;
+  }
+  std::cerr << "Falling back to using tokens as targets for the unknown word: "
+            << word << "\n";
+  size_t pos = 0;
+  while (pos < word.size()) {
+    // The longest token starting at `pos`
+    int token = -1;
+    size_t end = pos;
+    int node = 0;
+    for (size_t i = pos; i < word.size(); ++i) {
+      node = tokens_.child(node, word[i]);
+      if (node < 0) {
+        break;
+      }
+      if (tokens_.values[node] >= 0) {
+        token = tokens_.values[node];
+        end = i + 1;
+      }
+    }
+    if (token >= 0) {
+      target.push_back(token);
+      pos = end;
+      continue;
+    }
+
+    int nBytes = utf8Bytes(word[pos]);
+    if (nBytes < 0 || pos + nBytes > word.size()) {
+      throw std::runtime_error("TargetTokenizer: invalid UTF-8 : " + word);
+    }
+    std::string character = word.substr(pos, nBytes);
+    if (!skipUnk_) {
+      throw std::invalid_argument(
+          "Unknown token '" + character +
+          "' when falling back to tokens for the unknown word: " + word);
+    }
+    std::cerr << "Skipping unknown token '" << character
+              << "' when falling back to tokens for the unknown word: "
+              << word << "\n";
+    pos += nBytes;
+  }
+}
+
+bool TargetTokenizer::startsWithSeparator(int idx) const {
+  if (separator_.empty()) {
+    return false;
+  }
+  const auto& entry = dict_.getEntry(idx);
+  return entry.compare(0, separator_.size(), separator_) == 0;
+}
+
+bool TargetTokenizer::endsWithSeparator(int idx) const {
+  if (separator_.empty()) {
+    return false;
+  }
+  const auto& entry = dict_.getEntry(idx);
+  return entry.size() >= separator_.size() &&
+      entry.compare(
+          entry.size() - separator_.size(), separator_.size(), separator_) ==
+      0;
+}
+
+} // namespace w2l
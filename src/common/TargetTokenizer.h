@@ -0,0 +1,94 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "libraries/common/Dictionary.h"
+#include "libraries/common/WordUtils.h"
+
+namespace w2l {
+
+/**
+ * TargetTokenizer maps the words of a transcript to the token indices of its
+ * target, as wrd2Target() then Dictionary::mapEntriesToIndices() do, without
+ * building a string: the spellings of the lexicon are mapped to indices when
+ * it's built, and the words are looked up in a byte trie of the lexicon.
+ *
+ * With `fallback2Ltr`, a word missing from the lexicon is segmented greedily
+ * into the longest tokens of `dict` which match it, looked up in a byte trie
+ * of the tokens: its letters for a dictionary of letters, but fewer tokens
+ * for a dictionary of word pieces. A character starting no token is unknown.
+ * FLAGS_wordseparator and FLAGS_sampletarget apply as in wrd2Target().
+ *
+ * It's read-only once built, so that all the data threads share one.
+ */
+class TargetTokenizer {
+ public:
+  TargetTokenizer(
+      const LexiconMap& lexicon,
+      const Dictionary& dict,
+      bool fallback2Ltr = false,
+      bool skipUnk = false);
+
+  /* The token indices of the target of `words` */
+  std::vector<int> tokenize(const std::vector<std::string>& words) const;
+
+ private:
+  // A trie of byte strings in arrays. The children of the node n are the
+  // nodes [childBegin[n], childEnd[n]), sorted by the byte of their edge.
+  struct ByteTrie {
+    std::vector<int> childBegin;
+    std::vector<int> childEnd;
+    std::vector<unsigned char> labels;
+    std::vector<int> values; // -1 if no key ends at the node
+
+    explicit ByteTrie(std::vector<std::pair<std::string, int>> keys);
+
+    /* The child of `node` by `byte`, -1 if none */
+    int child(int node, unsigned char byte) const;
+
+    /* The value of `key`, -1 if it's not in the trie */
+    int find(const std::string& key) const;
+  };
+
+  Dictionary dict_;
+  bool fallback2Ltr_;
+  bool skipUnk_;
+
+  ByteTrie words_; // the words of the lexicon, by word index
+  // The entries of the dictionary by token index, with `fallback2Ltr`
+  ByteTrie tokens_;
+
+  // The spellings of the word w are [firstSpelling_[w], firstSpelling_[w + 1])
+  // and the tokens of the spelling s [firstToken_[s], firstToken_[s + 1])
+  // of spellingTokens_, -1 for the tokens missing from the dictionary
+  std::vector<int64_t> firstSpelling_;
+  std::vector<int64_t> firstToken_;
+  std::vector<int> spellingTokens_;
+  // The tokens missing from the dictionary, by position in spellingTokens_
+  std::unordered_map<int64_t, std::string> missingTokens_;
+
+  // FLAGS_wordseparator, and its index (-1 if none or not in the dictionary)
+  std::string separator_;
+  int separatorIdx_;
+
+  /* Appends the target of `word` to `target` */
+  void tokenizeWord(const std::string& word, std::vector<int>& target) const;
+
+  bool startsWithSeparator(int idx) const;
+
+  bool endsWithSeparator(int idx) const;
+};
+
+} // namespace w2l
@@ -17,6 +17,7 @@
 
 #include "common/Defines.h"
 #include "libraries/common/Dictionary.h"
+#include "libraries/common/TaskScheduler.h"
 
 namespace w2l {
 
@@ -57,6 +58,35 @@ void remapLabels(std::vector<T>& labels, const Dictionary& dict) {
 };
 
 // Input: B x inRow x inCol (Row Major), Output: B x inCol x inRow (Row Major)
+// The matrices are transposed by square tiles, whose rows are contiguous both
+// in the input and the output, so that the cache lines and pages are reused.
+template <typename T>
+void transpose2d(
+    const T* in,
+    T* out,
+    int64_t inRow,
+    int64_t inCol,
+    int64_t inBatch = 1) {
+  constexpr int64_t kTileSz = 32;
+  for (int64_t b = 0; b < inBatch; ++b) {
+    const T* batchIn = in + b * inRow * inCol;
+    T* batchOut = out + b * inRow * inCol;
+    for (int64_t r0 = 0; r0 < inRow; r0 += kTileSz) {
+      int64_t r1 = std::min(r0 + kTileSz, inRow);
+      for (int64_t c0 = 0; c0 < inCol; c0 += kTileSz) {
+        int64_t c1 = std::min(c0 + kTileSz, inCol);
+        for (int64_t c = c0; c < c1; ++c) {
+          T* outRow = batchOut + c * inRow;
+#pragma omp simd
+          for (int64_t r = r0; r < r1; ++r) {
+            outRow[r] = batchIn[r * inCol + c];
+          }
+        }
+      }
+    }
+  }
+}
+
 template <typename T>
 std::vector<T> transpose2d(
     const std::vector<T>& in,
@@ -66,18 +96,38 @@ std::vector<T> transpose2d(
   if (in.size() != inRow * inCol * inBatch) {
     throw std::invalid_argument("Invalid input size");
   }
-  std::vector<T> out(in.size());
-  for (size_t b = 0; b < inBatch; ++b) {
-    int64_t start = b * inRow * inCol;
-    for (size_t c = 0; c < inCol; ++c) {
-      for (size_t r = 0; r < inRow; ++r) {
-        out[start + c * inRow + r] = in[start + r * inCol + c];
-      }
-    }
+  if (inRow == 1 || inCol == 1) {
+    return in;
   }
+  std::vector<T> out(in.size());
+  transpose2d(in.data(), out.data(), inRow, inCol, inBatch);
   return out;
 }
 
+// Same as transpose2d(), in place of `data`. The transpose is computed in a
+// scratch buffer of the thread, which is then swapped with `data`, so that the
+// buffers are reused from a call to the next.
+template <typename T>
+void transpose2dInPlace(
+    std::vector<T>& data,
+    int64_t inRow,
+    int64_t inCol,
+    int64_t inBatch = 1) {
+  if (data.size() != inRow * inCol * inBatch) {
+    throw std::invalid_argument("Invalid input size");
+  }
+  if (inRow == 1 || inCol == 1) {
+    return;
+  }
+  static thread_local std::vector<T> scratch;
+  scratch.resize(data.size());
+  transpose2d(data.data(), scratch.data(), inRow, inCol, inBatch);
+  data.swap(scratch);
+}
+
+// Normalizes each frame with the mean and stddev of the values of the frames
+// [frame - leftCtxSize, frame + rightCtxSize]. These are computed from prefix
+// sums over the frames, so the cost doesn't depend on the context size.
 template <typename T>
 std::vector<T> localNormalize(
     const std::vector<T>& in,
@@ -92,39 +142,48 @@ std::vector<T> localNormalize(
   int64_t perBatchSz = in.size() / batchSz;
   int64_t perFrameSz = perBatchSz / frameSz;
   auto out(in);
-  for (size_t b = 0; b < batchSz; ++b) {
-    std::vector<T> sum(frameSz, 0.0), sum2(frameSz, 0.0);
-    int64_t curFrame = 0;
-    // accumulate sum, sum^2 for computing mean, stddev
-    for (auto i = b * perBatchSz; i < (b + 1) * perBatchSz; ++i) {
-      auto start = std::max(curFrame - rightCtxSize, 0L);
-      auto end = std::min(curFrame + leftCtxSize, frameSz - 1);
-      for (int64_t j = start; j <= end; ++j) {
-        sum[j] += in[i];
-        sum2[j] += in[i] * in[i];
+  TaskScheduler::get().parallelFor(batchSz, [&](int64_t b) {
+    const T* batchIn = in.data() + b * perBatchSz;
+    T* batchOut = out.data() + b * perBatchSz;
+    // accumulate sum, sum^2 of each frame, whose values are frameSz apart
+    std::vector<double> sum(frameSz, 0.0), sum2(frameSz, 0.0);
+    for (int64_t k = 0; k < perFrameSz; ++k) {
+      const T* values = batchIn + k * frameSz;
+#pragma omp simd
+      for (int64_t j = 0; j < frameSz; ++j) {
+        sum[j] += values[j];
+        sum2[j] += values[j] * values[j];
       }
-      curFrame = (curFrame + 1) % frameSz;
+    }
+    // prefix sums over the frames
+    std::vector<double> prefix(frameSz + 1, 0.0), prefix2(frameSz + 1, 0.0);
+    for (int64_t j = 0; j < frameSz; ++j) {
+      prefix[j + 1] = prefix[j] + sum[j];
+      prefix2[j + 1] = prefix2[j] + sum2[j];
     }
     // compute mean, stddev
-    for (auto j = 0; j < frameSz; ++j) {
-      int64_t N = (std::min(j + rightCtxSize, frameSz - 1) -
-                   std::max(j - leftCtxSize, 0L) + 1) *
-          perFrameSz;
-      sum[j] /= N;
-      sum2[j] /= N;
-      sum2[j] -= (sum[j] * sum[j]);
-      sum2[j] = std::sqrt(sum2[j]);
+    std::vector<T> mean(frameSz), stddev(frameSz);
+    for (int64_t j = 0; j < frameSz; ++j) {
+      int64_t start = std::max<int64_t>(j - leftCtxSize, 0);
+      int64_t end = std::min(j + rightCtxSize, frameSz - 1);
+      double N = (end - start + 1) * perFrameSz;
+      double m = (prefix[end + 1] - prefix[start]) / N;
+      double var = (prefix2[end + 1] - prefix2[start]) / N - m * m;
+      mean[j] = m;
+      stddev[j] = std::sqrt(std::max(var, 0.0));
     }
     // perform local normalization
-    curFrame = 0;
-    for (auto i = b * perBatchSz; i < (b + 1) * perBatchSz; ++i) {
-      out[i] -= sum[curFrame];
-      if (sum2[curFrame] > threshold) {
-        out[i] /= sum2[curFrame];
+    for (int64_t k = 0; k < perFrameSz; ++k) {
+      T* values = batchOut + k * frameSz;
+#pragma omp simd
+      for (int64_t j = 0; j < frameSz; ++j) {
+        values[j] -= mean[j];
+        if (stddev[j] > threshold) {
+          values[j] /= stddev[j];
+        }
       }
-      curFrame = (curFrame + 1) % frameSz;
     }
-  }
+  });
   return out;
 }
 
@@ -44,6 +44,33 @@ TEST(DictionaryTest, TestBasic) {
   ASSERT_EQ(dict.indexSize(), 5);
 }
 
+TEST(DictionaryTest, Lookup) {
+  Dictionary dict;
+  for (int i = 0; i < 1000; ++i) {
+    dict.addEntry("tkn" + std::to_string(i));
+  }
+  ASSERT_EQ(dict.entrySize(), 1000);
+  for (int i = 0; i < 1000; ++i) {
+    ASSERT_EQ(dict.getIndex("tkn" + std::to_string(i)), i);
+  }
+  ASSERT_EQ(dict.getIndex("tkn42"), 42);
+  ASSERT_EQ(dict.getIndex("tkn421", 5), 42);
+  ASSERT_TRUE(dict.contains("tkn999"));
+  ASSERT_FALSE(dict.contains("tkn1000"));
+  ASSERT_FALSE(dict.contains("tkn", 3));
+  ASSERT_THROW(dict.getIndex("tkn"), std::invalid_argument);
+  ASSERT_THROW(dict.addEntry("tkn7"), std::invalid_argument);
+
+  dict.freeze();
+  ASSERT_TRUE(dict.isFrozen());
+  ASSERT_THROW(dict.addEntry("tkn"), std::logic_error);
+  for (int i = 0; i < 1000; ++i) {
+    ASSERT_EQ(dict.getIndex("tkn" + std::to_string(i)), i);
+  }
+  dict.setDefaultIndex(0);
+  ASSERT_EQ(dict.getIndex("tkn"), 0);
+}
+
 TEST(DictionaryTest, FromFile) {
   ASSERT_THROW(Dictionary("not_a_real_file"), std::invalid_argument);
 
@@ -10,12 +10,15 @@
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
+#include <atomic>
 #include <future>
 #include <memory>
 
 #include "common/FlashlightUtils.h"
+#include "common/TargetTokenizer.h"
 #include "common/Transforms.h"
 #include "libraries/common/Dictionary.h"
+#include "libraries/common/TaskScheduler.h"
 #include "libraries/common/WordUtils.h"
 
 using namespace w2l;
@@ -429,6 +432,68 @@ TEST(W2lCommonTest, WrdToTarget) {
   ASSERT_THAT(target4, ::testing::ElementsAreArray({"_7", "89"}));
 }
 
+TEST(W2lCommonTest, TargetTokenizer) {
+  gflags::FlagSaver flagsaver;
+  w2l::FLAGS_wordseparator = "_";
+
+  LexiconMap lexicon;
+  lexicon["123"].push_back({"1", "23_"});
+  lexicon["456"].push_back({"456_"});
+  lexicon["789"].push_back({"_7", "89"});
+  lexicon["010"].push_back({"_0", "10"});
+  lexicon["105"].push_back({"10", "5"});
+  lexicon["2100"].push_back({"2", "1", "00"});
+  lexicon["888"].push_back({"8", "8", "8"});
+  lexicon["12"].push_back({"1", "2"});
+
+  Dictionary dict;
+  for (auto l : lexicon) {
+    for (auto p : l.second) {
+      for (auto c : p) {
+        if (!dict.contains(c)) {
+          dict.addEntry(c);
+        }
+      }
+    }
+  }
+  dict.addEntry("_");
+
+  // As wrd2Target() then mapEntriesToIndices()
+  std::vector<std::vector<std::string>> transcripts = {{"123", "456"},
+                                                       {"789", "010"},
+                                                       {"105", "2100"},
+                                                       {"12", "888", "12"},
+                                                       {"010", "12", "456"},
+                                                       {}};
+  TargetTokenizer tokenizer(lexicon, dict);
+  for (const auto& words : transcripts) {
+    ASSERT_EQ(
+        tokenizer.tokenize(words),
+        dict.mapEntriesToIndices(wrd2Target(words, lexicon, dict)));
+  }
+
+  // unknown words "111", "199"
+  std::vector<std::string> words = {"111", "789", "199"};
+  TargetTokenizer fallback(lexicon, dict, true, true);
+  ASSERT_EQ(
+      fallback.tokenize(words),
+      dict.mapEntriesToIndices(wrd2Target(words, lexicon, dict, true, true)));
+  TargetTokenizer skip(lexicon, dict, false, true);
+  ASSERT_EQ(
+      skip.tokenize(words),
+      dict.mapEntriesToIndices(wrd2Target(words, lexicon, dict, false, true)));
+  TargetTokenizer strict(lexicon, dict);
+  EXPECT_THROW(strict.tokenize(words), std::invalid_argument);
+
+  // The fallback takes the longest tokens
+  ASSERT_EQ(
+      fallback.tokenize({"1050"}),
+      dict.mapEntriesToIndices({"10", "5"}));
+  ASSERT_EQ(
+      fallback.tokenize({"1050", "123"}),
+      dict.mapEntriesToIndices({"10", "5", "_", "1", "23_"}));
+}
+
 TEST(W2lCommonTest, TargetToSingleLtr) {
   gflags::FlagSaver flagsaver;
   w2l::FLAGS_wordseparator = "_";
@@ -480,6 +545,57 @@ TEST(W2lCommonTest, UT8Split) {
   }
 }
 
+TEST(W2lCommonTest, TaskScheduler) {
+  TaskScheduler scheduler(4, false);
+  ASSERT_EQ(scheduler.numThreads(), 4);
+
+  std::vector<int> counts(1000, 0);
+  scheduler.parallelFor(counts.size(), [&](int64_t i) { ++counts[i]; });
+  for (auto count : counts) {
+    ASSERT_EQ(count, 1);
+  }
+
+  // Nested loops don't wait for workers busy with the outer loop
+  std::atomic<int64_t> sum(0);
+  scheduler.parallelFor(16, [&](int64_t i) {
+    scheduler.parallelFor(100, [&](int64_t j) { sum += i * 100 + j; });
+  });
+  ASSERT_EQ(sum, 1600 * 1599 / 2);
+
+  ASSERT_THROW(
+      scheduler.parallelFor(
+          10,
+          [](int64_t i) {
+            if (i == 7) {
+              throw std::runtime_error("bleh");
+            }
+          }),
+      std::runtime_error);
+
+  std::vector<std::future<int>> futures;
+  for (int i = 0; i < 100; ++i) {
+    futures.push_back(scheduler.async([i]() { return i * i; }));
+  }
+  for (int i = 0; i < 100; ++i) {
+    ASSERT_EQ(futures[i].get(), i * i);
+  }
+  auto fails = scheduler.async([]() -> int { throw std::runtime_error(""); });
+  ASSERT_THROW(fails.get(), std::runtime_error);
+
+  // Tasks submitted by tasks, and the ones left at destruction, are run
+  std::atomic<int> done(0);
+  {
+    TaskScheduler local(2, true);
+    for (int i = 0; i < 50; ++i) {
+      local.submit([&]() {
+        local.submit([&]() { ++done; });
+        ++done;
+      });
+    }
+  }
+  ASSERT_EQ(done, 100);
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
@@ -21,11 +21,12 @@ class AutoSegmentationCriterion : public SequenceCriterion {
   explicit AutoSegmentationCriterion(
       int N,
       w2l::CriterionScaleMode scalemode = w2l::CriterionScaleMode::NONE,
-      double transdiag = 0.0)
+      double transdiag = 0.0,
+      int transTopK = 0)
       : N_(N),
         scaleMode_(scalemode),
         fac_(ForceAlignmentCriterion(N, scalemode)),
-        fcc_(FullConnectionCriterion(N, scalemode)) {
+        fcc_(FullConnectionCriterion(N, scalemode, transTopK)) {
     if (N_ <= 0) {
       throw af::exception("ASG: N is zero or negative.");
     }
@@ -35,12 +36,13 @@ class AutoSegmentationCriterion : public SequenceCriterion {
   }
 
   std::vector<fl::Variable> forward(
-      const std::vector<fl::Variable>& inputs) override {
-    if (inputs.size() != 2) {
-      throw std::invalid_argument("Invalid inputs size");
-    }
-    return {fcc_.forward(inputs[0], inputs[1]) -
-            fac_.forward(inputs[0], inputs[1])};
+      const std::vector<fl::Variable>& inputs) override;
+
+  /* Compute both terms by a single fused criterion on the CUDA backend,
+   * unless the transitions of the full connection are sparse. Off by
+   * default: the two criteria run as separate autograd nodes. */
+  static void setFusedCuda(bool fused) {
+    fusedCuda() = fused;
   }
 
   af::array viterbiPath(const af::array& input) override {
@@ -64,6 +66,11 @@ class AutoSegmentationCriterion : public SequenceCriterion {
     fcc_.setParams(params_[0], 0);
   }
 
+  static bool& fusedCuda() {
+    static bool fused = false;
+    return fused;
+  }
+
  private:
   int N_;
   w2l::CriterionScaleMode scaleMode_;
@@ -8,6 +8,8 @@
 
 #include "ConnectionistTemporalClassificationCriterion.h"
 
+#include <algorithm>
+
 using namespace fl;
 
 namespace w2l {
@@ -24,6 +26,24 @@ af::array ConnectionistTemporalClassificationCriterion::viterbiPath(
   return af::moddims(bestpath, bestpath.dims(1), bestpath.dims(2));
 }
 
+std::vector<std::vector<int>>
+ConnectionistTemporalClassificationCriterion::greedyPath(
+    const af::array& input) {
+  auto path = ctcGreedyPath(input);
+  int T = path.dims(0);
+  int B = path.dims(1);
+  std::vector<int> pathVec(path.elements());
+  if (!pathVec.empty()) {
+    path.host(pathVec.data());
+  }
+  std::vector<std::vector<int>> paths(B);
+  for (int b = 0; b < B; ++b) {
+    auto begin = pathVec.begin() + b * T;
+    paths[b].assign(begin, std::find(begin, begin + T, -1));
+  }
+  return paths;
+}
+
 std::string ConnectionistTemporalClassificationCriterion::prettyString() const {
   return "ConnectionistTemporalClassificationCriterion";
 }
@@ -24,6 +24,11 @@ class ConnectionistTemporalClassificationCriterion : public SequenceCriterion {
 
   af::array viterbiPath(const af::array& input) override;
 
+  /* Returns the greedy transcript of each of the B utterances of `input`
+   * (N x T x B): the best class of each frame, with the repeats collapsed and
+   * the blanks removed by one kernel, copied to the host by one transfer. */
+  std::vector<std::vector<int>> greedyPath(const af::array& input);
+
   std::string prettyString() const override;
 
  private:
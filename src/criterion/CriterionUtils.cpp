@@ -10,6 +10,8 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstdlib>
+#include <stdexcept>
 
 using fl::Variable;
 
@@ -48,6 +50,126 @@ CriterionScaleMode getCriterionScaleMode(
   }
 }
 
+namespace {
+
+/* Frame t of the result is frame t + offset of `x` (1 x T x B), 0 outside */
+af::array shiftFrames(const af::array& x, int offset) {
+  int T = x.dims(1);
+  int B = x.dims(2);
+  if (offset == 0) {
+    return x;
+  } else if (std::abs(offset) >= T) {
+    return af::constant(0, 1, T, B, x.type());
+  }
+  auto zeros = af::constant(0, 1, std::abs(offset), B, x.type());
+  return offset > 0
+      ? af::join(1, x(af::span, af::seq(offset, T - 1), af::span), zeros)
+      : af::join(1, zeros, x(af::span, af::seq(0, T - 1 + offset), af::span));
+}
+
+} // namespace
+
+namespace detail {
+
+af::array filterFrames(const af::array& prevAttn, int K) {
+  int T = prevAttn.dims(1);
+  int B = prevAttn.dims(2);
+  af::array frames(K, T, B, prevAttn.type());
+  for (int k = 0; k < K; ++k) {
+    frames(k, af::span, af::span) = shiftFrames(prevAttn, k - (K - 1) / 2);
+  }
+  return frames;
+}
+
+} // namespace detail
+
+Variable locationEnergies(
+    const Variable& keys,
+    const Variable& query,
+    const Variable& prevAttn,
+    const Variable& filter,
+    const Variable& filterBias,
+    const Variable& weight) {
+  int A = keys.dims(0);
+  int T = keys.dims(1);
+  int B = keys.dims(2);
+  int K = filter.dims(1);
+  if (query.dims() != af::dim4(A, 1, B) ||
+      (!prevAttn.isempty() && prevAttn.dims() != af::dim4(1, T, B)) ||
+      filter.dims() != af::dim4(A, K) || filterBias.elements() != A ||
+      weight.elements() != A) {
+    throw std::invalid_argument("locationEnergies: mismatched dims");
+  } else if (K % 2 == 0) {
+    throw std::invalid_argument("locationEnergies: the filter must be odd");
+  } else if (
+      keys.type() != f32 || query.type() != f32 ||
+      (!prevAttn.isempty() && prevAttn.type() != f32) ||
+      filter.type() != f32 || filterBias.type() != f32 ||
+      weight.type() != f32) {
+    throw std::invalid_argument("locationEnergies: inputs must be float32");
+  }
+
+  auto energies = detail::locationEnergiesForward(
+      keys.array(),
+      query.array(),
+      prevAttn.array(),
+      filter.array(),
+      filterBias.array(),
+      weight.array());
+
+  auto gradFunc = [A, T, B, K](
+                      std::vector<Variable>& inputs,
+                      const Variable& gradOutput) {
+    af::array gradKeys, gradQuery, gradWeight;
+    detail::locationEnergiesBackward(
+        gradOutput.array(),
+        inputs[0].array(),
+        inputs[1].array(),
+        inputs[2].array(),
+        inputs[3].array(),
+        inputs[4].array(),
+        inputs[5].array(),
+        gradKeys,
+        gradQuery,
+        gradWeight);
+    auto& prev = inputs[2];
+    auto& filt = inputs[3];
+    inputs[0].addGrad(Variable(gradKeys, false));
+    inputs[1].addGrad(Variable(gradQuery, false));
+    inputs[4].addGrad(Variable(
+        af::moddims(af::sum(af::moddims(gradQuery, A, B), 1), inputs[4].dims()),
+        false));
+    inputs[5].addGrad(
+        Variable(af::moddims(gradWeight, inputs[5].dims()), false));
+    if (prev.isempty()) {
+      return;
+    }
+
+    // The location term is a matrix product of the filter with the frames
+    // around each frame
+    auto flatGradKeys = af::moddims(gradKeys, A, T * B);
+    if (filt.isCalcGrad()) {
+      auto frames =
+          af::moddims(detail::filterFrames(prev.array(), K), K, T * B);
+      filt.addGrad(Variable(af::matmulNT(flatGradKeys, frames), false));
+    }
+    if (prev.isCalcGrad()) {
+      auto gradFrames = af::moddims(
+          af::matmulTN(filt.array(), flatGradKeys), K, T, B);
+      auto gradPrev = af::constant(0, 1, T, B, f32);
+      for (int k = 0; k < K; ++k) {
+        gradPrev = gradPrev +
+            shiftFrames(gradFrames(k, af::span, af::span), (K - 1) / 2 - k);
+      }
+      prev.addGrad(Variable(gradPrev, false));
+    }
+  };
+  return Variable(
+      energies,
+      {keys, query, prevAttn, filter, filterBias, weight},
+      gradFunc);
+}
+
 Variable getLinearTarget(const Variable& targetVar, int T) {
   int L = targetVar.dims(0);
   int B = targetVar.dims(1);
@@ -73,4 +195,25 @@ Variable getLinearTarget(const Variable& targetVar, int T) {
   return Variable(af::array(T, B, newTarget.data()), false);
 }
 
+void topKTransitions(
+    const af::array& trans,
+    int K,
+    af::array& value,
+    af::array& index) {
+  // Column m of `trans` holds the transitions into class m
+  af::array idx;
+  af::topk(value, idx, trans, K, 0, AF_TOPK_MAX);
+  index = idx.as(s32);
+}
+
+af::array scatterTransitionGrad(const af::array& grad, const af::array& index) {
+  int K = index.dims(0);
+  int N = index.dims(1);
+  auto column = af::range(af::dim4(K, N), 1, s32);
+  af::array result = af::constant(0.0, N, N, grad.type());
+  // The indices of a column are distinct, so no gradient is lost
+  result(af::flat(index + column * N)) = af::flat(grad);
+  return result;
+}
+
 } // namespace w2l
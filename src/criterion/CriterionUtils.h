@@ -89,8 +89,95 @@ CriterionScaleMode getCriterionScaleMode(const std::string& onorm, bool sqnorm);
 // Input: N x T x B (type: float), Output: T x B (type: int)
 af::array viterbiPath(const af::array& input, const af::array& trans);
 
+// Input: N x T x B (type: float) CTC emissions, with the blank last, Output:
+// T x B (type: int) best class of each frame with the repeats collapsed and the
+// blanks removed, padded with -1
+af::array ctcGreedyPath(const af::array& input);
+
+// Best alignment of the targets with the Viterbi algorithm. Input: N x T x B
+// (type: float), `target` L x B (type: int) padded with -1, `trans` N x N
+// (type: float) for ASG or empty for CTC, with the blank last, `inputSize` B
+// (type: int) frames of each sample or empty for all T. Output: T x B (type:
+// int) class of each frame along the alignment, -1 beyond the input size
+af::array forcedAlignmentPath(
+    const af::array& input,
+    const af::array& target,
+    const af::array& trans,
+    const af::array& inputSize = af::array());
+
+// Inference step of dot-product attention, one kernel on CUDA, for the B
+// queries `query` (H x 1 x B) over `keys` (H x T x B) and `values` (V x T x B).
+// Output: the attention softmax(query' * keys * scale + bias) (1 x T x B) and
+// the summaries (V x 1 x B). `bias` (1 x T x B) may be empty, `query` and
+// `keys` too for scores which are `bias` only. (type: float)
+std::pair<af::array, af::array> attentionStep(
+    const af::array& query,
+    const af::array& keys,
+    const af::array& values,
+    const af::array& bias,
+    float scale = 1.0);
+
+// Energies of the neural location attention for one decoder step:
+// weight * tanh(keys + query + filterBias + filter (*) prevAttn), where the
+// location term is the K-tap filter of each attention dimension over the
+// previous attention, centered on each frame. `keys` A x T x B, `query`
+// A x 1 x B, `prevAttn` 1 x T x B or empty, `filter` A x K with K odd,
+// `filterBias` A, `weight` 1 x A. Output: 1 x T x B. One kernel on CUDA for
+// the forward and one for the backward, which recomputes the hidden units
+// rather than keeping the A x T x B intermediates. (type: float)
+fl::Variable locationEnergies(
+    const fl::Variable& keys,
+    const fl::Variable& query,
+    const fl::Variable& prevAttn,
+    const fl::Variable& filter,
+    const fl::Variable& filterBias,
+    const fl::Variable& weight);
+
 fl::Variable getLinearTarget(const fl::Variable& target, int T);
 
+// Input: N x N transitions, Output: K x N values and indices (type: int) of
+// the K highest transitions into each class, highest first
+void topKTransitions(
+    const af::array& trans,
+    int K,
+    af::array& value,
+    af::array& index);
+
+// Input: K x N gradient of the transitions selected by `index`, Output: the
+// N x N gradient of all the transitions
+af::array scatterTransitionGrad(const af::array& grad, const af::array& index);
+
+namespace detail {
+
+// Backend implementations of locationEnergies(). Backward: the gradients of
+// the keys, of the query, and of the weight, the rest being derived from the
+// one of the keys.
+af::array locationEnergiesForward(
+    const af::array& keys,
+    const af::array& query,
+    const af::array& prevAttn,
+    const af::array& filter,
+    const af::array& filterBias,
+    const af::array& weight);
+
+void locationEnergiesBackward(
+    const af::array& gradEnergies,
+    const af::array& keys,
+    const af::array& query,
+    const af::array& prevAttn,
+    const af::array& filter,
+    const af::array& filterBias,
+    const af::array& weight,
+    af::array& gradKeys,
+    af::array& gradQuery,
+    af::array& gradWeight);
+
+// The previous attention (1 x T x B) around each frame, as K x T x B: row k
+// is frame t + k - (K - 1) / 2 of `prevAttn` at frame t, 0 outside
+af::array filterFrames(const af::array& prevAttn, int K);
+
+} // namespace detail
+
 // workaround for https://github.com/arrayfire/arrayfire/issues/2273
 // use as a drop-in replacement for af::reorder
 inline af::array reorder(
@@ -18,17 +18,25 @@ namespace w2l {
 
 FullConnectionCriterion::FullConnectionCriterion(
     int N,
-    w2l::CriterionScaleMode scalemode)
-    : N_(N), scaleMode_(scalemode) {
+    w2l::CriterionScaleMode scalemode,
+    int topK)
+    : N_(N), scaleMode_(scalemode), topK_(topK) {
   if (N_ <= 0) {
     throw std::invalid_argument(
         "FCC: Size of transition matrix is less than 0.");
   }
+  if (topK_ < 0) {
+    throw std::invalid_argument("FCC: topK is negative.");
+  }
   auto transition = constant(0.0, af::dim4(N_, N_));
   params_ = {transition};
 }
 
 std::string FullConnectionCriterion::prettyString() const {
+  if (isSparse()) {
+    return "FullConnectionCriterion (top " + std::to_string(topK_) +
+        " transitions)";
+  }
   return "FullConnectionCriterion";
 }
 
@@ -14,11 +14,17 @@
 
 namespace w2l {
 
+/**
+ * The denominator of ASG loss. If 0 < `topK` < N, it only sums over the paths
+ * made of the `topK` highest transitions into each class, selected at every
+ * forward pass, which costs O(T * N * topK) rather than O(T * N * N).
+ */
 class FullConnectionCriterion : public fl::BinaryModule {
  public:
   explicit FullConnectionCriterion(
       int N,
-      w2l::CriterionScaleMode scalemode = w2l::CriterionScaleMode::NONE);
+      w2l::CriterionScaleMode scalemode = w2l::CriterionScaleMode::NONE,
+      int topK = 0);
 
   fl::Variable forward(const fl::Variable& input, const fl::Variable& target)
       override;
@@ -31,11 +37,18 @@ class FullConnectionCriterion : public fl::BinaryModule {
 
   int N_;
   w2l::CriterionScaleMode scaleMode_;
+  int topK_ = 0;
+
+  // Whether the transitions are restricted to the topK_ highest ones
+  bool isSparse() const {
+    return topK_ > 0 && topK_ < N_;
+  }
 
   FL_SAVE_LOAD_WITH_BASE(
       fl::BinaryModule,
       fl::serializeAs<int64_t>(N_),
-      scaleMode_)
+      scaleMode_,
+      fl::versioned(topK_, 1))
 };
 
 typedef FullConnectionCriterion FCCLoss;
@@ -43,3 +56,4 @@ typedef FullConnectionCriterion FCCLoss;
 } // namespace w2l
 
 CEREAL_REGISTER_TYPE(w2l::FullConnectionCriterion)
+CEREAL_CLASS_VERSION(w2l::FullConnectionCriterion, 1)
@@ -8,6 +8,7 @@
 
 #include "Seq2SeqCriterion.h"
 #include <algorithm>
+#include <limits>
 #include <numeric>
 #include <queue>
 
@@ -15,6 +16,38 @@ using namespace fl;
 
 namespace w2l {
 
+namespace {
+// The tensors of a state, owned or shared with the other states of a batch
+Variable hiddenOf(const Seq2SeqState* state, int n) {
+  return state->batch ? state->batch->hidden[n].col(state->batchIdx)
+                      : state->hidden[n];
+}
+
+Variable summaryOf(const Seq2SeqState* state) {
+  return state->batch ? state->batch->summary.col(state->batchIdx)
+                      : state->summary;
+}
+
+// The batch all of `states` come from, if they come from the same
+// decodeBatchStep(), their columns in it being put in `batchIdx`
+std::shared_ptr<Seq2SeqState> commonBatch(
+    const std::vector<Seq2SeqState*>& states,
+    af::array& batchIdx) {
+  std::shared_ptr<Seq2SeqState> batch = states[0]->batch;
+  std::vector<int> idx(states.size());
+  for (int i = 0; i < states.size() && batch; i++) {
+    if (states[i]->batch != batch) {
+      return nullptr;
+    }
+    idx[i] = states[i]->batchIdx;
+  }
+  if (batch) {
+    batchIdx = af::array(idx.size(), idx.data());
+  }
+  return batch;
+}
+} // namespace
+
 namespace detail {
 std::shared_ptr<AttentionBase> buildAttention() {
   std::shared_ptr<AttentionBase> attention;
@@ -37,16 +70,32 @@ std::shared_ptr<AttentionBase> buildAttention() {
         FLAGS_attnconvkernel);
   } else if (FLAGS_attention == w2l::kMultiHeadContentAttention) {
     attention = std::make_shared<MultiHeadContentAttention>(
-        FLAGS_encoderdim, FLAGS_numattnhead);
+        FLAGS_encoderdim,
+        FLAGS_numattnhead,
+        false,
+        false,
+        FLAGS_attnchunksize);
   } else if (FLAGS_attention == w2l::kMultiHeadKeyValueContentAttention) {
     attention = std::make_shared<MultiHeadContentAttention>(
-        FLAGS_encoderdim, FLAGS_numattnhead, true);
+        FLAGS_encoderdim,
+        FLAGS_numattnhead,
+        true,
+        false,
+        FLAGS_attnchunksize);
   } else if (FLAGS_attention == w2l::kMultiHeadSplitContentAttention) {
     attention = std::make_shared<MultiHeadContentAttention>(
-        FLAGS_encoderdim, FLAGS_numattnhead, false, true);
+        FLAGS_encoderdim,
+        FLAGS_numattnhead,
+        false,
+        true,
+        FLAGS_attnchunksize);
   } else if (FLAGS_attention == w2l::kMultiHeadKeyValueSplitContentAttention) {
     attention = std::make_shared<MultiHeadContentAttention>(
-        FLAGS_encoderdim, FLAGS_numattnhead, true, true);
+        FLAGS_encoderdim,
+        FLAGS_numattnhead,
+        true,
+        true,
+        FLAGS_attnchunksize);
   } else {
     throw std::runtime_error("Unimplmented attention: " + FLAGS_attention);
   }
@@ -217,7 +266,7 @@ std::vector<Variable> Seq2SeqCriterion::forward(
   const auto& target = inputs[1];
 
   Variable out, alpha;
-  if (useSequentialDecoder_) {
+  if (needsSequentialDecoder(train_)) {
     std::tie(out, alpha) = decoder(input, target);
   } else {
     std::tie(out, alpha) = vectorizedDecoder(input, target);
@@ -341,6 +390,19 @@ af::array Seq2SeqCriterion::viterbiPath(const af::array& input) {
   return viterbiPathBase(input, false).first;
 }
 
+std::vector<std::vector<int>> Seq2SeqCriterion::batchViterbiPath(
+    const af::array& input) {
+  // The greedy decoding of each utterance
+  std::vector<std::vector<int>> paths(input.dims(2));
+  for (int b = 0; b < input.dims(2); b++) {
+    auto path = viterbiPathBase(input(af::span, af::span, b), false).first;
+    if (!path.isempty()) {
+      paths[b] = afToVector<int>(path);
+    }
+  }
+  return paths;
+}
+
 std::pair<af::array, Variable> Seq2SeqCriterion::viterbiPathBase(
     const af::array& input,
     bool saveAttn) {
@@ -354,8 +416,10 @@ std::pair<af::array, Variable> Seq2SeqCriterion::viterbiPathBase(
   Variable y, ox;
   af::array maxIdx, maxValues;
   int pred;
+  Variable x(input, false);
+  precomputeAttention(x);
   for (int u = 0; u < maxDecoderOutputLen_; u++) {
-    std::tie(ox, state) = decodeStep(Variable(input, false), y, state);
+    std::tie(ox, state) = decodeStep(x, y, state);
     max(maxValues, maxIdx, ox.array());
     maxIdx.host(&pred);
     if (saveAttn) {
@@ -372,6 +436,7 @@ std::pair<af::array, Variable> Seq2SeqCriterion::viterbiPathBase(
     alpha = concatenate(alphaVec, 0);
   }
 
+  clearPrecomputedAttention();
   if (wasTrain) {
     train();
   }
@@ -398,6 +463,10 @@ std::vector<Seq2SeqCriterion::CandidateHypo> Seq2SeqCriterion::beamSearch(
   bool wasTrain = train_;
   eval();
 
+  // All the steps and hypotheses attend to the same encoder output
+  Variable x(input, false);
+  precomputeAttention(x);
+
   std::vector<Seq2SeqCriterion::CandidateHypo> complete;
   std::vector<Seq2SeqCriterion::CandidateHypo> newBeam;
   auto cmpfn = [](Seq2SeqCriterion::CandidateHypo& lhs,
@@ -425,7 +494,7 @@ std::vector<Seq2SeqCriterion::CandidateHypo> Seq2SeqCriterion::beamSearch(
 
     Variable ox;
     Seq2SeqState state;
-    std::tie(ox, state) = decodeStep(Variable(input, false), prevY, prevState);
+    std::tie(ox, state) = decodeStep(x, prevY, prevState);
     ox = logSoftmax(ox, 0); // C x 1 x B
     ox = fl::reorder(ox, 0, 2, 1);
 
@@ -483,6 +552,7 @@ std::vector<Seq2SeqCriterion::CandidateHypo> Seq2SeqCriterion::beamSearch(
     }
   }
 
+  clearPrecomputedAttention();
   if (wasTrain) {
     train();
   }
@@ -490,10 +560,96 @@ std::vector<Seq2SeqCriterion::CandidateHypo> Seq2SeqCriterion::beamSearch(
   return complete.empty() ? beam : complete;
 }
 
+void Seq2SeqCriterion::streamPath(
+    Seq2SeqStream& stream,
+    const af::array& chunk,
+    bool isLast) {
+  if (!window_ || window_->computeSingleStepRange(1, 0).first < 0) {
+    throw std::invalid_argument(
+        "[Seq2SeqCriterion] streaming requires a window with a static range");
+  }
+  for (int i = 0; i < nAttnRound_; i++) {
+    if (std::dynamic_pointer_cast<SimpleLocationAttention>(attention(i)) ||
+        std::dynamic_pointer_cast<LocationAttention>(attention(i)) ||
+        std::dynamic_pointer_cast<NeuralLocationAttention>(attention(i))) {
+      throw std::invalid_argument(
+          "[Seq2SeqCriterion] streaming doesn't support location attentions");
+    }
+  }
+  if (stream.done) {
+    return;
+  }
+  if (!chunk.isempty()) {
+    stream.frames =
+        stream.frames.isempty() ? chunk : af::join(1, stream.frames, chunk);
+    stream.nFrames += chunk.dims(1);
+  }
+  if (stream.nFrames == 0) {
+    stream.done = isLast;
+    return;
+  }
+
+  bool wasTrain = train_;
+  eval();
+  // As the range only grows with the length of the input, a step whose range
+  // is the same for the fed frames and for an unbounded input is final
+  const int kUnboundedSteps = std::numeric_limits<int>::max() / 2;
+  Variable y, ox;
+  af::array maxIdx, maxValues;
+  int pred;
+  stream.done = isLast;
+  while (static_cast<int>(stream.path.size()) < maxDecoderOutputLen_) {
+    int step = stream.state.step;
+    auto range = window_->computeSingleStepRange(stream.nFrames, step);
+    if (!isLast &&
+        range != window_->computeSingleStepRange(kUnboundedSteps, step)) {
+      break;
+    }
+    if (range.first >= range.second || range.first < stream.firstFrame) {
+      throw std::logic_error(
+          "[Seq2SeqCriterion] the window isn't monotonic at step " +
+          std::to_string(step));
+    }
+
+    /* (1) Drop the frames before the window of this step */
+    if (range.first > stream.firstFrame) {
+      stream.frames = stream.frames(
+          af::span, af::seq(range.first - stream.firstFrame, af::end));
+      stream.firstFrame = range.first;
+    }
+
+    /* (2) Attend to the frames of the window only */
+    Variable xWindow(
+        stream.frames(
+            af::span, af::seq(0, range.second - stream.firstFrame - 1)),
+        false);
+    if (!stream.path.empty()) {
+      y = constant(stream.path.back(), 1, s32, false);
+    }
+    std::tie(ox, stream.state) =
+        decodeStep(xWindow, y, stream.state, /* applyWindow = */ false);
+    max(maxValues, maxIdx, ox.array());
+    maxIdx.host(&pred);
+    if (pred == eos_) {
+      stream.done = true;
+      break;
+    }
+    stream.path.push_back(pred);
+  }
+  if (static_cast<int>(stream.path.size()) >= maxDecoderOutputLen_) {
+    stream.done = true;
+  }
+
+  if (wasTrain) {
+    train();
+  }
+}
+
 std::pair<Variable, Seq2SeqState> Seq2SeqCriterion::decodeStep(
     const Variable& xEncoded,
     const Variable& y,
-    const Seq2SeqState& inState) const {
+    const Seq2SeqState& inState,
+    bool applyWindow) const {
   size_t stepSize = af::getMemStepSize();
   af::setMemStepSize(10 * (1 << 10));
   Variable hy;
@@ -521,7 +677,7 @@ std::pair<Variable, Seq2SeqState> Seq2SeqCriterion::decodeStep(
     hy = moddims(hy, {hy.dims(0), 1, hy.dims(1)}); // H x B -> H x 1 x B
 
     Variable windowWeight;
-    if (window_ && (!train_ || trainWithWindow_)) {
+    if (applyWindow && window_ && (!train_ || trainWithWindow_)) {
       windowWeight = window_->computeSingleStepWindow(
           inState.alpha, xEncoded.dims(1), xEncoded.dims(2), inState.step);
     }
@@ -543,50 +699,131 @@ Seq2SeqCriterion::decodeBatchStep(
     const std::vector<Seq2SeqState*>& inStates,
     const int attentionThreshold,
     const float smoothingTemperature) const {
-  // NB: xEncoded has to be with batchsize 1
-  size_t stepSize = af::getMemStepSize();
-  af::setMemStepSize(10 * (1 << 10));
-  int batchSize = ys.size();
-  std::vector<Variable> statesVector(batchSize);
+  af::array inBatchIdx;
+  auto inBatch = commonBatch(inStates, inBatchIdx);
 
   // Batch Ys
-  for (int i = 0; i < batchSize; i++) {
+  for (int i = 0; i < ys.size(); i++) {
     if (ys[i].isempty()) {
       ys[i] = startEmbedding();
     } else {
       ys[i] = embedding()->forward(ys[i]);
       if (inputFeeding_) {
-        ys[i] = ys[i] + moddims(inStates[i]->summary, ys[i].dims());
+        ys[i] = ys[i] + moddims(summaryOf(inStates[i]), ys[i].dims());
       }
     }
     ys[i] = moddims(ys[i], {ys[i].dims(0), -1});
   }
-  Variable yBatched = concatenate(ys, 1); // H x B
+  return decodeBatchStepEmbedded(
+      xEncoded,
+      concatenate(ys, 1), // H x B
+      inStates,
+      inBatch,
+      inBatchIdx,
+      attentionThreshold,
+      smoothingTemperature);
+}
+
+std::pair<std::vector<std::vector<float>>, std::vector<Seq2SeqStatePtr>>
+Seq2SeqCriterion::decodeBatchStep(
+    const fl::Variable& xEncoded,
+    const std::vector<int>& tokens,
+    const std::vector<Seq2SeqState*>& inStates,
+    const int attentionThreshold,
+    const float smoothingTemperature) const {
+  const int batchSize = tokens.size();
+  const int nStart = std::count(tokens.begin(), tokens.end(), -1);
+  if (nStart > 0 && nStart < batchSize) {
+    // Mixed starts and tokens are embedded one by one
+    std::vector<Variable> ys(batchSize);
+    for (int i = 0; i < batchSize; i++) {
+      if (tokens[i] >= 0) {
+        ys[i] = fl::constant(tokens[i], 1, s32, false);
+      }
+    }
+    return decodeBatchStep(
+        xEncoded, ys, inStates, attentionThreshold, smoothingTemperature);
+  }
 
+  af::array inBatchIdx;
+  auto inBatch = commonBatch(inStates, inBatchIdx);
+  Variable yBatched;
+  if (nStart == batchSize) {
+    auto start = startEmbedding();
+    yBatched = tile(moddims(start, {start.dims(0), 1}), {1, batchSize});
+  } else {
+    yBatched = embedding()->forward(
+        Variable(af::array(batchSize, tokens.data()), false));
+    yBatched = moddims(yBatched, {yBatched.dims(0), batchSize}); // H x B
+    if (inputFeeding_) {
+      Variable summaries;
+      if (inBatch) {
+        summaries = inBatch->summary(af::span, inBatchIdx);
+      } else {
+        std::vector<Variable> summaryVector(batchSize);
+        for (int i = 0; i < batchSize; i++) {
+          summaryVector[i] = summaryOf(inStates[i]);
+        }
+        summaries = concatenate(summaryVector, 1);
+      }
+      yBatched = yBatched + moddims(summaries, yBatched.dims());
+    }
+  }
+  return decodeBatchStepEmbedded(
+      xEncoded,
+      yBatched,
+      inStates,
+      inBatch,
+      inBatchIdx,
+      attentionThreshold,
+      smoothingTemperature);
+}
+
+std::pair<std::vector<std::vector<float>>, std::vector<Seq2SeqStatePtr>>
+Seq2SeqCriterion::decodeBatchStepEmbedded(
+    const fl::Variable& xEncoded,
+    fl::Variable yBatched,
+    const std::vector<Seq2SeqState*>& inStates,
+    const std::shared_ptr<Seq2SeqState>& inBatch,
+    const af::array& inBatchIdx,
+    const int attentionThreshold,
+    const float smoothingTemperature) const {
+  // NB: xEncoded has to be with batchsize 1
+  size_t stepSize = af::getMemStepSize();
+  af::setMemStepSize(10 * (1 << 10));
+  int batchSize = inStates.size();
+  std::vector<Variable> statesVector(batchSize);
+
+  // The output states share the batched tensors of this step
+  auto outBatch = std::make_shared<Seq2SeqState>(nAttnRound_);
   std::vector<Seq2SeqStatePtr> outstates(batchSize);
   for (int i = 0; i < batchSize; i++) {
     outstates[i] = std::make_shared<Seq2SeqState>(nAttnRound_);
     outstates[i]->step = inStates[i]->step + 1;
+    outstates[i]->batch = outBatch;
+    outstates[i]->batchIdx = i;
   }
   Variable outStateBatched;
 
   for (int n = 0; n < nAttnRound_; n++) {
     /* (1) RNN forward */
-    if (inStates[0]->hidden[n].isempty()) {
+    if (!inStates[0]->batch && inStates[0]->hidden[n].isempty()) {
       std::tie(yBatched, outStateBatched) =
           decodeRNN(n)->forward(yBatched, Variable());
     } else {
-      for (int i = 0; i < batchSize; i++) {
-        statesVector[i] = inStates[i]->hidden[n];
+      Variable inStateHiddenBatched;
+      if (inBatch) {
+        inStateHiddenBatched = inBatch->hidden[n](af::span, inBatchIdx);
+      } else {
+        for (int i = 0; i < batchSize; i++) {
+          statesVector[i] = hiddenOf(inStates[i], n);
+        }
+        inStateHiddenBatched = concatenate(statesVector, 1).linear();
       }
-      Variable inStateHiddenBatched = concatenate(statesVector, 1).linear();
       std::tie(yBatched, outStateBatched) =
           decodeRNN(n)->forward(yBatched, inStateHiddenBatched);
     }
-
-    for (int i = 0; i < batchSize; i++) {
-      outstates[i]->hidden[n] = outStateBatched.col(i);
-    }
+    outBatch->hidden[n] = outStateBatched;
 
     /* (2) Attention forward */
     if (window_ && (!train_ || trainWithWindow_)) {
@@ -612,17 +849,21 @@ Seq2SeqCriterion::decodeBatchStep(
       outstates[i]->isValid =
           std::abs(outstates[i]->peakAttnPos - inStates[i]->peakAttnPos) <=
           attentionThreshold;
-      outstates[i]->alpha = alphaBatched.col(i);
-      outstates[i]->summary = yBatched.col(i);
     }
+    outBatch->alpha = alphaBatched;
+    outBatch->summary = yBatched;
   }
 
   /* (3) Linear forward */
   auto outBatched = linearOut()->forward(yBatched);
   outBatched = logSoftmax(outBatched / smoothingTemperature, 0);
+  // Copy all the scores at once, C x B column-major
+  auto outScores = w2l::afToVector<float>(outBatched);
+  int nClass = outBatched.dims(0);
   std::vector<std::vector<float>> out(batchSize);
   for (int i = 0; i < batchSize; i++) {
-    out[i] = w2l::afToVector<float>(outBatched.col(i));
+    out[i].assign(
+        outScores.begin() + i * nClass, outScores.begin() + (i + 1) * nClass);
   }
 
   af::setMemStepSize(stepSize);
@@ -630,20 +871,27 @@ Seq2SeqCriterion::decodeBatchStep(
 }
 
 void Seq2SeqCriterion::setUseSequentialDecoder() {
-  useSequentialDecoder_ = false;
-  if ((pctTeacherForcing_ < 100 && samplingStrategy_ == w2l::kModelSampling) ||
-      samplingStrategy_ == w2l::kGumbelSampling || inputFeeding_) {
-    useSequentialDecoder_ = true;
-  } else if (
+  useSequentialDecoder_ = needsSequentialDecoder(true);
+}
+
+bool Seq2SeqCriterion::needsSequentialDecoder(bool train) const {
+  // The steps feeding back the previous output or attention can't run at once
+  if (inputFeeding_ ||
       std::dynamic_pointer_cast<SimpleLocationAttention>(attention(0)) ||
       std::dynamic_pointer_cast<LocationAttention>(attention(0)) ||
       std::dynamic_pointer_cast<NeuralLocationAttention>(attention(0))) {
-    useSequentialDecoder_ = true;
-  } else if (
-      window_ && trainWithWindow_ &&
+    return true;
+  }
+  if (window_ && (!train || trainWithWindow_) &&
       std::dynamic_pointer_cast<MedianWindow>(window_)) {
-    useSequentialDecoder_ = true;
+    return true;
   }
+  // Outside of training, the decoder is always fed the target, so the steps
+  // run in parallel whatever the sampling strategy
+  return train &&
+      ((pctTeacherForcing_ < 100 &&
+        samplingStrategy_ == w2l::kModelSampling) ||
+       samplingStrategy_ == w2l::kGumbelSampling);
 }
 
 std::string Seq2SeqCriterion::prettyString() const {
@@ -668,33 +916,32 @@ AMUpdateFunc buildAmUpdateFunction(
                           const std::vector<AMStatePtr>& rawPrevStates,
                           int& t) {
     if (t == 0) {
+      // Replaces the projections of the previous utterance
       buf->input = fl::Variable(af::array(N, T, emissions), false);
+      s2sCriterion->precomputeAttention(buf->input);
     }
     int batchSize = rawY.size();
     buf->prevStates.resize(0);
-    buf->ys.resize(0);
+    buf->tokens.resize(0);
 
     // Cast to seq2seq states
     for (int i = 0; i < batchSize; i++) {
       Seq2SeqState* prevState =
           static_cast<Seq2SeqState*>(rawPrevStates[i].get());
-      fl::Variable y;
-      if (t > 0) {
-        y = fl::constant(rawY[i], 1, s32, false);
-      } else {
+      if (t == 0) {
         prevState = &buf->dummyState;
       }
-      buf->ys.push_back(y);
+      buf->tokens.push_back(t > 0 ? rawY[i] : -1);
       buf->prevStates.push_back(prevState);
     }
 
-    // Run forward in batch
+    // Run forward in batch, the states being gathered from the previous step
     std::vector<std::vector<float>> amScores;
     std::vector<Seq2SeqStatePtr> outStates;
 
     std::tie(amScores, outStates) = s2sCriterion->decodeBatchStep(
         buf->input,
-        buf->ys,
+        buf->tokens,
         buf->prevStates,
         buf->attentionThreshold,
         buf->smoothingTemperature);
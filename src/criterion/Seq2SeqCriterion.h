@@ -25,15 +25,42 @@ struct Seq2SeqState {
   int step;
   int peakAttnPos;
   bool isValid;
+  // The states returned by decodeBatchStep() don't own their tensors: they
+  // are column `batchIdx` of alpha, hidden and summary of `batch`, which is
+  // shared by all the states of a step and never modified.
+  std::shared_ptr<Seq2SeqState> batch;
+  int batchIdx;
 
-  Seq2SeqState() : hidden(1), step(0), peakAttnPos(-1), isValid(false) {}
+  Seq2SeqState()
+      : hidden(1), step(0), peakAttnPos(-1), isValid(false), batchIdx(-1) {}
 
   explicit Seq2SeqState(int nAttnRound)
-      : hidden(nAttnRound), step(0), peakAttnPos(-1), isValid(false) {}
+      : hidden(nAttnRound),
+        step(0),
+        peakAttnPos(-1),
+        isValid(false),
+        batchIdx(-1) {}
 };
 
 typedef std::shared_ptr<Seq2SeqState> Seq2SeqStatePtr;
 
+/**
+ * State of a greedy decoding whose encoder output is fed by chunks: `frames`
+ * holds the fed frames from `firstFrame`, the earlier ones being out of the
+ * window of all the next steps.
+ */
+struct Seq2SeqStream {
+  Seq2SeqState state;
+  af::array frames; // H x (nFrames - firstFrame)
+  int firstFrame;
+  int nFrames;
+  std::vector<int> path;
+  bool done;
+
+  explicit Seq2SeqStream(int nAttnRound)
+      : state(nAttnRound), firstFrame(0), nFrames(0), done(false) {}
+};
+
 class Seq2SeqCriterion : public SequenceCriterion {
  public:
   struct CandidateHypo {
@@ -80,6 +107,9 @@ class Seq2SeqCriterion : public SequenceCriterion {
 
   af::array viterbiPath(const af::array& input) override;
 
+  std::vector<std::vector<int>> batchViterbiPath(
+      const af::array& input) override;
+
   std::pair<af::array, fl::Variable> viterbiPathBase(
       const af::array& input,
       bool saveAttn);
@@ -92,6 +122,17 @@ class Seq2SeqCriterion : public SequenceCriterion {
 
   std::vector<int> beamPath(const af::array& input, int beamSize = 10);
 
+  /* Greedy decoding of the next `chunk` (H x T) of an encoder output, for a
+   * window whose range doesn't depend on the previous attention: a step runs
+   * as soon as the frames of its window are all fed, attending to them only,
+   * so that the memory doesn't grow with the length of the input. The steps
+   * are appended to `stream.path` until EOS, or until the end of the frames
+   * if `isLast`. */
+  void streamPath(
+      Seq2SeqStream& stream,
+      const af::array& chunk,
+      bool isLast);
+
   std::string prettyString() const override;
 
   std::shared_ptr<fl::Embedding> embedding() const {
@@ -114,6 +155,20 @@ class Seq2SeqCriterion : public SequenceCriterion {
     return params_.back();
   }
 
+  /* Precomputes the encoder projections of the attentions for the decoding
+   * steps on `xEncoded`, see AttentionBase::precompute() */
+  void precomputeAttention(const fl::Variable& xEncoded) const {
+    for (int i = 0; i < nAttnRound_; i++) {
+      attention(i)->precompute(xEncoded);
+    }
+  }
+
+  void clearPrecomputedAttention() const {
+    for (int i = 0; i < nAttnRound_; i++) {
+      attention(i)->clearPrecomputed();
+    }
+  }
+
   std::pair<std::vector<std::vector<float>>, std::vector<Seq2SeqStatePtr>>
   decodeBatchStep(
       const fl::Variable& xEncoded,
@@ -122,10 +177,26 @@ class Seq2SeqCriterion : public SequenceCriterion {
       const int attentionThreshold = std::numeric_limits<int>::infinity(),
       const float smoothingTemperature = 1.0) const;
 
+  /**
+   * decodeBatchStep() from the previous token of each state (-1 at the start
+   * of the sequence), for the beam search: the tokens are embedded by a single
+   * lookup, and when the input states all come from the same step, as they do
+   * in a beam, their hidden states and summaries are gathered from its batch
+   * by index instead of being concatenated column by column.
+   */
+  std::pair<std::vector<std::vector<float>>, std::vector<Seq2SeqStatePtr>>
+  decodeBatchStep(
+      const fl::Variable& xEncoded,
+      const std::vector<int>& tokens,
+      const std::vector<Seq2SeqState*>& inStates,
+      const int attentionThreshold = std::numeric_limits<int>::infinity(),
+      const float smoothingTemperature = 1.0) const;
+
   std::pair<fl::Variable, Seq2SeqState> decodeStep(
       const fl::Variable& xEncoded,
       const fl::Variable& y,
-      const Seq2SeqState& instate) const;
+      const Seq2SeqState& instate,
+      bool applyWindow = true) const;
 
   void clearWindow() {
     trainWithWindow_ = false;
@@ -178,6 +249,26 @@ class Seq2SeqCriterion : public SequenceCriterion {
   Seq2SeqCriterion() = default;
 
   void setUseSequentialDecoder();
+
+  /*
+   * decodeBatchStep() from the embedded previous tokens `yBatched` (H x B).
+   * `inBatch` is the batch all the input states come from, if any, and
+   * `inBatchIdx` their columns in it.
+   */
+  std::pair<std::vector<std::vector<float>>, std::vector<Seq2SeqStatePtr>>
+  decodeBatchStepEmbedded(
+      const fl::Variable& xEncoded,
+      fl::Variable yBatched,
+      const std::vector<Seq2SeqState*>& inStates,
+      const std::shared_ptr<Seq2SeqState>& inBatch,
+      const af::array& inBatchIdx,
+      const int attentionThreshold,
+      const float smoothingTemperature) const;
+
+  /* Whether the decoder steps must run one at a time, in train mode or not.
+   * Teacher forcing without a step-dependent window or attention runs them all
+   * at once, by one call of each decoder layer and attention. */
+  bool needsSequentialDecoder(bool train) const;
 };
 
 w2l::Seq2SeqCriterion buildSeq2Seq(int numClasses, int eosIdx);
@@ -186,7 +277,7 @@ w2l::Seq2SeqCriterion buildSeq2Seq(int numClasses, int eosIdx);
 struct Seq2SeqDecoderBuffer {
   fl::Variable input;
   Seq2SeqState dummyState;
-  std::vector<fl::Variable> ys;
+  std::vector<int> tokens;
   std::vector<Seq2SeqState*> prevStates;
   int attentionThreshold;
   double smoothingTemperature;
@@ -199,7 +290,7 @@ struct Seq2SeqDecoderBuffer {
       : dummyState(nAttnRound),
         attentionThreshold(attnThre),
         smoothingTemperature(smootTemp) {
-    ys.reserve(beamSize);
+    tokens.reserve(beamSize);
     prevStates.reserve(beamSize);
   }
 };
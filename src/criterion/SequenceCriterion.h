@@ -8,6 +8,8 @@
 
 #pragma once
 
+#include <vector>
+
 #include <flashlight/flashlight.h>
 
 namespace w2l {
@@ -16,6 +18,25 @@ class SequenceCriterion : public fl::Container {
  public:
   virtual af::array viterbiPath(const af::array& input) = 0;
 
+  /* Returns the best path of each of the B utterances of `input` (N x T x B).
+   * The paths of the criterions whose viterbiPath() returns a T x B array are
+   * computed by one call and copied to the host by one transfer. */
+  virtual std::vector<std::vector<int>> batchViterbiPath(
+      const af::array& input) {
+    auto path = viterbiPath(input);
+    int T = path.dims(0);
+    int B = path.dims(1);
+    std::vector<int> pathVec(path.elements());
+    if (!pathVec.empty()) {
+      path.as(s32).host(pathVec.data());
+    }
+    std::vector<std::vector<int>> paths(B);
+    for (int b = 0; b < B; ++b) {
+      paths[b].assign(pathVec.begin() + b * T, pathVec.begin() + (b + 1) * T);
+    }
+    return paths;
+  }
+
  private:
   FL_SAVE_LOAD_WITH_BASE(fl::Container)
 };
@@ -10,6 +10,8 @@
 
 #include <flashlight/flashlight.h>
 
+#include "criterion/CriterionUtils.h"
+
 namespace w2l {
 
 class AttentionBase : public fl::Container {
@@ -55,7 +57,89 @@ class AttentionBase : public fl::Container {
       const fl::Variable& prevAttn,
       const fl::Variable& attnWeight) = 0;
 
+  /**
+   * Computes once the projections of the encoder output which don't depend
+   * on the decoder state (e.g. the keys and values of the multi-head
+   * attention) for the decoding steps on `xEncoded`. In eval mode, forward()
+   * reuses them whenever it is passed this same `xEncoded`, so that the cost
+   * of a step is the one of its queries, whatever the number of steps and of
+   * hypotheses in the batch. The cache holds until clearPrecomputed() or the
+   * next call.
+   */
+  void precompute(const fl::Variable& xEncoded) {
+    precomputedFor_ = xEncoded;
+    precomputed_ = projectEncoder(xEncoded);
+    for (auto& projection : precomputed_) {
+      projection.array().eval();
+    }
+  }
+
+  void clearPrecomputed() {
+    precomputedFor_ = fl::Variable();
+    precomputed_.clear();
+  }
+
+  /**
+   * Computes the attention and the summaries of the inference steps by
+   * attentionStep(), one kernel on CUDA, rather than module by module. Off
+   * by default.
+   */
+  static void setFusedInference(bool fused) {
+    fusedInference() = fused;
+  }
+
+ protected:
+  /* The projections of the encoder output cached by precompute(), none by
+   * default */
+  virtual std::vector<fl::Variable> projectEncoder(
+      const fl::Variable& /* xEncoded */) {
+    return {};
+  }
+
+  /* projectEncoder(`xEncoded`), from the cache if precomputed for it */
+  std::vector<fl::Variable> encoderProjections(const fl::Variable& xEncoded) {
+    if (!train_ && !precomputed_.empty() &&
+        &precomputedFor_.array() == &xEncoded.array()) {
+      return precomputed_;
+    }
+    return projectEncoder(xEncoded);
+  }
+
+  /* Whether forward() is a decoding step, which needs no gradient, to be
+   * fused: the attention of a single step in eval mode, with
+   * setFusedInference(true) */
+  bool isInferenceStep(const fl::Variable& state) const {
+    return fusedInference() && !train_ && state.dims(1) == 1;
+  }
+
+  /* The attention and the summaries of an inference step, fused in one kernel
+   * on CUDA. The scores are `scale` * `query`' * `keys` + `bias` + the log of
+   * `attnWeight`, see attentionStep(). */
+  static std::pair<fl::Variable, fl::Variable> inferenceStep(
+      const af::array& query,
+      const af::array& keys,
+      const af::array& values,
+      af::array bias,
+      const fl::Variable& attnWeight,
+      float scale = 1.0) {
+    if (!attnWeight.isempty()) {
+      auto logWeight = af::log(attnWeight.array());
+      bias = bias.isempty() ? logWeight : bias + logWeight;
+    }
+    auto result = attentionStep(query, keys, values, bias, scale);
+    return std::make_pair(
+        fl::Variable(result.first, false), fl::Variable(result.second, false));
+  }
+
  private:
+  static bool& fusedInference() {
+    static bool fused = false;
+    return fused;
+  }
+
+  fl::Variable precomputedFor_;
+  std::vector<fl::Variable> precomputed_;
+
   FL_SAVE_LOAD_WITH_BASE(fl::Container)
 };
 
@@ -23,8 +23,19 @@ std::pair<Variable, Variable> ContentAttention::forward(
     throw std::invalid_argument("Invalid dimension for content attention");
   }
 
-  auto keys = keyValue_ ? xEncoded(af::seq(0, dim / 2 - 1)) : xEncoded;
-  auto values = keyValue_ ? xEncoded(af::seq(dim / 2, dim - 1)) : xEncoded;
+  auto projections = encoderProjections(xEncoded);
+  const auto& keys = projections[0];
+  const auto& values = projections[1];
+
+  if (isInferenceStep(state)) {
+    return inferenceStep(
+        state.array(),
+        keys.array(),
+        values.array(),
+        af::array(),
+        attnWeight,
+        1.0 / std::sqrt(state.dims(0)));
+  }
 
   // [targetlen, seqlen, batchsize]
   auto innerProd = matmulTN(state, keys) / std::sqrt(state.dims(0));
@@ -42,6 +53,16 @@ std::pair<Variable, Variable> ContentAttention::forward(
   return std::make_pair(attention, summaries);
 }
 
+std::vector<Variable> ContentAttention::projectEncoder(
+    const Variable& xEncoded) {
+  if (!keyValue_) {
+    return {xEncoded, xEncoded};
+  }
+  int dim = xEncoded.dims(0);
+  return {xEncoded(af::seq(0, dim / 2 - 1)),
+          xEncoded(af::seq(dim / 2, dim - 1))};
+}
+
 std::string ContentAttention::prettyString() const {
   return "ContentBasedAttention";
 }
@@ -76,6 +97,11 @@ std::pair<Variable, Variable> NeuralContentAttention::forward(
   // [targetlen, seqlen, batchsize]
   auto nnOut = moddims(module(0)->forward({hidden}).front(), {U, T, B});
 
+  if (isInferenceStep(state)) {
+    return inferenceStep(
+        af::array(), af::array(), xEncoded.array(), nnOut.array(), attnWeight);
+  }
+
   if (!attnWeight.isempty()) {
     nnOut = nnOut + log(attnWeight);
   }
@@ -24,6 +24,11 @@ class ContentAttention : public AttentionBase {
 
   std::string prettyString() const override;
 
+ protected:
+  /* The keys and the values */
+  std::vector<fl::Variable> projectEncoder(
+      const fl::Variable& xEncoded) override;
+
  private:
   bool keyValue_;
 
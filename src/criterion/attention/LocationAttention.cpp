@@ -34,13 +34,26 @@ std::pair<Variable, Variable> SimpleLocationAttention::forward(
   int T = xEncoded.dims(1);
   int B = xEncoded.dims(2);
 
-  // [1, seqlen, batchsize]
-  auto innerProd = matmulTN(state, xEncoded);
-
+  Variable Ha;
   if (!prevAttn.isempty()) {
-    auto Ha = moddims(
+    Ha = moddims(
         module(0)->forward({moddims(prevAttn, {1, T, 1, B})}).front(),
         {1, T, B});
+  }
+
+  if (isInferenceStep(state)) {
+    return inferenceStep(
+        state.array(),
+        xEncoded.array(),
+        xEncoded.array(),
+        Ha.isempty() ? af::array() : Ha.array(),
+        attnWeight);
+  }
+
+  // [1, seqlen, batchsize]
+  auto innerProd = matmulTN(state, xEncoded);
+
+  if (!Ha.isempty()) {
     innerProd = innerProd + Ha;
   }
 
@@ -84,6 +97,20 @@ std::pair<Variable, Variable> LocationAttention::forward(
   int T = xEncoded.dims(1);
   int B = xEncoded.dims(2);
 
+  if (isInferenceStep(state)) {
+    // state' * x + state' * Ha = state' * (x + Ha)
+    auto keys = xEncoded.array();
+    if (!prevAttn.isempty()) {
+      keys = keys +
+          moddims(
+              module(0)->forward({moddims(prevAttn, {1, T, 1, B})}).front(),
+              {H, T, B})
+              .array();
+    }
+    return inferenceStep(
+        state.array(), keys, xEncoded.array(), af::array(), attnWeight);
+  }
+
   auto innerProd = matmulTN(state, xEncoded);
 
   if (!prevAttn.isempty()) {
@@ -140,19 +167,37 @@ std::pair<Variable, Variable> NeuralLocationAttention::forward(
   int T = xEncoded.dims(1);
   int B = xEncoded.dims(2);
 
-  auto Hx = module(0)->forward({xEncoded}).front();
-  auto tileHy = tile(module(1)->forward({state}).front(), {1, T, 1});
+  auto Hx = encoderProjections(xEncoded).front();
+  auto Hy = module(1)->forward({state}).front();
 
   // [1, seqlen, batchsize]
-  auto hidden = Hx + tileHy;
-  if (!prevAttn.isempty()) {
-    auto Ha = moddims(
-        module(2)->forward({moddims(prevAttn, {1, T, 1, B})}).front(),
-        {-1, T, B});
-    hidden = hidden + Ha;
+  Variable nnOut;
+  Variable filter, filterBias;
+  if (fusedEnergies() && Hx.type() == f32 &&
+      locationFilter(filter, filterBias)) {
+    if (prevAttn.isempty()) {
+      // No location term, and no gradient for its parameters
+      filter = Variable(filter.array(), false);
+      filterBias = Variable(af::constant(0, filterBias.dims(), f32), false);
+    }
+    nnOut = locationEnergies(
+        Hx, Hy, prevAttn, filter, filterBias, module(4)->param(0));
+  } else {
+    auto hidden = Hx + tile(Hy, {1, T, 1});
+    if (!prevAttn.isempty()) {
+      auto Ha = moddims(
+          module(2)->forward({moddims(prevAttn, {1, T, 1, B})}).front(),
+          {-1, T, B});
+      hidden = hidden + Ha;
+    }
+    hidden = module(3)->forward({hidden}).front();
+    nnOut = module(4)->forward({hidden}).front();
+  }
+
+  if (isInferenceStep(state)) {
+    return inferenceStep(
+        af::array(), af::array(), xEncoded.array(), nnOut.array(), attnWeight);
   }
-  hidden = module(3)->forward({hidden}).front();
-  auto nnOut = module(4)->forward({hidden}).front();
 
   if (!attnWeight.isempty()) {
     nnOut = nnOut + log(attnWeight);
@@ -167,6 +212,39 @@ std::pair<Variable, Variable> NeuralLocationAttention::forward(
   return std::make_pair(attention, summaries);
 }
 
+bool NeuralLocationAttention::locationFilter(
+    Variable& filter,
+    Variable& filterBias) {
+  auto location = std::dynamic_pointer_cast<Sequential>(module(2));
+  if (!location || location->modules().size() != 3 ||
+      !std::dynamic_pointer_cast<Tanh>(module(3)) ||
+      module(4)->params().size() != 1) {
+    return false;
+  }
+  auto conv = location->module(0);
+  auto projection = location->module(2);
+  if (conv->params().size() != 2 || projection->params().size() != 1) {
+    return false;
+  }
+  // Conv2D weight [1, K, 1, C] and bias [1, 1, C, 1], Linear weight [A, C]:
+  // the projection of the convolution is a convolution with A channels
+  auto convWeight = conv->param(0);
+  int K = convWeight.dims(1);
+  int C = convWeight.dims(3);
+  if (K % 2 == 0 || convWeight.type() != f32) {
+    return false;
+  }
+  auto weight = projection->param(0);
+  filter = matmulNT(weight, moddims(convWeight, {K, C}));
+  filterBias = matmul(weight, moddims(conv->param(1), {C, 1}));
+  return true;
+}
+
+std::vector<Variable> NeuralLocationAttention::projectEncoder(
+    const Variable& xEncoded) {
+  return {module(0)->forward({xEncoded}).front()};
+}
+
 std::string NeuralLocationAttention::prettyString() const {
   return "NeuralLocationBasedAttention";
 }
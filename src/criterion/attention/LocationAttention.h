@@ -64,9 +64,35 @@ class NeuralLocationAttention : public AttentionBase {
 
   std::string prettyString() const override;
 
+  /**
+   * Computes the energies of float32 inputs by locationEnergies(), one kernel
+   * for the forward and one for the backward on CUDA, rather than module by
+   * module. Off by default.
+   */
+  static void setFusedEnergies(bool fused) {
+    fusedEnergies() = fused;
+  }
+
+ protected:
+  /* The projection of the encoder output into the attention space */
+  std::vector<fl::Variable> projectEncoder(
+      const fl::Variable& xEncoded) override;
+
  private:
   NeuralLocationAttention() = default;
 
+  static bool& fusedEnergies() {
+    static bool fused = false;
+    return fused;
+  }
+
+  /**
+   * The location term folded into one A x K filter and its bias, for
+   * locationEnergies(), which computes the energies in one kernel. False if
+   * the modules aren't the ones the constructor adds, or the filter is even.
+   */
+  bool locationFilter(fl::Variable& filter, fl::Variable& filterBias);
+
   FL_SAVE_LOAD_WITH_BASE(AttentionBase)
 };
 } // namespace w2l
@@ -51,14 +51,10 @@ Variable MedianWindow::computeSingleStepWindow(
       af::abs(clamp(startIdx + wL_ + wR_ - inputSteps, 0, wL_ + wR_));
   startIdx = startIdx - endDiff;
 
-  auto maskArray = af::constant(0.0, 1, inputSteps, batchSize, f32);
-  auto indices = range(af::dim4(width, batchSize), 0) +
-      tile(moddims(startIdx, {1, batchSize}), {width, 1}) +
-      tile(moddims(
-               af::seq(0, batchSize * inputSteps - 1, inputSteps),
-               {1, batchSize}),
-           {width, 1});
-  maskArray(flat(indices)) = 1.0;
+  // The windows of the whole batch by one comparison with the frame indices
+  auto ts = range(af::dim4(1, inputSteps, batchSize), 1);
+  auto starts = tile(moddims(startIdx, {1, 1, batchSize}), {1, inputSteps});
+  auto maskArray = ((ts >= starts) && (ts < starts + width)).as(f32);
 
   // [1, inputSteps, batchSize]
   auto mask = Variable(maskArray, false);
@@ -66,6 +62,7 @@ Variable MedianWindow::computeSingleStepWindow(
   return mask;
 }
 
+/* The window of a step depends on the attention of the previous one */
 Variable MedianWindow::computeWindowMask(
     int /* unused */,
     int /* unused */,
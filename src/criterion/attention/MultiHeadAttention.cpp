@@ -8,18 +8,119 @@
 
 #include "criterion/attention/MultiHeadAttention.h"
 
+#include <algorithm>
 #include <cmath>
 
 using namespace fl;
 
+namespace {
+
+// Scores of the query rows `rows` (R x D x BH) over the keys (T x D x BH)
+af::array chunkScores(
+    const af::array& query,
+    const af::array& key,
+    const af::array& logWeight,
+    const af::seq& rows,
+    float scale) {
+  auto scores = af::matmulNT(query, key) * scale;
+  if (!logWeight.isempty()) {
+    scores += logWeight(rows, af::span, af::span);
+  }
+  return scores;
+}
+
+/**
+ * Scaled dot-product attention of `query` (U x D x BH) over `key` and `value`
+ * (T x D x BH), computed `chunkSize` query rows at a time. The scores of a
+ * chunk are dropped once its summaries are computed, and recomputed from the
+ * log-sum-exp of its rows by the backward pass, so that the gradient keeps the
+ * inputs only. Returns the summaries (U x D x BH) and the attention (U x T x
+ * BH), which has no gradient.
+ */
+std::pair<Variable, af::array> chunkedAttention(
+    const Variable& query,
+    const Variable& key,
+    const Variable& value,
+    const af::array& logWeight,
+    float scale,
+    int chunkSize) {
+  int U = query.dims(0);
+  int T = key.dims(0);
+  int BH = query.dims(2);
+  auto type = query.type();
+
+  af::array attention(U, T, BH, type);
+  af::array summaries(U, value.dims(1), BH, type);
+  af::array logSumExp(U, 1, BH, type);
+  for (int u = 0; u < U; u += chunkSize) {
+    auto rows = af::seq(u, std::min(u + chunkSize, U) - 1);
+    auto scores = chunkScores(
+        query.array()(rows, af::span, af::span),
+        key.array(),
+        logWeight,
+        rows,
+        scale);
+    auto maxScores = af::max(scores, 1);
+    auto expScores = af::exp(scores - af::tile(maxScores, 1, T));
+    auto sumExp = af::sum(expScores, 1);
+    auto chunk = expScores / af::tile(sumExp, 1, T);
+    attention(rows, af::span, af::span) = chunk;
+    summaries(rows, af::span, af::span) = af::matmul(chunk, value.array());
+    logSumExp(rows, af::span, af::span) = maxScores + af::log(sumExp);
+  }
+
+  auto gradFunc = [logSumExp, logWeight, scale, chunkSize](
+                      std::vector<Variable>& inputs,
+                      const Variable& gradOutput) {
+    const auto& q = inputs[0].array();
+    const auto& k = inputs[1].array();
+    const auto& v = inputs[2].array();
+    const auto& gradSummaries = gradOutput.array();
+    int U = q.dims(0);
+    int T = k.dims(0);
+
+    auto gradQuery = af::constant(0, q.dims(), q.type());
+    auto gradKey = af::constant(0, k.dims(), k.type());
+    auto gradValue = af::constant(0, v.dims(), v.type());
+    for (int u = 0; u < U; u += chunkSize) {
+      auto rows = af::seq(u, std::min(u + chunkSize, U) - 1);
+      af::array chunkQuery = q(rows, af::span, af::span);
+      af::array chunkGrad = gradSummaries(rows, af::span, af::span);
+      auto chunk = af::exp(
+          chunkScores(chunkQuery, k, logWeight, rows, scale) -
+          af::tile(logSumExp(rows, af::span, af::span), 1, T));
+
+      gradValue += af::matmulTN(chunk, chunkGrad);
+      // Gradient of the scores through the softmax
+      auto gradChunk = af::matmulNT(chunkGrad, v);
+      auto gradScores = chunk *
+          (gradChunk - af::tile(af::sum(gradChunk * chunk, 1), 1, T)) * scale;
+      gradQuery(rows, af::span, af::span) = af::matmul(gradScores, k);
+      gradKey += af::matmulTN(gradScores, chunkQuery);
+    }
+    inputs[0].addGrad(Variable(gradQuery, false));
+    inputs[1].addGrad(Variable(gradKey, false));
+    inputs[2].addGrad(Variable(gradValue, false));
+  };
+
+  return std::make_pair(
+      Variable(summaries, {query, key, value}, gradFunc), attention);
+}
+
+} // namespace
+
 namespace w2l {
 
 MultiHeadContentAttention::MultiHeadContentAttention(
     int dim,
     int numHeads /* = 8 */,
     bool keyValue /* = false */,
-    bool splitInput /* = false */)
-    : numHeads_(numHeads), keyValue_(keyValue), splitInput_(splitInput) {
+    bool splitInput /* = false */,
+    int chunkSize /* = 0 */)
+    : numHeads_(numHeads),
+      keyValue_(keyValue),
+      splitInput_(splitInput),
+      chunkSize_(chunkSize) {
   if (splitInput && dim % numHeads != 0) {
     throw std::invalid_argument("Invalid dimensions");
   }
@@ -47,33 +148,37 @@ std::pair<Variable, Variable> MultiHeadContentAttention::forward(
     throw std::invalid_argument("Invalid input encoder dimension");
   }
 
-  auto xEncodedKey =
-      keyValue_ ? xEncoded(af::seq(0, hEncode / 2 - 1)) : xEncoded;
-  auto xEncodedValue =
-      keyValue_ ? xEncoded(af::seq(hEncode / 2, hEncode - 1)) : xEncoded;
-
   auto query = splitInput_ ? state : module(0)->forward({state})[0];
-  auto key = splitInput_ ? xEncodedKey : module(1)->forward({xEncodedKey})[0];
-  auto value =
-      splitInput_ ? xEncodedValue : module(2)->forward({xEncodedValue})[0];
-
   query = moddims(reorder(query, 1, 0, 2), {U, hiddenDim, B * numHeads_});
-  key = moddims(reorder(key, 1, 0, 2), {T, hiddenDim, B * numHeads_});
-  value = moddims(reorder(value, 1, 0, 2), {T, hiddenDim, B * numHeads_});
-
-  // [U, T, B * numHeads_]
-  auto innerProd =
-      matmulNT(query, key) / std::sqrt(static_cast<float>(hiddenDim));
-
-  if (!attnWeight.isempty()) {
-    innerProd = innerProd + tile(log(attnWeight), {1, 1, numHeads_});
+  auto projections = encoderProjections(xEncoded);
+  const auto& key = projections[0];
+  const auto& value = projections[1];
+
+  float scale = 1.0 / std::sqrt(static_cast<float>(hiddenDim));
+  Variable attention, summaries;
+  if (chunkSize_ > 0 && (attnWeight.isempty() || !attnWeight.isCalcGrad())) {
+    auto logWeight = attnWeight.isempty()
+        ? af::array()
+        : af::tile(af::log(attnWeight.array()), 1, 1, numHeads_);
+    af::array attentionArray;
+    std::tie(summaries, attentionArray) =
+        chunkedAttention(query, key, value, logWeight, scale, chunkSize_);
+    attention = Variable(attentionArray, false);
+  } else {
+    // [U, T, B * numHeads_]
+    auto innerProd =
+        matmulNT(query, key) / std::sqrt(static_cast<float>(hiddenDim));
+
+    if (!attnWeight.isempty()) {
+      innerProd = innerProd + tile(log(attnWeight), {1, 1, numHeads_});
+    }
+
+    // [U, T, B * numHeads_]
+    attention = softmax(innerProd, 1);
+    // [U, hiddendim, B * numHeads_]
+    summaries = matmul(attention, value);
   }
 
-  // [U, T, B * numHeads_]
-  auto attention = softmax(innerProd, 1);
-  // [U, hiddendim, B * numHeads_]
-  auto summaries = matmul(attention, value);
-
   // [hiddendim * numHeads_, U, B];
   summaries = reorder(moddims(summaries, {U, hState, B}), 1, 0, 2);
 
@@ -86,6 +191,27 @@ std::pair<Variable, Variable> MultiHeadContentAttention::forward(
   return std::make_pair(attention, out_summaries);
 }
 
+std::vector<Variable> MultiHeadContentAttention::projectEncoder(
+    const Variable& xEncoded) {
+  int hEncode = xEncoded.dims(0);
+  int T = xEncoded.dims(1);
+  int B = xEncoded.dims(2);
+  auto hiddenDim = hEncode / (1 + keyValue_) / numHeads_;
+
+  auto xEncodedKey =
+      keyValue_ ? xEncoded(af::seq(0, hEncode / 2 - 1)) : xEncoded;
+  auto xEncodedValue =
+      keyValue_ ? xEncoded(af::seq(hEncode / 2, hEncode - 1)) : xEncoded;
+
+  auto key = splitInput_ ? xEncodedKey : module(1)->forward({xEncodedKey})[0];
+  auto value =
+      splitInput_ ? xEncodedValue : module(2)->forward({xEncodedValue})[0];
+
+  key = moddims(reorder(key, 1, 0, 2), {T, hiddenDim, B * numHeads_});
+  value = moddims(reorder(value, 1, 0, 2), {T, hiddenDim, B * numHeads_});
+  return {key, value};
+}
+
 std::string MultiHeadContentAttention::prettyString() const {
   return "MultiHeadContentAttention";
 }
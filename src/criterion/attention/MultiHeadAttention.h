@@ -19,7 +19,8 @@ class MultiHeadContentAttention : public AttentionBase {
       int dim,
       int num_heads = 8,
       bool keyValue = false,
-      bool splitInput = false);
+      bool splitInput = false,
+      int chunkSize = 0);
 
   std::pair<fl::Variable, fl::Variable> forward(
       const fl::Variable& state,
@@ -29,13 +30,27 @@ class MultiHeadContentAttention : public AttentionBase {
 
   std::string prettyString() const override;
 
+ protected:
+  /* The keys and the values of the heads, T x hiddendim x (B * numHeads) */
+  std::vector<fl::Variable> projectEncoder(
+      const fl::Variable& xEncoded) override;
+
  private:
   int numHeads_;
   bool keyValue_;
   bool splitInput_;
-  FL_SAVE_LOAD_WITH_BASE(AttentionBase, numHeads_, keyValue_, splitInput_)
+  // Query rows over which the scores are computed at a time, all if 0
+  int chunkSize_ = 0;
+
+  FL_SAVE_LOAD_WITH_BASE(
+      AttentionBase,
+      numHeads_,
+      keyValue_,
+      splitInput_,
+      fl::versioned(chunkSize_, 1))
 };
 
 } // namespace w2l
 
 CEREAL_REGISTER_TYPE(w2l::MultiHeadContentAttention)
+CEREAL_CLASS_VERSION(w2l::MultiHeadContentAttention, 1)
@@ -33,10 +33,12 @@ Variable SoftPretrainWindow::computeWindowMask(
     int targetLen,
     int inputSteps,
     int batchSize) {
-  auto ts = af::range(af::dim4(targetLen, inputSteps), 1);
-  auto us = af::range(af::dim4(targetLen, inputSteps));
-  double vratio = (double)inputSteps / (double)targetLen;
-  auto maskArray = exp(-pow(ts - vratio * us, 2) / (2 * std_ * std_));
+  auto maskArray = cachedWindowMask(targetLen, inputSteps, [&]() {
+    auto ts = af::range(af::dim4(targetLen, inputSteps), 1);
+    auto us = af::range(af::dim4(targetLen, inputSteps));
+    double vratio = (double)inputSteps / (double)targetLen;
+    return af::array(exp(-pow(ts - vratio * us, 2) / (2 * std_ * std_)));
+  });
 
   // [targetLen, inputSteps, batchSize]
   return Variable(tile(maskArray, {1, 1, batchSize}), false);
@@ -40,16 +40,17 @@ Variable SoftWindow::computeSingleStepWindow(
 
 Variable
 SoftWindow::computeWindowMask(int targetLen, int inputSteps, int batchSize) {
-  std::vector<int> centerVec(targetLen, 0);
-  for (int u = 0; u < targetLen; ++u) {
-    centerVec[u] = getCenter(u, inputSteps);
-  }
-
-  auto ts = af::range(af::dim4(inputSteps));
-  ts = af::tile(af::moddims(ts, {1, inputSteps}), {targetLen, 1});
-  auto centers =
-      af::tile(af::array(targetLen, 1, centerVec.data()), {1, inputSteps});
-  auto maskArray = exp(-pow(ts - centers, 2) / (2 * std_ * std_));
+  auto maskArray = cachedWindowMask(targetLen, inputSteps, [&]() {
+    std::vector<int> centerVec(targetLen, 0);
+    for (int u = 0; u < targetLen; ++u) {
+      centerVec[u] = getCenter(u, inputSteps);
+    }
+
+    auto ts = af::range(af::dim4(targetLen, inputSteps), 1);
+    auto centers =
+        af::tile(af::array(targetLen, 1, centerVec.data()), {1, inputSteps});
+    return af::array(exp(-pow(ts - centers, 2) / (2 * std_ * std_)));
+  });
 
   // [targetLen, inputSteps, batchSize]
   auto mask = Variable(tile(maskArray, {1, 1, batchSize}), false);
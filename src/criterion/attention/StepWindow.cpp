@@ -8,6 +8,8 @@
 
 #include "StepWindow.h"
 
+#include <tuple>
+
 using namespace fl;
 
 namespace w2l {
@@ -16,10 +18,8 @@ StepWindow::StepWindow() {}
 StepWindow::StepWindow(int sMin, int sMax, double vMin, double vMax)
     : sMin_(sMin), sMax_(sMax), vMin_(vMin), vMax_(vMax) {}
 
-Variable StepWindow::computeSingleStepWindow(
-    const Variable& /* unused */,
+std::pair<int, int> StepWindow::computeSingleStepRange(
     int inputSteps,
-    int batchSize,
     int step) {
   int start_idx = std::max(
       0,
@@ -27,13 +27,20 @@ Variable StepWindow::computeSingleStepWindow(
           std::round(std::min(inputSteps - vMax_, sMin_ + step * vMin_))));
   int end_idx =
       std::min(static_cast<int>(std::round(sMax_ + step * vMax_)), inputSteps);
+  return std::make_pair(start_idx, end_idx);
+}
 
-  std::vector<float> maskvec(inputSteps, 0.0);
-  std::fill(maskvec.begin() + start_idx, maskvec.begin() + end_idx, 1.0);
+Variable StepWindow::computeSingleStepWindow(
+    const Variable& /* unused */,
+    int inputSteps,
+    int batchSize,
+    int step) {
+  int start_idx, end_idx;
+  std::tie(start_idx, end_idx) = computeSingleStepRange(inputSteps, step);
 
   // [1, inputSteps]
-  auto maskarray = af::constant(0.0, 1, inputSteps);
-  maskarray(af::span, af::seq(start_idx, end_idx - 1)) = 1.0;
+  auto ts = af::range(af::dim4(1, inputSteps), 1);
+  auto maskarray = ((ts >= start_idx) && (ts < end_idx)).as(f32);
 
   // [1, inputSteps, batchSize]
   auto mask = Variable(tile(maskarray, {1, 1, batchSize}), false);
@@ -43,14 +50,22 @@ Variable StepWindow::computeSingleStepWindow(
 
 Variable
 StepWindow::computeWindowMask(int targetLen, int inputSteps, int batchSize) {
-  std::vector<Variable> maskvec(targetLen, Variable());
-  for (int u = 0; u < targetLen; ++u) {
-    maskvec[u] = computeSingleStepWindow(
-        Variable() /* unused */, inputSteps, batchSize, u);
-  }
+  auto maskArray = cachedWindowMask(targetLen, inputSteps, [&]() {
+    // The ranges of all the steps, compared at once with the frame indices
+    std::vector<int> startVec(targetLen), endVec(targetLen);
+    for (int u = 0; u < targetLen; ++u) {
+      std::tie(startVec[u], endVec[u]) = computeSingleStepRange(inputSteps, u);
+    }
+    auto ts = af::range(af::dim4(targetLen, inputSteps), 1);
+    auto starts =
+        af::tile(af::array(targetLen, 1, startVec.data()), {1, inputSteps});
+    auto ends =
+        af::tile(af::array(targetLen, 1, endVec.data()), {1, inputSteps});
+    return ((ts >= starts) && (ts < ends)).as(f32);
+  });
 
   // [targetLen, inputSteps, batchSize]
-  auto mask = concatenate(maskvec, 0);
+  auto mask = Variable(tile(maskArray, {1, 1, batchSize}), false);
 
   return mask;
 }
@@ -26,6 +26,9 @@ class StepWindow : public WindowBase {
   fl::Variable computeWindowMask(int targetLen, int inputSteps, int batchSize)
       override;
 
+  std::pair<int, int> computeSingleStepRange(int inputSteps, int step)
+      override;
+
  private:
   int sMin_;
   int sMax_;
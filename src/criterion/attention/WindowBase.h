@@ -8,6 +8,11 @@
 
 #pragma once
 
+#include <deque>
+#include <functional>
+#include <map>
+#include <utility>
+
 #include <flashlight/flashlight.h>
 
 namespace w2l {
@@ -22,9 +27,22 @@ class WindowBase {
       int batchSize,
       int step) = 0;
 
+  /* The masks of all the steps at once, [targetLen, inputSteps, batchSize] */
   virtual fl::Variable
   computeWindowMask(int targetLen, int inputSteps, int batchSize) = 0;
 
+  /**
+   * The [start, end) range of the input frames attended at `step` of an input
+   * of `inputSteps` frames, for windows which don't depend on the previous
+   * attention and never move backwards, so that streaming inference can slice
+   * the input instead of masking it. (-1, -1) for the other windows.
+   */
+  virtual std::pair<int, int> computeSingleStepRange(
+      int /* inputSteps */,
+      int /* step */) {
+    return std::make_pair(-1, -1);
+  }
+
   virtual ~WindowBase() {}
 
   void setBatchStat(int seqLen, int targetLen, int batchSize) {
@@ -38,7 +56,37 @@ class WindowBase {
   int targetLen_;
   int batchSize_;
 
+  /**
+   * The [targetLen, inputSteps] mask of all the steps returned by `compute`,
+   * for the windows which depend on the lengths only. The masks of the last
+   * `kMaxCachedMasks` pairs of lengths are kept on the device, as the batches
+   * of a sorted dataset repeat the same lengths.
+   */
+  af::array cachedWindowMask(
+      int targetLen,
+      int inputSteps,
+      const std::function<af::array()>& compute) {
+    auto key = std::make_pair(targetLen, inputSteps);
+    auto it = maskCache_.find(key);
+    if (it != maskCache_.end()) {
+      return it->second;
+    }
+    if (maskCacheOrder_.size() >= kMaxCachedMasks) {
+      maskCache_.erase(maskCacheOrder_.front());
+      maskCacheOrder_.pop_front();
+    }
+    auto mask = compute();
+    maskCache_.emplace(key, mask);
+    maskCacheOrder_.push_back(key);
+    return mask;
+  }
+
  private:
+  static constexpr size_t kMaxCachedMasks = 32;
+
+  std::map<std::pair<int, int>, af::array> maskCache_;
+  std::deque<std::pair<int, int>> maskCacheOrder_; // oldest first
+
   FL_SAVE_LOAD()
 };
 
@@ -86,6 +86,67 @@ TEST(AttentionTest, NeuralLocationAttention) {
   sequential_test(std::make_shared<NeuralLocationAttention>(H, A, C, K), H);
 }
 
+TEST(AttentionTest, NeuralLocationAttentionFused) {
+  // On CUDA, the second shape runs several blocks of the forward and tiles
+  // of the backward, and more attention dimensions than the lanes of a warp
+  // and the threads of a block
+  struct Shape {
+    int H, A, C, K, B, T;
+    float outputTolerance, gradTolerance;
+  };
+  NeuralLocationAttention::setFusedEnergies(true);
+  for (const auto& shape : {Shape{8, 6, 4, 5, 2, 7, 1e-5, 1e-4},
+                            Shape{16, 300, 4, 7, 3, 70, 1e-4, 1e-3}}) {
+    int H = shape.H, T = shape.T, B = shape.B;
+    NeuralLocationAttention attention(H, shape.A, shape.C, shape.K);
+
+    Variable encodedx(af::randn(H, T, B), true);
+    Variable encodedy(af::randn(H, 1, B), true);
+    Variable prevAttn(af::randu(1, T, B), true);
+    for (const auto& prev : {Variable(), prevAttn}) {
+      // The energies module by module, as the attention would compute them
+      // without locationEnergies()
+      auto hidden = attention.module(0)->forward({encodedx}).front() +
+          tile(attention.module(1)->forward({encodedy}).front(), {1, T, 1});
+      if (!prev.isempty()) {
+        hidden = hidden +
+            moddims(attention.module(2)
+                        ->forward({moddims(prev, {1, T, 1, B})})
+                        .front(),
+                    {-1, T, B});
+      }
+      auto energies = attention.module(4)->forward({tanh(hidden)}).front();
+      auto expected = matmulNT(encodedx, softmax(energies, 1));
+
+      auto result = attention.forward(encodedy, encodedx, prev).second;
+      ASSERT_TRUE(allClose(result, expected, shape.outputTolerance));
+
+      // The gradients of the inputs and of all the parameters
+      auto grad = Variable(af::randn(expected.dims()), false);
+      std::vector<Variable> vars = {encodedx, encodedy, prev};
+      auto params = attention.params();
+      vars.insert(vars.end(), params.begin(), params.end());
+      std::vector<af::array> expectedGrads;
+      expected.backward(grad);
+      for (auto& var : vars) {
+        expectedGrads.push_back(var.isGradAvailable() ? var.grad().array()
+                                                      : af::array());
+        var.zeroGrad();
+      }
+      result.backward(grad);
+      for (size_t i = 0; i < vars.size(); ++i) {
+        if (expectedGrads[i].isempty()) {
+          continue;
+        }
+        ASSERT_TRUE(allClose(
+            vars[i].grad().array(), expectedGrads[i], shape.gradTolerance));
+        vars[i].zeroGrad();
+      }
+    }
+  }
+  NeuralLocationAttention::setFusedEnergies(false);
+}
+
 TEST(AttentionTest, MultiHeadContentAttention) {
   int H = 512, B = 2, T = 10, U = 5, NH = 8;
 
@@ -109,6 +170,103 @@ TEST(AttentionTest, MultiHeadContentAttention) {
   }
 }
 
+TEST(AttentionTest, MultiHeadChunkedAttention) {
+  int H = 64, B = 2, T = 10, U = 7, NH = 4, C = 3;
+
+  for (bool keyValue : {true, false}) {
+    MultiHeadContentAttention full(H, NH, keyValue);
+    MultiHeadContentAttention chunked(H, NH, keyValue, false, C);
+    for (int i = 0; i < static_cast<int>(full.params().size()); ++i) {
+      chunked.setParams(Variable(full.param(i).array().copy(), true), i);
+    }
+
+    auto Hencode = keyValue ? H * 2 : H;
+    auto x = af::randn(Hencode, T, B);
+    auto y = af::randn(H, U, B);
+    Variable windowMask(af::randu(U, T, B) + 0.1, false);
+    Variable x1(x, true), y1(y, true), x2(x, true), y2(y, true);
+
+    auto expected = full(y1, x1, Variable{}, windowMask);
+    auto result = chunked(y2, x2, Variable{}, windowMask);
+    ASSERT_TRUE(allClose(result.first, expected.first, 1e-5));
+    ASSERT_TRUE(allClose(result.second, expected.second, 1e-5));
+
+    auto grad = Variable(af::randn(H, U, B), false);
+    expected.second.backward(grad);
+    result.second.backward(grad);
+    ASSERT_TRUE(allClose(x2.grad(), x1.grad(), 1e-4));
+    ASSERT_TRUE(allClose(y2.grad(), y1.grad(), 1e-4));
+  }
+}
+
+TEST(AttentionTest, InferenceStep) {
+  int H = 8, B = 3, T = 10, K = 5;
+  // The attentions, with the dimension of their encoded input
+  std::vector<std::pair<std::shared_ptr<AttentionBase>, int>> attentions = {
+      {std::make_shared<ContentAttention>(), H},
+      {std::make_shared<ContentAttention>(true), 2 * H},
+      {std::make_shared<NeuralContentAttention>(H), H},
+      {std::make_shared<SimpleLocationAttention>(K), H},
+      {std::make_shared<LocationAttention>(H, K), H},
+      {std::make_shared<NeuralLocationAttention>(H, H, 4, K), H},
+  };
+
+  Variable encodedy(af::randn(H, 1, B), false);
+  Variable prevAttn(af::randu(1, T, B), false);
+  Variable windowMask(af::randu(1, T, B) + 0.1, false);
+  AttentionBase::setFusedInference(true);
+  for (auto& attention : attentions) {
+    Variable encodedx(af::randn(attention.second, T, B), false);
+    for (const auto& prev : {Variable(), prevAttn}) {
+      for (const auto& mask : {Variable(), windowMask}) {
+        auto& module = attention.first;
+        module->train();
+        auto expected = module->forward(encodedy, encodedx, prev, mask);
+        module->eval();
+        auto result = module->forward(encodedy, encodedx, prev, mask);
+        ASSERT_EQ(result.first.dims(), expected.first.dims());
+        ASSERT_EQ(result.second.dims(), expected.second.dims());
+        ASSERT_TRUE(allClose(result.first, expected.first, 1e-5));
+        ASSERT_TRUE(allClose(result.second, expected.second, 1e-5));
+      }
+    }
+  }
+  AttentionBase::setFusedInference(false);
+}
+
+TEST(AttentionTest, PrecomputedEncoderProjections) {
+  int H = 8, B = 3, T = 10, K = 5;
+  std::vector<std::pair<std::shared_ptr<AttentionBase>, int>> attentions = {
+      {std::make_shared<ContentAttention>(true), 2 * H},
+      {std::make_shared<NeuralLocationAttention>(H, H, 4, K), H},
+      {std::make_shared<MultiHeadContentAttention>(H, 2), H},
+      {std::make_shared<MultiHeadContentAttention>(H, 2, true), 2 * H},
+  };
+
+  Variable encodedy(af::randn(H, 1, B), false);
+  for (auto& attention : attentions) {
+    auto& module = attention.first;
+    module->eval();
+    Variable encodedx(af::randn(attention.second, T, B), false);
+    auto expected = module->forward(encodedy, encodedx, Variable());
+
+    module->precompute(encodedx);
+    // Several steps reuse the projections
+    for (int step = 0; step < 2; ++step) {
+      auto result = module->forward(encodedy, encodedx, Variable());
+      ASSERT_TRUE(allClose(result.first, expected.first, 1e-5));
+      ASSERT_TRUE(allClose(result.second, expected.second, 1e-5));
+    }
+
+    // Another encoder output isn't served from the cache
+    Variable otherx(af::randn(attention.second, T, B), false);
+    auto other = module->forward(encodedy, otherx, Variable());
+    module->clearPrecomputed();
+    auto otherExpected = module->forward(encodedy, otherx, Variable());
+    ASSERT_TRUE(allClose(other.second, otherExpected.second, 1e-5));
+  }
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
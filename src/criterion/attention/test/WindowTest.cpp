@@ -44,6 +44,9 @@ TEST(WindowTest, MedianWindow) {
   auto mask_1 =
       window.computeSingleStepWindow(input_attn, inputsteps, batchsize, 1);
   ASSERT_EQ(mask_1.dims(), af::dim4(1, inputsteps, batchsize));
+  ASSERT_TRUE(allClose(
+      af::sum(mask_1.array(), 1),
+      af::constant(w_l + w_r, 1, 1, batchsize, f32)));
 
   // make sure large window size is handled
   MedianWindow large_window(100, 100);
@@ -111,6 +114,19 @@ TEST(WindowTest, StepWindow) {
 
   auto mask_v = window.computeWindowMask(targetlen, inputsteps, batchsize);
   ASSERT_EQ(mask_v.dims(), af::dim4(targetlen, inputsteps, batchsize));
+
+  std::vector<Variable> masks;
+  for (int step = 0; step < targetlen; ++step) {
+    masks.emplace_back(window.computeSingleStepWindow(
+        input_attn, inputsteps, batchsize, step));
+  }
+  ASSERT_TRUE(allClose(concatenate(masks, 0), mask_v));
+
+  // The cached mask of the same lengths, tiled for another batch size
+  auto mask_c = window.computeWindowMask(targetlen, inputsteps, 2);
+  ASSERT_EQ(mask_c.dims(), af::dim4(targetlen, inputsteps, 2));
+  ASSERT_TRUE(allClose(
+      mask_c.array(), mask_v.array()(af::span, af::span, af::seq(0, 1))));
 }
 
 TEST(WindowTest, SoftWindow) {
@@ -137,6 +153,13 @@ TEST(WindowTest, SoftWindow) {
 
   auto mask_v = window.computeWindowMask(targetlen, inputsteps, batchsize);
   ASSERT_EQ(mask_v.dims(), af::dim4(targetlen, inputsteps, batchsize));
+
+  std::vector<Variable> masks;
+  for (int step = 0; step < targetlen; ++step) {
+    masks.emplace_back(window.computeSingleStepWindow(
+        input_attn, inputsteps, batchsize, step));
+  }
+  ASSERT_TRUE(allClose(concatenate(masks, 0), mask_v, 1e-6));
 }
 
 TEST(WindowTest, SoftPretrainWindow) {
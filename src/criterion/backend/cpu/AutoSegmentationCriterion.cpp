@@ -0,0 +1,24 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "criterion/AutoSegmentationCriterion.h"
+
+using fl::Variable;
+
+namespace w2l {
+
+std::vector<Variable> AutoSegmentationCriterion::forward(
+    const std::vector<Variable>& inputs) {
+  if (inputs.size() != 2) {
+    throw std::invalid_argument("Invalid inputs size");
+  }
+  return {fcc_.forward(inputs[0], inputs[1]) -
+          fac_.forward(inputs[0], inputs[1])};
+}
+
+} // namespace w2l
@@ -10,9 +10,13 @@
 
 #include "common/FlashlightUtils.h"
 #include "libraries/criterion/cpu/CriterionUtils.h"
+#include "libraries/criterion/cpu/CtcGreedyPath.h"
+#include "libraries/criterion/cpu/ForcedAlignmentPath.h"
 #include "libraries/criterion/cpu/ViterbiPath.h"
 
 using CriterionUtils = w2l::cpu::CriterionUtils<float>;
+using CtcGreedyPath = w2l::cpu::CtcGreedyPath<float>;
+using ForcedAlignmentPath = w2l::cpu::ForcedAlignmentPath<float>;
 using ViterbiPath = w2l::cpu::ViterbiPath<float>;
 
 namespace w2l {
@@ -47,6 +51,170 @@ af::array viterbiPath(const af::array& input, const af::array& trans) {
   return af::array(T, B, pathVec.data());
 }
 
+af::array ctcGreedyPath(const af::array& input) {
+  auto B = input.dims(2);
+  auto T = input.dims(1);
+  auto N = input.dims(0);
+
+  if (input.type() != f32) {
+    throw std::invalid_argument("ctcGreedyPath: input must be float32");
+  }
+
+  auto inputVec = afToVector<float>(input);
+  std::vector<int> pathVec(B * T);
+  std::vector<int> pathSizeVec(B);
+
+  CtcGreedyPath::compute(
+      B, T, N, inputVec.data(), pathVec.data(), pathSizeVec.data());
+
+  return af::array(T, B, pathVec.data());
+}
+
+af::array forcedAlignmentPath(
+    const af::array& input,
+    const af::array& target,
+    const af::array& trans,
+    const af::array& inputSize /* = af::array() */) {
+  auto B = input.dims(2);
+  auto T = input.dims(1);
+  auto N = input.dims(0);
+  auto L = target.dims(0);
+
+  if (target.dims(1) != B ||
+      (!trans.isempty() && (N != trans.dims(0) || N != trans.dims(1))) ||
+      (!inputSize.isempty() && inputSize.elements() != B)) {
+    throw std::invalid_argument("forcedAlignmentPath: mismatched dims");
+  } else if (input.type() != f32) {
+    throw std::invalid_argument("forcedAlignmentPath: input must be float32");
+  } else if (!trans.isempty() && trans.type() != f32) {
+    throw std::invalid_argument("forcedAlignmentPath: trans must be float32");
+  } else if (target.type() != s32) {
+    throw std::invalid_argument("forcedAlignmentPath: target must be int32");
+  } else if (!inputSize.isempty() && inputSize.type() != s32) {
+    throw std::invalid_argument("forcedAlignmentPath: inputSize must be int32");
+  }
+
+  auto inputVec = afToVector<float>(input);
+  auto targetVec = afToVector<int>(target);
+  auto targetSizeVec = afToVector<int>(getTargetSizeArray(target, T));
+  auto transVec =
+      trans.isempty() ? std::vector<float>() : afToVector<float>(trans);
+  auto inputSizeVec =
+      inputSize.isempty() ? std::vector<int>() : afToVector<int>(inputSize);
+  std::vector<int> pathVec(B * T);
+  std::vector<uint8_t> workspaceVec(
+      ForcedAlignmentPath::getWorkspaceSize(B, T, L));
+
+  ForcedAlignmentPath::compute(
+      B,
+      T,
+      N,
+      L,
+      inputVec.data(),
+      inputSize.isempty() ? nullptr : inputSizeVec.data(),
+      targetVec.data(),
+      targetSizeVec.data(),
+      trans.isempty() ? nullptr : transVec.data(),
+      pathVec.data(),
+      workspaceVec.data());
+
+  return af::array(T, B, pathVec.data());
+}
+
+std::pair<af::array, af::array> attentionStep(
+    const af::array& query,
+    const af::array& keys,
+    const af::array& values,
+    const af::array& bias,
+    float scale /* = 1.0 */) {
+  auto T = values.dims(1);
+  auto B = values.dims(2);
+
+  // The ArrayFire ops are as fast as a fused loop on the CPU
+  af::array scores = bias.isempty() ? af::constant(0, 1, T, B) : bias;
+  if (!query.isempty()) {
+    scores = scores + af::matmulTN(query, keys) * scale;
+  }
+  auto attention = fl::softmax(fl::Variable(scores, false), 1).array();
+  auto summary = af::matmulNT(values, attention);
+  return std::make_pair(attention, summary);
+}
+
+namespace {
+
+/* The hidden units of locationEnergies(), before the tanh: A x T x B */
+af::array locationHidden(
+    const af::array& keys,
+    const af::array& query,
+    const af::array& prevAttn,
+    const af::array& filter,
+    const af::array& filterBias) {
+  auto A = keys.dims(0);
+  auto T = keys.dims(1);
+  auto B = keys.dims(2);
+  auto hidden = keys + af::tile(query, 1, T) +
+      af::tile(af::moddims(filterBias, A), 1, T, B);
+  if (!prevAttn.isempty()) {
+    auto K = filter.dims(1);
+    auto frames = af::moddims(detail::filterFrames(prevAttn, K), K, T * B);
+    hidden = hidden + af::moddims(af::matmul(filter, frames), A, T, B);
+  }
+  return hidden;
+}
+
+} // namespace
+
+namespace detail {
+
+// The ArrayFire ops are as fast as a fused loop on the CPU
+
+af::array locationEnergiesForward(
+    const af::array& keys,
+    const af::array& query,
+    const af::array& prevAttn,
+    const af::array& filter,
+    const af::array& filterBias,
+    const af::array& weight) {
+  auto A = keys.dims(0);
+  auto T = keys.dims(1);
+  auto B = keys.dims(2);
+  auto hidden = af::tanh(
+      locationHidden(keys, query, prevAttn, filter, filterBias));
+  return af::moddims(
+      af::matmul(af::moddims(weight, 1, A), af::moddims(hidden, A, T * B)),
+      1,
+      T,
+      B);
+}
+
+void locationEnergiesBackward(
+    const af::array& gradEnergies,
+    const af::array& keys,
+    const af::array& query,
+    const af::array& prevAttn,
+    const af::array& filter,
+    const af::array& filterBias,
+    const af::array& weight,
+    af::array& gradKeys,
+    af::array& gradQuery,
+    af::array& gradWeight) {
+  auto A = keys.dims(0);
+  auto T = keys.dims(1);
+  auto B = keys.dims(2);
+  auto hidden = af::moddims(
+      af::tanh(locationHidden(keys, query, prevAttn, filter, filterBias)),
+      A,
+      T * B);
+  auto grad = af::moddims(gradEnergies, 1, T * B);
+  gradWeight = af::matmulNT(grad, hidden);
+  gradKeys = af::tile(af::moddims(weight, A), 1, T * B) *
+      af::tile(grad, A) * (1 - hidden * hidden);
+  gradKeys = af::moddims(gradKeys, A, T, B);
+  gradQuery = af::sum(gradKeys, 1);
+}
+
+} // namespace detail
+
 af::array getTargetSizeArray(const af::array& target, int maxSize) {
   int B = target.dims(1);
   int L = target.dims(0);
@@ -11,15 +11,20 @@
 #include "common/FlashlightUtils.h"
 #include "criterion/CriterionUtils.h"
 #include "libraries/criterion/cpu/FullConnectionCriterion.h"
+#include "libraries/criterion/cpu/SparseConnectionCriterion.h"
 
 using fl::Variable;
 using FCC = w2l::cpu::FullConnectionCriterion<float>;
+using SCC = w2l::cpu::SparseConnectionCriterion<float>;
 
 namespace {
 // By passing shared_ptr<Context> we avoid copies from forward to backward.
 struct Context {
   std::vector<float> transVec;
   std::vector<uint8_t> workspaceVec;
+  // The top K transitions, when sparse
+  af::array transIndex;
+  std::vector<int> transIndexVec;
 };
 } // namespace
 
@@ -57,6 +62,42 @@ static void backward(
   inputs[1].addGrad(Variable(transGrad, false));
 }
 
+static void sparseBackward(
+    std::vector<Variable>& inputs,
+    const Variable& gradVar,
+    int B,
+    int T,
+    int N,
+    int K,
+    const std::shared_ptr<Context>& ctx) {
+  if (gradVar.type() != f32) {
+    throw std::invalid_argument("FCC: grad must be float32");
+  }
+
+  auto gradVec = afToVector<float>(gradVar);
+  std::vector<float> inputGradVec(B * T * N);
+  std::vector<float> transGradVec(K * N);
+
+  SCC::backward(
+      B,
+      T,
+      N,
+      K,
+      ctx->transIndexVec.data(),
+      ctx->transVec.data(),
+      gradVec.data(),
+      inputGradVec.data(),
+      transGradVec.data(),
+      ctx->workspaceVec.data());
+
+  af::array inputGrad(N, T, B, inputGradVec.data());
+  af::array transGrad(K, N, transGradVec.data());
+
+  inputs[0].addGrad(Variable(inputGrad, false));
+  inputs[1].addGrad(
+      Variable(scatterTransitionGrad(transGrad, ctx->transIndex), false));
+}
+
 Variable FullConnectionCriterion::forward(
     const Variable& inputVar,
     const Variable& targetVar) {
@@ -78,8 +119,38 @@ Variable FullConnectionCriterion::forward(
   auto inputVec = afToVector<float>(inputVar);
   auto targetVec = afToVector<int>(targetVar);
   auto targetSizeVec = afToVector<int>(targetSize);
-  ctx->transVec = afToVector<float>(transVar);
   std::vector<float> lossVec(B);
+
+  if (isSparse()) {
+    int K = topK_;
+    af::array transValue;
+    topKTransitions(transVar.array(), K, transValue, ctx->transIndex);
+    ctx->transVec = afToVector<float>(transValue);
+    ctx->transIndexVec = afToVector<int>(ctx->transIndex);
+    ctx->workspaceVec.assign(SCC::getWorkspaceSize(B, T, N, K), 0);
+
+    SCC::forward(
+        B,
+        T,
+        N,
+        K,
+        scaleMode_,
+        inputVec.data(),
+        targetSizeVec.data(),
+        ctx->transIndexVec.data(),
+        ctx->transVec.data(),
+        lossVec.data(),
+        ctx->workspaceVec.data());
+
+    return Variable(
+        af::array(B, lossVec.data()),
+        {inputVar.withoutData(), transVar.withoutData()},
+        [=](std::vector<Variable>& inputs, const Variable& gradVar) mutable {
+          sparseBackward(inputs, gradVar, B, T, N, K, ctx);
+        });
+  }
+
+  ctx->transVec = afToVector<float>(transVar);
   ctx->workspaceVec.assign(FCC::getWorkspaceSize(B, T, N), 0);
 
   FCC::forward(
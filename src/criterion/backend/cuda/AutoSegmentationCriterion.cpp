@@ -0,0 +1,170 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "criterion/AutoSegmentationCriterion.h"
+
+#include <flashlight/common/cuda.h>
+
+#include "criterion/CriterionUtils.h"
+#include "criterion/backend/cuda/WorkspacePool.h"
+#include "libraries/criterion/cuda/AutoSegmentationCriterion.cuh"
+
+using fl::Variable;
+using ASG = w2l::cuda::AutoSegmentationCriterion<float>;
+// float16 inputs, from mixed-precision training, are recursed on in float
+using ASGHalf = w2l::cuda::AutoSegmentationCriterion<float, float>;
+
+namespace w2l {
+
+template <class Criterion>
+static void backward(
+    std::vector<Variable>& inputs,
+    const Variable& gradVar,
+    int B,
+    int T,
+    int N,
+    int L,
+    const af::array& target,
+    const af::array& targetSize,
+    const af::array& trans,
+    af::array& workspace,
+    af::dtype inputType) {
+  if (gradVar.type() != f32) {
+    throw std::invalid_argument("ASG: grad must be float32");
+  }
+
+  const auto& grad = gradVar.array();
+  af::array inputGrad(N, T, B, f32);
+  af::array transGrad(N, N, f32);
+
+  {
+    fl::DevicePtr targetRaw(target);
+    fl::DevicePtr targetSizeRaw(targetSize);
+    fl::DevicePtr transRaw(trans);
+    fl::DevicePtr gradRaw(grad);
+    fl::DevicePtr inputGradRaw(inputGrad);
+    fl::DevicePtr transGradRaw(transGrad);
+    fl::DevicePtr workspaceRaw(workspace);
+    Criterion::backward(
+        B,
+        T,
+        N,
+        L,
+        static_cast<const int*>(targetRaw.get()),
+        static_cast<const int*>(targetSizeRaw.get()),
+        static_cast<const float*>(transRaw.get()),
+        static_cast<const float*>(gradRaw.get()),
+        static_cast<float*>(inputGradRaw.get()),
+        static_cast<float*>(transGradRaw.get()),
+        workspaceRaw.get(),
+        fl::cuda::getActiveStream());
+  }
+
+  if (inputType != f32) {
+    inputGrad = inputGrad.as(inputType);
+  }
+  inputs[0].addGrad(Variable(inputGrad, false));
+  inputs[1].addGrad(Variable(transGrad, false));
+}
+
+template <class Criterion>
+static Variable forward(
+    const Variable& inputVar,
+    const Variable& targetVar,
+    const Variable& transVar,
+    const af::array& input,
+    CriterionScaleMode scaleMode) {
+  int B = inputVar.dims(2);
+  int T = inputVar.dims(1);
+  int N = inputVar.dims(0);
+  int L = targetVar.dims(0);
+  auto inputType = inputVar.type();
+
+  const auto& target = targetVar.array();
+  const auto& targetSize = getTargetSizeArray(target, T);
+  const auto& trans = transVar.array();
+  af::array loss(B, f32);
+  auto stream = fl::cuda::getActiveStream();
+  auto workspace = WorkspacePool::get().acquire(
+      Criterion::getWorkspaceSize(B, T, N, L), stream);
+
+  {
+    fl::DevicePtr inputRaw(input);
+    fl::DevicePtr targetRaw(target);
+    fl::DevicePtr targetSizeRaw(targetSize);
+    fl::DevicePtr transRaw(trans);
+    fl::DevicePtr lossRaw(loss);
+    fl::DevicePtr workspaceRaw(*workspace);
+
+    Criterion::forward(
+        B,
+        T,
+        N,
+        L,
+        scaleMode,
+        static_cast<const float*>(inputRaw.get()),
+        static_cast<const int*>(targetRaw.get()),
+        static_cast<const int*>(targetSizeRaw.get()),
+        static_cast<const float*>(transRaw.get()),
+        static_cast<float*>(lossRaw.get()),
+        workspaceRaw.get(),
+        stream);
+  }
+
+  return Variable(
+      loss,
+      {inputVar.withoutData(), transVar.withoutData()},
+      [=](std::vector<Variable>& inputs, const Variable& gradVar) mutable {
+        backward<Criterion>(
+            inputs,
+            gradVar,
+            B,
+            T,
+            N,
+            L,
+            target,
+            targetSize,
+            trans,
+            *workspace,
+            inputType);
+      });
+}
+
+std::vector<Variable> AutoSegmentationCriterion::forward(
+    const std::vector<Variable>& inputs) {
+  if (inputs.size() != 2) {
+    throw std::invalid_argument("Invalid inputs size");
+  }
+  const auto& inputVar = inputs[0];
+  const auto& targetVar = inputs[1];
+  if (!fusedCuda() || fcc_.isSparse()) {
+    // Two separate criteria, by default and for the sparse full connection,
+    // which has kernels of its own
+    return {fcc_.forward(inputVar, targetVar) -
+            fac_.forward(inputVar, targetVar)};
+  }
+
+  const auto& transVar = param(0);
+  if (inputVar.dims(0) != transVar.dims(0)) {
+    throw std::invalid_argument("ASG: input dim doesn't match N");
+  } else if (inputVar.type() != f32 && inputVar.type() != f16) {
+    throw std::invalid_argument("ASG: input must be float32 or float16");
+  } else if (targetVar.type() != s32) {
+    throw std::invalid_argument("ASG: target must be int32");
+  }
+
+  if (inputVar.type() == f16) {
+    // The recursions dominate: converting the input is cheap next to them
+    return {w2l::forward<ASGHalf>(
+        inputVar, targetVar, transVar, inputVar.array().as(f32), scaleMode_)};
+  }
+  return {w2l::forward<ASG>(
+      inputVar, targetVar, transVar, inputVar.array(), scaleMode_)};
+}
+
+} // namespace w2l
@@ -8,6 +8,8 @@
 
 #include <ctc.h> // warpctc
 
+#include <algorithm>
+
 #include <flashlight/autograd/autograd.h>
 #include <flashlight/common/cuda.h>
 
@@ -36,9 +38,14 @@ std::vector<Variable> ConnectionistTemporalClassificationCriterion::forward(
   if (inputs.size() != 2) {
     throw std::invalid_argument("Invalid inputs size");
   }
-  const auto& input = inputs[0];
   const auto& target = inputs[1];
-  validate(input, target);
+  validate(inputs[0], target);
+  if (inputs[0].type() != f32 && inputs[0].type() != f16) {
+    throw std::invalid_argument("CTC: input must be float32 or float16");
+  }
+  // float16 inputs, from mixed-precision training, go through warp-ctc in
+  // float32
+  auto input = inputs[0].type() == f16 ? inputs[0].as(f32) : inputs[0];
   const int N = input.dims(0);
   const int T = input.dims(1);
   const int B = input.dims(2);
@@ -97,10 +104,11 @@ std::vector<Variable> ConnectionistTemporalClassificationCriterion::forward(
     const int* targetVec = batchTargetVec.data() + b * batchL;
     int L = batchTargetSizeVec[b];
 
-    // A heuristic to modify target length to be able to compute CTC loss
-    L = std::min(L, T);
+    // A heuristic to modify target length to be able to compute CTC loss,
+    // the one of the CPU criterion: each repeat needs a blank between the
+    // two labels
     const int R = w2l::countRepeats(targetVec, L);
-    L = std::min(L + R, T) - R;
+    L = std::max(std::min(L + R, T) - R, 0);
 
     labelLengths.push_back(L);
     for (int l = 0; l < L; ++l) {
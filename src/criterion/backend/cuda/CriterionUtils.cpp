@@ -10,10 +10,19 @@
 
 #include <flashlight/common/cuda.h>
 
+#include "criterion/backend/cuda/WorkspacePool.h"
 #include "libraries/criterion/cuda/CriterionUtils.cuh"
+#include "libraries/criterion/cuda/CtcGreedyPath.cuh"
+#include "libraries/criterion/cuda/ForcedAlignmentPath.cuh"
 #include "libraries/criterion/cuda/ViterbiPath.cuh"
+#include "libraries/module/cuda/AttentionStep.cuh"
+#include "libraries/module/cuda/LocationEnergies.cuh"
 
+using AttentionStep = w2l::cuda::AttentionStep<float>;
 using CriterionUtils = w2l::cuda::CriterionUtils<float>;
+using CtcGreedyPath = w2l::cuda::CtcGreedyPath<float>;
+using ForcedAlignmentPath = w2l::cuda::ForcedAlignmentPath<float>;
+using LocationEnergies = w2l::cuda::LocationEnergies<float>;
 using ViterbiPath = w2l::cuda::ViterbiPath<float>;
 
 namespace w2l {
@@ -32,13 +41,15 @@ af::array viterbiPath(const af::array& input, const af::array& trans) {
   }
 
   af::array path(T, B, s32);
-  af::array workspace(ViterbiPath::getWorkspaceSize(B, T, N), u8);
+  auto stream = fl::cuda::getActiveStream();
+  auto workspace = WorkspacePool::get().acquire(
+      ViterbiPath::getWorkspaceSize(B, T, N), stream);
 
   {
     fl::DevicePtr inputRaw(input);
     fl::DevicePtr transRaw(trans);
     fl::DevicePtr pathRaw(path);
-    fl::DevicePtr workspaceRaw(workspace);
+    fl::DevicePtr workspaceRaw(*workspace);
 
     ViterbiPath::compute(
         B,
@@ -48,12 +59,252 @@ af::array viterbiPath(const af::array& input, const af::array& trans) {
         static_cast<const float*>(transRaw.get()),
         static_cast<int*>(pathRaw.get()),
         workspaceRaw.get(),
+        stream);
+  }
+
+  return path;
+}
+
+af::array ctcGreedyPath(const af::array& input) {
+  auto B = input.dims(2);
+  auto T = input.dims(1);
+  auto N = input.dims(0);
+
+  if (input.type() != f32) {
+    throw std::invalid_argument("ctcGreedyPath: input must be float32");
+  }
+
+  af::array path(T, B, s32);
+  af::array pathSize(B, s32);
+
+  {
+    fl::DevicePtr inputRaw(input);
+    fl::DevicePtr pathRaw(path);
+    fl::DevicePtr pathSizeRaw(pathSize);
+
+    CtcGreedyPath::compute(
+        B,
+        T,
+        N,
+        static_cast<const float*>(inputRaw.get()),
+        static_cast<int*>(pathRaw.get()),
+        static_cast<int*>(pathSizeRaw.get()),
         fl::cuda::getActiveStream());
   }
 
   return path;
 }
 
+af::array forcedAlignmentPath(
+    const af::array& input,
+    const af::array& target,
+    const af::array& trans,
+    const af::array& inputSize /* = af::array() */) {
+  auto B = input.dims(2);
+  auto T = input.dims(1);
+  auto N = input.dims(0);
+  auto L = target.dims(0);
+
+  if (target.dims(1) != B ||
+      (!trans.isempty() && (N != trans.dims(0) || N != trans.dims(1))) ||
+      (!inputSize.isempty() && inputSize.elements() != B)) {
+    throw std::invalid_argument("forcedAlignmentPath: mismatched dims");
+  } else if (input.type() != f32) {
+    throw std::invalid_argument("forcedAlignmentPath: input must be float32");
+  } else if (!trans.isempty() && trans.type() != f32) {
+    throw std::invalid_argument("forcedAlignmentPath: trans must be float32");
+  } else if (target.type() != s32) {
+    throw std::invalid_argument("forcedAlignmentPath: target must be int32");
+  } else if (!inputSize.isempty() && inputSize.type() != s32) {
+    throw std::invalid_argument("forcedAlignmentPath: inputSize must be int32");
+  }
+
+  af::array path(T, B, s32);
+  auto targetSize = getTargetSizeArray(target, T);
+  auto stream = fl::cuda::getActiveStream();
+  auto workspace = WorkspacePool::get().acquire(
+      ForcedAlignmentPath::getWorkspaceSize(B, T, L), stream);
+
+  {
+    fl::DevicePtr inputRaw(input);
+    fl::DevicePtr inputSizeRaw(inputSize);
+    fl::DevicePtr targetRaw(target);
+    fl::DevicePtr targetSizeRaw(targetSize);
+    fl::DevicePtr transRaw(trans);
+    fl::DevicePtr pathRaw(path);
+    fl::DevicePtr workspaceRaw(*workspace);
+
+    ForcedAlignmentPath::compute(
+        B,
+        T,
+        N,
+        L,
+        static_cast<const float*>(inputRaw.get()),
+        static_cast<const int*>(inputSizeRaw.get()),
+        static_cast<const int*>(targetRaw.get()),
+        static_cast<const int*>(targetSizeRaw.get()),
+        static_cast<const float*>(transRaw.get()),
+        static_cast<int*>(pathRaw.get()),
+        workspaceRaw.get(),
+        stream);
+  }
+
+  return path;
+}
+
+std::pair<af::array, af::array> attentionStep(
+    const af::array& query,
+    const af::array& keys,
+    const af::array& values,
+    const af::array& bias,
+    float scale /* = 1.0 */) {
+  auto B = values.dims(2);
+  auto T = values.dims(1);
+  auto V = values.dims(0);
+  auto H = query.dims(0);
+
+  if (query.dims(1) > 1 || (!query.isempty() && query.dims(2) != B) ||
+      (query.isempty() ? !keys.isempty()
+                       : keys.dims() != af::dim4(H, T, B)) ||
+      (!bias.isempty() && bias.dims() != af::dim4(1, T, B))) {
+    throw std::invalid_argument("attentionStep: mismatched dims");
+  } else if (
+      values.type() != f32 || (!query.isempty() && query.type() != f32) ||
+      (!keys.isempty() && keys.type() != f32) ||
+      (!bias.isempty() && bias.type() != f32)) {
+    throw std::invalid_argument("attentionStep: inputs must be float32");
+  }
+
+  af::array attention(1, T, B, f32);
+  af::array summary(V, 1, B, f32);
+
+  {
+    fl::DevicePtr queryRaw(query);
+    fl::DevicePtr keysRaw(keys);
+    fl::DevicePtr valuesRaw(values);
+    fl::DevicePtr biasRaw(bias);
+    fl::DevicePtr attentionRaw(attention);
+    fl::DevicePtr summaryRaw(summary);
+
+    AttentionStep::compute(
+        B,
+        T,
+        H,
+        V,
+        scale,
+        static_cast<const float*>(queryRaw.get()),
+        static_cast<const float*>(keysRaw.get()),
+        static_cast<const float*>(valuesRaw.get()),
+        static_cast<const float*>(biasRaw.get()),
+        static_cast<float*>(attentionRaw.get()),
+        static_cast<float*>(summaryRaw.get()),
+        fl::cuda::getActiveStream());
+  }
+
+  return std::make_pair(attention, summary);
+}
+
+namespace detail {
+
+af::array locationEnergiesForward(
+    const af::array& keys,
+    const af::array& query,
+    const af::array& prevAttn,
+    const af::array& filter,
+    const af::array& filterBias,
+    const af::array& weight) {
+  auto A = keys.dims(0);
+  auto T = keys.dims(1);
+  auto B = keys.dims(2);
+  auto K = filter.dims(1);
+
+  af::array energies(1, T, B, f32);
+
+  {
+    fl::DevicePtr keysRaw(keys);
+    fl::DevicePtr queryRaw(query);
+    fl::DevicePtr prevAttnRaw(prevAttn);
+    fl::DevicePtr filterRaw(filter);
+    fl::DevicePtr filterBiasRaw(filterBias);
+    fl::DevicePtr weightRaw(weight);
+    fl::DevicePtr energiesRaw(energies);
+
+    LocationEnergies::forward(
+        B,
+        T,
+        A,
+        K,
+        static_cast<const float*>(keysRaw.get()),
+        static_cast<const float*>(queryRaw.get()),
+        static_cast<const float*>(prevAttnRaw.get()),
+        static_cast<const float*>(filterRaw.get()),
+        static_cast<const float*>(filterBiasRaw.get()),
+        static_cast<const float*>(weightRaw.get()),
+        static_cast<float*>(energiesRaw.get()),
+        fl::cuda::getActiveStream());
+  }
+
+  return energies;
+}
+
+void locationEnergiesBackward(
+    const af::array& gradEnergies,
+    const af::array& keys,
+    const af::array& query,
+    const af::array& prevAttn,
+    const af::array& filter,
+    const af::array& filterBias,
+    const af::array& weight,
+    af::array& gradKeys,
+    af::array& gradQuery,
+    af::array& gradWeight) {
+  auto A = keys.dims(0);
+  auto T = keys.dims(1);
+  auto B = keys.dims(2);
+  auto K = filter.dims(1);
+  auto tiles = LocationEnergies::numTiles(T);
+
+  gradKeys = af::array(A, T, B, f32);
+  af::array tileGradQuery(A, tiles, B, f32);
+  af::array tileGradWeight(A, tiles, B, f32);
+
+  {
+    fl::DevicePtr gradEnergiesRaw(gradEnergies);
+    fl::DevicePtr keysRaw(keys);
+    fl::DevicePtr queryRaw(query);
+    fl::DevicePtr prevAttnRaw(prevAttn);
+    fl::DevicePtr filterRaw(filter);
+    fl::DevicePtr filterBiasRaw(filterBias);
+    fl::DevicePtr weightRaw(weight);
+    fl::DevicePtr gradKeysRaw(gradKeys);
+    fl::DevicePtr tileGradQueryRaw(tileGradQuery);
+    fl::DevicePtr tileGradWeightRaw(tileGradWeight);
+
+    LocationEnergies::backward(
+        B,
+        T,
+        A,
+        K,
+        static_cast<const float*>(gradEnergiesRaw.get()),
+        static_cast<const float*>(keysRaw.get()),
+        static_cast<const float*>(queryRaw.get()),
+        static_cast<const float*>(prevAttnRaw.get()),
+        static_cast<const float*>(filterRaw.get()),
+        static_cast<const float*>(filterBiasRaw.get()),
+        static_cast<const float*>(weightRaw.get()),
+        static_cast<float*>(gradKeysRaw.get()),
+        static_cast<float*>(tileGradQueryRaw.get()),
+        static_cast<float*>(tileGradWeightRaw.get()),
+        fl::cuda::getActiveStream());
+  }
+
+  gradQuery = af::sum(tileGradQuery, 1);
+  gradWeight = af::moddims(
+      af::sum(af::moddims(tileGradWeight, A, tiles * B), 1), 1, A);
+}
+
+} // namespace detail
+
 af::array getTargetSizeArray(const af::array& target, int maxSize) {
   int B = target.dims(1);
   int L = target.dims(0);
@@ -11,6 +11,7 @@
 #include <flashlight/common/cuda.h>
 
 #include "criterion/CriterionUtils.h"
+#include "criterion/backend/cuda/WorkspacePool.h"
 #include "libraries/criterion/cuda/ForceAlignmentCriterion.cuh"
 
 using fl::Variable;
@@ -27,7 +28,8 @@ static void backward(
     int L,
     const af::array& target,
     const af::array& targetSize,
-    af::array& workspace) {
+    af::array& workspace,
+    af::dtype inputType) {
   if (gradVar.type() != f32) {
     throw std::invalid_argument("FAC: grad must be float32");
   }
@@ -57,6 +59,9 @@ static void backward(
         fl::cuda::getActiveStream());
   }
 
+  if (inputType != f32) {
+    inputGrad = inputGrad.as(inputType);
+  }
   inputs[0].addGrad(Variable(inputGrad, false));
   inputs[1].addGrad(Variable(transGrad, false));
 }
@@ -72,18 +77,24 @@ Variable ForceAlignmentCriterion::forward(
 
   if (N != transVar.dims(0)) {
     throw std::invalid_argument("FAC: input dim doesn't match N");
-  } else if (inputVar.type() != f32) {
-    throw std::invalid_argument("FAC: input must be float32");
+  } else if (inputVar.type() != f32 && inputVar.type() != f16) {
+    throw std::invalid_argument("FAC: input must be float32 or float16");
   } else if (targetVar.type() != s32) {
     throw std::invalid_argument("FAC: target must be int32");
   }
 
-  const auto& input = inputVar.array();
+  // float16 inputs, from mixed-precision training, are recursed on in double
+  // as the float32 ones: the workspace is only [B][T][L]
+  auto inputType = inputVar.type();
+  const auto& input =
+      inputType == f16 ? inputVar.array().as(f32) : inputVar.array();
   const auto& target = targetVar.array();
   const auto& targetSize = getTargetSizeArray(target, T);
   const auto& trans = transVar.array();
   af::array loss(B, f32);
-  af::array workspace(FAC::getWorkspaceSize(B, T, N, L), u8);
+  auto stream = fl::cuda::getActiveStream();
+  auto workspace =
+      WorkspacePool::get().acquire(FAC::getWorkspaceSize(B, T, N, L), stream);
 
   {
     fl::DevicePtr inputRaw(input);
@@ -91,7 +102,7 @@ Variable ForceAlignmentCriterion::forward(
     fl::DevicePtr targetSizeRaw(targetSize);
     fl::DevicePtr transRaw(trans);
     fl::DevicePtr lossRaw(loss);
-    fl::DevicePtr workspaceRaw(workspace);
+    fl::DevicePtr workspaceRaw(*workspace);
 
     FAC::forward(
         B,
@@ -105,14 +116,24 @@ Variable ForceAlignmentCriterion::forward(
         static_cast<const float*>(transRaw.get()),
         static_cast<float*>(lossRaw.get()),
         workspaceRaw.get(),
-        fl::cuda::getActiveStream());
+        stream);
   }
 
   return Variable(
       loss,
       {inputVar.withoutData(), transVar.withoutData()},
       [=](std::vector<Variable>& inputs, const Variable& gradVar) mutable {
-        backward(inputs, gradVar, B, T, N, L, target, targetSize, workspace);
+        backward(
+            inputs,
+            gradVar,
+            B,
+            T,
+            N,
+            L,
+            target,
+            targetSize,
+            *workspace,
+            inputType);
       });
 }
 
@@ -11,13 +11,19 @@
 #include <flashlight/common/cuda.h>
 
 #include "criterion/CriterionUtils.h"
+#include "criterion/backend/cuda/WorkspacePool.h"
 #include "libraries/criterion/cuda/FullConnectionCriterion.cuh"
+#include "libraries/criterion/cuda/SparseConnectionCriterion.cuh"
 
 using fl::Variable;
 using FCC = w2l::cuda::FullConnectionCriterion<float>;
+// float16 inputs, from mixed-precision training, are recursed on in float
+using FCCHalf = w2l::cuda::FullConnectionCriterion<float, float>;
+using SCC = w2l::cuda::SparseConnectionCriterion<float>;
 
 namespace w2l {
 
+template <class Criterion>
 static void backward(
     std::vector<Variable>& inputs,
     const Variable& gradVar,
@@ -25,7 +31,8 @@ static void backward(
     int T,
     int N,
     const af::array& trans,
-    af::array& workspace) {
+    af::array& workspace,
+    af::dtype inputType) {
   if (gradVar.type() != f32) {
     throw std::invalid_argument("FCC: grad must be float32");
   }
@@ -40,7 +47,7 @@ static void backward(
     fl::DevicePtr inputGradRaw(inputGrad);
     fl::DevicePtr transGradRaw(transGrad);
     fl::DevicePtr workspaceRaw(workspace);
-    FCC::backward(
+    Criterion::backward(
         B,
         T,
         N,
@@ -52,59 +59,202 @@ static void backward(
         fl::cuda::getActiveStream());
   }
 
+  if (inputType != f32) {
+    inputGrad = inputGrad.as(inputType);
+  }
   inputs[0].addGrad(Variable(inputGrad, false));
   inputs[1].addGrad(Variable(transGrad, false));
 }
 
-Variable FullConnectionCriterion::forward(
+template <class Criterion>
+static Variable forward(
     const Variable& inputVar,
-    const Variable& targetVar) {
-  const auto& transVar = param(0);
+    const Variable& transVar,
+    const af::array& input,
+    const af::array& targetSize,
+    CriterionScaleMode scaleMode) {
   int B = inputVar.dims(2);
   int T = inputVar.dims(1);
   int N = inputVar.dims(0);
+  auto inputType = inputVar.type();
 
-  if (N != transVar.dims(0)) {
-    throw std::invalid_argument("FCC: input dim doesn't match N");
-  } else if (inputVar.type() != f32) {
-    throw std::invalid_argument("FCC: input must be float32");
-  } else if (targetVar.type() != s32) {
-    throw std::invalid_argument("FCC: target must be int32");
-  }
-
-  const auto& input = inputVar.array();
-  const auto& target = targetVar.array();
-  const auto& targetSize = getTargetSizeArray(target, T);
   const auto& trans = transVar.array();
   af::array loss(B, f32);
-  af::array workspace(FCC::getWorkspaceSize(B, T, N), u8);
+  auto stream = fl::cuda::getActiveStream();
+  auto workspace = WorkspacePool::get().acquire(
+      Criterion::getWorkspaceSize(B, T, N), stream);
 
   {
     fl::DevicePtr inputRaw(input);
     fl::DevicePtr targetSizeRaw(targetSize);
     fl::DevicePtr transRaw(trans);
     fl::DevicePtr lossRaw(loss);
-    fl::DevicePtr workspaceRaw(workspace);
+    fl::DevicePtr workspaceRaw(*workspace);
 
-    FCC::forward(
+    Criterion::forward(
         B,
         T,
         N,
-        scaleMode_,
+        scaleMode,
         static_cast<const float*>(inputRaw.get()),
         static_cast<const int*>(targetSizeRaw.get()),
         static_cast<const float*>(transRaw.get()),
         static_cast<float*>(lossRaw.get()),
         workspaceRaw.get(),
+        stream);
+  }
+
+  return Variable(
+      loss,
+      {inputVar.withoutData(), transVar.withoutData()},
+      [=](std::vector<Variable>& inputs, const Variable& gradVar) mutable {
+        backward<Criterion>(
+            inputs, gradVar, B, T, N, trans, *workspace, inputType);
+      });
+}
+
+static void sparseBackward(
+    std::vector<Variable>& inputs,
+    const Variable& gradVar,
+    int B,
+    int T,
+    int N,
+    int K,
+    const af::array& transIndex,
+    const af::array& transValue,
+    af::array& workspace,
+    af::dtype inputType) {
+  if (gradVar.type() != f32) {
+    throw std::invalid_argument("FCC: grad must be float32");
+  }
+
+  const auto& grad = gradVar.array();
+  af::array inputGrad(N, T, B, f32);
+  af::array transGrad(K, N, f32);
+
+  {
+    fl::DevicePtr transIndexRaw(transIndex);
+    fl::DevicePtr transValueRaw(transValue);
+    fl::DevicePtr gradRaw(grad);
+    fl::DevicePtr inputGradRaw(inputGrad);
+    fl::DevicePtr transGradRaw(transGrad);
+    fl::DevicePtr workspaceRaw(workspace);
+    SCC::backward(
+        B,
+        T,
+        N,
+        K,
+        static_cast<const int*>(transIndexRaw.get()),
+        static_cast<const float*>(transValueRaw.get()),
+        static_cast<const float*>(gradRaw.get()),
+        static_cast<float*>(inputGradRaw.get()),
+        static_cast<float*>(transGradRaw.get()),
+        workspaceRaw.get(),
         fl::cuda::getActiveStream());
   }
 
+  if (inputType != f32) {
+    inputGrad = inputGrad.as(inputType);
+  }
+  inputs[0].addGrad(Variable(inputGrad, false));
+  inputs[1].addGrad(
+      Variable(scatterTransitionGrad(transGrad, transIndex), false));
+}
+
+static Variable sparseForward(
+    const Variable& inputVar,
+    const Variable& transVar,
+    const af::array& input,
+    const af::array& targetSize,
+    CriterionScaleMode scaleMode,
+    int K) {
+  int B = inputVar.dims(2);
+  int T = inputVar.dims(1);
+  int N = inputVar.dims(0);
+  auto inputType = inputVar.type();
+
+  af::array transValue, transIndex;
+  topKTransitions(transVar.array(), K, transValue, transIndex);
+  af::array loss(B, f32);
+  auto stream = fl::cuda::getActiveStream();
+  auto workspace = WorkspacePool::get().acquire(
+      SCC::getWorkspaceSize(B, T, N, K), stream);
+
+  {
+    fl::DevicePtr inputRaw(input);
+    fl::DevicePtr targetSizeRaw(targetSize);
+    fl::DevicePtr transIndexRaw(transIndex);
+    fl::DevicePtr transValueRaw(transValue);
+    fl::DevicePtr lossRaw(loss);
+    fl::DevicePtr workspaceRaw(*workspace);
+
+    SCC::forward(
+        B,
+        T,
+        N,
+        K,
+        scaleMode,
+        static_cast<const float*>(inputRaw.get()),
+        static_cast<const int*>(targetSizeRaw.get()),
+        static_cast<const int*>(transIndexRaw.get()),
+        static_cast<const float*>(transValueRaw.get()),
+        static_cast<float*>(lossRaw.get()),
+        workspaceRaw.get(),
+        stream);
+  }
+
   return Variable(
       loss,
       {inputVar.withoutData(), transVar.withoutData()},
       [=](std::vector<Variable>& inputs, const Variable& gradVar) mutable {
-        backward(inputs, gradVar, B, T, N, trans, workspace);
+        sparseBackward(
+            inputs,
+            gradVar,
+            B,
+            T,
+            N,
+            K,
+            transIndex,
+            transValue,
+            *workspace,
+            inputType);
       });
 }
 
+Variable FullConnectionCriterion::forward(
+    const Variable& inputVar,
+    const Variable& targetVar) {
+  const auto& transVar = param(0);
+  int T = inputVar.dims(1);
+  int N = inputVar.dims(0);
+
+  if (N != transVar.dims(0)) {
+    throw std::invalid_argument("FCC: input dim doesn't match N");
+  } else if (inputVar.type() != f32 && inputVar.type() != f16) {
+    throw std::invalid_argument("FCC: input must be float32 or float16");
+  } else if (targetVar.type() != s32) {
+    throw std::invalid_argument("FCC: target must be int32");
+  }
+
+  const auto& target = targetVar.array();
+  const auto& targetSize = getTargetSizeArray(target, T);
+
+  if (isSparse()) {
+    return sparseForward(
+        inputVar,
+        transVar,
+        inputVar.type() == f16 ? inputVar.array().as(f32) : inputVar.array(),
+        targetSize,
+        scaleMode_,
+        topK_);
+  }
+  if (inputVar.type() == f16) {
+    // The recursions dominate: converting the input is cheap next to them
+    return w2l::forward<FCCHalf>(
+        inputVar, transVar, inputVar.array().as(f32), targetSize, scaleMode_);
+  }
+  return w2l::forward<FCC>(
+      inputVar, transVar, inputVar.array(), targetSize, scaleMode_);
+}
+
 } // namespace w2l
@@ -0,0 +1,69 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "criterion/backend/cuda/WorkspacePool.h"
+
+#include <algorithm>
+
+namespace w2l {
+
+namespace {
+// Sizes are rounded up so that slightly longer batches reuse the buffers
+constexpr size_t kGranularity = 1 << 20;
+
+bool smaller(const af::array& a, const af::array& b) {
+  return a.elements() < b.elements();
+}
+} // namespace
+
+WorkspacePool::WorkspacePool(size_t maxFree) : maxFree_(maxFree) {}
+
+WorkspacePool& WorkspacePool::get() {
+  // Leaked, as buffers may be released after static destruction
+  static auto* pool = new WorkspacePool();
+  return *pool;
+}
+
+WorkspacePool::BufferPtr WorkspacePool::acquire(
+    size_t size,
+    cudaStream_t stream) {
+  Key key(af::getDevice(), stream);
+  af::array buffer;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& buffers = free_[key];
+    // The largest free buffer, replaced if it is too small
+    auto largest = std::max_element(buffers.begin(), buffers.end(), smaller);
+    if (largest != buffers.end()) {
+      if (largest->elements() >= size) {
+        buffer = std::move(*largest);
+      }
+      buffers.erase(largest);
+    }
+  }
+  if (buffer.isempty()) {
+    size_t capacity = (size + kGranularity - 1) / kGranularity * kGranularity;
+    buffer = af::array(std::max(capacity, kGranularity), u8);
+  }
+  return BufferPtr(new af::array(std::move(buffer)), [this, key](af::array* p) {
+    release(key, std::move(*p));
+    delete p;
+  });
+}
+
+void WorkspacePool::release(const Key& key, af::array&& buffer) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto& buffers = free_[key];
+  buffers.push_back(std::move(buffer));
+  if (buffers.size() > maxFree_) {
+    // Drop the smallest buffer, which is the least likely to be reused
+    buffers.erase(std::min_element(buffers.begin(), buffers.end(), smaller));
+  }
+}
+
+} // namespace w2l
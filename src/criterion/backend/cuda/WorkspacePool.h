@@ -0,0 +1,59 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <arrayfire.h>
+#include <cuda_runtime.h>
+
+namespace w2l {
+
+/**
+ * WorkspacePool recycles the device buffers which the CUDA criterions
+ * partition with `Workspace<>`, so that a training step does not allocate
+ * them anew. Free buffers are kept per device and stream: a buffer released
+ * by the host is then only handed to work queued after the one which used it.
+ * A buffer is reused if it is large enough, and replaced by a larger one
+ * otherwise, so the buffers only grow to the largest batch shape. At most
+ * `maxFree` free buffers are kept per device and stream. All the methods are
+ * thread-safe.
+ */
+class WorkspacePool {
+ public:
+  // Returns the buffer to its pool when the last copy is destroyed
+  using BufferPtr = std::shared_ptr<af::array>;
+
+  explicit WorkspacePool(size_t maxFree = 4);
+
+  WorkspacePool(const WorkspacePool&) = delete;
+  WorkspacePool& operator=(const WorkspacePool&) = delete;
+
+  /* The pool of the criterions, which is never destroyed */
+  static WorkspacePool& get();
+
+  /* Returns a u8 buffer of at least `size` bytes on the active device */
+  BufferPtr acquire(size_t size, cudaStream_t stream);
+
+ private:
+  using Key = std::pair<int, cudaStream_t>; // device and stream
+
+  size_t maxFree_;
+  std::mutex mutex_;
+  std::map<Key, std::vector<af::array>> free_;
+
+  void release(const Key& key, af::array&& buffer);
+};
+
+} // namespace w2l
@@ -0,0 +1,425 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/**
+ * Benchmarks the criterion kernels of the libraries (FCC, FAC, Viterbi path
+ * and CTC) on the CPU and, if built with CUDA, the ones with a CUDA version
+ * (all but CTC, which runs in warp-ctc) on the GPU, over a sweep of shapes
+ * (batch B, frames T, classes N, target length L).
+ *
+ * Usage: CriterionBenchmark [iterations] [BxTxNxL ...]
+ *
+ * One tab-separated line is printed per kernel, backend and shape, with the
+ * average forward and backward times, the workspace size and the bandwidth
+ * achieved on the emissions (B x T x N floats read by the forward, their
+ * gradient written by the backward), a lower bound of the memory traffic.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "libraries/criterion/cpu/ConnectionistTemporalClassificationCriterion.h"
+#include "libraries/criterion/cpu/ForceAlignmentCriterion.h"
+#include "libraries/criterion/cpu/FullConnectionCriterion.h"
+#include "libraries/criterion/cpu/ViterbiPath.h"
+
+#ifdef W2L_LIBRARIES_USE_CUDA
+#include <cuda_runtime.h>
+
+#include "libraries/criterion/cuda/ForceAlignmentCriterion.cuh"
+#include "libraries/criterion/cuda/FullConnectionCriterion.cuh"
+#include "libraries/criterion/cuda/ViterbiPath.cuh"
+#endif // W2L_LIBRARIES_USE_CUDA
+
+using namespace w2l;
+
+namespace {
+
+struct Shape {
+  int B, T, N, L;
+};
+
+// Random inputs of a shape, the same for all the kernels and backends
+struct Inputs {
+  std::vector<float> input; // [B][T][N]
+  std::vector<float> trans; // [N][N]
+  std::vector<int> target; // [B][L], the last class (CTC blank) excluded
+  std::vector<int> targetSize; // [B]
+  std::vector<float> grad; // [B]
+
+  explicit Inputs(const Shape& s)
+      : input(s.B * s.T * s.N),
+        trans(s.N * s.N),
+        target(s.B * s.L),
+        targetSize(s.B, s.L),
+        grad(s.B, 1) {
+    std::mt19937 gen(0);
+    std::normal_distribution<float> normal;
+    std::uniform_int_distribution<int> label(0, s.N - 2);
+    for (auto& x : input) {
+      x = normal(gen);
+    }
+    for (auto& x : trans) {
+      x = normal(gen);
+    }
+    for (auto& x : target) {
+      x = label(gen);
+    }
+  }
+};
+
+constexpr double kNoTime = -1;
+
+void report(
+    const char* kernel,
+    const char* backend,
+    const Shape& s,
+    double fwdMs,
+    double bwdMs,
+    size_t workspaceBytes) {
+  double emissionBytes = sizeof(float) * s.B * s.T * s.N;
+  auto gbps = [emissionBytes](double ms) {
+    return ms > 0 ? emissionBytes / (ms * 1e6) : 0;
+  };
+  std::printf(
+      "%s\t%s\t%d\t%d\t%d\t%d\t%.4f\t%.4f\t%zu\t%.3f\t%.3f\n",
+      kernel,
+      backend,
+      s.B,
+      s.T,
+      s.N,
+      s.L,
+      fwdMs,
+      bwdMs,
+      workspaceBytes,
+      gbps(fwdMs),
+      gbps(bwdMs));
+  std::fflush(stdout);
+}
+
+// Average time of `fn` in ms, after a first call
+template <class Fn>
+double timeCpuMs(int iters, Fn&& fn) {
+  fn();
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iters; ++i) {
+    fn();
+  }
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+             .count() /
+      iters;
+}
+
+void benchCpu(const Shape& s, const Inputs& in, int iters) {
+  const int B = s.B, T = s.T, N = s.N, L = s.L;
+  const auto scale = CriterionScaleMode::NONE;
+  std::vector<float> loss(B), inputGrad(B * T * N), transGrad(N * N);
+  std::vector<int> path(B * T);
+  std::vector<char> ws;
+
+  using FCC = cpu::FullConnectionCriterion<float>;
+  ws.assign(FCC::getWorkspaceSize(B, T, N), 0);
+  double fwd = timeCpuMs(iters, [&]() {
+    FCC::forward(
+        B,
+        T,
+        N,
+        scale,
+        in.input.data(),
+        in.targetSize.data(),
+        in.trans.data(),
+        loss.data(),
+        ws.data());
+  });
+  double bwd = timeCpuMs(iters, [&]() {
+    FCC::backward(
+        B,
+        T,
+        N,
+        in.trans.data(),
+        in.grad.data(),
+        inputGrad.data(),
+        transGrad.data(),
+        ws.data());
+  });
+  report("fcc", "cpu", s, fwd, bwd, ws.size());
+
+  using FAC = cpu::ForceAlignmentCriterion<float>;
+  ws.assign(FAC::getWorkspaceSize(B, T, N, L), 0);
+  fwd = timeCpuMs(iters, [&]() {
+    FAC::forward(
+        B,
+        T,
+        N,
+        L,
+        scale,
+        in.input.data(),
+        in.target.data(),
+        in.targetSize.data(),
+        in.trans.data(),
+        loss.data(),
+        ws.data());
+  });
+  bwd = timeCpuMs(iters, [&]() {
+    FAC::backward(
+        B,
+        T,
+        N,
+        L,
+        in.target.data(),
+        in.targetSize.data(),
+        in.grad.data(),
+        inputGrad.data(),
+        transGrad.data(),
+        ws.data());
+  });
+  report("fac", "cpu", s, fwd, bwd, ws.size());
+
+  using Viterbi = cpu::ViterbiPath<float>;
+  ws.assign(Viterbi::getWorkspaceSize(B, T, N), 0);
+  fwd = timeCpuMs(iters, [&]() {
+    Viterbi::compute(
+        B, T, N, in.input.data(), in.trans.data(), path.data(), ws.data());
+  });
+  report("viterbi", "cpu", s, fwd, kNoTime, ws.size());
+
+  using CTC = cpu::ConnectionistTemporalClassificationCriterion<float>;
+  ws.assign(CTC::getWorkspaceSize(B, T, L), 0);
+  fwd = timeCpuMs(iters, [&]() {
+    CTC::forward(
+        B,
+        T,
+        N,
+        L,
+        scale,
+        in.input.data(),
+        in.target.data(),
+        in.targetSize.data(),
+        loss.data(),
+        ws.data());
+  });
+  bwd = timeCpuMs(iters, [&]() {
+    CTC::backward(B, T, N, L, in.grad.data(), inputGrad.data(), ws.data());
+  });
+  report("ctc", "cpu", s, fwd, bwd, ws.size());
+}
+
+#ifdef W2L_LIBRARIES_USE_CUDA
+
+void checkCuda(cudaError_t err) {
+  if (err != cudaSuccess) {
+    throw std::runtime_error(
+        std::string("CUDA error: ") + cudaGetErrorString(err));
+  }
+}
+
+// Device copy of a host vector, or uninitialized storage of `size` elements
+template <class T>
+class DeviceBuffer {
+ public:
+  explicit DeviceBuffer(size_t size) : size_(size) {
+    checkCuda(cudaMalloc(&data_, std::max<size_t>(size, 1) * sizeof(T)));
+  }
+
+  explicit DeviceBuffer(const std::vector<T>& host)
+      : DeviceBuffer(host.size()) {
+    checkCuda(cudaMemcpy(
+        data_, host.data(), size_ * sizeof(T), cudaMemcpyHostToDevice));
+  }
+
+  ~DeviceBuffer() {
+    cudaFree(data_);
+  }
+
+  DeviceBuffer(const DeviceBuffer&) = delete;
+  DeviceBuffer& operator=(const DeviceBuffer&) = delete;
+
+  T* get() const {
+    return static_cast<T*>(data_);
+  }
+
+ private:
+  void* data_{nullptr};
+  size_t size_;
+};
+
+// Average time of `fn` on `stream` in ms, after a first call
+template <class Fn>
+double timeCudaMs(int iters, cudaStream_t stream, Fn&& fn) {
+  fn();
+  cudaEvent_t start, stop;
+  checkCuda(cudaEventCreate(&start));
+  checkCuda(cudaEventCreate(&stop));
+  checkCuda(cudaEventRecord(start, stream));
+  for (int i = 0; i < iters; ++i) {
+    fn();
+  }
+  checkCuda(cudaEventRecord(stop, stream));
+  checkCuda(cudaEventSynchronize(stop));
+  float ms = 0;
+  checkCuda(cudaEventElapsedTime(&ms, start, stop));
+  cudaEventDestroy(start);
+  cudaEventDestroy(stop);
+  checkCuda(cudaGetLastError());
+  return ms / iters;
+}
+
+void benchCuda(const Shape& s, const Inputs& in, int iters) {
+  const int B = s.B, T = s.T, N = s.N, L = s.L;
+  const auto scale = CriterionScaleMode::NONE;
+  cudaStream_t stream;
+  checkCuda(cudaStreamCreate(&stream));
+  DeviceBuffer<float> input(in.input), trans(in.trans), grad(in.grad);
+  DeviceBuffer<int> target(in.target), targetSize(in.targetSize);
+  DeviceBuffer<float> loss(B), inputGrad(B * T * N), transGrad(N * N);
+  DeviceBuffer<int> path(B * T);
+
+  using FCC = cuda::FullConnectionCriterion<float>;
+  size_t wsSize = FCC::getWorkspaceSize(B, T, N);
+  // Per-frame launches, then one kernel per pass (up to 2048 classes), to
+  // set the threshold of the latter
+  for (int persistentMaxN : {0, N}) {
+    if (persistentMaxN > 2048) {
+      break;
+    }
+    FCC::setPersistentMaxN(persistentMaxN);
+    DeviceBuffer<char> ws(wsSize);
+    double fwd = timeCudaMs(iters, stream, [&]() {
+      FCC::forward(
+          B,
+          T,
+          N,
+          scale,
+          input.get(),
+          targetSize.get(),
+          trans.get(),
+          loss.get(),
+          ws.get(),
+          stream);
+    });
+    double bwd = timeCudaMs(iters, stream, [&]() {
+      FCC::backward(
+          B,
+          T,
+          N,
+          trans.get(),
+          grad.get(),
+          inputGrad.get(),
+          transGrad.get(),
+          ws.get(),
+          stream);
+    });
+    report(
+        persistentMaxN ? "fcc-persistent" : "fcc", "cuda", s, fwd, bwd, wsSize);
+  }
+  FCC::setPersistentMaxN(0);
+
+  using FAC = cuda::ForceAlignmentCriterion<float>;
+  wsSize = FAC::getWorkspaceSize(B, T, N, L);
+  // One block per sample, then the states split between blocks
+  for (bool split : {false, true}) {
+    FAC::setSplitTargets(split);
+    DeviceBuffer<char> ws(wsSize);
+    double fwd = timeCudaMs(iters, stream, [&]() {
+      FAC::forward(
+          B,
+          T,
+          N,
+          L,
+          scale,
+          input.get(),
+          target.get(),
+          targetSize.get(),
+          trans.get(),
+          loss.get(),
+          ws.get(),
+          stream);
+    });
+    double bwd = timeCudaMs(iters, stream, [&]() {
+      FAC::backward(
+          B,
+          T,
+          N,
+          L,
+          target.get(),
+          targetSize.get(),
+          grad.get(),
+          inputGrad.get(),
+          transGrad.get(),
+          ws.get(),
+          stream);
+    });
+    report(split ? "fac-split" : "fac", "cuda", s, fwd, bwd, wsSize);
+  }
+  FAC::setSplitTargets(false);
+
+  using Viterbi = cuda::ViterbiPath<float>;
+  wsSize = Viterbi::getWorkspaceSize(B, T, N);
+  {
+    DeviceBuffer<char> ws(wsSize);
+    double fwd = timeCudaMs(iters, stream, [&]() {
+      Viterbi::compute(
+          B, T, N, input.get(), trans.get(), path.get(), ws.get(), stream);
+    });
+    report("viterbi", "cuda", s, fwd, kNoTime, wsSize);
+  }
+
+  checkCuda(cudaStreamDestroy(stream));
+}
+
+#endif // W2L_LIBRARIES_USE_CUDA
+
+Shape parseShape(const std::string& str) {
+  Shape s;
+  char x1, x2, x3;
+  std::istringstream ss(str);
+  if (!(ss >> s.B >> x1 >> s.T >> x2 >> s.N >> x3 >> s.L) || x1 != 'x' ||
+      x2 != 'x' || x3 != 'x' || s.B < 1 || s.T < 1 || s.N < 2 || s.L < 1) {
+    throw std::invalid_argument("Invalid shape (expected BxTxNxL): " + str);
+  }
+  return s;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  int iters = argc > 1 ? std::stoi(argv[1]) : 10;
+  std::vector<Shape> shapes;
+  for (int i = 2; i < argc; ++i) {
+    shapes.push_back(parseShape(argv[i]));
+  }
+  if (shapes.empty()) {
+    // Letters (N = 30) at the batch sizes and lengths of training, and larger
+    // token sets
+    shapes = {{1, 150, 30, 40},
+              {8, 400, 30, 100},
+              {32, 400, 30, 100},
+              {8, 1500, 30, 300},
+              {8, 400, 300, 100},
+              {8, 400, 1000, 50}};
+  }
+
+  std::cout << "kernel\tbackend\tB\tT\tN\tL\tfwd_ms\tbwd_ms\tworkspace_bytes"
+            << "\tfwd_GBps\tbwd_GBps" << std::endl;
+  for (const auto& s : shapes) {
+    Inputs in(s);
+    benchCpu(s, in, iters);
+#ifdef W2L_LIBRARIES_USE_CUDA
+    benchCuda(s, in, iters);
+#endif // W2L_LIBRARIES_USE_CUDA
+  }
+  return 0;
+}
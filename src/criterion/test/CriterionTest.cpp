@@ -11,7 +11,17 @@
 #include <arrayfire.h>
 #include <array>
 
+#include "common/FlashlightUtils.h"
 #include "criterion/criterion.h"
+#include "libraries/criterion/cpu/ConnectionistTemporalClassificationCriterion.h"
+#include "libraries/criterion/cpu/CriterionUtils.h"
+#include "libraries/criterion/cpu/ForceAlignmentCriterion.h"
+#include "libraries/criterion/cpu/FullConnectionCriterion.h"
+
+#ifdef W2L_LIBRARIES_USE_CUDA
+#include "libraries/criterion/cuda/ForceAlignmentCriterion.cuh"
+#include "libraries/criterion/cuda/FullConnectionCriterion.cuh"
+#endif // W2L_LIBRARIES_USE_CUDA
 
 using namespace fl;
 using namespace w2l;
@@ -117,6 +127,79 @@ TEST(CriterionTest, CTCJacobian) {
   jacobian_test(func_conv_in, in);
 }
 
+TEST(CriterionTest, CTCMatchesCpuLibrary) {
+  // The criterion of the backend against the CPU library, on targets of
+  // several sizes in a batch, with repeated labels, and too long for T
+  struct Shape {
+    int B, T, N, L, nClasses;
+  };
+  std::vector<Shape> shapes = {
+      {1, 10, 5, 3, 4},
+      {3, 25, 8, 10, 7},
+      {4, 30, 6, 20, 2}, // many repeats
+      {2, 12, 6, 15, 5}, // longer than T
+      {2, 8, 5, 6, 1}, // all repeats, which need 11 frames
+  };
+  // Beyond the target sizes warp-ctc handles on GPU
+  if (af::getActiveBackend() != AF_BACKEND_CUDA) {
+    shapes.push_back({2, 1500, 30, 700, 29});
+  }
+
+  using CpuCTC = cpu::ConnectionistTemporalClassificationCriterion<float>;
+  for (const auto& shape : shapes) {
+    int B = shape.B, T = shape.T, N = shape.N, L = shape.L;
+    auto in = Variable(af::randn(N, T, B), true);
+    auto t = (af::abs(af::randu(L, B, af::dtype::s32)) % shape.nClasses)
+                 .as(af::dtype::s32);
+    // The last sample is padded to half the size
+    if (B > 1) {
+      t(af::seq(L / 2, L - 1), B - 1) = -1;
+    }
+    auto tgt = Variable(t, false);
+    auto ctc = ConnectionistTemporalClassificationCriterion(
+        w2l::CriterionScaleMode::TARGET_SZ_SQRT);
+    auto loss = ctc({in, tgt}).front();
+    auto grad = af::randu(B);
+    loss.backward(Variable(grad, false));
+
+    auto logprobs = Variable(in.array(), true);
+    auto normalized = logSoftmax(logprobs, 0);
+    auto inputVec = afToVector<float>(normalized);
+    auto targetVec = afToVector<int>(t);
+    auto gradVec = afToVector<float>(grad);
+    std::vector<int> targetSizeVec(B, 0);
+    cpu::CriterionUtils<float>::batchTargetSize(
+        B, L, L, targetVec.data(), targetSizeVec.data());
+    std::vector<uint8_t> workspace(CpuCTC::getWorkspaceSize(B, T, L));
+    std::vector<float> expectedLoss(B), normalizedGrad(B * T * N);
+    CpuCTC::forward(
+        B,
+        T,
+        N,
+        L,
+        w2l::CriterionScaleMode::TARGET_SZ_SQRT,
+        inputVec.data(),
+        targetVec.data(),
+        targetSizeVec.data(),
+        expectedLoss.data(),
+        workspace.data());
+    CpuCTC::backward(
+        B,
+        T,
+        N,
+        L,
+        gradVec.data(),
+        normalizedGrad.data(),
+        workspace.data());
+    normalized.backward(
+        Variable(af::array(N, T, B, normalizedGrad.data()), false));
+
+    auto lossDiff = loss.array() - af::array(B, expectedLoss.data());
+    checkZero(lossDiff / af::max<float>(af::abs(loss.array())), 1E-4);
+    checkZero(in.grad().array() - logprobs.grad().array(), 1E-4);
+  }
+}
+
 TEST(CriterionTest, Batching) {
   {
     int N = 10, T = 25, L = 15, B = 5;
@@ -281,6 +364,13 @@ TEST(CriterionTest, ViterbiPath) {
   auto expectedPath2b = af::tile(expectedPath2, 1, 77);
   auto path2b = asg.viterbiPath(input2b);
   checkZero(path2b - expectedPath2b);
+  auto paths2b = asg.batchViterbiPath(input2b);
+  ASSERT_EQ(paths2b.size(), 77u);
+  std::vector<int> expectedPath2Vec2(
+      expectedPath2Vec.begin(), expectedPath2Vec.end());
+  for (const auto& path : paths2b) {
+    ASSERT_EQ(path, expectedPath2Vec2);
+  }
 
   // If trasition probablities are same, CTC and ASG viterbi paths should match
   AutoSegmentationCriterion asg2(30);
@@ -294,6 +384,97 @@ TEST(CriterionTest, ViterbiPath) {
   }
 }
 
+TEST(CriterionTest, ForcedAlignmentPath) {
+  const int N = 6, T = 20, L = 5, B = 3;
+  auto input = af::log(af::randu(N, T, B));
+  // Repeats, padding, and a target too long for its frames
+  std::array<int, L * B> targetVec = {
+      0, 1, 1, 2, -1, 4, 3, 0, 2, 1, 2, 2, 2, 2, 2};
+  af::array target(L, B, targetVec.data());
+  std::array<int, B> inputSizeVec = {T, 12, 4};
+  af::array inputSize(B, inputSizeVec.data());
+
+  // CTC: the path collapses to the (shortened) target
+  std::vector<int> ctcPath(T * B);
+  forcedAlignmentPath(input, target, af::array(), inputSize)
+      .host(ctcPath.data());
+  // With the repeats, 4 frames are too short for any label of the last one
+  std::vector<std::vector<int>> ctcExpected = {
+      {0, 1, 1, 2}, {4, 3, 0, 2, 1}, {}};
+  for (int b = 0; b < B; ++b) {
+    std::vector<int> collapsed;
+    for (int t = 0; t < T; ++t) {
+      int token = ctcPath[b * T + t];
+      if (t >= inputSizeVec[b]) {
+        ASSERT_EQ(token, -1);
+      } else if (
+          token != N - 1 && (t == 0 || token != ctcPath[b * T + t - 1])) {
+        collapsed.push_back(token);
+      }
+    }
+    ASSERT_EQ(collapsed, ctcExpected[b]);
+  }
+
+  // ASG: each frame is a label of the target, in order
+  std::vector<int> asgPath(T * B);
+  auto trans = af::randu(N, N);
+  forcedAlignmentPath(input, target, trans, inputSize).host(asgPath.data());
+  std::vector<std::vector<int>> asgExpected = {{0, 1, 2}, {4, 3, 0, 2, 1}, {2}};
+  for (int b = 0; b < B; ++b) {
+    std::vector<int> collapsed;
+    for (int t = 0; t < inputSizeVec[b]; ++t) {
+      int token = asgPath[b * T + t];
+      if (t == 0 || token != asgPath[b * T + t - 1]) {
+        collapsed.push_back(token);
+      }
+    }
+    ASSERT_EQ(collapsed, asgExpected[b]);
+  }
+
+  // Without transitions, the ASG alignment of a target of T labels is the
+  // target itself
+  af::array full = af::range(af::dim4(T), 0, s32) % N;
+  std::vector<int> fullPath(T);
+  forcedAlignmentPath(
+      input(af::span, af::span, 0), full, af::constant(0, N, N))
+      .host(fullPath.data());
+  for (int t = 0; t < T; ++t) {
+    ASSERT_EQ(fullPath[t], t % N);
+  }
+}
+
+TEST(CriterionTest, CTCGreedyPath) {
+  auto in = af::randu(4, 5, 2); // All values < 1
+  std::array<int, 5> path = {3, 2, 0, 2, 2};
+  for (int j = 0; j < 5; ++j) {
+    in(path[j], j, af::span) = 2;
+  }
+  ConnectionistTemporalClassificationCriterion ctc;
+  auto paths = ctc.greedyPath(in);
+  ASSERT_EQ(paths.size(), 2u);
+  for (const auto& p : paths) {
+    ASSERT_EQ(p, std::vector<int>({2, 0, 2}));
+  }
+
+  // Match the collapsed viterbi path, over several tiles of frames
+  const int N = 30, T = 700, B = 3;
+  auto randInput = af::randu(N, T, B);
+  std::vector<int> viterbiVec(T * B);
+  ctc.viterbiPath(randInput).as(s32).host(viterbiVec.data());
+  auto greedy = ctc.greedyPath(randInput);
+  ASSERT_EQ(greedy.size(), static_cast<size_t>(B));
+  for (int b = 0; b < B; ++b) {
+    std::vector<int> expected;
+    for (int t = 0; t < T; ++t) {
+      int token = viterbiVec[b * T + t];
+      if (token != N - 1 && (t == 0 || token != viterbiVec[b * T + t - 1])) {
+        expected.push_back(token);
+      }
+    }
+    ASSERT_EQ(greedy[b], expected);
+  }
+}
+
 TEST(CriterionTest, FCCCost) {
   // Test case: 1
   std::array<float, 12> input1 = {
@@ -365,6 +546,69 @@ TEST(CriterionTest, FCCJacobian) {
   jacobian_test(func_trans, transition);
 }
 
+TEST(CriterionTest, FCCTopK) {
+  int N = 6, T = 10, L = 4, B = 3, K = 2;
+  auto in = Variable(af::log(af::randu(N, T, B)), true);
+  auto t = af::abs(af::randu(L, B, af::dtype::s32)) % (N - 1);
+  auto tgt = Variable(t.as(af::dtype::s32), false);
+
+  // K well separated transitions into each class, the others negligible
+  std::vector<float> transVec(N * N, -100.0);
+  for (int m = 0; m < N; ++m) {
+    for (int k = 0; k < K; ++k) {
+      transVec[m * N + (m + k * 3) % N] = 0.1 * k + 0.05 * m;
+    }
+  }
+  auto transition = Variable(af::array(N, N, transVec.data()), true);
+
+  auto dense = FullConnectionCriterion(N);
+  auto sparse = FullConnectionCriterion(N, w2l::CriterionScaleMode::NONE, K);
+  dense.setParams(transition, 0);
+  sparse.setParams(transition, 0);
+
+  std::vector<float> denseLoss(B), sparseLoss(B);
+  dense(in, tgt).host(denseLoss.data());
+  sparse(in, tgt).host(sparseLoss.data());
+  for (int b = 0; b < B; ++b) {
+    ASSERT_NEAR(denseLoss[b], sparseLoss[b], 1e-4);
+  }
+
+  auto func_in = [&](Variable& inp) { return sparse.forward(inp, tgt); };
+  jacobian_test(func_in, in);
+
+  auto func_trans = [&](Variable& transition_p) {
+    sparse.setParams(transition_p, 0);
+    return sparse.forward(in, tgt);
+  };
+  jacobian_test(func_trans, transition);
+}
+
+#ifdef W2L_LIBRARIES_USE_CUDA
+TEST(CriterionTest, FCCHalfMatchesFloat) {
+  // float16 inputs run the shifted float recursions: on long inputs, they
+  // must keep up with the double ones of float32 inputs
+  int N = 30, T = 1000, L = 50, B = 3;
+  auto in = Variable(af::randn(N, T, B).as(f16), true);
+  auto inFloat = Variable(in.array().as(f32), true);
+  auto t = (af::abs(af::randu(L, B, af::dtype::s32)) % N).as(s32);
+  auto tgt = Variable(t, false);
+  auto fcc = FullConnectionCriterion(N, w2l::CriterionScaleMode::TARGET_SZ);
+  fcc.setParams(Variable(af::randn(N, N), true), 0);
+
+  auto loss = fcc(in, tgt);
+  auto lossFloat = fcc(inFloat, tgt);
+  auto grad = af::randu(B);
+  loss.backward(Variable(grad, false));
+  lossFloat.backward(Variable(grad, false));
+
+  checkZero(
+      (loss.array() - lossFloat.array()) /
+          af::max<float>(af::abs(lossFloat.array())),
+      1E-4);
+  checkZero(in.grad().array().as(f32) - inFloat.grad().array(), 1E-3);
+}
+#endif // W2L_LIBRARIES_USE_CUDA
+
 TEST(CriterionTest, FACCost) {
   // Test case: 1
   std::array<float, 12> input1 = {
@@ -396,6 +640,40 @@ TEST(CriterionTest, FACCost) {
   ASSERT_NEAR(loss2.scalar<float>(), -log(32), kEpsilon);
 }
 
+#ifdef W2L_LIBRARIES_USE_CUDA
+TEST(CriterionTest, FACSplitTargetsMatchSingleBlock) {
+  // A small batch of targets longer than a block, whose states are split
+  // between several blocks when enabled
+  int N = 30, T = 1000, L = 600, B = 2;
+  auto t = (af::abs(af::randu(L, B, af::dtype::s32)) % N).as(s32);
+  t(af::seq(L / 2, L - 1), B - 1) = -1;
+  auto tgt = Variable(t, false);
+  auto input = af::randn(N, T, B);
+  auto trans = af::randn(N, N);
+  auto grad = af::randu(B);
+
+  using CudaFAC = w2l::cuda::ForceAlignmentCriterion<float>;
+  auto run = [&](bool split) -> std::vector<af::array> {
+    CudaFAC::setSplitTargets(split);
+    auto fac = ForceAlignmentCriterion(N, w2l::CriterionScaleMode::TARGET_SZ);
+    auto transVar = Variable(trans, true);
+    fac.setParams(transVar, 0);
+    auto in = Variable(input, true);
+    auto loss = fac(in, tgt);
+    loss.backward(Variable(grad, false));
+    CudaFAC::setSplitTargets(false);
+    return {loss.array(), in.grad().array(), transVar.grad().array()};
+  };
+
+  auto single = run(false);
+  auto split = run(true);
+  checkZero(
+      (split[0] - single[0]) / af::max<float>(af::abs(single[0])), 1E-5);
+  checkZero(split[1] - single[1], 1E-5);
+  checkZero(split[2] - single[2], 1E-4);
+}
+#endif // W2L_LIBRARIES_USE_CUDA
+
 TEST(CriterionTest, FACJacobian) {
   int N = 3, T = 10, B = 3, L = 3;
   auto in = Variable(af::log(af::randu(N, T, B)), true);
@@ -535,6 +813,117 @@ TEST(CriterionTest, ASGBatching) {
   }
 }
 
+TEST(CriterionTest, ASGMatchesCpuLibrary) {
+  // The criterion of the backend against FCC - FAC of the CPU library, with
+  // padded targets
+  struct Shape {
+    int B, T, N, L;
+  };
+  std::vector<Shape> shapes = {
+      {1, 5, 3, 2}, {3, 40, 10, 12}, {4, 100, 30, 40}, {2, 20, 50, 5}};
+
+  using CpuFCC = cpu::FullConnectionCriterion<float>;
+  using CpuFAC = cpu::ForceAlignmentCriterion<float>;
+  auto check = [&]() {
+    for (const auto& shape : shapes) {
+      int B = shape.B, T = shape.T, N = shape.N, L = shape.L;
+      auto in = Variable(af::randn(N, T, B), true);
+      auto trans = Variable(af::randn(N, N), true);
+      auto t = (af::abs(af::randu(L, B, af::dtype::s32)) % N).as(s32);
+      if (B > 1) {
+        t(af::seq(L / 2, L - 1), B - 1) = -1;
+      }
+      auto asg =
+          AutoSegmentationCriterion(N, w2l::CriterionScaleMode::TARGET_SZ_SQRT);
+      asg.setParams(trans, 0);
+      auto loss = asg({in, Variable(t, false)}).front();
+      auto grad = af::randu(B);
+      loss.backward(Variable(grad, false));
+
+      auto inputVec = afToVector<float>(in);
+      auto transVec = afToVector<float>(trans);
+      auto targetVec = afToVector<int>(t);
+      auto gradVec = afToVector<float>(grad);
+      std::vector<int> targetSizeVec(B, 0);
+      cpu::CriterionUtils<float>::batchTargetSize(
+          B, L, T, targetVec.data(), targetSizeVec.data());
+
+      std::vector<float> fccLoss(B), facLoss(B);
+      std::vector<float> fccInputGrad(B * T * N), facInputGrad(B * T * N);
+      std::vector<float> fccTransGrad(N * N), facTransGrad(N * N);
+      std::vector<uint8_t> fccWorkspace(CpuFCC::getWorkspaceSize(B, T, N));
+      std::vector<uint8_t> facWorkspace(CpuFAC::getWorkspaceSize(B, T, N, L));
+      CpuFCC::forward(
+          B,
+          T,
+          N,
+          w2l::CriterionScaleMode::TARGET_SZ_SQRT,
+          inputVec.data(),
+          targetSizeVec.data(),
+          transVec.data(),
+          fccLoss.data(),
+          fccWorkspace.data());
+      CpuFCC::backward(
+          B,
+          T,
+          N,
+          transVec.data(),
+          gradVec.data(),
+          fccInputGrad.data(),
+          fccTransGrad.data(),
+          fccWorkspace.data());
+      CpuFAC::forward(
+          B,
+          T,
+          N,
+          L,
+          w2l::CriterionScaleMode::TARGET_SZ_SQRT,
+          inputVec.data(),
+          targetVec.data(),
+          targetSizeVec.data(),
+          transVec.data(),
+          facLoss.data(),
+          facWorkspace.data());
+      CpuFAC::backward(
+          B,
+          T,
+          N,
+          L,
+          targetVec.data(),
+          targetSizeVec.data(),
+          gradVec.data(),
+          facInputGrad.data(),
+          facTransGrad.data(),
+          facWorkspace.data());
+
+      auto expectedLoss =
+          af::array(B, fccLoss.data()) - af::array(B, facLoss.data());
+      auto expectedInputGrad = af::array(N, T, B, fccInputGrad.data()) -
+          af::array(N, T, B, facInputGrad.data());
+      auto expectedTransGrad = af::array(N, N, fccTransGrad.data()) -
+          af::array(N, N, facTransGrad.data());
+      checkZero(
+          (loss.array() - expectedLoss) /
+              af::max<float>(af::abs(expectedLoss)),
+          1E-4);
+      checkZero(in.grad().array() - expectedInputGrad, 1E-4);
+      checkZero(trans.grad().array() - expectedTransGrad, 1E-3);
+    }
+  };
+
+  check();
+#ifdef W2L_LIBRARIES_USE_CUDA
+  // Again with one kernel per pass of the CUDA FullConnectionCriterion
+  cuda::FullConnectionCriterion<float>::setPersistentMaxN(2048);
+  check();
+  cuda::FullConnectionCriterion<float>::setPersistentMaxN(0);
+  // And with the fused CUDA criterion
+  AutoSegmentationCriterion::setFusedCuda(true);
+  check();
+  AutoSegmentationCriterion::setFusedCuda(false);
+#endif
+}
+
 TEST(CriterionTest, ASGCompareLua) {
   // Compare with lua version
   const int N = 6, L = 5, T = 5, B = 3;
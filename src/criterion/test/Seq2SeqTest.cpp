@@ -185,6 +185,38 @@ TEST(Seq2SeqTest, Seq2SeqStepWindow) {
   }
 }
 
+TEST(Seq2SeqTest, Seq2SeqStepWindowStreaming) {
+  int nclass = 40;
+  int hiddendim = 256;
+  int inputsteps = 200;
+  int maxoutputlen = 100;
+  int chunksize = 17;
+
+  Seq2SeqCriterion seq2seq(
+      nclass,
+      hiddendim,
+      nclass - 1 /* eos token index */,
+      maxoutputlen,
+      {std::make_shared<ContentAttention>()},
+      std::make_shared<StepWindow>(1, 20, 2.2, 5.8));
+
+  seq2seq.eval();
+  auto input = af::randn(hiddendim, inputsteps, 1, f32);
+
+  auto viterbipath = seq2seq.viterbiPathBase(input, false).first;
+  Seq2SeqStream stream(1);
+  for (int t = 0; t < inputsteps; t += chunksize) {
+    int end = std::min(t + chunksize, inputsteps);
+    seq2seq.streamPath(
+        stream, input(af::span, af::seq(t, end - 1)), end == inputsteps);
+  }
+  ASSERT_TRUE(stream.done);
+  ASSERT_EQ(stream.path.size(), viterbipath.elements());
+  for (int idx = 0; idx < stream.path.size(); idx++) {
+    ASSERT_EQ(stream.path[idx], viterbipath(idx).scalar<int>());
+  }
+}
+
 TEST(Seq2SeqTest, Seq2SeqStepWindowVectorized) {
   int nclass = 20;
   int hiddendim = 16;
@@ -366,6 +398,7 @@ TEST(Seq2SeqTest, BatchedDecoderStep) {
     auto input = noGrad(af::randn(H, T, 1, f32));
     std::vector<std::vector<float>> single_scores(B);
     std::vector<std::vector<float>> batched_scores;
+    std::vector<Seq2SeqState> singleOutStates(B);
 
     for (int i = 0; i < B; i++) {
       Variable y = constant(i % N, 1, s32, false);
@@ -384,6 +417,7 @@ TEST(Seq2SeqTest, BatchedDecoderStep) {
       std::tie(ox, outstate) = seq2seq.decodeStep(input, y, inStates[i]);
       ox = logSoftmax(ox, 0);
       single_scores[i] = w2l::afToVector<float>(ox);
+      singleOutStates[i] = outstate;
     }
 
     // Batched forward
@@ -397,6 +431,30 @@ TEST(Seq2SeqTest, BatchedDecoderStep) {
         ASSERT_NEAR(single_scores[i][j], batched_scores[i][j], 1e-5);
       }
     }
+
+    // Next step from the output states in reverse order, which are gathered
+    // from the batch they share
+    std::vector<Variable> nextYs;
+    std::vector<Seq2SeqState*> nextStatePtrs;
+    for (int i = 0; i < B; i++) {
+      nextYs.push_back(constant((i + 1) % N, 1, s32, false));
+      nextStatePtrs.push_back(outstates[B - 1 - i].get());
+    }
+    std::vector<Seq2SeqStatePtr> nextOutstates;
+    std::tie(batched_scores, nextOutstates) =
+        seq2seq.decodeBatchStep(input, nextYs, nextStatePtrs);
+    for (int i = 0; i < B; i++) {
+      Seq2SeqState outstate(nAttnRound);
+      Variable ox;
+      std::tie(ox, outstate) = seq2seq.decodeStep(
+          input,
+          constant((i + 1) % N, 1, s32, false),
+          singleOutStates[B - 1 - i]);
+      auto scores = w2l::afToVector<float>(logSoftmax(ox, 0));
+      for (int j = 0; j < N; j++) {
+        ASSERT_NEAR(scores[j], batched_scores[i][j], 1e-5);
+      }
+    }
   }
 }
 
@@ -462,6 +520,17 @@ TEST(Seq2SeqTest, Seq2SeqSampling) {
       w2l::kModelSampling);
   seq2seq2.train();
   ASSERT_THROW(seq2seq2.vectorizedDecoder(input, target), std::logic_error);
+
+  // Outside of training the target is fed at every step, so the forward runs
+  // the steps in parallel and matches the sequential decoder
+  seq2seq2.eval();
+  std::tie(output, attention) = seq2seq2.vectorizedDecoder(input, target);
+  Variable outputSeq, attentionSeq;
+  std::tie(outputSeq, attentionSeq) = seq2seq2.decoder(input, target);
+  ASSERT_TRUE(allClose(output, outputSeq, 1e-6));
+  ASSERT_TRUE(allClose(attention, attentionSeq, 1e-6));
+  auto losses = seq2seq2({input, target}).front();
+  ASSERT_EQ(losses.dims(0), B);
 }
 
 int main(int argc, char** argv) {
@@ -0,0 +1,231 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "AudioPack.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <istream>
+#include <stdexcept>
+#include <streambuf>
+
+#include <glog/logging.h>
+
+#include "common/Defines.h"
+#include "data/Sound.h"
+#include "libraries/common/Utils.h"
+
+namespace w2l {
+
+namespace {
+
+constexpr const char kAudioPackMagic[8] =
+    {'W', '2', 'L', 'A', 'P', 'A', 'C', 'K'};
+constexpr int kAudioPackVersion = 1;
+
+// Header of a pack. Data is stored in the native byte order.
+struct AudioPackHeader {
+  char magic[8];
+  int version;
+  int reserved = 0;
+  uint64_t nRecords;
+  uint64_t indexOffset;
+};
+
+// Read-only, seekable streambuf over a buffer, as needed by the virtual IO of
+// loadSound()
+class MemoryStreamBuf : public std::streambuf {
+ public:
+  MemoryStreamBuf(const char* data, size_t size) {
+    char* begin = const_cast<char*>(data);
+    setg(begin, begin, begin + size);
+  }
+
+ protected:
+  pos_type seekoff(
+      off_type off,
+      std::ios_base::seekdir dir,
+      std::ios_base::openmode /* which */) override {
+    off_type pos = off;
+    if (dir == std::ios_base::cur) {
+      pos += gptr() - eback();
+    } else if (dir == std::ios_base::end) {
+      pos += egptr() - eback();
+    }
+    if (pos < 0 || pos > egptr() - eback()) {
+      return pos_type(off_type(-1));
+    }
+    setg(eback(), eback() + pos, egptr());
+    return pos_type(pos);
+  }
+
+  pos_type seekpos(pos_type pos, std::ios_base::openmode which) override {
+    return seekoff(off_type(pos), std::ios_base::beg, which);
+  }
+};
+
+void writeString(std::ofstream& f, const std::string& str) {
+  uint32_t len = str.size();
+  f.write(reinterpret_cast<const char*>(&len), sizeof(len));
+  f.write(str.data(), len);
+}
+
+std::string readString(const char* data, size_t size, size_t& pos) {
+  uint32_t len;
+  if (pos + sizeof(len) > size) {
+    throw std::runtime_error("[AudioPack] Corrupted index");
+  }
+  std::memcpy(&len, data + pos, sizeof(len));
+  pos += sizeof(len);
+  if (pos + len > size) {
+    throw std::runtime_error("[AudioPack] Corrupted index");
+  }
+  std::string str(data + pos, len);
+  pos += len;
+  return str;
+}
+
+} // namespace
+
+AudioPack::AudioPack(const std::string& path)
+    : path_(path), file_(std::make_shared<MemoryMappedFile>(path)) {
+  const char* data = file_->data();
+  size_t size = file_->size();
+
+  AudioPackHeader header;
+  if (size < sizeof(header)) {
+    throw std::runtime_error("[AudioPack] Truncated pack: " + path);
+  }
+  std::memcpy(&header, data, sizeof(header));
+  if (std::memcmp(header.magic, kAudioPackMagic, sizeof(header.magic)) != 0 ||
+      header.version != kAudioPackVersion || header.indexOffset > size) {
+    throw std::runtime_error("[AudioPack] Invalid pack: " + path);
+  }
+
+  size_t pos = header.indexOffset;
+  records_.resize(header.nRecords);
+  try {
+    for (auto& record : records_) {
+      uint64_t location[2];
+      if (pos + sizeof(location) + sizeof(double) > size) {
+        throw std::runtime_error("[AudioPack] Corrupted index");
+      }
+      std::memcpy(location, data + pos, sizeof(location));
+      std::memcpy(
+          &record.durationMs, data + pos + sizeof(location), sizeof(double));
+      pos += sizeof(location) + sizeof(double);
+      if (location[0] < sizeof(header) ||
+          location[0] + location[1] > header.indexOffset) {
+        throw std::runtime_error("[AudioPack] Corrupted index");
+      }
+      record.offset = location[0];
+      record.size = location[1];
+      record.sampleId = readString(data, size, pos);
+      record.transcript = splitOnWhitespace(readString(data, size, pos), true);
+    }
+  } catch (const std::runtime_error& ex) {
+    throw std::runtime_error(std::string(ex.what()) + ": " + path);
+  }
+}
+
+bool AudioPack::isAudioPack(const std::string& path) {
+  std::ifstream f(path, std::ios::binary);
+  char magic[sizeof(kAudioPackMagic)];
+  return f.read(magic, sizeof(magic)) &&
+      std::memcmp(magic, kAudioPackMagic, sizeof(magic)) == 0;
+}
+
+std::vector<float> AudioPack::loadSound(int64_t idx) const {
+  const auto& rec = record(idx);
+  const char* payload = file_->data() + rec.offset;
+
+  // Page in the whole payload with one readahead rather than a fault per page
+  // as it's parsed
+  static const uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+  uintptr_t begin = reinterpret_cast<uintptr_t>(payload) & ~(pageSize - 1);
+  madvise(
+      reinterpret_cast<void*>(begin),
+      reinterpret_cast<uintptr_t>(payload) + rec.size - begin,
+      MADV_WILLNEED);
+
+  MemoryStreamBuf buf(payload, rec.size);
+  std::istream stream(&buf);
+  return loadSoundAs(stream, FLAGS_samplerate, FLAGS_channels);
+}
+
+AudioPackWriter::AudioPackWriter(const std::string& path)
+    : path_(path), writer_(path, std::ios::binary | std::ios::trunc) {
+  if (!writer_) {
+    throw std::runtime_error("[AudioPackWriter] Cannot write pack: " + path);
+  }
+  // The header is written by close()
+  AudioPackHeader header;
+  writer_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+}
+
+AudioPackWriter::~AudioPackWriter() {
+  try {
+    close();
+  } catch (const std::exception& ex) {
+    LOG(ERROR) << ex.what();
+  }
+}
+
+void AudioPackWriter::add(
+    const std::string& sampleId,
+    const std::string& audioFile,
+    double durationMs,
+    const std::vector<std::string>& transcript) {
+  if (!writer_.is_open()) {
+    throw std::logic_error("[AudioPackWriter] Pack is closed: " + path_);
+  }
+  std::ifstream audio(audioFile, std::ios::binary);
+  if (!audio) {
+    throw std::runtime_error("[AudioPackWriter] Cannot read " + audioFile);
+  }
+  AudioPack::Record record;
+  record.sampleId = sampleId;
+  record.durationMs = durationMs;
+  record.transcript = transcript;
+  record.offset = writer_.tellp();
+  writer_ << audio.rdbuf();
+  record.size = static_cast<uint64_t>(writer_.tellp()) - record.offset;
+  if (!writer_) {
+    throw std::runtime_error("[AudioPackWriter] Failed writing " + path_);
+  }
+  records_.push_back(std::move(record));
+}
+
+void AudioPackWriter::close() {
+  if (!writer_.is_open()) {
+    return;
+  }
+  AudioPackHeader header;
+  std::memcpy(header.magic, kAudioPackMagic, sizeof(header.magic));
+  header.version = kAudioPackVersion;
+  header.nRecords = records_.size();
+  header.indexOffset = writer_.tellp();
+  for (const auto& record : records_) {
+    uint64_t location[2] = {record.offset, record.size};
+    writer_.write(reinterpret_cast<const char*>(location), sizeof(location));
+    writer_.write(
+        reinterpret_cast<const char*>(&record.durationMs), sizeof(double));
+    writeString(writer_, record.sampleId);
+    writeString(writer_, join(" ", record.transcript));
+  }
+  writer_.seekp(0);
+  writer_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  writer_.close();
+  if (!writer_) {
+    throw std::runtime_error("[AudioPackWriter] Failed writing " + path_);
+  }
+}
+
+} // namespace w2l
@@ -0,0 +1,101 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "libraries/common/MemoryMappedFile.h"
+
+namespace w2l {
+
+/**
+ * AudioPack is a shard of a dataset packing the encoded audio files of its
+ * samples (WAV, FLAC, ... as they are on disk) with their ids, durations and
+ * transcripts. The shard is memory mapped and each sample is decoded in place
+ * with the virtual IO of loadSound(), so that reading a sample is neither a
+ * file open nor a metadata lookup on the filesystem.
+ *
+ * Format: an AudioPackHeader, the audio payloads one after the other, then the
+ * index of the records, each being the offset and size in bytes of its payload
+ * (uint64_t), its duration in ms (double), then its sample id and its space
+ * separated transcript, each as a uint32_t length and its chars.
+ */
+class AudioPack {
+ public:
+  struct Record {
+    std::string sampleId;
+    double durationMs;
+    std::vector<std::string> transcript;
+    uint64_t offset;
+    uint64_t size;
+  };
+
+  explicit AudioPack(const std::string& path);
+
+  /* Returns true if `path` is a file starting with the magic of the packs */
+  static bool isAudioPack(const std::string& path);
+
+  int64_t size() const {
+    return records_.size();
+  }
+
+  const Record& record(int64_t idx) const {
+    return records_.at(idx);
+  }
+
+  const std::string& path() const {
+    return path_;
+  }
+
+  /* Decode the audio of the record `idx`, at -samplerate Hz and -channels */
+  std::vector<float> loadSound(int64_t idx) const;
+
+ private:
+  std::string path_;
+  MemoryMappedFilePtr file_;
+  std::vector<Record> records_;
+};
+
+/**
+ * AudioPackWriter writes an AudioPack from audio files, whose content is
+ * copied as is.
+ */
+class AudioPackWriter {
+ public:
+  explicit AudioPackWriter(const std::string& path);
+
+  ~AudioPackWriter();
+
+  AudioPackWriter(const AudioPackWriter&) = delete;
+  AudioPackWriter& operator=(const AudioPackWriter&) = delete;
+
+  void add(
+      const std::string& sampleId,
+      const std::string& audioFile,
+      double durationMs,
+      const std::vector<std::string>& transcript);
+
+  int64_t size() const {
+    return records_.size();
+  }
+
+  /* Write the index and the header. No record can be added afterwards. */
+  void close();
+
+ private:
+  std::string path_;
+  std::ofstream writer_;
+  std::vector<AudioPack::Record> records_;
+};
+
+} // namespace w2l
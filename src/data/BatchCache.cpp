@@ -0,0 +1,75 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "data/BatchCache.h"
+
+namespace w2l {
+
+BatchCache::BatchCache(int64_t capacity) : capacity_(capacity) {}
+
+BatchCache::BatchPtr BatchCache::get(const void* owner, int64_t idx) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(Key(owner, idx));
+  if (it == entries_.end()) {
+    return nullptr;
+  }
+  lru_.splice(lru_.begin(), lru_, it->second);
+  return it->second->batch;
+}
+
+void BatchCache::put(const void* owner, int64_t idx, BatchPtr batch) {
+  auto bytes = batchBytes(*batch);
+  if (bytes > capacity_) {
+    return; // would evict everything else and still not fit
+  }
+  Key key(owner, idx);
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(key);
+  if (it != entries_.end()) {
+    // Loaded concurrently by another thread
+    lru_.splice(lru_.begin(), lru_, it->second);
+    return;
+  }
+  lru_.push_front({key, std::move(batch), bytes});
+  entries_[key] = lru_.begin();
+  cached_ += bytes;
+  while (cached_ > capacity_) {
+    cached_ -= lru_.back().bytes;
+    entries_.erase(lru_.back().key);
+    lru_.pop_back();
+  }
+}
+
+void BatchCache::erase(const void* owner) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto it = lru_.begin(); it != lru_.end();) {
+    if (it->key.first == owner) {
+      cached_ -= it->bytes;
+      entries_.erase(it->key);
+      it = lru_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+int64_t BatchCache::cachedBytes() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return cached_;
+}
+
+int64_t BatchCache::batchBytes(const W2lFeatureData& batch) {
+  int64_t bytes = sizeof(batch) + batch.input.size() * sizeof(float) +
+      batch.sampleIds.size() * sizeof(int);
+  for (const auto& target : batch.targets) {
+    bytes += target.second.size() * sizeof(int);
+  }
+  return bytes;
+}
+
+} // namespace w2l
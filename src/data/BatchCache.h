@@ -0,0 +1,77 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+#include "data/Featurize.h"
+
+namespace w2l {
+
+/**
+ * BatchCache keeps the featurized batches of datasets which are read the same
+ * way every time, such as the validation sets (no shuffling, no
+ * augmentation), in an LRU cache of at most `capacity` bytes of host memory,
+ * so that they are read and decoded only once. Its batches are keyed by the
+ * dataset they come from and their index in it; a cache can be shared by
+ * several datasets, which then share its capacity. All the methods are
+ * thread-safe.
+ */
+class BatchCache {
+ public:
+  using BatchPtr = std::shared_ptr<const W2lFeatureData>;
+
+  explicit BatchCache(int64_t capacity);
+
+  /* The batch `idx` of `owner`, or nullptr if it isn't cached */
+  BatchPtr get(const void* owner, int64_t idx);
+
+  /* Caches a batch, evicting the least recently used ones beyond capacity */
+  void put(const void* owner, int64_t idx, BatchPtr batch);
+
+  /* Drops the batches of `owner`, e.g. once its batches are reshuffled */
+  void erase(const void* owner);
+
+  /* Bytes held by the cached batches */
+  int64_t cachedBytes() const;
+
+  /* Estimated host memory of a batch */
+  static int64_t batchBytes(const W2lFeatureData& batch);
+
+ private:
+  using Key = std::pair<const void*, int64_t>;
+
+  struct KeyHash {
+    size_t operator()(const Key& key) const {
+      return std::hash<const void*>()(key.first) * 31 +
+          std::hash<int64_t>()(key.second);
+    }
+  };
+
+  struct Entry {
+    Key key;
+    BatchPtr batch;
+    int64_t bytes;
+  };
+
+  int64_t capacity_;
+  mutable std::mutex mutex_;
+  // Most recently used first
+  std::list<Entry> lru_;
+  std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> entries_;
+  int64_t cached_{0};
+};
+
+} // namespace w2l
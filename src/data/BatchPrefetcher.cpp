@@ -0,0 +1,197 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "BatchPrefetcher.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <stdexcept>
+
+#include "libraries/common/TaskScheduler.h"
+
+namespace w2l {
+
+std::string BatchPrefetcher::Stats::toString() const {
+  auto pct = [this](int64_t n) {
+    return gets > 0 ? 100.0 * n / gets : 0.0;
+  };
+  char str[256];
+  std::snprintf(
+      str,
+      sizeof(str),
+      "batches: %lld, hits: %.1f%%, stalls: %.1f%%, misses: %.1f%%, "
+      "wait: %.3f sec, avg ready: %.2f",
+      static_cast<long long>(gets),
+      pct(hits),
+      pct(stalls),
+      pct(misses),
+      waitSec,
+      avgReady());
+  return str;
+}
+
+BatchPrefetcher::BatchPrefetcher(
+    LoadFunction load,
+    int64_t numThreads,
+    int64_t depth)
+    : load_(std::move(load)),
+      numThreads_(numThreads),
+      depth_(depth),
+      nextTicket_(0),
+      loading_(0),
+      workers_(0),
+      stop_(false) {
+  if (numThreads < 1 || depth < 1) {
+    throw std::invalid_argument(
+        "[BatchPrefetcher] numThreads and depth must be positive");
+  }
+}
+
+BatchPrefetcher::~BatchPrefetcher() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  stop_ = true;
+  // The workers still queued in the scheduler return as soon as they start
+  workersCv_.wait(lock, [this]() { return workers_ == 0; });
+}
+
+W2lFeatureData BatchPrefetcher::get(int64_t idx, int64_t size) {
+  auto start = std::chrono::steady_clock::now();
+  std::unique_lock<std::mutex> lock(mutex_);
+  ++stats_.gets;
+
+  // Keep the batches of the window [idx, end) only
+  int64_t end = std::min(idx + 1 + depth_, size);
+  for (auto it = slots_.begin(); it != slots_.end();) {
+    if (it->first < idx || it->first >= end) {
+      it = slots_.erase(it);
+    } else {
+      stats_.readySum += it->second.state == State::READY;
+      ++it;
+    }
+  }
+  for (int64_t i = idx + 1; i < end; ++i) {
+    if (slots_.find(i) == slots_.end()) {
+      Slot slot;
+      slot.state = State::QUEUED;
+      slot.ticket = nextTicket_++;
+      queue_.emplace_back(i, slot.ticket);
+      slots_.emplace(i, std::move(slot));
+    }
+  }
+  schedule();
+
+  auto it = slots_.find(idx);
+  if (it != slots_.end() && it->second.state == State::LOADING) {
+    ++stats_.stalls;
+    int64_t ticket = it->second.ticket;
+    readyCv_.wait(lock, [this, idx, ticket, &it]() {
+      it = slots_.find(idx);
+      return it == slots_.end() || it->second.ticket != ticket ||
+          it->second.state == State::READY;
+    });
+    if (it != slots_.end() && it->second.ticket != ticket) {
+      it = slots_.end();
+    }
+  } else if (it != slots_.end() && it->second.state == State::READY) {
+    ++stats_.hits;
+  } else {
+    ++stats_.misses;
+  }
+
+  W2lFeatureData data;
+  if (it != slots_.end() && it->second.state == State::READY) {
+    data = take(it);
+  } else {
+    // The workers skip a batch dropped before they pick it
+    if (it != slots_.end()) {
+      slots_.erase(it);
+    }
+    lock.unlock();
+    data = load_(idx);
+    lock.lock();
+  }
+  stats_.waitSec += std::chrono::duration<double>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+  return data;
+}
+
+void BatchPrefetcher::reset() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  slots_.clear();
+  queue_.clear();
+  readyCv_.notify_all();
+  // No batch may still be loading from the previous order of the dataset
+  readyCv_.wait(lock, [this]() { return loading_ == 0; });
+}
+
+BatchPrefetcher::Stats BatchPrefetcher::stats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+void BatchPrefetcher::resetStats() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  stats_ = Stats();
+}
+
+void BatchPrefetcher::schedule() {
+  int64_t numWorkers = std::min<int64_t>(numThreads_, queue_.size());
+  for (; workers_ < numWorkers; ++workers_) {
+    TaskScheduler::get().submit([this]() { worker(); });
+  }
+}
+
+void BatchPrefetcher::worker() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stop_ && !queue_.empty()) {
+    auto request = queue_.front();
+    queue_.pop_front();
+    auto it = slots_.find(request.first);
+    if (it == slots_.end() || it->second.ticket != request.second) {
+      continue;
+    }
+    it->second.state = State::LOADING;
+    ++loading_;
+    lock.unlock();
+
+    W2lFeatureData data;
+    std::exception_ptr error;
+    try {
+      data = load_(request.first);
+    } catch (...) {
+      error = std::current_exception();
+    }
+
+    lock.lock();
+    --loading_;
+    it = slots_.find(request.first);
+    if (it != slots_.end() && it->second.ticket == request.second) {
+      it->second.state = State::READY;
+      it->second.data = std::move(data);
+      it->second.error = error;
+    }
+    readyCv_.notify_all();
+  }
+  --workers_;
+  workersCv_.notify_all();
+}
+
+W2lFeatureData BatchPrefetcher::take(
+    std::unordered_map<int64_t, Slot>::iterator it) {
+  auto data = std::move(it->second.data);
+  auto error = it->second.error;
+  slots_.erase(it);
+  if (error) {
+    std::rethrow_exception(error);
+  }
+  return data;
+}
+
+} // namespace w2l
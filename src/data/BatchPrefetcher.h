@@ -0,0 +1,106 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "data/Featurize.h"
+
+namespace w2l {
+
+/**
+ * BatchPrefetcher loads the batches of a dataset ahead of the caller on the
+ * TaskScheduler of the process, with at most `numThreads` batches loading at a
+ * time. Each get(idx) schedules the `depth` batches
+ * following `idx` and drops the ones loaded for other positions, so that at
+ * most `depth` batches are held at a time whatever the order of the calls. A
+ * batch which isn't scheduled yet is loaded by the caller itself. All the
+ * methods are thread-safe.
+ */
+class BatchPrefetcher {
+ public:
+  using LoadFunction = std::function<W2lFeatureData(int64_t)>;
+
+  struct Stats {
+    int64_t gets = 0;
+    int64_t hits = 0; // batches which were loaded when requested
+    int64_t stalls = 0; // batches being loaded by a worker when requested
+    int64_t misses = 0; // batches loaded by the caller
+    double waitSec = 0; // time spent by get() waiting for or loading batches
+    int64_t readySum = 0; // sum over the calls of the batches loaded ahead
+
+    double avgReady() const {
+      return gets > 0 ? static_cast<double>(readySum) / gets : 0.0;
+    }
+
+    std::string toString() const;
+  };
+
+  BatchPrefetcher(LoadFunction load, int64_t numThreads, int64_t depth);
+
+  /* Waits for the batches being loaded */
+  ~BatchPrefetcher();
+
+  BatchPrefetcher(const BatchPrefetcher&) = delete;
+  BatchPrefetcher& operator=(const BatchPrefetcher&) = delete;
+
+  /* Returns batch `idx` of the `size` batches of the dataset */
+  W2lFeatureData get(int64_t idx, int64_t size);
+
+  /* Drops the batches loaded ahead, e.g. as the dataset was shuffled */
+  void reset();
+
+  Stats stats() const;
+
+  void resetStats();
+
+ private:
+  enum class State { QUEUED, LOADING, READY };
+
+  // A batch of the window. Its ticket tells it apart from an earlier request
+  // for the same batch, which was dropped meanwhile.
+  struct Slot {
+    State state;
+    int64_t ticket;
+    W2lFeatureData data;
+    std::exception_ptr error;
+  };
+
+  LoadFunction load_;
+  int64_t numThreads_;
+  int64_t depth_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable workersCv_;
+  std::condition_variable readyCv_;
+  std::unordered_map<int64_t, Slot> slots_;
+  std::deque<std::pair<int64_t, int64_t>> queue_; // batch and ticket
+  int64_t nextTicket_;
+  int64_t loading_; // batches being loaded by the workers
+  int64_t workers_; // tasks submitted to the scheduler and not done
+  bool stop_;
+  Stats stats_;
+
+  /* Submits workers for the queue, up to `numThreads_` */
+  void schedule();
+
+  /* Loads the batches of the queue until it is empty */
+  void worker();
+  W2lFeatureData take(std::unordered_map<int64_t, Slot>::iterator it);
+};
+
+} // namespace w2l
@@ -0,0 +1,149 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "data/DatasetIndex.h"
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#include <glog/logging.h>
+
+#include "libraries/common/Utils.h"
+
+namespace w2l {
+
+namespace {
+
+constexpr const char kDatasetIndexMagic[8] =
+    {'W', '2', 'L', 'I', 'N', 'D', 'X', 0};
+constexpr int kDatasetIndexVersion = 1;
+constexpr uint64_t kAlignment = 8;
+
+// Header of an index. Data is stored in the native byte order.
+struct DatasetIndexHeader {
+  char magic[8];
+  int version;
+  int reserved = 0;
+  uint64_t numArrays;
+};
+
+// Holds an exclusive lock on a file while in scope
+class FileLock {
+ public:
+  explicit FileLock(const std::string& path)
+      : fd_(open(path.c_str(), O_CREAT | O_RDWR, 0644)) {
+    if (fd_ < 0) {
+      throw std::runtime_error("[DatasetIndex] Cannot open " + path);
+    }
+    if (flock(fd_, LOCK_EX) != 0) {
+      close(fd_);
+      throw std::runtime_error("[DatasetIndex] Cannot lock " + path);
+    }
+  }
+
+  ~FileLock() {
+    flock(fd_, LOCK_UN);
+    close(fd_);
+  }
+
+ private:
+  int fd_;
+};
+
+} // namespace
+
+DatasetIndex::Writer::Writer(const std::string& path)
+    : path_(path), out_(path + ".tmp", std::ios::binary), numArrays_(0) {
+  if (!out_) {
+    throw std::runtime_error("[DatasetIndex] Cannot write " + path + ".tmp");
+  }
+  DatasetIndexHeader header;
+  out_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+}
+
+void DatasetIndex::Writer::addBytes(const void* data, uint64_t size) {
+  static const char padding[kAlignment] = {0};
+  out_.write(reinterpret_cast<const char*>(&size), sizeof(size));
+  out_.write(static_cast<const char*>(data), size);
+  out_.write(padding, (kAlignment - size % kAlignment) % kAlignment);
+  ++numArrays_;
+}
+
+void DatasetIndex::Writer::commit() {
+  DatasetIndexHeader header;
+  std::memcpy(header.magic, kDatasetIndexMagic, sizeof(header.magic));
+  header.version = kDatasetIndexVersion;
+  header.numArrays = numArrays_;
+  out_.seekp(0);
+  out_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  out_.close();
+  if (!out_ || std::rename((path_ + ".tmp").c_str(), path_.c_str()) != 0) {
+    throw std::runtime_error("[DatasetIndex] Cannot write " + path_);
+  }
+}
+
+DatasetIndex::DatasetIndex(const std::string& path)
+    : file_(std::make_shared<MemoryMappedFile>(path)) {
+  const char* data = file_->data();
+  uint64_t size = file_->size();
+  DatasetIndexHeader header;
+  if (size < sizeof(header)) {
+    throw std::runtime_error("[DatasetIndex] Invalid index " + path);
+  }
+  std::memcpy(&header, data, sizeof(header));
+  if (std::memcmp(header.magic, kDatasetIndexMagic, sizeof(header.magic)) !=
+          0 ||
+      header.version != kDatasetIndexVersion) {
+    throw std::runtime_error("[DatasetIndex] Invalid index " + path);
+  }
+  uint64_t offset = sizeof(header);
+  for (uint64_t i = 0; i < header.numArrays; ++i) {
+    uint64_t arraySize;
+    if (size - offset < sizeof(arraySize)) {
+      throw std::runtime_error("[DatasetIndex] Truncated index " + path);
+    }
+    std::memcpy(&arraySize, data + offset, sizeof(arraySize));
+    offset += sizeof(arraySize);
+    if (size - offset < arraySize) {
+      throw std::runtime_error("[DatasetIndex] Truncated index " + path);
+    }
+    arrays_.emplace_back(data + offset, arraySize);
+    offset += (arraySize + kAlignment - 1) / kAlignment * kAlignment;
+    offset = std::min(offset, size);
+  }
+}
+
+std::shared_ptr<DatasetIndex> DatasetIndex::getOrBuild(
+    const std::string& dir,
+    const std::string& key,
+    const std::function<void(Writer&)>& build) {
+  try {
+    dirCreate(dir);
+  } catch (const std::runtime_error&) {
+    if (!dirExists(dir)) {
+      throw; // not created concurrently by another process
+    }
+  }
+  auto path = pathsConcat(dir, hashKey(key) + ".index");
+  FileLock lock(path + ".lock");
+  if (!fileExists(path)) {
+    LOG(INFO) << "[DatasetIndex] Building " << path;
+    Writer writer(path);
+    build(writer);
+    writer.commit();
+  }
+  return std::make_shared<DatasetIndex>(path);
+}
+
+} // namespace w2l
@@ -0,0 +1,108 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "libraries/common/MemoryMappedFile.h"
+
+namespace w2l {
+
+/* A read-only array in memory owned by someone else */
+template <typename T>
+struct ArrayView {
+  const T* data = nullptr;
+  size_t size = 0;
+
+  ArrayView() {}
+
+  ArrayView(const T* data, size_t size) : data(data), size(size) {}
+
+  explicit ArrayView(const std::vector<T>& vec)
+      : data(vec.data()), size(vec.size()) {}
+
+  const T& operator[](size_t i) const {
+    return data[i];
+  }
+};
+
+/**
+ * DatasetIndex is a file of arrays describing a dataset (sample ids,
+ * durations, targets, ...), built once and memory mapped read-only by every
+ * process which loads the dataset, so that the processes of a node share one
+ * copy of it in the page cache instead of parsing the dataset each into its
+ * own heap. The arrays are read in place, in the order they were written.
+ *
+ * Format: a DatasetIndexHeader, then each array as its size in bytes
+ * (uint64_t) followed by its bytes, padded to a multiple of 8 bytes.
+ */
+class DatasetIndex {
+ public:
+  class Writer {
+   public:
+    /* Writes `path` + ".tmp", renamed to `path` by commit() */
+    explicit Writer(const std::string& path);
+
+    template <typename T>
+    void add(const T* data, size_t size) {
+      addBytes(data, size * sizeof(T));
+    }
+
+    template <typename T>
+    void add(const std::vector<T>& vec) {
+      add(vec.data(), vec.size());
+    }
+
+    void commit();
+
+   private:
+    std::string path_;
+    std::ofstream out_;
+    uint64_t numArrays_;
+
+    void addBytes(const void* data, uint64_t size);
+  };
+
+  explicit DatasetIndex(const std::string& path);
+
+  size_t numArrays() const {
+    return arrays_.size();
+  }
+
+  template <typename T>
+  ArrayView<T> array(size_t i) const {
+    const auto& bytes = arrays_.at(i);
+    return ArrayView<T>(
+        reinterpret_cast<const T*>(bytes.data), bytes.size / sizeof(T));
+  }
+
+  /**
+   * Maps the index of `key` in `dir`, after building it with `build` unless it
+   * exists. The processes calling it for the same index are serialized by a
+   * lock on a file of `dir`, so the first one builds the index and the others
+   * only map it. `dir` should be on a local file system (/dev/shm, ...),
+   * shared by the processes of a node.
+   */
+  static std::shared_ptr<DatasetIndex> getOrBuild(
+      const std::string& dir,
+      const std::string& key,
+      const std::function<void(Writer&)>& build);
+
+ private:
+  MemoryMappedFilePtr file_;
+  std::vector<ArrayView<char>> arrays_;
+};
+
+} // namespace w2l
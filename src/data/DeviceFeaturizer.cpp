@@ -0,0 +1,239 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "DeviceFeaturizer.h"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include "libraries/feature/Ceplifter.h"
+#include "libraries/feature/Dct.h"
+#include "libraries/feature/TriFilterbank.h"
+#include "libraries/feature/Windowing.h"
+
+namespace w2l {
+
+DeviceFeaturizer::DeviceFeaturizer(
+    const FeatureParams& params,
+    FeatureType type)
+    : params_(params), type_(type) {
+  int64_t nSamples = params_.numFrameSizeSamples();
+  if (nSamples <= 1 || params_.numFrameStrideSamples() <= 0) {
+    throw std::invalid_argument("DeviceFeaturizer: invalid frame size/stride");
+  }
+  std::vector<float> ones(nSamples, 1.0);
+  auto window = Windowing<float>(nSamples, params_.windowType).apply(ones);
+  window_ = af::array(nSamples, window.data());
+  if (type_ == FeatureType::POW) {
+    return;
+  }
+
+  if (params_.numFilterbankChans <= 0 || params_.melFloor <= 0.0) {
+    throw std::invalid_argument("DeviceFeaturizer: invalid filterbank params");
+  }
+  // Row Major : filterFreqResponseLen() X numFilterbankChans
+  auto filterbank = TriFilterbank<float>(
+                        params_.numFilterbankChans,
+                        params_.filterFreqResponseLen(),
+                        params_.samplingFreq,
+                        params_.lowFreqFilterbank,
+                        params_.highFreqFilterbank,
+                        FrequencyScale::MEL)
+                        .filterbank();
+  filterbank_ = af::array(
+      params_.numFilterbankChans,
+      params_.filterFreqResponseLen(),
+      filterbank.data());
+  if (type_ == FeatureType::MFSC) {
+    return;
+  }
+
+  // The DCT of the identity is the DCT matrix
+  auto nChans = params_.numFilterbankChans;
+  auto nCeps = params_.numCepstralCoeffs;
+  std::vector<float> identity(nChans * nChans, 0.0);
+  for (int64_t i = 0; i < nChans; ++i) {
+    identity[i * nChans + i] = 1.0;
+  }
+  auto dct = Dct<float>(nChans, nCeps).apply(identity);
+  dct_ = af::array(nCeps, nChans, dct.data());
+  ones.assign(nCeps, 1.0);
+  auto lifter = Ceplifter<float>(nCeps, params_.lifterParam).apply(ones);
+  lifter_ = af::array(nCeps, lifter.data());
+}
+
+int64_t DeviceFeaturizer::featSz() const {
+  switch (type_) {
+    case FeatureType::POW:
+      return params_.powSpecFeatSz();
+    case FeatureType::MFSC:
+      return params_.mfscFeatSz();
+    case FeatureType::MFCC:
+      return params_.mfccFeatSz();
+  }
+  throw std::invalid_argument("DeviceFeaturizer: unsupported feature type");
+}
+
+af::array DeviceFeaturizer::apply(const af::array& input) const {
+  int64_t nSamples = params_.numFrameSizeSamples();
+  int64_t nFrames = params_.numFrames(input.dims(0));
+  int64_t N = input.elements() / std::max<dim_t>(input.dims(0), 1);
+  if (nFrames == 0) {
+    return af::array(featSz(), 0, N, f32);
+  }
+
+  /* (1) frameSignal(): nSamples X nFrames X N */
+  // HTK: Values coming out of rasta treat samples as integers,
+  // not range -1..1, hence scale up here to match (approx)
+  auto frames = af::unwrap(
+                    af::moddims(input.as(f32), input.dims(0), 1, N),
+                    nSamples,
+                    1,
+                    params_.numFrameStrideSamples(),
+                    1) *
+      32768.0;
+
+  bool useEnergy = params_.useEnergy && type_ != FeatureType::POW;
+  af::array energy;
+  if (useEnergy && params_.rawEnergy) {
+    energy = logEnergy(frames);
+  }
+
+  /* (2) PowerSpectrum */
+  if (params_.ditherVal != 0.0) {
+    frames += params_.ditherVal * af::randu(frames.dims());
+  }
+  if (params_.zeroMeanFrame) {
+    frames -= af::tile(af::mean(frames, 0), nSamples);
+  }
+  if (params_.preemCoef != 0) {
+    // The first sample of a frame is its own predecessor
+    auto prev = af::shift(frames, 1);
+    prev(0, af::span, af::span) = frames(0, af::span, af::span);
+    frames -= params_.preemCoef * prev;
+  }
+  frames *= af::tile(window_, 1, nFrames, N);
+  if (useEnergy && !params_.rawEnergy) {
+    energy = logEnergy(frames);
+  }
+  auto feat = af::abs(af::fftR2C<1>(frames, af::dim4(params_.nFft())));
+  if (type_ == FeatureType::POW) {
+    return feat;
+  }
+
+  /* (3) Mfsc */
+  if (params_.usePower) {
+    feat *= feat;
+  }
+  feat = af::matmul(
+      filterbank_,
+      af::moddims(feat, params_.filterFreqResponseLen(), nFrames * N));
+  feat = af::log(af::max(feat, params_.melFloor));
+  feat = af::moddims(feat, params_.numFilterbankChans, nFrames, N);
+
+  /* (4) Mfcc */
+  if (type_ == FeatureType::MFCC) {
+    auto nCeps = params_.numCepstralCoeffs;
+    feat = af::matmul(
+        dct_, af::moddims(feat, params_.numFilterbankChans, nFrames * N));
+    feat *= af::tile(lifter_, 1, nFrames * N);
+    feat = af::moddims(feat, nCeps, nFrames, N);
+    if (useEnergy) {
+      // Replace C0 with energy
+      feat(0, af::span, af::span) = energy;
+    }
+  } else if (useEnergy) {
+    feat = af::join(0, energy, feat);
+  }
+
+  /* (5) Derivatives */
+  if (params_.deltaWindow <= 0) {
+    return feat;
+  }
+  auto deltas = derivative(feat, params_.deltaWindow);
+  if (params_.accWindow <= 0) {
+    return af::join(0, feat, deltas);
+  }
+  return af::join(0, feat, deltas, derivative(deltas, params_.accWindow));
+}
+
+af::array DeviceFeaturizer::logEnergy(const af::array& frames) const {
+  auto energy = af::sum(frames * frames, 0);
+  if (type_ == FeatureType::MFSC) {
+    energy = af::max(energy, std::numeric_limits<float>::min());
+  }
+  return af::log(energy);
+}
+
+af::array DeviceFeaturizer::derivative(
+    const af::array& input,
+    int64_t windowLen) const {
+  int nFrames = input.dims(1);
+  auto frame = af::range(af::dim4(nFrames), 0, s32);
+  auto output = af::constant(0.0, input.dims(), input.type());
+  for (int d = 1; d <= windowLen; ++d) {
+    auto next = af::min(frame + d, nFrames - 1);
+    auto prev = af::max(frame - d, 0);
+    output += d *
+        (input(af::span, next, af::span) - input(af::span, prev, af::span));
+  }
+  return output / ((windowLen * (windowLen + 1) * (2 * windowLen + 1)) / 3.0);
+}
+
+af::array normalizeOnDevice(const af::array& input, double threshold) {
+  if (input.isempty()) {
+    return input;
+  }
+  auto dims = input.dims();
+  auto in = af::moddims(input, dims[0] * dims[1] * dims[2], dims[3]);
+  auto out = in - af::tile(af::mean(in, 0), in.dims(0));
+  auto stddev = af::sqrt(af::mean(out * out, 0));
+  stddev = af::select(stddev > threshold, stddev, 1.0);
+  out /= af::tile(stddev, in.dims(0));
+  return af::moddims(out, dims);
+}
+
+af::array localNormalizeOnDevice(
+    const af::array& input,
+    int64_t leftCtxSize,
+    int64_t rightCtxSize,
+    double threshold) {
+  if (input.isempty()) {
+    return input;
+  }
+  auto dims = input.dims();
+  int nFrames = dims[0];
+  int perFrameSz = dims[1] * dims[2];
+  auto in = af::moddims(input, nFrames, perFrameSz, 1, dims[3]);
+
+  // Sums over the frames [j - leftCtxSize, j + rightCtxSize] of each frame j,
+  // as differences of cumulative sums
+  auto frame = af::range(af::dim4(nFrames), 0, s32);
+  auto hi = af::min(frame + static_cast<int>(rightCtxSize), nFrames - 1) + 1;
+  auto lo = af::max(frame - static_cast<int>(leftCtxSize), 0);
+  auto count = ((hi - lo) * perFrameSz).as(f32);
+  auto windowMean = [&](const af::array& x) {
+    auto cumsum = af::join(
+        0,
+        af::constant(0.0, 1, 1, 1, dims[3], x.type()),
+        af::accum(af::sum(x, 1), 0));
+    return (cumsum(hi, af::span, af::span, af::span) -
+            cumsum(lo, af::span, af::span, af::span)) /
+        af::tile(count, 1, 1, 1, dims[3]);
+  };
+  auto mean = windowMean(in);
+  auto stddev = af::sqrt(windowMean(in * in) - mean * mean);
+  stddev = af::select(stddev > threshold, stddev, 1.0);
+  auto out = (in - af::tile(mean, 1, perFrameSz)) /
+      af::tile(stddev, 1, perFrameSz);
+  return af::moddims(out, dims);
+}
+
+} // namespace w2l
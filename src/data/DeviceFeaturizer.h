@@ -0,0 +1,63 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <arrayfire.h>
+
+#include "libraries/feature/FeatureParams.h"
+
+namespace w2l {
+
+/**
+ * DeviceFeaturizer computes the PowerSpectrum, Mfsc or Mfcc features of
+ * libraries/feature with ArrayFire, on a batch of signals already on the
+ * device. The window, the filterbank, the DCT and the lifter are taken from
+ * the CPU implementation for the same FeatureParams; dithering draws from the
+ * ArrayFire generator instead of the one of Dither.
+ */
+class DeviceFeaturizer {
+ public:
+  enum class FeatureType { POW, MFSC, MFCC };
+
+  DeviceFeaturizer(const FeatureParams& params, FeatureType type);
+
+  // input - input speech signals (Col Major : T X N)
+  // Returns - features (Col Major : FEAT X FRAMESZ X N)
+  af::array apply(const af::array& input) const;
+
+  int64_t featSz() const;
+
+ private:
+  FeatureParams params_;
+  FeatureType type_;
+
+  af::array window_; // numFrameSizeSamples()
+  af::array filterbank_; // numFilterbankChans X filterFreqResponseLen()
+  af::array dct_; // numCepstralCoeffs X numFilterbankChans
+  af::array lifter_; // numCepstralCoeffs
+
+  // Log of the energy of each frame (1 X FRAMESZ X N)
+  af::array logEnergy(const af::array& frames) const;
+
+  // Derivatives<T>::computeDerivative() along the frames of `input`
+  af::array derivative(const af::array& input, int64_t windowLen) const;
+};
+
+// normalize() of common/Transforms.h for the features of each sample
+// (Col Major : FRAMES X FEAT X CHANNELS X BATCHSZ) on the device
+af::array normalizeOnDevice(const af::array& input, double threshold = 0.0);
+
+// localNormalize() of common/Transforms.h on the device
+af::array localNormalizeOnDevice(
+    const af::array& input,
+    int64_t leftCtxSize,
+    int64_t rightCtxSize,
+    double threshold = 0.0);
+
+} // namespace w2l
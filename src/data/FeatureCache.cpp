@@ -0,0 +1,257 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "FeatureCache.h"
+
+#include <dirent.h>
+#include <unistd.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#include <glog/logging.h>
+
+#include "libraries/common/Utils.h"
+
+namespace w2l {
+
+namespace {
+
+constexpr const char kFeatureCacheMagic[8] =
+    {'W', '2', 'L', 'F', 'E', 'A', 'T', 0};
+constexpr int kFeatureCacheVersion = 1;
+constexpr const char* kShardExt = ".shard";
+
+// Header of a shard. Data is stored in the native byte order.
+struct FeatureCacheHeader {
+  char magic[8];
+  int version;
+  int reserved = 0;
+  uint64_t nRecords;
+  uint64_t indexOffset;
+};
+
+// IEEE 754 half precision, rounded to nearest even
+uint16_t floatToHalf(float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  uint16_t sign = (bits >> 16) & 0x8000;
+  uint32_t absBits = bits & 0x7fffffff;
+  if (absBits >= 0x7f800000) { // inf or nan
+    return sign | 0x7c00 | (absBits > 0x7f800000 ? 0x200 : 0);
+  } else if (absBits >= 0x477ff000) { // rounds above the largest half
+    return sign | 0x7c00;
+  } else if (absBits < 0x38800000) { // rounds to a subnormal half
+    float absValue;
+    std::memcpy(&absValue, &absBits, sizeof(absValue));
+    // The subnormals are the multiples of 2^-24
+    return sign |
+        static_cast<uint16_t>(std::nearbyint(absValue * 16777216.0f));
+  }
+  uint32_t rounded = absBits + 0xfff + ((absBits >> 13) & 1);
+  return sign | ((rounded - (112u << 23)) >> 13);
+}
+
+float halfToFloat(uint16_t value) {
+  uint32_t sign = static_cast<uint32_t>(value & 0x8000) << 16;
+  uint32_t exponent = (value >> 10) & 0x1f;
+  uint32_t mantissa = value & 0x3ff;
+  if (exponent == 0) { // zero or subnormal
+    float absValue = std::ldexp(static_cast<float>(mantissa), -24);
+    return sign ? -absValue : absValue;
+  }
+  uint32_t bits = exponent == 0x1f
+      ? sign | 0x7f800000 | (mantissa << 13)
+      : sign | ((exponent + 112) << 23) | (mantissa << 13);
+  float result;
+  std::memcpy(&result, &bits, sizeof(result));
+  return result;
+}
+
+// Create `path` unless it exists, possibly created concurrently by another
+// process
+void ensureDir(const std::string& path) {
+  try {
+    dirCreate(path);
+  } catch (const std::runtime_error&) {
+    if (!dirExists(path)) {
+      throw;
+    }
+  }
+}
+
+} // namespace
+
+FeatureCache::FeatureCache(const std::string& path, const std::string& key)
+    : dir_(pathsConcat(path, hashKey(key))), writerCount_(0) {
+  ensureDir(path);
+  ensureDir(dir_);
+  char host[256] = "";
+  gethostname(host, sizeof(host) - 1);
+  writerPath_ = pathsConcat(
+      dir_, std::string(host) + "-" + std::to_string(getpid()) + "-");
+  sync();
+}
+
+FeatureCache::~FeatureCache() {
+  try {
+    std::lock_guard<std::mutex> lock(mutex_);
+    seal();
+  } catch (const std::exception& ex) {
+    LOG(ERROR) << "[FeatureCache] " << ex.what();
+  }
+}
+
+bool FeatureCache::find(
+    const std::string& sampleId,
+    std::vector<float>& features) {
+  Record record;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = records_.find(sampleId);
+    if (it == records_.end()) {
+      return false;
+    }
+    record = it->second;
+  }
+  // The shards are never unmapped
+  features.resize(record.size);
+  for (uint64_t i = 0; i < record.size; ++i) {
+    features[i] = halfToFloat(record.data[i]);
+  }
+  return true;
+}
+
+void FeatureCache::insert(
+    const std::string& sampleId,
+    std::vector<float>& features) {
+  std::vector<uint16_t> halves(features.size());
+  for (size_t i = 0; i < features.size(); ++i) {
+    halves[i] = floatToHalf(features[i]);
+    features[i] = halfToFloat(halves[i]);
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!writer_.is_open()) {
+    auto path = writerPath_ + std::to_string(writerCount_) + ".tmp";
+    writer_.open(path, std::ios::binary | std::ios::trunc);
+    if (!writer_) {
+      throw std::runtime_error("[FeatureCache] Cannot write shard: " + path);
+    }
+    // The header is written when the shard is sealed
+    FeatureCacheHeader header;
+    writer_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  }
+  uint64_t offset = writer_.tellp();
+  writer_.write(
+      reinterpret_cast<const char*>(halves.data()),
+      halves.size() * sizeof(uint16_t));
+  if (!writer_) {
+    throw std::runtime_error("[FeatureCache] Failed writing a shard");
+  }
+  writerIndex_.emplace_back(sampleId, std::make_pair(offset, halves.size()));
+}
+
+void FeatureCache::sync() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  seal();
+
+  DIR* dir = opendir(dir_.c_str());
+  if (!dir) {
+    throw std::runtime_error("[FeatureCache] Cannot list " + dir_);
+  }
+  std::vector<std::string> names;
+  while (struct dirent* entry = readdir(dir)) {
+    std::string name = entry->d_name;
+    size_t extLen = std::strlen(kShardExt);
+    if (name.size() > extLen &&
+        name.compare(name.size() - extLen, extLen, kShardExt) == 0 &&
+        shardNames_.find(name) == shardNames_.end()) {
+      names.push_back(name);
+    }
+  }
+  closedir(dir);
+  for (const auto& name : names) {
+    mapShard(pathsConcat(dir_, name));
+    shardNames_.insert(name);
+  }
+}
+
+void FeatureCache::seal() {
+  if (!writer_.is_open()) {
+    return;
+  }
+  FeatureCacheHeader header;
+  std::memcpy(header.magic, kFeatureCacheMagic, sizeof(header.magic));
+  header.version = kFeatureCacheVersion;
+  header.nRecords = writerIndex_.size();
+  header.indexOffset = writer_.tellp();
+  for (const auto& record : writerIndex_) {
+    const auto& sampleId = record.first;
+    uint64_t location[2] = {record.second.first, record.second.second};
+    uint32_t idLen = sampleId.size();
+    writer_.write(reinterpret_cast<const char*>(location), sizeof(location));
+    writer_.write(reinterpret_cast<const char*>(&idLen), sizeof(idLen));
+    writer_.write(sampleId.data(), idLen);
+  }
+  writer_.seekp(0);
+  writer_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  writer_.close();
+  writerIndex_.clear();
+  if (!writer_) {
+    throw std::runtime_error("[FeatureCache] Failed writing a shard");
+  }
+
+  // Readers only consider complete shards
+  auto path = writerPath_ + std::to_string(writerCount_++);
+  if (std::rename((path + ".tmp").c_str(), (path + kShardExt).c_str()) != 0) {
+    throw std::runtime_error("[FeatureCache] Cannot rename shard: " + path);
+  }
+}
+
+void FeatureCache::mapShard(const std::string& path) {
+  auto shard = std::make_shared<MemoryMappedFile>(path);
+  const char* data = shard->data();
+  size_t size = shard->size();
+
+  FeatureCacheHeader header;
+  if (size < sizeof(header)) {
+    throw std::runtime_error("[FeatureCache] Truncated shard: " + path);
+  }
+  std::memcpy(&header, data, sizeof(header));
+  if (std::memcmp(header.magic, kFeatureCacheMagic, sizeof(header.magic)) !=
+          0 ||
+      header.version != kFeatureCacheVersion || header.indexOffset > size) {
+    throw std::runtime_error("[FeatureCache] Invalid shard: " + path);
+  }
+  size_t pos = header.indexOffset;
+  for (uint64_t r = 0; r < header.nRecords; ++r) {
+    uint64_t location[2];
+    uint32_t idLen;
+    if (pos + sizeof(location) + sizeof(idLen) > size) {
+      throw std::runtime_error("[FeatureCache] Corrupted shard: " + path);
+    }
+    std::memcpy(location, data + pos, sizeof(location));
+    std::memcpy(&idLen, data + pos + sizeof(location), sizeof(idLen));
+    pos += sizeof(location) + sizeof(idLen);
+    if (pos + idLen > size || location[0] % sizeof(uint16_t) != 0 ||
+        location[0] + location[1] * sizeof(uint16_t) > header.indexOffset) {
+      throw std::runtime_error("[FeatureCache] Corrupted shard: " + path);
+    }
+    // The mapping is page-aligned and the records start at even offsets
+    Record record{reinterpret_cast<const uint16_t*>(data + location[0]),
+                  location[1]};
+    records_.emplace(std::string(data + pos, idLen), record);
+    pos += idLen;
+  }
+  shards_.push_back(shard);
+}
+
+} // namespace w2l
@@ -0,0 +1,90 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "libraries/common/MemoryMappedFile.h"
+
+namespace w2l {
+
+/**
+ * FeatureCache is an on-disk cache of the features of the samples of a
+ * dataset, stored in half precision and keyed by sample id. The features
+ * computed with different parameters are kept apart in the subdirectory of
+ * the hash of `key`, which describes these parameters.
+ *
+ * Each process appends the features it inserts to its own shard, which is
+ * sealed by sync(). Sealed shards, whichever process wrote them, are memory
+ * mapped by sync() and their features are read in place by find(). So the
+ * samples inserted during an epoch are found in the next ones, sync() being
+ * called between two epochs. All the methods are thread-safe.
+ *
+ * Shard format: a FeatureCacheHeader, the features of the records, then the
+ * index of the records, each being its offset in the file and number of
+ * features (uint64_t), then its sample id as a uint32_t length and its chars.
+ */
+class FeatureCache {
+ public:
+  FeatureCache(const std::string& path, const std::string& key);
+
+  ~FeatureCache();
+
+  FeatureCache(const FeatureCache&) = delete;
+  FeatureCache& operator=(const FeatureCache&) = delete;
+
+  /* Fill `features` and return true if `sampleId` is in a sealed shard */
+  bool find(const std::string& sampleId, std::vector<float>& features);
+
+  /*
+   * Append the features of `sampleId` to the shard of this process. They are
+   * rounded in place to the precision they are stored with, so that they are
+   * the same as the ones find() will return.
+   */
+  void insert(const std::string& sampleId, std::vector<float>& features);
+
+  /* Seal the shard of this process and map the shards sealed since */
+  void sync();
+
+  const std::string& dir() const {
+    return dir_;
+  }
+
+ private:
+  struct Record {
+    const uint16_t* data;
+    uint64_t size;
+  };
+
+  std::string dir_;
+  std::mutex mutex_;
+
+  std::vector<MemoryMappedFilePtr> shards_;
+  std::unordered_set<std::string> shardNames_;
+  std::unordered_map<std::string, Record> records_;
+
+  // Shard being written, renamed from `writerPath_` + ".tmp" when sealed
+  std::ofstream writer_;
+  std::string writerPath_;
+  int writerCount_;
+  std::vector<std::pair<std::string, std::pair<uint64_t, uint64_t>>>
+      writerIndex_;
+
+  void seal();
+  void mapShard(const std::string& path);
+};
+
+} // namespace w2l
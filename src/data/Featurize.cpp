@@ -10,6 +10,8 @@
 
 #include <math.h>
 #include <fstream>
+#include <memory>
+#include <sstream>
 #include <vector>
 
 #include <glog/logging.h>
@@ -17,6 +19,8 @@
 #include "common/Defines.h"
 #include "common/FlashlightUtils.h"
 #include "common/Transforms.h"
+#include "data/DeviceFeaturizer.h"
+#include "data/FeatureCache.h"
 #include "libraries/feature/Mfcc.h"
 #include "libraries/feature/Mfsc.h"
 #include "libraries/feature/PowerSpectrum.h"
@@ -25,23 +29,177 @@ namespace w2l {
 
 namespace {
 
+// The featurizers of the flags are per thread: the prefetch threads of the
+// datasets featurize their batches without sharing the dither RNG or the FFT
+// buffers. Only the first thread measures the FFTW plans: the planner mutex
+// serializes their creation, and the others reuse the wisdom FFTW keeps.
 Mfcc<float>& getMfcc() {
-  static Mfcc<float> mfcc(defineSpeechFeatureParams());
+  static thread_local Mfcc<float> mfcc(defineSpeechFeatureParams());
   return mfcc;
 }
 
 Mfsc<float>& getMfsc() {
-  static Mfsc<float> mfsc(defineSpeechFeatureParams());
+  static thread_local Mfsc<float> mfsc(defineSpeechFeatureParams());
   return mfsc;
 }
 
 PowerSpectrum<float>& getPowerSpectrum() {
-  static PowerSpectrum<float> powspec(defineSpeechFeatureParams());
+  static thread_local PowerSpectrum<float> powspec(
+      defineSpeechFeatureParams());
   return powspec;
 }
 
+// The features of the flags, with their constants on the device of the thread
+DeviceFeaturizer& getDeviceFeaturizer() {
+  static thread_local DeviceFeaturizer featurizer(
+      defineSpeechFeatureParams(),
+      FLAGS_mfcc ? DeviceFeaturizer::FeatureType::MFCC
+                 : FLAGS_mfsc ? DeviceFeaturizer::FeatureType::MFSC
+                              : DeviceFeaturizer::FeatureType::POW);
+  return featurizer;
+}
+
+bool useDeviceFeatures() {
+  return FLAGS_device_features && (FLAGS_pow || FLAGS_mfsc || FLAGS_mfcc);
+}
+
+PowerSpectrum<float>& getFeaturizer() {
+  if (FLAGS_mfcc) {
+    return getMfcc();
+  } else if (FLAGS_mfsc) {
+    return getMfsc();
+  }
+  return getPowerSpectrum();
+}
+
+// The cache of -featurecache, for the features and the input of the flags
+FeatureCache* getFeatureCache() {
+  static std::unique_ptr<FeatureCache> cache = []() {
+    std::unique_ptr<FeatureCache> featureCache;
+    if (!FLAGS_featurecache.empty() && !useDeviceFeatures() &&
+        (FLAGS_pow || FLAGS_mfsc || FLAGS_mfcc)) {
+      auto params = defineSpeechFeatureParams();
+      std::ostringstream key;
+      key << (FLAGS_mfcc ? "mfcc" : FLAGS_mfsc ? "mfsc" : "pow") << " "
+          << FLAGS_channels << " " << params.samplingFreq << " "
+          << params.frameSizeMs << " " << params.frameStrideMs << " "
+          << params.numFilterbankChans << " " << params.lowFreqFilterbank
+          << " " << params.highFreqFilterbank << " "
+          << params.numCepstralCoeffs << " " << params.lifterParam << " "
+          << static_cast<int>(params.windowType) << " " << params.preemCoef
+          << " " << params.melFloor << " " << params.ditherVal << " "
+          << params.usePower << " " << params.useEnergy << " "
+          << params.rawEnergy << " " << params.zeroMeanFrame;
+      if (params.fastLog) {
+        key << " fastlog"; // the keys of the exact features are unchanged
+      }
+      featureCache.reset(new FeatureCache(FLAGS_featurecache, key.str()));
+      LOG(INFO) << "Caching the features of '" << key.str() << "' in "
+                << featureCache->dir();
+    }
+    return featureCache;
+  }();
+  return cache.get();
+}
+
+// batchApply() of `featurizer` on the signals of `data` batched in `input`
+// (T X CHANNELS X BATCHSZ), the features of their frames before derivatives
+// being read from `cache` for the samples featurized before.
+//
+// The padding of a signal in the batch is zeros, so the features of a frame
+// only depend on the signal and on the index of the frame. The ones of the
+// frames starting in the signal are cached, and the next ones are all the
+// features of a frame of zeros. The derivatives and the normalization, which
+// depend on the padding, are computed afterwards.
+std::vector<float> cachedBatchApply(
+    PowerSpectrum<float>& featurizer,
+    FeatureCache& cache,
+    const std::vector<W2lLoaderData>& data,
+    const std::vector<float>& input,
+    int64_t T) {
+  auto params = featurizer.getFeatureParams();
+  int64_t nSamples = params.numFrameSizeSamples();
+  int64_t stride = params.numFrameStrideSamples();
+  int64_t nFrames = params.numFrames(T);
+  std::vector<float> zeros(nSamples, 0.0);
+  auto zeroFrameFeat = featurizer.frameFeatures(zeros.data(), 1);
+  int64_t frameFeatSz = zeroFrameFeat.size();
+
+  std::vector<float> output;
+  std::vector<float> frameFeat;
+  for (size_t b = 0; b < data.size(); ++b) {
+    int64_t len = data[b].input.size() / FLAGS_channels;
+    int64_t nSignalFrames = (len + stride - 1) / stride;
+    // FEAT X SIGNALFRAMES X CHANNELS (Col Major)
+    int64_t cachedSz = nSignalFrames * frameFeatSz * FLAGS_channels;
+    if (!cache.find(data[b].sampleId, frameFeat) ||
+        frameFeat.size() != cachedSz) {
+      frameFeat.clear();
+      for (int64_t c = 0; c < FLAGS_channels && nSignalFrames > 0; ++c) {
+        // The signal zero-padded to the end of its last frame
+        auto signal = input.begin() + (b * FLAGS_channels + c) * T;
+        std::vector<float> padded(signal, signal + len);
+        padded.resize((nSignalFrames - 1) * stride + nSamples, 0.0);
+        auto feat = featurizer.frameFeatures(padded.data(), nSignalFrames);
+        frameFeat.insert(frameFeat.end(), feat.begin(), feat.end());
+      }
+      cache.insert(data[b].sampleId, frameFeat);
+    }
+
+    std::vector<float> feat(nFrames * frameFeatSz);
+    for (int64_t c = 0; c < FLAGS_channels; ++c) {
+      for (int64_t f = 0; f < nFrames; ++f) {
+        auto src = f < nSignalFrames
+            ? frameFeat.begin() + (c * nSignalFrames + f) * frameFeatSz
+            : zeroFrameFeat.begin();
+        std::copy(src, src + frameFeatSz, feat.begin() + f * frameFeatSz);
+      }
+      auto curFeat = featurizer.applyDerivatives(feat);
+      output.insert(output.end(), curFeat.begin(), curFeat.end());
+    }
+  }
+  return output;
+}
+
 } // namespace
 
+std::vector<int> featurizeTarget(
+    const std::vector<std::string>& target,
+    int targetType,
+    const Dictionary& dict) {
+  return featurizeTarget(dict.mapEntriesToIndices(target), targetType, dict);
+}
+
+std::vector<int> featurizeTarget(
+    std::vector<int> tokens,
+    int targetType,
+    const Dictionary& dict) {
+  if (targetType == kWordIdx) {
+    return tokens;
+  } else if (targetType != kTargetIdx) {
+    LOG(FATAL) << "Unrecognized target type" << targetType;
+  }
+  auto tgtVec = std::move(tokens);
+  if (!FLAGS_surround.empty()) {
+    auto idx = dict.getIndex(FLAGS_surround);
+    tgtVec.emplace_back(idx);
+    if (tgtVec.size() > 1) {
+      tgtVec.emplace_back(idx);
+      std::rotate(tgtVec.begin(), tgtVec.end() - 1, tgtVec.end());
+    }
+  }
+  if (FLAGS_replabel > 0) {
+    tgtVec = packReplabels(tgtVec, dict, FLAGS_replabel);
+  }
+  if (FLAGS_criterion == kAsgCriterion) {
+    uniq(tgtVec);
+  }
+  if (FLAGS_eostoken) {
+    tgtVec.emplace_back(dict.getIndex(kEosToken));
+  }
+  return tgtVec;
+}
+
 W2lFeatureData featurize(
     const std::vector<W2lLoaderData>& data,
     const DictionaryMap& dicts) {
@@ -72,14 +230,24 @@ W2lFeatureData featurize(
         mergedInput.begin() + b * maxInSize);
   }
   // T X CHANNELS X BATCHSZ (Col Major)
-  auto inFeat =
-      transpose2d<float>(std::move(mergedInput), T, FLAGS_channels, batchSz);
+  auto inFeat = std::move(mergedInput);
+  transpose2dInPlace(inFeat, T, FLAGS_channels, batchSz);
   feat.inputDims = af::dim4(T, FLAGS_channels, 1, batchSz);
-  if (FLAGS_pow || FLAGS_mfsc || FLAGS_mfcc) {
-    if ((FLAGS_mfcc && FLAGS_mfsc) || (FLAGS_pow && FLAGS_mfsc) ||
-        (FLAGS_mfcc && FLAGS_pow)) {
-      LOG(FATAL) << "Only one of -mfsc, -mfcc, -pow options can set to true";
-    }
+  if ((FLAGS_mfcc && FLAGS_mfsc) || (FLAGS_pow && FLAGS_mfsc) ||
+      (FLAGS_mfcc && FLAGS_pow)) {
+    LOG(FATAL) << "Only one of -mfsc, -mfcc, -pow options can set to true";
+  }
+  auto cache = getFeatureCache();
+  if (cache) {
+    int64_t featSz = getSpeechFeatureSize();
+    inFeat = cachedBatchApply(getFeaturizer(), *cache, data, inFeat, T);
+    T = inFeat.size() / (FLAGS_channels * batchSz * featSz);
+    // Before: FEAT X FRAMES X CHANNELS X BATCHSIZE (Col Major)
+    transpose2dInPlace(inFeat, T, featSz, FLAGS_channels * batchSz);
+    // After: FRAMES X FEAT X CHANNELS X BATCHSIZE (Col Major)
+    feat.inputDims = af::dim4(T, featSz, FLAGS_channels, batchSz);
+  } else if (
+      !useDeviceFeatures() && (FLAGS_pow || FLAGS_mfsc || FLAGS_mfcc)) {
     int64_t featSz = 1;
     if (FLAGS_mfcc) {
       auto& mfcc = getMfcc();
@@ -98,12 +266,15 @@ W2lFeatureData featurize(
     }
     T = inFeat.size() / (FLAGS_channels * batchSz * featSz);
     // Before: FEAT X FRAMES X CHANNELS X BATCHSIZE (Col Major)
-    inFeat = transpose2d<float>(inFeat, T, featSz, FLAGS_channels * batchSz);
+    transpose2dInPlace(inFeat, T, featSz, FLAGS_channels * batchSz);
     // After: FRAMES X FEAT X CHANNELS X BATCHSIZE (Col Major)
     feat.inputDims = af::dim4(T, featSz, FLAGS_channels, batchSz);
   }
 
-  if (FLAGS_localnrmlleftctx > 0 || FLAGS_localnrmlrightctx > 0) {
+  if (useDeviceFeatures()) {
+    // Featurized and normalized on the device by featurizeOnDevice()
+    feat.input = std::move(inFeat);
+  } else if (FLAGS_localnrmlleftctx > 0 || FLAGS_localnrmlrightctx > 0) {
     feat.input = localNormalize(
         inFeat, FLAGS_localnrmlleftctx, FLAGS_localnrmlrightctx, T, batchSz);
   } else {
@@ -111,62 +282,49 @@ W2lFeatureData featurize(
   }
 
   // Featurize Target
-  for (auto targetIter : data[0].targets) {
-    auto targetType = targetIter.first;
+  std::vector<int> targetTypes;
+  for (const auto& targetIter : data[0].targets) {
+    targetTypes.push_back(targetIter.first);
+  }
+  for (const auto& targetIter : data[0].targetIndices) {
+    if (data[0].targets.find(targetIter.first) == data[0].targets.end()) {
+      targetTypes.push_back(targetIter.first);
+    }
+  }
+  for (auto targetType : targetTypes) {
     std::vector<std::vector<int>> tgtFeat;
     size_t maxTgtSize = 0;
-    if (dicts.find(targetType) == dicts.end()) {
+    auto dictIter = dicts.find(targetType);
+    if (dictIter == dicts.end()) {
       LOG(FATAL) << "Dictionary not provided for target: " << targetType;
     }
-    auto dict = dicts.find(targetType)->second;
+    const auto& dict = dictIter->second;
 
     for (const auto& d : data) {
-      if (d.targets.find(targetType) == d.targets.end()) {
-        LOG(FATAL) << "Target type not found for featurization: " << targetType;
-      }
-      auto target = d.targets.find(targetType)->second;
-
-      if (targetType == kTargetIdx) {
-        auto tgtVec = dict.mapEntriesToIndices(target);
-        if (!FLAGS_surround.empty()) {
-          auto idx = dict.getIndex(FLAGS_surround);
-          tgtVec.emplace_back(idx);
-          if (tgtVec.size() > 1) {
-            tgtVec.emplace_back(idx);
-            std::rotate(tgtVec.begin(), tgtVec.end() - 1, tgtVec.end());
-          }
-        }
-        if (FLAGS_replabel > 0) {
-          tgtVec = packReplabels(tgtVec, dict, FLAGS_replabel);
-        }
-        if (FLAGS_criterion == kAsgCriterion) {
-          uniq(tgtVec);
-        }
-        if (FLAGS_eostoken) {
-          tgtVec.emplace_back(dict.getIndex(kEosToken));
-        }
-        tgtFeat.emplace_back(tgtVec);
-        maxTgtSize = std::max(maxTgtSize, tgtVec.size());
-
-        int padVal =
-            FLAGS_eostoken ? dict.getIndex(kEosToken) : kTargetPadValue;
-        // L X BATCHSZ (Col Major)
-        feat.targets[targetType].resize(batchSz * maxTgtSize, padVal);
-        feat.targetDims[targetType] = af::dim4(maxTgtSize, batchSz);
-      } else if (targetType == kWordIdx) {
-        auto tgtVec = dict.mapEntriesToIndices(target);
-        tgtFeat.emplace_back(tgtVec);
-        maxTgtSize = std::max(maxTgtSize, tgtVec.size());
-
-        int padVal = dict.getIndex(kUnkToken);
-        // L X BATCHSZ (Col Major)
-        feat.targets[targetType].resize(batchSz * maxTgtSize, padVal);
-        feat.targetDims[targetType] = af::dim4(maxTgtSize, batchSz);
+      auto indices = d.targetIndices.find(targetType);
+      if (indices != d.targetIndices.end()) {
+        tgtFeat.emplace_back(indices->second);
       } else {
-        LOG(FATAL) << "Unrecognized target type" << targetType;
+        auto target = d.targets.find(targetType);
+        if (target == d.targets.end()) {
+          LOG(FATAL) << "Target type not found for featurization: "
+                     << targetType;
+        }
+        tgtFeat.emplace_back(featurizeTarget(target->second, targetType, dict));
       }
+      maxTgtSize = std::max(maxTgtSize, tgtFeat.back().size());
     }
 
+    int padVal = kTargetPadValue;
+    if (targetType == kTargetIdx && FLAGS_eostoken) {
+      padVal = dict.getIndex(kEosToken);
+    } else if (targetType == kWordIdx) {
+      padVal = dict.getIndex(kUnkToken);
+    }
+    // L X BATCHSZ (Col Major)
+    feat.targets[targetType].resize(batchSz * maxTgtSize, padVal);
+    feat.targetDims[targetType] = af::dim4(maxTgtSize, batchSz);
+
     // Batch into a single array
     for (size_t i = 0; i < batchSz; ++i) {
       if (tgtFeat[i].empty()) {
@@ -208,6 +366,33 @@ W2lFeatureData featurize(
   return feat;
 }
 
+af::array featurizeOnDevice(const af::array& input) {
+  if (!useDeviceFeatures() || input.isempty()) {
+    return input;
+  }
+  // T X CHANNELS X 1 X BATCHSZ
+  auto dims = input.dims();
+  auto& featurizer = getDeviceFeaturizer();
+  auto featSz = featurizer.featSz();
+  // FEAT X FRAMES X (CHANNELS * BATCHSZ)
+  auto feat = featurizer.apply(af::moddims(input, dims[0], dims[1] * dims[3]));
+  // FRAMES X FEAT X CHANNELS X BATCHSZ
+  feat = af::moddims(
+      af::reorder(feat, 1, 0, 2), feat.dims(1), featSz, dims[1], dims[3]);
+  if (FLAGS_localnrmlleftctx > 0 || FLAGS_localnrmlrightctx > 0) {
+    return localNormalizeOnDevice(
+        feat, FLAGS_localnrmlleftctx, FLAGS_localnrmlrightctx);
+  }
+  return normalizeOnDevice(feat);
+}
+
+void syncFeatureCache() {
+  auto cache = getFeatureCache();
+  if (cache) {
+    cache->sync();
+  }
+}
+
 FeatureParams defineSpeechFeatureParams() {
   FeatureParams params;
 
@@ -231,6 +416,7 @@ FeatureParams defineSpeechFeatureParams() {
   params.numCepstralCoeffs = FLAGS_mfcccoeffs;
   params.lifterParam = kLifterParam;
   params.melFloor = FLAGS_melfloor;
+  params.fastLog = FLAGS_fastlog;
 
   return params;
 }
@@ -33,6 +33,8 @@ typedef std::unordered_map<int, std::vector<std::string>> TargetMap;
 struct W2lLoaderData {
   std::vector<float> input;
   TargetMap targets;
+  // Targets already mapped by featurizeTarget(), used instead of `targets`
+  TargetFeatMap targetIndices;
   std::string sampleId;
 };
 
@@ -40,6 +42,37 @@ W2lFeatureData featurize(
     const std::vector<W2lLoaderData>& data,
     const DictionaryMap& dicts);
 
+/**
+ * Maps a target of type `targetType` to the indices of `dict`, as featurize()
+ * does. The result only depends on the target and on the flags, so it can be
+ * computed once per sample and passed as `W2lLoaderData::targetIndices`.
+ */
+std::vector<int> featurizeTarget(
+    const std::vector<std::string>& target,
+    int targetType,
+    const Dictionary& dict);
+
+/* featurizeTarget() of a target already mapped to the indices of `dict` */
+std::vector<int> featurizeTarget(
+    std::vector<int> tokens,
+    int targetType,
+    const Dictionary& dict);
+
+/**
+ * With -device_features, featurize() leaves the input as raw audio
+ * (T X CHANNELS X 1 X BATCHSZ) and featurizeOnDevice() computes its features
+ * and normalizes them on the device; it returns the input as is otherwise.
+ */
+af::array featurizeOnDevice(const af::array& input);
+
+/**
+ * With -featurecache, featurize() reads the features of the samples it has
+ * featurized before from an on-disk cache, in which it writes the other ones.
+ * syncFeatureCache() makes the features written so far available to the next
+ * calls, e.g. at the end of an epoch.
+ */
+void syncFeatureCache();
+
 FeatureParams defineSpeechFeatureParams();
 
 int64_t getSpeechFeatureSize();
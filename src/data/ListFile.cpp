@@ -0,0 +1,178 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "data/ListFile.h"
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+
+namespace w2l {
+
+namespace {
+
+// Bytes of the list parsed at least by each thread
+constexpr size_t kListChunkSize = 1 << 22;
+
+bool isSpace(char c) {
+  return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+} // namespace
+
+ListFile::ListFile(const std::string& filename) {
+  try {
+    file_ = std::make_shared<MemoryMappedFile>(filename);
+  } catch (const std::runtime_error&) {
+    throw std::invalid_argument("Could not read file '" + filename + "'");
+  }
+  const char* data = file_->data();
+  size_t size = file_->size();
+
+  // Parse chunks of whole lines in parallel
+  size_t numThreads = std::min<size_t>(
+      std::max(std::thread::hardware_concurrency(), 1u),
+      size / kListChunkSize + 1);
+  std::vector<size_t> bounds(numThreads + 1, size);
+  bounds[0] = 0;
+  for (size_t i = 1; i < numThreads; ++i) {
+    bounds[i] = std::max(bounds[i - 1], size / numThreads * i);
+    const char* eol = static_cast<const char*>(
+        std::memchr(data + bounds[i], '\n', size - bounds[i]));
+    bounds[i] = eol ? eol - data + 1 : size;
+  }
+  std::vector<std::vector<Row>> chunks(numThreads);
+  std::vector<std::exception_ptr> errors(numThreads);
+  auto parseChunk = [&](size_t i) {
+    try {
+      parse(bounds[i], bounds[i + 1], chunks[i]);
+    } catch (...) {
+      errors[i] = std::current_exception();
+    }
+  };
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < numThreads; ++i) {
+    threads.emplace_back(parseChunk, i);
+  }
+  parseChunk(0);
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  size_t numRows = 0;
+  for (size_t i = 0; i < numThreads; ++i) {
+    if (errors[i]) {
+      std::rethrow_exception(errors[i]);
+    }
+    numRows += chunks[i].size();
+  }
+  rows_.reserve(numRows);
+  for (const auto& chunk : chunks) {
+    rows_.insert(rows_.end(), chunk.begin(), chunk.end());
+  }
+}
+
+void ListFile::parse(size_t begin, size_t end, std::vector<Row>& rows) const {
+  const char* data = file_->data();
+  size_t fields[4][2];
+  while (begin < end) {
+    const char* eol = static_cast<const char*>(
+        std::memchr(data + begin, '\n', end - begin));
+    size_t lineEnd = eol ? eol - data : end;
+    // The first three columns, and the first word of the transcript
+    int numFields = 0;
+    size_t c = begin;
+    while (numFields < 4) {
+      while (c < lineEnd && isSpace(data[c])) {
+        ++c;
+      }
+      if (c == lineEnd) {
+        break;
+      }
+      fields[numFields][0] = c;
+      while (c < lineEnd && !isSpace(data[c])) {
+        ++c;
+      }
+      fields[numFields++][1] = c;
+    }
+    if (numFields > 0) {
+      if (numFields < 3) {
+        throw std::runtime_error(
+            "Cannot parse " + std::string(data + begin, data + lineEnd));
+      }
+      Row row;
+      row.idBegin = fields[0][0];
+      row.idEnd = fields[0][1];
+      row.handleBegin = fields[1][0];
+      row.handleEnd = fields[1][1];
+      row.audioSize =
+          std::stod(std::string(data + fields[2][0], data + fields[2][1]));
+      row.end = lineEnd;
+      while (row.end > fields[numFields - 1][1] && isSpace(data[row.end - 1])) {
+        --row.end;
+      }
+      row.wordsBegin = numFields == 4 ? fields[3][0] : row.end;
+      rows.push_back(row);
+    }
+    begin = lineEnd + 1;
+  }
+}
+
+std::string ListFile::id(size_t row) const {
+  const auto& r = rows_[row];
+  return std::string(file_->data() + r.idBegin, file_->data() + r.idEnd);
+}
+
+std::string ListFile::audioHandle(size_t row) const {
+  const auto& r = rows_[row];
+  return std::string(
+      file_->data() + r.handleBegin, file_->data() + r.handleEnd);
+}
+
+std::vector<std::string> ListFile::words(size_t row) const {
+  const auto& r = rows_[row];
+  const char* data = file_->data();
+  std::vector<std::string> words;
+  for (size_t c = r.wordsBegin; c < r.end;) {
+    while (c < r.end && isSpace(data[c])) {
+      ++c;
+    }
+    size_t word = c;
+    while (c < r.end && !isSpace(data[c])) {
+      ++c;
+    }
+    if (c > word) {
+      words.emplace_back(data + word, data + c);
+    }
+  }
+  return words;
+}
+
+std::string ListFile::transcript(size_t row) const {
+  const auto& r = rows_[row];
+  const char* data = file_->data();
+  std::string transcript;
+  transcript.reserve(r.end - r.wordsBegin);
+  bool space = false;
+  for (size_t c = r.wordsBegin; c < r.end; ++c) {
+    if (isSpace(data[c])) {
+      space = true;
+      continue;
+    }
+    if (space) {
+      transcript.push_back(' ');
+      space = false;
+    }
+    transcript.push_back(data[c]);
+  }
+  return transcript;
+}
+
+} // namespace w2l
@@ -0,0 +1,69 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "libraries/common/MemoryMappedFile.h"
+
+namespace w2l {
+
+/**
+ * ListFile parses the rows of a list file, each of which is
+ * `[sample id] [audio handle] [size] [word transcript]` with whitespace
+ * separated columns; blank lines are skipped. The file is memory mapped and
+ * split in chunks of whole lines parsed in parallel. A row is stored as the
+ * offsets of its fields into the mapping, which is the arena of the strings
+ * of all the rows, so a large list costs a few words per row on the heap.
+ */
+class ListFile {
+ public:
+  explicit ListFile(const std::string& filename);
+
+  size_t size() const {
+    return rows_.size();
+  }
+
+  std::string id(size_t row) const;
+
+  std::string audioHandle(size_t row) const;
+
+  double audioSize(size_t row) const {
+    return rows_[row].audioSize;
+  }
+
+  bool hasWords(size_t row) const {
+    return rows_[row].wordsBegin < rows_[row].end;
+  }
+
+  std::vector<std::string> words(size_t row) const;
+
+  /* The words, separated by single spaces */
+  std::string transcript(size_t row) const;
+
+ private:
+  struct Row {
+    size_t idBegin;
+    size_t idEnd;
+    size_t handleBegin;
+    size_t handleEnd;
+    size_t wordsBegin; // the transcript is [wordsBegin, end) of the line
+    size_t end;
+    double audioSize;
+  };
+
+  MemoryMappedFilePtr file_;
+  std::vector<Row> rows_;
+
+  void parse(size_t begin, size_t end, std::vector<Row>& rows) const;
+};
+
+} // namespace w2l
@@ -5,12 +5,6 @@
 #include "data/Sound.h"
 
 namespace {
-constexpr const size_t kIdIdx = 0;
-constexpr const size_t kInIdx = 1;
-constexpr const size_t kSzIdx = 2;
-constexpr const size_t kTgtIdx = 3;
-constexpr const size_t kNumCols = 4;
-
 af::array toArray(const std::string& str) {
   return af::array(str.length(), str.data());
 }
@@ -22,29 +16,18 @@ ListFileDataset::ListFileDataset(
     const std::string& filename,
     const DataTransformFunction& inFeatFunc /* = nullptr */,
     const DataTransformFunction& tgtFeatFunc /* = nullptr */)
-    : inFeatFunc_(inFeatFunc), tgtFeatFunc_(tgtFeatFunc), numRows_(0) {
-  std::ifstream inFile(filename);
-  if (!inFile) {
-    throw std::invalid_argument("Unable to open file -" + filename);
-  }
-  std::string line;
-  while (std::getline(inFile, line)) {
-    if (line.empty()) {
-      continue;
+    : inFeatFunc_(inFeatFunc),
+      tgtFeatFunc_(tgtFeatFunc),
+      numRows_(0),
+      list_(filename) {
+  numRows_ = list_.size();
+  sizes_.reserve(numRows_);
+  for (int64_t i = 0; i < numRows_; ++i) {
+    if (!list_.hasWords(i)) {
+      throw std::runtime_error("Invalid line: " + list_.id(i));
     }
-    auto splits = w2l::splitOnWhitespace(line, true);
-    if (splits.size() < kNumCols) {
-      throw std::runtime_error("Invalid line: " + line);
-    }
-
-    ids_.emplace_back(std::move(splits[kIdIdx]));
-    inputs_.emplace_back(std::move(splits[kInIdx]));
-    sizes_.emplace_back(std::stod(splits[kSzIdx]));
-    targets_.emplace_back(w2l::join(
-        " ", std::vector<std::string>(splits.begin() + kTgtIdx, splits.end())));
-    ++numRows_;
+    sizes_.emplace_back(list_.audioSize(i));
   }
-  inFile.close();
 }
 
 int64_t ListFileDataset::size() const {
@@ -53,7 +36,7 @@ int64_t ListFileDataset::size() const {
 
 std::vector<af::array> ListFileDataset::get(const int64_t idx) const {
   checkIndexBounds(idx);
-  auto audio = loadAudio(inputs_[idx]);
+  auto audio = loadAudio(list_.audioHandle(idx));
   af::array input;
   if (inFeatFunc_) {
     input = inFeatFunc_(
@@ -61,10 +44,11 @@ std::vector<af::array> ListFileDataset::get(const int64_t idx) const {
   } else {
     input = af::array(audio.second, audio.first.data());
   }
-  af::array transcript = toArray(targets_[idx]);
+  auto words = list_.transcript(idx);
+  af::array transcript = toArray(words);
   af::array target;
   if (tgtFeatFunc_) {
-    std::vector<char> curTarget(targets_[idx].begin(), targets_[idx].end());
+    std::vector<char> curTarget(words.begin(), words.end());
     target = tgtFeatFunc_(
         static_cast<void*>(curTarget.data()),
         {static_cast<dim_t>(curTarget.size())},
@@ -73,7 +57,7 @@ std::vector<af::array> ListFileDataset::get(const int64_t idx) const {
     target = transcript;
   }
 
-  af::array sampleIdx = toArray(ids_[idx]);
+  af::array sampleIdx = toArray(list_.id(idx));
 
   return {input, target, transcript, sampleIdx};
 }
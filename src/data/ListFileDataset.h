@@ -13,6 +13,7 @@
 
 #include <flashlight/flashlight.h>
 
+#include "data/ListFile.h"
 #include "libraries/common/Dictionary.h"
 #include "libraries/common/Utils.h"
 
@@ -62,9 +63,8 @@ class ListFileDataset : public fl::Dataset {
  protected:
   DataTransformFunction inFeatFunc_, tgtFeatFunc_;
   int64_t numRows_;
-  std::vector<std::string> ids_;
-  std::vector<std::string> inputs_;
-  std::vector<std::string> targets_;
+  // The rows, whose strings stay in the mapping of the file
+  ListFile list_;
   std::vector<double> sizes_;
 };
 } // namespace w2l
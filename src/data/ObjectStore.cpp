@@ -0,0 +1,454 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "data/ObjectStore.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+
+#ifdef W2L_USE_CURL
+#include <curl/curl.h>
+#endif
+
+#include <glog/logging.h>
+
+#include "common/Defines.h"
+#include "libraries/common/Utils.h"
+
+namespace w2l {
+
+namespace {
+
+// Bytes of an object read at once by an ObjectInputStream
+constexpr int64_t kStreamBufferSize = 1 << 18;
+// Blocks waiting to be prefetched, beyond which readaheads are dropped
+constexpr size_t kMaxPendingPrefetches = 1024;
+constexpr int kHttpRetries = 5;
+
+#ifdef W2L_USE_CURL
+
+struct Sink {
+  char* data;
+  int64_t size;
+  int64_t written;
+};
+
+size_t writeToSink(char* ptr, size_t size, size_t nmemb, void* userdata) {
+  auto* sink = static_cast<Sink*>(userdata);
+  int64_t bytes = size * nmemb;
+  if (sink->written + bytes > sink->size) {
+    return 0; // more than requested: fail the transfer
+  }
+  std::memcpy(sink->data + sink->written, ptr, bytes);
+  sink->written += bytes;
+  return bytes;
+}
+
+// A handle per thread, so that connections are reused
+CURL* threadHandle() {
+  thread_local std::unique_ptr<CURL, void (*)(CURL*)> handle(
+      curl_easy_init(), curl_easy_cleanup);
+  if (!handle) {
+    throw std::runtime_error("[HttpObjectStore] curl_easy_init failed");
+  }
+  curl_easy_reset(handle.get());
+  return handle.get();
+}
+
+// Performs the request set on `curl`, retrying transfer errors and server
+// errors, and returns the HTTP status
+long perform(CURL* curl, const std::string& url, Sink* sink) {
+  std::string error;
+  for (int attempt = 0; attempt < kHttpRetries; ++attempt) {
+    if (attempt > 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(100 << attempt));
+    }
+    if (sink) {
+      sink->written = 0;
+    }
+    auto res = curl_easy_perform(curl);
+    long status = 0;
+    if (res == CURLE_OK) {
+      curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+      if (status < 500) {
+        return status;
+      }
+      error = "HTTP " + std::to_string(status);
+    } else {
+      error = curl_easy_strerror(res);
+    }
+  }
+  throw std::runtime_error("[HttpObjectStore] " + url + ": " + error);
+}
+
+#endif
+
+} // namespace
+
+bool ObjectStore::isRemote(const std::string& path) {
+  for (const char* scheme : {"http://", "https://", "s3://", "gs://"}) {
+    if (startsWith(path, scheme)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+std::shared_ptr<ObjectStore> ObjectStore::get() {
+  static std::shared_ptr<ObjectStore> store =
+      std::make_shared<CachedObjectStore>(
+          std::make_shared<HttpObjectStore>(),
+          FLAGS_objectstore_block_kb << 10,
+          FLAGS_objectstore_cache_mb << 20,
+          FLAGS_objectstore_readahead,
+          FLAGS_objectstore_threads);
+  return store;
+}
+
+HttpObjectStore::HttpObjectStore()
+    : header_(getEnvVar("W2L_OBJECTSTORE_HEADER")) {
+#ifdef W2L_USE_CURL
+  static std::once_flag init;
+  std::call_once(init, []() { curl_global_init(CURL_GLOBAL_DEFAULT); });
+#endif
+}
+
+std::string HttpObjectStore::httpUrl(const std::string& url) {
+  if (startsWith(url, "s3://")) {
+    auto path = url.substr(5);
+    auto slash = std::min(path.find('/'), path.size());
+    return "https://" + path.substr(0, slash) + ".s3.amazonaws.com" +
+        path.substr(slash);
+  } else if (startsWith(url, "gs://")) {
+    return "https://storage.googleapis.com/" + url.substr(5);
+  }
+  return url;
+}
+
+#ifdef W2L_USE_CURL
+
+int64_t HttpObjectStore::size(const std::string& url) {
+  auto curl = threadHandle();
+  auto httpUrl = HttpObjectStore::httpUrl(url);
+  curl_slist* headers = nullptr;
+  if (!header_.empty()) {
+    headers = curl_slist_append(headers, header_.c_str());
+  }
+  curl_easy_setopt(curl, CURLOPT_URL, httpUrl.c_str());
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+  curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+  curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+  long status;
+  try {
+    status = perform(curl, url, nullptr);
+  } catch (...) {
+    curl_slist_free_all(headers);
+    throw;
+  }
+  curl_off_t length = -1;
+  curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length);
+  curl_slist_free_all(headers);
+  if (status != 200 || length < 0) {
+    throw std::runtime_error(
+        "[HttpObjectStore] Cannot stat " + url + ": HTTP " +
+        std::to_string(status));
+  }
+  return length;
+}
+
+void HttpObjectStore::read(
+    const std::string& url,
+    int64_t offset,
+    char* data,
+    int64_t size) {
+  if (size <= 0) {
+    return;
+  }
+  auto curl = threadHandle();
+  auto httpUrl = HttpObjectStore::httpUrl(url);
+  auto range =
+      std::to_string(offset) + "-" + std::to_string(offset + size - 1);
+  curl_slist* headers = nullptr;
+  if (!header_.empty()) {
+    headers = curl_slist_append(headers, header_.c_str());
+  }
+  Sink sink{data, size, 0};
+  curl_easy_setopt(curl, CURLOPT_URL, httpUrl.c_str());
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+  curl_easy_setopt(curl, CURLOPT_RANGE, range.c_str());
+  curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeToSink);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &sink);
+  long status;
+  try {
+    status = perform(curl, url, &sink);
+  } catch (...) {
+    curl_slist_free_all(headers);
+    throw;
+  }
+  curl_slist_free_all(headers);
+  // A server ignoring the range sends the whole object, with status 200
+  if ((status != 206 && !(status == 200 && offset == 0)) ||
+      sink.written != size) {
+    throw std::runtime_error(
+        "[HttpObjectStore] Cannot read " + range + " of " + url + ": HTTP " +
+        std::to_string(status));
+  }
+}
+
+#else
+
+int64_t HttpObjectStore::size(const std::string& url) {
+  throw std::runtime_error(
+      "[HttpObjectStore] Cannot read " + url + ": built without libcurl");
+}
+
+void HttpObjectStore::read(
+    const std::string& url,
+    int64_t /* offset */,
+    char* /* data */,
+    int64_t /* size */) {
+  throw std::runtime_error(
+      "[HttpObjectStore] Cannot read " + url + ": built without libcurl");
+}
+
+#endif
+
+CachedObjectStore::CachedObjectStore(
+    std::shared_ptr<ObjectStore> store,
+    int64_t blockSize,
+    int64_t capacity,
+    int readahead,
+    int numThreads)
+    : store_(std::move(store)),
+      blockSize_(blockSize),
+      capacity_(capacity),
+      readahead_(readahead) {
+  if (blockSize_ <= 0) {
+    throw std::invalid_argument("CachedObjectStore: invalid block size");
+  }
+  if (readahead_ > 0) {
+    for (int i = 0; i < std::max(numThreads, 1); ++i) {
+      threads_.emplace_back(&CachedObjectStore::runPrefetch, this);
+    }
+  }
+}
+
+CachedObjectStore::~CachedObjectStore() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  prefetchCv_.notify_all();
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+}
+
+int64_t CachedObjectStore::size(const std::string& url) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = sizes_.find(url);
+    if (it != sizes_.end()) {
+      return it->second;
+    }
+  }
+  auto size = store_->size(url);
+  std::lock_guard<std::mutex> lock(mutex_);
+  sizes_[url] = size;
+  return size;
+}
+
+void CachedObjectStore::read(
+    const std::string& url,
+    int64_t offset,
+    char* data,
+    int64_t size) {
+  if (size <= 0) {
+    return;
+  }
+  auto objectSize = this->size(url);
+  if (offset < 0 || offset + size > objectSize) {
+    throw std::out_of_range("CachedObjectStore: read past the end of " + url);
+  }
+  int64_t first = offset / blockSize_;
+  int64_t last = (offset + size - 1) / blockSize_;
+  for (int64_t b = first; b <= last; ++b) {
+    auto block = getBlock(url, b);
+    int64_t begin = std::max(offset, b * blockSize_);
+    int64_t end = std::min(offset + size, b * blockSize_ + blockSize_);
+    std::memcpy(
+        data + begin - offset,
+        block->data() + begin - b * blockSize_,
+        end - begin);
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  int64_t numBlocks = (objectSize + blockSize_ - 1) / blockSize_;
+  for (int64_t b = last + 1; b <= std::min(last + readahead_, numBlocks - 1);
+       ++b) {
+    auto key = url + "#" + std::to_string(b);
+    if (prefetch_.size() < kMaxPendingPrefetches && !blocks_.count(key) &&
+        !fetching_.count(key)) {
+      prefetch_.emplace_back(url, b);
+      prefetchCv_.notify_one();
+    }
+  }
+}
+
+CachedObjectStore::Block CachedObjectStore::getBlock(
+    const std::string& url,
+    int64_t index) {
+  auto key = url + "#" + std::to_string(index);
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    auto it = blocks_.find(key);
+    if (it != blocks_.end()) {
+      lru_.splice(lru_.begin(), lru_, it->second);
+      return it->second->second;
+    }
+    if (!fetching_.count(key)) {
+      break;
+    }
+    fetched_.wait(lock);
+  }
+  fetching_.insert(key);
+  lock.unlock();
+
+  std::shared_ptr<std::vector<char>> block;
+  try {
+    int64_t begin = index * blockSize_;
+    block = std::make_shared<std::vector<char>>(
+        std::max<int64_t>(std::min(blockSize_, size(url) - begin), 0));
+    store_->read(url, begin, block->data(), block->size());
+  } catch (...) {
+    lock.lock();
+    fetching_.erase(key);
+    fetched_.notify_all();
+    throw;
+  }
+
+  lock.lock();
+  fetching_.erase(key);
+  lru_.emplace_front(key, block);
+  blocks_[key] = lru_.begin();
+  cached_ += block->size();
+  // The block just read is kept, even if it is larger than the cache
+  while (cached_ > capacity_ && lru_.size() > 1) {
+    cached_ -= lru_.back().second->size();
+    blocks_.erase(lru_.back().first);
+    lru_.pop_back();
+  }
+  fetched_.notify_all();
+  return block;
+}
+
+void CachedObjectStore::runPrefetch() {
+  while (true) {
+    std::pair<std::string, int64_t> next;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      prefetchCv_.wait(lock, [this]() { return stop_ || !prefetch_.empty(); });
+      if (stop_) {
+        return;
+      }
+      next = std::move(prefetch_.front());
+      prefetch_.pop_front();
+    }
+    try {
+      getBlock(next.first, next.second);
+    } catch (const std::exception& ex) {
+      // Read again, and reported, when the block is needed
+      VLOG(1) << "[CachedObjectStore] Prefetch failed: " << ex.what();
+    }
+  }
+}
+
+ObjectInputStream::Buffer::Buffer(
+    std::shared_ptr<ObjectStore> store,
+    const std::string& url)
+    : store_(std::move(store)), url_(url) {
+  try {
+    size_ = store_->size(url_);
+  } catch (const std::exception& ex) {
+    VLOG(1) << "[ObjectInputStream] " << ex.what();
+  }
+}
+
+ObjectInputStream::Buffer::int_type ObjectInputStream::Buffer::underflow() {
+  if (gptr() < egptr()) {
+    return traits_type::to_int_type(*gptr());
+  }
+  int64_t pos = bufferBegin_ + (gptr() - eback());
+  if (pos >= size_) {
+    return traits_type::eof();
+  }
+  auto n = std::min(kStreamBufferSize, size_ - pos);
+  buffer_.resize(kStreamBufferSize);
+  store_->read(url_, pos, buffer_.data(), n);
+  bufferBegin_ = pos;
+  setg(buffer_.data(), buffer_.data(), buffer_.data() + n);
+  return traits_type::to_int_type(*gptr());
+}
+
+ObjectInputStream::Buffer::pos_type ObjectInputStream::Buffer::seekoff(
+    off_type offset,
+    std::ios_base::seekdir way,
+    std::ios_base::openmode which) {
+  if (!(which & std::ios_base::in) || !valid()) {
+    return pos_type(off_type(-1));
+  }
+  int64_t current = bufferBegin_ + (gptr() - eback());
+  int64_t target = offset;
+  if (way == std::ios_base::cur) {
+    target += current;
+  } else if (way == std::ios_base::end) {
+    target += size_;
+  }
+  if (target < 0 || target > size_) {
+    return pos_type(off_type(-1));
+  }
+  if (target >= bufferBegin_ && target < bufferBegin_ + (egptr() - eback())) {
+    setg(eback(), eback() + (target - bufferBegin_), egptr());
+  } else {
+    bufferBegin_ = target;
+    setg(buffer_.data(), buffer_.data(), buffer_.data());
+  }
+  return pos_type(target);
+}
+
+ObjectInputStream::Buffer::pos_type ObjectInputStream::Buffer::seekpos(
+    pos_type pos,
+    std::ios_base::openmode which) {
+  return seekoff(off_type(pos), std::ios_base::beg, which);
+}
+
+ObjectInputStream::ObjectInputStream(
+    std::shared_ptr<ObjectStore> store,
+    const std::string& url)
+    : std::istream(nullptr), buffer_(std::move(store), url) {
+  rdbuf(&buffer_);
+  if (!buffer_.valid()) {
+    setstate(std::ios_base::failbit);
+  }
+}
+
+std::unique_ptr<std::istream> openInputStream(const std::string& path) {
+  if (ObjectStore::isRemote(path)) {
+    return std::unique_ptr<std::istream>(
+        new ObjectInputStream(ObjectStore::get(), path));
+  }
+  return std::unique_ptr<std::istream>(
+      new std::ifstream(path, std::ios::binary));
+}
+
+} // namespace w2l
@@ -0,0 +1,165 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <istream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace w2l {
+
+/**
+ * Range reads of the objects of a remote store, named by URLs. All the
+ * methods are thread-safe.
+ */
+class ObjectStore {
+ public:
+  virtual ~ObjectStore() {}
+
+  /* Size in bytes of the object */
+  virtual int64_t size(const std::string& url) = 0;
+
+  /* Reads the bytes [offset, offset + size) of the object into `data` */
+  virtual void
+  read(const std::string& url, int64_t offset, char* data, int64_t size) = 0;
+
+  /* Returns true if `path` is the URL of an object, rather than a file */
+  static bool isRemote(const std::string& path);
+
+  /**
+   * The store of the process: an HttpObjectStore behind a CachedObjectStore
+   * set by the -objectstore_* flags
+   */
+  static std::shared_ptr<ObjectStore> get();
+};
+
+/**
+ * Reads http://, https://, s3:// and gs:// URLs with HTTP range requests.
+ * Buckets are read through their public HTTPS endpoints, and the requests
+ * carry the header set by the W2L_OBJECTSTORE_HEADER environment variable
+ * (e.g. "Authorization: Bearer ..."), if any. Failed requests are retried.
+ * Requires libcurl at build time.
+ */
+class HttpObjectStore : public ObjectStore {
+ public:
+  HttpObjectStore();
+
+  int64_t size(const std::string& url) override;
+
+  void read(const std::string& url, int64_t offset, char* data, int64_t size)
+      override;
+
+  /* The HTTP(S) URL of s3:// and gs:// URLs; other URLs are unchanged */
+  static std::string httpUrl(const std::string& url);
+
+ private:
+  std::string header_;
+};
+
+/**
+ * Caches the objects of another store by blocks of `blockSize` bytes, in an
+ * LRU cache of `capacity` bytes. A read prefetches the `readahead` blocks
+ * after the ones it reads on background threads, so that the latency of the
+ * store is hidden when objects are read sequentially (an audio file decoded
+ * from its start, consecutive samples of a blob).
+ */
+class CachedObjectStore : public ObjectStore {
+ public:
+  CachedObjectStore(
+      std::shared_ptr<ObjectStore> store,
+      int64_t blockSize,
+      int64_t capacity,
+      int readahead,
+      int numThreads);
+
+  ~CachedObjectStore() override;
+
+  int64_t size(const std::string& url) override;
+
+  void read(const std::string& url, int64_t offset, char* data, int64_t size)
+      override;
+
+ private:
+  using Block = std::shared_ptr<const std::vector<char>>;
+
+  std::shared_ptr<ObjectStore> store_;
+  int64_t blockSize_;
+  int64_t capacity_;
+  int readahead_;
+
+  std::mutex mutex_;
+  std::condition_variable fetched_;
+  std::unordered_map<std::string, int64_t> sizes_;
+  // Blocks by `url#index`, most recently used first
+  std::list<std::pair<std::string, Block>> lru_;
+  std::unordered_map<std::string, decltype(lru_)::iterator> blocks_;
+  int64_t cached_{0};
+  std::unordered_set<std::string> fetching_;
+
+  // Blocks to prefetch, as (url, index)
+  std::deque<std::pair<std::string, int64_t>> prefetch_;
+  std::condition_variable prefetchCv_;
+  bool stop_{false};
+  std::vector<std::thread> threads_;
+
+  /* The block, fetched unless it is cached or being fetched */
+  Block getBlock(const std::string& url, int64_t index);
+
+  void runPrefetch();
+};
+
+/* A seekable read-only stream of an object */
+class ObjectInputStream : public std::istream {
+ public:
+  ObjectInputStream(std::shared_ptr<ObjectStore> store, const std::string& url);
+
+ private:
+  class Buffer : public std::streambuf {
+   public:
+    Buffer(std::shared_ptr<ObjectStore> store, const std::string& url);
+
+    bool valid() const {
+      return size_ >= 0;
+    }
+
+   protected:
+    int_type underflow() override;
+
+    pos_type seekoff(
+        off_type offset,
+        std::ios_base::seekdir way,
+        std::ios_base::openmode which) override;
+
+    pos_type seekpos(pos_type pos, std::ios_base::openmode which) override;
+
+   private:
+    std::shared_ptr<ObjectStore> store_;
+    std::string url_;
+    int64_t size_{-1};
+    int64_t bufferBegin_{0}; // offset in the object of the buffer
+    std::vector<char> buffer_;
+  };
+
+  Buffer buffer_;
+};
+
+/* A file or an object, read with an ObjectInputStream of ObjectStore::get() */
+std::unique_ptr<std::istream> openInputStream(const std::string& path);
+
+} // namespace w2l
@@ -0,0 +1,70 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "PinnedBufferPool.h"
+
+#include <algorithm>
+
+#include <arrayfire.h>
+
+namespace w2l {
+
+namespace {
+constexpr size_t kMinCapacity = 1 << 16;
+} // namespace
+
+PinnedBufferPool::PinnedBufferPool(size_t maxFree) : maxFree_(maxFree) {}
+
+PinnedBufferPool::~PinnedBufferPool() {
+  for (auto& buffer : free_) {
+    af::freePinned(buffer.second);
+  }
+}
+
+PinnedBufferPool::BufferPtr PinnedBufferPool::acquire(size_t size) {
+  float* buffer = nullptr;
+  size_t capacity = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // The smallest free buffer which is large enough
+    auto best = free_.end();
+    for (auto it = free_.begin(); it != free_.end(); ++it) {
+      if (it->first >= size &&
+          (best == free_.end() || it->first < best->first)) {
+        best = it;
+      }
+    }
+    if (best != free_.end()) {
+      capacity = best->first;
+      buffer = best->second;
+      free_.erase(best);
+    }
+  }
+  if (!buffer) {
+    capacity = kMinCapacity;
+    while (capacity < size) {
+      capacity *= 2;
+    }
+    buffer = static_cast<float*>(af::pinned(capacity, f32));
+  }
+  return BufferPtr(
+      buffer, [this, capacity](float* ptr) { release(capacity, ptr); });
+}
+
+void PinnedBufferPool::release(size_t capacity, float* buffer) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  free_.emplace_back(capacity, buffer);
+  if (free_.size() > maxFree_) {
+    // Drop the smallest buffer, which is the least likely to be reused
+    auto smallest = std::min_element(free_.begin(), free_.end());
+    af::freePinned(smallest->second);
+    free_.erase(smallest);
+  }
+}
+
+} // namespace w2l
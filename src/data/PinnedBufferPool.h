@@ -0,0 +1,51 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace w2l {
+
+/**
+ * PinnedBufferPool recycles buffers of page-locked host memory, from which the
+ * device copies are DMA transfers rather than copies staged through a driver
+ * buffer, as the ones of pageable memory. Buffers are allocated for a power of
+ * two elements and at most `maxFree` free buffers are kept. All the methods
+ * are thread-safe.
+ */
+class PinnedBufferPool {
+ public:
+  // Returns the buffer to its pool when destroyed, which must happen before
+  // the pool is destroyed
+  using BufferPtr = std::unique_ptr<float, std::function<void(float*)>>;
+
+  explicit PinnedBufferPool(size_t maxFree = 4);
+
+  ~PinnedBufferPool();
+
+  PinnedBufferPool(const PinnedBufferPool&) = delete;
+  PinnedBufferPool& operator=(const PinnedBufferPool&) = delete;
+
+  /* Returns a buffer of at least `size` floats */
+  BufferPtr acquire(size_t size);
+
+ private:
+  size_t maxFree_;
+  std::mutex mutex_;
+  std::vector<std::pair<size_t, float*>> free_; // capacity and buffer
+
+  void release(size_t capacity, float* buffer);
+};
+
+} // namespace w2l
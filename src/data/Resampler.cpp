@@ -0,0 +1,191 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "data/Resampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+namespace w2l {
+
+constexpr int64_t Resampler::kMaxPhases;
+
+namespace {
+
+int64_t gcd(int64_t a, int64_t b) {
+  while (b != 0) {
+    auto r = a % b;
+    a = b;
+    b = r;
+  }
+  return a;
+}
+
+// Fraction of the lower Nyquist frequency passed, leaving a transition band
+// below it for the filter to attenuate
+constexpr double kRolloff = 0.95;
+
+} // namespace
+
+Resampler::Resampler(
+    int64_t inRate,
+    int64_t outRate,
+    int64_t inChannels,
+    int64_t outChannels,
+    int zeroCrossings /* = 16 */)
+    : inChannels_(inChannels), outChannels_(outChannels) {
+  if (inRate <= 0 || outRate <= 0 || zeroCrossings <= 0) {
+    throw std::invalid_argument("[Resampler] Invalid sample rates");
+  }
+  if (inChannels <= 0 || outChannels <= 0 ||
+      (inChannels > 1 && outChannels > 1 && inChannels != outChannels)) {
+    throw std::invalid_argument(
+        "[Resampler] Cannot mix " + std::to_string(inChannels) +
+        " channels into " + std::to_string(outChannels));
+  }
+  auto divisor = gcd(inRate, outRate);
+  up_ = outRate / divisor;
+  down_ = inRate / divisor;
+  if (up_ > kMaxPhases) {
+    throw std::invalid_argument(
+        "[Resampler] Cannot resample from " + std::to_string(inRate) +
+        " Hz to " + std::to_string(outRate) + " Hz");
+  }
+  numMixed_ = inChannels == 1 ? 1 : outChannels;
+
+  if (up_ == down_) {
+    halfTaps_ = 0; // the channels are only mixed
+  } else {
+    // The output frame n is at the time t = n * down_ / up_ of the input,
+    // i.e. at the phase p = n * down_ % up_ between the input frames m =
+    // n * down_ / up_ and m + 1. It's the sum over the input frames i of
+    // x[i] * h(t - i), with the low-pass filter h a windowed sinc. Each
+    // phase has its taps, applied to the input frames
+    // [m - halfTaps_ + 1, m + halfTaps_].
+    const double pi = std::acos(-1);
+    double cutoff = kRolloff * std::min(1.0, double(up_) / down_);
+    double halfWidth = zeroCrossings / cutoff;
+    halfTaps_ = std::ceil(halfWidth);
+    int64_t numTaps = 2 * halfTaps_;
+    filters_.resize(up_ * numTaps);
+    for (int64_t p = 0; p < up_; ++p) {
+      for (int64_t j = 0; j < numTaps; ++j) {
+        double t = double(p) / up_ + halfTaps_ - 1 - j;
+        if (std::abs(t) >= halfWidth) {
+          continue;
+        }
+        double x = pi * cutoff * t;
+        double sinc = x == 0 ? 1.0 : std::sin(x) / x;
+        // Blackman window
+        double w = pi * t / halfWidth;
+        double window = 0.42 + 0.5 * std::cos(w) + 0.08 * std::cos(2 * w);
+        filters_[p * numTaps + j] = cutoff * sinc * window;
+      }
+    }
+  }
+  // The input before the first frame is silence
+  history_.assign(numMixed_, std::vector<float>(halfTaps_, 0));
+  historyStart_ = -halfTaps_;
+}
+
+void Resampler::process(
+    const float* input,
+    int64_t frames,
+    std::vector<float>& output) {
+  for (int64_t c = 0; c < numMixed_; ++c) {
+    auto& history = history_[c];
+    auto offset = history.size();
+    history.resize(offset + frames);
+    float* dst = history.data() + offset;
+    if (numMixed_ == 1 && inChannels_ > 1) {
+      float scale = 1.0 / inChannels_;
+      std::fill(dst, dst + frames, 0);
+      for (int64_t i = 0; i < inChannels_; ++i) {
+        const float* src = input + i;
+#pragma omp simd
+        for (int64_t f = 0; f < frames; ++f) {
+          dst[f] += src[f * inChannels_];
+        }
+      }
+#pragma omp simd
+      for (int64_t f = 0; f < frames; ++f) {
+        dst[f] *= scale;
+      }
+    } else {
+      const float* src = input + (inChannels_ == 1 ? 0 : c);
+      for (int64_t f = 0; f < frames; ++f) {
+        dst[f] = src[f * inChannels_];
+      }
+    }
+  }
+  inputFrames_ += frames;
+  produce(std::numeric_limits<int64_t>::max(), output);
+}
+
+void Resampler::flush(std::vector<float>& output) {
+  // Pads the input with silence up to the last taps of the last frames
+  for (auto& history : history_) {
+    history.resize(history.size() + 2 * halfTaps_ + 1, 0);
+  }
+  produce(outputFrames(inputFrames_), output);
+}
+
+int64_t Resampler::outputFrames(int64_t frames) const {
+  return (frames * up_ + down_ - 1) / down_;
+}
+
+void Resampler::produce(int64_t end, std::vector<float>& output) {
+  int64_t historyEnd = historyStart_ + history_[0].size();
+  int64_t numTaps = 2 * halfTaps_;
+  std::vector<float> frame(numMixed_);
+  while (nextOutput_ < end) {
+    int64_t time = nextOutput_ * down_;
+    int64_t m = time / up_;
+    if (m + halfTaps_ >= historyEnd) {
+      break;
+    }
+    if (halfTaps_ == 0) {
+      for (int64_t c = 0; c < numMixed_; ++c) {
+        frame[c] = history_[c][m - historyStart_];
+      }
+    } else {
+      const float* filter = filters_.data() + (time % up_) * numTaps;
+      for (int64_t c = 0; c < numMixed_; ++c) {
+        const float* x = history_[c].data() + (m - halfTaps_ + 1) -
+            historyStart_;
+        float sum = 0;
+#pragma omp simd reduction(+ : sum)
+        for (int64_t j = 0; j < numTaps; ++j) {
+          sum += filter[j] * x[j];
+        }
+        frame[c] = sum;
+      }
+    }
+    for (int64_t c = 0; c < outChannels_; ++c) {
+      output.push_back(frame[numMixed_ == 1 ? 0 : c]);
+    }
+    ++nextOutput_;
+  }
+
+  // Drops the input which no output frame left needs
+  int64_t needed =
+      nextOutput_ * down_ / up_ - std::max<int64_t>(halfTaps_ - 1, 0);
+  int64_t drop = std::min<int64_t>(
+      std::max<int64_t>(needed - historyStart_, 0), history_[0].size());
+  if (drop > 0) {
+    for (auto& history : history_) {
+      history.erase(history.begin(), history.begin() + drop);
+    }
+    historyStart_ += drop;
+  }
+}
+
+} // namespace w2l
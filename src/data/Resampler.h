@@ -0,0 +1,69 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace w2l {
+
+/**
+ * Resampler converts a stream of interleaved frames from `inRate` Hz and
+ * `inChannels` channels to `outRate` Hz and `outChannels` channels, chunk by
+ * chunk, so that a sound is converted as it's decoded. The channels are
+ * mixed first: averaged into one, duplicated from one, or kept as they are.
+ * Then they're resampled by a polyphase windowed-sinc filter of
+ * `zeroCrossings` zero crossings each side, low-pass at the lower of the two
+ * Nyquist frequencies. The rates must have a ratio up/down, in lowest terms,
+ * with at most kMaxPhases as `up`, which is the case of the usual rates
+ * (8, 11.025, 16, 22.05, 44.1, 48 kHz, ...).
+ */
+class Resampler {
+ public:
+  static constexpr int64_t kMaxPhases = 4096;
+
+  Resampler(
+      int64_t inRate,
+      int64_t outRate,
+      int64_t inChannels,
+      int64_t outChannels,
+      int zeroCrossings = 16);
+
+  /* Converts the next `frames` frames of `input`, appended to `output` */
+  void process(const float* input, int64_t frames, std::vector<float>& output);
+
+  /* Appends the frames left once the whole input is processed */
+  void flush(std::vector<float>& output);
+
+  /* Number of frames converted from `frames` input frames, once flushed */
+  int64_t outputFrames(int64_t frames) const;
+
+ private:
+  int64_t up_;
+  int64_t down_;
+  int64_t inChannels_;
+  int64_t outChannels_;
+  // Channels resampled: 1 if they're duplicated after, else outChannels_
+  int64_t numMixed_;
+
+  // Filter of each of the `up_` phases, of 2 * halfTaps_ taps each
+  int64_t halfTaps_;
+  std::vector<float> filters_;
+
+  // Mixed input of each channel, from the input frame historyStart_ on
+  std::vector<std::vector<float>> history_;
+  int64_t historyStart_;
+  int64_t inputFrames_{0};
+  int64_t nextOutput_{0};
+
+  /* Appends the output frames [nextOutput_, end) which have their input */
+  void produce(int64_t end, std::vector<float>& output);
+};
+
+} // namespace w2l
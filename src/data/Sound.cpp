@@ -14,6 +14,9 @@
 
 #include <sndfile.h>
 
+#include "data/ObjectStore.h"
+#include "data/Resampler.h"
+
 namespace {
 
 struct EnumClassHash {
@@ -185,11 +188,11 @@ static sf_count_t sf_vio_wo_tell(void* user_data) {
 } /* extern "C" */
 
 SoundInfo loadSoundInfo(const std::string& filename) {
-  std::ifstream f(filename);
-  if (!f.is_open()) {
+  auto f = openInputStream(filename);
+  if (!*f) {
     throw std::runtime_error("could not open file for read " + filename);
   }
-  return loadSoundInfo(f);
+  return loadSoundInfo(*f);
 }
 
 SoundInfo loadSoundInfo(std::istream& f) {
@@ -221,11 +224,11 @@ SoundInfo loadSoundInfo(std::istream& f) {
 
 template <typename T>
 std::vector<T> loadSound(const std::string& filename) {
-  std::ifstream f(filename);
-  if (!f.is_open()) {
+  auto f = openInputStream(filename);
+  if (!*f) {
     throw std::runtime_error("could not open file " + filename);
   }
-  return loadSound<T>(f);
+  return loadSound<T>(*f);
 }
 
 template <typename T>
@@ -268,6 +271,104 @@ std::vector<T> loadSound(std::istream& f) {
   return in;
 }
 
+std::vector<float>
+loadSoundAs(std::istream& f, int64_t samplerate, int64_t channels) {
+  SoundReader reader(f);
+  const auto& info = reader.info();
+  if (info.samplerate == samplerate && info.channels == channels) {
+    std::vector<float> in(info.frames * info.channels);
+    if (reader.read(in.data(), info.frames) != info.frames) {
+      throw std::runtime_error("loadSoundAs: read error");
+    }
+    return in;
+  }
+  Resampler resampler(info.samplerate, samplerate, info.channels, channels);
+  std::vector<float> out;
+  out.reserve(resampler.outputFrames(info.frames) * channels);
+  const int64_t kChunkFrames = 1 << 16;
+  std::vector<float> chunk(kChunkFrames * info.channels);
+  int64_t nframe;
+  while ((nframe = reader.read(chunk.data(), kChunkFrames)) > 0) {
+    resampler.process(chunk.data(), nframe, out);
+  }
+  resampler.flush(out);
+  return out;
+}
+
+std::vector<float>
+loadSoundAs(const std::string& filename, int64_t samplerate, int64_t channels) {
+  auto f = openInputStream(filename);
+  if (!*f) {
+    throw std::runtime_error("could not open file " + filename);
+  }
+  return loadSoundAs(*f, samplerate, channels);
+}
+
+SoundReader::SoundReader(const std::string& filename)
+    : file_(openInputStream(filename)), sndfile_(nullptr) {
+  if (!*file_) {
+    throw std::runtime_error("could not open file " + filename);
+  }
+  open(*file_);
+}
+
+SoundReader::SoundReader(std::istream& f) : sndfile_(nullptr) {
+  open(f);
+}
+
+SoundReader::~SoundReader() {
+  if (sndfile_) {
+    sf_close(sndfile_);
+  }
+}
+
+void SoundReader::open(std::istream& f) {
+  SF_VIRTUAL_IO vsf = {sf_vio_ro_get_filelen,
+                       sf_vio_ro_seek,
+                       sf_vio_ro_read,
+                       sf_vio_ro_write,
+                       sf_vio_ro_tell};
+  SF_INFO info;
+  info.format = 0;
+
+  if (!(sndfile_ = sf_open_virtual(&vsf, SFM_READ, &info, &f))) {
+    throw std::runtime_error(
+        "SoundReader: unknown format or could not open stream");
+  }
+  info_.frames = info.frames;
+  info_.samplerate = info.samplerate;
+  info_.channels = info.channels;
+}
+
+template <typename T>
+int64_t SoundReader::read(T* buffer, int64_t frames) {
+  sf_count_t nframe;
+  if (std::is_same<T, float>::value) {
+    nframe = sf_readf_float(sndfile_, reinterpret_cast<float*>(buffer), frames);
+  } else if (std::is_same<T, double>::value) {
+    nframe =
+        sf_readf_double(sndfile_, reinterpret_cast<double*>(buffer), frames);
+  } else if (std::is_same<T, int>::value) {
+    nframe = sf_readf_int(sndfile_, reinterpret_cast<int*>(buffer), frames);
+  } else if (std::is_same<T, short>::value) {
+    nframe = sf_readf_short(sndfile_, reinterpret_cast<short*>(buffer), frames);
+  } else {
+    throw std::logic_error("SoundReader: called with unsupported T");
+  }
+  if (nframe < 0 || sf_error(sndfile_) != SF_ERR_NO_ERROR) {
+    throw std::runtime_error("SoundReader: read error");
+  }
+  return nframe;
+}
+
+template <typename T>
+std::vector<T> SoundReader::readChunk(int64_t frames) {
+  std::vector<T> chunk(frames * info_.channels);
+  auto nframe = read(chunk.data(), frames);
+  chunk.resize(nframe * info_.channels);
+  return chunk;
+}
+
 template <typename T>
 void saveSound(
     const std::string& filename,
@@ -372,6 +473,16 @@ template std::vector<double> w2l::loadSound<double>(std::istream&);
 template std::vector<int> w2l::loadSound<int>(std::istream&);
 template std::vector<short> w2l::loadSound<short>(std::istream&);
 
+template int64_t w2l::SoundReader::read(float*, int64_t);
+template int64_t w2l::SoundReader::read(double*, int64_t);
+template int64_t w2l::SoundReader::read(int*, int64_t);
+template int64_t w2l::SoundReader::read(short*, int64_t);
+
+template std::vector<float> w2l::SoundReader::readChunk<float>(int64_t);
+template std::vector<double> w2l::SoundReader::readChunk<double>(int64_t);
+template std::vector<int> w2l::SoundReader::readChunk<int>(int64_t);
+template std::vector<short> w2l::SoundReader::readChunk<short>(int64_t);
+
 template void w2l::saveSound(
     const std::string&,
     const std::vector<float>&,
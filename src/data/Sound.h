@@ -9,9 +9,14 @@
 #pragma once
 
 #include <cstdint>
+#include <fstream>
 #include <istream>
+#include <memory>
+#include <string>
 #include <vector>
 
+struct SNDFILE_tag;
+
 namespace w2l {
 
 enum class SoundFormat {
@@ -74,6 +79,8 @@ struct SoundInfo {
   int64_t channels;
 };
 
+// The files may also be objects at http(s)://, s3:// or gs:// URLs, read
+// through ObjectStore::get()
 SoundInfo loadSoundInfo(std::istream& f);
 SoundInfo loadSoundInfo(const std::string& filename);
 
@@ -82,6 +89,56 @@ std::vector<T> loadSound(std::istream& f);
 template <typename T>
 std::vector<T> loadSound(const std::string& filename);
 
+/**
+ * Loads a sound at `samplerate` Hz with `channels` channels, whatever the
+ * ones it's stored with: it's then downmixed and resampled by a Resampler
+ * chunk by chunk as it's decoded.
+ */
+std::vector<float>
+loadSoundAs(std::istream& f, int64_t samplerate, int64_t channels);
+std::vector<float>
+loadSoundAs(const std::string& filename, int64_t samplerate, int64_t channels);
+
+/**
+ * SoundReader decodes a sound chunk by chunk, so that a long recording is
+ * processed with a bounded amount of memory. The frames hold the samples of
+ * the channels interleaved, as the ones returned by loadSound().
+ */
+class SoundReader {
+ public:
+  explicit SoundReader(const std::string& filename);
+
+  // `f` must outlive the reader
+  explicit SoundReader(std::istream& f);
+
+  ~SoundReader();
+
+  SoundReader(const SoundReader&) = delete;
+  SoundReader& operator=(const SoundReader&) = delete;
+
+  const SoundInfo& info() const {
+    return info_;
+  }
+
+  /*
+   * Decodes the next `frames` frames, or the ones left if fewer, into
+   * `buffer`. Returns the number of frames decoded, which is 0 at the end.
+   */
+  template <typename T>
+  int64_t read(T* buffer, int64_t frames);
+
+  /* Returns the next `frames` frames, or the ones left if fewer */
+  template <typename T>
+  std::vector<T> readChunk(int64_t frames);
+
+ private:
+  std::unique_ptr<std::istream> file_;
+  SNDFILE_tag* sndfile_;
+  SoundInfo info_;
+
+  void open(std::istream& f);
+};
+
 template <typename T>
 void saveSound(
     std::ostream& f,
@@ -0,0 +1,153 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "data/SpecAugmentStage.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+
+#include "libraries/common/Utils.h"
+
+namespace w2l {
+
+namespace {
+
+/* Uniform in [low, high) */
+int randomInt(std::mt19937& rng, int low, int high) {
+  std::uniform_int_distribution<int> uniformDist(low, high - 1);
+  return uniformDist(rng);
+}
+
+} // namespace
+
+SpecAugmentStage::SpecAugmentStage(
+    int tWarpW,
+    int fMaskF,
+    int nFMask,
+    int tMaskT,
+    float tMaskP,
+    int nTMask,
+    bool globalMean /* = false */)
+    : timeWarpW_(tWarpW),
+      freqMaskF_(fMaskF),
+      numFreqMask_(nFMask),
+      timeMaskT_(tMaskT),
+      timeMaskP_(tMaskP),
+      numTimeMask_(nTMask),
+      globalMean_(globalMean) {
+  if (numFreqMask_ > 0 && freqMaskF_ <= 0) {
+    throw std::invalid_argument("invalid arguments for frequency masking.");
+  }
+  if (numTimeMask_ > 0 && timeMaskT_ <= 0) {
+    throw std::invalid_argument("invalid arguments for time masking.");
+  }
+  if (numTimeMask_ > 0 && (timeMaskP_ <= 0 || timeMaskP_ > 1.0)) {
+    throw std::invalid_argument("invalid arguments for time masking.");
+  }
+}
+
+SpecAugmentStage SpecAugmentStage::fromString(const std::string& policy) {
+  auto params = splitOnWhitespace(policy, true);
+  if (params.size() != 6 && params.size() != 7) {
+    throw std::invalid_argument("invalid SpecAugment policy: " + policy);
+  }
+  return SpecAugmentStage(
+      std::stoi(params[0]),
+      std::stoi(params[1]),
+      std::stoi(params[2]),
+      std::stoi(params[3]),
+      std::stof(params[4]),
+      std::stoi(params[5]),
+      params.size() == 7 && std::stoi(params[6]) != 0);
+}
+
+void SpecAugmentStage::apply(
+    std::vector<float>& input,
+    const af::dim4& dims,
+    uint64_t seed) const {
+  int64_t numTimeSteps = dims[0]; // number of time steps
+  int64_t numFreqChans = dims[1]; // number of frequency channels
+  int64_t numChannels = dims[2];
+  int64_t batchSz = dims[3];
+  if (input.size() != dims.elements()) {
+    throw std::invalid_argument("SpecAugmentStage: invalid input dims");
+  }
+  if (numFreqChans < freqMaskF_) {
+    throw std::runtime_error("Invalid input frequency channels");
+  }
+  if (input.empty()) {
+    return;
+  }
+
+  float replaceVal = globalMean_
+      ? std::accumulate(input.begin(), input.end(), 0.0) / input.size()
+      : 0.0;
+  // an upper bound on the time mask
+  int T = std::min(timeMaskT_, static_cast<int>(numTimeSteps * timeMaskP_));
+  bool warp = timeWarpW_ > 0 && numTimeSteps > 2 * timeWarpW_;
+
+  std::mt19937 rng(seed);
+  std::vector<float> srcPos(numTimeSteps), column(numTimeSteps);
+  int64_t sampleSz = numTimeSteps * numFreqChans * numChannels;
+  for (int64_t b = 0; b < batchSz; ++b) {
+    float* sample = input.data() + b * sampleSz;
+
+    if (warp) {
+      // Moves the frame w0 to w0 + w: [0, dest] is stretched onto [0, w0] and
+      // [dest, last] onto [w0, last]
+      int64_t w0 = randomInt(rng, timeWarpW_, numTimeSteps - timeWarpW_);
+      int64_t w = randomInt(rng, -timeWarpW_, timeWarpW_ + 1);
+      int64_t dest = w0 + w;
+      int64_t last = numTimeSteps - 1;
+      for (int64_t t = 0; t < numTimeSteps; ++t) {
+        srcPos[t] = t < dest
+            ? static_cast<float>(t) * w0 / std::max<int64_t>(dest, 1)
+            : w0 +
+                static_cast<float>(t - dest) * (last - w0) /
+                    std::max<int64_t>(last - dest, 1);
+      }
+      for (int64_t col = 0; col < numFreqChans * numChannels; ++col) {
+        float* frames = sample + col * numTimeSteps;
+        std::copy(frames, frames + numTimeSteps, column.begin());
+        for (int64_t t = 0; t < numTimeSteps; ++t) {
+          auto lo = std::min<int64_t>(std::floor(srcPos[t]), last);
+          auto hi = std::min<int64_t>(lo + 1, last);
+          float frac = srcPos[t] - lo;
+          frames[t] = (1 - frac) * column[lo] + frac * column[hi];
+        }
+      }
+    }
+
+    for (int i = 0; i < numFreqMask_; ++i) {
+      auto f = randomInt(rng, 0, freqMaskF_);
+      auto f0 = randomInt(rng, 0, numFreqChans - f);
+      for (int64_t c = 0; c < numChannels; ++c) {
+        for (int64_t fr = f0; fr <= f0 + f; ++fr) {
+          float* frames = sample + (c * numFreqChans + fr) * numTimeSteps;
+          std::fill(frames, frames + numTimeSteps, replaceVal);
+        }
+      }
+    }
+
+    if (T > 0) {
+      for (int i = 0; i < numTimeMask_; ++i) {
+        auto t = randomInt(rng, 0, T);
+        auto t0 = randomInt(rng, 0, numTimeSteps - t);
+        for (int64_t col = 0; col < numFreqChans * numChannels; ++col) {
+          float* frames = sample + col * numTimeSteps;
+          std::fill(frames + t0, frames + t0 + t + 1, replaceVal);
+        }
+      }
+    }
+  }
+}
+
+} // namespace w2l
@@ -0,0 +1,60 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <arrayfire.h>
+
+namespace w2l {
+
+/**
+ * SpecAugment (see module/SpecAugment.h) of the features of a batch on the
+ * CPU, so that the data threads augment the next batches while the device
+ * runs the current one. It draws the same random warps and masks as the SAUG
+ * layer, independently for each sample, and replaces the masked features by 0
+ * or by the mean of the batch.
+ */
+class SpecAugmentStage {
+ public:
+  SpecAugmentStage(
+      int tWarpW,
+      int fMaskF,
+      int nFMask,
+      int tMaskT,
+      float tMaskP,
+      int nTMask,
+      bool globalMean = false);
+
+  /**
+   * Parses "tWarpW fMaskF nFMask tMaskT tMaskP nTMask [globalMean]", the
+   * arguments of the SAUG layer followed by an optional 0/1 masking strategy
+   */
+  static SpecAugmentStage fromString(const std::string& policy);
+
+  /**
+   * Augments `input`, FRAMES x FEAT x CHANNELS x BATCHSZ (Col Major), as
+   * featurize() returns it. The draws only depend on `seed`.
+   */
+  void apply(std::vector<float>& input, const af::dim4& dims, uint64_t seed)
+      const;
+
+ private:
+  int timeWarpW_;
+  int freqMaskF_;
+  int numFreqMask_;
+  int timeMaskT_;
+  float timeMaskP_;
+  int numTimeMask_;
+  bool globalMean_;
+};
+
+} // namespace w2l
@@ -0,0 +1,175 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "data/SpeedPerturbStage.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <stdexcept>
+
+#include "data/Resampler.h"
+#include "libraries/common/Utils.h"
+
+namespace w2l {
+
+namespace {
+
+// The factors are drawn by hundredths, so that a speed factor is a ratio of
+// rates Resampler supports
+constexpr int kFactorSteps = 100;
+
+// Window of TEMPO, and the largest shift of a window, in ms
+constexpr double kWindowMs = 20;
+constexpr double kToleranceMs = 5;
+
+} // namespace
+
+SpeedPerturbStage::SpeedPerturbStage(
+    Mode mode,
+    double minFactor,
+    double maxFactor,
+    int64_t sampleRate,
+    int64_t channels)
+    : mode_(mode),
+      minSteps_(std::ceil(minFactor * kFactorSteps - 1e-6)),
+      maxSteps_(std::floor(maxFactor * kFactorSteps + 1e-6)),
+      channels_(channels) {
+  if (minSteps_ <= 0 || minSteps_ > maxSteps_) {
+    throw std::invalid_argument(
+        "SpeedPerturbStage: invalid factors, they must be positive and at "
+        "least 0.01 apart or equal");
+  }
+  if (sampleRate <= 0 || channels_ <= 0) {
+    throw std::invalid_argument("SpeedPerturbStage: invalid audio format");
+  }
+  // An even number of frames, so that the window is 2 hops
+  int64_t windowSize = 2 * std::lround(sampleRate * kWindowMs / 2000);
+  if (mode_ == Mode::TEMPO) {
+    windowSize = std::max<int64_t>(windowSize, 4);
+    const double pi = std::acos(-1);
+    window_.resize(windowSize);
+    for (int64_t i = 0; i < windowSize; ++i) {
+      window_[i] = 0.5 - 0.5 * std::cos(2 * pi * i / windowSize);
+    }
+  }
+}
+
+SpeedPerturbStage SpeedPerturbStage::fromString(
+    const std::string& policy,
+    int64_t sampleRate,
+    int64_t channels) {
+  auto params = splitOnWhitespace(policy, true);
+  if (params.size() != 3 || (params[0] != "speed" && params[0] != "tempo")) {
+    throw std::invalid_argument("invalid speed perturbation: " + policy);
+  }
+  return SpeedPerturbStage(
+      params[0] == "speed" ? Mode::SPEED : Mode::TEMPO,
+      std::stod(params[1]),
+      std::stod(params[2]),
+      sampleRate,
+      channels);
+}
+
+void SpeedPerturbStage::apply(std::vector<W2lLoaderData>& batch, uint64_t seed)
+    const {
+  std::mt19937_64 rng(seed);
+  std::uniform_int_distribution<int> draw(minSteps_, maxSteps_);
+  for (auto& sample : batch) {
+    int steps = draw(rng);
+    if (steps == kFactorSteps || sample.input.empty()) {
+      continue;
+    }
+    sample.input = mode_ == Mode::SPEED ? resample(sample.input, steps)
+                                        : stretch(sample.input, steps);
+  }
+}
+
+std::vector<float> SpeedPerturbStage::perturb(
+    const std::vector<float>& audio,
+    double factor) const {
+  int steps = std::lround(factor * kFactorSteps);
+  if (steps <= 0) {
+    throw std::invalid_argument("SpeedPerturbStage: invalid factor");
+  }
+  if (steps == kFactorSteps || audio.empty()) {
+    return audio;
+  }
+  return mode_ == Mode::SPEED ? resample(audio, steps) : stretch(audio, steps);
+}
+
+std::vector<float> SpeedPerturbStage::resample(
+    const std::vector<float>& audio,
+    int steps) const {
+  // Played `steps` / kFactorSteps times faster, the audio has that many
+  // times its rate
+  Resampler resampler(steps, kFactorSteps, channels_, channels_);
+  int64_t frames = audio.size() / channels_;
+  std::vector<float> output;
+  output.reserve(resampler.outputFrames(frames) * channels_);
+  resampler.process(audio.data(), frames, output);
+  resampler.flush(output);
+  return output;
+}
+
+std::vector<float> SpeedPerturbStage::stretch(
+    const std::vector<float>& audio,
+    int steps) const {
+  const int64_t C = channels_;
+  const int64_t frames = audio.size() / C;
+  const int64_t windowSize = window_.size();
+  const int64_t hop = windowSize / 2;
+  const int64_t tolerance = std::lround(hop * kToleranceMs * 2 / kWindowMs);
+  const int64_t outFrames = frames * kFactorSteps / steps;
+  if (frames < windowSize) {
+    return resample(audio, steps); // too short to find a continuation
+  }
+
+  // The window k is added at the output frame k * hop. It's read from around
+  // the input frame k * hop * factor, at the shift whose first half best
+  // matches the input which followed the previous window.
+  std::vector<float> output((outFrames + windowSize) * C, 0);
+  int64_t prevStart = 0;
+  for (int64_t k = 0; k * hop < outFrames; ++k) {
+    int64_t nominal =
+        std::min(k * hop * steps / kFactorSteps, frames - windowSize);
+    int64_t start = nominal;
+    if (k > 0) {
+      const float* natural = audio.data() + (prevStart + hop) * C;
+      double bestScore = -std::numeric_limits<double>::infinity();
+      int64_t first = std::max<int64_t>(nominal - tolerance, 0);
+      int64_t last = std::min(nominal + tolerance, frames - windowSize);
+      for (int64_t candidate = first; candidate <= last; ++candidate) {
+        const float* x = audio.data() + candidate * C;
+        float score = 0;
+        for (int64_t i = 0; i < hop * C; ++i) {
+          score += x[i] * natural[i];
+        }
+        if (score > bestScore) {
+          bestScore = score;
+          start = candidate;
+        }
+      }
+    }
+    const float* x = audio.data() + start * C;
+    float* y = output.data() + k * hop * C;
+    for (int64_t i = 0; i < windowSize; ++i) {
+      // Nothing overlaps the first half of the first window
+      float weight = k == 0 && i < hop ? 1.0f : window_[i];
+      for (int64_t c = 0; c < C; ++c) {
+        y[i * C + c] += weight * x[i * C + c];
+      }
+    }
+    prevStart = start;
+  }
+  output.resize(outFrames * C);
+  return output;
+}
+
+} // namespace w2l
@@ -0,0 +1,73 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "data/Featurize.h"
+
+namespace w2l {
+
+/**
+ * Speed or tempo perturbation of the audio of a batch on the CPU, between its
+ * loading and featurize(), so that the data threads perturb each sample with
+ * a new random factor every time it's read instead of reading perturbed
+ * copies of the corpus. The factor of a sample is drawn uniformly among the
+ * multiples of 0.01 in [minFactor, maxFactor]:
+ *
+ * - SPEED plays the audio `factor` times faster, shifting its pitch too: it
+ *   is resampled by the polyphase filter of Resampler;
+ * - TEMPO makes it `factor` times faster at the same pitch (WSOLA): windows
+ *   of 20ms read `factor` times their hop apart are overlap-added, each one
+ *   shifted by up to 5ms to best continue the previous one.
+ *
+ * The audio is FRAMES x `channels` interleaved, as loadSound() returns it.
+ */
+class SpeedPerturbStage {
+ public:
+  enum class Mode { SPEED, TEMPO };
+
+  SpeedPerturbStage(
+      Mode mode,
+      double minFactor,
+      double maxFactor,
+      int64_t sampleRate,
+      int64_t channels);
+
+  /* Parses "speed|tempo minFactor maxFactor" */
+  static SpeedPerturbStage fromString(
+      const std::string& policy,
+      int64_t sampleRate,
+      int64_t channels);
+
+  /* Perturbs the inputs of `batch`. The draws only depend on `seed`. */
+  void apply(std::vector<W2lLoaderData>& batch, uint64_t seed) const;
+
+  /* `audio` made `factor` times faster, `factor` rounded to 0.01 */
+  std::vector<float> perturb(const std::vector<float>& audio, double factor)
+      const;
+
+ private:
+  Mode mode_;
+  // The factors in hundredths
+  int minSteps_;
+  int maxSteps_;
+  int64_t channels_;
+  // Hann window of TEMPO, whose halves add up to 1
+  std::vector<float> window_;
+
+  std::vector<float> resample(const std::vector<float>& audio, int steps)
+      const;
+
+  std::vector<float> stretch(const std::vector<float>& audio, int steps) const;
+};
+
+} // namespace w2l
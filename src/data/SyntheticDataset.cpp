@@ -0,0 +1,125 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "data/SyntheticDataset.h"
+
+#include <algorithm>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+#include "common/Defines.h"
+
+namespace w2l {
+
+SyntheticDataset::SyntheticDataset(
+    const DictionaryMap& dicts,
+    int64_t numSamples,
+    int64_t numFeatures,
+    int64_t minFrames,
+    int64_t maxFrames,
+    double framesPerToken,
+    int64_t batchSize,
+    int worldRank /* = 0 */,
+    int worldSize /* = 1 */,
+    int seed /* = 0 */)
+    : W2lDataset(dicts, batchSize, worldRank, worldSize),
+      numFeatures_(numFeatures),
+      framesPerToken_(framesPerToken) {
+  if (numSamples < 1 || numFeatures < 1 || minFrames < 1 ||
+      maxFrames < minFrames || framesPerToken <= 0) {
+    throw std::invalid_argument("SyntheticDataset: invalid sample shapes");
+  }
+  auto dict = dicts.find(kTargetIdx);
+  if (dict == dicts.end()) {
+    throw std::invalid_argument("SyntheticDataset: no token dictionary");
+  }
+  // The blank and the end of sentence, appended last, aren't drawn
+  numTokens_ = dict->second.indexSize();
+  if (dict->second.contains(kEosToken)) {
+    --numTokens_;
+  }
+  if (dict->second.contains(kBlankToken)) {
+    --numTokens_;
+  }
+  if (numTokens_ < 1) {
+    throw std::invalid_argument("SyntheticDataset: no tokens to draw");
+  }
+  targetPadValue_ = FLAGS_eostoken ? dict->second.getIndex(kEosToken)
+                                   : kTargetPadValue;
+
+  std::mt19937 gen(seed);
+  std::uniform_int_distribution<int64_t> frames(minFrames, maxFrames);
+  sampleFrames_.resize(numSamples);
+  for (auto& f : sampleFrames_) {
+    f = frames(gen);
+  }
+  std::sort(sampleFrames_.begin(), sampleFrames_.end());
+  sampleCount_ = numSamples;
+  sampleDurations_.resize(numSamples);
+  for (int64_t i = 0; i < numSamples; ++i) {
+    sampleDurations_[i] = sampleFrames_[i] * FLAGS_framestridems;
+  }
+
+  shuffle(-1);
+}
+
+SyntheticDataset::~SyntheticDataset() {
+  prefetcher_ = nullptr; // join all threads
+}
+
+std::vector<af::array> SyntheticDataset::get(const int64_t idx) const {
+  checkIndexBounds(idx);
+
+  const auto& batch = sampleBatches_[idx];
+  int64_t B = batch.size();
+  std::vector<int> frames(B), tokens(B);
+  int64_t maxFrames = 0, maxTokens = 0;
+  for (int64_t b = 0; b < B; ++b) {
+    frames[b] = sampleFrames_[batch[b]];
+    tokens[b] = std::max<int>(1, frames[b] / framesPerToken_);
+    maxFrames = std::max<int64_t>(maxFrames, frames[b]);
+    maxTokens = std::max<int64_t>(maxTokens, tokens[b]);
+  }
+
+  std::vector<af::array> result(kNumDataIdx);
+  // T x K x 1 x B, zero past the end of each sample
+  auto frameMask = af::range(af::dim4(maxFrames, 1, 1, B)) <
+      af::tile(af::moddims(af::array(B, frames.data()), 1, 1, 1, B), maxFrames);
+  result[kInputIdx] = af::randn(maxFrames, numFeatures_, 1, B) *
+      af::tile(frameMask.as(f32), 1, numFeatures_);
+
+  // L x B, padded as featurize() pads the targets
+  auto tokenMask = af::range(af::dim4(maxTokens, B)) <
+      af::tile(af::moddims(af::array(B, tokens.data()), 1, B), maxTokens);
+  auto labels =
+      af::floor(af::randu(maxTokens, B) * (numTokens_ - 1e-3)).as(s32);
+  result[kTargetIdx] = af::select(tokenMask, labels, targetPadValue_);
+  result[kWordIdx] = af::array(af::dim4(0, B), s32);
+
+  // The ids are packed as featurize() packs them
+  std::vector<std::string> ids(B);
+  size_t maxIdLen = 0;
+  for (int64_t b = 0; b < B; ++b) {
+    ids[b] = "synthetic-" + std::to_string(batch[b]);
+    maxIdLen = std::max(maxIdLen, ids[b].size());
+  }
+  std::vector<int> idChars(maxIdLen * B, -1);
+  for (int64_t b = 0; b < B; ++b) {
+    std::copy(ids[b].begin(), ids[b].end(), idChars.begin() + maxIdLen * b);
+  }
+  result[kSampleIdx] = af::array(maxIdLen, B, idChars.data());
+  return result;
+}
+
+std::vector<W2lLoaderData> SyntheticDataset::getLoaderData(
+    const int64_t /* idx */) const {
+  throw std::logic_error(
+      "SyntheticDataset: the batches are only generated by get()");
+}
+} // namespace w2l
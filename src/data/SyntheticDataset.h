@@ -0,0 +1,54 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "data/W2lDataset.h"
+
+namespace w2l {
+
+/**
+ * Dataset of random batches generated on the device, to measure the
+ * throughput of the training loop without loading, featurizing or copying
+ * any data. The samples have between `minFrames` and `maxFrames` frames of
+ * `numFeatures` features, drawn uniformly once, and one random token every
+ * `framesPerToken` frames. They are sorted by length and batched like the
+ * samples of the other datasets, so that the batches are padded as theirs.
+ */
+class SyntheticDataset : public W2lDataset {
+ public:
+  SyntheticDataset(
+      const DictionaryMap& dicts,
+      int64_t numSamples,
+      int64_t numFeatures,
+      int64_t minFrames,
+      int64_t maxFrames,
+      double framesPerToken,
+      int64_t batchSize,
+      int worldRank = 0,
+      int worldSize = 1,
+      int seed = 0);
+
+  ~SyntheticDataset() override;
+
+  std::vector<af::array> get(const int64_t idx) const override;
+
+  /* Throws, the batches are generated on the device by get() */
+  virtual std::vector<W2lLoaderData> getLoaderData(
+      const int64_t idx) const override;
+
+ private:
+  int64_t numFeatures_;
+  double framesPerToken_;
+  int64_t numTokens_;
+  int targetPadValue_;
+  std::vector<int64_t> sampleFrames_;
+};
+} // namespace w2l
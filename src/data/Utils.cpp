@@ -8,78 +8,239 @@
 
 #include "data/Utils.h"
 
+#include <functional>
+#include <stdexcept>
+#include <thread>
+
 namespace w2l {
 
+namespace {
+
+// Samples per thread below which sorting and filtering use fewer threads
+constexpr size_t kMinSamplesPerThread = 1 << 16;
+
+size_t numThreadsFor(size_t numSamples) {
+  return std::min<size_t>(
+      std::max(std::thread::hardware_concurrency(), 1u),
+      numSamples / kMinSamplesPerThread + 1);
+}
+
+/* Calls fn(begin, end) on `numThreads` consecutive chunks of [0, n) */
+template <class Fn>
+void parallelChunks(size_t n, size_t numThreads, const Fn& fn) {
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < numThreads; ++i) {
+    threads.emplace_back(fn, n * i / numThreads, n * (i + 1) / numThreads);
+  }
+  fn(0, n / numThreads);
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+// The order of a sample: its keys, then its position, so that the order is
+// the same whatever the number of threads
+struct SortKey {
+  double first;
+  double second;
+  int64_t position;
+
+  bool operator<(const SortKey& other) const {
+    if (first != other.first) {
+      return first < other.first;
+    }
+    if (second != other.second) {
+      return second < other.second;
+    }
+    return position < other.position;
+  }
+};
+
+/* Sorts chunks of `keys` in parallel, then merges them in parallel rounds */
+void parallelSort(std::vector<SortKey>& keys) {
+  size_t n = keys.size();
+  size_t numThreads = numThreadsFor(n);
+  std::vector<size_t> bounds;
+  for (size_t i = 0; i <= numThreads; ++i) {
+    bounds.push_back(n * i / numThreads);
+  }
+  parallelChunks(n, numThreads, [&keys](size_t begin, size_t end) {
+    std::sort(keys.begin() + begin, keys.begin() + end);
+  });
+  while (bounds.size() > 2) {
+    std::vector<size_t> merged;
+    std::vector<std::thread> threads;
+    size_t i = 0;
+    for (; i + 2 < bounds.size(); i += 2) {
+      size_t begin = bounds[i], middle = bounds[i + 1], end = bounds[i + 2];
+      threads.emplace_back([&keys, begin, middle, end]() {
+        std::inplace_merge(
+            keys.begin() + begin, keys.begin() + middle, keys.begin() + end);
+      });
+      merged.push_back(begin);
+    }
+    if (i + 1 < bounds.size()) {
+      merged.push_back(bounds[i]); // an odd run, merged in a next round
+    }
+    merged.push_back(n);
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    bounds = std::move(merged);
+  }
+}
+
+} // namespace
+
+constexpr size_t SpeechSampleStore::kNumIndexArrays;
+
+SpeechSampleStore::SpeechSampleStore() : textOffsets_{0}, wordOffsets_{0} {
+  syncColumns();
+}
+
+void SpeechSampleStore::add(
+    const std::string& sampleId,
+    const std::string& audioFile,
+    const std::vector<std::string>& transcript) {
+  if (index_) {
+    throw std::logic_error("SpeechSampleStore: can't add to an index");
+  }
+  arena_ += sampleId;
+  textOffsets_.push_back(arena_.size());
+  arena_ += audioFile;
+  textOffsets_.push_back(arena_.size());
+  for (const auto& word : transcript) {
+    if (!words_.contains(word)) {
+      words_.addEntry(word);
+    }
+    wordIndices_.push_back(words_.getIndex(word));
+  }
+  wordOffsets_.push_back(wordIndices_.size());
+  syncColumns();
+}
+
+std::vector<std::string> SpeechSampleStore::getTranscript(int64_t idx) const {
+  const auto& offsets = columns_.wordOffsets;
+  std::vector<std::string> transcript;
+  transcript.reserve(offsets[idx + 1] - offsets[idx]);
+  for (auto w = offsets[idx]; w < offsets[idx + 1]; ++w) {
+    transcript.push_back(words_.getEntry(columns_.wordIndices[w]));
+  }
+  return transcript;
+}
+
+void SpeechSampleStore::shrinkToFit() {
+  arena_.shrink_to_fit();
+  textOffsets_.shrink_to_fit();
+  wordIndices_.shrink_to_fit();
+  wordOffsets_.shrink_to_fit();
+  syncColumns();
+}
+
+void SpeechSampleStore::write(DatasetIndex::Writer& writer) const {
+  // The words, by index, as a char arena and offsets
+  std::string words;
+  std::vector<int64_t> wordEnds;
+  for (size_t w = 0; w < words_.entrySize(); ++w) {
+    words += words_.getEntry(w);
+    wordEnds.push_back(words.size());
+  }
+  writer.add(words.data(), words.size());
+  writer.add(wordEnds);
+  writer.add(columns_.arena.data, columns_.arena.size);
+  writer.add(columns_.textOffsets.data, columns_.textOffsets.size);
+  writer.add(columns_.wordIndices.data, columns_.wordIndices.size);
+  writer.add(columns_.wordOffsets.data, columns_.wordOffsets.size);
+}
+
+void SpeechSampleStore::attach(
+    std::shared_ptr<DatasetIndex> index,
+    size_t first) {
+  auto words = index->array<char>(first);
+  auto wordEnds = index->array<int64_t>(first + 1);
+  words_ = Dictionary();
+  for (size_t w = 0; w < wordEnds.size; ++w) {
+    words_.addEntry(std::string(
+        words.data + (w > 0 ? wordEnds[w - 1] : 0), words.data + wordEnds[w]));
+  }
+  columns_.arena = index->array<char>(first + 2);
+  columns_.textOffsets = index->array<int64_t>(first + 3);
+  columns_.wordIndices = index->array<int>(first + 4);
+  columns_.wordOffsets = index->array<int64_t>(first + 5);
+  if (columns_.wordOffsets.size < 1 ||
+      columns_.textOffsets.size != 2 * columns_.wordOffsets.size - 1) {
+    throw std::runtime_error("SpeechSampleStore: invalid index");
+  }
+  std::string().swap(arena_);
+  std::vector<int64_t>().swap(textOffsets_);
+  std::vector<int>().swap(wordIndices_);
+  std::vector<int64_t>().swap(wordOffsets_);
+  index_ = std::move(index);
+}
+
+void SpeechSampleStore::syncColumns() {
+  columns_.arena = ArrayView<char>(arena_.data(), arena_.size());
+  columns_.textOffsets = ArrayView<int64_t>(textOffsets_);
+  columns_.wordIndices = ArrayView<int>(wordIndices_);
+  columns_.wordOffsets = ArrayView<int64_t>(wordOffsets_);
+}
+
 std::vector<int64_t> sortSamples(
     const std::vector<SpeechSampleMetaInfo>& samples,
     const std::string& dataorder,
     const int64_t inputbinsize,
     const int64_t outputbinsize) {
-  std::vector<int64_t> sortedIndices(samples.size());
-  std::iota(sortedIndices.begin(), sortedIndices.end(), 0);
+  // The comparisons of the orders, as keys computed once per sample
+  std::function<SortKey(const SpeechSampleMetaInfo&)> key;
   if (dataorder.compare("input_spiral") == 0) {
     // Sort samples in increasing order of output bins. For samples in the same
     // output bin, sorting is done based on input size in alternating manner
     // (spiral) for consecutive bins.
     VLOG(1) << "Doing data ordering by input_spiral";
-    std::sort(
-        sortedIndices.begin(),
-        sortedIndices.end(),
-        [&](int64_t i1, int64_t i2) {
-          auto& s1 = samples[i1];
-          auto& s2 = samples[i2];
-          auto s1_y = s1.reflength() / outputbinsize;
-          auto s2_y = s2.reflength() / outputbinsize;
-          if (s1_y != s2_y) {
-            return s1_y < s2_y;
-          }
-          if (s1_y % 2 == 0) {
-            return s1.audiolength() < s2.audiolength();
-          } else {
-            return s2.audiolength() < s1.audiolength();
-          }
-        });
+    key = [outputbinsize](const SpeechSampleMetaInfo& s) {
+      auto y = s.reflength() / outputbinsize;
+      return SortKey{static_cast<double>(y),
+                     y % 2 == 0 ? s.audiolength() : -s.audiolength(),
+                     0};
+    };
   } else if (dataorder.compare("output_spiral") == 0) {
     // Sort samples in increasing order of input bins. For samples in the same
     // input bin, sorting is done based on output size in alternating manner
     // (spiral) for consecutive bins.
     VLOG(1) << "Doing data ordering by output_spiral";
-    std::sort(
-        sortedIndices.begin(),
-        sortedIndices.end(),
-        [&](int64_t i1, int64_t i2) {
-          auto& s1 = samples[i1];
-          auto& s2 = samples[i2];
-          int s1_x = s1.audiolength() / inputbinsize;
-          int s2_x = s2.audiolength() / inputbinsize;
-          if (s1_x != s2_x) {
-            return s1_x < s2_x;
-          }
-          if (s1_x % 2 == 0) {
-            return s1.reflength() < s2.reflength();
-          } else {
-            return s2.reflength() < s1.reflength();
-          }
-        });
+    key = [inputbinsize](const SpeechSampleMetaInfo& s) {
+      int x = s.audiolength() / inputbinsize;
+      auto reflength = static_cast<double>(s.reflength());
+      return SortKey{
+          static_cast<double>(x), x % 2 == 0 ? reflength : -reflength, 0};
+    };
   } else if (dataorder.compare("input") == 0) {
     // Sort by input size
     VLOG(1) << "Doing data ordering by input";
-    std::sort(
-        sortedIndices.begin(),
-        sortedIndices.end(),
-        [&](int64_t i1, int64_t i2) {
-          auto& s1 = samples[i1];
-          auto& s2 = samples[i2];
-          return s1.audiolength() < s2.audiolength();
-        });
+    key = [](const SpeechSampleMetaInfo& s) {
+      return SortKey{s.audiolength(), 0, 0};
+    };
   } // Default is no sorting.
 
-  std::vector<int64_t> sortedSampleIndices(samples.size());
-  for (size_t i = 0; i < sortedSampleIndices.size(); ++i) {
-    sortedSampleIndices[i] = samples[sortedIndices[i]].index();
+  size_t n = samples.size();
+  std::vector<SortKey> keys(n);
+  parallelChunks(n, numThreadsFor(n), [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      keys[i] = key ? key(samples[i]) : SortKey{0, 0, 0};
+      keys[i].position = i;
+    }
+  });
+  if (key) {
+    parallelSort(keys);
+  }
+
+  std::vector<int64_t> sortedSampleIndices(n);
+  for (size_t i = 0; i < n; ++i) {
+    sortedSampleIndices[i] = samples[keys[i].position].index();
   }
   return sortedSampleIndices;
 }
+
 void filterSamples(
     std::vector<SpeechSampleMetaInfo>& samples,
     const int64_t minInputSz,
@@ -87,18 +248,26 @@ void filterSamples(
     const int64_t minTargetSz,
     const int64_t maxTargetSz) {
   auto initialSize = samples.size();
-  samples.erase(
-      std::remove_if(
-          samples.begin(),
-          samples.end(),
-          [minInputSz, maxInputSz, minTargetSz, maxTargetSz](
-              const SpeechSampleMetaInfo& sample) {
-            return sample.audiolength() < minInputSz ||
-                sample.audiolength() > maxInputSz ||
-                sample.reflength() < minTargetSz ||
-                sample.reflength() > maxTargetSz;
-          }),
-      samples.end());
+  // The samples are tested in parallel, and the kept ones moved in order
+  std::vector<char> keep(initialSize);
+  parallelChunks(
+      initialSize, numThreadsFor(initialSize), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+          const auto& sample = samples[i];
+          keep[i] = !(
+              sample.audiolength() < minInputSz ||
+              sample.audiolength() > maxInputSz ||
+              sample.reflength() < minTargetSz ||
+              sample.reflength() > maxTargetSz);
+        }
+      });
+  size_t kept = 0;
+  for (size_t i = 0; i < initialSize; ++i) {
+    if (keep[i]) {
+      samples[kept++] = std::move(samples[i]);
+    }
+  }
+  samples.resize(kept);
   LOG(INFO) << "Filtered " << initialSize - samples.size() << "/" << initialSize
             << " samples";
 }
@@ -14,6 +14,9 @@
 
 #include <glog/logging.h>
 
+#include "data/DatasetIndex.h"
+#include "libraries/common/Dictionary.h"
+
 namespace w2l {
 
 // Helper class used to send metadata about samples in a dataset for
@@ -85,6 +88,86 @@ class SpeechSample {
   }
 };
 
+/**
+ * Columnar storage of the SpeechSamples of a dataset. The ids and the audio
+ * paths of all the samples are offsets into one char arena, and the
+ * transcripts are indices into a Dictionary of their distinct words, so a
+ * sample costs a few words of memory on top of its chars and its word
+ * indices, instead of a std::string per id, path and word.
+ *
+ * The columns are built by add(), or are arrays of a DatasetIndex, read in
+ * place, after attach().
+ */
+class SpeechSampleStore {
+ public:
+  SpeechSampleStore();
+
+  SpeechSampleStore(const SpeechSampleStore&) = delete;
+  SpeechSampleStore& operator=(const SpeechSampleStore&) = delete;
+
+  int64_t size() const {
+    return columns_.wordOffsets.size - 1;
+  }
+
+  void add(
+      const std::string& sampleId,
+      const std::string& audioFile,
+      const std::vector<std::string>& transcript);
+
+  std::string getSampleId(int64_t idx) const {
+    return text(2 * idx);
+  }
+
+  std::string getAudioFile(int64_t idx) const {
+    return text(2 * idx + 1);
+  }
+
+  std::vector<std::string> getTranscript(int64_t idx) const;
+
+  SpeechSample get(int64_t idx) const {
+    return SpeechSample(
+        getSampleId(idx), getAudioFile(idx), getTranscript(idx));
+  }
+
+  /* Frees the spare capacity left by add() */
+  void shrinkToFit();
+
+  /* Appends the columns to `writer`, as kNumIndexArrays arrays */
+  void write(DatasetIndex::Writer& writer) const;
+
+  /* Replaces the samples by the ones written at array `first` of `index` */
+  void attach(std::shared_ptr<DatasetIndex> index, size_t first);
+
+  static constexpr size_t kNumIndexArrays = 6;
+
+ private:
+  // Built by add(), and empty once attached to an index
+  std::string arena_;
+  std::vector<int64_t> textOffsets_;
+  std::vector<int> wordIndices_;
+  std::vector<int64_t> wordOffsets_;
+  std::shared_ptr<DatasetIndex> index_;
+
+  // The id then the path of each sample, [textOffsets[k], textOffsets[k+1])
+  // of `arena` for the k-th string. The words of sample i are
+  // [wordOffsets[i], wordOffsets[i + 1]) of `wordIndices`.
+  Dictionary words_;
+  struct {
+    ArrayView<char> arena;
+    ArrayView<int64_t> textOffsets;
+    ArrayView<int> wordIndices;
+    ArrayView<int64_t> wordOffsets;
+  } columns_;
+
+  void syncColumns();
+
+  std::string text(int64_t k) const {
+    return std::string(
+        columns_.arena.data + columns_.textOffsets[k],
+        columns_.arena.data + columns_.textOffsets[k + 1]);
+  }
+};
+
 std::vector<int64_t> sortSamples(
     const std::vector<SpeechSampleMetaInfo>& samples,
     const std::string& dataorder,
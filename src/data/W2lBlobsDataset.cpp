@@ -6,16 +6,137 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <glog/logging.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <functional>
+#include <future>
 #include <numeric>
 #include <sstream>
 
 #include "common/Defines.h"
+#include "data/ObjectStore.h"
 #include "data/W2lBlobsDataset.h"
 
 namespace w2l {
 
+namespace {
+
+constexpr const char kBlobMetaMagic[8] =
+    {'W', '2', 'L', 'B', 'M', 'E', 'T', 'A'};
+constexpr int kBlobMetaVersion = 1;
+constexpr const char* kBlobMetaExt = ".meta";
+constexpr int64_t kMaxIndexingThreads = 32;
+
+// Header of a sidecar file, followed by the input and target sizes of the
+// samples (int64_t). Data is stored in the native byte order.
+struct BlobMetaHeader {
+  char magic[8];
+  int version;
+  int reserved = 0;
+  uint64_t blobSize; // to tell a sidecar file of an older blob
+  uint64_t nSamples;
+};
+
+// A read-only blob, read from an object store
+class ObjectBlobDataset : public fl::BlobDataset {
+ public:
+  ObjectBlobDataset(std::shared_ptr<ObjectStore> store, const std::string& url)
+      : store_(std::move(store)), url_(url) {
+    readIndex();
+  }
+
+ protected:
+  int64_t writeData(int64_t /* offset */, const char* /* data */, int64_t)
+      const override {
+    throw std::logic_error("ObjectBlobDataset is read-only: " + url_);
+  }
+
+  int64_t readData(int64_t offset, char* data, int64_t size) const override {
+    size = std::min(size, store_->size(url_) - offset);
+    if (size <= 0) {
+      return 0;
+    }
+    store_->read(url_, offset, data, size);
+    return size;
+  }
+
+  void flushData() override {}
+
+  bool isEmptyData() const override {
+    return store_->size(url_) == 0;
+  }
+
+ private:
+  std::shared_ptr<ObjectStore> store_;
+  std::string url_;
+};
+
+int64_t fileSize(const std::string& path) {
+  if (ObjectStore::isRemote(path)) {
+    return ObjectStore::get()->size(path);
+  }
+  struct stat info;
+  if (stat(path.c_str(), &info) != 0) {
+    throw std::runtime_error("Cannot stat " + path);
+  }
+  return info.st_size;
+}
+
+bool readBlobSizes(
+    const std::string& blobPath,
+    std::vector<std::pair<int64_t, int64_t>>& sizes) {
+  auto f = openInputStream(blobPath + kBlobMetaExt);
+  BlobMetaHeader header;
+  if (!f->read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+      std::memcmp(header.magic, kBlobMetaMagic, sizeof(header.magic)) != 0 ||
+      header.version != kBlobMetaVersion ||
+      header.blobSize != fileSize(blobPath)) {
+    return false;
+  }
+  sizes.resize(header.nSamples);
+  return static_cast<bool>(f->read(
+      reinterpret_cast<char*>(sizes.data()),
+      sizes.size() * sizeof(sizes[0])));
+}
+
+void writeBlobSizes(
+    const std::string& blobPath,
+    const std::vector<std::pair<int64_t, int64_t>>& sizes) {
+  if (ObjectStore::isRemote(blobPath)) {
+    // The objects are read-only; a sidecar file may be uploaded along
+    LOG(INFO) << "Cannot write blob sizes next to " << blobPath;
+    return;
+  }
+  // Written atomically, as other processes may be reading it
+  auto path = blobPath + kBlobMetaExt;
+  auto tmpPath = path + "." + std::to_string(getpid()) + ".tmp";
+  std::ofstream f(tmpPath, std::ios::binary | std::ios::trunc);
+  BlobMetaHeader header;
+  std::memcpy(header.magic, kBlobMetaMagic, sizeof(header.magic));
+  header.version = kBlobMetaVersion;
+  header.blobSize = fileSize(blobPath);
+  header.nSamples = sizes.size();
+  f.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  f.write(
+      reinterpret_cast<const char*>(sizes.data()),
+      sizes.size() * sizeof(sizes[0]));
+  f.close();
+  if (!f || std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+    // The sizes are computed again next time
+    LOG(WARNING) << "Cannot write blob sizes to " << path;
+    std::remove(tmpPath.c_str());
+  }
+}
+
+} // namespace
+
 W2lBlobsDataset::W2lBlobsDataset(
     const std::string& filenames,
     const DictionaryMap& dicts,
@@ -26,24 +147,48 @@ W2lBlobsDataset::W2lBlobsDataset(
     bool fallback2Ltr /* = false */,
     bool skipUnk /* = false */,
     const std::string& rootdir /* = "" */)
-    : W2lDataset(dicts, batchSize, worldRank, worldSize),
-      lexicon_(lexicon),
-      fallback2Ltr_(fallback2Ltr),
-      skipUnk_(skipUnk) {
+    : W2lDataset(dicts, batchSize, worldRank, worldSize) {
   includeWrd_ = (dicts.find(kWordIdx) != dicts.end());
 
   LOG_IF(FATAL, dicts.find(kTargetIdx) == dicts.end())
       << "Target dictionary does not exist";
+  tokenizer_ = fl::cpp::make_unique<TargetTokenizer>(
+      lexicon, dicts.at(kTargetIdx), fallback2Ltr, skipUnk);
 
   auto filesVec = split(',', filenames);
-  std::vector<SpeechSampleMetaInfo> speechSamplesMetaInfo;
   for (const auto& f : filesVec) {
-    auto fullpath = pathsConcat(rootdir, trim(f));
-    auto fileSampleInfo = loadBlob(fullpath);
-    speechSamplesMetaInfo.insert(
-        speechSamplesMetaInfo.end(),
-        fileSampleInfo.begin(),
-        fileSampleInfo.end());
+    blobPaths_.push_back(pathsConcat(rootdir, trim(f)));
+  }
+  blobs_.resize(blobPaths_.size());
+
+  // Blobs are indexed in parallel, as it's bound by the filesystem latency
+  int64_t nBlobs = blobPaths_.size();
+  std::vector<std::vector<std::pair<int64_t, int64_t>>> blobSizes(nBlobs);
+  int64_t nThreads = std::min(nBlobs, kMaxIndexingThreads);
+  std::vector<std::future<void>> indexers;
+  std::atomic<int64_t> nextBlob(0);
+  for (int64_t t = 0; t < nThreads; ++t) {
+    indexers.push_back(std::async(std::launch::async, [&]() {
+      for (int64_t b = nextBlob++; b < nBlobs; b = nextBlob++) {
+        blobSizes[b] = loadBlobSizes(b);
+      }
+    }));
+  }
+  for (auto& indexer : indexers) {
+    indexer.get();
+  }
+
+  std::vector<SpeechSampleMetaInfo> speechSamplesMetaInfo;
+  for (int64_t b = 0; b < nBlobs; ++b) {
+    for (int64_t s = 0; s < blobSizes[b].size(); ++s) {
+      speechSamplesMetaInfo.emplace_back(SpeechSampleMetaInfo(
+          blobSizes[b][s].first,
+          blobSizes[b][s].second,
+          speechSamplesMetaInfo.size()));
+      blobIndex_.emplace_back(b);
+      sampleIndex_.emplace_back(s);
+    }
+    LOG(INFO) << blobSizes[b].size() << " files found in " << blobPaths_[b];
   }
 
   filterSamples(
@@ -58,13 +203,14 @@ W2lBlobsDataset::W2lBlobsDataset(
       FLAGS_dataorder,
       FLAGS_inputbinsize,
       FLAGS_outputbinsize);
+  setSampleDurations(speechSamplesMetaInfo, sampleSizeOrder_);
 
   shuffle(-1);
   LOG(INFO) << "Total batches (i.e. iters): " << sampleBatches_.size();
 }
 
 W2lBlobsDataset::~W2lBlobsDataset() {
-  threadpool_ = nullptr; // join all threads
+  prefetcher_ = nullptr; // join all threads
 }
 
 std::vector<W2lLoaderData> W2lBlobsDataset::getLoaderData(
@@ -80,7 +226,7 @@ std::vector<W2lLoaderData> W2lBlobsDataset::getLoaderData(
 
     data[id].sampleId = std::to_string(sampleIndex_[i]);
 
-    auto rawSample = blobs_.at(blobIndex_[i])->rawGet(sampleIndex_[i]);
+    auto rawSample = getBlob(blobIndex_[i])->rawGet(sampleIndex_[i]);
     auto& audio_v = rawSample.at(0);
     auto& target_v = rawSample.at(1);
 
@@ -90,8 +236,8 @@ std::vector<W2lLoaderData> W2lBlobsDataset::getLoaderData(
     std::istringstream audiois(
         std::string((char*)audio_v.data(), audio_v.size()));
     data[id].input = w2l::loadSound<float>(audiois);
-    data[id].targets[kTargetIdx] = wrd2Target(
-        transcript, lexicon_, dicts_.at(kTargetIdx), fallback2Ltr_, skipUnk_);
+    data[id].targetIndices[kTargetIdx] = featurizeTarget(
+        tokenizer_->tokenize(transcript), kTargetIdx, dicts_.at(kTargetIdx));
 
     if (includeWrd_) {
       data[id].targets[kWordIdx] = transcript;
@@ -100,32 +246,43 @@ std::vector<W2lLoaderData> W2lBlobsDataset::getLoaderData(
   return data;
 }
 
-std::vector<SpeechSampleMetaInfo> W2lBlobsDataset::loadBlob(
-    const std::string& filename) {
-  std::shared_ptr<fl::BlobDataset> blob =
-      std::make_shared<fl::FileBlobDataset>(filename);
+std::vector<std::pair<int64_t, int64_t>> W2lBlobsDataset::loadBlobSizes(
+    int64_t idx) {
+  const auto& path = blobPaths_[idx];
+  std::vector<std::pair<int64_t, int64_t>> sizes;
+  if (readBlobSizes(path, sizes)) {
+    return sizes;
+  }
 
-  // The format of the list: columns should be space-separated
-  // [utterance id] [audio file (full path)] [audio length] [word transcripts]
-  std::vector<SpeechSampleMetaInfo> samplesMetaInfo;
-  auto curDataSize = blobIndex_.size();
-  int64_t idx = curDataSize;
+  auto blob = getBlob(idx);
   for (int64_t s = 0; s < blob->size(); s++) {
     auto info = blob->getEntries(s);
-
-    blobIndex_.emplace_back(blobs_.size());
-    sampleIndex_.emplace_back(s);
-
-    samplesMetaInfo.emplace_back(SpeechSampleMetaInfo(
-        info.at(0).dims.elements(), info.at(1).dims.elements(), idx));
-
-    ++idx;
+    sizes.emplace_back(info.at(0).dims.elements(), info.at(1).dims.elements());
   }
+  writeBlobSizes(path, sizes);
+  return sizes;
+}
 
-  blobs_.push_back(blob);
-
-  LOG(INFO) << samplesMetaInfo.size() << " files found. ";
-
-  return samplesMetaInfo;
+std::shared_ptr<fl::BlobDataset> W2lBlobsDataset::getBlob(int64_t idx) const {
+  {
+    std::lock_guard<std::mutex> lock(blobsMutex_);
+    if (blobs_.at(idx)) {
+      return blobs_[idx];
+    }
+  }
+  // Opened without the lock, so that blobs are opened concurrently. A blob
+  // opened by two threads at once is kept only once.
+  std::shared_ptr<fl::BlobDataset> blob;
+  if (ObjectStore::isRemote(blobPaths_[idx])) {
+    blob = std::make_shared<ObjectBlobDataset>(
+        ObjectStore::get(), blobPaths_[idx]);
+  } else {
+    blob = std::make_shared<fl::FileBlobDataset>(blobPaths_[idx]);
+  }
+  std::lock_guard<std::mutex> lock(blobsMutex_);
+  if (!blobs_[idx]) {
+    blobs_[idx] = blob;
+  }
+  return blobs_[idx];
 }
 } // namespace w2l
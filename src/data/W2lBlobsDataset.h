@@ -8,12 +8,24 @@
 
 #pragma once
 
+#include <mutex>
+#include <utility>
+
+#include "common/TargetTokenizer.h"
 #include "common/Utils.h"
 #include "data/Utils.h"
 #include "data/W2lDataset.h"
 
 namespace w2l {
 
+/**
+ * Dataset of the samples of blobs. The sizes of the samples of a blob are
+ * saved the first time it's indexed in a sidecar file `[blob]` + ".meta",
+ * from which they are read afterwards. The blobs are indexed in parallel, and
+ * the blobs whose sizes are read from sidecar files are only opened when
+ * their samples are first loaded. Blobs at http(s)://, s3:// or gs:// URLs
+ * are read by ranges through ObjectStore::get().
+ */
 class W2lBlobsDataset : public W2lDataset {
  public:
   W2lBlobsDataset(
@@ -33,15 +45,19 @@ class W2lBlobsDataset : public W2lDataset {
       const int64_t idx) const override;
 
  private:
-  std::vector<std::shared_ptr<fl::BlobDataset>> blobs_;
+  std::vector<std::string> blobPaths_;
+  mutable std::vector<std::shared_ptr<fl::BlobDataset>> blobs_;
+  mutable std::mutex blobsMutex_;
   std::vector<int64_t> sampleSizeOrder_;
   std::vector<int64_t> blobIndex_;
   std::vector<int64_t> sampleIndex_;
-  LexiconMap lexicon_;
+  std::unique_ptr<TargetTokenizer> tokenizer_;
   bool includeWrd_;
-  bool fallback2Ltr_;
-  bool skipUnk_;
 
-  std::vector<SpeechSampleMetaInfo> loadBlob(const std::string& filename);
+  // Input and target sizes of the samples of the blob `idx`, as read from its
+  // sidecar file or computed from the blob, which is then opened
+  std::vector<std::pair<int64_t, int64_t>> loadBlobSizes(int64_t idx);
+
+  std::shared_ptr<fl::BlobDataset> getBlob(int64_t idx) const;
 };
 } // namespace w2l
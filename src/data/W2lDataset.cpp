@@ -8,8 +8,12 @@
 
 #include "W2lDataset.h"
 
+#include <algorithm>
 #include <functional>
 #include <numeric>
+#include <random>
+#include <stdexcept>
+#include <unordered_map>
 
 #include <glog/logging.h>
 
@@ -26,12 +30,26 @@ W2lDataset::W2lDataset(
     : dicts_(dicts),
       batchSize_(batchsize),
       worldRank_(worldrank),
-      worldSize_(worldsize),
-      threadpool_(fl::cpp::make_unique<fl::ThreadPool>(FLAGS_nthread)) {
+      worldSize_(worldsize) {
   if (batchSize_ < 1 || worldRank_ < 0 || worldSize_ < 1 ||
       worldRank_ >= worldSize_) {
     LOG(FATAL) << "Invalid arguments!";
   }
+  if (FLAGS_nthread > 0) {
+    prefetcher_ = fl::cpp::make_unique<BatchPrefetcher>(
+        [this](int64_t idx) { return this->getFeatureData(idx); },
+        FLAGS_nthread,
+        FLAGS_prefetchdepth > 0 ? FLAGS_prefetchdepth : FLAGS_nthread);
+  }
+  if (af::getActiveBackend() == AF_BACKEND_CUDA) {
+    pinnedPool_ = fl::cpp::make_unique<PinnedBufferPool>();
+  }
+}
+
+W2lDataset::~W2lDataset() {
+  if (batchCache_) {
+    batchCache_->erase(this); // another dataset may be allocated here
+  }
 }
 
 int64_t W2lDataset::size() const {
@@ -41,16 +59,11 @@ int64_t W2lDataset::size() const {
 std::vector<af::array> W2lDataset::get(const int64_t idx) const {
   checkIndexBounds(idx);
 
-  W2lFeatureData feat;
-  if (FLAGS_nthread > 0) {
-    feat = getFeatureDataAndPrefetch(idx);
-  } else {
-    feat = getFeatureData(idx);
-  }
+  auto feat = getFeatureDataAndPrefetch(idx);
   std::vector<af::array> result(kNumDataIdx);
   result[kInputIdx] = feat.input.empty()
       ? af::array(feat.inputDims)
-      : af::array(feat.inputDims, feat.input.data());
+      : featurizeOnDevice(inputToDevice(feat.inputDims, feat.input));
   for (const auto& target : feat.targets) {
     auto targetType = target.first;
     auto targetData = target.second;
@@ -65,55 +78,175 @@ std::vector<af::array> W2lDataset::get(const int64_t idx) const {
   return result;
 }
 
+af::array W2lDataset::inputToDevice(
+    const af::dim4& dims,
+    const std::vector<float>& input) const {
+  if (!pinnedPool_) {
+    return af::array(dims, input.data());
+  }
+  // The host data is copied when the array is created, so the buffer can be
+  // reused right after
+  auto buffer = pinnedPool_->acquire(input.size());
+  std::copy(input.begin(), input.end(), buffer.get());
+  return af::array(dims, buffer.get());
+}
+
 int64_t W2lDataset::getGlobalBatchIdx(const int64_t idx) {
-  return sampleBatches_[idx][0] / (worldSize_ * batchSize_);
+  return globalBatchIds_[idx];
+}
+
+int64_t W2lDataset::numSamples() const {
+  int64_t count = 0;
+  for (const auto& batch : sampleBatches_) {
+    count += batch.size();
+  }
+  return count;
+}
+
+std::vector<double> W2lDataset::getSampleDurations(const int64_t idx) const {
+  checkIndexBounds(idx);
+  std::vector<double> durations;
+  if (sampleDurations_.empty()) {
+    return durations;
+  }
+  for (auto i : sampleBatches_[idx]) {
+    durations.push_back(sampleDurations_[i]);
+  }
+  return durations;
 }
 
 W2lFeatureData W2lDataset::getFeatureData(const int64_t idx) const {
+  if (batchCache_) {
+    auto cached = batchCache_->get(this, idx);
+    if (!cached) {
+      cached = std::make_shared<const W2lFeatureData>(
+          featurize(getLoaderData(idx), dicts_));
+      batchCache_->put(this, idx, cached);
+    }
+    return *cached;
+  }
   auto ldData = getLoaderData(idx);
-  return featurize(ldData, dicts_);
+  if (speedPerturb_) {
+    speedPerturb_->apply(ldData, FLAGS_seed + nPerturbed_++);
+  }
+  auto feat = featurize(ldData, dicts_);
+  if (specAugment_) {
+    specAugment_->apply(
+        feat.input, feat.inputDims, FLAGS_seed + nAugmented_++);
+  }
+  return feat;
 }
 
 W2lFeatureData W2lDataset::getFeatureDataAndPrefetch(const int64_t idx) const {
-  W2lFeatureData feat;
-  // check cache
-  auto cachedata = prefetchCache_.find(idx);
-  if (cachedata != prefetchCache_.end()) {
-    feat = cachedata->second.get();
-    prefetchCache_.erase(idx);
-  } else {
-    feat = getFeatureData(idx);
+  return prefetcher_ ? prefetcher_->get(idx, size()) : getFeatureData(idx);
+}
+
+void W2lDataset::setSpecAugment(
+    std::shared_ptr<SpecAugmentStage> specAugment) {
+  if (specAugment && batchCache_) {
+    LOG(FATAL) << "The batches of a dataset augmented with SpecAugment "
+               << "can't be cached";
   }
+  if (specAugment && FLAGS_device_features &&
+      (FLAGS_pow || FLAGS_mfsc || FLAGS_mfcc)) {
+    LOG(FATAL) << "SpecAugment in the data threads needs the features to be "
+               << "computed on the CPU, not with -device_features";
+  }
+  if (prefetcher_) {
+    prefetcher_->reset(); // the batches prefetched so far aren't augmented
+  }
+  specAugment_ = std::move(specAugment);
+}
 
-  int64_t prefetchSize = FLAGS_nthread;
-  // remove from cache (if necessary)
-  for (auto it = prefetchCache_.begin(); it != prefetchCache_.end();) {
-    if (it->first < idx || it->first > idx + prefetchSize) {
-      it = prefetchCache_.erase(it);
-      continue;
-    } else {
-      ++it;
-    }
+void W2lDataset::setSpeedPerturb(
+    std::shared_ptr<SpeedPerturbStage> speedPerturb) {
+  if (speedPerturb && batchCache_) {
+    LOG(FATAL) << "The batches of a dataset with speed perturbation "
+               << "can't be cached";
+  }
+  if (prefetcher_) {
+    prefetcher_->reset(); // the batches prefetched so far aren't perturbed
   }
+  speedPerturb_ = std::move(speedPerturb);
+}
 
-  // add to cache
-  for (int64_t i = idx + 1; i < std::min(idx + 1 + prefetchSize, size()); ++i) {
-    if (prefetchCache_.find(i) == prefetchCache_.end()) {
-      prefetchCache_.emplace(
-          i,
-          threadpool_->enqueue(
-              [this](int64_t j) { return this->getFeatureData(j); }, i));
-    }
+void W2lDataset::setBatchCache(std::shared_ptr<BatchCache> cache) {
+  if (cache && specAugment_) {
+    LOG(FATAL) << "The batches of a dataset augmented with SpecAugment "
+               << "can't be cached";
   }
-  return feat;
+  if (cache && speedPerturb_) {
+    LOG(FATAL) << "The batches of a dataset with speed perturbation "
+               << "can't be cached";
+  }
+  if (prefetcher_) {
+    prefetcher_->reset();
+  }
+  if (batchCache_) {
+    batchCache_->erase(this);
+  }
+  batchCache_ = std::move(cache);
+}
+
+BatchPrefetcher::Stats W2lDataset::prefetchStats() const {
+  return prefetcher_ ? prefetcher_->stats() : BatchPrefetcher::Stats();
 }
 
 void W2lDataset::shuffle(int seed) {
-  prefetchCache_.clear();
-  RoundRobinBatchPacker shuffler(batchSize_, worldSize_, worldRank_);
+  if (prefetcher_) {
+    prefetcher_->reset();
+    prefetcher_->resetStats();
+  }
+  // The samples featurized during the previous epoch are read from the cache
+  syncFeatureCache();
+  if (batchCache_) {
+    batchCache_->erase(this); // the batches are about to change
+  }
+  std::unique_ptr<BatchPacker> shuffler;
+  if (FLAGS_batchframes > 0) {
+    std::vector<double> sampleFrames(sampleDurations_.size());
+    for (size_t i = 0; i < sampleFrames.size(); ++i) {
+      sampleFrames[i] = sampleDurations_[i] / FLAGS_framestridems;
+    }
+    shuffler = fl::cpp::make_unique<DynamicBatchPacker>(
+        std::move(sampleFrames), FLAGS_batchframes, worldSize_, worldRank_);
+  } else if (FLAGS_balancebatches && worldSize_ > 1) {
+    shuffler = fl::cpp::make_unique<BalancedBatchPacker>(
+        sampleDurations_, batchSize_, worldSize_, worldRank_);
+  } else {
+    shuffler = fl::cpp::make_unique<RoundRobinBatchPacker>(
+        batchSize_, worldSize_, worldRank_);
+  }
   // We shuffle such that calling `get(idx)` from different mpi jobs with same
   // `idx` would return similar length samples
-  sampleBatches_ = shuffler.getBatches(sampleCount_, seed);
+  sampleBatches_ = shuffler->getBatches(sampleCount_, seed);
+
+  // The batches are told apart by their first sample
+  globalBatchIds_.resize(sampleBatches_.size());
+  std::iota(globalBatchIds_.begin(), globalBatchIds_.end(), 0);
+  if (seed >= 0) {
+    std::unordered_map<int64_t, int64_t> firstSampleBatch;
+    auto batches = shuffler->getBatches(sampleCount_, -1);
+    for (size_t i = 0; i < batches.size(); ++i) {
+      firstSampleBatch[batches[i][0]] = i;
+    }
+    for (size_t i = 0; i < sampleBatches_.size(); ++i) {
+      globalBatchIds_[i] = firstSampleBatch.at(sampleBatches_[i][0]);
+    }
+  }
+}
+
+void W2lDataset::setSampleDurations(
+    const std::vector<SpeechSampleMetaInfo>& samples,
+    const std::vector<int64_t>& sampleOrder) {
+  std::unordered_map<int64_t, double> durations;
+  for (const auto& sample : samples) {
+    durations[sample.index()] = sample.audiolength();
+  }
+  sampleDurations_.resize(sampleOrder.size());
+  for (size_t i = 0; i < sampleOrder.size(); ++i) {
+    sampleDurations_[i] = durations.at(sampleOrder[i]);
+  }
 }
 
 std::vector<std::vector<int64_t>> RoundRobinBatchPacker::getBatches(
@@ -165,4 +298,111 @@ std::vector<std::vector<int64_t>> RoundRobinBatchPacker::getBatches(
   return batches;
 }
 
+std::vector<std::vector<int64_t>> BalancedBatchPacker::getBatches(
+    int64_t nSamples,
+    int64_t seed) const {
+  if (nSamples != sampleSizes_.size()) {
+    throw std::invalid_argument(
+        "[BalancedBatchPacker] The sizes of " + std::to_string(nSamples) +
+        " samples are needed");
+  }
+  // The global batches of RoundRobinBatchPacker
+  int64_t nSamplesPerGlobalBatch = worldSize_ * batchSize_;
+  int64_t nGlobalBatches = nSamples / nSamplesPerGlobalBatch;
+  if ((nSamples % nSamplesPerGlobalBatch) >= worldSize_) {
+    ++nGlobalBatches;
+  }
+
+  std::vector<int64_t> globalBatchIdx(nGlobalBatches);
+  std::iota(globalBatchIdx.begin(), globalBatchIdx.end(), 0);
+  if (seed >= 0) {
+    auto rng = std::default_random_engine(seed);
+    std::shuffle(globalBatchIdx.begin(), globalBatchIdx.end(), rng);
+  }
+
+  std::vector<std::vector<int64_t>> batches(nGlobalBatches);
+  std::vector<int64_t> order;
+  std::vector<double> procSizes(worldSize_);
+  std::vector<int64_t> procSamples(worldSize_);
+  for (size_t i = 0; i < nGlobalBatches; ++i) {
+    int64_t begin = globalBatchIdx[i] * nSamplesPerGlobalBatch;
+    int64_t end = std::min(begin + nSamplesPerGlobalBatch, nSamples);
+    order.resize(end - begin);
+    std::iota(order.begin(), order.end(), begin);
+    std::stable_sort(order.begin(), order.end(), [this](int64_t a, int64_t b) {
+      return sampleSizes_[a] > sampleSizes_[b];
+    });
+
+    // As many samples per process as with RoundRobinBatchPacker
+    int64_t minProcSamples = (end - begin) / worldSize_;
+    int64_t remaining = (end - begin) % worldSize_;
+    std::fill(procSizes.begin(), procSizes.end(), 0.0);
+    std::fill(procSamples.begin(), procSamples.end(), 0);
+    for (auto sample : order) {
+      int64_t best = -1;
+      for (int64_t proc = 0; proc < worldSize_; ++proc) {
+        if (procSamples[proc] < minProcSamples + (proc < remaining) &&
+            (best < 0 || procSizes[proc] < procSizes[best])) {
+          best = proc;
+        }
+      }
+      procSizes[best] += sampleSizes_[sample];
+      ++procSamples[best];
+      if (best == worldRank_) {
+        batches[i].push_back(sample);
+      }
+    }
+    std::sort(batches[i].begin(), batches[i].end());
+  }
+  return batches;
+}
+
+std::vector<std::vector<int64_t>> DynamicBatchPacker::getBatches(
+    int64_t nSamples,
+    int64_t seed) const {
+  if (nSamples != sampleSizes_.size()) {
+    throw std::invalid_argument(
+        "[DynamicBatchPacker] The sizes of " + std::to_string(nSamples) +
+        " samples are needed");
+  }
+  std::vector<int64_t> order(nSamples);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [this](int64_t i, int64_t j) {
+    return sampleSizes_[i] < sampleSizes_[j];
+  });
+
+  // Global batches [begin, end) of `order`. A global batch has at least one
+  // sample per process, and the last one is dropped if it can't.
+  std::vector<std::pair<int64_t, int64_t>> globalBatches;
+  int64_t begin = 0;
+  for (int64_t end = 1; end <= nSamples; ++end) {
+    int64_t nNextSamples = end - begin + 1;
+    int64_t nNextSamplesPerProc = (nNextSamples + worldSize_ - 1) / worldSize_;
+    bool full = end == nSamples ||
+        (end - begin >= worldSize_ &&
+         nNextSamplesPerProc * sampleSizes_[order[end]] > maxBatchSize_);
+    if (full) {
+      if (end - begin >= worldSize_) {
+        globalBatches.emplace_back(begin, end);
+      }
+      begin = end;
+    }
+  }
+
+  if (seed >= 0) {
+    auto rng = std::default_random_engine(seed);
+    std::shuffle(globalBatches.begin(), globalBatches.end(), rng);
+  }
+
+  std::vector<std::vector<int64_t>> batches(globalBatches.size());
+  for (size_t i = 0; i < globalBatches.size(); ++i) {
+    for (int64_t j = globalBatches[i].first + worldRank_;
+         j < globalBatches[i].second;
+         j += worldSize_) {
+      batches[i].push_back(order[j]);
+    }
+  }
+  return batches;
+}
+
 } // namespace w2l
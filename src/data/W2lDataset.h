@@ -8,12 +8,19 @@
 
 #pragma once
 
-#include <unordered_map>
+#include <atomic>
+#include <memory>
 #include <vector>
 
 #include <flashlight/flashlight.h>
 
+#include "data/BatchCache.h"
+#include "data/BatchPrefetcher.h"
 #include "data/Featurize.h"
+#include "data/PinnedBufferPool.h"
+#include "data/SpecAugmentStage.h"
+#include "data/SpeedPerturbStage.h"
+#include "data/Utils.h"
 #include "libraries/common/Dictionary.h"
 
 namespace w2l {
@@ -26,22 +33,57 @@ class W2lDataset : public fl::Dataset {
       int worldrank = 0,
       int worldsize = 1);
 
+  ~W2lDataset() override;
+
   int64_t size() const override;
 
-  // NB: get() is thread-hostile if FLAGS_nthread > 0: it must be called
-  // from only one thread. In this case, it also expects calls to be sequential,
-  // or else samples will be loaded into cache unnecessarily and discarded.
+  // If FLAGS_nthread > 0, get(idx) returns a batch prefetched by the data
+  // threads, which load the FLAGS_prefetchdepth batches following idx ahead.
   std::vector<af::array> get(const int64_t idx) const override;
 
   virtual std::vector<W2lLoaderData> getLoaderData(const int64_t idx) const = 0;
 
   int64_t getGlobalBatchIdx(const int64_t idx);
 
+  /* Number of samples in the batches */
+  int64_t numSamples() const;
+
+  /**
+   * Input length in ms of the samples of the batch `idx`, in their order in
+   * the batch. Empty if the dataset doesn't record the lengths.
+   */
+  std::vector<double> getSampleDurations(const int64_t idx) const;
+
   W2lFeatureData getFeatureData(const int64_t idx) const;
 
   W2lFeatureData getFeatureDataAndPrefetch(const int64_t idx) const;
 
-  void shuffle(int seed);
+  /* Metrics of the prefetching since the last shuffle() */
+  BatchPrefetcher::Stats prefetchStats() const;
+
+  /**
+   * Augments the features of the batches returned from now on, in
+   * getFeatureData() and thus in the data threads. Not with -device_features,
+   * whose batches are featurized on the device.
+   */
+  void setSpecAugment(std::shared_ptr<SpecAugmentStage> specAugment);
+
+  /**
+   * Perturbs the speed or tempo of the audio of the batches returned from now
+   * on, in getFeatureData() before it's featurized, and thus in the data
+   * threads.
+   */
+  void setSpeedPerturb(std::shared_ptr<SpeedPerturbStage> speedPerturb);
+
+  /**
+   * Keeps the batches returned by getFeatureData() in `cache`, from which they
+   * are read instead of being loaded again, until the next shuffle(). Only
+   * for datasets read the same way every time, without augmentation, such as
+   * the validation sets. nullptr to disable.
+   */
+  void setBatchCache(std::shared_ptr<BatchCache> cache);
+
+  virtual void shuffle(int seed);
 
  protected:
   DictionaryMap dicts_;
@@ -53,12 +95,40 @@ class W2lDataset : public fl::Dataset {
   int64_t worldRank_; // The GPU id for which this Dataset is being used
   int64_t worldSize_; // Total number of parallel GPUs/ CPUs used in training
 
-  // used if FLAGS_nthread > 1
-  std::unique_ptr<fl::ThreadPool> threadpool_;
-  mutable std::unordered_map<int64_t, std::future<W2lFeatureData>>
-      prefetchCache_;
+  // used if FLAGS_nthread > 0. It must be reset by the destructors of the
+  // derived classes, whose getLoaderData() its threads call.
+  std::unique_ptr<BatchPrefetcher> prefetcher_;
+
+  // Staging buffers of the inputs copied to the device, if it's a GPU
+  std::unique_ptr<PinnedBufferPool> pinnedPool_;
+
+  std::shared_ptr<SpecAugmentStage> specAugment_;
+  // Number of batches augmented so far, seeding the draws of the next one
+  mutable std::atomic<uint64_t> nAugmented_{0};
+
+  std::shared_ptr<SpeedPerturbStage> speedPerturb_;
+  // Number of batches perturbed so far, seeding the draws of the next one
+  mutable std::atomic<uint64_t> nPerturbed_{0};
+
+  std::shared_ptr<BatchCache> batchCache_;
 
   std::vector<std::vector<int64_t>> sampleBatches_;
+  // Index of each batch of `sampleBatches_` in the order of the global
+  // batches before shuffling
+  std::vector<int64_t> globalBatchIds_;
+
+  // Input length in ms of the samples, in the order of their indices in
+  // `sampleBatches_`. Used if FLAGS_batchframes > 0.
+  std::vector<double> sampleDurations_;
+
+  /* Sets `sampleDurations_`, given the index in the dataset of each sample */
+  void setSampleDurations(
+      const std::vector<SpeechSampleMetaInfo>& samples,
+      const std::vector<int64_t>& sampleOrder);
+
+  af::array inputToDevice(
+      const af::dim4& dims,
+      const std::vector<float>& input) const;
 };
 
 // Abstract class which defines an interface to pack samples
@@ -88,4 +158,61 @@ class RoundRobinBatchPacker : public BatchPacker {
   int64_t worldSize_;
   int64_t worldRank_;
 };
+
+// Implementation which packs the same global batches, of `batchSize` samples
+// per process, as RoundRobinBatchPacker. The samples of each global batch are
+// dealt, the largest first, to the process whose batch has the smallest total
+// size so far, so that the processes wait less for each other.
+class BalancedBatchPacker : public BatchPacker {
+ public:
+  BalancedBatchPacker(
+      std::vector<double> sampleSizes,
+      int64_t batchSize,
+      int64_t worldSize,
+      int64_t worldRank)
+      : sampleSizes_(std::move(sampleSizes)),
+        batchSize_(batchSize),
+        worldSize_(worldSize),
+        worldRank_(worldRank) {}
+
+  // Use seed < 0, for no shuffling of the batches
+  virtual std::vector<std::vector<int64_t>> getBatches(
+      int64_t numSamples,
+      int64_t seed) const override;
+
+ private:
+  std::vector<double> sampleSizes_;
+  int64_t batchSize_;
+  int64_t worldSize_;
+  int64_t worldRank_;
+};
+
+// Implementation which sorts the samples by size and packs consecutive ones
+// into the largest batches whose padded size, i.e. the number of samples
+// times the size of the largest one, is at most `maxBatchSize` per process.
+// Each global batch is dealt to the processes in Round Robin order, so they
+// all get as many batches of similar sizes.
+class DynamicBatchPacker : public BatchPacker {
+ public:
+  DynamicBatchPacker(
+      std::vector<double> sampleSizes,
+      double maxBatchSize,
+      int64_t worldSize,
+      int64_t worldRank)
+      : sampleSizes_(std::move(sampleSizes)),
+        maxBatchSize_(maxBatchSize),
+        worldSize_(worldSize),
+        worldRank_(worldRank) {}
+
+  // Use seed < 0, for no shuffling of the batches
+  virtual std::vector<std::vector<int64_t>> getBatches(
+      int64_t numSamples,
+      int64_t seed) const override;
+
+ private:
+  std::vector<double> sampleSizes_;
+  double maxBatchSize_;
+  int64_t worldSize_;
+  int64_t worldRank_;
+};
 } // namespace w2l
@@ -6,15 +6,28 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <sys/stat.h>
+
 #include <glog/logging.h>
+#include <exception>
 #include <functional>
 #include <numeric>
+#include <sstream>
+#include <thread>
 
 #include "common/Defines.h"
+#include "data/ListFile.h"
 #include "data/W2lListFilesDataset.h"
 
 namespace w2l {
 
+namespace {
+
+// Rows of a list file whose targets are mapped at least by each thread
+constexpr int64_t kRowsPerThread = 1 << 14;
+
+} // namespace
+
 W2lListFilesDataset::W2lListFilesDataset(
     const std::string& filenames,
     const DictionaryMap& dicts,
@@ -30,19 +43,37 @@ W2lListFilesDataset::W2lListFilesDataset(
       fallback2Ltr_(fallback2Ltr),
       skipUnk_(skipUnk) {
   includeWrd_ = (dicts.find(kWordIdx) != dicts.end());
+  pretokenize_ = FLAGS_sampletarget == 0;
 
   LOG_IF(FATAL, dicts.find(kTargetIdx) == dicts.end())
       << "Target dictionary does not exist";
+  tokenizer_ = fl::cpp::make_unique<TargetTokenizer>(
+      lexicon_, dicts_.at(kTargetIdx), fallback2Ltr_, skipUnk_);
 
-  auto filesVec = split(',', filenames);
+  std::vector<std::string> paths;
+  bool hasPacks = false;
+  for (const auto& f : split(',', filenames)) {
+    paths.push_back(pathsConcat(rootdir, trim(f)));
+    hasPacks = hasPacks || AudioPack::isAudioPack(paths.back());
+  }
   std::vector<SpeechSampleMetaInfo> speechSamplesMetaInfo;
-  for (const auto& f : filesVec) {
-    auto fullpath = pathsConcat(rootdir, trim(f));
-    auto fileSampleInfo = loadListFile(fullpath);
-    speechSamplesMetaInfo.insert(
-        speechSamplesMetaInfo.end(),
-        fileSampleInfo.begin(),
-        fileSampleInfo.end());
+  if (!FLAGS_dataindex.empty() && !hasPacks) {
+    speechSamplesMetaInfo = loadIndex(paths);
+  } else {
+    for (const auto& path : paths) {
+      auto fileSampleInfo = AudioPack::isAudioPack(path) ? loadPackFile(path)
+                                                         : loadListFile(path);
+      speechSamplesMetaInfo.insert(
+          speechSamplesMetaInfo.end(),
+          fileSampleInfo.begin(),
+          fileSampleInfo.end());
+    }
+    data_.shrinkToFit();
+    for (const auto& targets : tokenizedTargets_) {
+      auto& columns = targetColumns_[targets.first];
+      columns.indices = ArrayView<int>(targets.second.indices);
+      columns.offsets = ArrayView<int64_t>(targets.second.offsets);
+    }
   }
 
   filterSamples(
@@ -57,13 +88,14 @@ W2lListFilesDataset::W2lListFilesDataset(
       FLAGS_dataorder,
       FLAGS_inputbinsize,
       FLAGS_outputbinsize);
+  setSampleDurations(speechSamplesMetaInfo, sampleSizeOrder_);
 
   shuffle(-1);
   LOG(INFO) << "Total batches (i.e. iters): " << sampleBatches_.size();
 }
 
 W2lListFilesDataset::~W2lListFilesDataset() {
-  threadpool_ = nullptr; // join all threads
+  prefetcher_ = nullptr; // join all threads
 }
 
 std::vector<W2lLoaderData> W2lListFilesDataset::getLoaderData(
@@ -77,17 +109,30 @@ std::vector<W2lLoaderData> W2lListFilesDataset::getLoaderData(
           "W2lListFilesDataset::getLoaderData idx out of range");
     }
 
-    data[id].sampleId = data_[i].getSampleId();
-    data[id].input = loadSound(data_[i].getAudioFile());
-    data[id].targets[kTargetIdx] = wrd2Target(
-        data_[i].getTranscript(),
-        lexicon_,
-        dicts_.at(kTargetIdx),
-        fallback2Ltr_,
-        skipUnk_);
+    data[id].sampleId = data_.getSampleId(i);
+    // The samples of an index have no packs, nor pack records
+    if (!packs_.empty() && packRecords_[i].first >= 0) {
+      const auto& packRecord = packRecords_[i];
+      data[id].input = packs_[packRecord.first]->loadSound(packRecord.second);
+    } else {
+      data[id].input = loadSound(data_.getAudioFile(i));
+    }
+    if (pretokenize_) {
+      for (const auto& targets : targetColumns_) {
+        const auto& indices = targets.second.indices;
+        const auto& offsets = targets.second.offsets;
+        data[id].targetIndices[targets.first].assign(
+            indices.data + offsets[i], indices.data + offsets[i + 1]);
+      }
+      continue;
+    }
+    data[id].targetIndices[kTargetIdx] = featurizeTarget(
+        tokenizer_->tokenize(data_.getTranscript(i)),
+        kTargetIdx,
+        dicts_.at(kTargetIdx));
 
     if (includeWrd_) {
-      data[id].targets[kWordIdx] = data_[i].getTranscript();
+      data[id].targets[kWordIdx] = data_.getTranscript(i);
     }
   }
   return data;
@@ -95,41 +140,190 @@ std::vector<W2lLoaderData> W2lListFilesDataset::getLoaderData(
 
 std::vector<float> W2lListFilesDataset::loadSound(
     const std::string& audioHandle) const {
-  return w2l::loadSound<float>(audioHandle);
+  return loadSoundAs(audioHandle, FLAGS_samplerate, FLAGS_channels);
 }
 
-std::vector<SpeechSampleMetaInfo> W2lListFilesDataset::loadListFile(
-    const std::string& filename) {
-  std::ifstream infile(filename);
+std::vector<SpeechSampleMetaInfo> W2lListFilesDataset::loadIndex(
+    const std::vector<std::string>& paths) {
+  // Everything the samples and their targets are computed from
+  std::ostringstream key;
+  for (const auto& path : paths) {
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0) {
+      throw std::runtime_error("Could not read file '" + path + "'");
+    }
+    key << path << " " << info.st_size << " " << info.st_mtime << "\n";
+  }
+  key << fallback2Ltr_ << skipUnk_ << pretokenize_ << includeWrd_ << " "
+      << FLAGS_sampletarget << " " << FLAGS_surround << " " << FLAGS_replabel
+      << " " << FLAGS_criterion << " " << FLAGS_eostoken << "\n";
+  for (int type : {kTargetIdx, kWordIdx}) {
+    auto dict = dicts_.find(type);
+    if (dict == dicts_.end()) {
+      continue;
+    }
+    key << type << " " << dict->second.entrySize() << ":";
+    for (size_t i = 0;
+         dict->second.isContiguous() && i < dict->second.indexSize();
+         ++i) {
+      key << " " << dict->second.getEntry(i);
+    }
+    key << "\n";
+  }
+  // Independent of the order of the lexicon. std::hash differs across builds,
+  // which only leads to building the index again.
+  uint64_t lexiconHash = 0;
+  for (const auto& entry : lexicon_) {
+    std::string spellings = entry.first;
+    for (const auto& spelling : entry.second) {
+      spellings += "\t" + join(" ", spelling);
+    }
+    lexiconHash += std::hash<std::string>()(spellings);
+  }
+  key << lexicon_.size() << " " << lexiconHash;
+
+  auto index = DatasetIndex::getOrBuild(
+      FLAGS_dataindex, key.str(), [&](DatasetIndex::Writer& writer) {
+        std::vector<double> durations;
+        std::vector<int64_t> refLengths;
+        for (const auto& path : paths) {
+          for (const auto& info : loadListFile(path)) {
+            durations.push_back(info.audiolength());
+            refLengths.push_back(info.reflength());
+          }
+        }
+        data_.write(writer);
+        writer.add(durations);
+        writer.add(refLengths);
+        std::vector<int> types;
+        for (const auto& targets : tokenizedTargets_) {
+          types.push_back(targets.first);
+        }
+        writer.add(types);
+        for (int type : types) {
+          writer.add(tokenizedTargets_[type].indices);
+          writer.add(tokenizedTargets_[type].offsets);
+        }
+      });
 
-  LOG_IF(FATAL, !infile) << "Could not read file '" << filename << "'";
+  // The process which built the index frees its own copy, and reads the
+  // index as the others do
+  tokenizedTargets_.clear();
+  data_.attach(index, 0);
+  size_t array = SpeechSampleStore::kNumIndexArrays;
+  auto durations = index->array<double>(array++);
+  auto refLengths = index->array<int64_t>(array++);
+  auto types = index->array<int>(array++);
+  if (durations.size != data_.size() || refLengths.size != data_.size() ||
+      index->numArrays() != array + 2 * types.size) {
+    throw std::runtime_error("Invalid dataset index");
+  }
+  for (size_t t = 0; t < types.size; ++t) {
+    auto& columns = targetColumns_[types[t]];
+    columns.indices = index->array<int>(array++);
+    columns.offsets = index->array<int64_t>(array++);
+  }
+  index_ = index;
+
+  std::vector<SpeechSampleMetaInfo> samplesMetaInfo;
+  samplesMetaInfo.reserve(data_.size());
+  for (int64_t i = 0; i < data_.size(); ++i) {
+    samplesMetaInfo.emplace_back(durations[i], refLengths[i], i);
+  }
+  LOG(INFO) << samplesMetaInfo.size() << " files found in the index. ";
+  return samplesMetaInfo;
+}
 
+std::vector<SpeechSampleMetaInfo> W2lListFilesDataset::loadListFile(
+    const std::string& filename) {
   // The format of the list: columns should be space-separated
   // [utterance id] [audio file (full path)] [audio length] [word transcripts]
-  std::string line;
-  std::vector<SpeechSampleMetaInfo> samplesMetaInfo;
+  ListFile list(filename);
+  int64_t numRows = list.size();
+  if (numRows < 1) {
+    throw std::runtime_error("Train files not found from " + filename);
+  }
+
   auto curDataSize = data_.size();
-  int64_t idx = curDataSize;
-  while (std::getline(infile, line)) {
-    auto tokens = splitOnWhitespace(line, true);
+  for (int64_t i = 0; i < numRows; ++i) {
+    data_.add(list.id(i), list.audioHandle(i), list.words(i));
+  }
+  packRecords_.resize(curDataSize + numRows, {-1, 0});
+  std::vector<SpeechSampleMetaInfo> samplesMetaInfo(numRows);
+
+  // The targets are mapped by chunks of rows in parallel, unless they are
+  // sampled, so that the samples don't depend on the scheduling of threads
+  size_t numThreads = pretokenize_
+      ? std::min<size_t>(
+            std::max(std::thread::hardware_concurrency(), 1u),
+            numRows / kRowsPerThread + 1)
+      : 1;
+  std::vector<std::unordered_map<int, TokenizedTargets>> chunkTargets(
+      numThreads);
+  std::vector<std::exception_ptr> errors(numThreads);
+  auto load = [&](size_t t) {
+    try {
+      for (int64_t i = numRows * t / numThreads;
+           i < numRows * (t + 1) / numThreads;
+           ++i) {
+        auto transcript = data_.getTranscript(curDataSize + i);
+        auto targets = tokenizer_->tokenize(transcript);
+        samplesMetaInfo[i] = SpeechSampleMetaInfo(
+            list.audioSize(i), targets.size(), curDataSize + i);
+        tokenizeTargets(transcript, std::move(targets), chunkTargets[t]);
+      }
+    } catch (...) {
+      errors[t] = std::current_exception();
+    }
+  };
+  std::vector<std::thread> threads;
+  for (size_t t = 1; t < numThreads; ++t) {
+    threads.emplace_back(load, t);
+  }
+  load(0);
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (size_t t = 0; t < numThreads; ++t) {
+    if (errors[t]) {
+      std::rethrow_exception(errors[t]);
+    }
+    for (const auto& chunk : chunkTargets[t]) {
+      auto& tokenized = tokenizedTargets_[chunk.first];
+      int64_t base = tokenized.indices.size();
+      tokenized.indices.insert(
+          tokenized.indices.end(),
+          chunk.second.indices.begin(),
+          chunk.second.indices.end());
+      for (size_t k = 1; k < chunk.second.offsets.size(); ++k) {
+        tokenized.offsets.push_back(base + chunk.second.offsets[k]);
+      }
+    }
+  }
 
-    LOG_IF(FATAL, tokens.size() < 3) << "Cannot parse " << line;
+  LOG(INFO) << samplesMetaInfo.size() << " files found. ";
 
-    data_.emplace_back(SpeechSample(
-        tokens[0],
-        tokens[1],
-        std::vector<std::string>(tokens.begin() + 3, tokens.end())));
+  return samplesMetaInfo;
+}
 
-    auto audioLength = std::stod(tokens[2]);
-    auto targets = wrd2Target(
-        data_.back().getTranscript(),
-        lexicon_,
-        dicts_.at(kTargetIdx),
-        fallback2Ltr_,
-        skipUnk_);
+std::vector<SpeechSampleMetaInfo> W2lListFilesDataset::loadPackFile(
+    const std::string& filename) {
+  auto pack = std::make_shared<AudioPack>(filename);
+  int packIdx = packs_.size();
+  packs_.push_back(pack);
+
+  std::vector<SpeechSampleMetaInfo> samplesMetaInfo;
+  int64_t idx = data_.size();
+  for (int64_t r = 0; r < pack->size(); ++r) {
+    const auto& record = pack->record(r);
+    data_.add(record.sampleId, filename, record.transcript);
+    packRecords_.emplace_back(packIdx, r);
+
+    auto targets = tokenizer_->tokenize(record.transcript);
 
     samplesMetaInfo.emplace_back(
-        SpeechSampleMetaInfo(audioLength, targets.size(), idx));
+        SpeechSampleMetaInfo(record.durationMs, targets.size(), idx));
+    tokenizeTargets(record.transcript, std::move(targets), tokenizedTargets_);
 
     ++idx;
   }
@@ -138,8 +332,31 @@ std::vector<SpeechSampleMetaInfo> W2lListFilesDataset::loadListFile(
     throw std::runtime_error("Train files not found from " + filename);
   }
 
-  LOG(INFO) << samplesMetaInfo.size() << " files found. ";
+  LOG(INFO) << samplesMetaInfo.size() << " files found in pack. ";
 
   return samplesMetaInfo;
 }
+
+void W2lListFilesDataset::tokenizeTargets(
+    const std::vector<std::string>& transcript,
+    std::vector<int> targets,
+    std::unordered_map<int, TokenizedTargets>& tokenizedTargets) const {
+  if (!pretokenize_) {
+    return;
+  }
+  auto append = [&tokenizedTargets](
+                    int targetType, const std::vector<int>& indices) {
+    auto& tokenized = tokenizedTargets[targetType];
+    tokenized.indices.insert(
+        tokenized.indices.end(), indices.begin(), indices.end());
+    tokenized.offsets.push_back(tokenized.indices.size());
+  };
+  append(
+      kTargetIdx,
+      featurizeTarget(std::move(targets), kTargetIdx, dicts_.at(kTargetIdx)));
+  if (includeWrd_) {
+    append(
+        kWordIdx, featurizeTarget(transcript, kWordIdx, dicts_.at(kWordIdx)));
+  }
+}
 } // namespace w2l
@@ -8,12 +8,27 @@
 
 #pragma once
 
+#include <memory>
+#include <unordered_map>
+#include <utility>
+
 #include "common/FlashlightUtils.h"
+#include "common/TargetTokenizer.h"
+#include "data/AudioPack.h"
+#include "data/DatasetIndex.h"
 #include "data/Utils.h"
 #include "data/W2lDataset.h"
 
 namespace w2l {
 
+/**
+ * Dataset of the samples of list files or of audio packs (see AudioPack),
+ * which can be given in place of list files in `filenames`.
+ *
+ * With -dataindex, the samples of list files and their targets are loaded
+ * into a DatasetIndex by the first process of a node, and read in place from
+ * it by all of them.
+ */
 class W2lListFilesDataset : public W2lDataset {
  public:
   W2lListFilesDataset(
@@ -36,12 +51,46 @@ class W2lListFilesDataset : public W2lDataset {
 
  private:
   std::vector<int64_t> sampleSizeOrder_;
-  std::vector<SpeechSample> data_;
+  SpeechSampleStore data_;
   LexiconMap lexicon_;
   bool includeWrd_;
   bool fallback2Ltr_;
   bool skipUnk_;
+  // Maps the transcripts to the indices of the target dictionary
+  std::unique_ptr<TargetTokenizer> tokenizer_;
+
+  // Targets of the samples of `data_` mapped by featurizeTarget() once and
+  // for all, unless they are sampled for each epoch (-sampletarget). Those of
+  // type t of sample i are [offsets[i], offsets[i + 1]) of `indices` of t.
+  struct TokenizedTargets {
+    std::vector<int> indices;
+    std::vector<int64_t> offsets{0};
+  };
+  bool pretokenize_;
+  std::unordered_map<int, TokenizedTargets> tokenizedTargets_;
+  // The targets read by getLoaderData(): those of `tokenizedTargets_`, or of
+  // `index_`
+  struct TargetColumns {
+    ArrayView<int> indices;
+    ArrayView<int64_t> offsets;
+  };
+  std::unordered_map<int, TargetColumns> targetColumns_;
+
+  // The index mapped with -dataindex, which holds the samples and targets
+  std::shared_ptr<DatasetIndex> index_;
+
+  // Pack and record of each sample of `data_`, whose pack index is -1 if its
+  // audio is a file
+  std::vector<std::shared_ptr<AudioPack>> packs_;
+  std::vector<std::pair<int, int64_t>> packRecords_;
 
+  std::vector<SpeechSampleMetaInfo> loadIndex(
+      const std::vector<std::string>& paths);
   std::vector<SpeechSampleMetaInfo> loadListFile(const std::string& filename);
+  std::vector<SpeechSampleMetaInfo> loadPackFile(const std::string& filename);
+  void tokenizeTargets(
+      const std::vector<std::string>& transcript,
+      std::vector<int> targets,
+      std::unordered_map<int, TokenizedTargets>& tokenizedTargets) const;
 };
 } // namespace w2l
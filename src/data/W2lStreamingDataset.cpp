@@ -0,0 +1,241 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "data/W2lStreamingDataset.h"
+
+#include <algorithm>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+
+#include <glog/logging.h>
+
+#include "common/Defines.h"
+#include "common/Utils.h"
+#include "data/AudioPack.h"
+#include "data/Sound.h"
+
+namespace w2l {
+
+W2lStreamingDataset::W2lStreamingDataset(
+    const std::string& filenames,
+    const DictionaryMap& dicts,
+    const LexiconMap& lexicon,
+    int64_t batchSize,
+    int worldRank,
+    int worldSize,
+    int64_t bufferSize,
+    int64_t bucketBatches,
+    int64_t epochBatches,
+    int seed /* = 0 */,
+    bool fallback2Ltr /* = false */,
+    bool skipUnk /* = false */,
+    const std::string& rootdir /* = "" */)
+    : W2lDataset(dicts, batchSize, worldRank, worldSize),
+      bufferSize_(bufferSize),
+      bucketBatches_(bucketBatches),
+      epochBatches_(epochBatches),
+      rng_(seed * static_cast<uint64_t>(worldSize) + worldRank) {
+  includeWrd_ = (dicts.find(kWordIdx) != dicts.end());
+  LOG_IF(FATAL, dicts.find(kTargetIdx) == dicts.end())
+      << "Target dictionary does not exist";
+  tokenizer_ = fl::cpp::make_unique<TargetTokenizer>(
+      lexicon, dicts.at(kTargetIdx), fallback2Ltr, skipUnk);
+  if (bufferSize_ < 1 || bucketBatches_ < 1 || epochBatches_ < 1) {
+    throw std::invalid_argument(
+        "W2lStreamingDataset: the buffer, buckets and epochs can't be empty");
+  }
+  if (FLAGS_sampletarget > 0) {
+    throw std::invalid_argument(
+        "W2lStreamingDataset: the targets can't be sampled");
+  }
+
+  for (const auto& f : split(',', filenames)) {
+    paths_.push_back(pathsConcat(rootdir, trim(f)));
+    if (AudioPack::isAudioPack(paths_.back())) {
+      throw std::invalid_argument(
+          "W2lStreamingDataset: audio packs can't be streamed, " +
+          paths_.back());
+    }
+  }
+  rowSharding_ = paths_.size() < static_cast<size_t>(worldSize_);
+  for (size_t f = 0; f < paths_.size(); ++f) {
+    if (rowSharding_ || static_cast<int64_t>(f) % worldSize_ == worldRank_) {
+      files_.push_back(f);
+    }
+  }
+  keepBehind_ = 2 * std::max(FLAGS_prefetchdepth, FLAGS_nthread) + 16;
+
+  globalBatchIds_.resize(epochBatches_);
+  std::iota(globalBatchIds_.begin(), globalBatchIds_.end(), 0);
+  LOG(INFO) << "Streaming " << files_.size() << " list files"
+            << (rowSharding_ ? ", 1 row in " + std::to_string(worldSize_)
+                             : std::string())
+            << ", epochs of " << epochBatches_ << " batches";
+}
+
+W2lStreamingDataset::~W2lStreamingDataset() {
+  prefetcher_ = nullptr; // join all threads
+}
+
+int64_t W2lStreamingDataset::size() const {
+  return epochBatches_;
+}
+
+std::vector<W2lLoaderData> W2lStreamingDataset::getLoaderData(
+    const int64_t idx) const {
+  Batch batch;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    batch = batchAt(epochStart_ + idx);
+  }
+  std::vector<W2lLoaderData> data(batch.size());
+  for (size_t i = 0; i < batch.size(); ++i) {
+    data[i].sampleId = batch[i].id;
+    data[i].input =
+        loadSoundAs(batch[i].audioHandle, FLAGS_samplerate, FLAGS_channels);
+    data[i].targetIndices[kTargetIdx] = featurizeTarget(
+        std::move(batch[i].targets), kTargetIdx, dicts_.at(kTargetIdx));
+    if (includeWrd_) {
+      data[i].targets[kWordIdx] = std::move(batch[i].words);
+    }
+  }
+  return data;
+}
+
+void W2lStreamingDataset::shuffle(int /* seed */) {
+  if (prefetcher_) {
+    prefetcher_->reset();
+    prefetcher_->resetStats();
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  epochStart_ = std::max(epochStart_, maxRead_ + 1);
+}
+
+const W2lStreamingDataset::Batch& W2lStreamingDataset::batchAt(
+    int64_t streamIdx) const {
+  while (nBatches_ <= streamIdx) {
+    if (ready_.empty()) {
+      bucket();
+    }
+    batches_[nBatches_++] = std::move(ready_.back());
+    ready_.pop_back();
+  }
+  maxRead_ = std::max(maxRead_, streamIdx);
+  batches_.erase(
+      batches_.begin(), batches_.lower_bound(maxRead_ - keepBehind_));
+  auto batch = batches_.find(streamIdx);
+  if (batch == batches_.end()) {
+    throw std::out_of_range(
+        "W2lStreamingDataset: batch " + std::to_string(streamIdx) +
+        " was dropped, the batches must be read in order");
+  }
+  return batch->second;
+}
+
+void W2lStreamingDataset::bucket() const {
+  const size_t poolSize = bucketBatches_ * batchSize_;
+  std::vector<Row> pool;
+  while (pool.size() < poolSize) {
+    Row row;
+    while (static_cast<int64_t>(buffer_.size()) < bufferSize_ &&
+           readRow(row)) {
+      buffer_.push_back(std::move(row));
+    }
+    if (buffer_.empty()) {
+      continue; // the end of a pass, the files are rewound
+    }
+    std::uniform_int_distribution<size_t> draw(0, buffer_.size() - 1);
+    std::swap(buffer_[draw(rng_)], buffer_.back());
+    pool.push_back(std::move(buffer_.back()));
+    buffer_.pop_back();
+  }
+
+  std::sort(pool.begin(), pool.end(), [](const Row& a, const Row& b) {
+    return a.audioSize < b.audioSize;
+  });
+  std::vector<Batch> batches;
+  for (auto& row : pool) {
+    bool full;
+    if (FLAGS_batchframes > 0) {
+      // The padded size of the batch with this sample, the largest so far
+      double frames = row.audioSize / FLAGS_framestridems;
+      full = !batches.empty() &&
+          (batches.back().size() + 1) * frames > FLAGS_batchframes;
+    } else {
+      full = !batches.empty() &&
+          batches.back().size() >= static_cast<size_t>(batchSize_);
+    }
+    if (batches.empty() || full) {
+      batches.emplace_back();
+    }
+    batches.back().push_back(std::move(row));
+  }
+  std::shuffle(batches.begin(), batches.end(), rng_);
+  for (auto& batch : batches) {
+    ready_.push_back(std::move(batch));
+  }
+}
+
+bool W2lStreamingDataset::readRow(Row& row) const {
+  std::string line;
+  while (true) {
+    if (!file_.is_open()) {
+      if (nextFile_ == files_.size()) {
+        if (passRows_ == 0) {
+          throw std::runtime_error(
+              "W2lStreamingDataset: no samples to read in the shard of "
+              "process " +
+              std::to_string(worldRank_));
+        }
+        nextFile_ = 0;
+        passRows_ = 0;
+        return false;
+      }
+      const auto& path = paths_[files_[nextFile_++]];
+      file_.clear();
+      file_.open(path);
+      if (!file_.is_open()) {
+        throw std::runtime_error("Could not read file '" + path + "'");
+      }
+      nextRow_ = 0;
+    }
+    if (!std::getline(file_, line)) {
+      file_.close();
+      continue;
+    }
+    if (trim(line).empty()) {
+      continue;
+    }
+    if (rowSharding_ && nextRow_++ % worldSize_ != worldRank_) {
+      continue;
+    }
+
+    // [sample id] [audio handle] [size] [word transcript]
+    std::istringstream columns(line);
+    row.words.clear();
+    if (!(columns >> row.id >> row.audioHandle >> row.audioSize)) {
+      throw std::runtime_error(
+          "W2lStreamingDataset: invalid list file row '" + line + "'");
+    }
+    std::string word;
+    while (columns >> word) {
+      row.words.push_back(word);
+    }
+    row.targets = tokenizer_->tokenize(row.words);
+    int64_t targetSize = row.targets.size();
+    if (row.audioSize < FLAGS_minisz || row.audioSize > FLAGS_maxisz ||
+        targetSize < FLAGS_mintsz || targetSize > FLAGS_maxtsz) {
+      continue;
+    }
+    ++passRows_;
+    return true;
+  }
+}
+
+} // namespace w2l
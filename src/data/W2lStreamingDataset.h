@@ -0,0 +1,123 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "common/TargetTokenizer.h"
+#include "data/W2lDataset.h"
+
+namespace w2l {
+
+/**
+ * Dataset of the samples of list files read as a stream, so that neither its
+ * start nor its memory depend on the size of the corpus. Nothing is read
+ * before the first batch, and only these samples are held in memory:
+ *
+ * - each process reads its own shard: whole list files if there are at least
+ *   as many as processes, else every `worldSize`-th row from `worldRank`;
+ * - the rows go through a shuffle buffer of `bufferSize` samples, from which
+ *   they are drawn at random;
+ * - `bucketBatches` batches worth of drawn samples are sorted by size and cut
+ *   into batches (of `batchSize` samples, or of at most FLAGS_batchframes
+ *   padded frames if > 0), handed out in random order, so that the batches
+ *   are padded little without sorting the corpus.
+ *
+ * The list files are read again from the start once they are all read, so
+ * the stream is endless: an epoch is the next `epochBatches` batches, and
+ * shuffle() moves on to the following ones instead of permuting them. The
+ * batches must be read roughly in order, as the training loop and the
+ * prefetcher do: those more than a few prefetch depths behind the last one
+ * read are dropped.
+ *
+ * The samples are filtered by their input sizes and target sizes
+ * (FLAGS_minisz ... FLAGS_maxtsz) as they are read. Audio packs and
+ * FLAGS_dataindex aren't supported.
+ */
+class W2lStreamingDataset : public W2lDataset {
+ public:
+  W2lStreamingDataset(
+      const std::string& filenames,
+      const DictionaryMap& dicts,
+      const LexiconMap& lexicon,
+      int64_t batchSize,
+      int worldRank,
+      int worldSize,
+      int64_t bufferSize,
+      int64_t bucketBatches,
+      int64_t epochBatches,
+      int seed = 0,
+      bool fallback2Ltr = false,
+      bool skipUnk = false,
+      const std::string& rootdir = "");
+
+  ~W2lStreamingDataset() override;
+
+  int64_t size() const override;
+
+  virtual std::vector<W2lLoaderData> getLoaderData(
+      const int64_t idx) const override;
+
+  /* Starts the next epoch after the batches read so far */
+  void shuffle(int seed) override;
+
+ private:
+  struct Row {
+    std::string id;
+    std::string audioHandle;
+    double audioSize;
+    std::vector<std::string> words;
+    std::vector<int> targets; // by the target dictionary
+  };
+  using Batch = std::vector<Row>;
+
+  std::vector<std::string> paths_;
+  std::unique_ptr<TargetTokenizer> tokenizer_;
+  bool includeWrd_;
+  int64_t bufferSize_;
+  int64_t bucketBatches_;
+  int64_t epochBatches_;
+  // Batches of the stream kept behind the last one read
+  int64_t keepBehind_;
+  // Whether the process reads every worldSize-th row of all the files,
+  // rather than all the rows of its files
+  bool rowSharding_;
+
+  // The state of the stream, advanced by the data threads
+  mutable std::mutex mutex_;
+  mutable std::mt19937_64 rng_;
+  mutable std::vector<size_t> files_; // of paths_ read by this process
+  mutable size_t nextFile_{0};
+  mutable std::ifstream file_;
+  mutable int64_t nextRow_{0}; // in the file, for sharding rows
+  mutable int64_t passRows_{0}; // read since the files were last rewound
+  mutable std::vector<Row> buffer_;
+  mutable std::vector<Batch> ready_; // bucketed, handed out from the back
+  // The batches around the last one read, by their index in the stream
+  mutable std::map<int64_t, Batch> batches_;
+  mutable int64_t nBatches_{0};
+  mutable int64_t maxRead_{-1};
+  int64_t epochStart_{0};
+
+  /* The batch `streamIdx` of the stream, with the lock held */
+  const Batch& batchAt(int64_t streamIdx) const;
+
+  /* Fills `ready_` from the shuffle buffer, with the lock held */
+  void bucket() const;
+
+  /* Reads the next row of the shard into `row`, false at the end of a pass */
+  bool readRow(Row& row) const;
+};
+} // namespace w2l
@@ -6,6 +6,13 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
 #include <arrayfire.h>
 #include <flashlight/flashlight.h>
 #include <gmock/gmock.h>
@@ -13,8 +20,19 @@
 
 #include "common/Defines.h"
 #include "common/FlashlightUtils.h"
+#include "common/Transforms.h"
+#include "data/AudioPack.h"
+#include "data/BatchCache.h"
+#include "data/DatasetIndex.h"
+#include "data/DeviceFeaturizer.h"
+#include "data/FeatureCache.h"
+#include "data/ObjectStore.h"
 #include "data/Featurize.h"
+#include "data/SpecAugmentStage.h"
+#include "data/SpeedPerturbStage.h"
 #include "data/W2lListFilesDataset.h"
+#include "data/W2lStreamingDataset.h"
+#include "libraries/feature/Mfcc.h"
 
 using namespace w2l;
 
@@ -89,6 +107,190 @@ TEST(DataTest, inputFeaturizer) {
   ASSERT_TRUE(af::max<double>(af::abs(ch1 - ch2)) < 1E-5);
 }
 
+TEST(DataTest, deviceFeaturizer) {
+  int64_t T = 8000, N = 3;
+  std::vector<float> input(T * N);
+  for (int j = 0; j < input.size(); ++j) {
+    auto freq = (j / T + 1) * 100.0;
+    input[j] = 0.5 * std::sin(2 * M_PI * (j % T) * freq / 16000) +
+        0.05 * std::cos(j);
+  }
+  // Default params: energy, pre-emphasis, zero mean frames, derivatives...
+  FeatureParams params;
+  params.samplingFreq = 16000;
+  std::vector<std::vector<float>> cpuFeat = {
+      PowerSpectrum<float>(params).batchApply(input, N),
+      Mfsc<float>(params).batchApply(input, N),
+      Mfcc<float>(params).batchApply(input, N)};
+  std::vector<DeviceFeaturizer::FeatureType> types = {
+      DeviceFeaturizer::FeatureType::POW,
+      DeviceFeaturizer::FeatureType::MFSC,
+      DeviceFeaturizer::FeatureType::MFCC};
+  for (int i = 0; i < types.size(); ++i) {
+    DeviceFeaturizer featurizer(params, types[i]);
+    auto deviceFeat = featurizer.apply(af::array(T, N, input.data()));
+    auto nFrames = params.numFrames(T);
+    ASSERT_EQ(deviceFeat.dims(), af::dim4(featurizer.featSz(), nFrames, N));
+    af::array expected(deviceFeat.dims(), cpuFeat[i].data());
+    // Relative to the magnitude of the features
+    ASSERT_LT(
+        af::max<double>(af::abs(deviceFeat - expected)),
+        1E-4 * af::max<double>(af::abs(expected)));
+  }
+
+  // FRAMES X FEAT X CHANNELS X BATCHSZ
+  af::dim4 dims(50, 8, 2, 3);
+  auto feat = af::randn(dims);
+  std::vector<float> featVec(feat.elements());
+  feat.host(featVec.data());
+  auto expected = normalize(featVec, dims[3]);
+  ASSERT_LT(
+      af::max<double>(af::abs(
+          normalizeOnDevice(feat) - af::array(dims, expected.data()))),
+      1E-4);
+  expected = localNormalize(featVec, 4, 6, dims[0], dims[3]);
+  ASSERT_LT(
+      af::max<double>(af::abs(
+          localNormalizeOnDevice(feat, 4, 6) -
+          af::array(dims, expected.data()))),
+      1E-4);
+}
+
+TEST(DataTest, featureCache) {
+  char* user = getenv("USER");
+  std::string userstr = user ? std::string(user) : "unknown";
+  auto cacheDir =
+      "/tmp/" + userstr + "_featurecache_" + std::to_string(getpid());
+
+  std::vector<float> feat(1000);
+  for (int i = 0; i < feat.size(); ++i) {
+    feat[i] = 20 * std::sin(i * 0.1) - 0.5;
+  }
+  auto stored = feat;
+  std::vector<float> found;
+  {
+    FeatureCache cache(cacheDir, "mfsc 40");
+    cache.insert("sample0", stored);
+    for (int i = 0; i < feat.size(); ++i) {
+      ASSERT_NEAR(stored[i], feat[i], 1E-3 * std::abs(feat[i]));
+    }
+    // Only sealed shards are read
+    ASSERT_FALSE(cache.find("sample0", found));
+    cache.sync();
+    ASSERT_TRUE(cache.find("sample0", found));
+    ASSERT_EQ(found, stored);
+    ASSERT_FALSE(cache.find("sample1", found));
+    cache.insert("sample1", feat);
+  }
+
+  // Shards sealed by another instance, and only for the same key
+  FeatureCache cache(cacheDir, "mfsc 40");
+  ASSERT_TRUE(cache.find("sample0", found));
+  ASSERT_EQ(found, stored);
+  ASSERT_TRUE(cache.find("sample1", found));
+  ASSERT_EQ(found, stored);
+  FeatureCache otherCache(cacheDir, "mfsc 80");
+  ASSERT_FALSE(otherCache.find("sample0", found));
+}
+
+TEST(DataTest, specAugmentStage) {
+  int64_t T = 200, F = 40, B = 8;
+  af::dim4 dims(T, F, 1, B);
+  std::vector<float> input(dims.elements());
+  for (size_t i = 0; i < input.size(); ++i) {
+    input[i] = 1 + (i % 7);
+  }
+
+  auto masked = input;
+  SpecAugmentStage::fromString("0 10 1 20 1.0 1").apply(masked, dims, 1);
+  auto sameSeed = input;
+  SpecAugmentStage::fromString("0 10 1 20 1.0 1").apply(sameSeed, dims, 1);
+  ASSERT_EQ(masked, sameSeed);
+
+  // Each value is either masked or kept, and each sample has its own masks
+  std::vector<std::vector<bool>> maskedFrames(B, std::vector<bool>(T, true));
+  for (int64_t b = 0; b < B; ++b) {
+    int64_t nMaskedChans = 0;
+    for (int64_t f = 0; f < F; ++f) {
+      bool allMasked = true;
+      for (int64_t t = 0; t < T; ++t) {
+        auto i = t + T * (f + F * b);
+        ASSERT_TRUE(masked[i] == 0 || masked[i] == input[i]);
+        allMasked = allMasked && masked[i] == 0;
+        maskedFrames[b][t] = maskedFrames[b][t] && masked[i] == 0;
+      }
+      nMaskedChans += allMasked;
+    }
+    ASSERT_GT(nMaskedChans, 0);
+    ASSERT_GT(
+        std::count(maskedFrames[b].begin(), maskedFrames[b].end(), true), 0);
+  }
+  ASSERT_NE(
+      std::count(maskedFrames.begin(), maskedFrames.end(), maskedFrames[0]), B);
+
+  // Time warping keeps the values in the range of the input
+  auto warped = input;
+  SpecAugmentStage::fromString("5 10 0 20 1.0 0").apply(warped, dims, 2);
+  ASSERT_NE(warped, input);
+  ASSERT_GE(*std::min_element(warped.begin(), warped.end()), 1 - 1e-5);
+  ASSERT_LE(*std::max_element(warped.begin(), warped.end()), 7 + 1e-5);
+
+  ASSERT_THROW(
+      SpecAugmentStage::fromString("0 10 1 20"), std::invalid_argument);
+}
+
+TEST(DataTest, speedPerturbStage) {
+  // 1s of a 200Hz sine at 16kHz: 400 zero crossings
+  std::vector<float> audio(16000);
+  for (int i = 0; i < audio.size(); ++i) {
+    audio[i] = std::sin(2 * M_PI * 200 * i / 16000 + 0.1);
+  }
+  auto zeroCrossings = [](const std::vector<float>& v) {
+    int n = 0;
+    for (int i = 1; i < v.size(); ++i) {
+      n += (v[i - 1] < 0) != (v[i] < 0);
+    }
+    return n;
+  };
+
+  // Faster speed: as many periods in less time
+  SpeedPerturbStage speed(SpeedPerturbStage::Mode::SPEED, 0.9, 1.1, 16000, 1);
+  auto faster = speed.perturb(audio, 1.25);
+  ASSERT_EQ(faster.size(), 12800);
+  ASSERT_NEAR(zeroCrossings(faster), 400, 2);
+  ASSERT_EQ(speed.perturb(audio, 1.0), audio);
+
+  // Faster tempo: the same frequency in less time
+  auto tempo = SpeedPerturbStage::fromString("tempo 0.9 1.1", 16000, 1);
+  auto slower = tempo.perturb(audio, 0.8);
+  ASSERT_EQ(slower.size(), 20000);
+  ASSERT_NEAR(zeroCrossings(slower), 500, 5);
+  faster = tempo.perturb(audio, 1.25);
+  ASSERT_EQ(faster.size(), 12800);
+  ASSERT_NEAR(zeroCrossings(faster), 320, 5);
+
+  // A factor by sample, drawn from the seed
+  std::vector<W2lLoaderData> batch(4), sameSeed;
+  for (auto& sample : batch) {
+    sample.input = audio;
+  }
+  sameSeed = batch;
+  speed.apply(batch, 1);
+  speed.apply(sameSeed, 1);
+  for (int i = 0; i < batch.size(); ++i) {
+    ASSERT_EQ(batch[i].input, sameSeed[i].input);
+    ASSERT_GE(batch[i].input.size(), 16000 / 1.1 - 1);
+    ASSERT_LE(batch[i].input.size(), 16000 / 0.9 + 1);
+  }
+
+  ASSERT_THROW(
+      SpeedPerturbStage::fromString("pitch 0.9 1.1", 16000, 1),
+      std::invalid_argument);
+  ASSERT_THROW(
+      SpeedPerturbStage::fromString("speed 1.1 0.9", 16000, 1),
+      std::invalid_argument);
+}
+
 TEST(DataTest, targetFeaturizer) {
   auto dict = getDict();
   dict.addEntry(kEosToken);
@@ -195,6 +397,130 @@ TEST(DataTest, W2lListDataset) {
   ASSERT_EQ(input.dims(), af::dim4(24000));
 }
 
+TEST(DataTest, W2lStreamingDataset) {
+  gflags::FlagSaver flagsaver;
+  w2l::FLAGS_mfcc = false;
+  w2l::FLAGS_mfsc = false;
+  w2l::FLAGS_pow = false;
+  w2l::FLAGS_nthread = 0;
+  w2l::FLAGS_prefetchdepth = 0;
+  w2l::FLAGS_replabel = 0;
+  w2l::FLAGS_surround = "";
+  w2l::FLAGS_batchframes = 0;
+
+  // The same 3 samples in 2 list files
+  auto fileList = "/tmp/" + std::to_string(getpid()) + "_stream";
+  for (int f = 0; f < 2; ++f) {
+    std::ofstream fs(fileList + std::to_string(f) + ".lst");
+    for (int64_t idx = 0; idx < 3; idx++) {
+      std::array<char, 20> fchar;
+      snprintf(fchar.data(), fchar.size(), "%09ld.", idx);
+      auto audioFile =
+          pathsConcat(loadPath, "dataset/" + std::string(fchar.data()) + "wav");
+      fs << f << "-" << idx << " " << audioFile << " " << 1000 * (idx + 1)
+         << " uh uh" << std::endl;
+    }
+  }
+  auto lists = fileList + "0.lst," + fileList + "1.lst";
+
+  DictionaryMap dicts;
+  dicts.insert({kTargetIdx, getDict()});
+  std::vector<std::string> ids;
+  {
+    // 2 processes: each reads its own file
+    W2lStreamingDataset ds(lists, dicts, getLexicon(), 2, 1, 2, 2, 1, 4);
+    ASSERT_EQ(ds.size(), 4);
+    for (int64_t i = 0; i < ds.size(); ++i) {
+      auto data = ds.getLoaderData(i);
+      ASSERT_GE(data.size(), 1);
+      ASSERT_LE(data.size(), 2);
+      for (const auto& sample : data) {
+        ASSERT_EQ(sample.sampleId.substr(0, 2), "1-");
+        ASSERT_FALSE(sample.input.empty());
+        ids.push_back(sample.sampleId);
+      }
+    }
+    // Every sample of a pass is read before the next pass is
+    std::sort(ids.begin(), ids.begin() + 3);
+    ASSERT_EQ(ids[0], "1-0");
+    ASSERT_EQ(ids[2], "1-2");
+    ds.shuffle(0);
+    // The next epoch goes on with the next batches
+    ASSERT_NE(ds.getLoaderData(0)[0].sampleId, "");
+  }
+  {
+    // More processes than files: the rows are dealt
+    W2lStreamingDataset ds(lists, dicts, getLexicon(), 1, 2, 4, 1, 1, 40);
+    for (int64_t i = 0; i < 3; ++i) {
+      auto id = ds.getLoaderData(i)[0].sampleId;
+      ASSERT_TRUE(id == "0-2" || id == "1-2") << id;
+    }
+    for (int64_t i = 3; i < 40; ++i) {
+      ds.getLoaderData(i);
+    }
+    ASSERT_THROW(ds.getLoaderData(0), std::out_of_range);
+  }
+}
+
+TEST(DataTest, W2lAudioPackDataset) {
+  gflags::FlagSaver flagsaver;
+  w2l::FLAGS_mfcc = false;
+  w2l::FLAGS_mfsc = false;
+  w2l::FLAGS_pow = false;
+  w2l::FLAGS_nthread = 6;
+  w2l::FLAGS_replabel = 0;
+  w2l::FLAGS_surround = "";
+  w2l::FLAGS_dataorder = "none";
+
+  char* user = getenv("USER");
+  std::string userstr = user ? std::string(user) : "unknown";
+  auto fileList = "/tmp/" + userstr + "_packlist.txt";
+  auto packFile = "/tmp/" + userstr + "_" + std::to_string(getpid()) + ".pack";
+
+  std::ofstream fs(fileList, std::ofstream::out);
+  {
+    AudioPackWriter writer(packFile);
+    for (int64_t idx = 0; idx < 3; idx++) {
+      std::array<char, 20> fchar;
+      snprintf(fchar.data(), fchar.size(), "%09ld.", idx);
+      auto audioFile =
+          pathsConcat(loadPath, "dataset/" + std::string(fchar.data()) + "wav");
+      auto targets = loadTarget(
+          pathsConcat(loadPath, "dataset/" + std::string(fchar.data()) + "wrd"));
+      auto info = w2l::loadSoundInfo(audioFile);
+      auto durationMs =
+          (static_cast<double>(info.frames) / info.samplerate) * 1e3;
+
+      writer.add(std::to_string(idx), audioFile, durationMs, targets);
+      fs << idx << " " << audioFile << " " << durationMs;
+      for (auto t : targets) {
+        fs << " " << t;
+      }
+      fs << std::endl;
+    }
+  }
+  fs.close();
+  ASSERT_TRUE(AudioPack::isAudioPack(packFile));
+  ASSERT_FALSE(AudioPack::isAudioPack(fileList));
+
+  DictionaryMap dicts;
+  dicts.insert({kTargetIdx, getDict()});
+  auto lexicon = getLexicon();
+
+  // The samples of a pack are the ones of the list it was written from
+  W2lListFilesDataset listDs(fileList, dicts, lexicon, 1);
+  W2lListFilesDataset packDs(packFile, dicts, lexicon, 1);
+  ASSERT_EQ(packDs.size(), listDs.size());
+  for (int64_t i = 0; i < packDs.size(); ++i) {
+    auto expected = listDs.get(i);
+    auto fields = packDs.get(i);
+    for (auto idx : {kInputIdx, kTargetIdx, kSampleIdx}) {
+      ASSERT_EQ(fields[idx].dims(), expected[idx].dims());
+      ASSERT_TRUE(af::allTrue<bool>(fields[idx] == expected[idx]));
+    }
+  }
+}
+
 TEST(RoundRobinBatchShufflerTest, params) {
   auto packer = RoundRobinBatchPacker(2, 2, 0);
   auto batches = packer.getBatches(11, 0);
@@ -235,6 +561,296 @@ TEST(RoundRobinBatchShufflerTest, params) {
   ASSERT_THAT(batches[1], ::testing::ElementsAre(4, 5));
 }
 
+TEST(DynamicBatchPackerTest, params) {
+  // Sorted by size: samples 1, 6, 3, 2 | 5, 0 | 7, 4
+  std::vector<double> sizes = {5, 1, 3, 2, 8, 4, 1, 7};
+  auto packer = DynamicBatchPacker(sizes, 8, 2, 0);
+  auto batches = packer.getBatches(8, -1);
+  EXPECT_EQ(batches.size(), 3);
+  ASSERT_THAT(batches[0], ::testing::ElementsAre(1, 3));
+  ASSERT_THAT(batches[1], ::testing::ElementsAre(5));
+  ASSERT_THAT(batches[2], ::testing::ElementsAre(7));
+
+  packer = DynamicBatchPacker(sizes, 8, 2, 1);
+  batches = packer.getBatches(8, -1);
+  EXPECT_EQ(batches.size(), 3);
+  ASSERT_THAT(batches[0], ::testing::ElementsAre(6, 2));
+  ASSERT_THAT(batches[1], ::testing::ElementsAre(0));
+  ASSERT_THAT(batches[2], ::testing::ElementsAre(4));
+
+  // The processes get the same global batches with the same seed
+  auto batches0 = DynamicBatchPacker(sizes, 8, 2, 0).getBatches(8, 3);
+  auto batches1 = DynamicBatchPacker(sizes, 8, 2, 1).getBatches(8, 3);
+  ASSERT_EQ(batches0.size(), batches1.size());
+  for (int i = 0; i < batches0.size(); ++i) {
+    ASSERT_EQ(batches0[i].size(), batches1[i].size());
+    ASSERT_LE(std::abs(sizes[batches0[i][0]] - sizes[batches1[i][0]]), 1);
+  }
+
+  // A sample larger than the budget is batched alone, and the last samples
+  // are dropped if there are fewer than processes
+  packer = DynamicBatchPacker({1, 20, 2, 3, 4}, 4, 1, 0);
+  batches = packer.getBatches(5, -1);
+  EXPECT_EQ(batches.size(), 4);
+  ASSERT_THAT(batches[0], ::testing::ElementsAre(0, 2));
+  ASSERT_THAT(batches[1], ::testing::ElementsAre(3));
+  ASSERT_THAT(batches[2], ::testing::ElementsAre(4));
+  ASSERT_THAT(batches[3], ::testing::ElementsAre(1));
+  packer = DynamicBatchPacker({1, 2, 3}, 2, 2, 1);
+  batches = packer.getBatches(3, -1);
+  EXPECT_EQ(batches.size(), 1);
+  ASSERT_THAT(batches[0], ::testing::ElementsAre(1));
+}
+
+TEST(BalancedBatchPackerTest, params) {
+  std::vector<double> sizes = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+  auto packer = BalancedBatchPacker(sizes, 2, 2, 0);
+  auto batches = packer.getBatches(10, -1);
+  EXPECT_EQ(batches.size(), 3);
+  ASSERT_THAT(batches[0], ::testing::ElementsAre(0, 3));
+  ASSERT_THAT(batches[1], ::testing::ElementsAre(4, 7));
+  ASSERT_THAT(batches[2], ::testing::ElementsAre(9));
+
+  packer = BalancedBatchPacker(sizes, 2, 2, 1);
+  batches = packer.getBatches(10, -1);
+  EXPECT_EQ(batches.size(), 3);
+  ASSERT_THAT(batches[0], ::testing::ElementsAre(1, 2));
+  ASSERT_THAT(batches[1], ::testing::ElementsAre(5, 6));
+  ASSERT_THAT(batches[2], ::testing::ElementsAre(8));
+
+  // The processes share the global batches of RoundRobinBatchPacker
+  for (int64_t rank = 0; rank < 3; ++rank) {
+    auto balanced = BalancedBatchPacker(sizes, 3, 3, rank).getBatches(10, 5);
+    auto roundRobin = RoundRobinBatchPacker(3, 3, rank).getBatches(10, 5);
+    ASSERT_EQ(balanced.size(), roundRobin.size());
+    for (int i = 0; i < balanced.size(); ++i) {
+      ASSERT_EQ(balanced[i].size(), roundRobin[i].size());
+      ASSERT_EQ(balanced[i][0] / 9, roundRobin[i][0] / 9);
+    }
+  }
+}
+
+TEST(DataTest, sortAndFilterSamples) {
+  // Enough samples for several threads, with many equal keys
+  std::vector<SpeechSampleMetaInfo> samples;
+  for (int64_t i = 0; i < 300000; ++i) {
+    samples.emplace_back((i * 7919) % 1000, (i * 104729) % 50, i);
+  }
+
+  auto sorted = sortSamples(samples, "input_spiral", 100, 10);
+  ASSERT_EQ(sorted.size(), samples.size());
+  for (size_t i = 1; i < sorted.size(); ++i) {
+    const auto& prev = samples[sorted[i - 1]];
+    const auto& cur = samples[sorted[i]];
+    auto prevBin = prev.reflength() / 10, bin = cur.reflength() / 10;
+    ASSERT_LE(prevBin, bin);
+    if (prevBin == bin) {
+      if (bin % 2 == 0) {
+        ASSERT_LE(prev.audiolength(), cur.audiolength());
+      } else {
+        ASSERT_GE(prev.audiolength(), cur.audiolength());
+      }
+      if (prev.audiolength() == cur.audiolength()) {
+        ASSERT_LT(sorted[i - 1], sorted[i]); // ties keep the list order
+      }
+    }
+  }
+  ASSERT_EQ(sortSamples(samples, "input_spiral", 100, 10), sorted);
+  auto unsorted = sortSamples(samples, "none", 100, 10);
+  ASSERT_EQ(unsorted[12345], 12345);
+
+  auto filtered = samples;
+  filterSamples(filtered, 100, 800, 5, 40);
+  std::vector<int64_t> expected;
+  for (const auto& sample : samples) {
+    if (sample.audiolength() >= 100 && sample.audiolength() <= 800 &&
+        sample.reflength() >= 5 && sample.reflength() <= 40) {
+      expected.push_back(sample.index());
+    }
+  }
+  ASSERT_EQ(filtered.size(), expected.size());
+  for (size_t i = 0; i < expected.size(); ++i) {
+    ASSERT_EQ(filtered[i].index(), expected[i]);
+  }
+}
+
+TEST(DataTest, speechSampleStore) {
+  SpeechSampleStore store;
+  store.add("a", "/tmp/a.flac", {"hello", "world"});
+  store.add("b", "", {});
+  store.add("", "/tmp/c.wav", {"world", "hello", "world"});
+  store.shrinkToFit();
+  ASSERT_EQ(store.size(), 3);
+  ASSERT_EQ(store.getSampleId(0), "a");
+  ASSERT_EQ(store.getAudioFile(0), "/tmp/a.flac");
+  ASSERT_THAT(store.getTranscript(0), ::testing::ElementsAre("hello", "world"));
+  ASSERT_EQ(store.getAudioFile(1), "");
+  ASSERT_TRUE(store.getTranscript(1).empty());
+  auto sample = store.get(2);
+  ASSERT_EQ(sample.getSampleId(), "");
+  ASSERT_EQ(sample.getAudioFile(), "/tmp/c.wav");
+  ASSERT_THAT(
+      sample.getTranscript(),
+      ::testing::ElementsAre("world", "hello", "world"));
+}
+
+TEST(DataTest, datasetIndex) {
+  auto dir = "/tmp/datasetindex_" + std::to_string(getpid());
+  int numBuilds = 0;
+  auto build = [&numBuilds](DatasetIndex::Writer& writer) {
+    SpeechSampleStore store;
+    store.add("a", "/tmp/a.flac", {"hello", "world"});
+    store.add("b", "/tmp/b.flac", {"world"});
+    store.write(writer);
+    writer.add(std::vector<double>{1.5, 2.5, 3.5});
+    ++numBuilds;
+  };
+  auto index = DatasetIndex::getOrBuild(dir, "key", build);
+  ASSERT_EQ(DatasetIndex::getOrBuild(dir, "key", build)->numArrays(), 7);
+  ASSERT_EQ(numBuilds, 1);
+  ASSERT_EQ(index->numArrays(), SpeechSampleStore::kNumIndexArrays + 1);
+
+  SpeechSampleStore store;
+  store.attach(index, 0);
+  ASSERT_EQ(store.size(), 2);
+  ASSERT_EQ(store.getSampleId(1), "b");
+  ASSERT_EQ(store.getAudioFile(0), "/tmp/a.flac");
+  ASSERT_THAT(store.getTranscript(0), ::testing::ElementsAre("hello", "world"));
+  ASSERT_THAT(store.getTranscript(1), ::testing::ElementsAre("world"));
+  auto durations = index->array<double>(SpeechSampleStore::kNumIndexArrays);
+  ASSERT_EQ(durations.size, 3);
+  ASSERT_EQ(durations[2], 3.5);
+  ASSERT_THROW(store.add("c", "", {}), std::logic_error);
+
+  DatasetIndex::getOrBuild(dir, "other key", build);
+  ASSERT_EQ(numBuilds, 2);
+}
+
+namespace {
+
+// Objects in memory, counting the reads
+class MemoryObjectStore : public ObjectStore {
+ public:
+  std::unordered_map<std::string, std::string> objects;
+  std::atomic<int> numReads{0};
+
+  int64_t size(const std::string& url) override {
+    return objects.at(url).size();
+  }
+
+  void read(const std::string& url, int64_t offset, char* data, int64_t size)
+      override {
+    ++numReads;
+    std::memcpy(data, objects.at(url).data() + offset, size);
+  }
+};
+
+} // namespace
+
+TEST(DataTest, objectStore) {
+  ASSERT_TRUE(ObjectStore::isRemote("s3://bucket/a.flac"));
+  ASSERT_FALSE(ObjectStore::isRemote("/data/a.flac"));
+  ASSERT_EQ(
+      HttpObjectStore::httpUrl("s3://bucket/dir/a.flac"),
+      "https://bucket.s3.amazonaws.com/dir/a.flac");
+  ASSERT_EQ(
+      HttpObjectStore::httpUrl("gs://bucket/a.flac"),
+      "https://storage.googleapis.com/bucket/a.flac");
+
+  auto memory = std::make_shared<MemoryObjectStore>();
+  std::string object;
+  for (int i = 0; i < 1000; ++i) {
+    object += std::to_string(i) + ",";
+  }
+  memory->objects["s3://bucket/object"] = object;
+  {
+    // Blocks of 100 bytes, 5 of which fit in the cache, without readahead
+    CachedObjectStore store(memory, 100, 500, 0, 1);
+    std::string data(250, 0);
+    store.read("s3://bucket/object", 50, &data[0], data.size());
+    ASSERT_EQ(data, object.substr(50, 250));
+    ASSERT_EQ(memory->numReads, 3);
+    store.read("s3://bucket/object", 120, &data[0], 150);
+    ASSERT_EQ(memory->numReads, 3);
+    for (int b = 3; b < 10; ++b) {
+      store.read("s3://bucket/object", b * 100, &data[0], 10);
+    }
+    ASSERT_EQ(memory->numReads, 10);
+    store.read("s3://bucket/object", 0, &data[0], 10); // evicted
+    ASSERT_EQ(memory->numReads, 11);
+    ASSERT_THROW(
+        store.read("s3://bucket/object", object.size() - 5, &data[0], 10),
+        std::out_of_range);
+  }
+  {
+    // Blocks after the ones read are prefetched
+    memory->numReads = 0;
+    CachedObjectStore store(memory, 100, 1 << 20, 3, 2);
+    std::string data(10, 0);
+    store.read("s3://bucket/object", 0, &data[0], data.size());
+    for (int i = 0; i < 100 && memory->numReads < 4; ++i) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ASSERT_EQ(memory->numReads, 4);
+    store.read("s3://bucket/object", 100, &data[0], data.size());
+    ASSERT_GE(memory->numReads, 4);
+  }
+
+  auto store = std::make_shared<CachedObjectStore>(memory, 64, 1 << 20, 0, 1);
+  ObjectInputStream stream(store, "s3://bucket/object");
+  ASSERT_TRUE(stream.good());
+  std::string all(
+      (std::istreambuf_iterator<char>(stream)),
+      std::istreambuf_iterator<char>());
+  ASSERT_EQ(all, object);
+  stream.clear();
+  stream.seekg(-4, std::ios_base::end);
+  ASSERT_EQ(
+      static_cast<int64_t>(stream.tellg()),
+      static_cast<int64_t>(object.size()) - 4);
+  std::string tail(4, 0);
+  stream.read(&tail[0], 4);
+  ASSERT_EQ(tail, object.substr(object.size() - 4));
+  stream.seekg(10);
+  std::string word(5, 0);
+  stream.read(&word[0], 5);
+  ASSERT_EQ(word, object.substr(10, 5));
+  ASSERT_FALSE(ObjectInputStream(store, "s3://bucket/missing").good());
+}
+
+TEST(DataTest, batchCache) {
+  auto batch = [](int size) {
+    auto feat = std::make_shared<W2lFeatureData>();
+    feat->input.resize(size, 1.0);
+    return BatchCache::BatchPtr(feat);
+  };
+  auto bytes = BatchCache::batchBytes(*batch(100));
+  BatchCache cache(3 * bytes);
+  int owner1, owner2;
+  cache.put(&owner1, 0, batch(100));
+  cache.put(&owner1, 1, batch(100));
+  cache.put(&owner2, 0, batch(100));
+  ASSERT_EQ(cache.cachedBytes(), 3 * bytes);
+  ASSERT_EQ(cache.get(&owner1, 0)->input.size(), 100);
+  ASSERT_EQ(cache.get(&owner1, 2), nullptr);
+
+  // The least recently used batch is evicted
+  cache.put(&owner2, 1, batch(100));
+  ASSERT_EQ(cache.get(&owner1, 1), nullptr);
+  ASSERT_NE(cache.get(&owner1, 0), nullptr);
+  ASSERT_EQ(cache.cachedBytes(), 3 * bytes);
+
+  // Batches larger than the cache aren't cached
+  cache.put(&owner2, 2, batch(1000));
+  ASSERT_EQ(cache.get(&owner2, 2), nullptr);
+  ASSERT_EQ(cache.cachedBytes(), 3 * bytes);
+
+  cache.erase(&owner2);
+  ASSERT_EQ(cache.get(&owner2, 0), nullptr);
+  ASSERT_EQ(cache.get(&owner2, 1), nullptr);
+  ASSERT_EQ(cache.cachedBytes(), bytes);
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
 
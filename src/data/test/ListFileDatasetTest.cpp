@@ -14,6 +14,7 @@
 #include <gtest/gtest.h>
 
 #include "common/Utils.h"
+#include "data/ListFile.h"
 #include "data/ListFileDataset.h"
 
 using namespace w2l;
@@ -41,6 +42,42 @@ TEST(ListFileDatasetTest, LoadData) {
   }
 }
 
+TEST(ListFileDatasetTest, ListFile) {
+  auto path = "/tmp/listfile.lst";
+  {
+    std::ofstream out(path);
+    out << "a /tmp/a.flac 1.5  hello   world \n\n  \t\n";
+    out << "b\t/tmp/b.flac 2\n";
+    // Enough rows for several chunks
+    for (int i = 0; i < 300000; ++i) {
+      out << "id" << i << " /tmp/" << i << ".wav " << i << " w" << i << "\n";
+    }
+    out << "last /tmp/last.wav 3 no newline";
+  }
+  ListFile list(path);
+  ASSERT_EQ(list.size(), 300003);
+  ASSERT_EQ(list.id(0), "a");
+  ASSERT_EQ(list.audioHandle(0), "/tmp/a.flac");
+  ASSERT_EQ(list.audioSize(0), 1.5);
+  ASSERT_EQ(list.words(0), std::vector<std::string>({"hello", "world"}));
+  ASSERT_EQ(list.transcript(0), "hello world");
+  ASSERT_EQ(list.id(1), "b");
+  ASSERT_FALSE(list.hasWords(1));
+  ASSERT_TRUE(list.words(1).empty());
+  for (int i = 0; i < 300000; i += 997) {
+    ASSERT_EQ(list.id(i + 2), "id" + std::to_string(i));
+    ASSERT_EQ(list.audioSize(i + 2), i);
+    ASSERT_EQ(list.transcript(i + 2), "w" + std::to_string(i));
+  }
+  ASSERT_EQ(list.transcript(300002), "no newline");
+
+  {
+    std::ofstream out(path);
+    out << "a /tmp/a.flac 1.5 hello\nb /tmp/b.flac\n";
+  }
+  ASSERT_THROW(ListFile{path}, std::runtime_error);
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
 
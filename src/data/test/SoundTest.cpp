@@ -8,11 +8,13 @@
 
 #include <gmock/gmock.h>
 
+#include <cmath>
 #include <fstream>
 #include <functional>
 #include <sstream>
 
 #include "common/FlashlightUtils.h"
+#include "data/Resampler.h"
 #include "data/Sound.h"
 
 namespace {
@@ -103,6 +105,27 @@ TEST(SoundTest, Stereo) {
   }
 }
 
+TEST(SoundTest, ChunkedRead) {
+  auto audiopath = w2l::pathsConcat(loadPath, "test_stereo.wav");
+  auto vecFloat = w2l::loadSound<float>(audiopath);
+
+  // From a file and from a stream, in chunks not dividing the frames
+  std::ifstream f(audiopath);
+  w2l::SoundReader fileReader(audiopath);
+  w2l::SoundReader streamReader(f);
+  for (auto* reader : {&fileReader, &streamReader}) {
+    ASSERT_EQ(reader->info().frames, 24576);
+    ASSERT_EQ(reader->info().channels, 2);
+    std::vector<float> chunks;
+    std::vector<float> chunk;
+    while (!(chunk = reader->readChunk<float>(1000)).empty()) {
+      ASSERT_LE(chunk.size(), 1000 * 2);
+      chunks.insert(chunks.end(), chunk.begin(), chunk.end());
+    }
+    ASSERT_EQ(chunks, vecFloat);
+  }
+}
+
 TEST(SoundTest, OggReadWrite) {
   auto audiopath = w2l::pathsConcat(loadPath, "test_stereo.wav");
   auto outaudiopath = w2l::pathsConcat("/tmp", "test_stereo_out.ogg");
@@ -158,6 +181,78 @@ TEST(SoundTest, StreamReadWrite) {
   }
 }
 
+TEST(SoundTest, Resample) {
+  const double pi = std::acos(-1);
+  // A stereo 440 Hz tone at 44.1 kHz, and a 10 kHz one above the Nyquist
+  // frequency of 16 kHz, downmixed and resampled to mono 16 kHz
+  int64_t frames = 44100;
+  std::vector<float> input(2 * frames);
+  std::vector<float> high(frames);
+  for (int64_t i = 0; i < frames; ++i) {
+    input[2 * i] = std::sin(2 * pi * 440 * i / 44100);
+    input[2 * i + 1] = std::sin(2 * pi * 440 * i / 44100 + 0.5);
+    high[i] = std::sin(2 * pi * 10000 * i / 44100);
+  }
+  auto resample = [](const std::vector<float>& in,
+                     int64_t inChannels,
+                     int64_t chunkFrames) {
+    w2l::Resampler resampler(44100, 16000, inChannels, 1);
+    std::vector<float> out;
+    int64_t inFrames = in.size() / inChannels;
+    for (int64_t i = 0; i < inFrames; i += chunkFrames) {
+      auto n = std::min(chunkFrames, inFrames - i);
+      resampler.process(in.data() + i * inChannels, n, out);
+    }
+    resampler.flush(out);
+    return out;
+  };
+  auto output = resample(input, 2, frames);
+  ASSERT_EQ(output.size(), 16000);
+  // The chunks don't change the output
+  ASSERT_EQ(resample(input, 2, 777), output);
+  for (int64_t i = 100; i < 15900; ++i) {
+    double t = 2 * pi * 440 * i / 16000;
+    ASSERT_NEAR(output[i], (std::sin(t) + std::sin(t + 0.5)) / 2, 1E-4);
+  }
+  auto aliased = resample(high, 1, 1000);
+  for (int64_t i = 100; i < 15900; ++i) {
+    ASSERT_NEAR(aliased[i], 0, 1E-3);
+  }
+
+  // Upsampled and duplicated to stereo
+  w2l::Resampler upsampler(8000, 16000, 1, 2);
+  std::vector<float> tone(8000);
+  for (int64_t i = 0; i < tone.size(); ++i) {
+    tone[i] = std::sin(2 * pi * 300 * i / 8000);
+  }
+  std::vector<float> upsampled;
+  upsampler.process(tone.data(), tone.size(), upsampled);
+  upsampler.flush(upsampled);
+  ASSERT_EQ(upsampled.size(), 2 * 16000);
+  for (int64_t i = 100; i < 15900; ++i) {
+    ASSERT_NEAR(upsampled[2 * i], std::sin(2 * pi * 300 * i / 16000), 1E-4);
+    ASSERT_EQ(upsampled[2 * i], upsampled[2 * i + 1]);
+  }
+
+  ASSERT_THROW(w2l::Resampler(16000, 16000, 3, 2), std::invalid_argument);
+  ASSERT_THROW(w2l::Resampler(16000, 16001, 1, 1), std::invalid_argument);
+}
+
+TEST(SoundTest, LoadSoundAs) {
+  auto audiopath = w2l::pathsConcat(loadPath, "test_stereo.wav");
+  auto vecFloat = w2l::loadSound<float>(audiopath);
+  ASSERT_EQ(w2l::loadSoundAs(audiopath, 48000, 2), vecFloat);
+
+  // Resampled as it's decoded, as when the whole sound is resampled at once
+  w2l::Resampler resampler(48000, 16000, 2, 1);
+  std::vector<float> expected;
+  resampler.process(vecFloat.data(), vecFloat.size() / 2, expected);
+  resampler.flush(expected);
+  auto resampled = w2l::loadSoundAs(audiopath, 16000, 1);
+  ASSERT_EQ(resampled.size(), 24576 / 3);
+  ASSERT_EQ(resampled, expected);
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
 
@@ -0,0 +1,353 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/**
+ * Benchmarks the decoders on a fixed slice of recorded emissions (as written
+ * by Test), with the lexicon and LM of the flags used by Decoder. Each decoder
+ * runs for each beam size and number of threads of --bench_beamsizes and
+ * --bench_threads, and one JSON line is printed per run, with its throughput
+ * (frames/s), real-time factor, candidates per frame and peak RSS.
+ *
+ * The Seq2Seq decoders search the recorded frames replayed as the scores of
+ * their steps, so the acoustic model isn't part of the measure: the tokens of
+ * the emissions must be those of the dictionary.
+ *
+ * Usage: DecoderBenchmark --flagsfile=[decode flags] --emission_dir=[dir]
+ *   --bench_decoders=lexicon,lexiconfree --bench_beamsizes=50,500
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "common/Defines.h"
+#include "common/FlashlightUtils.h"
+#include "libraries/common/Dictionary.h"
+#include "libraries/common/WordUtils.h"
+#include "libraries/decoder/LexiconDecoder.h"
+#include "libraries/decoder/LexiconFreeDecoder.h"
+#include "libraries/decoder/LexiconFreeSeq2SeqDecoder.h"
+#include "libraries/decoder/LexiconSeq2SeqDecoder.h"
+#include "libraries/decoder/Trie.h"
+#include "libraries/lm/KenLM.h"
+#include "libraries/lm/ZeroLM.h"
+#include "runtime/runtime.h"
+
+namespace {
+
+DEFINE_string(
+    bench_decoders,
+    "lexicon,lexiconfree,lexiconseq2seq,lexiconfreeseq2seq",
+    "decoders to benchmark, among lexicon, lexiconfree, lexiconseq2seq and "
+    "lexiconfreeseq2seq");
+DEFINE_string(bench_beamsizes, "50,500", "beam sizes to benchmark");
+DEFINE_string(bench_threads, "1", "numbers of decoder threads to benchmark");
+DEFINE_int64(bench_samples, 100, "samples of the emission set decoded");
+DEFINE_int64(bench_iters, 1, "passes over the samples of each run");
+DEFINE_string(
+    bench_token_lm,
+    "",
+    "token KenLM of the lexicon-free decoders, none if empty");
+DEFINE_string(bench_output, "", "file the results are appended to, or stdout");
+
+std::vector<int> parseInts(const std::string& list) {
+  std::vector<int> ints;
+  for (const auto& field : w2l::split(',', list, true)) {
+    ints.push_back(std::stoi(field));
+  }
+  return ints;
+}
+
+// The peak RSS since the last reset, in KB (0 if unknown)
+int64_t readPeakRssKb() {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.compare(0, 6, "VmHWM:") == 0) {
+      return std::stoll(line.substr(6));
+    }
+  }
+  return 0;
+}
+
+// Resets the peak RSS to the current RSS, where the kernel allows it
+void resetPeakRss() {
+  std::ofstream clearRefs("/proc/self/clear_refs");
+  clearRefs << "5";
+}
+
+// Replays the recorded frames as the scores of the steps of a Seq2Seq decoder,
+// whatever the tokens of the hypothesis
+w2l::AMUpdateFunc replayAmUpdateFunction() {
+  return [](const float* emissions,
+            const int N,
+            const int T,
+            const std::vector<int>& rawY,
+            const std::vector<w2l::AMStatePtr>& /* prevStates */,
+            int& t) {
+    const float* frame = emissions + std::min(t, T - 1) * N;
+    std::vector<std::vector<float>> scores(
+        rawY.size(), std::vector<float>(frame, frame + N));
+    return std::make_pair(
+        scores, std::vector<w2l::AMStatePtr>(rawY.size(), nullptr));
+  };
+}
+
+} // namespace
+
+using namespace w2l;
+
+int main(int argc, char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  google::InstallFailureSignalHandler();
+  gflags::SetUsageMessage(
+      "Usage: DecoderBenchmark --flagsfile=[decode flags] "
+      "--emission_dir=[emissions] --test=[list]");
+  if (argc <= 1) {
+    LOG(FATAL) << gflags::ProgramUsage();
+  }
+
+  /* ===================== Parse Options ===================== */
+  gflags::ParseCommandLineFlags(&argc, &argv, false);
+  auto flagsfile = FLAGS_flagsfile;
+  if (!flagsfile.empty()) {
+    gflags::ReadFromFlagsFile(flagsfile, argv[0], true);
+    gflags::ParseCommandLineFlags(&argc, &argv, false);
+  }
+  if (FLAGS_emission_dir.empty()) {
+    LOG(FATAL) << "--emission_dir is required";
+  }
+
+  /* ===================== Load Emissions ===================== */
+  // The first --bench_samples samples, in memory before the runs
+  std::string emissionPath =
+      pathsConcat(FLAGS_emission_dir, cleanFilepath(FLAGS_test));
+  EmissionSet emissionSet;
+  if (fileExists(EmissionFileReader::indexPath(emissionPath + ".emissions"))) {
+    EmissionFileReader reader(emissionPath + ".emissions");
+    emissionSet = reader.meta();
+    int nLoaded = std::min<int64_t>(reader.size(), FLAGS_bench_samples);
+    emissionSet.emissions.resize(nLoaded);
+    for (int i = 0; i < nLoaded; ++i) {
+      emissionSet.emissions[i] = reader.emission(i);
+    }
+  } else {
+    W2lSerializer::load(emissionPath + ".bin", emissionSet);
+  }
+  gflags::ReadFlagsFromString(emissionSet.gflags, gflags::GetArgv0(), true);
+  // override with user-specified flags
+  gflags::ParseCommandLineFlags(&argc, &argv, false);
+  if (!flagsfile.empty()) {
+    gflags::ReadFromFlagsFile(flagsfile, argv[0], true);
+    gflags::ParseCommandLineFlags(&argc, &argv, false);
+  }
+  w2l::handleDeprecatedFlags();
+
+  int nSamples = std::min<int64_t>(
+      emissionSet.emissions.size(), std::max<int64_t>(FLAGS_bench_samples, 1));
+  int N = emissionSet.emissionN;
+  int64_t nFrames = 0;
+  for (int i = 0; i < nSamples; ++i) {
+    nFrames += emissionSet.emissionT[i];
+  }
+  double audioSeconds = nFrames * FLAGS_emission_frame_ms / 1000;
+  LOG(INFO) << "[Benchmark] " << nSamples << " samples, " << nFrames
+            << " frames of " << N << " tokens";
+
+  /* ===================== Create Dictionary ===================== */
+  auto dictPath = pathsConcat(FLAGS_tokensdir, FLAGS_tokens);
+  if (dictPath.empty() || !fileExists(dictPath)) {
+    throw std::runtime_error("Invalid dictionary filepath specified.");
+  }
+  Dictionary tokenDict(dictPath);
+  for (int64_t r = 1; r <= FLAGS_replabel; ++r) {
+    tokenDict.addEntry(std::to_string(r));
+  }
+  if (FLAGS_criterion == kCtcCriterion) {
+    tokenDict.addEntry(kBlankToken);
+  }
+  if (FLAGS_eostoken) {
+    tokenDict.addEntry(kEosToken);
+  }
+  tokenDict.freeze();
+  if (tokenDict.indexSize() != N) {
+    LOG(FATAL) << "[Benchmark] The emissions have " << N
+               << " tokens, the dictionary " << tokenDict.indexSize();
+  }
+
+  if (FLAGS_lexicon.empty()) {
+    LOG(FATAL) << "--lexicon is required";
+  }
+  auto lexicon = loadWords(FLAGS_lexicon, FLAGS_maxword);
+  auto wordDict = createWordDict(lexicon);
+  wordDict.freeze();
+
+  /* ===================== Build LM and Trie ===================== */
+  LMPtr wordLm = std::make_shared<ZeroLM>();
+  if (!FLAGS_lm.empty()) {
+    wordLm = std::make_shared<KenLM>(FLAGS_lm, wordDict);
+  }
+  LMPtr tokenLm = std::make_shared<ZeroLM>();
+  if (!FLAGS_bench_token_lm.empty()) {
+    tokenLm = std::make_shared<KenLM>(FLAGS_bench_token_lm, tokenDict);
+  }
+
+  int silIdx = tokenDict.getIndex(FLAGS_wordseparator);
+  int blankIdx =
+      FLAGS_criterion == kCtcCriterion ? tokenDict.getIndex(kBlankToken) : -1;
+  int unkIdx = wordDict.getIndex(kUnkToken);
+  // Seq2Seq decoders end on the EOS token, or the last one without it
+  int eosIdx = FLAGS_eostoken ? tokenDict.getIndex(kEosToken) : N - 1;
+  auto trie = std::make_shared<Trie>(N, silIdx);
+  auto startState = wordLm->start(false);
+  for (const auto& it : lexicon) {
+    int usrIdx = wordDict.getIndex(it.first);
+    float score = wordLm->score(startState, usrIdx).second;
+    for (const auto& tokens : it.second) {
+      trie->insert(tkn2Idx(tokens, tokenDict, FLAGS_replabel), usrIdx, score);
+    }
+  }
+  SmearingMode smearMode = SmearingMode::NONE;
+  if (FLAGS_smearing == "logadd") {
+    smearMode = SmearingMode::LOGADD;
+  } else if (FLAGS_smearing == "max") {
+    smearMode = SmearingMode::MAX;
+  }
+  trie->smear(smearMode);
+  auto flatTrie = std::make_shared<FlatTrie>(*trie);
+
+  CriterionType criterionType = FLAGS_criterion == kCtcCriterion
+      ? CriterionType::CTC
+      : CriterionType::ASG;
+  const auto& transition = emissionSet.transition;
+  auto makeDecoder = [&](const std::string& type, int beamSize)
+      -> std::unique_ptr<Decoder> {
+    DecoderOptions opt(
+        beamSize,
+        FLAGS_beamsizetoken,
+        static_cast<float>(FLAGS_beamthreshold),
+        static_cast<float>(FLAGS_lmweight),
+        static_cast<float>(FLAGS_wordscore),
+        static_cast<float>(FLAGS_unkscore),
+        static_cast<float>(FLAGS_silscore),
+        static_cast<float>(FLAGS_eosscore),
+        FLAGS_logadd,
+        criterionType);
+    if (type == "lexicon") {
+      return std::unique_ptr<Decoder>(new LexiconDecoder(
+          opt, flatTrie, wordLm, silIdx, blankIdx, unkIdx, transition, false));
+    } else if (type == "lexiconfree") {
+      return std::unique_ptr<Decoder>(
+          new LexiconFreeDecoder(opt, tokenLm, silIdx, blankIdx, transition));
+    }
+    opt.criterionType = CriterionType::S2S;
+    const auto& sizes = emissionSet.emissionT;
+    int maxOutputLength =
+        *std::max_element(sizes.begin(), sizes.begin() + nSamples);
+    if (type == "lexiconseq2seq") {
+      return std::unique_ptr<Decoder>(new LexiconSeq2SeqDecoder(
+          opt,
+          trie,
+          wordLm,
+          eosIdx,
+          replayAmUpdateFunction(),
+          maxOutputLength,
+          false));
+    } else if (type == "lexiconfreeseq2seq") {
+      return std::unique_ptr<Decoder>(new LexiconFreeSeq2SeqDecoder(
+          opt, tokenLm, eosIdx, replayAmUpdateFunction(), maxOutputLength));
+    }
+    LOG(FATAL) << "[Benchmark] Invalid decoder: " << type;
+    return nullptr;
+  };
+
+  /* ===================== Benchmark ===================== */
+  std::ofstream outputFile;
+  if (!FLAGS_bench_output.empty()) {
+    outputFile.open(FLAGS_bench_output, std::ios::app);
+    if (!outputFile.is_open()) {
+      LOG(FATAL) << "[Benchmark] Cannot write " << FLAGS_bench_output;
+    }
+  }
+  std::ostream& output = outputFile.is_open() ? outputFile : std::cout;
+
+  for (const auto& type : split(',', FLAGS_bench_decoders, true)) {
+    for (int beamSize : parseInts(FLAGS_bench_beamsizes)) {
+      for (int nThreads : parseInts(FLAGS_bench_threads)) {
+        // The decoders are built before the clock starts
+        std::vector<std::unique_ptr<Decoder>> decoders;
+        for (int i = 0; i < nThreads; ++i) {
+          decoders.push_back(makeDecoder(type, beamSize));
+        }
+        std::vector<DecoderStats> stats(nThreads);
+        std::vector<double> busySeconds(nThreads, 0);
+        std::atomic<int64_t> next(0);
+        int64_t nItems = nSamples * FLAGS_bench_iters;
+
+        resetPeakRss();
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for (int tid = 0; tid < nThreads; ++tid) {
+          threads.emplace_back([&, tid]() {
+            for (int64_t i = next++; i < nItems; i = next++) {
+              int s = i % nSamples;
+              auto decodeStart = std::chrono::steady_clock::now();
+              decoders[tid]->decode(
+                  emissionSet.emissions[s].data(),
+                  emissionSet.emissionT[s],
+                  N);
+              busySeconds[tid] += std::chrono::duration<double>(
+                                      std::chrono::steady_clock::now() -
+                                      decodeStart)
+                                      .count();
+              stats[tid] += decoders[tid]->stats();
+            }
+          });
+        }
+        for (auto& thread : threads) {
+          thread.join();
+        }
+        double seconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+
+        DecoderStats total;
+        double busy = 0;
+        for (int i = 0; i < nThreads; ++i) {
+          total += stats[i];
+          busy += busySeconds[i];
+        }
+        double frames = static_cast<double>(nFrames) * FLAGS_bench_iters;
+        std::ostringstream line;
+        line << "{\"decoder\": \"" << type << "\", \"beamsize\": " << beamSize
+             << ", \"threads\": " << nThreads << ", \"samples\": " << nItems
+             << ", \"frames\": " << frames << ", \"seconds\": " << seconds
+             << ", \"frames_per_sec\": " << frames / seconds << ", \"rtf\": "
+             << (audioSeconds > 0 ? busy / (audioSeconds * FLAGS_bench_iters)
+                                  : 0)
+             << ", \"candidates_per_frame\": "
+             << total.candidates / std::max<double>(total.frames, 1)
+             << ", \"peak_hypothesis_kb\": "
+             << total.peakHypothesisBytes / 1024
+             << ", \"peak_rss_kb\": " << readPeakRssKb() << "}";
+        output << line.str() << std::endl;
+      }
+    }
+  }
+  return 0;
+}
@@ -7,7 +7,17 @@
  */
 
 #include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
+#include <iterator>
+#include <limits>
+#include <random>
+#include <sstream>
 #include <string>
 #include <vector>
 
@@ -19,9 +29,18 @@
 #include "common/Transforms.h"
 #include "criterion/criterion.h"
 #include "libraries/common/Dictionary.h"
+#include "libraries/common/Utils.h"
+#include "libraries/decoder/BatchLexiconDecoder.h"
+#include "libraries/decoder/BiasingTrie.h"
+#include "libraries/decoder/GraphDecoder.h"
 #include "libraries/decoder/LexiconDecoder.h"
+#include "libraries/decoder/LexiconFreeDecoder.h"
+#include "libraries/decoder/LexiconFreeSeq2SeqDecoder.h"
+#include "libraries/decoder/SearchGraph.h"
 #include "libraries/decoder/Trie.h"
+#include "libraries/lm/ConvLM.h"
 #include "libraries/lm/KenLM.h"
+#include "libraries/lm/ZeroLM.h"
 #include "module/module.h"
 #include "runtime/runtime.h"
 
@@ -156,6 +175,76 @@ TEST(DecoderTest, run) {
     ASSERT_NEAR(node->maxScore, trieScoreTarget[i], 1e-5);
   }
 
+  // Compile the trie and check it survives a save / memory-mapped load, in a
+  // file of its own so that concurrent runs don't overwrite each other's
+  char triePathTemplate[] = "/tmp/w2l_decoder_test_trie_XXXXXX";
+  int trieFd = mkstemp(triePathTemplate);
+  ASSERT_NE(trieFd, -1);
+  close(trieFd);
+  const std::string triePath = triePathTemplate;
+  std::make_shared<FlatTrie>(*trie)->save(triePath, "0123456789abcdef");
+  auto flatTrie = FlatTrie::load(triePath);
+  ASSERT_EQ(flatTrie->fingerprint(), "0123456789abcdef");
+  for (int i = 0; i < sentence.size(); i++) {
+    auto wordTensor = tokens2Tensor(sentence[i], tokenDict);
+    auto node = flatTrie->search(wordTensor);
+    ASSERT_NE(node, nullptr);
+    ASSERT_NEAR(node->maxScore, trieScoreTarget[i], 1e-5);
+    ASSERT_EQ(
+        node->nLabels,
+        static_cast<int>(trie->search(wordTensor)->labels.size()));
+  }
+
+  // A file whose offsets point outside of the trie is rejected
+  {
+    std::vector<char> bytes;
+    {
+      std::ifstream in(triePath, std::ios::binary);
+      bytes.assign(
+          std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    size_t nodesOffset = bytes.size() -
+        flatTrie->nNodes() * sizeof(FlatTrieNode) -
+        flatTrie->nLabels() * (sizeof(int) + sizeof(float));
+    const std::string corruptedPath = triePath + ".corrupted";
+    // A child of the root past the last node, then a label past the last one
+    std::vector<std::pair<size_t, int>> corruptions = {
+        {offsetof(FlatTrieNode, firstChild), flatTrie->nNodes()},
+        {offsetof(FlatTrieNode, firstLabel), flatTrie->nLabels()}};
+    for (const auto& corruption : corruptions) {
+      // The offset, followed by a count of 1
+      int fields[2] = {corruption.second, 1};
+      auto corrupted = bytes;
+      std::memcpy(
+          &corrupted[nodesOffset + corruption.first], fields, sizeof(fields));
+      {
+        std::ofstream out(corruptedPath, std::ios::binary);
+        out.write(corrupted.data(), corrupted.size());
+      }
+      EXPECT_THROW(FlatTrie::load(corruptedPath), std::runtime_error);
+    }
+    std::remove(corruptedPath.c_str());
+  }
+  // The mapping outlives the file
+  std::remove(triePath.c_str());
+
+  // A copy, in huge pages if there are any, is searched the same way
+  auto trieCopy = flatTrie->clone(HugePages::TRANSPARENT);
+  ASSERT_EQ(trieCopy->nNodes(), flatTrie->nNodes());
+  ASSERT_EQ(trieCopy->fingerprint(), flatTrie->fingerprint());
+  for (int i = 0; i < sentence.size(); i++) {
+    auto wordTensor = tokens2Tensor(sentence[i], tokenDict);
+    auto node = trieCopy->search(wordTensor);
+    ASSERT_NE(node, nullptr);
+    ASSERT_NEAR(node->maxScore, trieScoreTarget[i], 1e-5);
+    ASSERT_EQ(
+        std::vector<int>(
+            trieCopy->labels(node), trieCopy->labels(node) + node->nLabels),
+        std::vector<int>(
+            flatTrie->labels(flatTrie->search(wordTensor)),
+            flatTrie->labels(flatTrie->search(wordTensor)) + node->nLabels));
+  }
+
   /* -------- Build Decoder --------*/
   DecoderOptions decoderOpt(
       2500, // FLAGS_beamsize
@@ -170,7 +259,7 @@ TEST(DecoderTest, run) {
       CriterionType::ASG);
 
   LexiconDecoder decoder(
-      decoderOpt, trie, lm, silIdx, blankIdx, unkIdx, transitions, false);
+      decoderOpt, flatTrie, lm, silIdx, blankIdx, unkIdx, transitions, false);
   LOG(INFO) << "[Decoder] Decoder constructed.\n";
 
   /* -------- Run --------*/
@@ -198,6 +287,1282 @@ TEST(DecoderTest, run) {
   for (int i = 0; i < std::min(n_hyp, 5); i++) {
     ASSERT_NEAR(results[i].score, hypScoreTarget[i], 1e-3);
   }
+
+  /* -------- Check counters --------*/
+  const auto& stats = decoder.stats();
+  ASSERT_EQ(stats.frames, T);
+  ASSERT_GE(stats.candidates, stats.merged + stats.stored);
+  ASSERT_GE(stats.pruned(), 0);
+  ASSERT_GT(stats.stored, 0);
+  ASSERT_GT(stats.lmQueries, 0);
+  ASSERT_LE(stats.lmCacheHits, stats.lmQueries);
+  ASSERT_GT(stats.trieExpansions, 0);
+  ASSERT_GT(stats.peakHypothesisBytes, 0);
+
+  /* -------- Check lattice --------*/
+  auto lattice = decoder.getLattice();
+  ASSERT_EQ(lattice.finals.size(), n_hyp);
+  ASSERT_EQ(lattice.starts.size(), 1);
+  std::vector<int> incomingArc(lattice.frames.size(), -1);
+  for (int i = 0; i < lattice.arcs.size(); i++) {
+    const auto& arc = lattice.arcs[i];
+    ASSERT_LT(lattice.frames[arc.from], lattice.frames[arc.to]);
+    ASSERT_EQ(incomingArc[arc.to], -1);
+    incomingArc[arc.to] = i;
+  }
+  for (int i = 0; i < n_hyp; i++) {
+    double latticeScore = 0;
+    std::vector<int> latticeWords, decodedWords;
+    for (int node = lattice.finals[i]; incomingArc[node] >= 0;) {
+      const auto& arc = lattice.arcs[incomingArc[node]];
+      latticeScore += arc.amScore + arc.lmScore;
+      if (arc.word >= 0) {
+        latticeWords.insert(latticeWords.begin(), arc.word);
+      }
+      node = arc.from;
+    }
+    for (auto word : results[i].words) {
+      if (word >= 0) {
+        decodedWords.push_back(word);
+      }
+    }
+    ASSERT_NEAR(latticeScore, results[i].score, 1e-3);
+    ASSERT_EQ(latticeWords, decodedWords);
+  }
+
+  /* -------- Check compact hypothesis --------*/
+  auto bestHyp = decoder.getBestHypothesis();
+  auto compactHyp = decoder.getBestCompactHypothesis();
+  ASSERT_LT(compactHyp.tokens.size(), bestHyp.tokens.size());
+  ASSERT_EQ(compactHyp.expand().tokens, bestHyp.tokens);
+  ASSERT_EQ(compactHyp.expand().words, bestHyp.words);
+  for (int t = 0; t < bestHyp.tokens.size(); t++) {
+    ASSERT_EQ(compactHyp.tokenAt(t), bestHyp.tokens[t]);
+    ASSERT_EQ(compactHyp.wordAt(t), bestHyp.words[t]);
+  }
+
+  /* -------- Run batched --------*/
+  BatchLexiconDecoder batchDecoder(
+      decoderOpt,
+      flatTrie,
+      lm,
+      silIdx,
+      blankIdx,
+      unkIdx,
+      transitions,
+      false,
+      2 // batchSize
+  );
+  auto batchResults = batchDecoder.decode(
+      {emission.data(), emission.data()}, {T, T / 2}, N);
+  ASSERT_EQ(batchResults.size(), 2);
+  ASSERT_EQ(batchResults[0].size(), n_hyp);
+  for (int i = 0; i < n_hyp; i++) {
+    ASSERT_EQ(batchResults[0][i].score, results[i].score);
+    ASSERT_EQ(batchResults[0][i].words, results[i].words);
+  }
+  auto halfResults = decoder.decode(emission.data(), T / 2, N);
+  ASSERT_EQ(batchResults[1].size(), halfResults.size());
+  for (int i = 0; i < halfResults.size(); i++) {
+    ASSERT_EQ(batchResults[1][i].score, halfResults[i].score);
+  }
+
+  /* -------- Run on sparse emissions --------*/
+  // With all the tokens listed, the sparse emissions decode the same
+  auto sparseResults =
+      decoder.decodeSparse(sparsifyEmissions(emission.data(), T, N, N, -1));
+  ASSERT_EQ(sparseResults.size(), n_hyp);
+  for (int i = 0; i < n_hyp; i++) {
+    ASSERT_EQ(sparseResults[i].score, results[i].score);
+    ASSERT_EQ(sparseResults[i].words, results[i].words);
+  }
+
+  /* -------- Run on half-precision emissions --------*/
+  // Truncate the emissions to halves, flushing the subnormals to 0
+  std::vector<uint16_t> halves(emission.size());
+  for (size_t i = 0; i < emission.size(); i++) {
+    uint32_t bits;
+    std::memcpy(&bits, &emission[i], sizeof(bits));
+    uint32_t exponent = (bits >> 23) & 0xff;
+    halves[i] = ((bits >> 16) & 0x8000) |
+        (exponent <= 112
+             ? 0
+             : ((exponent - 112) << 10) | ((bits & 0x7fffff) >> 13));
+  }
+  std::vector<float> rounded(emission.size());
+  halvesToFloats(halves.data(), halves.size(), rounded.data());
+  auto roundedResults = decoder.decode(rounded.data(), T, N);
+  auto halfPrecisionResults = decoder.decodeHalf(halves.data(), T, N);
+  ASSERT_EQ(halfPrecisionResults.size(), roundedResults.size());
+  for (int i = 0; i < roundedResults.size(); i++) {
+    ASSERT_EQ(halfPrecisionResults[i].score, roundedResults[i].score);
+    ASSERT_EQ(halfPrecisionResults[i].words, roundedResults[i].words);
+  }
+
+  /* -------- Run online with stable words --------*/
+  std::vector<int> stableWords;
+  decoder.setStableWordsCallback([&](const std::vector<int>& words) {
+    stableWords.insert(stableWords.end(), words.begin(), words.end());
+  });
+  decoder.decodeBegin();
+  for (int t = 0; t < T; t += 10) {
+    decoder.decodeStep(emission.data() + t * N, std::min(10, T - t), N);
+    int nPrefixWords = 0;
+    for (auto word : decoder.getStablePrefix().words) {
+      nPrefixWords += word >= 0;
+    }
+    ASSERT_EQ(nPrefixWords, stableWords.size());
+  }
+  decoder.decodeEnd();
+  std::vector<int> bestWords;
+  for (auto word : decoder.getAllFinalHypothesis()[0].words) {
+    if (word >= 0) {
+      bestWords.push_back(word);
+    }
+  }
+  ASSERT_GT(stableWords.size(), 0);
+  ASSERT_LE(stableWords.size(), bestWords.size());
+  ASSERT_TRUE(
+      std::equal(stableWords.begin(), stableWords.end(), bestWords.begin()));
+}
+
+TEST(DecoderTest, kenLmLoadModel) {
+  std::string dataDir = "";
+#ifdef DECODER_TEST_DATADIR
+  dataDir = DECODER_TEST_DATADIR;
+#endif
+  const std::string path = pathsConcat(dataDir, "lm.arpa");
+
+  // A model alive is shared with the same load method and replica only
+  auto model = KenLM::loadModel(path, KenLMLoadMethod::POPULATE);
+  ASSERT_EQ(KenLM::loadModel(path, KenLMLoadMethod::POPULATE), model);
+  ASSERT_NE(KenLM::loadModel(path, KenLMLoadMethod::READ), model);
+  ASSERT_NE(KenLM::loadModel(path, KenLMLoadMethod::POPULATE, 1), model);
+}
+
+TEST(DecoderTest, trieUpdate) {
+  const int N = 5;
+  std::mt19937 rng(0);
+  std::uniform_int_distribution<int> token(0, N - 1), length(2, 6);
+  std::uniform_real_distribution<float> score(-10, 0);
+  auto randomWord = [&]() {
+    std::vector<int> indices(length(rng));
+    for (auto& idx : indices) {
+      idx = token(rng);
+    }
+    return indices;
+  };
+  std::vector<std::pair<std::vector<int>, float>> words;
+  for (int i = 0; i < 100; i++) {
+    words.emplace_back(randomWord(), score(rng));
+  }
+  // Words inserted afterwards, some being prefixes of the words above
+  std::vector<std::pair<std::vector<int>, float>> newWords;
+  for (int i = 0; i < 20; i++) {
+    auto indices = i % 4 == 0
+        ? std::vector<int>(words[i].first.begin(), words[i].first.end() - 1)
+        : randomWord();
+    newWords.emplace_back(indices, score(rng) + 5);
+  }
+
+  // The scores of the nodes in breadth-first order
+  auto maxScores = [](const Trie& trie) {
+    FlatTrie flatTrie(trie);
+    std::vector<float> scores;
+    for (int i = 0; i < flatTrie.nNodes(); i++) {
+      scores.push_back((flatTrie.getRoot() + i)->maxScore);
+    }
+    return scores;
+  };
+  for (auto smearMode : {SmearingMode::MAX, SmearingMode::LOGADD}) {
+    auto trie = std::make_shared<Trie>(N, -1);
+    for (int i = 0; i < words.size(); i++) {
+      trie->insert(words[i].first, i, words[i].second);
+    }
+    trie->smear(smearMode);
+    auto before = maxScores(*trie);
+
+    // Smearing the paths of the new words of a fork gives the scores of a
+    // full smearing, and leaves the forked trie as it was
+    auto fork = trie->fork();
+    auto expected = std::make_shared<Trie>(N, -1);
+    for (int i = 0; i < words.size(); i++) {
+      expected->insert(words[i].first, i, words[i].second);
+    }
+    for (int i = 0; i < newWords.size(); i++) {
+      fork->insert(newWords[i].first, words.size() + i, newWords[i].second);
+      fork->smearPath(newWords[i].first, smearMode);
+      expected->insert(
+          newWords[i].first, words.size() + i, newWords[i].second);
+    }
+    expected->smear(smearMode);
+    auto after = maxScores(*fork);
+    auto expectedScores = maxScores(*expected);
+    ASSERT_EQ(after.size(), expectedScores.size());
+    for (int i = 0; i < after.size(); i++) {
+      ASSERT_NEAR(after[i], expectedScores[i], 1e-5);
+    }
+    ASSERT_EQ(maxScores(*trie), before);
+    for (int i = 0; i < newWords.size(); i++) {
+      int label = words.size() + i;
+      auto node = trie->search(newWords[i].first);
+      ASSERT_TRUE(
+          !node ||
+          std::find(node->labels.begin(), node->labels.end(), label) ==
+              node->labels.end());
+      node = fork->search(newWords[i].first);
+      ASSERT_NE(
+          std::find(node->labels.begin(), node->labels.end(), label),
+          node->labels.end());
+    }
+    ASSERT_THROW(
+        fork->smearPath(std::vector<int>(7, N - 1), smearMode),
+        std::invalid_argument);
+  }
+}
+
+// A ZeroLM which is not one for the decoders, using the generic LM path
+class GenericZeroLM : public LM {
+ public:
+  LMStatePtr start(bool startWithNothing) override {
+    return lm_.start(startWithNothing);
+  }
+
+  std::pair<LMStatePtr, float> score(const LMStatePtr& state, const int token)
+      override {
+    return lm_.score(state, token);
+  }
+
+  std::pair<LMStatePtr, float> finish(const LMStatePtr& state) override {
+    return lm_.finish(state);
+  }
+
+ private:
+  ZeroLM lm_;
+};
+
+TEST(DecoderTest, zeroLmSpecialization) {
+  const int T = 60, N = 12, sil = 0, blank = N - 1;
+  std::mt19937 gen(3);
+  std::normal_distribution<float> normal;
+  std::uniform_int_distribution<int> letter(1, N - 2), length(1, 5);
+  auto trie = std::make_shared<Trie>(N, sil);
+  for (int w = 0; w < 200; w++) {
+    std::vector<int> spelling;
+    for (int i = length(gen); i > 0; i--) {
+      spelling.push_back(letter(gen));
+    }
+    spelling.push_back(sil);
+    trie->insert(spelling, w, -(w % 7));
+  }
+  trie->smear(SmearingMode::MAX);
+  auto flatTrie = std::make_shared<FlatTrie>(*trie);
+  std::vector<float> emissions(T * N), transitions(N * N);
+  for (auto& score : emissions) {
+    score = normal(gen);
+  }
+  for (auto& score : transitions) {
+    score = 0.1 * normal(gen);
+  }
+
+  // The inline ZeroLM queries find the same hypothesis as the batched ones
+  for (auto criterion : {CriterionType::ASG, CriterionType::CTC}) {
+    for (bool isLmToken : {false, true}) {
+      DecoderOptions decoderOpt(
+          40, 8, 25, 1.5, 0.5, -5, -0.5, 0, false, criterion);
+      int blankIdx = criterion == CriterionType::CTC ? blank : -1;
+      LexiconDecoder zeroDecoder(
+          decoderOpt,
+          flatTrie,
+          std::make_shared<ZeroLM>(),
+          sil,
+          blankIdx,
+          N,
+          transitions,
+          isLmToken);
+      LexiconDecoder genericDecoder(
+          decoderOpt,
+          flatTrie,
+          std::make_shared<GenericZeroLM>(),
+          sil,
+          blankIdx,
+          N,
+          transitions,
+          isLmToken);
+      auto results = zeroDecoder.decode(emissions.data(), T, N);
+      auto genericResults = genericDecoder.decode(emissions.data(), T, N);
+      ASSERT_GT(results.size(), 0);
+      ASSERT_EQ(results.size(), genericResults.size());
+      for (int i = 0; i < results.size(); i++) {
+        ASSERT_EQ(results[i].score, genericResults[i].score);
+        ASSERT_EQ(results[i].words, genericResults[i].words);
+        ASSERT_EQ(results[i].tokens, genericResults[i].tokens);
+      }
+      ASSERT_EQ(
+          zeroDecoder.stats().lmQueries, genericDecoder.stats().lmQueries);
+    }
+  }
+}
+
+// A bigram LM on the words, scoring word w after word v by ((7w + 3v) % 11)
+class BigramTestLM : public LM {
+ public:
+  struct State : LMState {
+    int word = -1;
+  };
+
+  LMStatePtr start(bool /* startWithNothing */) override {
+    return std::make_shared<State>();
+  }
+
+  std::pair<LMStatePtr, float> score(const LMStatePtr& state, const int word)
+      override {
+    auto child = state->child<State>(word);
+    child->word = word;
+    int previous = std::static_pointer_cast<State>(state)->word;
+    return std::make_pair(child, -0.5f * ((7 * word + 3 * previous) % 11));
+  }
+
+  std::pair<LMStatePtr, float> finish(const LMStatePtr& state) override {
+    return std::make_pair(state, 0.0f);
+  }
+
+  void saveState(const LMStatePtr& state, std::ostream& out) const override {
+    const int word = std::static_pointer_cast<State>(state)->word;
+    out.write(reinterpret_cast<const char*>(&word), sizeof(word));
+  }
+
+  LMStatePtr loadState(std::istream& in) override {
+    auto state = std::make_shared<State>();
+    in.read(reinterpret_cast<char*>(&state->word), sizeof(state->word));
+    return state;
+  }
+};
+
+TEST(DecoderTest, lmLookahead) {
+  const int T = 10, N = 8, sil = 0;
+  std::mt19937 gen(5);
+  std::normal_distribution<float> normal;
+  std::uniform_int_distribution<int> letter(1, N - 1), length(1, 4);
+  auto lm = std::make_shared<BigramTestLM>();
+  auto startState = lm->start(false);
+  auto trie = std::make_shared<Trie>(N, sil);
+  std::vector<std::vector<int>> spellings;
+  for (int w = 0; w < 40; w++) {
+    std::vector<int> spelling;
+    for (int i = length(gen); i > 0; i--) {
+      spelling.push_back(letter(gen));
+    }
+    spelling.push_back(sil);
+    trie->insert(spelling, w, lm->score(startState, w).second);
+    spellings.push_back(spelling);
+  }
+  trie->smear(SmearingMode::MAX);
+  auto flatTrie = std::make_shared<FlatTrie>(*trie);
+
+  // The lookahead of a node is the best LM score of the words below it
+  LMLookahead lookahead(flatTrie, lm, 40, 1000);
+  DecoderStats stats;
+  auto state = lm->score(startState, 3).first;
+  const FlatTrieNode* node = flatTrie->search({spellings[0][0]});
+  float best = kNegativeInfinity;
+  for (int w = 0; w < spellings.size(); w++) {
+    if (spellings[w][0] == spellings[0][0]) {
+      best = std::max(best, lm->score(state, w).second);
+    }
+  }
+  ASSERT_EQ(lookahead.score(state, node, stats), best);
+  ASSERT_EQ(lookahead.score(state, flatTrie->getRoot(), stats), 0);
+  LMLookahead noLookahead(flatTrie, lm, 0, 1000);
+  ASSERT_EQ(noLookahead.score(state, node, stats), node->maxScore);
+
+  // With a beam keeping everything, the lookahead finds the same words
+  std::vector<float> emissions(T * N);
+  for (auto& score : emissions) {
+    score = normal(gen);
+  }
+  DecoderOptions decoderOpt(
+      20000, // FLAGS_beamsize
+      100, // FLAGS_beamsizetoken
+      1000, // FLAGS_beamthreshold
+      1.0, // FLAGS_lmweight
+      0.5, // FLAGS_wordscore
+      kNegativeInfinity, // FLAGS_unkscore
+      0, // FLAGS_silscore
+      0, // FLAGS_eosscore
+      false, // FLAGS_logadd
+      CriterionType::ASG);
+  std::vector<float> transitions(N * N, 0);
+  LexiconDecoder decoder(
+      decoderOpt, flatTrie, lm, sil, -1, -1, transitions, false);
+  auto results = decoder.decode(emissions.data(), T, N);
+  decoderOpt.lmLookaheadWords = 40;
+  LexiconDecoder lookaheadDecoder(
+      decoderOpt, flatTrie, lm, sil, -1, -1, transitions, false);
+  auto lookaheadResults = lookaheadDecoder.decode(emissions.data(), T, N);
+  ASSERT_NEAR(lookaheadResults[0].score, results[0].score, 1e-3);
+  ASSERT_EQ(lookaheadResults[0].words, results[0].words);
+}
+
+// A unigram LM on the words, with the scores of a unigram ARPA file
+class UnigramTestLM : public LM {
+ public:
+  UnigramTestLM(const std::vector<float>& scores, float finalScore)
+      : scores_(scores), finalScore_(finalScore) {}
+
+  LMStatePtr start(bool /* startWithNothing */) override {
+    return std::make_shared<LMState>();
+  }
+
+  std::pair<LMStatePtr, float> score(const LMStatePtr& state, const int word)
+      override {
+    return std::make_pair(state, scores_[word]);
+  }
+
+  std::pair<LMStatePtr, float> finish(const LMStatePtr& state) override {
+    return std::make_pair(state, finalScore_);
+  }
+
+ private:
+  std::vector<float> scores_;
+  float finalScore_;
+};
+
+TEST(DecoderTest, searchGraph) {
+  const int T = 40, N = 8, sil = 0, blank = N - 1, nWords = 30;
+  std::mt19937 gen(7);
+  std::normal_distribution<float> normal;
+  std::uniform_int_distribution<int> letter(1, N - 2), length(1, 4);
+  std::vector<std::string> words;
+  std::vector<std::vector<std::vector<int>>> spellings(nWords);
+  for (int w = 0; w < nWords; w++) {
+    words.push_back("w" + std::to_string(w));
+    std::vector<int> spelling;
+    for (int i = length(gen); i > 0; i--) {
+      spelling.push_back(letter(gen));
+    }
+    spelling.push_back(sil);
+    spellings[w].push_back(spelling);
+  }
+  char* user = getenv("USER");
+  std::string userstr = user ? std::string(user) : "unknown";
+  const std::string arpaPath = "/tmp/" + userstr + "_test_graph.arpa";
+  const std::string graphPath = "/tmp/" + userstr + "_test.graph";
+
+  /* -------- Unigram: the same search as the lexicon decoder --------*/
+  // The last word is missing from the LM, hence scored as <unk>
+  std::vector<float> unigrams(nWords);
+  {
+    std::ofstream arpa(arpaPath);
+    arpa << "\\data\\\nngram 1=" << nWords + 2 << "\n\n\\1-grams:\n";
+    arpa << "-99\t<s>\n-1.5\t</s>\n-3\t<unk>\n";
+    for (int w = 0; w < nWords; w++) {
+      unigrams[w] = w + 1 < nWords ? -1 - 0.3 * (w % 5) : -3;
+      if (w + 1 < nWords) {
+        arpa << unigrams[w] << "\t" << words[w] << "\n";
+      }
+    }
+    arpa << "\n\\end\\\n";
+  }
+  auto graph = SearchGraph::compile(arpaPath, words, spellings);
+  ASSERT_EQ(graph->nRoots(), 1);
+  graph->save(graphPath);
+  auto loadedGraph = SearchGraph::load(graphPath);
+  ASSERT_EQ(loadedGraph->nNodes(), graph->nNodes());
+  ASSERT_EQ(loadedGraph->nArcs(), graph->nArcs());
+
+  auto lm = std::make_shared<UnigramTestLM>(unigrams, -1.5);
+  auto trie = std::make_shared<Trie>(N, sil);
+  for (int w = 0; w < nWords; w++) {
+    trie->insert(spellings[w][0], w, unigrams[w]);
+  }
+  trie->smear(SmearingMode::MAX);
+  auto flatTrie = std::make_shared<FlatTrie>(*trie);
+  std::vector<float> emissions(T * N), transitions(N * N);
+  for (auto& score : emissions) {
+    score = normal(gen);
+  }
+  for (auto& score : transitions) {
+    score = 0.1 * normal(gen);
+  }
+  for (auto criterion : {CriterionType::ASG, CriterionType::CTC}) {
+    DecoderOptions decoderOpt(
+        500, 8, 25, 1.5, 0.5, kNegativeInfinity, -0.5, 0, false, criterion);
+    int blankIdx = criterion == CriterionType::CTC ? blank : -1;
+    LexiconDecoder lexiconDecoder(
+        decoderOpt, flatTrie, lm, sil, blankIdx, -1, transitions, false);
+    GraphDecoder graphDecoder(decoderOpt, graph, sil, blankIdx, transitions);
+    GraphDecoder loadedDecoder(
+        decoderOpt, loadedGraph, sil, blankIdx, transitions);
+    auto results = lexiconDecoder.decode(emissions.data(), T, N);
+    auto graphResults = graphDecoder.decode(emissions.data(), T, N);
+    auto loadedResults = loadedDecoder.decode(emissions.data(), T, N);
+    ASSERT_GT(graphResults.size(), 0);
+    ASSERT_NEAR(graphResults[0].score, results[0].score, 1e-3);
+    ASSERT_EQ(graphResults[0].words, results[0].words);
+    ASSERT_EQ(graphResults[0].tokens, results[0].tokens);
+    ASSERT_EQ(loadedResults[0].score, graphResults[0].score);
+    ASSERT_EQ(loadedResults[0].words, graphResults[0].words);
+    ASSERT_EQ(graphDecoder.stats().lmQueries, 0);
+  }
+
+  /* -------- Bigram: explicit n-grams, backoff and sentence end --------*/
+  {
+    std::ofstream arpa(arpaPath);
+    arpa << "\\data\\\nngram 1=5\nngram 2=3\n\n\\1-grams:\n";
+    arpa << "-99\t<s>\t-0.5\n-1.5\t</s>\n-1\tw0\t-0.25\n-1.2\tw1\n-2\tw2\n";
+    arpa << "\n\\2-grams:\n-0.1\t<s> w0\n-0.2\tw0 w1\n-0.4\tw0 </s>\n";
+    arpa << "\n\\end\\\n";
+  }
+  graph = SearchGraph::compile(arpaPath, words, spellings);
+  ASSERT_EQ(graph->nRoots(), 3); // empty, <s> and w0
+
+  // Total weight of word `w` from root `node`, and the root it leads to
+  auto walk = [&](const SearchGraphNode* node, int w) {
+    float weight = 0;
+    for (int token : spellings[w][0]) {
+      const SearchGraphArc* arc = graph->findArc(node, token);
+      if (!arc) {
+        return std::make_pair(kNegativeInfinity, node);
+      }
+      weight += arc->weight;
+      node = graph->getNode(arc->next);
+    }
+    for (int i = 0; i < node->nWords; i++) {
+      if (graph->words(node)[i].word == w) {
+        return std::make_pair(
+            weight + graph->words(node)[i].weight,
+            graph->getNode(graph->words(node)[i].next));
+      }
+    }
+    return std::make_pair(kNegativeInfinity, node);
+  };
+  const SearchGraphNode* start = graph->getStart();
+  ASSERT_TRUE(graph->isRoot(start));
+  auto w0 = walk(start, 0);
+  ASSERT_NEAR(w0.first, -0.1, 1e-6);
+  ASSERT_NEAR(walk(w0.second, 1).first, -0.2, 1e-6);
+  ASSERT_EQ(walk(w0.second, 2).first, kNegativeInfinity);
+  const SearchGraphNode* backoff = graph->getBackoff(w0.second);
+  ASSERT_NE(backoff, nullptr);
+  ASSERT_EQ(graph->getRoot(w0.second).backoffWeight, -0.25f);
+  ASSERT_NEAR(walk(backoff, 2).first, -2, 1e-6);
+  ASSERT_EQ(graph->getBackoff(backoff), nullptr);
+  ASSERT_NEAR(graph->getRoot(w0.second).finalWeight, -0.4, 1e-6);
+  ASSERT_NEAR(graph->getRoot(start).finalWeight, -0.5 - 1.5, 1e-6);
+  // w1 has no bigram context, so it leads back to the unigram tree
+  auto w1 = walk(w0.second, 1);
+  ASSERT_EQ(w1.second, backoff);
+  ASSERT_NEAR(walk(backoff, 29).first, -100, 1e-4); // <unk>, missing
+}
+
+TEST(DecoderTest, biasingTrie) {
+  BiasingTrie biasing;
+  biasing.insert({3, 4, 5}, 2);
+  biasing.insert({3, 6}, 1);
+  biasing.insert({7}, 0.5);
+  auto state = biasing.next(0, 3);
+  ASSERT_EQ(state.second, 2); // the best phrase of the word
+  auto middle = biasing.next(state.first, 4);
+  ASSERT_EQ(middle.second, 2);
+  ASSERT_EQ(biasing.next(middle.first, 5), std::make_pair(0, 2.0f));
+  ASSERT_EQ(biasing.next(state.first, 6), std::make_pair(0, 1.0f));
+  ASSERT_EQ(biasing.next(0, 7), std::make_pair(0, 0.5f));
+  ASSERT_EQ(biasing.next(0, 8), std::make_pair(0, 0.0f));
+  // Leaving a phrase takes its bonuses back, and may start another one
+  ASSERT_EQ(biasing.next(middle.first, 8), std::make_pair(0, -4.0f));
+  ASSERT_EQ(biasing.next(middle.first, 7), std::make_pair(0, -3.5f));
+  ASSERT_EQ(biasing.finish(middle.first), -4);
+  ASSERT_EQ(biasing.finish(0), 0);
+
+  const int T = 30, N = 8, sil = 0, nWords = 40;
+  std::mt19937 gen(11);
+  std::normal_distribution<float> normal;
+  std::uniform_int_distribution<int> letter(1, N - 1), length(1, 3);
+  auto trie = std::make_shared<Trie>(N, sil);
+  for (int w = 0; w < nWords; w++) {
+    std::vector<int> spelling;
+    for (int i = length(gen); i > 0; i--) {
+      spelling.push_back(letter(gen));
+    }
+    spelling.push_back(sil);
+    trie->insert(spelling, w, 0);
+  }
+  auto flatTrie = std::make_shared<FlatTrie>(*trie);
+  std::vector<float> emissions(T * N), transitions(N * N, 0);
+  for (auto& score : emissions) {
+    score = normal(gen);
+  }
+  DecoderOptions decoderOpt(
+      500, 8, 1000, 0, 0, kNegativeInfinity, 0, 0, false, CriterionType::ASG);
+  LexiconDecoder decoder(
+      decoderOpt,
+      flatTrie,
+      std::make_shared<ZeroLM>(),
+      sil,
+      -1,
+      -1,
+      transitions,
+      false);
+  auto wordsOf = [](const DecodeResult& result) {
+    std::vector<int> words;
+    for (int word : result.words) {
+      if (word >= 0) {
+        words.push_back(word);
+      }
+    }
+    return words;
+  };
+  auto best = decoder.decode(emissions.data(), T, N)[0];
+  auto bestWords = wordsOf(best);
+  ASSERT_GE(bestWords.size(), 2);
+
+  // Boosting the best path adds its bonus
+  auto session = std::make_shared<BiasingTrie>();
+  session->insert({bestWords[0], bestWords[1]}, 1);
+  decoder.setBiasing(session);
+  auto boosted = decoder.decode(emissions.data(), T, N)[0];
+  ASSERT_GE(boosted.score, best.score + 2 - 1e-4);
+
+  // A large bonus makes the decoder spell a phrase out
+  std::vector<int> phrase{bestWords[0] == 0 ? 1 : 0, 2};
+  session = std::make_shared<BiasingTrie>();
+  session->insert(phrase, 100);
+  decoder.setBiasing(session);
+  auto words = wordsOf(decoder.decode(emissions.data(), T, N)[0]);
+  ASSERT_NE(
+      std::search(words.begin(), words.end(), phrase.begin(), phrase.end()),
+      words.end());
+
+  // The shared structures are left untouched
+  decoder.setBiasing(nullptr);
+  auto unbiased = decoder.decode(emissions.data(), T, N)[0];
+  ASSERT_EQ(unbiased.score, best.score);
+  ASSERT_EQ(unbiased.words, best.words);
+}
+
+TEST(DecoderTest, parallelExpansion) {
+  const int T = 30, N = 8, sil = 0, blank = N - 1, nWords = 60;
+  std::mt19937 gen(13);
+  std::normal_distribution<float> normal;
+  std::uniform_int_distribution<int> letter(1, N - 2), length(1, 4);
+  auto bigramLm = std::make_shared<BigramTestLM>();
+  auto startState = bigramLm->start(false);
+  auto trie = std::make_shared<Trie>(N, sil);
+  for (int w = 0; w < nWords; w++) {
+    std::vector<int> spelling;
+    for (int i = length(gen); i > 0; i--) {
+      spelling.push_back(letter(gen));
+    }
+    spelling.push_back(sil);
+    trie->insert(spelling, w, bigramLm->score(startState, w).second);
+  }
+  trie->smear(SmearingMode::MAX);
+  auto flatTrie = std::make_shared<FlatTrie>(*trie);
+  std::vector<float> emissions(T * N), transitions(N * N);
+  for (auto& score : emissions) {
+    score = normal(gen);
+  }
+  for (auto& score : transitions) {
+    score = 0.1 * normal(gen);
+  }
+
+  // Tasks proposing to their own buffers find the same beam as a single one
+  std::vector<LMPtr> lms{bigramLm, std::make_shared<ZeroLM>()};
+  for (const auto& lm : lms) {
+    for (auto criterion : {CriterionType::ASG, CriterionType::CTC}) {
+      DecoderOptions decoderOpt(
+          1000, 8, 1000, 1.0, 0.5, kNegativeInfinity, 0, 0, false, criterion);
+      const int blankIdx = criterion == CriterionType::CTC ? blank : -1;
+      LexiconDecoder serial(
+          decoderOpt, flatTrie, lm, sil, blankIdx, -1, transitions, false);
+      auto results = serial.decode(emissions.data(), T, N);
+      decoderOpt.expandThreads = 4;
+      LexiconDecoder parallel(
+          decoderOpt, flatTrie, lm, sil, blankIdx, -1, transitions, false);
+      auto parallelResults = parallel.decode(emissions.data(), T, N);
+      ASSERT_GT(results.size(), 2 * 32);
+      ASSERT_EQ(parallelResults.size(), results.size());
+      for (int i = 0; i < results.size(); i++) {
+        ASSERT_EQ(parallelResults[i].score, results[i].score);
+        ASSERT_EQ(parallelResults[i].words, results[i].words);
+      }
+      ASSERT_EQ(parallel.stats().candidates, serial.stats().candidates);
+    }
+  }
+}
+
+TEST(DecoderTest, snapshot) {
+  const int T = 40, N = 8, sil = 0, blank = N - 1, nWords = 40;
+  std::mt19937 gen(17);
+  std::normal_distribution<float> normal;
+  std::uniform_int_distribution<int> letter(1, N - 2), length(1, 3);
+  auto trie = std::make_shared<Trie>(N, sil);
+  for (int w = 0; w < nWords; w++) {
+    std::vector<int> spelling;
+    for (int i = length(gen); i > 0; i--) {
+      spelling.push_back(letter(gen));
+    }
+    spelling.push_back(sil);
+    trie->insert(spelling, w, 0);
+  }
+  auto flatTrie = std::make_shared<FlatTrie>(*trie);
+  std::vector<float> emissions(T * N), transitions(N * N, 0);
+  for (auto& score : emissions) {
+    score = normal(gen);
+  }
+  DecoderOptions decoderOpt(
+      200, 8, 10, 1.0, 0.5, kNegativeInfinity, 0, 0, false, CriterionType::CTC);
+  auto makeDecoder = [&](const FlatTriePtr& lexicon) {
+    return LexiconDecoder(
+        decoderOpt,
+        lexicon,
+        std::make_shared<BigramTestLM>(),
+        sil,
+        blank,
+        -1,
+        transitions,
+        false);
+  };
+
+  // A decoder resumed from a snapshot of a pruned decoder ends up the same
+  auto decoder = makeDecoder(flatTrie);
+  decoder.decodeBegin();
+  decoder.decodeStep(emissions.data(), T / 2, N);
+  decoder.prune(5);
+  std::stringstream snapshot;
+  decoder.snapshot(snapshot);
+  auto resumed = makeDecoder(flatTrie);
+  resumed.restore(snapshot);
+  ASSERT_EQ(resumed.nHypothesis(), decoder.nHypothesis());
+  ASSERT_EQ(resumed.nDecodedFramesInBuffer(), decoder.nDecodedFramesInBuffer());
+  for (auto* d : {&decoder, &resumed}) {
+    d->decodeStep(emissions.data() + T / 2 * N, T - T / 2, N);
+    d->decodeEnd();
+  }
+  auto results = decoder.getAllFinalHypothesis();
+  auto resumedResults = resumed.getAllFinalHypothesis();
+  ASSERT_EQ(resumedResults.size(), results.size());
+  for (int i = 0; i < results.size(); i++) {
+    ASSERT_EQ(resumedResults[i].score, results[i].score);
+    ASSERT_EQ(resumedResults[i].words, results[i].words);
+  }
+
+  // Snapshots of another lexicon or corrupted are rejected
+  auto otherTrie = std::make_shared<Trie>(N, sil);
+  otherTrie->insert({1, sil}, 0, 0);
+  auto otherLexicon = std::make_shared<FlatTrie>(*otherTrie);
+  auto other = makeDecoder(otherLexicon);
+  snapshot.clear();
+  snapshot.seekg(0);
+  ASSERT_THROW(other.restore(snapshot), std::runtime_error);
+
+  // A lexicon set before a restore is only searched from the next utterance
+  auto switched = makeDecoder(flatTrie);
+  switched.setLexicon(otherLexicon);
+  snapshot.clear();
+  snapshot.seekg(0);
+  switched.restore(snapshot);
+  switched.decodeStep(emissions.data() + T / 2 * N, T - T / 2, N);
+  switched.decodeEnd();
+  auto switchedResults = switched.getAllFinalHypothesis();
+  ASSERT_EQ(switchedResults.size(), results.size());
+  for (int i = 0; i < results.size(); i++) {
+    ASSERT_EQ(switchedResults[i].score, results[i].score);
+    ASSERT_EQ(switchedResults[i].words, results[i].words);
+  }
+  switched.decode(emissions.data(), T, N);
+  for (const auto& result : switched.getAllFinalHypothesis()) {
+    for (auto word : result.words) {
+      ASSERT_TRUE(word == -1 || word == 0);
+    }
+  }
+  std::stringstream garbage("not a snapshot of a decoder");
+  ASSERT_THROW(resumed.restore(garbage), std::runtime_error);
+}
+
+TEST(DecoderTest, seq2seqEarlyStopping) {
+  const int V = 6, eos = V - 1, maxOutputLength = 40;
+  // Log-softmax of pseudo-random logits of (step, previous token), EOS
+  // becoming likely along the steps
+  AMUpdateFunc amUpdate = [&](
+                              const float* /* emissions */,
+                              const int /* N */,
+                              const int /* T */,
+                              const std::vector<int>& rawY,
+                              const std::vector<AMStatePtr>& /* states */,
+                              int& t) {
+    std::vector<std::vector<float>> scores;
+    std::vector<AMStatePtr> outStates;
+    for (const int y : rawY) {
+      std::mt19937 gen(1000 * t + y + 1);
+      std::normal_distribution<float> normal;
+      std::vector<float> logits(V);
+      for (auto& logit : logits) {
+        logit = 2 * normal(gen);
+      }
+      logits[eos] += 0.1 * t - 2;
+      float norm = 0;
+      for (const float logit : logits) {
+        norm += std::exp(logit);
+      }
+      for (auto& logit : logits) {
+        logit -= std::log(norm);
+      }
+      scores.push_back(logits);
+      outStates.push_back(std::make_shared<int>(t));
+    }
+    return std::make_pair(scores, outStates);
+  };
+  auto tokensOf = [&](const DecodeResult& result) {
+    std::vector<int> tokens;
+    for (int token : result.tokens) {
+      if (token >= 0 && token != eos) {
+        tokens.push_back(token);
+      }
+    }
+    return tokens;
+  };
+  DecoderOptions decoderOpt(
+      20, V, 1000, 0, 0, 0, 0, 0, false, CriterionType::S2S);
+  auto decode = [&](EarlyStopping earlyStopping,
+                    float lengthNormalization,
+                    LMPtr lm = std::make_shared<ZeroLM>()) {
+    decoderOpt.earlyStopping = earlyStopping;
+    decoderOpt.lengthNormalization = lengthNormalization;
+    LexiconFreeSeq2SeqDecoder decoder(
+        decoderOpt, lm, eos, amUpdate, maxOutputLength);
+    decoder.decodeStep(nullptr, 1, V);
+    return std::make_pair(decoder.getBestHypothesis(), decoder.stats().frames);
+  };
+
+  // Hypothesis are only merged on the same tokens, not on the LM state alone
+  auto constantLm = std::make_shared<UnigramTestLM>(std::vector<float>(V), 0);
+  auto constant = decode(EarlyStopping::NONE, 0, constantLm);
+  auto zero = decode(EarlyStopping::NONE, 0);
+  ASSERT_EQ(constant.first.score, zero.first.score);
+  ASSERT_EQ(tokensOf(constant.first), tokensOf(zero.first));
+
+  // The bound stops early with the best hypothesis of the full search
+  for (float alpha : {0.0f, 1.0f}) {
+    auto full = decode(EarlyStopping::NONE, alpha);
+    auto bound = decode(EarlyStopping::BOUND, alpha);
+    ASSERT_EQ(bound.first.score, full.first.score);
+    ASSERT_EQ(tokensOf(bound.first), tokensOf(full.first));
+    ASSERT_LT(bound.second, full.second);
+    auto heuristic = decode(EarlyStopping::HEURISTIC, alpha);
+    ASSERT_LE(heuristic.second, bound.second);
+  }
+
+  // Length normalization ranks the complete hypothesis on their mean score
+  std::vector<LexiconFreeSeq2SeqDecoderState> hyps;
+  hyps.reserve(3);
+  hyps.emplace_back(nullptr, nullptr, -3.0, -1);
+  hyps.emplace_back(nullptr, &hyps[0], -4.0, eos);
+  hyps.emplace_back(nullptr, &hyps[1], -4.0, eos);
+  ASSERT_EQ(outputLength(&hyps[2], 3, eos), 2);
+  std::vector<LexiconFreeSeq2SeqDecoderState> finals{
+      hyps[2], {nullptr, &hyps[0], -5.0, 1}};
+  decoderOpt.lengthNormalization = 1;
+  sortByNormalizedScore(finals, 3, eos, decoderOpt);
+  ASSERT_EQ(finals[0].score, -5.0); // -5 / 3 > -4 / 2
+}
+
+TEST(DecoderTest, adaptiveBeam) {
+  DecoderOptions decoderOpt(
+      10, // FLAGS_beamsize
+      10, // FLAGS_beamsizetoken
+      100.0, // FLAGS_beamthreshold
+      0, // FLAGS_lmweight
+      0, // FLAGS_lexiconcore
+      -std::numeric_limits<float>::infinity(), // FLAGS_unkscore
+      0, // FLAGS_silscore
+      0, // FLAGS_eosscore
+      false, // FLAGS_logadd
+      CriterionType::CTC);
+  ASSERT_EQ(AdaptiveBeam(decoderOpt).threshold(), 100.0);
+
+  decoderOpt.targetCandidates = 2;
+  AdaptiveBeam beam(decoderOpt);
+  std::vector<double> scores{-20.0, 0.0, -50.0, -10.0, -1.0};
+  beam.stepEnd(scores.data(), 4, 0.0);
+  ASSERT_NEAR(beam.threshold(), 10.0, 1e-6); // narrowed to the 2nd best
+  beam.stepEnd(scores.data(), 2, 0.0);
+  ASSERT_NEAR(beam.threshold(), 12.5, 1e-6); // widened back
+  beam.stepEnd(scores.data() + 1, 4, 0.0);
+  ASSERT_NEAR(beam.threshold(), 5.0, 1e-6); // never below 5% of 100
+  beam.reset();
+  ASSERT_EQ(beam.threshold(), 100.0);
+}
+
+TEST(DecoderTest, selectTopTokens) {
+  std::vector<float> scores{-3.0, 1.0, -1.0, 1.0, 2.0, -5.0};
+  std::vector<size_t> tokenIdx;
+  selectTopTokens(scores.data(), scores.size(), 3, tokenIdx);
+  ASSERT_EQ(tokenIdx, (std::vector<size_t>{4, 1, 3}));
+  selectTopTokens(scores.data(), scores.size(), 10, tokenIdx);
+  ASSERT_EQ(tokenIdx, (std::vector<size_t>{0, 1, 2, 3, 4, 5}));
+}
+
+TEST(DecoderTest, sparsifyEmissions) {
+  std::vector<float> scores{-3.0, 1.0, -1.0, 1.0, 2.0, -5.0, //
+                            0.0, -1.0, -2.0, -3.0, -4.0, -6.0};
+  auto sparse = sparsifyEmissions(scores.data(), 2, 6, 2, 5);
+  ASSERT_EQ(sparse.T, 2);
+  ASSERT_EQ(sparse.offsets, (std::vector<int>{0, 3, 6}));
+  ASSERT_EQ(sparse.tokens, (std::vector<int>{4, 1, 5, 0, 1, 5}));
+  ASSERT_EQ(sparse.floors, (std::vector<float>{1.0, -1.0}));
+  std::vector<float> frame(6);
+  sparse.densify(0, frame.data());
+  ASSERT_EQ(frame, (std::vector<float>{1.0, 1.0, 1.0, 1.0, 2.0, -5.0}));
+  sparse.densify(1, frame.data());
+  ASSERT_EQ(frame, (std::vector<float>{0.0, -1.0, -1.0, -1.0, -1.0, -6.0}));
+}
+
+TEST(DecoderTest, halvesToFloats) {
+  // More than a vector of 8, to convert a remainder
+  std::vector<uint16_t> halves{0x3c00, 0xc000, 0x0001, 0x7bff, 0x0000,
+                               0x8000, 0x3800, 0x7c00, 0xfc00, 0x3555};
+  std::vector<float> values(halves.size());
+  halvesToFloats(halves.data(), halves.size(), values.data());
+  ASSERT_EQ(values[0], 1.0);
+  ASSERT_EQ(values[1], -2.0);
+  ASSERT_EQ(values[2], std::ldexp(1.0f, -24));
+  ASSERT_EQ(values[3], 65504.0);
+  ASSERT_EQ(values[4], 0.0);
+  ASSERT_TRUE(std::signbit(values[5]));
+  ASSERT_EQ(values[6], 0.5);
+  ASSERT_TRUE(std::isinf(values[7]) && values[7] > 0);
+  ASSERT_TRUE(std::isinf(values[8]) && values[8] < 0);
+  ASSERT_EQ(values[9], 1365.0f / 4096);
+}
+
+TEST(DecoderTest, isBlankFrame) {
+  DecoderOptions decoderOpt(
+      10, // FLAGS_beamsize
+      10, // FLAGS_beamsizetoken
+      100.0, // FLAGS_beamthreshold
+      0, // FLAGS_lmweight
+      0, // FLAGS_lexiconcore
+      -std::numeric_limits<float>::infinity(), // FLAGS_unkscore
+      0, // FLAGS_silscore
+      0, // FLAGS_eosscore
+      false, // FLAGS_logadd
+      CriterionType::CTC);
+  std::vector<float> frame{std::log(0.0005f), std::log(0.9995f)};
+  ASSERT_FALSE(isBlankFrame(frame.data(), 1, decoderOpt)); // disabled
+  decoderOpt.blankSkipThreshold = 0.999;
+  ASSERT_TRUE(isBlankFrame(frame.data(), 1, decoderOpt));
+  ASSERT_FALSE(isBlankFrame(frame.data(), 0, decoderOpt));
+  decoderOpt.criterionType = CriterionType::ASG;
+  ASSERT_FALSE(isBlankFrame(frame.data(), 1, decoderOpt));
+}
+
+TEST(DecoderTest, blankSkip) {
+  const int T = 40, N = 8, sil = 0, blank = N - 1, nWords = 40;
+  std::mt19937 gen(19);
+  std::normal_distribution<float> normal;
+  std::uniform_int_distribution<int> letter(1, N - 2), length(1, 3);
+  auto trie = std::make_shared<Trie>(N, sil);
+  for (int w = 0; w < nWords; w++) {
+    std::vector<int> spelling;
+    for (int i = length(gen); i > 0; i--) {
+      spelling.push_back(letter(gen));
+    }
+    spelling.push_back(sil);
+    trie->insert(spelling, w, 0);
+  }
+  auto flatTrie = std::make_shared<FlatTrie>(*trie);
+  std::vector<float> transitions(N * N, 0);
+
+  // Log-softmax emissions, where the blank of every frame but one in three
+  // gets a posterior above 0.9999 if `dominated`
+  auto makeEmissions = [&](bool dominated) {
+    std::vector<float> emissions(T * N);
+    for (int t = 0; t < T; t++) {
+      float* frame = emissions.data() + t * N;
+      float maxScore = kNegativeInfinity;
+      for (int n = 0; n < N; n++) {
+        frame[n] = normal(gen);
+        if (dominated && n == blank && t % 3 != 0) {
+          frame[n] += 14;
+        }
+        maxScore = std::max(maxScore, frame[n]);
+      }
+      double sum = 0;
+      for (int n = 0; n < N; n++) {
+        sum += std::exp(frame[n] - maxScore);
+      }
+      for (int n = 0; n < N; n++) {
+        frame[n] -= maxScore + std::log(sum);
+      }
+    }
+    return emissions;
+  };
+  DecoderOptions decoderOpt(
+      200, 8, 10, 1.0, 0.5, kNegativeInfinity, 0, 0, false, CriterionType::CTC);
+  auto lm = std::make_shared<ZeroLM>();
+
+  // Blank-dominated frames look up no children in the lexicon, the others
+  // are expanded as without the threshold
+  auto emissions = makeEmissions(true);
+  decoderOpt.blankSkipThreshold = 0.999;
+  LexiconDecoder skipping(
+      decoderOpt, flatTrie, lm, sil, blank, -1, transitions, false);
+  skipping.decodeBegin();
+  for (int t = 0; t < T; t++) {
+    const float* frame = emissions.data() + t * N;
+    ASSERT_EQ(isBlankFrame(frame, blank, decoderOpt), t % 3 != 0);
+    auto expansions = skipping.stats().trieExpansions;
+    skipping.decodeStep(frame, 1, N);
+    if (t % 3 != 0) {
+      ASSERT_EQ(skipping.stats().trieExpansions, expansions);
+    } else {
+      ASSERT_GT(skipping.stats().trieExpansions, expansions);
+    }
+  }
+  skipping.decodeEnd();
+  ASSERT_FALSE(skipping.getAllFinalHypothesis().empty());
+
+  // When no frame reaches the threshold, the decoding is the same as without
+  emissions = makeEmissions(false);
+  for (int t = 0; t < T; t++) {
+    ASSERT_FALSE(isBlankFrame(emissions.data() + t * N, blank, decoderOpt));
+  }
+  LexiconDecoder lexiconSkipping(
+      decoderOpt, flatTrie, lm, sil, blank, -1, transitions, false);
+  LexiconFreeDecoder freeSkipping(decoderOpt, lm, sil, blank, transitions);
+  auto lexiconResults = lexiconSkipping.decode(emissions.data(), T, N);
+  auto freeResults = freeSkipping.decode(emissions.data(), T, N);
+  decoderOpt.blankSkipThreshold = 0;
+  LexiconDecoder lexicon(
+      decoderOpt, flatTrie, lm, sil, blank, -1, transitions, false);
+  LexiconFreeDecoder lexiconFree(decoderOpt, lm, sil, blank, transitions);
+  auto expectedLexicon = lexicon.decode(emissions.data(), T, N);
+  auto expectedFree = lexiconFree.decode(emissions.data(), T, N);
+  ASSERT_GT(lexiconResults.size(), 0);
+  ASSERT_EQ(lexiconResults.size(), expectedLexicon.size());
+  for (int i = 0; i < lexiconResults.size(); i++) {
+    ASSERT_EQ(lexiconResults[i].score, expectedLexicon[i].score);
+    ASSERT_EQ(lexiconResults[i].words, expectedLexicon[i].words);
+    ASSERT_EQ(lexiconResults[i].tokens, expectedLexicon[i].tokens);
+  }
+  ASSERT_GT(freeResults.size(), 0);
+  ASSERT_EQ(freeResults.size(), expectedFree.size());
+  for (int i = 0; i < freeResults.size(); i++) {
+    ASSERT_EQ(freeResults[i].score, expectedFree[i].score);
+    ASSERT_EQ(freeResults[i].tokens, expectedFree[i].tokens);
+  }
+  ASSERT_EQ(
+      lexiconSkipping.stats().trieExpansions, lexicon.stats().trieExpansions);
+}
+
+TEST(DecoderTest, transitionMatrix) {
+  // From token j to token i at i * N + j
+  std::vector<float> transitions{0, 1, 2, 3, 4, 5, 6, 7, 8};
+  TransitionMatrix matrix(transitions);
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      ASSERT_EQ(matrix.from(j)[i], transitions[i * 3 + j]);
+    }
+  }
+  ASSERT_TRUE(TransitionMatrix(std::vector<float>()).empty());
+  ASSERT_THROW(
+      TransitionMatrix(std::vector<float>(5)), std::invalid_argument);
+}
+
+namespace {
+
+// Vocabulary of the ConvLM tests, written in a file of its own
+std::string writeConvLmVocab() {
+  char pathTemplate[] = "/tmp/w2l_decoder_test_vocab_XXXXXX";
+  int fd = mkstemp(pathTemplate);
+  if (fd == -1) {
+    throw std::runtime_error("Cannot create the ConvLM vocabulary file");
+  }
+  close(fd);
+  std::ofstream out(pathTemplate);
+  out << "<fairseq_style>\n<pad>\n</s>\n<unk>\na\nb\nc\nd\n";
+  return pathTemplate;
+}
+
+// Score of `token` after `history`, which depends on all the tokens of the
+// history and their positions
+float fakeConvLmScore(const int* history, int length, int token) {
+  float score = -0.1f * token;
+  for (int j = 0; j < length; ++j) {
+    score -= 0.01f * (j + 1) * history[j];
+  }
+  return score;
+}
+
+// A ConvLM score function forwarding the histories into fakeConvLmScore()
+GetConvLmScoreFunc fakeConvLmScoreFunc(int vocabSize) {
+  return [vocabSize](
+             const std::vector<int>& inputs,
+             const std::vector<int>& lastTokenPositions,
+             int sampleSize,
+             int batchSize) {
+    sampleSize = sampleSize > 0 ? sampleSize : inputs.size();
+    std::vector<std::vector<float>> scores(
+        batchSize, std::vector<float>(vocabSize));
+    for (int b = 0; b < batchSize; ++b) {
+      for (int c = 0; c < vocabSize; ++c) {
+        scores[b][c] = fakeConvLmScore(
+            inputs.data() + b * sampleSize, lastTokenPositions[b] + 1, c);
+      }
+    }
+    return scores;
+  };
+}
+
+} // namespace
+
+TEST(DecoderTest, convLmUpdateCache) {
+  // Each score read from the cache, in either mode, must be the one of the
+  // history of its state truncated to the history size: a wrong or stale
+  // row, or a forward still running, would give another one
+  const std::string vocabPath = writeConvLmVocab();
+  const int vocabSize = 8, historySize = 3;
+  const size_t beamSize = 8;
+  Dictionary usrDict;
+  for (const auto& token : {"a", "b", "c", "d", "</s>"}) {
+    usrDict.addEntry(token);
+  }
+
+  // The scores are in [-1.2, 0] and the rows span 0.7: FP16 rounds them by
+  // at most 2^-11 * 1.2, INT8 by at most 0.7 / 510
+  std::vector<std::pair<ConvLMCacheType, float>> cacheTypes = {
+      {ConvLMCacheType::FP32, 0},
+      {ConvLMCacheType::FP16, 6e-4},
+      {ConvLMCacheType::INT8, 1.4e-3}};
+  for (const auto& cacheType : cacheTypes) {
+    for (bool async : {false, true}) {
+      ConvLM lm(
+          fakeConvLmScoreFunc(vocabSize),
+          vocabPath,
+          usrDict,
+          5, // lmMemory, so that the beam is forwarded in several batches
+          beamSize,
+          historySize,
+          async,
+          cacheType.first);
+      const float tolerance = cacheType.second;
+      // The beam, and the LM tokens of the full history of each state
+      std::vector<LMStatePtr> beam{lm.start(false)};
+      std::vector<std::vector<int>> histories{{2}};
+      for (int frame = 0; frame < 6; ++frame) {
+        lm.updateCache(beam);
+        std::vector<LMStatePtr> nextBeam;
+        std::vector<std::vector<int>> nextHistories;
+        for (size_t i = 0; i < beam.size(); ++i) {
+          const auto& history = histories[i];
+          int length = std::min<int>(history.size(), historySize);
+          const int* truncated = history.data() + history.size() - length;
+          for (int usrIdx = 0; usrIdx < 4; ++usrIdx) {
+            auto result = lm.score(beam[i], usrIdx);
+            ASSERT_NEAR(
+                result.second,
+                fakeConvLmScore(truncated, length, usrIdx + 4),
+                tolerance);
+            // The beam keeps two extensions of its first states
+            if (usrIdx < 2 && nextBeam.size() + 1 < beamSize) {
+              nextBeam.push_back(result.first);
+              nextHistories.push_back(history);
+              nextHistories.back().push_back(usrIdx + 4);
+            }
+          }
+          ASSERT_NEAR(
+              lm.finish(beam[i]).second,
+              fakeConvLmScore(truncated, length, 2),
+              tolerance);
+        }
+        // One state leaves the beam, and one state stays in it
+        nextBeam.push_back(beam[0]);
+        nextHistories.push_back(histories[0]);
+        beam = std::move(nextBeam);
+        histories = std::move(nextHistories);
+      }
+    }
+  }
+  std::remove(vocabPath.c_str());
+}
+
+TEST(DecoderTest, convLmInt8NonFinite) {
+  // A row with a non-finite log-prob has no quantization range: its finite
+  // scores must be kept exactly, and the non-finite one must still be
+  // rejected as with an FP32 cache
+  const std::string vocabPath = writeConvLmVocab();
+  const int vocabSize = 8;
+  Dictionary usrDict;
+  for (const auto& token : {"a", "b", "c", "d"}) {
+    usrDict.addEntry(token);
+  }
+  const float inf = std::numeric_limits<float>::infinity();
+  for (float bad : {-inf, inf, std::numeric_limits<float>::quiet_NaN()}) {
+    auto scoreFunc = fakeConvLmScoreFunc(vocabSize);
+    ConvLM lm(
+        [scoreFunc, bad](
+            const std::vector<int>& inputs,
+            const std::vector<int>& lastTokenPositions,
+            int sampleSize,
+            int batchSize) {
+          auto scores =
+              scoreFunc(inputs, lastTokenPositions, sampleSize, batchSize);
+          for (auto& row : scores) {
+            row[7] = bad;
+          }
+          return scores;
+        },
+        vocabPath,
+        usrDict,
+        10000,
+        4,
+        3,
+        false,
+        ConvLMCacheType::INT8);
+    auto start = lm.start(false);
+    lm.updateCache({start});
+    const int history[] = {2};
+    for (int usrIdx = 0; usrIdx < 3; ++usrIdx) {
+      ASSERT_EQ(
+          lm.score(start, usrIdx).second,
+          fakeConvLmScore(history, 1, usrIdx + 4));
+    }
+    ASSERT_THROW(lm.score(start, 3), std::runtime_error);
+  }
+  std::remove(vocabPath.c_str());
+}
+
+TEST(DecoderTest, floatToHalf) {
+  // Every half but the NaNs converts to a float and back to itself
+  for (uint32_t half = 0; half <= 0xffff; ++half) {
+    float value = halfToFloat(half);
+    if ((half & 0x7c00) == 0x7c00 && (half & 0x3ff)) {
+      ASSERT_TRUE(std::isnan(value));
+      ASSERT_TRUE(std::isnan(halfToFloat(floatToHalf(value))));
+    } else {
+      ASSERT_EQ(floatToHalf(value), half);
+    }
+  }
+  // Rounding to nearest even, of normals and of subnormals
+  ASSERT_EQ(floatToHalf(1.0f + std::ldexp(1.0f, -11)), 0x3c00);
+  ASSERT_EQ(floatToHalf(1.0f + 3 * std::ldexp(1.0f, -11)), 0x3c02);
+  ASSERT_EQ(floatToHalf(std::ldexp(1.0f, -25)), 0x0000);
+  ASSERT_EQ(floatToHalf(3 * std::ldexp(1.0f, -26)), 0x0001);
+  ASSERT_EQ(floatToHalf(3 * std::ldexp(1.0f, -25)), 0x0002);
+  // Float subnormals flush to a signed zero
+  ASSERT_EQ(floatToHalf(1e-40f), 0x0000);
+  ASSERT_EQ(floatToHalf(-1e-40f), 0x8000);
+  // Overflow and infinities
+  ASSERT_EQ(floatToHalf(65519.0f), 0x7bff);
+  ASSERT_EQ(floatToHalf(65520.0f), 0x7c00);
+  ASSERT_EQ(floatToHalf(-1e10f), 0xfc00);
+  ASSERT_EQ(floatToHalf(std::numeric_limits<float>::infinity()), 0x7c00);
+  ASSERT_EQ(floatToHalf(-std::numeric_limits<float>::infinity()), 0xfc00);
+  uint16_t nan = floatToHalf(std::numeric_limits<float>::quiet_NaN());
+  ASSERT_EQ(nan & 0x7c00, 0x7c00);
+  ASSERT_NE(nan & 0x3ff, 0);
 }
 
 int main(int argc, char** argv) {
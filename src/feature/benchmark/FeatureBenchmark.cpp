@@ -0,0 +1,219 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/**
+ * Benchmarks each stage of the feature extraction of libraries/feature, and
+ * the whole Mfsc / Mfcc pipelines for one signal on several OpenMP thread
+ * counts and for batches of signals with batchApply().
+ *
+ * Usage: FeatureBenchmark [filter] [min time per benchmark in sec]
+ * Only the benchmarks whose name contains `filter` are run. Each one reports
+ * its time per iteration, the audio samples featurized per second and its
+ * real-time factor (processing time / audio duration).
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "libraries/feature/Ceplifter.h"
+#include "libraries/feature/Dct.h"
+#include "libraries/feature/Derivatives.h"
+#include "libraries/feature/Mfcc.h"
+#include "libraries/feature/Mfsc.h"
+#include "libraries/feature/PowerSpectrum.h"
+#include "libraries/feature/TriFilterbank.h"
+
+using namespace w2l;
+
+namespace {
+
+constexpr int64_t kSamplingFreq = 16000;
+constexpr int64_t kAudioSec = 10;
+constexpr int64_t kNumFilters = 80;
+constexpr int64_t kNumCeps = 13;
+
+FeatureParams benchmarkParams() {
+  FeatureParams params;
+  params.samplingFreq = kSamplingFreq;
+  params.frameSizeMs = 25;
+  params.frameStrideMs = 10;
+  params.numFilterbankChans = kNumFilters;
+  params.lowFreqFilterbank = 0;
+  params.highFreqFilterbank = kSamplingFreq / 2;
+  params.numCepstralCoeffs = kNumCeps;
+  params.lifterParam = 22;
+  params.deltaWindow = 2;
+  params.accWindow = 2;
+  return params;
+}
+
+std::vector<float> randomSignal(int64_t size) {
+  std::mt19937 rng(0);
+  std::uniform_real_distribution<float> distribution(-1.0, 1.0);
+  std::vector<float> signal(size);
+  for (auto& s : signal) {
+    s = distribution(rng);
+  }
+  return signal;
+}
+
+struct Benchmark {
+  std::string name;
+  int64_t numSamples; // audio samples featurized by an iteration
+  int threads; // OpenMP threads of the benchmark, 0 to leave them untouched
+  std::function<void()> run;
+};
+
+void runBenchmark(const Benchmark& benchmark, double minTimeSec) {
+#ifdef _OPENMP
+  int defaultThreads = omp_get_max_threads();
+  if (benchmark.threads > 0) {
+    omp_set_num_threads(benchmark.threads);
+  }
+#endif
+  benchmark.run(); // warm-up
+  int64_t iterations = 0;
+  double elapsedSec = 0.0;
+  auto start = std::chrono::steady_clock::now();
+  while (elapsedSec < minTimeSec) {
+    benchmark.run();
+    ++iterations;
+    elapsedSec = std::chrono::duration<double>(
+                     std::chrono::steady_clock::now() - start)
+                     .count();
+  }
+#ifdef _OPENMP
+  omp_set_num_threads(defaultThreads);
+#endif
+
+  double secPerIter = elapsedSec / iterations;
+  double audioSec = static_cast<double>(benchmark.numSamples) / kSamplingFreq;
+  printf(
+      "%-36s %12.1f %10lld %14.3e %10.5f\n",
+      benchmark.name.c_str(),
+      secPerIter * 1e6,
+      static_cast<long long>(iterations),
+      benchmark.numSamples / secPerIter,
+      secPerIter / audioSec);
+}
+} // namespace
+
+int main(int argc, char** argv) {
+  std::string filter = argc > 1 ? argv[1] : "";
+  double minTimeSec = argc > 2 ? std::atof(argv[2]) : 0.5;
+
+  auto params = benchmarkParams();
+  int64_t numSamples = kAudioSec * kSamplingFreq;
+  auto signal = randomSignal(numSamples);
+
+  // Inputs of the stages, as computed by the previous ones
+  PowerSpectrum<float> powSpectrum(params);
+  TriFilterbank<float> filterbank(
+      params.numFilterbankChans,
+      params.filterFreqResponseLen(),
+      params.samplingFreq,
+      params.lowFreqFilterbank,
+      params.highFreqFilterbank,
+      FrequencyScale::MEL);
+  Dct<float> dct(params.numFilterbankChans, params.numCepstralCoeffs);
+  Ceplifter<float> ceplifter(params.numCepstralCoeffs, params.lifterParam);
+  Derivatives<float> derivatives(params.deltaWindow, params.accWindow);
+  auto powFeat = powSpectrum.apply(signal);
+  auto fbFeat = filterbank.apply(powFeat, params.melFloor);
+  auto cepFeat = dct.apply(fbFeat);
+
+  Mfsc<float> mfsc(params);
+  Mfcc<float> mfcc(params);
+
+  std::vector<Benchmark> benchmarks = {
+      // Framing, dithering, pre-emphasis, windowing and FFT are fused
+      {"stage/PowerSpectrum", numSamples, 1, [&]() {
+         powSpectrum.apply(signal);
+       }},
+      {"stage/TriFilterbank", numSamples, 1, [&]() {
+         filterbank.apply(powFeat, params.melFloor);
+       }},
+      {"stage/Dct", numSamples, 1, [&]() { dct.apply(fbFeat); }},
+      {"stage/Ceplifter", numSamples, 1, [&]() {
+         auto cep = cepFeat;
+         ceplifter.applyInPlace(cep);
+       }},
+      {"stage/Derivatives", numSamples, 1, [&]() {
+         derivatives.apply(cepFeat, params.numCepstralCoeffs);
+       }},
+  };
+
+  int maxThreads = 1;
+#ifdef _OPENMP
+  maxThreads = omp_get_max_threads();
+#endif
+  std::vector<int> threadCounts = {1, 2, 4, 8, maxThreads};
+  std::sort(threadCounts.begin(), threadCounts.end());
+  threadCounts.erase(
+      std::unique(threadCounts.begin(), threadCounts.end()),
+      threadCounts.end());
+  for (int threads : threadCounts) {
+    if (threads > maxThreads) {
+      continue;
+    }
+    auto suffix = "/threads:" + std::to_string(threads);
+    benchmarks.push_back({"Mfsc::apply" + suffix, numSamples, threads, [&]() {
+                            mfsc.apply(signal);
+                          }});
+    benchmarks.push_back({"Mfcc::apply" + suffix, numSamples, threads, [&]() {
+                            mfcc.apply(signal);
+                          }});
+  }
+
+  // batchApply() runs a thread per signal of the batch
+  std::vector<std::vector<float>> batches;
+  std::vector<int64_t> batchSizes = {1, 2, 4, 8, 16};
+  for (auto batchSz : batchSizes) {
+    batches.push_back(randomSignal(numSamples * batchSz));
+  }
+  for (size_t i = 0; i < batchSizes.size(); ++i) {
+    auto batchSz = batchSizes[i];
+    const auto& batch = batches[i];
+    benchmarks.push_back(
+        {"Mfcc::batchApply/batch:" + std::to_string(batchSz),
+         numSamples * batchSz,
+         0,
+         [&mfcc, &batch, batchSz]() { mfcc.batchApply(batch, batchSz); }});
+  }
+
+  printf(
+      "%lld sec of %lld Hz audio, %lld filters, %lld ceps, %d max threads\n",
+      static_cast<long long>(kAudioSec),
+      static_cast<long long>(kSamplingFreq),
+      static_cast<long long>(kNumFilters),
+      static_cast<long long>(kNumCeps),
+      maxThreads);
+  printf(
+      "%-36s %12s %10s %14s %10s\n",
+      "Benchmark",
+      "Time (us)",
+      "Iterations",
+      "Samples/s",
+      "RTF");
+  for (const auto& benchmark : benchmarks) {
+    if (benchmark.name.find(filter) != std::string::npos) {
+      runBenchmark(benchmark, minTimeSec);
+    }
+  }
+  return 0;
+}
@@ -9,8 +9,10 @@
 #include <gtest/gtest.h>
 
 #include "TestUtils.h"
+#include "libraries/feature/Ceplifter.h"
 #include "libraries/feature/Dct.h"
 
+using w2l::Ceplifter;
 using w2l::Dct;
 
 // Matlab code used:
@@ -64,6 +66,19 @@ TEST(DctTest, batchingTest) {
   }
 }
 
+TEST(DctTest, lifterTest) {
+  int F = 40, C = 13, L = 22;
+  auto dct = Dct<double>(F, C);
+  auto liftered = Dct<double>(F, C, L);
+  auto ceplifter = Ceplifter<double>(C, L);
+  // Few frames are transformed without BLAS
+  for (int B : {1, 5, 100}) {
+    auto input = randVec<double>(F * B);
+    auto expOutput = ceplifter.apply(dct.apply(input));
+    ASSERT_TRUE(compareVec<double>(liftered.apply(input), expOutput, 1E-10));
+  }
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
@@ -7,6 +7,7 @@
  */
 
 #include <gtest/gtest.h>
+#include <algorithm>
 #include <chrono>
 #include <thread>
 
@@ -49,6 +50,33 @@ TEST(DitherTest, basicTest) {
   }
 }
 
+TEST(DitherTest, offsetTest) {
+  int64_t N = 1000;
+  auto input = randVec<float>(N);
+
+  // The noise of successive calls is the one of a single call
+  Dither<float> dither(0.01);
+  auto output = dither.apply(input);
+  Dither<float> chunked(0.01);
+  std::vector<float> chunkedOutput(N);
+  for (int64_t i = 0; i < N; i += 37) {
+    int64_t size = std::min<int64_t>(37, N - i);
+    chunked.apply(input.data() + i, size, chunkedOutput.data() + i);
+  }
+  ASSERT_TRUE(compareVec<float>(output, chunkedOutput, 0));
+
+  // The noise at an offset doesn't depend on the calls made before
+  std::vector<float> offsetOutput(N - 5);
+  chunked.apply(input.data() + 5, N - 5, offsetOutput.data(), 5);
+  ASSERT_TRUE(compareVec<float>(
+      std::vector<float>(output.begin() + 5, output.end()), offsetOutput, 0));
+
+  for (size_t i = 0; i < N; ++i) {
+    ASSERT_GE(output[i] - input[i], 0.0);
+    ASSERT_LT(output[i] - input[i], 0.01 + 1E-6);
+  }
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
@@ -199,6 +199,33 @@ TEST(MfccTest, ZeroInputTest) {
   }
 }
 
+TEST(MfccTest, OutputBufferTest) {
+  auto params = FeatureParams();
+  params.useEnergy = true;
+  params.deltaWindow = 2;
+  params.accWindow = 2;
+  Mfcc<float> mfcc(params);
+  Mfsc<float> mfsc(params);
+  PowerSpectrum<float> powspec(params);
+  auto input = randVec<float>(8000);
+  for (PowerSpectrum<float>* featurizer :
+       std::vector<PowerSpectrum<float>*>{&mfcc, &mfsc, &powspec}) {
+    auto expected = featurizer->apply(input);
+    ASSERT_EQ(expected.size(), featurizer->outputSize(input.size()));
+    // Twice, the second time with the buffers of the first one
+    for (int i = 0; i < 2; ++i) {
+      std::vector<float> output(expected.size(), -1);
+      featurizer->apply(input.data(), input.size(), output.data());
+      ASSERT_EQ(output, expected);
+    }
+    // A shorter signal, in the larger buffers
+    std::vector<float> shorter(input.begin(), input.begin() + 2000);
+    std::vector<float> output(featurizer->outputSize(shorter.size()));
+    featurizer->apply(shorter.data(), shorter.size(), output.data());
+    ASSERT_EQ(output, featurizer->apply(shorter));
+  }
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
 
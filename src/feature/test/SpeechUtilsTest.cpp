@@ -9,6 +9,10 @@
 #include <arrayfire.h>
 #include <gtest/gtest.h>
 
+#include <cfloat>
+#include <cmath>
+#include <limits>
+
 #include "TestUtils.h"
 #include "libraries/feature/SpeechUtils.h"
 
@@ -51,6 +55,20 @@ TEST(SpeechUtilsTest, AfMatmulCompare) {
   }
 }
 
+TEST(SpeechUtilsTest, FastLog) {
+  std::vector<float> input;
+  for (float x = std::numeric_limits<float>::min(); x < 1E38; x *= 1.01) {
+    input.push_back(x);
+  }
+  std::vector<float> exact(input.size()), fast(input.size());
+  logArray(input.data(), input.size(), exact.data(), false);
+  logArray(input.data(), input.size(), fast.data(), true);
+  for (size_t i = 0; i < input.size(); ++i) {
+    ASSERT_EQ(exact[i], std::log(input[i]));
+    ASSERT_NEAR(fast[i], exact[i], 2 * std::abs(exact[i]) * FLT_EPSILON);
+  }
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
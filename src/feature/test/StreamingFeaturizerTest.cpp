@@ -0,0 +1,85 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <gtest/gtest.h>
+#include <memory>
+
+#include "TestUtils.h"
+#include "libraries/feature/Mfcc.h"
+#include "libraries/feature/StreamingFeaturizer.h"
+
+using namespace w2l;
+
+namespace {
+// Featurize `input` by chunks of `chunkSz` samples
+template <typename T>
+std::vector<T> streamApply(
+    StreamingFeaturizer<T>& stream,
+    const std::vector<T>& input,
+    int64_t chunkSz) {
+  std::vector<T> output;
+  for (size_t i = 0; i < input.size(); i += chunkSz) {
+    auto end = std::min(input.size(), i + chunkSz);
+    auto feat =
+        stream.apply(std::vector<T>(input.begin() + i, input.begin() + end));
+    output.insert(output.end(), feat.begin(), feat.end());
+  }
+  auto feat = stream.finish();
+  output.insert(output.end(), feat.begin(), feat.end());
+  return output;
+}
+
+// The power spectrum is large, so compare relatively
+template <typename T>
+bool compareRelative(const std::vector<T>& A, const std::vector<T>& B) {
+  if (A.size() != B.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < A.size(); ++i) {
+    if (std::abs(A[i] - B[i]) > 1E-4 * std::max<T>(1, std::abs(B[i]))) {
+      return false;
+    }
+  }
+  return true;
+}
+} // namespace
+
+TEST(StreamingFeaturizerTest, matchesBatchFeatures) {
+  auto input = randVec<float>(12345);
+  FeatureParams params;
+  params.deltaWindow = 3;
+  params.accWindow = 2;
+  std::vector<std::shared_ptr<PowerSpectrum<float>>> featurizers = {
+      std::make_shared<PowerSpectrum<float>>(params),
+      std::make_shared<Mfsc<float>>(params),
+      std::make_shared<Mfcc<float>>(params)};
+  for (auto& featurizer : featurizers) {
+    auto expected = featurizer->apply(input);
+    StreamingFeaturizer<float> stream(featurizer);
+    for (int64_t chunkSz : {1, 160, 399, 1000, 20000}) {
+      auto output = streamApply(stream, input, chunkSz);
+      ASSERT_TRUE(compareRelative(output, expected));
+    }
+  }
+}
+
+TEST(StreamingFeaturizerTest, strideLargerThanFrame) {
+  auto input = randVec<double>(5000);
+  FeatureParams params;
+  params.frameSizeMs = 10;
+  params.frameStrideMs = 25;
+  auto mfcc = std::make_shared<Mfcc<double>>(params);
+  auto expected = mfcc->apply(input);
+  StreamingFeaturizer<double> stream(mfcc);
+  ASSERT_TRUE(compareRelative(streamApply(stream, input, 77), expected));
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
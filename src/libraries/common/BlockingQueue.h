@@ -0,0 +1,103 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+namespace w2l {
+
+/**
+ * A bounded multi-producer multi-consumer FIFO queue.
+ *
+ * push() blocks while the queue holds `capacity` elements. Once producers are
+ * done they call close(): pop() then drains the remaining elements and
+ * returns false when the queue is empty.
+ *
+ * The time spent blocked in push() and pop() is summed over the threads: it
+ * tells whether the producers or the consumers are the bottleneck of a
+ * pipeline.
+ */
+template <class T>
+class BlockingQueue {
+ public:
+  explicit BlockingQueue(size_t capacity)
+      : capacity_(capacity > 0 ? capacity : 1), closed_(false) {}
+
+  // Returns false if the queue was closed, `value` is then dropped
+  bool push(T value) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!closed_ && queue_.size() >= capacity_) {
+      auto start = Clock::now();
+      notFull_.wait(
+          lock, [this]() { return closed_ || queue_.size() < capacity_; });
+      pushWait_ += Clock::now() - start;
+    }
+    if (closed_) {
+      return false;
+    }
+    queue_.push_back(std::move(value));
+    notEmpty_.notify_one();
+    return true;
+  }
+
+  // Returns false if the queue is closed and empty
+  bool pop(T& value) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!closed_ && queue_.empty()) {
+      auto start = Clock::now();
+      notEmpty_.wait(lock, [this]() { return closed_ || !queue_.empty(); });
+      popWait_ += Clock::now() - start;
+    }
+    if (queue_.empty()) {
+      return false;
+    }
+    value = std::move(queue_.front());
+    queue_.pop_front();
+    notFull_.notify_one();
+    return true;
+  }
+
+  void close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    notEmpty_.notify_all();
+    notFull_.notify_all();
+  }
+
+  // Seconds spent by producers waiting for room
+  double pushWaitSeconds() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return std::chrono::duration<double>(pushWait_).count();
+  }
+
+  // Seconds spent by consumers waiting for elements
+  double popWaitSeconds() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return std::chrono::duration<double>(popWait_).count();
+  }
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  size_t capacity_;
+  bool closed_;
+  std::deque<T> queue_;
+  Clock::duration pushWait_{0};
+  Clock::duration popWait_{0};
+  mutable std::mutex mutex_;
+  std::condition_variable notEmpty_;
+  std::condition_variable notFull_;
+};
+
+} // namespace w2l
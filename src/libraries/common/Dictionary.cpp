@@ -8,6 +8,8 @@
 
 #include "libraries/common/Dictionary.h"
 
+#include <algorithm>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <stdexcept>
@@ -16,6 +18,22 @@
 
 namespace w2l {
 
+namespace {
+
+constexpr size_t kMinSlots = 16;
+
+// 32-bit FNV-1a
+uint32_t hashEntry(const char* entry, size_t length) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < length; ++i) {
+    hash ^= static_cast<unsigned char>(entry[i]);
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+} // namespace
+
 Dictionary::Dictionary(std::istream& stream) {
   createFromStream(stream);
 }
@@ -51,11 +69,26 @@ void Dictionary::createFromStream(std::istream& stream) {
 }
 
 void Dictionary::addEntry(const std::string& entry, int idx) {
-  if (entry2idx_.find(entry) != entry2idx_.end()) {
+  if (frozen_) {
+    throw std::logic_error(
+        "Cannot add entry '" + entry + "' to a frozen dictionary");
+  }
+  auto hash = hashEntry(entry.data(), entry.size());
+  if (find(entry.data(), entry.size(), hash) >= 0) {
     throw std::invalid_argument(
         "Duplicate entry name in dictionary '" + entry + "'");
   }
-  entry2idx_[entry] = idx;
+  entries_.push_back({entry, idx, hash});
+  if (2 * entries_.size() > slots_.size()) {
+    rehash(std::max(kMinSlots, 2 * slots_.size()));
+  } else {
+    size_t mask = slots_.size() - 1;
+    size_t pos = hash & mask;
+    while (slots_[pos].entry >= 0) {
+      pos = (pos + 1) & mask;
+    }
+    slots_[pos] = {hash, static_cast<int32_t>(entries_.size() - 1)};
+  }
   if (idx2entry_.find(idx) == idx2entry_.end()) {
     idx2entry_[idx] = entry;
   }
@@ -63,7 +96,7 @@ void Dictionary::addEntry(const std::string& entry, int idx) {
 
 void Dictionary::addEntry(const std::string& entry) {
   // Check if the entry already exists in the dictionary
-  if (entry2idx_.find(entry) != entry2idx_.end()) {
+  if (contains(entry)) {
     throw std::invalid_argument(
         "Duplicate entry in dictionary '" + entry + "'");
   }
@@ -75,7 +108,7 @@ void Dictionary::addEntry(const std::string& entry) {
   addEntry(entry, idx);
 }
 
-std::string Dictionary::getEntry(int idx) const {
+const std::string& Dictionary::getEntry(int idx) const {
   auto iter = idx2entry_.find(idx);
   if (iter == idx2entry_.end()) {
     throw std::invalid_argument(
@@ -89,29 +122,91 @@ void Dictionary::setDefaultIndex(int idx) {
 }
 
 int Dictionary::getIndex(const std::string& entry) const {
-  auto iter = entry2idx_.find(entry);
-  if (iter == entry2idx_.end()) {
+  return getIndex(entry.data(), entry.size());
+}
+
+int Dictionary::getIndex(const char* entry) const {
+  return getIndex(entry, std::strlen(entry));
+}
+
+int Dictionary::getIndex(const char* entry, size_t length) const {
+  auto pos = find(entry, length, hashEntry(entry, length));
+  if (pos < 0) {
     if (defaultIndex_ < 0) {
       throw std::invalid_argument(
-          "Unknown entry in dictionary: '" + entry + "'");
+          "Unknown entry in dictionary: '" + std::string(entry, length) +
+          "'");
     } else {
-      std::cerr << "Skipping unknown entry: '" << entry << "'" << std::endl;
+      std::cerr << "Skipping unknown entry: '" << std::string(entry, length)
+                << "'" << std::endl;
       return defaultIndex_;
     }
   }
-  return iter->second;
+  return entries_[pos].idx;
 }
 
 bool Dictionary::contains(const std::string& entry) const {
-  auto iter = entry2idx_.find(entry);
-  if (iter == entry2idx_.end()) {
-    return false;
+  return contains(entry.data(), entry.size());
+}
+
+bool Dictionary::contains(const char* entry) const {
+  return contains(entry, std::strlen(entry));
+}
+
+bool Dictionary::contains(const char* entry, size_t length) const {
+  return find(entry, length, hashEntry(entry, length)) >= 0;
+}
+
+void Dictionary::freeze() {
+  frozen_ = true;
+  entries_.shrink_to_fit();
+  // At most a quarter full, as the table won't grow anymore
+  size_t numSlots = kMinSlots;
+  while (numSlots < 4 * entries_.size()) {
+    numSlots *= 2;
+  }
+  rehash(numSlots);
+}
+
+bool Dictionary::isFrozen() const {
+  return frozen_;
+}
+
+int32_t Dictionary::find(const char* entry, size_t length, uint32_t hash)
+    const {
+  if (slots_.empty()) {
+    return -1;
+  }
+  size_t mask = slots_.size() - 1;
+  for (size_t pos = hash & mask;; pos = (pos + 1) & mask) {
+    const auto& slot = slots_[pos];
+    if (slot.entry < 0) {
+      return -1;
+    }
+    if (slot.hash == hash) {
+      const auto& candidate = entries_[slot.entry].entry;
+      if (candidate.size() == length &&
+          std::memcmp(candidate.data(), entry, length) == 0) {
+        return slot.entry;
+      }
+    }
+  }
+}
+
+void Dictionary::rehash(size_t numSlots) {
+  slots_.assign(numSlots, {0, -1});
+  size_t mask = numSlots - 1;
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    size_t pos = entries_[i].hash & mask;
+    while (slots_[pos].entry >= 0) {
+      pos = (pos + 1) & mask;
+    }
+    slots_[pos] = {entries_[i].hash, static_cast<int32_t>(i)};
   }
-  return true;
 }
 
 size_t Dictionary::entrySize() const {
-  return entry2idx_.size();
+  return entries_.size();
 }
 
 bool Dictionary::isContiguous() const {
@@ -120,8 +215,8 @@ bool Dictionary::isContiguous() const {
       return false;
     }
   }
-  for (const auto& tknidx : entry2idx_) {
-    if (idx2entry_.find(tknidx.second) == idx2entry_.end()) {
+  for (const auto& entry : entries_) {
+    if (idx2entry_.find(entry.idx) == idx2entry_.end()) {
       return false;
     }
   }
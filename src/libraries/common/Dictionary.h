@@ -8,15 +8,20 @@
 
 #pragma once
 
+#include <cstdint>
 #include <istream>
 #include <string>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 namespace w2l {
 
 // A simple dictionary class which holds a bidirectional map
-// entry (strings) <--> integer indices. Not thread-safe !
+// entry (strings) <--> integer indices. Entries are looked up in an open
+// addressing hash table, for which C strings and (pointer, length) pairs are
+// looked up without building a std::string. Not thread-safe ! Once frozen, no
+// entry can be added and the lookups can be shared between threads.
 class Dictionary {
  public:
   // Creates an empty dictionary
@@ -34,14 +39,27 @@ class Dictionary {
 
   void addEntry(const std::string& entry);
 
-  std::string getEntry(int idx) const;
+  const std::string& getEntry(int idx) const;
 
   void setDefaultIndex(int idx);
 
   int getIndex(const std::string& entry) const;
 
+  int getIndex(const char* entry) const;
+
+  int getIndex(const char* entry, size_t length) const;
+
   bool contains(const std::string& entry) const;
 
+  bool contains(const char* entry) const;
+
+  bool contains(const char* entry, size_t length) const;
+
+  // Forbids adding entries and rehashes the entries for shorter lookups
+  void freeze();
+
+  bool isFrozen() const;
+
   // checks if all the indices are contiguous
   bool isContiguous() const;
 
@@ -55,9 +73,28 @@ class Dictionary {
   // Creates a dictionary from an input stream
   void createFromStream(std::istream& stream);
 
-  std::unordered_map<std::string, int> entry2idx_;
+  struct Entry {
+    std::string entry;
+    int idx;
+    uint32_t hash;
+  };
+
+  // Position, in `entries_`, of the entry hashed to each slot, or -1 if the
+  // slot is empty. The slots are a power of two and at most half full.
+  struct Slot {
+    uint32_t hash;
+    int32_t entry;
+  };
+
+  // Returns the position of `entry` in `entries_`, or -1
+  int32_t find(const char* entry, size_t length, uint32_t hash) const;
+  void rehash(size_t numSlots);
+
+  std::vector<Entry> entries_;
+  std::vector<Slot> slots_;
   std::unordered_map<int, std::string> idx2entry_;
   int defaultIndex_ = -1;
+  bool frozen_ = false;
 };
 
 typedef std::unordered_map<int, Dictionary> DictionaryMap;
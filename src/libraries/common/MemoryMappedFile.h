@@ -0,0 +1,46 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+namespace w2l {
+
+/**
+ * MemoryMappedFile maps a whole file read-only into memory. Pages are shared
+ * with every other thread or process mapping the same file and are loaded
+ * lazily by the OS, so opening even a large file is almost free.
+ */
+class MemoryMappedFile {
+ public:
+  explicit MemoryMappedFile(const std::string& path);
+
+  ~MemoryMappedFile();
+
+  MemoryMappedFile(const MemoryMappedFile&) = delete;
+  MemoryMappedFile& operator=(const MemoryMappedFile&) = delete;
+
+  const char* data() const {
+    return data_;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+ private:
+  const char* data_;
+  size_t size_;
+};
+
+using MemoryMappedFilePtr = std::shared_ptr<MemoryMappedFile>;
+
+} // namespace w2l
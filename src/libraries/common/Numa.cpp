@@ -0,0 +1,195 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "libraries/common/Numa.h"
+
+#ifdef __linux__
+#include <dirent.h>
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <sstream>
+#include <string>
+
+namespace w2l {
+
+namespace {
+
+#ifdef __linux__
+constexpr size_t kHugePageSize = 2 << 20;
+#endif
+
+} // namespace
+
+std::vector<int> numaNodes() {
+  std::vector<int> nodes;
+#ifdef __linux__
+  DIR* dir = opendir("/sys/devices/system/node");
+  if (dir) {
+    while (auto entry = readdir(dir)) {
+      std::string name = entry->d_name;
+      if (name.size() > 4 && name.compare(0, 4, "node") == 0 &&
+          std::all_of(name.begin() + 4, name.end(), ::isdigit)) {
+        int node = std::stoi(name.substr(4));
+        // Memory-only nodes have no CPU to bind threads to
+        if (!numaNodeCpus(node).empty()) {
+          nodes.push_back(node);
+        }
+      }
+    }
+    closedir(dir);
+  }
+#endif
+  if (nodes.empty()) {
+    nodes.push_back(0);
+  }
+  std::sort(nodes.begin(), nodes.end());
+  return nodes;
+}
+
+std::vector<int> numaNodeCpus(int node) {
+  std::vector<int> cpus;
+  // A list of ranges, such as "0-15,32-47"
+  std::ifstream list(
+      "/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+  std::string range;
+  while (std::getline(list, range, ',')) {
+    if (range.empty() || !::isdigit(range[0])) {
+      continue;
+    }
+    auto dash = range.find('-');
+    int first = std::stoi(range.substr(0, dash));
+    int last = dash == std::string::npos ? first
+                                         : std::stoi(range.substr(dash + 1));
+    for (int cpu = first; cpu <= last; ++cpu) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+NumaNodeBinding::NumaNodeBinding(int node) {
+#ifdef __linux__
+  auto cpus = numaNodeCpus(node);
+  if (cpus.empty()) {
+    return;
+  }
+  previousAffinity_.resize(sizeof(cpu_set_t));
+  auto previous = reinterpret_cast<cpu_set_t*>(previousAffinity_.data());
+  if (pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), previous)) {
+    return;
+  }
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : cpus) {
+    if (cpu < CPU_SETSIZE) {
+      CPU_SET(cpu, &set);
+    }
+  }
+  bound_ = pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#endif
+}
+
+NumaNodeBinding::~NumaNodeBinding() {
+#ifdef __linux__
+  if (bound_) {
+    pthread_setaffinity_np(
+        pthread_self(),
+        sizeof(cpu_set_t),
+        reinterpret_cast<cpu_set_t*>(previousAffinity_.data()));
+  }
+#endif
+}
+
+NumaInterleaving::NumaInterleaving() {
+#ifdef __linux__
+  auto nodes = numaNodes();
+  if (nodes.size() < 2) {
+    return;
+  }
+  // Called through syscall(), so that libnuma isn't needed
+  constexpr int kMaxNodes = 1024;
+  constexpr int kBitsPerWord = 8 * sizeof(unsigned long);
+  std::vector<unsigned long> mask(kMaxNodes / kBitsPerWord, 0);
+  for (int node : nodes) {
+    if (node < kMaxNodes) {
+      mask[node / kBitsPerWord] |= 1UL << (node % kBitsPerWord);
+    }
+  }
+  interleaved_ = syscall(
+                     SYS_set_mempolicy,
+                     MPOL_INTERLEAVE,
+                     mask.data(),
+                     static_cast<unsigned long>(kMaxNodes)) == 0;
+#endif
+}
+
+NumaInterleaving::~NumaInterleaving() {
+#ifdef __linux__
+  if (interleaved_) {
+    syscall(SYS_set_mempolicy, MPOL_DEFAULT, nullptr, 0UL);
+  }
+#endif
+}
+
+std::shared_ptr<char> allocatePages(size_t bytes, HugePages hugePages) {
+  bytes = std::max<size_t>(bytes, 1);
+#ifdef __linux__
+  void* data = MAP_FAILED;
+  if (hugePages == HugePages::EXPLICIT) {
+    size_t size = (bytes + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+    data = mmap(
+        nullptr,
+        size,
+        PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+        -1,
+        0);
+    if (data != MAP_FAILED) {
+      return std::shared_ptr<char>(
+          static_cast<char*>(data), [size](char* p) { munmap(p, size); });
+    }
+  }
+  data = mmap(
+      nullptr,
+      bytes,
+      PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS,
+      -1,
+      0);
+  if (data == MAP_FAILED) {
+    throw std::bad_alloc();
+  }
+#ifdef MADV_HUGEPAGE
+  if (hugePages != HugePages::NONE) {
+    // Before the pages are touched, so that they are huge from the start
+    madvise(data, bytes, MADV_HUGEPAGE);
+  }
+#endif
+  return std::shared_ptr<char>(
+      static_cast<char*>(data), [bytes](char* p) { munmap(p, bytes); });
+#else
+  auto data = static_cast<char*>(std::calloc(bytes, 1));
+  if (!data) {
+    throw std::bad_alloc();
+  }
+  return std::shared_ptr<char>(data, [](char* p) { std::free(p); });
+#endif
+}
+
+} // namespace w2l
@@ -0,0 +1,75 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace w2l {
+
+/**
+ * The NUMA nodes of the host with CPUs, as listed in sysfs, in increasing
+ * order. A single node 0 if the host isn't NUMA or the topology is unknown.
+ */
+std::vector<int> numaNodes();
+
+/* The CPUs of NUMA node `node`, empty if unknown */
+std::vector<int> numaNodeCpus(int node);
+
+/**
+ * Binds the calling thread to the CPUs of a NUMA node while in scope, then
+ * restores its previous affinity. The pages the thread first touches in the
+ * meantime are allocated on that node under the default memory policy, so
+ * that data built by a bound thread is local to the node.
+ */
+class NumaNodeBinding {
+ public:
+  explicit NumaNodeBinding(int node);
+  ~NumaNodeBinding();
+
+  NumaNodeBinding(const NumaNodeBinding&) = delete;
+  NumaNodeBinding& operator=(const NumaNodeBinding&) = delete;
+
+ private:
+  bool bound_ = false;
+  std::vector<char> previousAffinity_;
+};
+
+/**
+ * Interleaves the pages the calling thread allocates over all the NUMA nodes
+ * while in scope, page cache pages included, then restores the default
+ * memory policy.
+ */
+class NumaInterleaving {
+ public:
+  NumaInterleaving();
+  ~NumaInterleaving();
+
+  NumaInterleaving(const NumaInterleaving&) = delete;
+  NumaInterleaving& operator=(const NumaInterleaving&) = delete;
+
+ private:
+  bool interleaved_ = false;
+};
+
+/**
+ * How large read-only tables are backed: NONE by regular pages,
+ * TRANSPARENT by transparent huge pages (madvise), EXPLICIT by pages of the
+ * huge page pool (MAP_HUGETLB), or transparent ones if the pool is empty.
+ */
+enum class HugePages { NONE, TRANSPARENT, EXPLICIT };
+
+/**
+ * `bytes` of zeroed anonymous memory backed as `hugePages` says, released
+ * with the last copy of the pointer. Page-aligned whatever the mode.
+ */
+std::shared_ptr<char> allocatePages(size_t bytes, HugePages hugePages);
+
+} // namespace w2l
@@ -0,0 +1,208 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "libraries/common/TaskScheduler.h"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+
+namespace w2l {
+
+namespace {
+
+// The scheduler and the index of the worker running on this thread, if any
+thread_local const TaskScheduler* currentScheduler = nullptr;
+thread_local int currentWorker = -1;
+
+std::mutex& configMutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+
+int configNumThreads = 0;
+bool configPinThreads = false;
+bool started = false;
+
+} // namespace
+
+TaskScheduler::TaskScheduler(int numThreads, bool pinThreads)
+    : pending_(0), nextQueue_(0), stop_(false) {
+  if (numThreads <= 0) {
+    numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+  for (int i = 0; i < numThreads; ++i) {
+    queues_.emplace_back(new Queue());
+  }
+  for (int i = 0; i < numThreads; ++i) {
+    workers_.emplace_back(&TaskScheduler::worker, this, i, pinThreads);
+  }
+}
+
+TaskScheduler::~TaskScheduler() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+}
+
+void TaskScheduler::submit(std::function<void()> task) {
+  int index = currentScheduler == this
+      ? currentWorker
+      : static_cast<int>(nextQueue_++ % queues_.size());
+  {
+    std::lock_guard<std::mutex> lock(queues_[index]->mutex);
+    queues_[index]->tasks.push_back(std::move(task));
+  }
+  ++pending_;
+  {
+    // The workers check `pending_` under the lock before waiting
+    std::lock_guard<std::mutex> lock(mutex_);
+  }
+  cv_.notify_one();
+}
+
+void TaskScheduler::parallelFor(
+    int64_t n,
+    const std::function<void(int64_t)>& fn) {
+  if (n <= 0) {
+    return;
+  } else if (n == 1) {
+    fn(0);
+    return;
+  }
+
+  // Shared with the helper tasks, which may start after the loop is done
+  struct Loop {
+    const std::function<void(int64_t)>* fn;
+    int64_t n;
+    std::atomic<int64_t> next{0};
+    std::mutex mutex;
+    std::condition_variable cv;
+    int64_t done = 0;
+    std::exception_ptr error;
+  };
+  auto loop = std::make_shared<Loop>();
+  loop->fn = &fn;
+  loop->n = n;
+  auto run = [loop]() {
+    int64_t ran = 0;
+    std::exception_ptr error;
+    for (int64_t i = loop->next++; i < loop->n; i = loop->next++) {
+      try {
+        (*loop->fn)(i);
+      } catch (...) {
+        error = std::current_exception();
+      }
+      ++ran;
+    }
+    if (ran > 0) {
+      std::lock_guard<std::mutex> lock(loop->mutex);
+      if (error && !loop->error) {
+        loop->error = error;
+      }
+      loop->done += ran;
+      if (loop->done == loop->n) {
+        loop->cv.notify_all();
+      }
+    }
+  };
+
+  int64_t numHelpers = std::min<int64_t>(n - 1, numThreads());
+  for (int64_t i = 0; i < numHelpers; ++i) {
+    submit(run);
+  }
+  run();
+  // The indices left are being run by the helpers which took them
+  std::unique_lock<std::mutex> lock(loop->mutex);
+  loop->cv.wait(lock, [&loop]() { return loop->done == loop->n; });
+  if (loop->error) {
+    std::rethrow_exception(loop->error);
+  }
+}
+
+void TaskScheduler::configure(int numThreads, bool pinThreads) {
+  std::lock_guard<std::mutex> lock(configMutex());
+  if (started) {
+    throw std::logic_error(
+        "[TaskScheduler] configure() called after the scheduler started");
+  }
+  configNumThreads = numThreads;
+  configPinThreads = pinThreads;
+}
+
+TaskScheduler& TaskScheduler::get() {
+  static TaskScheduler* scheduler = []() {
+    std::lock_guard<std::mutex> lock(configMutex());
+    started = true;
+    // Never destroyed: tasks may still be submitted by static destructors
+    return new TaskScheduler(configNumThreads, configPinThreads);
+  }();
+  return *scheduler;
+}
+
+void TaskScheduler::worker(int index, bool pin) {
+  currentScheduler = this;
+  currentWorker = index;
+#ifdef __linux__
+  if (pin) {
+    int numCpus = std::max(std::thread::hardware_concurrency(), 1u);
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(index % numCpus, &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+  }
+#endif
+
+  std::function<void()> task;
+  while (true) {
+    if (pop(index, task)) {
+      task();
+      task = nullptr;
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this]() { return stop_ || pending_ > 0; });
+    if (stop_ && pending_ == 0) {
+      return;
+    }
+  }
+}
+
+bool TaskScheduler::pop(int index, std::function<void()>& task) {
+  int numQueues = queues_.size();
+  for (int i = 0; i < numQueues; ++i) {
+    auto& queue = *queues_[(index + i) % numQueues];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) {
+      continue;
+    }
+    // The newest task of its own queue is the most likely to be in cache
+    if (i == 0) {
+      task = std::move(queue.tasks.back());
+      queue.tasks.pop_back();
+    } else {
+      task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+    }
+    --pending_;
+    return true;
+  }
+  return false;
+}
+
+} // namespace w2l
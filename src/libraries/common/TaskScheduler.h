@@ -0,0 +1,112 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace w2l {
+
+/**
+ * A work-stealing pool of worker threads, on which the parallel CPU work of
+ * the process (featurization, batch loading, ...) is scheduled instead of each
+ * component starting its own threads, so that the process runs as many
+ * threads as its core budget whatever the components running at the same
+ * time.
+ *
+ * Each worker has its own queue: the tasks submitted by a worker go to its
+ * queue, the others are spread round-robin. A worker runs the tasks of its
+ * queue last in first out, and steals the oldest task of another queue when
+ * its own is empty. Tasks may submit tasks and call parallelFor(), but they
+ * should not block on other tasks, except through parallelFor(). All the
+ * methods are thread-safe.
+ */
+class TaskScheduler {
+ public:
+  /**
+   * Starts `numThreads` workers, one per hardware thread if `numThreads` <= 0.
+   * With `pinThreads`, worker i is bound to CPU i modulo the number of CPUs.
+   */
+  TaskScheduler(int numThreads, bool pinThreads);
+
+  /* Runs the tasks left, then stops the workers */
+  ~TaskScheduler();
+
+  TaskScheduler(const TaskScheduler&) = delete;
+  TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+  int numThreads() const {
+    return workers_.size();
+  }
+
+  /* Runs `task` on a worker. `task` should not throw, see async() */
+  void submit(std::function<void()> task);
+
+  /* Runs `fn` on a worker, its result or exception is set in the future */
+  template <typename Fn>
+  std::future<typename std::result_of<Fn()>::type> async(Fn&& fn) {
+    using Result = typename std::result_of<Fn()>::type;
+    auto task = std::make_shared<std::packaged_task<Result()>>(
+        std::forward<Fn>(fn));
+    auto future = task->get_future();
+    submit([task]() { (*task)(); });
+    return future;
+  }
+
+  /**
+   * Calls fn(i) for i in [0, n) on the workers and the calling thread, and
+   * returns once all the calls returned. The indices are handed out one at a
+   * time, so calls of different lengths keep the threads busy. Rethrows the
+   * first exception thrown by `fn`, once all the calls returned.
+   */
+  void parallelFor(int64_t n, const std::function<void(int64_t)>& fn);
+
+  /**
+   * Sets the number of workers and the pinning of the scheduler of the
+   * process. Must be called before its first get(), usually after the flags
+   * are parsed.
+   */
+  static void configure(int numThreads, bool pinThreads);
+
+  /* The scheduler of the process, started by the first call */
+  static TaskScheduler& get();
+
+ private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  std::vector<std::unique_ptr<Queue>> queues_;
+  std::atomic<int64_t> pending_; // tasks queued and not started
+  std::atomic<uint64_t> nextQueue_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stop_;
+
+  std::vector<std::thread> workers_;
+
+  void worker(int index, bool pin);
+
+  /* Pops a task from queue `index` if any, else steals one */
+  bool pop(int index, std::function<void()>& task);
+};
+
+} // namespace w2l
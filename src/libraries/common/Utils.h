@@ -9,6 +9,7 @@
 #pragma once
 
 #include <chrono>
+#include <cstdint>
 #include <cstring>
 #include <string>
 #include <type_traits>
@@ -94,6 +95,20 @@ std::string getCurrentTime();
 
 std::vector<std::string> getFileContent(const std::string& file);
 
+/**
+ * Hex digest of a 64-bit hash of `key`, to name files after it. Unlike
+ * std::hash, it is the same across builds and processes.
+ */
+std::string hashKey(const std::string& key);
+
+/**
+ * IEEE 754 binary16 conversions. floatToHalf() rounds to nearest even,
+ * overflows to infinity and keeps NaNs quiet.
+ */
+uint16_t floatToHalf(float value);
+
+float halfToFloat(uint16_t half);
+
 /**
  * Calls `f(args...)` repeatedly, retrying if an exception is thrown.
  * Supports sleeps between retries, with duration starting at `initial` and
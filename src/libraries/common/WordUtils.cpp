@@ -8,13 +8,71 @@
 
 #include "libraries/common/WordUtils.h"
 
-#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <thread>
 
 #include "libraries/common/Defines.h"
+#include "libraries/common/MemoryMappedFile.h"
 #include "libraries/common/Utils.h"
 
 namespace w2l {
 
+namespace {
+
+// Bytes of the lexicon parsed at least by each thread
+constexpr size_t kLexiconChunkSize = 1 << 20;
+
+using LexiconEntry = std::pair<std::string, std::vector<std::string>>;
+
+bool isSpace(char c) {
+  return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+// Parses the lines of [begin, end), each of which is a word and its spelling,
+// into `entries`, until the first invalid line
+void parseLexicon(
+    const char* begin,
+    const char* end,
+    std::vector<LexiconEntry>& entries) {
+  std::vector<std::string> fields;
+  while (begin < end) {
+    const char* eol =
+        static_cast<const char*>(std::memchr(begin, '\n', end - begin));
+    if (!eol) {
+      eol = end;
+    }
+    fields.clear();
+    for (const char* c = begin; c < eol;) {
+      while (c < eol && isSpace(*c)) {
+        ++c;
+      }
+      const char* token = c;
+      while (c < eol && !isSpace(*c)) {
+        ++c;
+      }
+      if (c > token) {
+        fields.emplace_back(token, c);
+      }
+    }
+    if (fields.size() < 2) {
+      throw std::runtime_error(
+          "[loadWords] Invalid line: " + std::string(begin, eol));
+    }
+    entries.emplace_back(
+        std::move(fields[0]),
+        std::vector<std::string>(
+            std::make_move_iterator(fields.begin() + 1),
+            std::make_move_iterator(fields.end())));
+    begin = eol + 1;
+  }
+}
+
+} // namespace
+
 Dictionary createWordDict(const LexiconMap& lexicon) {
   Dictionary dict;
   for (const auto& it : lexicon) {
@@ -25,34 +83,70 @@ Dictionary createWordDict(const LexiconMap& lexicon) {
 }
 
 LexiconMap loadWords(const std::string& filename, int maxWords) {
-  LexiconMap lexicon;
-
-  std::string line;
-  std::ifstream infile(filename);
-
-  if (!infile) {
+  std::unique_ptr<MemoryMappedFile> file;
+  try {
+    file.reset(new MemoryMappedFile(filename));
+  } catch (const std::runtime_error&) {
     throw std::invalid_argument("Cannot open " + filename);
   }
+  const char* data = file->data();
+  size_t size = file->size();
 
-  // Add at most `maxWords` words into the lexicon.
-  // If `maxWords` is negative then no limit is applied.
-  while (maxWords != lexicon.size() && std::getline(infile, line)) {
-    // Parse the line into two strings: word and spelling.
-    auto fields = splitOnWhitespace(line, true);
-    if (fields.size() < 2) {
-      throw std::runtime_error("[loadWords] Invalid line: " + line);
+  // Parse chunks of whole lines in parallel
+  size_t numThreads = std::min<size_t>(
+      std::max(std::thread::hardware_concurrency(), 1u),
+      size / kLexiconChunkSize + 1);
+  std::vector<size_t> bounds(numThreads + 1, size);
+  bounds[0] = 0;
+  for (size_t i = 1; i < numThreads; ++i) {
+    bounds[i] = std::max(bounds[i - 1], size / numThreads * i);
+    const char* eol = static_cast<const char*>(
+        std::memchr(data + bounds[i], '\n', size - bounds[i]));
+    bounds[i] = eol ? eol - data + 1 : size;
+  }
+  std::vector<std::vector<LexiconEntry>> chunks(numThreads);
+  std::vector<std::exception_ptr> errors(numThreads);
+  auto parse = [&](size_t i) {
+    try {
+      parseLexicon(data + bounds[i], data + bounds[i + 1], chunks[i]);
+    } catch (...) {
+      errors[i] = std::current_exception();
     }
-    const std::string& word = fields[0];
-    std::vector<std::string> spelling(fields.size() - 1);
-    std::copy(fields.begin() + 1, fields.end(), spelling.begin());
+  };
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < numThreads; ++i) {
+    threads.emplace_back(parse, i);
+  }
+  parse(0);
+  for (auto& thread : threads) {
+    thread.join();
+  }
 
-    // Add the word into the dictionary.
-    if (lexicon.find(word) == lexicon.end()) {
-      lexicon[word] = {};
+  LexiconMap lexicon;
+  size_t numLines = 0;
+  for (const auto& chunk : chunks) {
+    numLines += chunk.size();
+  }
+  lexicon.reserve(maxWords >= 0 ? std::min<size_t>(maxWords, numLines)
+                                : numLines);
+  // Add at most `maxWords` words into the lexicon, in the order of the file.
+  // If `maxWords` is negative then no limit is applied.
+  for (size_t i = 0; i < numThreads; ++i) {
+    for (auto& entry : chunks[i]) {
+      if (maxWords == lexicon.size()) {
+        break;
+      }
+      // Add the current spelling of the words to the list of spellings.
+      lexicon[entry.first].push_back(std::move(entry.second));
+    }
+    if (maxWords == lexicon.size()) {
+      break;
+    }
+    // Only the lines before the limit must be valid, as they are the only
+    // ones read
+    if (errors[i]) {
+      std::rethrow_exception(errors[i]);
     }
-
-    // Add the current spelling of the words to the list of spellings.
-    lexicon[word].push_back(spelling);
   }
 
   // Insert unknown word.
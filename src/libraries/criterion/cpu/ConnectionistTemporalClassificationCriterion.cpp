@@ -0,0 +1,258 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "libraries/criterion/cpu/ConnectionistTemporalClassificationCriterion.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "libraries/common/Utils.h"
+#include "libraries/common/Workspace.h"
+#include "libraries/criterion/cpu/CriterionUtils.h"
+#include "libraries/criterion/cpu/LogSumExp.h"
+
+namespace {
+
+template <class Float>
+struct WorkspacePtrs {
+  explicit WorkspacePtrs(void* workspace, int B, int T, int L) {
+    const int S = 2 * L + 1;
+    w2l::Workspace<> ws(workspace);
+    ws.request(&scale, B);
+    ws.request(&alpha, B, T, S);
+    ws.request(&alphaGrad, B, T, S);
+    ws.request(&label, B, S);
+    ws.request(&skip, B, S);
+    ws.request(&targetSize, B);
+    ws.request(&lseMax, B, S);
+    ws.request(&lseExp, B, 3, S);
+    requiredSize = ws.requiredSize();
+  }
+
+  Float* scale;
+  double* alpha;
+  double* alphaGrad;
+  int* label; // class of each state
+  int* skip; // whether the state may be reached from 2 states before
+  int* targetSize; // target size used, which T can fit
+  double* lseMax;
+  double* lseExp;
+  size_t requiredSize;
+};
+
+int countRepeats(const int* target, int L) {
+  int R = 0;
+  for (int i = 1; i < L; ++i) {
+    if (target[i] == target[i - 1]) {
+      ++R;
+    }
+  }
+  return R;
+}
+
+/**
+ * For the states s of [start, end), sets lseMax[s - start] to the largest of
+ * the scores of the (up to 3) states of `alphaPrev` from which s is reached, 0
+ * if they are all -inf, and lseExp[k * n + s - start] to exp(score_k - max),
+ * with n = end - start.
+ */
+void transitionExps(
+    const double* alphaPrev,
+    const int* skip,
+    int start,
+    int end,
+    double* lseMax,
+    double* lseExp) {
+  const int n = end - start;
+#pragma omp simd
+  for (int s = start; s < end; ++s) {
+    double s0 = alphaPrev[s];
+    double s1 = s > 0 ? alphaPrev[s - 1] : -INFINITY;
+    double s2 = skip[s] ? alphaPrev[s - 2] : -INFINITY;
+    double m = std::max(s0, std::max(s1, s2));
+    m = m == -INFINITY ? 0 : m;
+    lseMax[s - start] = m;
+    lseExp[s - start] = s0 - m;
+    lseExp[n + s - start] = s1 - m;
+    lseExp[2 * n + s - start] = s2 - m;
+  }
+  w2l::cpu::expInPlace(lseExp, 3 * n);
+}
+
+} // namespace
+
+namespace w2l {
+namespace cpu {
+
+template <class Float>
+size_t ConnectionistTemporalClassificationCriterion<Float>::getWorkspaceSize(
+    int B,
+    int T,
+    int L) {
+  WorkspacePtrs<Float> dummy(nullptr, B, T, L);
+  return dummy.requiredSize;
+}
+
+template <class Float>
+void ConnectionistTemporalClassificationCriterion<Float>::forward(
+    int B,
+    int T,
+    int N,
+    int _L,
+    CriterionScaleMode scaleMode,
+    const Float* _input,
+    const int* _target,
+    const int* targetSize,
+    Float* loss,
+    void* workspace) {
+  const int _S = 2 * _L + 1;
+  WorkspacePtrs<Float> ws(workspace, B, T, _L);
+  CriterionUtils<Float>::computeScale(B, T, N, scaleMode, targetSize, ws.scale);
+
+  // The samples have different lengths
+#pragma omp parallel for schedule(dynamic) num_threads(getNumThreads())
+  for (int b = 0; b < B; ++b) {
+    const auto* input = &_input[b * T * N];
+    const auto* target = &_target[b * _L];
+    auto* label = &ws.label[b * _S];
+    auto* skip = &ws.skip[b * _S];
+    auto* lseMax = &ws.lseMax[b * _S];
+    auto* lseExp = &ws.lseExp[b * 3 * _S];
+
+    // A heuristic to shorten the target to be able to compute CTC loss: each
+    // repeat needs a blank between the two labels
+    int L = targetSize[b];
+    int R = countRepeats(target, L);
+    L = std::max(std::min(L + R, T) - R, 0);
+    R = countRepeats(target, L);
+    const int S = 2 * L + 1;
+    ws.targetSize[b] = L;
+
+    auto* alpha = &ws.alpha[b * T * _S];
+    std::fill(alpha, alpha + T * S, -INFINITY);
+
+    for (int s = 0; s < S; ++s) {
+      label[s] = (s & 1) ? target[s / 2] : N - 1;
+      skip[s] = (s & 1) && s > 1 && target[s / 2] != target[s / 2 - 1];
+    }
+
+    int start = T - (L + R) > 0 ? 0 : 1;
+    int end = S == 1 ? 1 : 2;
+
+    if (start == 0) {
+      alpha[0] = input[N - 1];
+    }
+    if (S != 1) {
+      alpha[1] = input[target[0]];
+    }
+    for (int t = 1; t < T; ++t) {
+      // At each frame, only the states which can be reached from the first
+      // ones and can reach the last ones are computed
+      if (T - t <= L + R) {
+        if (start & 1 && target[start / 2] != target[start / 2 + 1]) {
+          ++start;
+        }
+        ++start;
+      }
+      if (t <= L + R) {
+        if (end % 2 == 0 && end < 2 * L &&
+            target[end / 2 - 1] != target[end / 2]) {
+          ++end;
+        }
+        ++end;
+      }
+
+      const auto* inputCur = &input[t * N];
+      auto* alphaCur = &alpha[t * S + start];
+      const int n = end - start;
+      transitionExps(&alpha[(t - 1) * S], skip, start, end, lseMax, lseExp);
+      for (int i = 0; i < n; ++i) {
+        alphaCur[i] = lseMax[i] +
+            std::log(lseExp[i] + lseExp[n + i] + lseExp[2 * n + i]) +
+            inputCur[label[start + i]];
+      }
+    }
+
+    const auto* alphaLast = &alpha[(T - 1) * S + (S == 1 ? 0 : S - 2)];
+    std::copy(alphaLast, alphaLast + (S == 1 ? 1 : 2), lseExp);
+    loss[b] = -logSumExp(lseExp, S == 1 ? 1 : 2) * ws.scale[b];
+  }
+}
+
+template <class Float>
+void ConnectionistTemporalClassificationCriterion<Float>::backward(
+    int B,
+    int T,
+    int N,
+    int _L,
+    const Float* grad,
+    Float* _inputGrad,
+    void* workspace) {
+  const int _S = 2 * _L + 1;
+  WorkspacePtrs<Float> ws(workspace, B, T, _L);
+  setZero(_inputGrad, B * T * N);
+
+#pragma omp parallel for schedule(dynamic) num_threads(getNumThreads())
+  for (int b = 0; b < B; ++b) {
+    auto* inputGrad = &_inputGrad[b * T * N];
+    const auto* label = &ws.label[b * _S];
+    const auto* skip = &ws.skip[b * _S];
+    auto* lseMax = &ws.lseMax[b * _S];
+    auto* lseExp = &ws.lseExp[b * 3 * _S];
+    const int S = 2 * ws.targetSize[b] + 1;
+    const auto* alpha = &ws.alpha[b * T * _S];
+    auto* alphaGrad = &ws.alphaGrad[b * T * _S];
+    setZero(alphaGrad, T * S);
+
+    // The gradient of the final log-sum-exp is the softmax of the last states
+    const int last = (T - 1) * S + (S == 1 ? 0 : S - 2);
+    const int nLast = S == 1 ? 1 : 2;
+    std::copy(&alpha[last], &alpha[last] + nLast, lseExp);
+    double sumLast = expSum(lseExp, nLast, maxValue(lseExp, nLast));
+    for (int i = 0; i < nLast && sumLast > 0; ++i) {
+      alphaGrad[last + i] = -lseExp[i] / sumLast;
+    }
+
+    const double gradScale = grad[b] * ws.scale[b];
+    for (int t = T - 1; t >= 0; --t) {
+      auto* alphaGradCur = &alphaGrad[t * S];
+      auto* inputGradCur = &inputGrad[t * N];
+      for (int s = 0; s < S; ++s) {
+        inputGradCur[label[s]] += alphaGradCur[s] * gradScale;
+      }
+      if (t == 0) {
+        break;
+      }
+
+      // Unreachable states have no gradient, so all the states are visited
+      // rather than the ones computed by forward()
+      auto* alphaGradPrev = &alphaGrad[(t - 1) * S];
+      transitionExps(&alpha[(t - 1) * S], skip, 0, S, lseMax, lseExp);
+      for (int s = 0; s < S; ++s) {
+        double sum = lseExp[s] + lseExp[S + s] + lseExp[2 * S + s];
+        if (alphaGradCur[s] == 0 || sum == 0) {
+          continue;
+        }
+        double g = alphaGradCur[s] / sum;
+        alphaGradPrev[s] += lseExp[s] * g;
+        if (s > 0) {
+          alphaGradPrev[s - 1] += lseExp[S + s] * g;
+        }
+        if (skip[s]) {
+          alphaGradPrev[s - 2] += lseExp[2 * S + s] * g;
+        }
+      }
+    }
+  }
+}
+
+template struct ConnectionistTemporalClassificationCriterion<float>;
+template struct ConnectionistTemporalClassificationCriterion<double>;
+
+} // namespace cpu
+} // namespace w2l
@@ -0,0 +1,73 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+#include "libraries/criterion/Defines.h"
+
+namespace w2l {
+namespace cpu {
+
+/// CTC loss, with the blank as the last class. Reference:
+/// https://www.cs.toronto.edu/~graves/icml_2006.pdf
+template <class Float>
+struct ConnectionistTemporalClassificationCriterion {
+  /**
+   * B: batch size
+   * T: input length
+   * L: target size
+   */
+  static size_t getWorkspaceSize(int B, int T, int L);
+
+  /**
+   * B: batch size
+   * T: input length
+   * N: dictionary size, blank included
+   * L: target size
+   * scaleMode: type of size scaling
+   * input: [B][T][N] log-probabilities
+   * target: [B][L] target labels
+   * targetSize: [B] target sizes, shortened if T cannot fit them
+   * loss: [B] (out) negative log-likelihood
+   * workspace: (in/out) internal workspace
+   */
+  static void forward(
+      int B,
+      int T,
+      int N,
+      int L,
+      CriterionScaleMode scaleMode,
+      const Float* input,
+      const int* target,
+      const int* targetSize,
+      Float* loss,
+      void* workspace);
+
+  /**
+   * B: batch size
+   * T: input length
+   * N: dictionary size, blank included
+   * L: target size
+   * grad: [B] gradient w.r.t. loss
+   * inputGrad: [B][T][N] (out) gradient w.r.t. input
+   * workspace: (in/out) internal workspace from forward
+   */
+  static void backward(
+      int B,
+      int T,
+      int N,
+      int L,
+      const Float* grad,
+      Float* inputGrad,
+      void* workspace);
+};
+
+} // namespace cpu
+} // namespace w2l
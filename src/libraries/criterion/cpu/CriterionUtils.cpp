@@ -9,9 +9,18 @@
 #include "libraries/criterion/cpu/CriterionUtils.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <vector>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace {
+std::atomic<int> numCriterionThreads(0);
+} // namespace
+
 namespace w2l {
 namespace cpu {
 
@@ -63,6 +72,22 @@ void CriterionUtils<Float>::computeScale(
   }
 }
 
+void setNumThreads(int numThreads) {
+  numCriterionThreads = numThreads > 0 ? numThreads : 0;
+}
+
+int getNumThreads() {
+  int numThreads = numCriterionThreads;
+  if (numThreads > 0) {
+    return numThreads;
+  }
+#ifdef _OPENMP
+  return omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
+
 template struct CriterionUtils<float>;
 template struct CriterionUtils<double>;
 
@@ -32,5 +32,15 @@ struct CriterionUtils {
       Float* scale);
 };
 
+/**
+ * Sets the number of threads over which the CPU criterions split a batch, the
+ * OpenMP default if `numThreads` <= 0. The samples are scheduled dynamically,
+ * so a batch of samples of different lengths keeps all the threads busy.
+ */
+void setNumThreads(int numThreads);
+
+/* Returns the number of threads over which the CPU criterions split a batch */
+int getNumThreads();
+
 } // namespace cpu
 } // namespace w2l
@@ -0,0 +1,52 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "libraries/criterion/cpu/CtcGreedyPath.h"
+
+#include <algorithm>
+
+#include "libraries/criterion/cpu/CriterionUtils.h"
+#include "libraries/criterion/cpu/LogSumExp.h"
+
+namespace w2l {
+namespace cpu {
+
+template <class Float>
+void CtcGreedyPath<Float>::compute(
+    int B,
+    int T,
+    int N,
+    const Float* _input,
+    int* _path,
+    int* pathSize) {
+  const int blank = N - 1;
+#pragma omp parallel for schedule(dynamic) num_threads(getNumThreads())
+  for (int b = 0; b < B; ++b) {
+    const auto* input = &_input[b * T * N];
+    auto* path = &_path[b * T];
+    int size = 0;
+    int prev = -1;
+    for (int t = 0; t < T; ++t) {
+      Float max;
+      int token = maxIndex(&input[t * N], N, &max);
+      token = token < 0 ? 0 : token;
+      if (token != blank && token != prev) {
+        path[size++] = token;
+      }
+      prev = token;
+    }
+    std::fill(path + size, path + T, -1);
+    pathSize[b] = size;
+  }
+}
+
+template struct CtcGreedyPath<float>;
+template struct CtcGreedyPath<double>;
+
+} // namespace cpu
+} // namespace w2l
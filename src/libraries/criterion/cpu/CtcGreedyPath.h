@@ -0,0 +1,27 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+namespace w2l {
+namespace cpu {
+
+/// Check CUDA header for docs.
+template <class Float>
+struct CtcGreedyPath {
+  static void compute(
+      int B,
+      int T,
+      int N,
+      const Float* input,
+      int* path,
+      int* pathSize);
+};
+
+} // namespace cpu
+} // namespace w2l
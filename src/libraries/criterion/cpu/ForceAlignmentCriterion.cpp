@@ -14,6 +14,7 @@
 #include "libraries/common/Utils.h"
 #include "libraries/common/Workspace.h"
 #include "libraries/criterion/cpu/CriterionUtils.h"
+#include "libraries/criterion/cpu/LogSumExp.h"
 
 namespace {
 
@@ -29,6 +30,8 @@ struct WorkspacePtrs {
     ws.request(&transBuf2, B, L);
     ws.request(&transBufGrad1, B, L);
     ws.request(&transBufGrad2, B, L);
+    ws.request(&lseBuf1, B, L);
+    ws.request(&lseBuf2, B, L);
     requiredSize = ws.requiredSize();
   }
 
@@ -40,6 +43,8 @@ struct WorkspacePtrs {
   Float* transBuf2;
   Float* transBufGrad1;
   Float* transBufGrad2;
+  double* lseBuf1;
+  double* lseBuf2;
   size_t requiredSize;
 };
 
@@ -71,13 +76,16 @@ void ForceAlignmentCriterion<Float>::forward(
   WorkspacePtrs<Float> ws(workspace, B, T, N, _L);
   CriterionUtils<Float>::computeScale(B, T, N, scaleMode, targetSize, ws.scale);
 
-#pragma omp parallel for num_threads(B)
+  // The samples have different lengths
+#pragma omp parallel for schedule(dynamic) num_threads(getNumThreads())
   for (int b = 0; b < B; ++b) {
     auto* alpha = &ws.alpha[b * T * _L];
     auto* input = &_input[b * T * N];
     auto* target = &_target[b * _L];
     auto* transBuf1 = &ws.transBuf1[b * _L];
     auto* transBuf2 = &ws.transBuf2[b * _L];
+    auto* lseMax = &ws.lseBuf1[b * _L];
+    auto* lseExp = &ws.lseBuf2[b * _L];
     int L = targetSize[b];
 
     alpha[0] = input[target[0]];
@@ -104,13 +112,18 @@ void ForceAlignmentCriterion<Float>::forward(
             alphaPrev[high - 1] + transBuf2[high] + inputCur[target[high]];
       }
 
+      // lse = logSumExp(s1, s2) = max + log1p(exp(min - max)), computed by
+      // vectorized loops over the tokens
+#pragma omp simd
       for (int i = low; i < high; ++i) {
         double s1 = alphaPrev[i] + transBuf1[i];
         double s2 = alphaPrev[i - 1] + transBuf2[i];
-        // lse = logSumExp(s1, s2)
-        double lse =
-            s1 < s2 ? s2 + log1p(exp(s1 - s2)) : s1 + log1p(exp(s2 - s1));
-        alphaCur[i] = lse + inputCur[target[i]];
+        lseMax[i] = std::max(s1, s2);
+        lseExp[i] = std::min(s1, s2) - lseMax[i];
+      }
+      expInPlace(lseExp + low, high - low);
+      for (int i = low; i < high; ++i) {
+        alphaCur[i] = lseMax[i] + std::log1p(lseExp[i]) + inputCur[target[i]];
       }
     }
 
@@ -131,14 +144,9 @@ void ForceAlignmentCriterion<Float>::backward(
     Float* transGrad,
     void* workspace) {
   WorkspacePtrs<Float> ws(workspace, B, T, N, _L);
-  setZero(_inputGrad, B * T * N);
   setZero(transGrad, N * N);
-  setZero(ws.alphaGrad, B * T * _L);
-  setZero(ws.transBatchGrad, B * N * N);
-  setZero(ws.transBufGrad1, B * _L);
-  setZero(ws.transBufGrad2, B * _L);
 
-#pragma omp parallel for num_threads(B)
+#pragma omp parallel for schedule(dynamic) num_threads(getNumThreads())
   for (int b = 0; b < B; ++b) {
     auto* alpha = &ws.alpha[b * T * _L];
     auto* alphaGrad = &ws.alphaGrad[b * T * _L];
@@ -149,8 +157,17 @@ void ForceAlignmentCriterion<Float>::backward(
     auto* transBuf2 = &ws.transBuf2[b * _L];
     auto* transBufGrad1 = &ws.transBufGrad1[b * _L];
     auto* transBufGrad2 = &ws.transBufGrad2[b * _L];
+    auto* lseGrad1 = &ws.lseBuf1[b * _L];
+    auto* lseGrad2 = &ws.lseBuf2[b * _L];
     int L = targetSize[b];
 
+    // Each thread clears the buffers of its samples
+    setZero(inputGrad, T * N);
+    setZero(alphaGrad, T * _L);
+    setZero(transBatchGrad, N * N);
+    setZero(transBufGrad1, _L);
+    setZero(transBufGrad2, _L);
+
     alphaGrad[T * L - 1] = 1;
 
     for (int t = T - 1; t > 0; --t) {
@@ -179,22 +196,32 @@ void ForceAlignmentCriterion<Float>::backward(
         transBufGrad2[high] += alphaCurGrad[high];
       }
 
+      // d1, d2 = dLogSumExp(s1, s2): the larger term gets
+      // 1 / (1 + exp(min - max)) and the other one the rest
+#pragma omp simd
       for (int i = low; i < high; ++i) {
         double s1 = alphaPrev[i] + transBuf1[i];
         double s2 = alphaPrev[i - 1] + transBuf2[i];
-        // d1, d2 = dLogSumExp(s1, s2)
-        double d1, d2;
-        if (s1 < s2) {
-          d2 = 1 / (1 + exp(s1 - s2));
-          d1 = 1 - d2;
-        } else {
-          d1 = 1 / (1 + exp(s2 - s1));
-          d2 = 1 - d1;
-        }
-        alphaPrevGrad[i] += d1 * alphaCurGrad[i];
-        alphaPrevGrad[i - 1] += d2 * alphaCurGrad[i];
-        transBufGrad1[i] += d1 * alphaCurGrad[i];
-        transBufGrad2[i] += d2 * alphaCurGrad[i];
+        lseGrad1[i] = std::min(s1, s2) - std::max(s1, s2);
+      }
+      expInPlace(lseGrad1 + low, high - low);
+#pragma omp simd
+      for (int i = low; i < high; ++i) {
+        double s1 = alphaPrev[i] + transBuf1[i];
+        double s2 = alphaPrev[i - 1] + transBuf2[i];
+        double dMax = 1 / (1 + lseGrad1[i]);
+        double dMin = 1 - dMax;
+        double d1 = s1 < s2 ? dMin : dMax;
+        double d2 = s1 < s2 ? dMax : dMin;
+        lseGrad1[i] = d1 * alphaCurGrad[i];
+        lseGrad2[i] = d2 * alphaCurGrad[i];
+        alphaPrevGrad[i] += lseGrad1[i];
+        transBufGrad1[i] += lseGrad1[i];
+        transBufGrad2[i] += lseGrad2[i];
+      }
+#pragma omp simd
+      for (int i = low; i < high; ++i) {
+        alphaPrevGrad[i - 1] += lseGrad2[i];
       }
     }
 
@@ -212,11 +239,10 @@ void ForceAlignmentCriterion<Float>::backward(
     }
   }
 
-  for (int b = 0; b < B; ++b) {
-    auto transBatchGrad = ws.transBatchGrad + b * N * N;
-    auto gradScale = grad[b] * ws.scale[b];
-    for (int i = 0; i < N * N; ++i) {
-      transGrad[i] += gradScale * transBatchGrad[i];
+#pragma omp parallel for if (N * N >= 4096)
+  for (int i = 0; i < N * N; ++i) {
+    for (int b = 0; b < B; ++b) {
+      transGrad[i] += grad[b] * ws.scale[b] * ws.transBatchGrad[b * N * N + i];
     }
   }
 }
@@ -0,0 +1,169 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "libraries/criterion/cpu/ForcedAlignmentPath.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+#include "libraries/common/Workspace.h"
+#include "libraries/criterion/cpu/CriterionUtils.h"
+
+namespace {
+
+template <class Float>
+struct WorkspacePtrs {
+  explicit WorkspacePtrs(void* workspace, int B, int T, int L) {
+    const int S = 2 * L + 1;
+    w2l::Workspace<> ws(workspace);
+    ws.request(&alpha, B, 2, S);
+    ws.request(&beta, B, T, S);
+    ws.request(&label, B, S);
+    requiredSize = ws.requiredSize();
+  }
+
+  Float* alpha;
+  uint8_t* beta; // states to go back by from each state: 0, 1 or 2
+  int* label; // class of each state
+  size_t requiredSize;
+};
+
+int countRepeats(const int* target, int L) {
+  int R = 0;
+  for (int i = 1; i < L; ++i) {
+    if (target[i] == target[i - 1]) {
+      ++R;
+    }
+  }
+  return R;
+}
+
+/*
+ * Fills the class of each state of the alignment of `target` in T frames, and
+ * returns the number of states: the labels for ASG, and for CTC the labels
+ * between blanks, the target being shortened as in CTC loss
+ */
+int computeLabels(
+    bool ctc,
+    int T,
+    int N,
+    const int* target,
+    int targetSize,
+    int* label) {
+  if (!ctc) {
+    int L = std::max(std::min(targetSize, T), 0);
+    std::copy(target, target + L, label);
+    return L;
+  }
+  int R = countRepeats(target, targetSize);
+  int L = std::max(std::min(targetSize + R, T) - R, 0);
+  int S = 2 * L + 1;
+  for (int s = 0; s < S; ++s) {
+    label[s] = (s & 1) ? target[s / 2] : N - 1;
+  }
+  return S;
+}
+
+} // namespace
+
+namespace w2l {
+namespace cpu {
+
+template <class Float>
+size_t ForcedAlignmentPath<Float>::getWorkspaceSize(int B, int T, int L) {
+  return WorkspacePtrs<Float>(nullptr, B, T, L).requiredSize;
+}
+
+template <class Float>
+void ForcedAlignmentPath<Float>::compute(
+    int B,
+    int T,
+    int N,
+    int _L,
+    const Float* _input,
+    const int* inputSize,
+    const int* _target,
+    const int* targetSize,
+    const Float* trans,
+    int* _path,
+    void* workspace) {
+  WorkspacePtrs<Float> ws(workspace, B, T, _L);
+  const int _S = 2 * _L + 1;
+  const bool ctc = trans == nullptr;
+
+#pragma omp parallel for schedule(dynamic) num_threads(getNumThreads())
+  for (int b = 0; b < B; ++b) {
+    const auto* input = &_input[b * T * N];
+    const auto* target = &_target[b * _L];
+    auto* path = &_path[b * T];
+    auto* alpha = &ws.alpha[b * 2 * _S];
+    auto* beta = &ws.beta[b * T * _S];
+    auto* label = &ws.label[b * _S];
+
+    std::fill(path, path + T, -1);
+    int sampleT = inputSize ? std::max(std::min(inputSize[b], T), 0) : T;
+    int S = computeLabels(ctc, sampleT, N, target, targetSize[b], label);
+    if (sampleT == 0 || S == 0) {
+      continue;
+    }
+
+    std::fill(alpha, alpha + S, -std::numeric_limits<Float>::infinity());
+    alpha[0] = input[label[0]];
+    if (ctc && S > 1) {
+      alpha[1] = input[label[1]];
+    }
+
+    for (int t = 1; t < sampleT; ++t) {
+      const auto* alphaPrev = &alpha[((t - 1) % 2) * _S];
+      const auto* inputCur = &input[t * N];
+      auto* alphaCur = &alpha[(t % 2) * _S];
+      auto* betaCur = &beta[t * _S];
+      for (int s = 0; s < S; ++s) {
+        const int m = label[s];
+        Float best = alphaPrev[s] + (ctc ? 0 : trans[m * N + m]);
+        int k = 0;
+        if (s > 0) {
+          Float move =
+              alphaPrev[s - 1] + (ctc ? 0 : trans[m * N + label[s - 1]]);
+          if (move > best) {
+            best = move;
+            k = 1;
+          }
+        }
+        if (ctc && s > 1 && m != N - 1 && m != label[s - 2] &&
+            alphaPrev[s - 2] > best) {
+          best = alphaPrev[s - 2];
+          k = 2;
+        }
+        alphaCur[s] = best + inputCur[m];
+        betaCur[s] = k;
+      }
+    }
+
+    // CTC may end on the last label or on the blank after it
+    const auto* alphaLast = &alpha[((sampleT - 1) % 2) * _S];
+    int s = S - 1;
+    if (ctc && S > 1 && alphaLast[S - 2] > alphaLast[S - 1]) {
+      s = S - 2;
+    }
+    for (int t = sampleT - 1; t >= 0; --t) {
+      path[t] = label[s];
+      if (t > 0) {
+        s -= beta[t * _S + s];
+      }
+    }
+  }
+}
+
+template struct ForcedAlignmentPath<float>;
+template struct ForcedAlignmentPath<double>;
+
+} // namespace cpu
+} // namespace w2l
@@ -0,0 +1,36 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+namespace w2l {
+namespace cpu {
+
+/// Check CUDA header for docs.
+template <class Float>
+struct ForcedAlignmentPath {
+  static size_t getWorkspaceSize(int B, int T, int L);
+
+  static void compute(
+      int B,
+      int T,
+      int N,
+      int L,
+      const Float* input,
+      const int* inputSize,
+      const int* target,
+      const int* targetSize,
+      const Float* trans,
+      int* path,
+      void* workspace);
+};
+
+} // namespace cpu
+} // namespace w2l
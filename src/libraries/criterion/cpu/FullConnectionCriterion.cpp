@@ -8,11 +8,13 @@
 
 #include "libraries/criterion/cpu/FullConnectionCriterion.h"
 
+#include <algorithm>
 #include <cmath>
 
 #include "libraries/common/Utils.h"
 #include "libraries/common/Workspace.h"
 #include "libraries/criterion/cpu/CriterionUtils.h"
+#include "libraries/criterion/cpu/LogSumExp.h"
 
 namespace {
 
@@ -36,6 +38,23 @@ struct WorkspacePtrs {
   size_t requiredSize;
 };
 
+// out[n] = alphaPrev[n] + trans[n], or alphaPrev[n] if trans is null
+template <class Float>
+void addTransitions(
+    const double* alphaPrev,
+    const Float* trans,
+    int N,
+    double* out) {
+  if (trans) {
+#pragma omp simd
+    for (int n = 0; n < N; ++n) {
+      out[n] = alphaPrev[n] + trans[n];
+    }
+  } else {
+    std::copy(alphaPrev, alphaPrev + N, out);
+  }
+}
+
 } // namespace
 
 namespace w2l {
@@ -60,7 +79,7 @@ void FullConnectionCriterion<Float>::forward(
   WorkspacePtrs<Float> ws(workspace, B, T, N);
   CriterionUtils<Float>::computeScale(B, T, N, scaleMode, targetSize, ws.scale);
 
-#pragma omp parallel for num_threads(B)
+#pragma omp parallel for schedule(dynamic) num_threads(getNumThreads())
   for (int b = 0; b < B; ++b) {
     for (int n = 0; n < N; ++n) {
       int k = b * T * N + n;
@@ -74,24 +93,16 @@ void FullConnectionCriterion<Float>::forward(
         auto* transBuf = &ws.transBuf[b * N * N + m * N];
         auto* alphaCur = &ws.alpha[b * T * N + t * N];
 
-        double maxValue = -INFINITY;
-        for (int n = 0; n < N; ++n) {
-          double val = transBuf[n] =
-              alphaPrev[n] + (t == T ? 0 : trans[m * N + n]);
-          maxValue = val > maxValue ? val : maxValue;
-        }
-
-        double sumValue = 0;
-        for (int n = 0; n < N; ++n) {
-          sumValue += exp(transBuf[n] - maxValue);
-        }
+        const auto* transCur = t == T ? nullptr : &trans[m * N];
+        addTransitions(alphaPrev, transCur, N, transBuf);
+        double lse = logSumExp(transBuf, N);
 
         if (t == T) {
-          loss[b] = ws.scale[b] * (log(sumValue) + maxValue);
+          loss[b] = ws.scale[b] * lse;
           break;
         }
 
-        alphaCur[m] = log(sumValue) + maxValue + inputCur[m];
+        alphaCur[m] = lse + inputCur[m];
       }
     }
   }
@@ -113,7 +124,7 @@ void FullConnectionCriterion<Float>::backward(
   setZero(ws.alphaGrad, B * T * N);
   setZero(ws.transBatchGrad, B * N * N);
 
-#pragma omp parallel for num_threads(B)
+#pragma omp parallel for schedule(dynamic) num_threads(getNumThreads())
   for (int b = 0; b < B; ++b) {
     for (int t = T; t > 0; --t) {
       for (int m = 0; m < N; ++m) {
@@ -123,18 +134,9 @@ void FullConnectionCriterion<Float>::backward(
         auto* transBuf = &ws.transBuf[b * N * N + m * N];
         auto* transBatchGrad = &ws.transBatchGrad[b * N * N + m * N];
 
-        double maxValue = -INFINITY;
-        for (int n = 0; n < N; ++n) {
-          double val = transBuf[n] =
-              alphaPrev[n] + (t == T ? 0 : trans[m * N + n]);
-          maxValue = val > maxValue ? val : maxValue;
-        }
-
-        double sumValue = 0;
-        for (int n = 0; n < N; ++n) {
-          transBuf[n] = exp(transBuf[n] - maxValue);
-          sumValue += transBuf[n];
-        }
+        const auto* transCur = t == T ? nullptr : &trans[m * N];
+        addTransitions(alphaPrev, transCur, N, transBuf);
+        double sumValue = expSum(transBuf, N, maxValue(transBuf, N));
 
         if (t == T) {
           for (int n = 0; n < N; ++n) {
@@ -0,0 +1,190 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "libraries/criterion/cpu/LogSumExp.h"
+
+#include <algorithm>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define W2L_CRITERION_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace {
+
+constexpr double kLog2e = 1.4426950408889634;
+constexpr double kLn2Hi = 6.93147180369123816490e-01;
+constexpr double kLn2Lo = 1.90821492927058770002e-10;
+// Adding 1.5 * 2^52 rounds to an integer, held by the low mantissa bits
+constexpr double kRound = 6755399441055744.0;
+constexpr double kMinExp = -708.0;
+constexpr double kMaxExp = 709.0;
+// Taylor series of exp(r) up to r^12 / 12!, from the highest degree
+constexpr int kNumCoefficients = 13;
+constexpr double kCoefficients[kNumCoefficients] = {1.0 / 479001600.0,
+                                                    1.0 / 39916800.0,
+                                                    1.0 / 3628800.0,
+                                                    1.0 / 362880.0,
+                                                    1.0 / 40320.0,
+                                                    1.0 / 5040.0,
+                                                    1.0 / 720.0,
+                                                    1.0 / 120.0,
+                                                    1.0 / 24.0,
+                                                    1.0 / 6.0,
+                                                    0.5,
+                                                    1.0,
+                                                    1.0};
+
+double expSumDefault(double* values, int n, double shift) {
+  double sum = 0;
+  for (int i = 0; i < n; ++i) {
+    values[i] = std::exp(values[i] - shift);
+    sum += values[i];
+  }
+  return sum;
+}
+
+#ifdef W2L_CRITERION_X86_KERNELS
+/**
+ * exp(x) within 3 ulp, from exp(x) = 2^k exp(r) with r = x - k ln(2) in
+ * [-ln(2)/2, ln(2)/2] and a polynomial for exp(r). Returns 0 below -708
+ * (instead of subnormals), inf above 709 and NaN for NaN, as 2^k isn't a
+ * normal double outside of [-708, 709].
+ */
+__attribute__((target("avx2,fma"))) inline __m256d polynomialExp(__m256d x) {
+  __m256d shifted =
+      _mm256_fmadd_pd(x, _mm256_set1_pd(kLog2e), _mm256_set1_pd(kRound));
+  __m256d k = _mm256_sub_pd(shifted, _mm256_set1_pd(kRound));
+  __m256d r = _mm256_fnmadd_pd(k, _mm256_set1_pd(kLn2Hi), x);
+  r = _mm256_fnmadd_pd(k, _mm256_set1_pd(kLn2Lo), r);
+
+  __m256d p = _mm256_set1_pd(kCoefficients[0]);
+  for (int i = 1; i < kNumCoefficients; ++i) {
+    p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(kCoefficients[i]));
+  }
+
+  // 2^k, from the biased exponent k + 1023
+  __m256i bits = _mm256_add_epi64(
+      _mm256_castpd_si256(shifted), _mm256_set1_epi64x(1023));
+  __m256d scale = _mm256_castsi256_pd(_mm256_slli_epi64(bits, 52));
+
+  __m256d y = _mm256_mul_pd(p, scale);
+  y = _mm256_blendv_pd(
+      y,
+      _mm256_setzero_pd(),
+      _mm256_cmp_pd(x, _mm256_set1_pd(kMinExp), _CMP_LT_OQ));
+  y = _mm256_blendv_pd(
+      y,
+      _mm256_set1_pd(INFINITY),
+      _mm256_cmp_pd(x, _mm256_set1_pd(kMaxExp), _CMP_GT_OQ));
+  return _mm256_blendv_pd(y, x, _mm256_cmp_pd(x, x, _CMP_UNORD_Q));
+}
+
+__attribute__((target("avx512f"))) inline __m512d polynomialExp(__m512d x) {
+  __m512d shifted =
+      _mm512_fmadd_pd(x, _mm512_set1_pd(kLog2e), _mm512_set1_pd(kRound));
+  __m512d k = _mm512_sub_pd(shifted, _mm512_set1_pd(kRound));
+  __m512d r = _mm512_fnmadd_pd(k, _mm512_set1_pd(kLn2Hi), x);
+  r = _mm512_fnmadd_pd(k, _mm512_set1_pd(kLn2Lo), r);
+
+  __m512d p = _mm512_set1_pd(kCoefficients[0]);
+  for (int i = 1; i < kNumCoefficients; ++i) {
+    p = _mm512_fmadd_pd(p, r, _mm512_set1_pd(kCoefficients[i]));
+  }
+
+  __m512i bits = _mm512_add_epi64(
+      _mm512_castpd_si512(shifted), _mm512_set1_epi64(1023));
+  __m512d scale = _mm512_castsi512_pd(_mm512_slli_epi64(bits, 52));
+
+  __m512d y = _mm512_mul_pd(p, scale);
+  y = _mm512_mask_blend_pd(
+      _mm512_cmp_pd_mask(x, _mm512_set1_pd(kMinExp), _CMP_LT_OQ),
+      y,
+      _mm512_setzero_pd());
+  y = _mm512_mask_blend_pd(
+      _mm512_cmp_pd_mask(x, _mm512_set1_pd(kMaxExp), _CMP_GT_OQ),
+      y,
+      _mm512_set1_pd(INFINITY));
+  return _mm512_mask_blend_pd(_mm512_cmp_pd_mask(x, x, _CMP_UNORD_Q), y, x);
+}
+
+__attribute__((target("avx2,fma"))) double
+expSumAvx2(double* values, int n, double shift) {
+  __m256d sum = _mm256_setzero_pd();
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256d x =
+        _mm256_sub_pd(_mm256_loadu_pd(values + i), _mm256_set1_pd(shift));
+    __m256d y = polynomialExp(x);
+    _mm256_storeu_pd(values + i, y);
+    sum = _mm256_add_pd(sum, y);
+  }
+  double lanes[4];
+  _mm256_storeu_pd(lanes, sum);
+  double result = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+  if (i < n) {
+    // The last values, through a zero-padded vector
+    double tail[4] = {0, 0, 0, 0};
+    std::copy(values + i, values + n, tail);
+    __m256d x = _mm256_sub_pd(_mm256_loadu_pd(tail), _mm256_set1_pd(shift));
+    __m256d y = polynomialExp(x);
+    _mm256_storeu_pd(tail, y);
+    for (int j = 0; i + j < n; ++j) {
+      values[i + j] = tail[j];
+      result += tail[j];
+    }
+  }
+  return result;
+}
+
+__attribute__((target("avx512f"))) double
+expSumAvx512(double* values, int n, double shift) {
+  __m512d sum = _mm512_setzero_pd();
+  for (int i = 0; i < n; i += 8) {
+    __mmask8 mask = n - i >= 8 ? 0xFF : (1 << (n - i)) - 1;
+    __m512d x = _mm512_sub_pd(
+        _mm512_maskz_loadu_pd(mask, values + i), _mm512_set1_pd(shift));
+    __m512d y = _mm512_maskz_mov_pd(mask, polynomialExp(x));
+    _mm512_mask_storeu_pd(values + i, mask, y);
+    sum = _mm512_add_pd(sum, y);
+  }
+  return _mm512_reduce_add_pd(sum);
+}
+#endif
+
+using ExpSumKernel = double (*)(double*, int, double);
+
+ExpSumKernel selectExpSum() {
+#ifdef W2L_CRITERION_X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    return expSumAvx512;
+  }
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return expSumAvx2;
+  }
+#endif
+  return expSumDefault;
+}
+
+} // namespace
+
+namespace w2l {
+namespace cpu {
+
+double expSum(double* values, int n, double shift) {
+  static const ExpSumKernel kernel = selectExpSum();
+  return kernel(values, n, shift);
+}
+
+void expInPlace(double* values, int n) {
+  expSum(values, n, 0.0);
+}
+
+} // namespace cpu
+} // namespace w2l
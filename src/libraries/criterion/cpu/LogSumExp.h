@@ -0,0 +1,69 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cmath>
+
+namespace w2l {
+namespace cpu {
+
+/**
+ * Reductions and exponentials over the classes or tokens of a frame, shared by
+ * the CPU criterions. The reductions are loops which the compiler vectorizes.
+ * The exponentials are computed with a polynomial, in kernels compiled for
+ * AVX2 and AVX-512 and picked at run time on x86-64, and by std::exp on other
+ * CPUs, for which libm is faster than the polynomial on narrow vectors.
+ */
+
+/* Returns the largest of `values`, -inf if n = 0 */
+template <class Float>
+inline Float maxValue(const Float* values, int n) {
+  Float result = -INFINITY;
+#pragma omp simd reduction(max : result)
+  for (int i = 0; i < n; ++i) {
+    result = values[i] > result ? values[i] : result;
+  }
+  return result;
+}
+
+/**
+ * Returns the index of the first largest of `values`, ignoring NaN, and sets
+ * `max` to it. Returns -1 if n = 0 or all the values are -inf or NaN.
+ */
+template <class Float>
+inline int maxIndex(const Float* values, int n, Float* max) {
+  *max = maxValue(values, n);
+  if (*max == -INFINITY) {
+    return -1;
+  }
+  for (int i = 0; i < n; ++i) {
+    if (values[i] == *max) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/* Sets values[i] = exp(values[i] - shift) and returns their sum */
+double expSum(double* values, int n, double shift);
+
+/* Sets values[i] = exp(values[i]) */
+void expInPlace(double* values, int n);
+
+/**
+ * Returns log(sum(exp(values))), computed as max + log(sum(exp(values - max))),
+ * and sets values[i] = exp(values[i] - max)
+ */
+inline double logSumExp(double* values, int n) {
+  double max = maxValue(values, n);
+  return std::log(expSum(values, n, max)) + max;
+}
+
+} // namespace cpu
+} // namespace w2l
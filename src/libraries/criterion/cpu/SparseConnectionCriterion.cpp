@@ -0,0 +1,176 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "libraries/criterion/cpu/SparseConnectionCriterion.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "libraries/common/Utils.h"
+#include "libraries/common/Workspace.h"
+#include "libraries/criterion/cpu/CriterionUtils.h"
+#include "libraries/criterion/cpu/LogSumExp.h"
+
+namespace {
+
+template <class Float>
+struct WorkspacePtrs {
+  explicit WorkspacePtrs(void* workspace, int B, int T, int N, int K) {
+    w2l::Workspace<> ws(workspace);
+    ws.request(&scale, B);
+    ws.request(&alpha, B, T, N);
+    ws.request(&alphaGrad, B, T, N);
+    ws.request(&transBatchGrad, B, N, K);
+    ws.request(&transBuf, B, std::max(N, K));
+    requiredSize = ws.requiredSize();
+  }
+
+  Float* scale;
+  double* alpha;
+  double* alphaGrad;
+  double* transBatchGrad;
+  double* transBuf;
+  size_t requiredSize;
+};
+
+// out[k] = alphaPrev[transIndex[k]] + trans[k]
+template <class Float>
+void gatherTransitions(
+    const double* alphaPrev,
+    const int* transIndex,
+    const Float* trans,
+    int K,
+    double* out) {
+#pragma omp simd
+  for (int k = 0; k < K; ++k) {
+    out[k] = alphaPrev[transIndex[k]] + trans[k];
+  }
+}
+
+} // namespace
+
+namespace w2l {
+namespace cpu {
+
+template <class Float>
+size_t
+SparseConnectionCriterion<Float>::getWorkspaceSize(int B, int T, int N, int K) {
+  return WorkspacePtrs<Float>(nullptr, B, T, N, K).requiredSize;
+}
+
+template <class Float>
+void SparseConnectionCriterion<Float>::forward(
+    int B,
+    int T,
+    int N,
+    int K,
+    CriterionScaleMode scaleMode,
+    const Float* input,
+    const int* targetSize,
+    const int* transIndex,
+    const Float* trans,
+    Float* loss,
+    void* workspace) {
+  WorkspacePtrs<Float> ws(workspace, B, T, N, K);
+  CriterionUtils<Float>::computeScale(B, T, N, scaleMode, targetSize, ws.scale);
+
+#pragma omp parallel for schedule(dynamic) num_threads(getNumThreads())
+  for (int b = 0; b < B; ++b) {
+    auto* alpha = &ws.alpha[b * T * N];
+    auto* transBuf = &ws.transBuf[b * std::max(N, K)];
+
+    std::copy(&input[b * T * N], &input[b * T * N] + N, alpha);
+
+    for (int t = 1; t < T; ++t) {
+      const auto* alphaPrev = &alpha[(t - 1) * N];
+      const auto* inputCur = &input[b * T * N + t * N];
+      auto* alphaCur = &alpha[t * N];
+
+      for (int m = 0; m < N; ++m) {
+        gatherTransitions(
+            alphaPrev, &transIndex[m * K], &trans[m * K], K, transBuf);
+        alphaCur[m] = logSumExp(transBuf, K) + inputCur[m];
+      }
+    }
+
+    const auto* alphaLast = &alpha[(T - 1) * N];
+    std::copy(alphaLast, alphaLast + N, transBuf);
+    loss[b] = ws.scale[b] * logSumExp(transBuf, N);
+  }
+}
+
+template <class Float>
+void SparseConnectionCriterion<Float>::backward(
+    int B,
+    int T,
+    int N,
+    int K,
+    const int* transIndex,
+    const Float* trans,
+    const Float* grad,
+    Float* _inputGrad,
+    Float* transGrad,
+    void* workspace) {
+  WorkspacePtrs<Float> ws(workspace, B, T, N, K);
+  setZero(transGrad, N * K);
+  setZero(ws.alphaGrad, B * T * N);
+  setZero(ws.transBatchGrad, B * N * K);
+
+#pragma omp parallel for schedule(dynamic) num_threads(getNumThreads())
+  for (int b = 0; b < B; ++b) {
+    const auto* alpha = &ws.alpha[b * T * N];
+    auto* alphaGrad = &ws.alphaGrad[b * T * N];
+    auto* transBatchGrad = &ws.transBatchGrad[b * N * K];
+    auto* transBuf = &ws.transBuf[b * std::max(N, K)];
+
+    // The gradient of the final log-sum-exp is the softmax of the last frame
+    const auto* alphaLast = &alpha[(T - 1) * N];
+    std::copy(alphaLast, alphaLast + N, transBuf);
+    double sumValue = expSum(transBuf, N, maxValue(transBuf, N));
+    for (int n = 0; n < N; ++n) {
+      alphaGrad[(T - 1) * N + n] = transBuf[n] / sumValue;
+    }
+
+    for (int t = T - 1; t > 0; --t) {
+      const auto* alphaPrev = &alpha[(t - 1) * N];
+      const auto* alphaCurGrad = &alphaGrad[t * N];
+      auto* alphaPrevGrad = &alphaGrad[(t - 1) * N];
+
+      for (int m = 0; m < N; ++m) {
+        const auto* transIndexCur = &transIndex[m * K];
+        gatherTransitions(alphaPrev, transIndexCur, &trans[m * K], K, transBuf);
+        sumValue = expSum(transBuf, K, maxValue(transBuf, K));
+
+        for (int k = 0; k < K; ++k) {
+          double val = transBuf[k] / sumValue * alphaCurGrad[m];
+          transBatchGrad[m * K + k] += val;
+          alphaPrevGrad[transIndexCur[k]] += val;
+        }
+      }
+    }
+
+    auto* inputGrad = &_inputGrad[b * T * N];
+    for (int i = 0; i < T * N; ++i) {
+      inputGrad[i] = ws.scale[b] * grad[b] * alphaGrad[i];
+    }
+  }
+
+  for (int b = 0; b < B; ++b) {
+    const auto* transBatchGrad = &ws.transBatchGrad[b * N * K];
+
+    for (int i = 0; i < N * K; ++i) {
+      transGrad[i] += ws.scale[b] * grad[b] * transBatchGrad[i];
+    }
+  }
+}
+
+template struct SparseConnectionCriterion<float>;
+template struct SparseConnectionCriterion<double>;
+
+} // namespace cpu
+} // namespace w2l
@@ -0,0 +1,50 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+#include "libraries/criterion/Defines.h"
+
+namespace w2l {
+namespace cpu {
+
+/// Check CUDA header for docs.
+template <class Float>
+struct SparseConnectionCriterion {
+  static size_t getWorkspaceSize(int B, int T, int N, int K);
+
+  static void forward(
+      int B,
+      int T,
+      int N,
+      int K,
+      CriterionScaleMode scaleMode,
+      const Float* input,
+      const int* targetSize,
+      const int* transIndex,
+      const Float* trans,
+      Float* loss,
+      void* workspace);
+
+  static void backward(
+      int B,
+      int T,
+      int N,
+      int K,
+      const int* transIndex,
+      const Float* trans,
+      const Float* grad,
+      Float* inputGrad,
+      Float* transGrad,
+      void* workspace);
+};
+
+} // namespace cpu
+} // namespace w2l
@@ -8,9 +8,12 @@
 
 #include "libraries/criterion/cpu/ViterbiPath.h"
 
+#include <algorithm>
 #include <cmath>
 
 #include "libraries/common/Workspace.h"
+#include "libraries/criterion/cpu/CriterionUtils.h"
+#include "libraries/criterion/cpu/LogSumExp.h"
 
 namespace {
 
@@ -20,11 +23,13 @@ struct WorkspacePtrs {
     w2l::Workspace<> ws(workspace);
     ws.request(&alpha, B, 2, N);
     ws.request(&beta, B, T, N);
+    ws.request(&transT, N, N);
     requiredSize = ws.requiredSize();
   }
 
   Float* alpha;
   int* beta;
+  Float* transT; // transitions from each class, transposed from `trans`
   size_t requiredSize;
 };
 
@@ -48,42 +53,57 @@ void ViterbiPath<Float>::compute(
     int* _path,
     void* workspace) {
   WorkspacePtrs<Float> ws(workspace, B, T, N);
+  if (T <= 0) {
+    return;
+  }
 
-#pragma omp parallel for num_threads(B)
+  // The max-plus product of a frame runs over the previous classes n, each
+  // updating the best score of all the classes m at once: the transitions
+  // from n to all the classes have to be contiguous
+  for (int m = 0; m < N; ++m) {
+    for (int n = 0; n < N; ++n) {
+      ws.transT[n * N + m] = trans[m * N + n];
+    }
+  }
+
+#pragma omp parallel for schedule(dynamic) num_threads(getNumThreads())
   for (int b = 0; b < B; ++b) {
     for (int n = 0; n < N; ++n) {
       ws.alpha[b * 2 * N + n] = input[b * T * N + n];
     }
 
-    for (int t = 1; t <= T; ++t) {
+    for (int t = 1; t < T; ++t) {
       const auto* alphaPrev = &ws.alpha[b * 2 * N + ((t - 1) % 2) * N];
       const auto* inputCur = &input[b * T * N + t * N];
       auto* alphaCur = &ws.alpha[b * 2 * N + (t % 2) * N];
       auto* betaCur = &ws.beta[b * T * N + t * N];
 
-      for (int m = 0; m < N; ++m) {
-        int maxIndex = -1;
-        Float maxValue = -INFINITY;
-        for (int n = 0; n < N; ++n) {
-          Float val = alphaPrev[n] + (t == T ? 0 : trans[m * N + n]);
-          if (val > maxValue) {
-            maxIndex = n;
-            maxValue = val;
-          }
+      // The first previous class with the best score wins, as in maxIndex()
+      std::fill(alphaCur, alphaCur + N, -INFINITY);
+      std::fill(betaCur, betaCur + N, -1);
+      for (int n = 0; n < N; ++n) {
+        const Float alphaN = alphaPrev[n];
+        const auto* transN = &ws.transT[n * N];
+#pragma omp simd
+        for (int m = 0; m < N; ++m) {
+          const Float val = alphaN + transN[m];
+          const bool better = val > alphaCur[m];
+          alphaCur[m] = better ? val : alphaCur[m];
+          betaCur[m] = better ? n : betaCur[m];
         }
-
-        if (t == T) {
-          auto* path = &_path[b * T];
-          path[T - 1] = maxIndex;
-          for (int s = T - 1; s > 0; --s) {
-            path[s - 1] = ws.beta[b * T * N + s * N + path[s]];
-          }
-          break;
-        }
-
-        alphaCur[m] = maxValue + inputCur[m];
-        betaCur[m] = maxIndex;
       }
+#pragma omp simd
+      for (int m = 0; m < N; ++m) {
+        alphaCur[m] += inputCur[m];
+      }
+    }
+
+    const auto* alphaLast = &ws.alpha[b * 2 * N + ((T - 1) % 2) * N];
+    Float maxValue;
+    auto* path = &_path[b * T];
+    path[T - 1] = cpu::maxIndex(alphaLast, N, &maxValue);
+    for (int s = T - 1; s > 0; --s) {
+      path[s - 1] = ws.beta[b * T * N + s * N + path[s]];
     }
   }
 }
@@ -0,0 +1,170 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "libraries/criterion/cuda/AutoSegmentationCriterion.cuh"
+
+#include <cstdint>
+
+#include "libraries/common/Workspace.h"
+#include "libraries/criterion/cuda/ForceAlignmentCriterion.cuh"
+#include "libraries/criterion/cuda/FullConnectionCriterion.cuh"
+
+namespace {
+
+constexpr int kBlockSize = 128;
+
+template <class Float, class Accum>
+struct WorkspacePtrs {
+  explicit WorkspacePtrs(void* workspace, int B, int T, int N, int L) {
+    using FCC = w2l::cuda::FullConnectionCriterion<Float, Accum>;
+    using FAC = w2l::cuda::ForceAlignmentCriterion<Float>;
+    w2l::Workspace<> ws(workspace);
+    ws.request(&facLoss, B);
+    ws.request(&facGrad, B);
+    ws.request(&fccWorkspace, FCC::getWorkspaceSize(B, T, N));
+    ws.request(&facWorkspace, FAC::getWorkspaceSize(B, T, N, L));
+    requiredSize = ws.requiredSize();
+  }
+
+  Float* facLoss;
+  Float* facGrad; // gradient w.r.t. the FAC loss, the opposite of `grad`
+  uint8_t* fccWorkspace;
+  uint8_t* facWorkspace;
+  size_t requiredSize;
+};
+
+/*
+ * ceil(B / kBlockSize) thread blocks
+ * kBlockSize threads/block
+ */
+template <class Float>
+__global__ void subtractKernel(int B, const Float* facLoss, Float* loss) {
+  int b = blockIdx.x * blockDim.x + threadIdx.x;
+  if (b < B) {
+    loss[b] -= facLoss[b];
+  }
+}
+
+/*
+ * ceil(B / kBlockSize) thread blocks
+ * kBlockSize threads/block
+ */
+template <class Float>
+__global__ void negateKernel(int B, const Float* grad, Float* facGrad) {
+  int b = blockIdx.x * blockDim.x + threadIdx.x;
+  if (b < B) {
+    facGrad[b] = -grad[b];
+  }
+}
+
+} // namespace
+
+namespace w2l {
+namespace cuda {
+
+template <class Float, class Accum>
+size_t AutoSegmentationCriterion<Float, Accum>::getWorkspaceSize(
+    int B,
+    int T,
+    int N,
+    int L) {
+  return WorkspacePtrs<Float, Accum>(nullptr, B, T, N, L).requiredSize;
+}
+
+template <class Float, class Accum>
+void AutoSegmentationCriterion<Float, Accum>::forward(
+    int B,
+    int T,
+    int N,
+    int L,
+    CriterionScaleMode scaleMode,
+    const Float* input,
+    const int* target,
+    const int* targetSize,
+    const Float* trans,
+    Float* loss,
+    void* workspace,
+    cudaStream_t stream) {
+  WorkspacePtrs<Float, Accum> ws(workspace, B, T, N, L);
+  FullConnectionCriterion<Float, Accum>::forward(
+      B,
+      T,
+      N,
+      scaleMode,
+      input,
+      targetSize,
+      trans,
+      loss,
+      ws.fccWorkspace,
+      stream);
+  ForceAlignmentCriterion<Float>::forward(
+      B,
+      T,
+      N,
+      L,
+      scaleMode,
+      input,
+      target,
+      targetSize,
+      trans,
+      ws.facLoss,
+      ws.facWorkspace,
+      stream);
+  int nBlocks = (B + kBlockSize - 1) / kBlockSize;
+  subtractKernel<<<nBlocks, kBlockSize, 0, stream>>>(B, ws.facLoss, loss);
+}
+
+template <class Float, class Accum>
+void AutoSegmentationCriterion<Float, Accum>::backward(
+    int B,
+    int T,
+    int N,
+    int L,
+    const int* target,
+    const int* targetSize,
+    const Float* trans,
+    const Float* grad,
+    Float* inputGrad,
+    Float* transGrad,
+    void* workspace,
+    cudaStream_t stream) {
+  WorkspacePtrs<Float, Accum> ws(workspace, B, T, N, L);
+  int nBlocks = (B + kBlockSize - 1) / kBlockSize;
+  negateKernel<<<nBlocks, kBlockSize, 0, stream>>>(B, grad, ws.facGrad);
+  // The full connection overwrites the outputs, the force alignment adds to
+  // them on the same stream
+  FullConnectionCriterion<Float, Accum>::backward(
+      B,
+      T,
+      N,
+      trans,
+      grad,
+      inputGrad,
+      transGrad,
+      ws.fccWorkspace,
+      stream);
+  ForceAlignmentCriterion<Float>::addBackward(
+      B,
+      T,
+      N,
+      L,
+      target,
+      targetSize,
+      ws.facGrad,
+      inputGrad,
+      transGrad,
+      ws.facWorkspace,
+      stream);
+}
+
+template struct AutoSegmentationCriterion<float>;
+template struct AutoSegmentationCriterion<double>;
+template struct AutoSegmentationCriterion<float, float>;
+
+} // namespace cuda
+} // namespace w2l
@@ -0,0 +1,120 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "libraries/criterion/cuda/CtcGreedyPath.cuh"
+
+#include <cmath>
+
+#include <cub/cub.cuh>
+
+namespace {
+
+constexpr int kWarpSize = 32;
+constexpr int kBlockSize = 256;
+constexpr int kWarps = kBlockSize / kWarpSize;
+
+/*
+ * B thread blocks
+ * kBlockSize threads/block
+ *
+ * Each warp computes the best class of a frame into `path`, then the block
+ * compacts `path` in place, kBlockSize frames at a time: a frame is kept if
+ * it isn't a blank or a repeat of the previous frame.
+ */
+template <class Float>
+__global__ void
+computeKernel(int T, int N, const Float* input, int* _path, int* pathSize) {
+  int b = blockIdx.x;
+  auto* path = &_path[b * T];
+
+  using WarpReduce = cub::WarpReduce<cub::KeyValuePair<int, Float>>;
+  using BlockScan = cub::BlockScan<int, kBlockSize>;
+  __shared__ typename WarpReduce::TempStorage warpStorage[kWarps];
+  __shared__ typename BlockScan::TempStorage scanStorage;
+  __shared__ int prevToken;
+  __shared__ int size;
+
+  int warp = threadIdx.x / kWarpSize;
+  int lane = threadIdx.x % kWarpSize;
+  for (int t = warp; t < T; t += kWarps) {
+    const auto* inputCur = &input[b * T * N + t * N];
+    cub::KeyValuePair<int, Float> threadMax(0, -INFINITY);
+    for (int n = lane; n < N; n += kWarpSize) {
+      if (inputCur[n] > threadMax.value) {
+        threadMax.key = n;
+        threadMax.value = inputCur[n];
+      }
+    }
+    auto result =
+        WarpReduce(warpStorage[warp]).Reduce(threadMax, cub::ArgMax());
+    if (lane == 0) {
+      path[t] = result.key;
+    }
+  }
+
+  if (threadIdx.x == 0) {
+    prevToken = -1;
+    size = 0;
+  }
+  __syncthreads();
+
+  const int blank = N - 1;
+  for (int t0 = 0; t0 < T; t0 += kBlockSize) {
+    int t = t0 + threadIdx.x;
+    int tileEnd = t0 + kBlockSize < T ? t0 + kBlockSize : T;
+    int token = t < T ? path[t] : blank;
+    int prev = threadIdx.x == 0 ? prevToken : t < T ? path[t - 1] : blank;
+    int keep = t < T && token != blank && token != prev;
+
+    int offset, count;
+    BlockScan(scanStorage).ExclusiveSum(keep, offset, count);
+    // All the frames of the tile are read before any of them is overwritten
+    __syncthreads();
+    if (keep) {
+      path[size + offset] = token;
+    }
+    if (t == tileEnd - 1) {
+      prevToken = token;
+    }
+    __syncthreads();
+    if (threadIdx.x == 0) {
+      size += count;
+    }
+    __syncthreads();
+  }
+
+  for (int t = size + threadIdx.x; t < T; t += kBlockSize) {
+    path[t] = -1;
+  }
+  if (threadIdx.x == 0) {
+    pathSize[b] = size;
+  }
+}
+
+} // namespace
+
+namespace w2l {
+namespace cuda {
+
+template <class Float>
+void CtcGreedyPath<Float>::compute(
+    int B,
+    int T,
+    int N,
+    const Float* input,
+    int* path,
+    int* pathSize,
+    cudaStream_t stream) {
+  computeKernel<<<B, kBlockSize, 0, stream>>>(T, N, input, path, pathSize);
+}
+
+template struct CtcGreedyPath<float>;
+template struct CtcGreedyPath<double>;
+
+} // namespace cuda
+} // namespace w2l
@@ -0,0 +1,40 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cuda_runtime.h>
+
+namespace w2l {
+namespace cuda {
+
+/// Computes the greedy CTC transcript: the best class of each frame, with the
+/// repeats collapsed and the blanks (the last class) removed.
+template <class Float>
+struct CtcGreedyPath {
+  /**
+   * B: batch size
+   * T: input length
+   * N: dictionary size, blank included
+   * input: [B][T][N] input frames from network
+   * path: [B][T] (out) transcript, padded with -1
+   * pathSize: [B] (out) transcript size
+   * stream: CUDA stream
+   */
+  static void compute(
+      int B,
+      int T,
+      int N,
+      const Float* input,
+      int* path,
+      int* pathSize,
+      cudaStream_t stream);
+};
+
+} // namespace cuda
+} // namespace w2l
@@ -17,6 +17,16 @@
 
 namespace {
 
+// Threads/block when the states of a sample are split between blocks
+constexpr int kTileSize = 256;
+
+// Each instantiation has its own setting, off until set
+template <class Float>
+bool& splitTargets() {
+  static bool split = false;
+  return split;
+}
+
 template <class Float>
 struct WorkspacePtrs {
   explicit WorkspacePtrs(void* workspace, int B, int T, int N, int L) {
@@ -29,6 +39,7 @@ struct WorkspacePtrs {
     ws.request(&transBuf2, B, L);
     ws.request(&transBufGrad1, B, L);
     ws.request(&transBufGrad2, B, L);
+    ws.request(&syncCount, B);
     requiredSize = ws.requiredSize();
   }
 
@@ -40,12 +51,51 @@ struct WorkspacePtrs {
   Float* transBuf2;
   Float* transBufGrad1;
   Float* transBufGrad2;
+  unsigned int* syncCount; // blocks arrived at the barriers of each sample
   size_t requiredSize;
 };
 
 /*
- * B thread blocks
- * L threads/block (ideally)
+ * Barrier of the blocks of a sample. When the sample is split between several
+ * blocks, they are all resident (cooperative launch), and wait for each other
+ * on `count`, the number of blocks of the sample arrived at a barrier so far
+ * (zeroed before the launch). `arrived` is the count to wait for.
+ */
+__device__ void
+sampleSync(unsigned int* count, int nTiles, unsigned int& arrived) {
+  if (nTiles == 1) {
+    __syncthreads();
+    return;
+  }
+  __threadfence();
+  __syncthreads();
+  if (threadIdx.x == 0) {
+    arrived += nTiles;
+    atomicAdd(count, 1);
+    while (atomicAdd(count, 0) < arrived) {
+    }
+    __threadfence();
+  }
+  __syncthreads();
+}
+
+/*
+ * The first state >= `begin` of a thread owning the states `first` + k *
+ * `stride`
+ */
+__device__ int firstState(int first, int stride, int begin) {
+  if (begin <= first) {
+    return first;
+  }
+  return first + (begin - first + stride - 1) / stride * stride;
+}
+
+/*
+ * B * nTiles thread blocks
+ * L / nTiles threads/block (ideally)
+ *
+ * The states of a sample are split between its nTiles blocks, which only need
+ * to wait for each other between the frames.
  */
 template <class Float>
 __global__ void forwardKernel(
@@ -57,16 +107,21 @@ __global__ void forwardKernel(
     const int* targetSize,
     const Float* trans,
     Float* _loss,
-    WorkspacePtrs<Float> ws) {
-  int b = blockIdx.x;
+    WorkspacePtrs<Float> ws,
+    int nTiles) {
+  int b = blockIdx.x / nTiles;
+  int first = (blockIdx.x % nTiles) * blockDim.x + threadIdx.x;
+  int stride = nTiles * blockDim.x;
   auto* alpha = &ws.alpha[b * T * _L];
   auto* input = &_input[b * T * N];
   auto* target = &_target[b * _L];
   auto* transBuf1 = &ws.transBuf1[b * _L];
   auto* transBuf2 = &ws.transBuf2[b * _L];
+  auto* syncCount = &ws.syncCount[b];
+  unsigned int arrived = 0;
   int L = targetSize[b];
 
-  for (int i = threadIdx.x; i < L; i += blockDim.x) {
+  for (int i = first; i < L; i += stride) {
     alpha[i] = i == 0 ? input[target[0]] : 0;
     transBuf1[i] = trans[target[i] * N + target[i]];
     transBuf2[i] = i > 0 ? trans[target[i] * N + target[i - 1]] : 0;
@@ -79,42 +134,46 @@ __global__ void forwardKernel(
 
     int high = t < L ? t : L;
     int low = T - t < L ? L - (T - t) : 1;
+    // State 0 is reached while there are enough frames left for the others,
+    // and state `high` only from the state before it
+    int begin = T - t >= L ? 0 : low;
+    int end = t < L ? high + 1 : L;
 
-    __syncthreads();
+    sampleSync(syncCount, nTiles, arrived);
 
-    if (threadIdx.x == 0) {
-      if (T - t >= L) {
+    for (int i = firstState(first, stride, begin); i < end; i += stride) {
+      if (i == 0) {
         alphaCur[0] = alphaPrev[0] + transBuf1[0] + inputCur[target[0]];
-      }
-    } else if (threadIdx.x == 1) {
-      if (t < L) {
+      } else if (i == high) {
         alphaCur[high] =
             alphaPrev[high - 1] + transBuf2[high] + inputCur[target[high]];
+      } else {
+        double s1 = alphaPrev[i] + transBuf1[i];
+        double s2 = alphaPrev[i - 1] + transBuf2[i];
+        // lse = logSumExp(s1, s2)
+        double lse =
+            s1 < s2 ? s2 + log(1 + exp(s1 - s2)) : s1 + log(1 + exp(s2 - s1));
+        alphaCur[i] = lse + inputCur[target[i]];
       }
     }
-
-    for (int i = low + threadIdx.x; i < high; i += blockDim.x) {
-      double s1 = alphaPrev[i] + transBuf1[i];
-      double s2 = alphaPrev[i - 1] + transBuf2[i];
-      // lse = logSumExp(s1, s2)
-      double lse =
-          s1 < s2 ? s2 + log(1 + exp(s1 - s2)) : s1 + log(1 + exp(s2 - s1));
-      alphaCur[i] = lse + inputCur[target[i]];
-    }
   }
 
-  __syncthreads();
+  sampleSync(syncCount, nTiles, arrived);
 
-  if (threadIdx.x == 0) {
+  if (first == 0) {
     _loss[b] = alpha[T * L - 1] * ws.scale[b];
   }
 }
 
 /*
- * B thread blocks
- * L threads/block (ideally)
+ * B * nTiles thread blocks
+ * L / nTiles threads/block (ideally)
+ *
+ * With `Add`, the input gradient is scaled as it is added to `inputGrad`, only
+ * at the target labels. Otherwise `inputGrad` (zeroed) holds this gradient
+ * only, and is scaled as a whole at the end.
  */
-template <class Float>
+template <class Float, bool Add>
 __global__ void backwardKernel(
     int T,
     int N,
@@ -124,8 +183,11 @@ __global__ void backwardKernel(
     const Float* grad,
     Float* _inputGrad,
     Float* transGrad,
-    WorkspacePtrs<Float> ws) {
-  int b = blockIdx.x;
+    WorkspacePtrs<Float> ws,
+    int nTiles) {
+  int b = blockIdx.x / nTiles;
+  int first = (blockIdx.x % nTiles) * blockDim.x + threadIdx.x;
+  int stride = nTiles * blockDim.x;
   auto* alpha = &ws.alpha[b * T * _L];
   auto* alphaGrad = &ws.alphaGrad[b * T * _L];
   auto* inputGrad = &_inputGrad[b * T * N];
@@ -135,9 +197,14 @@ __global__ void backwardKernel(
   auto* transBuf2 = &ws.transBuf2[b * _L];
   auto* transBufGrad1 = &ws.transBufGrad1[b * _L];
   auto* transBufGrad2 = &ws.transBufGrad2[b * _L];
+  auto* syncCount = &ws.syncCount[b];
+  unsigned int arrived = 0;
   int L = targetSize[b];
 
-  if (threadIdx.x == 0) {
+  Float gradScale = grad[b] * ws.scale[b];
+  Float addScale = Add ? gradScale : 1;
+
+  if (first == 0) {
     alphaGrad[T * L - 1] = 1;
   }
 
@@ -149,57 +216,48 @@ __global__ void backwardKernel(
 
     int high = t < L ? t : L;
     int low = T - t < L ? L - (T - t) : 1;
+    int begin = T - t >= L ? 0 : low;
+    int end = t < L ? high + 1 : L;
 
-    int high1 = t < L ? t + 1 : L;
-    int low1 = T - t < L ? L - (T - t) : 0;
+    sampleSync(syncCount, nTiles, arrived);
 
-    __syncthreads();
-
-    for (int i = low1 + threadIdx.x; i < high1; i += blockDim.x) {
-      atomicAdd(&inputCurGrad[target[i]], alphaCurGrad[i]);
-    }
-
-    if (threadIdx.x == 0) {
-      if (T - t >= L) {
+    for (int i = firstState(first, stride, begin); i < end; i += stride) {
+      atomicAdd(
+          &inputCurGrad[target[i]],
+          static_cast<Float>(addScale * alphaCurGrad[i]));
+      if (i == 0) {
         atomicAdd(&alphaPrevGrad[0], alphaCurGrad[0]);
         transBufGrad1[0] += alphaCurGrad[0];
-      }
-    } else if (threadIdx.x == 1) {
-      if (t < L) {
+      } else if (i == high) {
         atomicAdd(&alphaPrevGrad[high - 1], alphaCurGrad[high]);
         transBufGrad2[high] += alphaCurGrad[high];
-      }
-    }
-
-    for (int i = low + threadIdx.x; i < high; i += blockDim.x) {
-      double s1 = alphaPrev[i] + transBuf1[i];
-      double s2 = alphaPrev[i - 1] + transBuf2[i];
-      // d1, d2 = dLogSumExp(s1, s2)
-      double d1, d2;
-      if (s1 < s2) {
-        d2 = 1 / (1 + exp(s1 - s2));
-        d1 = 1 - d2;
       } else {
-        d1 = 1 / (1 + exp(s2 - s1));
-        d2 = 1 - d1;
+        double s1 = alphaPrev[i] + transBuf1[i];
+        double s2 = alphaPrev[i - 1] + transBuf2[i];
+        // d1, d2 = dLogSumExp(s1, s2)
+        double d1, d2;
+        if (s1 < s2) {
+          d2 = 1 / (1 + exp(s1 - s2));
+          d1 = 1 - d2;
+        } else {
+          d1 = 1 / (1 + exp(s2 - s1));
+          d2 = 1 - d1;
+        }
+        atomicAdd(&alphaPrevGrad[i], d1 * alphaCurGrad[i]);
+        atomicAdd(&alphaPrevGrad[i - 1], d2 * alphaCurGrad[i]);
+        transBufGrad1[i] += d1 * alphaCurGrad[i];
+        transBufGrad2[i] += d2 * alphaCurGrad[i];
       }
-      atomicAdd(&alphaPrevGrad[i], d1 * alphaCurGrad[i]);
-      atomicAdd(&alphaPrevGrad[i - 1], d2 * alphaCurGrad[i]);
-      transBufGrad1[i] += d1 * alphaCurGrad[i];
-      transBufGrad2[i] += d2 * alphaCurGrad[i];
     }
   }
 
-  __syncthreads();
-
-  __shared__ Float gradScale;
+  sampleSync(syncCount, nTiles, arrived);
 
-  if (threadIdx.x == 0) {
-    inputGrad[target[0]] += alphaGrad[0];
-    gradScale = grad[b] * ws.scale[b];
+  if (first == 0) {
+    inputGrad[target[0]] += addScale * alphaGrad[0];
   }
 
-  for (int i = threadIdx.x; i < L; i += blockDim.x) {
+  for (int i = first; i < L; i += stride) {
     atomicAdd(&transBatchGrad[target[i] * N + target[i]], transBufGrad1[i]);
     if (i > 0) {
       atomicAdd(
@@ -207,17 +265,85 @@ __global__ void backwardKernel(
     }
   }
 
-  __syncthreads();
+  sampleSync(syncCount, nTiles, arrived);
 
-  for (int i = threadIdx.x; i < T * N; i += blockDim.x) {
-    inputGrad[i] *= gradScale;
+  if (!Add) {
+    for (int i = first; i < T * N; i += stride) {
+      inputGrad[i] *= gradScale;
+    }
   }
 
-  for (int i = threadIdx.x; i < N * N; i += blockDim.x) {
+  for (int i = first; i < N * N; i += stride) {
     atomicAdd(&transGrad[i], gradScale * transBatchGrad[i]);
   }
 }
 
+/*
+ * Number of blocks to split each sample between: one, unless the batch alone
+ * leaves SMs idle and the targets are longer than a block, in which case the
+ * samples take as many blocks as can all be resident at once, for a
+ * cooperative launch.
+ */
+int tilesPerSample(int B, int L, const void* kernel) {
+  int nTiles = (L + kTileSize - 1) / kTileSize;
+  if (nTiles < 2) {
+    return 1;
+  }
+  int device, cooperative, nSms, blocksPerSm;
+  cudaGetDevice(&device);
+  cudaDeviceGetAttribute(&cooperative, cudaDevAttrCooperativeLaunch, device);
+  cudaDeviceGetAttribute(&nSms, cudaDevAttrMultiProcessorCount, device);
+  if (!cooperative || B >= nSms) {
+    return 1;
+  }
+  cudaOccupancyMaxActiveBlocksPerMultiprocessor(
+      &blocksPerSm, kernel, kTileSize, 0);
+  return std::max(std::min(nTiles, blocksPerSm * nSms / B), 1);
+}
+
+// backward() (zeroed outputs) or addBackward() (`Add`)
+template <class Float, bool Add>
+void launchBackward(
+    int B,
+    int T,
+    int N,
+    int L,
+    const int* target,
+    const int* targetSize,
+    const Float* grad,
+    Float* inputGrad,
+    Float* transGrad,
+    void* workspace,
+    cudaStream_t stream) {
+  WorkspacePtrs<Float> ws(workspace, B, T, N, L);
+  w2l::cuda::setZero(ws.alphaGrad, B * T * L, stream);
+  w2l::cuda::setZero(ws.transBatchGrad, B * N * N, stream);
+  w2l::cuda::setZero(ws.transBufGrad1, B * L, stream);
+  w2l::cuda::setZero(ws.transBufGrad2, B * L, stream);
+  const void* kernel =
+      reinterpret_cast<const void*>(&backwardKernel<Float, Add>);
+  int nTiles = splitTargets<Float>() ? tilesPerSample(B, L, kernel) : 1;
+  if (nTiles == 1) {
+    int blockSize = std::min(256, (L + 31) / 32 * 32);
+    backwardKernel<Float, Add><<<B, blockSize, 0, stream>>>(
+        T, N, L, target, targetSize, grad, inputGrad, transGrad, ws, 1);
+    return;
+  }
+  w2l::cuda::setZero(ws.syncCount, B, stream);
+  void* args[] = {&T,
+                  &N,
+                  &L,
+                  &target,
+                  &targetSize,
+                  &grad,
+                  &inputGrad,
+                  &transGrad,
+                  &ws,
+                  &nTiles};
+  cudaLaunchCooperativeKernel(
+      kernel, B * nTiles, kTileSize, args, 0, stream);
+}
+
 } // namespace
 
 namespace w2l {
@@ -229,6 +355,11 @@ ForceAlignmentCriterion<Float>::getWorkspaceSize(int B, int T, int N, int L) {
   return WorkspacePtrs<Float>(nullptr, B, T, N, L).requiredSize;
 }
 
+template <class Float>
+void ForceAlignmentCriterion<Float>::setSplitTargets(bool split) {
+  splitTargets<Float>() = split;
+}
+
 template <class Float>
 void ForceAlignmentCriterion<Float>::forward(
     int B,
@@ -243,12 +374,22 @@ void ForceAlignmentCriterion<Float>::forward(
     Float* loss,
     void* workspace,
     cudaStream_t stream) {
-  int blockSize = std::min(256, (L + 31) / 32 * 32);
   WorkspacePtrs<Float> ws(workspace, B, T, N, L);
   CriterionUtils<Float>::computeScale(
       B, T, N, scaleMode, targetSize, ws.scale, stream);
-  forwardKernel<<<B, blockSize, 0, stream>>>(
-      T, N, L, input, target, targetSize, trans, loss, ws);
+  const void* kernel = reinterpret_cast<const void*>(&forwardKernel<Float>);
+  int nTiles = splitTargets<Float>() ? tilesPerSample(B, L, kernel) : 1;
+  if (nTiles == 1) {
+    int blockSize = std::min(256, (L + 31) / 32 * 32);
+    forwardKernel<<<B, blockSize, 0, stream>>>(
+        T, N, L, input, target, targetSize, trans, loss, ws, 1);
+    return;
+  }
+  setZero(ws.syncCount, B, stream);
+  void* args[] = {
+      &T, &N, &L, &input, &target, &targetSize, &trans, &loss, &ws, &nTiles};
+  cudaLaunchCooperativeKernel(
+      kernel, B * nTiles, kTileSize, args, 0, stream);
 }
 
 template <class Float>
@@ -264,16 +405,47 @@ void ForceAlignmentCriterion<Float>::backward(
     Float* transGrad,
     void* workspace,
     cudaStream_t stream) {
-  int blockSize = std::min(256, (L + 31) / 32 * 32);
-  WorkspacePtrs<Float> ws(workspace, B, T, N, L);
   setZero(inputGrad, B * T * N, stream);
   setZero(transGrad, N * N, stream);
-  setZero(ws.alphaGrad, B * T * L, stream);
-  setZero(ws.transBatchGrad, B * N * N, stream);
-  setZero(ws.transBufGrad1, B * L, stream);
-  setZero(ws.transBufGrad2, B * L, stream);
-  backwardKernel<<<B, blockSize, 0, stream>>>(
-      T, N, L, target, targetSize, grad, inputGrad, transGrad, ws);
+  launchBackward<Float, false>(
+      B,
+      T,
+      N,
+      L,
+      target,
+      targetSize,
+      grad,
+      inputGrad,
+      transGrad,
+      workspace,
+      stream);
+}
+
+template <class Float>
+void ForceAlignmentCriterion<Float>::addBackward(
+    int B,
+    int T,
+    int N,
+    int L,
+    const int* target,
+    const int* targetSize,
+    const Float* grad,
+    Float* inputGrad,
+    Float* transGrad,
+    void* workspace,
+    cudaStream_t stream) {
+  launchBackward<Float, true>(
+      B,
+      T,
+      N,
+      L,
+      target,
+      targetSize,
+      grad,
+      inputGrad,
+      transGrad,
+      workspace,
+      stream);
 }
 
 template struct ForceAlignmentCriterion<float>;
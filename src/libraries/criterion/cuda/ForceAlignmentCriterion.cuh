@@ -26,6 +26,13 @@ struct ForceAlignmentCriterion {
    */
   static size_t getWorkspaceSize(int B, int T, int N, int L);
 
+  /**
+   * Split the states of each sample between several blocks, launched together
+   * by a cooperative launch, when the batch alone leaves SMs idle and the
+   * targets are longer than a block. Off by default: one block per sample.
+   */
+  static void setSplitTargets(bool split);
+
   /**
    * B: batch size
    * T: input length
@@ -79,6 +86,23 @@ struct ForceAlignmentCriterion {
       Float* transGrad,
       void* workspace,
       cudaStream_t stream);
+
+  /**
+   * backward(), adding the gradients to `inputGrad` and `transGrad` rather
+   * than overwriting them, e.g. to fuse the two terms of ASG loss
+   */
+  static void addBackward(
+      int B,
+      int T,
+      int N,
+      int L,
+      const int* target,
+      const int* targetSize,
+      const Float* grad,
+      Float* inputGrad,
+      Float* transGrad,
+      void* workspace,
+      cudaStream_t stream);
 };
 
 } // namespace cuda
@@ -0,0 +1,181 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "libraries/criterion/cuda/ForcedAlignmentPath.cuh"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "libraries/common/Workspace.h"
+
+namespace {
+
+template <class Float>
+struct WorkspacePtrs {
+  explicit WorkspacePtrs(void* workspace, int B, int T, int L) {
+    const int S = 2 * L + 1;
+    w2l::Workspace<> ws(workspace);
+    ws.request(&alpha, B, 2, S);
+    ws.request(&beta, B, T, S);
+    ws.request(&label, B, S);
+    requiredSize = ws.requiredSize();
+  }
+
+  Float* alpha;
+  uint8_t* beta; // states to go back by from each state: 0, 1 or 2
+  int* label; // class of each state
+  size_t requiredSize;
+};
+
+__device__ int countRepeats(const int* target, int L) {
+  int R = 0;
+  for (int i = 1; i < L; ++i) {
+    if (target[i] == target[i - 1]) {
+      ++R;
+    }
+  }
+  return R;
+}
+
+/*
+ * B thread blocks
+ * 2L + 1 threads/block (ideally), looping over the states beyond
+ *
+ * The states are the labels of the target for ASG, and for CTC the labels
+ * between blanks, the target being shortened as in CTC loss. Each frame
+ * updates all the states at once, then thread 0 backtracks the best path.
+ */
+template <class Float>
+__global__ void computeKernel(
+    int T,
+    int N,
+    int _L,
+    const Float* _input,
+    const int* inputSize,
+    const int* _target,
+    const int* targetSize,
+    const Float* trans,
+    int* _path,
+    WorkspacePtrs<Float> ws) {
+  const int b = blockIdx.x;
+  const int _S = 2 * _L + 1;
+  const bool ctc = trans == nullptr;
+  const auto* input = &_input[b * T * N];
+  const auto* target = &_target[b * _L];
+  auto* path = &_path[b * T];
+  auto* alpha = &ws.alpha[b * 2 * _S];
+  auto* beta = &ws.beta[b * T * _S];
+  auto* label = &ws.label[b * _S];
+
+  const int sampleT = inputSize ? max(min(inputSize[b], T), 0) : T;
+  __shared__ int sharedS;
+  if (threadIdx.x == 0) {
+    int L = targetSize[b];
+    if (ctc) {
+      int R = countRepeats(target, L);
+      L = max(min(L + R, sampleT) - R, 0);
+      sharedS = 2 * L + 1;
+    } else {
+      sharedS = max(min(L, sampleT), 0);
+    }
+  }
+  __syncthreads();
+  const int S = sampleT > 0 ? sharedS : 0;
+
+  for (int t = threadIdx.x; t < T; t += blockDim.x) {
+    path[t] = -1;
+  }
+  if (S == 0) {
+    return;
+  }
+  for (int s = threadIdx.x; s < S; s += blockDim.x) {
+    label[s] = !ctc ? target[s] : (s & 1) ? target[s / 2] : N - 1;
+    alpha[s] = s == 0 || (ctc && s == 1) ? input[label[s]] : -INFINITY;
+  }
+
+  for (int t = 1; t < sampleT; ++t) {
+    __syncthreads();
+    const auto* alphaPrev = &alpha[((t - 1) % 2) * _S];
+    const auto* inputCur = &input[t * N];
+    auto* alphaCur = &alpha[(t % 2) * _S];
+    auto* betaCur = &beta[t * _S];
+    for (int s = threadIdx.x; s < S; s += blockDim.x) {
+      const int m = label[s];
+      Float best = alphaPrev[s] + (ctc ? 0 : trans[m * N + m]);
+      int k = 0;
+      if (s > 0) {
+        Float move =
+            alphaPrev[s - 1] + (ctc ? 0 : trans[m * N + label[s - 1]]);
+        if (move > best) {
+          best = move;
+          k = 1;
+        }
+      }
+      if (ctc && s > 1 && m != N - 1 && m != label[s - 2] &&
+          alphaPrev[s - 2] > best) {
+        best = alphaPrev[s - 2];
+        k = 2;
+      }
+      alphaCur[s] = best + inputCur[m];
+      betaCur[s] = k;
+    }
+  }
+  __syncthreads();
+
+  if (threadIdx.x == 0) {
+    // CTC may end on the last label or on the blank after it
+    const auto* alphaLast = &alpha[((sampleT - 1) % 2) * _S];
+    int s = S - 1;
+    if (ctc && S > 1 && alphaLast[S - 2] > alphaLast[S - 1]) {
+      s = S - 2;
+    }
+    for (int t = sampleT - 1; t >= 0; --t) {
+      path[t] = label[s];
+      if (t > 0) {
+        s -= beta[t * _S + s];
+      }
+    }
+  }
+}
+
+} // namespace
+
+namespace w2l {
+namespace cuda {
+
+template <class Float>
+size_t ForcedAlignmentPath<Float>::getWorkspaceSize(int B, int T, int L) {
+  return WorkspacePtrs<Float>(nullptr, B, T, L).requiredSize;
+}
+
+template <class Float>
+void ForcedAlignmentPath<Float>::compute(
+    int B,
+    int T,
+    int N,
+    int L,
+    const Float* input,
+    const int* inputSize,
+    const int* target,
+    const int* targetSize,
+    const Float* trans,
+    int* path,
+    void* workspace,
+    cudaStream_t stream) {
+  int blockSize = std::min(256, (2 * L + 1 + 31) / 32 * 32);
+  WorkspacePtrs<Float> ws(workspace, B, T, L);
+  computeKernel<<<B, blockSize, 0, stream>>>(
+      T, N, L, input, inputSize, target, targetSize, trans, path, ws);
+}
+
+template struct ForcedAlignmentPath<float>;
+template struct ForcedAlignmentPath<double>;
+
+} // namespace cuda
+} // namespace w2l
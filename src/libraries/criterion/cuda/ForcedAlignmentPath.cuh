@@ -0,0 +1,63 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cuda_runtime.h>
+
+namespace w2l {
+namespace cuda {
+
+/**
+ * Computes the best path through the target of each sample with the Viterbi
+ * algorithm, i.e. the class of each frame along the most likely alignment of
+ * the target. With a transition matrix, as ASG: the frames go through the
+ * labels of the target in order, each label taking at least one frame. Without
+ * one, as CTC: the labels may be separated by blanks (the last class), and
+ * repeated labels must be. A target too long for its frames is shortened.
+ */
+template <class Float>
+struct ForcedAlignmentPath {
+  /**
+   * B: batch size
+   * T: input length
+   * L: target length
+   */
+  static size_t getWorkspaceSize(int B, int T, int L);
+
+  /**
+   * B: batch size
+   * T: input length
+   * N: dictionary size
+   * L: target length
+   * input: [B][T][N] input frames from network
+   * inputSize: [B] number of frames of each sample (all T if null)
+   * target: [B][L] target labels
+   * targetSize: [B] size of each target
+   * trans: [N][N] transition matrix for ASG, null for CTC
+   * path: [B][T] (out) class of each frame, -1 beyond the input size
+   * workspace: (in/out) internal workspace
+   * stream: CUDA stream
+   */
+  static void compute(
+      int B,
+      int T,
+      int N,
+      int L,
+      const Float* input,
+      const int* inputSize,
+      const int* target,
+      const int* targetSize,
+      const Float* trans,
+      int* path,
+      void* workspace,
+      cudaStream_t stream);
+};
+
+} // namespace cuda
+} // namespace w2l
@@ -8,7 +8,9 @@
 
 #include "libraries/criterion/cuda/FullConnectionCriterion.cuh"
 
+#include <algorithm>
 #include <cmath>
+#include <type_traits>
 
 #include <cub/cub.cuh>
 
@@ -20,11 +22,37 @@ namespace {
 
 constexpr int kBlockSize = 32;
 
-template <class Float>
+// The persistent kernels run one block per utterance, one warp per class at a
+// time, and keep two frames of N values in shared memory
+constexpr int kWarpSize = 32;
+constexpr int kPersistentBlockSize = 256;
+constexpr int kPersistentWarps = kPersistentBlockSize / kWarpSize;
+// Bounds the dynamic shared memory of the frames to 32KB with double
+constexpr int kMaxPersistentN = 2048;
+
+// Each instantiation has its own threshold, 0 until set
+template <class Float, class Accum>
+int& persistentMaxN() {
+  static int maxN = 0;
+  return maxN;
+}
+
+/*
+ * With float recursions, each frame of alpha is stored minus the maximum of
+ * the previous one, which keeps its values close to 0 whatever T, and
+ * logScale sums these maxima. The backward pass computes softmaxes of alpha,
+ * which do not depend on the shifts. Double recursions are not shifted, and
+ * logScale stays 0.
+ */
+template <class Accum>
+struct IsShifted : std::is_same<Accum, float> {};
+
+template <class Float, class Accum>
 struct WorkspacePtrs {
   explicit WorkspacePtrs(void* workspace, int B, int T, int N) {
     w2l::Workspace<> ws(workspace);
     ws.request(&scale, B);
+    ws.request(&logScale, B);
     ws.request(&alpha, B, T, N);
     ws.request(&alphaGrad, B, T, N);
     ws.request(&transBatchGrad, B, N, N);
@@ -33,10 +61,11 @@ struct WorkspacePtrs {
   }
 
   Float* scale;
-  double* alpha;
-  double* alphaGrad;
-  double* transBatchGrad;
-  double* transBuf;
+  double* logScale;
+  Accum* alpha;
+  Accum* alphaGrad;
+  Accum* transBatchGrad;
+  Accum* transBuf;
   size_t requiredSize;
 };
 
@@ -44,10 +73,16 @@ struct WorkspacePtrs {
  * B thread blocks
  * kBlockSize threads/block
  */
-template <class Float>
-__global__ void
-forwardInitial(int T, int N, const Float* input, WorkspacePtrs<Float> ws) {
+template <class Float, class Accum>
+__global__ void forwardInitial(
+    int T,
+    int N,
+    const Float* input,
+    WorkspacePtrs<Float, Accum> ws) {
   int b = blockIdx.x;
+  if (threadIdx.x == 0) {
+    ws.logScale[b] = 0;
+  }
   for (int n = threadIdx.x; n < N; n += blockDim.x) {
     int k = b * T * N + n;
     ws.alpha[k] = input[k];
@@ -58,7 +93,7 @@ forwardInitial(int T, int N, const Float* input, WorkspacePtrs<Float> ws) {
  * B * N thread blocks (B if Final)
  * kBlockSize threads/block
  */
-template <bool Final, class Float>
+template <bool Final, class Float, class Accum>
 __global__ void forwardStep(
     int T,
     int N,
@@ -66,7 +101,7 @@ __global__ void forwardStep(
     const Float* input,
     const Float* trans,
     Float* loss,
-    WorkspacePtrs<Float> ws) {
+    WorkspacePtrs<Float, Accum> ws) {
   int b, m;
   if (Final) {
     b = blockIdx.x;
@@ -80,34 +115,54 @@ __global__ void forwardStep(
   auto* alphaCur = &ws.alpha[b * T * N + t * N];
   auto* transBuf = &ws.transBuf[blockIdx.x * N];
 
-  using BlockReduce = cub::BlockReduce<double, kBlockSize>;
+  using BlockReduce = cub::BlockReduce<Accum, kBlockSize>;
   __shared__ typename BlockReduce::TempStorage tempStorage;
-  __shared__ double maxValue;
+  __shared__ Accum maxValue;
+  __shared__ Accum prevMaxValue;
 
-  double threadMax = -INFINITY;
+  constexpr bool shifted = IsShifted<Accum>::value;
+
+  Accum threadMax = -INFINITY;
+  Accum threadPrevMax = -INFINITY;
   for (int n = threadIdx.x; n < N; n += blockDim.x) {
-    double val = transBuf[n] = alphaPrev[n] + (Final ? 0 : trans[m * N + n]);
+    Accum val = transBuf[n] = alphaPrev[n] + (Final ? 0 : trans[m * N + n]);
     threadMax = val > threadMax ? val : threadMax;
+    threadPrevMax = alphaPrev[n] > threadPrevMax ? alphaPrev[n] : threadPrevMax;
   }
 
-  double maxResult = BlockReduce(tempStorage).Reduce(threadMax, cub::Max());
+  Accum maxResult = BlockReduce(tempStorage).Reduce(threadMax, cub::Max());
   if (threadIdx.x == 0) {
     maxValue = maxResult;
   }
 
+  if (!Final && shifted) {
+    __syncthreads();
+
+    Accum prevMaxResult =
+        BlockReduce(tempStorage).Reduce(threadPrevMax, cub::Max());
+    if (threadIdx.x == 0) {
+      prevMaxValue = prevMaxResult;
+    }
+  }
+
   __syncthreads();
 
-  double threadSum = 0;
+  Accum threadSum = 0;
   for (int n = threadIdx.x; n < N; n += blockDim.x) {
     threadSum += exp(transBuf[n] - maxValue);
   }
 
-  double sumResult = BlockReduce(tempStorage).Sum(threadSum);
+  Accum sumResult = BlockReduce(tempStorage).Sum(threadSum);
   if (threadIdx.x == 0) {
     if (Final) {
-      loss[b] = ws.scale[b] * (log(sumResult) + maxValue);
+      loss[b] =
+          ws.scale[b] * (log(sumResult) + maxValue + ws.logScale[b]);
     } else {
-      alphaCur[m] = log(sumResult) + maxValue + inputCur[m];
+      Accum shift = shifted ? prevMaxValue : 0;
+      alphaCur[m] = log(sumResult) + maxValue - shift + inputCur[m];
+      if (m == 0) {
+        ws.logScale[b] += shift;
+      }
     }
   }
 }
@@ -116,13 +171,13 @@ __global__ void forwardStep(
  * B * N thread blocks (B if Initial)
  * kBlockSize threads/block
  */
-template <bool Initial, class Float>
+template <bool Initial, class Float, class Accum>
 __global__ void backwardStep1(
     int T,
     int N,
     int t,
     const Float* trans,
-    WorkspacePtrs<Float> ws) {
+    WorkspacePtrs<Float, Accum> ws) {
   int b, m;
   if (Initial) {
     b = blockIdx.x;
@@ -137,29 +192,29 @@ __global__ void backwardStep1(
   auto* transBuf = &ws.transBuf[blockIdx.x * N];
   auto* transBatchGrad = &ws.transBatchGrad[blockIdx.x * N];
 
-  using BlockReduce = cub::BlockReduce<double, kBlockSize>;
+  using BlockReduce = cub::BlockReduce<Accum, kBlockSize>;
   __shared__ typename BlockReduce::TempStorage tempStorage;
-  __shared__ double maxValue;
-  __shared__ double sumValue;
+  __shared__ Accum maxValue;
+  __shared__ Accum sumValue;
 
-  double threadMax = -INFINITY;
+  Accum threadMax = -INFINITY;
   for (int n = threadIdx.x; n < N; n += blockDim.x) {
-    double val = transBuf[n] = alphaPrev[n] + (Initial ? 0 : trans[m * N + n]);
+    Accum val = transBuf[n] = alphaPrev[n] + (Initial ? 0 : trans[m * N + n]);
     threadMax = val > threadMax ? val : threadMax;
   }
 
-  double maxResult = BlockReduce(tempStorage).Reduce(threadMax, cub::Max());
+  Accum maxResult = BlockReduce(tempStorage).Reduce(threadMax, cub::Max());
   if (threadIdx.x == 0) {
     maxValue = maxResult;
   }
 
-  double threadSum = 0;
+  Accum threadSum = 0;
   for (int n = threadIdx.x; n < N; n += blockDim.x) {
     transBuf[n] = exp(transBuf[n] - maxValue);
     threadSum += transBuf[n];
   }
 
-  double sumResult = BlockReduce(tempStorage).Sum(threadSum);
+  Accum sumResult = BlockReduce(tempStorage).Sum(threadSum);
   if (threadIdx.x == 0) {
     sumValue = sumResult;
   }
@@ -180,22 +235,23 @@ __global__ void backwardStep1(
  * B * N thread blocks
  * kBlockSize threads/block
  */
-template <class Float>
-__global__ void backwardStep2(int T, int N, int t, WorkspacePtrs<Float> ws) {
+template <class Float, class Accum>
+__global__ void
+backwardStep2(int T, int N, int t, WorkspacePtrs<Float, Accum> ws) {
   int b = blockIdx.x / N;
   int m = blockIdx.x % N;
 
   auto* alphaPrevGrad = &ws.alphaGrad[b * T * N + (t - 1) * N];
 
-  using BlockReduce = cub::BlockReduce<double, kBlockSize>;
+  using BlockReduce = cub::BlockReduce<Accum, kBlockSize>;
   __shared__ typename BlockReduce::TempStorage tempStorage;
 
-  double threadSum = 0;
+  Accum threadSum = 0;
   for (int n = threadIdx.x; n < N; n += blockDim.x) {
     threadSum += ws.transBuf[b * N * N + n * N + m];
   }
 
-  double sumResult = BlockReduce(tempStorage).Sum(threadSum);
+  Accum sumResult = BlockReduce(tempStorage).Sum(threadSum);
   if (threadIdx.x == 0) {
     alphaPrevGrad[m] = sumResult;
   }
@@ -205,14 +261,14 @@ __global__ void backwardStep2(int T, int N, int t, WorkspacePtrs<Float> ws) {
  * B thread blocks
  * 128 threads/block
  */
-template <class Float>
+template <class Float, class Accum>
 __global__ void backwardFinal(
     int T,
     int N,
     const Float* _grad,
     Float* _inputGrad,
     Float* transGrad,
-    WorkspacePtrs<Float> ws) {
+    WorkspacePtrs<Float, Accum> ws) {
   int b = blockIdx.x;
 
   auto* alphaGrad = &ws.alphaGrad[b * T * N];
@@ -236,18 +292,256 @@ __global__ void backwardFinal(
   }
 }
 
+/*
+ * B thread blocks
+ * kPersistentBlockSize threads/block
+ * 2 * N Accum of dynamic shared memory
+ */
+template <class Float, class Accum>
+__global__ void forwardPersistent(
+    int T,
+    int N,
+    const Float* _input,
+    const Float* trans,
+    Float* loss,
+    WorkspacePtrs<Float, Accum> ws) {
+  int b = blockIdx.x;
+  int warp = threadIdx.x / kWarpSize;
+  int lane = threadIdx.x % kWarpSize;
+
+  const auto* input = &_input[b * T * N];
+  auto* alpha = &ws.alpha[b * T * N];
+
+  extern __shared__ __align__(sizeof(double)) unsigned char sharedMemory[];
+  auto* frames = reinterpret_cast<Accum*>(sharedMemory);
+  Accum* alphaPrev = frames;
+  Accum* alphaCur = frames + N;
+
+  using WarpReduce = cub::WarpReduce<Accum>;
+  using BlockReduce = cub::BlockReduce<Accum, kPersistentBlockSize>;
+  __shared__ typename WarpReduce::TempStorage warpStorage[kPersistentWarps];
+  __shared__ typename BlockReduce::TempStorage blockStorage;
+  __shared__ Accum maxValue;
+
+  for (int n = threadIdx.x; n < N; n += blockDim.x) {
+    alpha[n] = alphaPrev[n] = input[n];
+  }
+
+  __syncthreads();
+
+  // Only meaningful in thread 0, which computes the loss
+  double logScale = 0;
+
+  for (int t = 1; t < T; ++t) {
+    // Each warp computes the shift of the frame itself rather than waiting
+    // for a block reduction
+    Accum prevMax = 0;
+    if (IsShifted<Accum>::value) {
+      Accum threadPrevMax = -INFINITY;
+      for (int n = lane; n < N; n += kWarpSize) {
+        threadPrevMax =
+            alphaPrev[n] > threadPrevMax ? alphaPrev[n] : threadPrevMax;
+      }
+
+      prevMax =
+          WarpReduce(warpStorage[warp]).Reduce(threadPrevMax, cub::Max());
+      prevMax = __shfl_sync(0xffffffff, prevMax, 0);
+      if (threadIdx.x == 0) {
+        logScale += prevMax;
+      }
+    }
+
+    for (int m = warp; m < N; m += kPersistentWarps) {
+      const auto* transCur = &trans[m * N];
+
+      Accum threadMax = -INFINITY;
+      for (int n = lane; n < N; n += kWarpSize) {
+        Accum val = alphaPrev[n] + transCur[n];
+        threadMax = val > threadMax ? val : threadMax;
+      }
+
+      Accum rowMax =
+          WarpReduce(warpStorage[warp]).Reduce(threadMax, cub::Max());
+      rowMax = __shfl_sync(0xffffffff, rowMax, 0);
+
+      Accum threadSum = 0;
+      for (int n = lane; n < N; n += kWarpSize) {
+        threadSum += exp(alphaPrev[n] + transCur[n] - rowMax);
+      }
+
+      Accum rowSum = WarpReduce(warpStorage[warp]).Sum(threadSum);
+      if (lane == 0) {
+        alpha[t * N + m] = alphaCur[m] =
+            log(rowSum) + rowMax - prevMax + input[t * N + m];
+      }
+    }
+
+    __syncthreads();
+
+    auto* tmp = alphaPrev;
+    alphaPrev = alphaCur;
+    alphaCur = tmp;
+  }
+
+  Accum threadMax = -INFINITY;
+  for (int n = threadIdx.x; n < N; n += blockDim.x) {
+    threadMax = alphaPrev[n] > threadMax ? alphaPrev[n] : threadMax;
+  }
+
+  Accum maxResult = BlockReduce(blockStorage).Reduce(threadMax, cub::Max());
+  if (threadIdx.x == 0) {
+    maxValue = maxResult;
+  }
+
+  __syncthreads();
+
+  Accum threadSum = 0;
+  for (int n = threadIdx.x; n < N; n += blockDim.x) {
+    threadSum += exp(alphaPrev[n] - maxValue);
+  }
+
+  Accum sumResult = BlockReduce(blockStorage).Sum(threadSum);
+  if (threadIdx.x == 0) {
+    loss[b] = ws.scale[b] * (log(sumResult) + maxValue + logScale);
+  }
+}
+
+/*
+ * B thread blocks
+ * kPersistentBlockSize threads/block
+ * 2 * N Accum of dynamic shared memory
+ */
+template <class Float, class Accum>
+__global__ void backwardPersistent(
+    int T,
+    int N,
+    const Float* trans,
+    WorkspacePtrs<Float, Accum> ws) {
+  int b = blockIdx.x;
+  int warp = threadIdx.x / kWarpSize;
+  int lane = threadIdx.x % kWarpSize;
+
+  const auto* alpha = &ws.alpha[b * T * N];
+  auto* alphaGrad = &ws.alphaGrad[b * T * N];
+  auto* transBuf = &ws.transBuf[b * N * N];
+  auto* transBatchGrad = &ws.transBatchGrad[b * N * N];
+
+  extern __shared__ __align__(sizeof(double)) unsigned char sharedMemory[];
+  auto* frames = reinterpret_cast<Accum*>(sharedMemory);
+  Accum* alphaPrev = frames;
+  Accum* alphaCurGrad = frames + N;
+
+  using WarpReduce = cub::WarpReduce<Accum>;
+  using BlockReduce = cub::BlockReduce<Accum, kPersistentBlockSize>;
+  __shared__ typename WarpReduce::TempStorage warpStorage[kPersistentWarps];
+  __shared__ typename BlockReduce::TempStorage blockStorage;
+  __shared__ Accum maxValue;
+  __shared__ Accum sumValue;
+
+  // The gradient of the final log-sum-exp is the softmax of the last frame
+  const auto* alphaLast = &alpha[(T - 1) * N];
+
+  Accum threadMax = -INFINITY;
+  for (int n = threadIdx.x; n < N; n += blockDim.x) {
+    threadMax = alphaLast[n] > threadMax ? alphaLast[n] : threadMax;
+  }
+
+  Accum maxResult = BlockReduce(blockStorage).Reduce(threadMax, cub::Max());
+  if (threadIdx.x == 0) {
+    maxValue = maxResult;
+  }
+
+  __syncthreads();
+
+  Accum threadSum = 0;
+  for (int n = threadIdx.x; n < N; n += blockDim.x) {
+    threadSum += exp(alphaLast[n] - maxValue);
+  }
+
+  Accum sumResult = BlockReduce(blockStorage).Sum(threadSum);
+  if (threadIdx.x == 0) {
+    sumValue = sumResult;
+  }
+
+  __syncthreads();
+
+  for (int n = threadIdx.x; n < N; n += blockDim.x) {
+    alphaGrad[(T - 1) * N + n] = alphaCurGrad[n] =
+        exp(alphaLast[n] - maxValue) / sumValue;
+    if (T > 1) {
+      alphaPrev[n] = alpha[(T - 2) * N + n];
+    }
+  }
+
+  __syncthreads();
+
+  for (int t = T - 1; t > 0; --t) {
+    for (int m = warp; m < N; m += kPersistentWarps) {
+      const auto* transCur = &trans[m * N];
+      auto* transBufCur = &transBuf[m * N];
+      auto* transBatchGradCur = &transBatchGrad[m * N];
+
+      Accum rowMax = -INFINITY;
+      for (int n = lane; n < N; n += kWarpSize) {
+        Accum val = transBufCur[n] = alphaPrev[n] + transCur[n];
+        rowMax = val > rowMax ? val : rowMax;
+      }
+
+      rowMax = WarpReduce(warpStorage[warp]).Reduce(rowMax, cub::Max());
+      rowMax = __shfl_sync(0xffffffff, rowMax, 0);
+
+      Accum rowSum = 0;
+      for (int n = lane; n < N; n += kWarpSize) {
+        transBufCur[n] = exp(transBufCur[n] - rowMax);
+        rowSum += transBufCur[n];
+      }
+
+      rowSum = WarpReduce(warpStorage[warp]).Sum(rowSum);
+      rowSum = __shfl_sync(0xffffffff, rowSum, 0);
+
+      for (int n = lane; n < N; n += kWarpSize) {
+        transBufCur[n] = transBufCur[n] / rowSum * alphaCurGrad[m];
+        transBatchGradCur[n] += transBufCur[n];
+      }
+    }
+
+    __syncthreads();
+
+    // Once all the rows are done, sum the columns into the gradient of the
+    // previous frame and load the frame of the next step
+    for (int n = threadIdx.x; n < N; n += blockDim.x) {
+      Accum sum = 0;
+      for (int m = 0; m < N; ++m) {
+        sum += transBuf[m * N + n];
+      }
+      alphaGrad[(t - 1) * N + n] = alphaCurGrad[n] = sum;
+      if (t > 1) {
+        alphaPrev[n] = alpha[(t - 2) * N + n];
+      }
+    }
+
+    __syncthreads();
+  }
+}
+
 } // namespace
 
 namespace w2l {
 namespace cuda {
 
-template <class Float>
-size_t FullConnectionCriterion<Float>::getWorkspaceSize(int B, int T, int N) {
-  return WorkspacePtrs<Float>(nullptr, B, T, N).requiredSize;
+template <class Float, class Accum>
+size_t
+FullConnectionCriterion<Float, Accum>::getWorkspaceSize(int B, int T, int N) {
+  return WorkspacePtrs<Float, Accum>(nullptr, B, T, N).requiredSize;
 }
 
-template <class Float>
-void FullConnectionCriterion<Float>::forward(
+template <class Float, class Accum>
+void FullConnectionCriterion<Float, Accum>::setPersistentMaxN(int maxN) {
+  persistentMaxN<Float, Accum>() = std::min(maxN, kMaxPersistentN);
+}
+
+template <class Float, class Accum>
+void FullConnectionCriterion<Float, Accum>::forward(
     int B,
     int T,
     int N,
@@ -258,9 +552,17 @@ void FullConnectionCriterion<Float>::forward(
     Float* loss,
     void* workspace,
     cudaStream_t stream) {
-  WorkspacePtrs<Float> ws(workspace, B, T, N);
+  WorkspacePtrs<Float, Accum> ws(workspace, B, T, N);
   CriterionUtils<Float>::computeScale(
       B, T, N, scaleMode, targetSize, ws.scale, stream);
+  if (N <= persistentMaxN<Float, Accum>()) {
+    forwardPersistent<<<
+        B,
+        kPersistentBlockSize,
+        2 * N * sizeof(Accum),
+        stream>>>(T, N, input, trans, loss, ws);
+    return;
+  }
   forwardInitial<<<B, kBlockSize, 0, stream>>>(T, N, input, ws);
   for (int t = 1; t < T; ++t) {
     forwardStep<false>
@@ -270,8 +572,8 @@ void FullConnectionCriterion<Float>::forward(
       <<<B, kBlockSize, 0, stream>>>(T, N, T, input, trans, loss, ws);
 }
 
-template <class Float>
-void FullConnectionCriterion<Float>::backward(
+template <class Float, class Accum>
+void FullConnectionCriterion<Float, Accum>::backward(
     int B,
     int T,
     int N,
@@ -281,20 +583,30 @@ void FullConnectionCriterion<Float>::backward(
     Float* transGrad,
     void* workspace,
     cudaStream_t stream) {
-  WorkspacePtrs<Float> ws(workspace, B, T, N);
+  WorkspacePtrs<Float, Accum> ws(workspace, B, T, N);
   setZero(inputGrad, B * T * N, stream);
   setZero(transGrad, N * N, stream);
   setZero(ws.transBatchGrad, B * N * N, stream);
-  backwardStep1<true><<<B, kBlockSize, 0, stream>>>(T, N, T, trans, ws);
-  for (int t = T - 1; t > 0; --t) {
-    backwardStep1<false><<<B * N, kBlockSize, 0, stream>>>(T, N, t, trans, ws);
-    backwardStep2<<<B * N, kBlockSize, 0, stream>>>(T, N, t, ws);
+  if (N <= persistentMaxN<Float, Accum>()) {
+    backwardPersistent<<<
+        B,
+        kPersistentBlockSize,
+        2 * N * sizeof(Accum),
+        stream>>>(T, N, trans, ws);
+  } else {
+    backwardStep1<true><<<B, kBlockSize, 0, stream>>>(T, N, T, trans, ws);
+    for (int t = T - 1; t > 0; --t) {
+      backwardStep1<false>
+          <<<B * N, kBlockSize, 0, stream>>>(T, N, t, trans, ws);
+      backwardStep2<<<B * N, kBlockSize, 0, stream>>>(T, N, t, ws);
+    }
   }
   backwardFinal<<<B, 128, 0, stream>>>(T, N, grad, inputGrad, transGrad, ws);
 }
 
 template struct FullConnectionCriterion<float>;
 template struct FullConnectionCriterion<double>;
+template struct FullConnectionCriterion<float, float>;
 
 } // namespace cuda
 } // namespace w2l
@@ -15,8 +15,16 @@
 namespace w2l {
 namespace cuda {
 
-/// The denominator of ASG loss. Reference: https://arxiv.org/abs/1609.03193
-template <class Float>
+/**
+ * The denominator of ASG loss. Reference: https://arxiv.org/abs/1609.03193
+ *
+ * Float is the type of the inputs and outputs, Accum the one of the forward
+ * and backward recursions. With Accum = float, the recursions are rescaled in
+ * log space at every frame to keep up with double; this halves the workspace
+ * and is faster on GPUs with weak double-precision throughput. The default
+ * double recursions are not rescaled.
+ */
+template <class Float, class Accum = double>
 struct FullConnectionCriterion {
   /**
    * B: batch size
@@ -25,6 +33,16 @@ struct FullConnectionCriterion {
    */
   static size_t getWorkspaceSize(int B, int T, int N);
 
+  /**
+   * Recurse over the frames of dictionaries of up to maxN classes in a single
+   * kernel per pass, with one block per utterance, instead of one or two
+   * kernels per frame over B * N blocks. The single kernel has B blocks only,
+   * so it pays off for small B and N: set the threshold from measurements
+   * (see CriterionBenchmark). 0, the default, always launches per frame, and
+   * maxN is capped at 2048 by the shared memory of the kernel.
+   */
+  static void setPersistentMaxN(int maxN);
+
   /**
    * B: batch size
    * T: input length
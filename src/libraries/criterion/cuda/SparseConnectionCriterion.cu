@@ -0,0 +1,353 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "libraries/criterion/cuda/SparseConnectionCriterion.cuh"
+
+#include <cmath>
+
+#include <cub/cub.cuh>
+
+#include "libraries/common/CudaUtils.cuh"
+#include "libraries/common/Workspace.h"
+#include "libraries/criterion/cuda/CriterionUtils.cuh"
+
+namespace {
+
+// The steps run one warp per class
+constexpr int kWarpSize = 32;
+constexpr int kBlockSize = 256;
+constexpr int kWarps = kBlockSize / kWarpSize;
+
+template <class Float>
+struct WorkspacePtrs {
+  explicit WorkspacePtrs(void* workspace, int B, int T, int N, int K) {
+    w2l::Workspace<> ws(workspace);
+    ws.request(&scale, B);
+    ws.request(&alpha, B, T, N);
+    ws.request(&alphaGrad, B, T, N);
+    ws.request(&transBatchGrad, B, N, K);
+    requiredSize = ws.requiredSize();
+  }
+
+  Float* scale;
+  double* alpha;
+  double* alphaGrad;
+  double* transBatchGrad;
+  size_t requiredSize;
+};
+
+/*
+ * B thread blocks
+ * kBlockSize threads/block
+ */
+template <class Float>
+__global__ void
+forwardInitial(int T, int N, const Float* input, WorkspacePtrs<Float> ws) {
+  int b = blockIdx.x;
+  for (int n = threadIdx.x; n < N; n += blockDim.x) {
+    int k = b * T * N + n;
+    ws.alpha[k] = input[k];
+  }
+}
+
+/*
+ * (N / kWarps) x B thread blocks, rounded up
+ * kBlockSize threads/block
+ */
+template <class Float>
+__global__ void forwardStep(
+    int T,
+    int N,
+    int K,
+    int t,
+    const Float* input,
+    const int* transIndex,
+    const Float* trans,
+    WorkspacePtrs<Float> ws) {
+  int b = blockIdx.y;
+  int warp = threadIdx.x / kWarpSize;
+  int lane = threadIdx.x % kWarpSize;
+  int m = blockIdx.x * kWarps + warp;
+  if (m >= N) {
+    return;
+  }
+
+  const auto* alphaPrev = &ws.alpha[b * T * N + (t - 1) * N];
+  const auto* transIndexCur = &transIndex[m * K];
+  const auto* transCur = &trans[m * K];
+
+  using WarpReduce = cub::WarpReduce<double>;
+  __shared__ typename WarpReduce::TempStorage tempStorage[kWarps];
+
+  double threadMax = -INFINITY;
+  for (int k = lane; k < K; k += kWarpSize) {
+    double val = alphaPrev[transIndexCur[k]] + transCur[k];
+    threadMax = val > threadMax ? val : threadMax;
+  }
+
+  double maxValue =
+      WarpReduce(tempStorage[warp]).Reduce(threadMax, cub::Max());
+  maxValue = __shfl_sync(0xffffffff, maxValue, 0);
+
+  double threadSum = 0;
+  for (int k = lane; k < K; k += kWarpSize) {
+    threadSum += exp(alphaPrev[transIndexCur[k]] + transCur[k] - maxValue);
+  }
+
+  double sumValue = WarpReduce(tempStorage[warp]).Sum(threadSum);
+  if (lane == 0) {
+    int i = b * T * N + t * N + m;
+    ws.alpha[i] = log(sumValue) + maxValue + input[i];
+  }
+}
+
+/*
+ * B thread blocks
+ * kBlockSize threads/block
+ */
+template <class Float>
+__global__ void
+forwardFinal(int T, int N, Float* loss, WorkspacePtrs<Float> ws) {
+  int b = blockIdx.x;
+  const auto* alphaLast = &ws.alpha[b * T * N + (T - 1) * N];
+
+  using BlockReduce = cub::BlockReduce<double, kBlockSize>;
+  __shared__ typename BlockReduce::TempStorage tempStorage;
+  __shared__ double maxValue;
+
+  double threadMax = -INFINITY;
+  for (int n = threadIdx.x; n < N; n += blockDim.x) {
+    threadMax = alphaLast[n] > threadMax ? alphaLast[n] : threadMax;
+  }
+
+  double maxResult = BlockReduce(tempStorage).Reduce(threadMax, cub::Max());
+  if (threadIdx.x == 0) {
+    maxValue = maxResult;
+  }
+
+  __syncthreads();
+
+  double threadSum = 0;
+  for (int n = threadIdx.x; n < N; n += blockDim.x) {
+    threadSum += exp(alphaLast[n] - maxValue);
+  }
+
+  double sumResult = BlockReduce(tempStorage).Sum(threadSum);
+  if (threadIdx.x == 0) {
+    loss[b] = ws.scale[b] * (log(sumResult) + maxValue);
+  }
+}
+
+/*
+ * B thread blocks
+ * kBlockSize threads/block
+ */
+template <class Float>
+__global__ void backwardInitial(int T, int N, WorkspacePtrs<Float> ws) {
+  int b = blockIdx.x;
+  const auto* alphaLast = &ws.alpha[b * T * N + (T - 1) * N];
+  auto* alphaLastGrad = &ws.alphaGrad[b * T * N + (T - 1) * N];
+
+  using BlockReduce = cub::BlockReduce<double, kBlockSize>;
+  __shared__ typename BlockReduce::TempStorage tempStorage;
+  __shared__ double maxValue;
+  __shared__ double sumValue;
+
+  double threadMax = -INFINITY;
+  for (int n = threadIdx.x; n < N; n += blockDim.x) {
+    threadMax = alphaLast[n] > threadMax ? alphaLast[n] : threadMax;
+  }
+
+  double maxResult = BlockReduce(tempStorage).Reduce(threadMax, cub::Max());
+  if (threadIdx.x == 0) {
+    maxValue = maxResult;
+  }
+
+  __syncthreads();
+
+  double threadSum = 0;
+  for (int n = threadIdx.x; n < N; n += blockDim.x) {
+    threadSum += exp(alphaLast[n] - maxValue);
+  }
+
+  double sumResult = BlockReduce(tempStorage).Sum(threadSum);
+  if (threadIdx.x == 0) {
+    sumValue = sumResult;
+  }
+
+  __syncthreads();
+
+  for (int n = threadIdx.x; n < N; n += blockDim.x) {
+    alphaLastGrad[n] = exp(alphaLast[n] - maxValue) / sumValue;
+  }
+}
+
+/*
+ * (N / kWarps) x B thread blocks, rounded up
+ * kBlockSize threads/block
+ */
+template <class Float>
+__global__ void backwardStep(
+    int T,
+    int N,
+    int K,
+    int t,
+    const int* transIndex,
+    const Float* trans,
+    WorkspacePtrs<Float> ws) {
+  int b = blockIdx.y;
+  int warp = threadIdx.x / kWarpSize;
+  int lane = threadIdx.x % kWarpSize;
+  int m = blockIdx.x * kWarps + warp;
+  if (m >= N) {
+    return;
+  }
+
+  const auto* alphaPrev = &ws.alpha[b * T * N + (t - 1) * N];
+  const auto* alphaCurGrad = &ws.alphaGrad[b * T * N + t * N];
+  auto* alphaPrevGrad = &ws.alphaGrad[b * T * N + (t - 1) * N];
+  auto* transBatchGrad = &ws.transBatchGrad[b * N * K + m * K];
+  const auto* transIndexCur = &transIndex[m * K];
+  const auto* transCur = &trans[m * K];
+
+  using WarpReduce = cub::WarpReduce<double>;
+  __shared__ typename WarpReduce::TempStorage tempStorage[kWarps];
+
+  double threadMax = -INFINITY;
+  for (int k = lane; k < K; k += kWarpSize) {
+    double val = alphaPrev[transIndexCur[k]] + transCur[k];
+    threadMax = val > threadMax ? val : threadMax;
+  }
+
+  double maxValue =
+      WarpReduce(tempStorage[warp]).Reduce(threadMax, cub::Max());
+  maxValue = __shfl_sync(0xffffffff, maxValue, 0);
+
+  double threadSum = 0;
+  for (int k = lane; k < K; k += kWarpSize) {
+    threadSum += exp(alphaPrev[transIndexCur[k]] + transCur[k] - maxValue);
+  }
+
+  double sumValue = WarpReduce(tempStorage[warp]).Sum(threadSum);
+  sumValue = __shfl_sync(0xffffffff, sumValue, 0);
+
+  // Several classes are reached from the same one, hence the atomics
+  for (int k = lane; k < K; k += kWarpSize) {
+    int n = transIndexCur[k];
+    double val = exp(alphaPrev[n] + transCur[k] - maxValue) / sumValue *
+        alphaCurGrad[m];
+    transBatchGrad[k] += val;
+    atomicAdd(&alphaPrevGrad[n], val);
+  }
+}
+
+/*
+ * B thread blocks
+ * 128 threads/block
+ */
+template <class Float>
+__global__ void backwardFinal(
+    int T,
+    int N,
+    int K,
+    const Float* _grad,
+    Float* _inputGrad,
+    Float* transGrad,
+    WorkspacePtrs<Float> ws) {
+  int b = blockIdx.x;
+
+  auto* alphaGrad = &ws.alphaGrad[b * T * N];
+  auto* inputGrad = &_inputGrad[b * T * N];
+  auto* transBatchGrad = &ws.transBatchGrad[b * N * K];
+
+  __shared__ Float gradScale;
+
+  if (threadIdx.x == 0) {
+    gradScale = ws.scale[b] * _grad[b];
+  }
+
+  __syncthreads();
+
+  for (int i = threadIdx.x; i < T * N; i += blockDim.x) {
+    inputGrad[i] = gradScale * alphaGrad[i];
+  }
+
+  for (int i = threadIdx.x; i < N * K; i += blockDim.x) {
+    atomicAdd(&transGrad[i], gradScale * transBatchGrad[i]);
+  }
+}
+
+} // namespace
+
+namespace w2l {
+namespace cuda {
+
+template <class Float>
+size_t
+SparseConnectionCriterion<Float>::getWorkspaceSize(int B, int T, int N, int K) {
+  return WorkspacePtrs<Float>(nullptr, B, T, N, K).requiredSize;
+}
+
+template <class Float>
+void SparseConnectionCriterion<Float>::forward(
+    int B,
+    int T,
+    int N,
+    int K,
+    CriterionScaleMode scaleMode,
+    const Float* input,
+    const int* targetSize,
+    const int* transIndex,
+    const Float* trans,
+    Float* loss,
+    void* workspace,
+    cudaStream_t stream) {
+  WorkspacePtrs<Float> ws(workspace, B, T, N, K);
+  CriterionUtils<Float>::computeScale(
+      B, T, N, scaleMode, targetSize, ws.scale, stream);
+  dim3 steps((N + kWarps - 1) / kWarps, B);
+  forwardInitial<<<B, kBlockSize, 0, stream>>>(T, N, input, ws);
+  for (int t = 1; t < T; ++t) {
+    forwardStep<<<steps, kBlockSize, 0, stream>>>(
+        T, N, K, t, input, transIndex, trans, ws);
+  }
+  forwardFinal<<<B, kBlockSize, 0, stream>>>(T, N, loss, ws);
+}
+
+template <class Float>
+void SparseConnectionCriterion<Float>::backward(
+    int B,
+    int T,
+    int N,
+    int K,
+    const int* transIndex,
+    const Float* trans,
+    const Float* grad,
+    Float* inputGrad,
+    Float* transGrad,
+    void* workspace,
+    cudaStream_t stream) {
+  WorkspacePtrs<Float> ws(workspace, B, T, N, K);
+  setZero(transGrad, N * K, stream);
+  setZero(ws.alphaGrad, B * T * N, stream);
+  setZero(ws.transBatchGrad, B * N * K, stream);
+  dim3 steps((N + kWarps - 1) / kWarps, B);
+  backwardInitial<<<B, kBlockSize, 0, stream>>>(T, N, ws);
+  for (int t = T - 1; t > 0; --t) {
+    backwardStep<<<steps, kBlockSize, 0, stream>>>(
+        T, N, K, t, transIndex, trans, ws);
+  }
+  backwardFinal<<<B, 128, 0, stream>>>(
+      T, N, K, grad, inputGrad, transGrad, ws);
+}
+
+template struct SparseConnectionCriterion<float>;
+template struct SparseConnectionCriterion<double>;
+
+} // namespace cuda
+} // namespace w2l
@@ -0,0 +1,89 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cuda_runtime.h>
+
+#include "libraries/criterion/Defines.h"
+
+namespace w2l {
+namespace cuda {
+
+/**
+ * FullConnectionCriterion with K transitions into each class: class m is
+ * reached from classes transIndex[m][0..K) only, which costs O(T * N * K)
+ * rather than O(T * N * N).
+ */
+template <class Float>
+struct SparseConnectionCriterion {
+  /**
+   * B: batch size
+   * T: input length
+   * N: dictionary size
+   * K: transitions into each class
+   */
+  static size_t getWorkspaceSize(int B, int T, int N, int K);
+
+  /**
+   * B: batch size
+   * T: input length
+   * N: dictionary size
+   * K: transitions into each class
+   * scaleMode: type of size scaling
+   * input: [B][T][N] input frames from network
+   * targetSize: [B] target sizes (may be null if not needed for scaleMode)
+   * transIndex: [N][K] classes from which each class is reached, distinct
+   * trans: [N][K] transition scores, trans[m][k] from transIndex[m][k] to m
+   * loss: [B] (out) loss value
+   * workspace: (in/out) internal workspace
+   * stream: CUDA stream
+   */
+  static void forward(
+      int B,
+      int T,
+      int N,
+      int K,
+      CriterionScaleMode scaleMode,
+      const Float* input,
+      const int* targetSize,
+      const int* transIndex,
+      const Float* trans,
+      Float* loss,
+      void* workspace,
+      cudaStream_t stream);
+
+  /**
+   * B: batch size
+   * T: input length
+   * N: dictionary size
+   * K: transitions into each class
+   * transIndex: [N][K] classes from which each class is reached
+   * trans: [N][K] transition scores
+   * grad: [B] gradient w.r.t. loss
+   * inputGrad: [B][T][N] (out) gradient w.r.t. input
+   * transGrad: [N][K] (out) gradient w.r.t transitions
+   * workspace: (in/out) internal workspace from forward
+   * stream: CUDA stream
+   */
+  static void backward(
+      int B,
+      int T,
+      int N,
+      int K,
+      const int* transIndex,
+      const Float* trans,
+      const Float* grad,
+      Float* inputGrad,
+      Float* transGrad,
+      void* workspace,
+      cudaStream_t stream);
+};
+
+} // namespace cuda
+} // namespace w2l
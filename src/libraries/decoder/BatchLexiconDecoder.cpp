@@ -0,0 +1,164 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+#include "libraries/decoder/BatchLexiconDecoder.h"
+
+namespace w2l {
+
+BatchLexiconDecoder::BatchLexiconDecoder(
+    const DecoderOptions& opt,
+    const FlatTriePtr& lexicon,
+    const LMPtr& lm,
+    const int sil,
+    const int blank,
+    const int unk,
+    const std::vector<float>& transitions,
+    const bool isLmToken,
+    const int batchSize)
+    : lm_(lm) {
+  if (batchSize < 1) {
+    throw std::invalid_argument(
+        "[BatchLexiconDecoder] Invalid batch size: " +
+        std::to_string(batchSize));
+  }
+  streams_.reserve(batchSize);
+  for (int b = 0; b < batchSize; b++) {
+    streams_.emplace_back(
+        opt, lexicon, lm, sil, blank, unk, transitions, isLmToken);
+  }
+}
+
+void BatchLexiconDecoder::decodeBegin() {
+  for (auto& decoder : streams_) {
+    decoder.decodeBegin();
+  }
+}
+
+void BatchLexiconDecoder::decodeStep(
+    const std::vector<const float*>& emissions,
+    const std::vector<int>& T,
+    int N) {
+  if (emissions.size() != streams_.size() || T.size() != streams_.size()) {
+    throw std::invalid_argument(
+        "[BatchLexiconDecoder] Expected emissions for " +
+        std::to_string(streams_.size()) + " streams");
+  }
+
+  int maxT = 0;
+  for (int b = 0; b < streams_.size(); b++) {
+    auto& decoder = streams_[b];
+    // Extend hyp_ buffer
+    decoder.hyp_.reserveFrames(
+        decoder.nDecodedFrames_ - decoder.nPrunedFrames_ + T[b] + 2);
+    maxT = std::max(maxT, T[b]);
+  }
+
+  for (int t = 0; t < maxT; t++) {
+    lmStates_.clear();
+    for (int b = 0; b < streams_.size(); b++) {
+      auto& decoder = streams_[b];
+      if (t < T[b]) {
+        decoder.decodeFrame(emissions[b] + t * N, N);
+      }
+      // Finished streams keep their states cached for `decodeEnd()`
+      for (const auto& hyp :
+           decoder.hyp_[decoder.nDecodedFrames_ - decoder.nPrunedFrames_]) {
+        lmStates_.emplace_back(hyp.lmState);
+      }
+    }
+    lm_->updateCache(lmStates_);
+  }
+
+  for (auto& decoder : streams_) {
+    decoder.stats_.updatePeakBytes(
+        decoder.hyp_.bytes() + decoder.candidates_.bytes());
+    decoder.reportStableWords();
+  }
+}
+
+void BatchLexiconDecoder::decodeEnd() {
+  for (auto& decoder : streams_) {
+    decoder.decodeEnd();
+  }
+}
+
+std::vector<std::vector<DecodeResult>> BatchLexiconDecoder::decode(
+    const std::vector<const float*>& emissions,
+    const std::vector<int>& T,
+    int N) {
+  decodeBegin();
+  decodeStep(emissions, T, N);
+  decodeEnd();
+
+  std::vector<std::vector<DecodeResult>> results(streams_.size());
+  for (int b = 0; b < streams_.size(); b++) {
+    results[b] = streams_[b].getAllFinalHypothesis();
+  }
+  return results;
+}
+
+void BatchLexiconDecoder::prune(int lookBack) {
+  for (auto& decoder : streams_) {
+    decoder.prune(lookBack);
+  }
+}
+
+int BatchLexiconDecoder::nDecodedFramesInBuffer(int stream) const {
+  return getStream(stream).nDecodedFramesInBuffer();
+}
+
+DecodeResult BatchLexiconDecoder::getBestHypothesis(
+    int stream,
+    int lookBack) const {
+  return getStream(stream).getBestHypothesis(lookBack);
+}
+
+CompactDecodeResult BatchLexiconDecoder::getBestCompactHypothesis(
+    int stream,
+    int lookBack) const {
+  return getStream(stream).getBestCompactHypothesis(lookBack);
+}
+
+std::vector<DecodeResult> BatchLexiconDecoder::getAllFinalHypothesis(
+    int stream) const {
+  return getStream(stream).getAllFinalHypothesis();
+}
+
+DecodeResult BatchLexiconDecoder::getStablePrefix(int stream) const {
+  return getStream(stream).getStablePrefix();
+}
+
+WordLattice BatchLexiconDecoder::getLattice(int stream) const {
+  return getStream(stream).getLattice();
+}
+
+void BatchLexiconDecoder::setStableWordsCallback(
+    int stream,
+    const StableWordsCallback& callback) {
+  getStream(stream);
+  streams_[stream].setStableWordsCallback(callback);
+}
+
+const DecoderStats& BatchLexiconDecoder::stats(int stream) const {
+  return getStream(stream).stats();
+}
+
+const LexiconDecoder& BatchLexiconDecoder::getStream(int stream) const {
+  if (stream < 0 || stream >= streams_.size()) {
+    throw std::out_of_range(
+        "[BatchLexiconDecoder] Invalid stream index: " +
+        std::to_string(stream));
+  }
+  return streams_[stream];
+}
+
+} // namespace w2l
@@ -0,0 +1,96 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include "libraries/decoder/LexiconDecoder.h"
+
+namespace w2l {
+/**
+ * BatchLexiconDecoder runs the LexiconDecoder search on B independent
+ * utterances (streams) advanced frame by frame in lockstep. All the streams
+ * share the same lexicon and LM, and after each frame the LM cache is updated
+ * once with the hypothesis of all the streams, so that batched LMs (e.g.
+ * ConvLM) forward them together instead of stream by stream.
+ *
+ * Streams may have different lengths: a stream is simply not expanded any more
+ * once its emissions are consumed. Usage is the same as for `Decoder`, except
+ * that emissions are given per stream and results are queried per stream.
+ *
+ * Note: the LM cache (e.g. `lmMemory` and `beamSize` of ConvLM) must be large
+ * enough to hold the hypothesis of all the streams of one frame.
+ */
+class BatchLexiconDecoder {
+ public:
+  BatchLexiconDecoder(
+      const DecoderOptions& opt,
+      const FlatTriePtr& lexicon,
+      const LMPtr& lm,
+      const int sil,
+      const int blank,
+      const int unk,
+      const std::vector<float>& transitions,
+      const bool isLmToken,
+      const int batchSize);
+
+  int batchSize() const {
+    return streams_.size();
+  }
+
+  /* Initialize all the streams before starting consume emissions */
+  void decodeBegin();
+
+  /*
+   * Consume emissions of all the streams, `emissions[b]` holding `T[b]` x N
+   * values for stream b
+   */
+  void decodeStep(
+      const std::vector<const float*>& emissions,
+      const std::vector<int>& T,
+      int N);
+
+  /* Finish up decoding of all the streams */
+  void decodeEnd();
+
+  /* Offline decode function, returns all the final hypothesis of each stream */
+  std::vector<std::vector<DecodeResult>> decode(
+      const std::vector<const float*>& emissions,
+      const std::vector<int>& T,
+      int N);
+
+  /* Prune the hypothesis space of all the streams */
+  void prune(int lookBack = 0);
+
+  int nDecodedFramesInBuffer(int stream) const;
+
+  DecodeResult getBestHypothesis(int stream, int lookBack = 0) const;
+
+  CompactDecodeResult getBestCompactHypothesis(int stream, int lookBack = 0)
+      const;
+
+  std::vector<DecodeResult> getAllFinalHypothesis(int stream) const;
+
+  DecodeResult getStablePrefix(int stream) const;
+
+  WordLattice getLattice(int stream) const;
+
+  void setStableWordsCallback(int stream, const StableWordsCallback& callback);
+
+  const DecoderStats& stats(int stream) const;
+
+ private:
+  LMPtr lm_;
+  std::vector<LexiconDecoder> streams_;
+
+  // LM states of the last frame of all the streams, to update the LM cache
+  std::vector<LMStatePtr> lmStates_;
+
+  const LexiconDecoder& getStream(int stream) const;
+};
+
+} // namespace w2l
@@ -0,0 +1,72 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "libraries/decoder/BiasingTrie.h"
+
+namespace w2l {
+
+BiasingTrie::BiasingTrie() : nodes_(1, Node{{}, -1, 0, false}) {}
+
+void BiasingTrie::insert(const std::vector<int>& phrase, float bonus) {
+  if (phrase.empty()) {
+    throw std::invalid_argument("[BiasingTrie] Empty phrase");
+  }
+  int node = 0;
+  for (const int word : phrase) {
+    auto& children = nodes_[node].children;
+    auto it = std::lower_bound(
+        children.begin(), children.end(), std::make_pair(word, -1));
+    if (it != children.end() && it->first == word) {
+      node = it->second;
+      nodes_[node].bonus = std::max(nodes_[node].bonus, bonus);
+      continue;
+    }
+    const int child = nodes_.size();
+    children.insert(it, std::make_pair(word, child));
+    nodes_.push_back(Node{{}, node, bonus, false});
+    node = child;
+  }
+  nodes_[node].isEnd = true;
+}
+
+std::pair<int, float> BiasingTrie::next(int state, int word) const {
+  float score = 0;
+  while (true) {
+    const int child = findChild(state, word);
+    if (child >= 0) {
+      // Start over once the longest phrase is complete
+      int nextState = nodes_[child].children.empty() ? 0 : child;
+      return std::make_pair(nextState, score + nodes_[child].bonus);
+    } else if (state == 0) {
+      return std::make_pair(0, score);
+    }
+    // Leave the phrase, the word may start another one
+    score -= pending(state);
+    state = 0;
+  }
+}
+
+int BiasingTrie::findChild(int node, int word) const {
+  const auto& children = nodes_[node].children;
+  auto it = std::lower_bound(
+      children.begin(), children.end(), std::make_pair(word, -1));
+  return it != children.end() && it->first == word ? it->second : -1;
+}
+
+float BiasingTrie::pending(int node) const {
+  float total = 0;
+  for (; node > 0 && !nodes_[node].isEnd; node = nodes_[node].parent) {
+    total += nodes_[node].bonus;
+  }
+  return total;
+}
+
+} // namespace w2l
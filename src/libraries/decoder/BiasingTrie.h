@@ -0,0 +1,70 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace w2l {
+
+/**
+ * BiasingTrie boosts a few phrases (sequences of words, e.g. the contact names
+ * of a user) in a LexiconDecoder, on top of the shared lexicon trie and LM,
+ * which are left untouched: it is built for a session in microseconds instead
+ * of rebuilding the LM.
+ *
+ * The phrases are stored in a trie on the words, whose nodes are the biasing
+ * states of the hypothesis, 0 being the root. Each word completed along a
+ * phrase gets the bonus of the phrase (the best one, for words shared by
+ * several phrases), and the bonuses of a phrase left unfinished are taken
+ * back, so that only the complete phrases are boosted.
+ */
+class BiasingTrie {
+ public:
+  BiasingTrie();
+
+  /* Boost each word of `phrase` by `bonus`, once the phrase is complete */
+  void insert(const std::vector<int>& phrase, float bonus);
+
+  /**
+   * The state after `word` from `state`, and the bonus to add to the score of
+   * the hypothesis (negative when an unfinished phrase is left).
+   */
+  std::pair<int, float> next(int state, int word) const;
+
+  /* The bonus to add to a hypothesis ending in `state` */
+  float finish(int state) const {
+    return -pending(state);
+  }
+
+  int nNodes() const {
+    return nodes_.size();
+  }
+
+ private:
+  struct Node {
+    std::vector<std::pair<int, int>> children; // (word, node), sorted by word
+    int parent;
+    float bonus; // Bonus of the word leading to the node
+    bool isEnd; // A phrase ends at the node
+  };
+
+  std::vector<Node> nodes_;
+
+  /* The child of `node` for `word`, or -1 if missing */
+  int findChild(int node, int word) const;
+
+  /* The bonuses given since the last complete phrase of the path to `node` */
+  float pending(int node) const;
+};
+
+using BiasingTriePtr = std::shared_ptr<const BiasingTrie>;
+
+} // namespace w2l
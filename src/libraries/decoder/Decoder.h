@@ -31,7 +31,7 @@ namespace w2l {
  */
 class Decoder {
  public:
-  explicit Decoder(const DecoderOptions& opt) : opt_(opt) {}
+  explicit Decoder(const DecoderOptions& opt) : opt_(opt), beam_(opt) {}
   virtual ~Decoder() = default;
 
   /* Initialize decoder before starting consume emissions */
@@ -52,6 +52,59 @@ class Decoder {
     return getAllFinalHypothesis();
   }
 
+  /**
+   * Consume sparse emissions (see SparseEmissions) frame by frame. Each frame
+   * is expanded into a row of N scores, the tokens not listed scoring the
+   * floor of the frame, and only the listed tokens of the frame are expanded
+   * instead of the `beamSizeToken` best ones of the row.
+   */
+  virtual void decodeSparseStep(const SparseEmissions& emissions) {
+    frame_.resize(emissions.N);
+    try {
+      for (int t = 0; t < emissions.T; t++) {
+        emissions.densify(t, frame_.data());
+        sparseTokens_ = emissions.tokens.data() + emissions.offsets[t];
+        nSparseTokens_ = emissions.offsets[t + 1] - emissions.offsets[t];
+        decodeStep(frame_.data(), 1, emissions.N);
+      }
+    } catch (...) {
+      nSparseTokens_ = -1;
+      throw;
+    }
+    nSparseTokens_ = -1;
+  }
+
+  /* Offline decode function for sparse emissions */
+  std::vector<DecodeResult> decodeSparse(const SparseEmissions& emissions) {
+    decodeBegin();
+    decodeSparseStep(emissions);
+    decodeEnd();
+    return getAllFinalHypothesis();
+  }
+
+  /**
+   * Consume T x N emissions stored as half-precision floats, e.g. mapped from
+   * an emission file, without a full-precision copy: each frame is converted
+   * into a row of N floats, which stays in cache, and decoded as decodeStep()
+   * would.
+   */
+  virtual void decodeHalfStep(const uint16_t* emissions, int T, int N) {
+    frame_.resize(N);
+    for (int t = 0; t < T; t++) {
+      halvesToFloats(emissions + static_cast<size_t>(t) * N, N, frame_.data());
+      decodeStep(frame_.data(), 1, N);
+    }
+  }
+
+  /* Offline decode function for half-precision emissions */
+  std::vector<DecodeResult>
+  decodeHalf(const uint16_t* emissions, int T, int N) {
+    decodeBegin();
+    decodeHalfStep(emissions, T, N);
+    decodeEnd();
+    return getAllFinalHypothesis();
+  }
+
   /* Prune the hypothesis space */
   virtual void prune(int lookBack = 0) = 0;
 
@@ -65,11 +118,54 @@ class Decoder {
    */
   virtual DecodeResult getBestHypothesis(int lookBack = 0) const = 0;
 
+  /*
+   * Same as `getBestHypothesis()`, but only storing the frames where tokens
+   * change and words are emitted
+   */
+  virtual CompactDecodeResult getBestCompactHypothesis(int lookBack = 0) const {
+    return CompactDecodeResult(getBestHypothesis(lookBack));
+  }
+
   /* Get all the final hypothesis */
   virtual std::vector<DecodeResult> getAllFinalHypothesis() const = 0;
 
+  /* Counters of the work done on the current (or last) input */
+  const DecoderStats& stats() const {
+    return stats_;
+  }
+
  protected:
   DecoderOptions opt_;
+  // Beam threshold, adapted step by step if enabled in the options
+  AdaptiveBeam beam_;
+  DecoderStats stats_;
+
+  /**
+   * The tokens to expand for the frame `emissions[0..N)`: its listed tokens
+   * when decoding sparse emissions, its `beamSizeToken` best ones otherwise
+   * (see selectTopTokens).
+   */
+  void selectTokens(const float* emissions, int N, std::vector<size_t>& idx)
+      const {
+    if (nSparseTokens_ < 0) {
+      selectTopTokens(emissions, N, opt_.beamSizeToken, idx);
+      return;
+    }
+    idx.assign(
+        sparseTokens_,
+        sparseTokens_ + std::min(nSparseTokens_, opt_.beamSizeToken));
+    // As selectTopTokens, keep the index order if all the tokens are kept
+    if (static_cast<int>(idx.size()) >= N) {
+      std::sort(idx.begin(), idx.end());
+    }
+  }
+
+ private:
+  // Frame of sparse or half-precision emissions being decoded, and its listed
+  // tokens if any
+  std::vector<float> frame_;
+  const int* sparseTokens_ = nullptr;
+  int nSparseTokens_ = -1;
 };
 
 } // namespace w2l
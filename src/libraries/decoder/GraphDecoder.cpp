@@ -0,0 +1,319 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <functional>
+
+#include "libraries/decoder/GraphDecoder.h"
+
+namespace w2l {
+
+void GraphDecoder::candidatesReset() {
+  beam_.stepBegin();
+  candidatesBestScore_ = kNegativeInfinity;
+  candidates_.clear();
+  candidatePtrs_.clear();
+  candidatesIndex_.clear();
+}
+
+void GraphDecoder::candidatesAdd(
+    const SearchGraphNode* node,
+    const GraphDecoderState* parent,
+    const double score,
+    const double lmScore,
+    const int token,
+    const int word,
+    const bool prevBlank) {
+  ++stats_.candidates;
+  if (!isValidCandidate(candidatesBestScore_, score, beam_.threshold())) {
+    return;
+  }
+
+  /* Merge hypothesis getting into the same state from different paths */
+  size_t hash = hashCombine(
+      std::hash<const SearchGraphNode*>()(node), 2 * token + prevBlank);
+  int position = candidatesIndex_.findOrInsert(
+      hash, candidates_.size(), [&](const int idx) {
+        const GraphDecoderState& candidate = candidates_[idx];
+        return candidate.node == node && candidate.token == token &&
+            candidate.prevBlank == prevBlank;
+      });
+  if (position < 0) {
+    candidates_.emplace_back(
+        node, parent, score, lmScore, token, word, prevBlank);
+    return;
+  }
+
+  ++stats_.merged;
+  GraphDecoderState& merged = candidates_[position];
+  GraphDecoderState proposed(
+      node, parent, score, lmScore, token, word, prevBlank);
+  if (proposed.score > merged.score) {
+    // Keep the path of the best scoring hypothesis
+    std::swap(merged, proposed);
+  }
+  mergeStates(&merged, &proposed, opt_.logAdd);
+  candidates_.updateScore(position);
+}
+
+void GraphDecoder::candidatesStore(
+    std::vector<GraphDecoderState>& nextHyp,
+    const bool returnSorted) {
+  if (candidates_.empty()) {
+    nextHyp.clear();
+    return;
+  }
+
+  /* Select valid candidates (already merged in `candidatesAdd()`) */
+  beam_.stepEnd(candidates_.scores(), candidates_.size(), candidatesBestScore_);
+  pruneCandidates(
+      candidatePtrs_, candidates_, candidatesBestScore_ - beam_.threshold());
+
+  /* Sort hypothesis and select top-K */
+  storeTopCandidates(
+      nextHyp, candidates_, candidatePtrs_, opt_.beamSize, returnSorted);
+  stats_.stored += nextHyp.size();
+}
+
+void GraphDecoder::decodeBegin() {
+  beam_.reset();
+  stats_ = DecoderStats();
+  hyp_.clear();
+  hyp_.reserveFrames(2);
+  hyp_[0].emplace_back(graph_->getStart(), nullptr, 0.0, 0.0, sil_, -1);
+  nDecodedFrames_ = 0;
+  nPrunedFrames_ = 0;
+}
+
+void GraphDecoder::decodeStep(const float* emissions, int T, int N) {
+  // Extend hyp_ buffer
+  hyp_.reserveFrames(nDecodedFrames_ - nPrunedFrames_ + T + 2);
+
+  for (int t = 0; t < T; t++) {
+    decodeFrame(emissions + t * N, N);
+  }
+  stats_.updatePeakBytes(hyp_.bytes() + candidates_.bytes());
+}
+
+void GraphDecoder::decodeFrame(const float* emissions, int N) {
+  const int frame = nDecodedFrames_ - nPrunedFrames_;
+  const bool isCtc = opt_.criterionType == CriterionType::CTC;
+  const bool isAsg = opt_.criterionType == CriterionType::ASG;
+
+  // A blank frame only goes through the blank transition (3)
+  const bool blankOnly = isBlankFrame(emissions, blank_, opt_);
+  if (blankOnly) {
+    tokenIdx_.clear();
+  } else {
+    selectTokens(emissions, N, tokenIdx_);
+  }
+
+  candidatesReset();
+  for (const GraphDecoderState& prevHyp : hyp_[frame]) {
+    const SearchGraphNode* prevNode = prevHyp.node;
+    const int prevIdx = prevHyp.token;
+
+    /* (0) The nodes to take arcs from: the backoff roots at a boundary */
+    sources_.assign(1, std::make_pair(prevNode, 0.0f));
+    if (!tokenIdx_.empty() && graph_->isRoot(prevNode)) {
+      const SearchGraphNode* node = prevNode;
+      float backoffWeight = 0;
+      while (const SearchGraphNode* backoff = graph_->getBackoff(node)) {
+        backoffWeight += graph_->getRoot(node).backoffWeight;
+        sources_.emplace_back(backoff, backoffWeight);
+        node = backoff;
+      }
+    }
+
+    /* (1) Try children */
+    for (const auto& source : sources_) {
+      for (const int n : tokenIdx_) {
+        const SearchGraphArc* arc = graph_->findArc(source.first, n);
+        if (!arc) {
+          continue;
+        }
+        ++stats_.trieExpansions;
+        const SearchGraphNode* node = graph_->getNode(arc->next);
+        double score = prevHyp.score + emissions[n];
+        if (nDecodedFrames_ > 0 && isAsg) {
+          score += transitions_.from(prevIdx)[n];
+        }
+        if (n == sil_) {
+          score += opt_.silScore;
+        }
+        const float lmScore = source.second + arc->weight;
+
+        // We eat-up a new token
+        if ((!isCtc || prevHyp.prevBlank || n != prevIdx) && node->nArcs > 0) {
+          candidatesAdd(
+              node,
+              &prevHyp,
+              score + opt_.lmWeight * lmScore,
+              prevHyp.lmScore + opt_.lmWeight * lmScore,
+              n,
+              -1,
+              false // prevBlank
+          );
+        }
+
+        // If we got a true word
+        const SearchGraphWord* words = graph_->words(node);
+        for (int i = 0; i < node->nWords; i++) {
+          const float wordLmScore = lmScore + words[i].weight;
+          candidatesAdd(
+              graph_->getNode(words[i].next),
+              &prevHyp,
+              score + opt_.lmWeight * wordLmScore + opt_.wordScore,
+              prevHyp.lmScore + opt_.lmWeight * wordLmScore + opt_.wordScore,
+              n,
+              words[i].word,
+              false // prevBlank
+          );
+        }
+      }
+    }
+
+    /* (2) Try same node */
+    if (!blankOnly && (!isCtc || !prevHyp.prevBlank)) {
+      int n = prevIdx;
+      double score = prevHyp.score + emissions[n];
+      if (nDecodedFrames_ > 0 && isAsg) {
+        score += transitions_.from(prevIdx)[n];
+      }
+      if (n == sil_) {
+        score += opt_.silScore;
+      }
+
+      candidatesAdd(
+          prevNode,
+          &prevHyp,
+          score,
+          prevHyp.lmScore,
+          n,
+          -1,
+          false // prevBlank
+      );
+    }
+
+    /* (3) CTC only, try blank */
+    if (isCtc) {
+      int n = blank_;
+      double score = prevHyp.score + emissions[n];
+      candidatesAdd(
+          prevNode,
+          &prevHyp,
+          score,
+          prevHyp.lmScore,
+          n,
+          -1,
+          true // prevBlank
+      );
+    }
+    // finish proposing
+  }
+
+  candidatesStore(hyp_[frame + 1], false);
+  ++nDecodedFrames_;
+  ++stats_.frames;
+}
+
+void GraphDecoder::decodeEnd() {
+  candidatesReset();
+  const auto& lastHyp = hyp_[nDecodedFrames_ - nPrunedFrames_];
+  bool hasNiceEnding = false;
+  for (const GraphDecoderState& prevHyp : lastHyp) {
+    if (graph_->isRoot(prevHyp.node)) {
+      hasNiceEnding = true;
+      break;
+    }
+  }
+  for (const GraphDecoderState& prevHyp : lastHyp) {
+    if (!hasNiceEnding || graph_->isRoot(prevHyp.node)) {
+      const float lmScore = graph_->getRoot(prevHyp.node).finalWeight;
+      candidatesAdd(
+          prevHyp.node,
+          &prevHyp,
+          prevHyp.score + opt_.lmWeight * lmScore,
+          prevHyp.lmScore + opt_.lmWeight * lmScore,
+          sil_,
+          -1,
+          false // prevBlank
+      );
+    }
+  }
+
+  candidatesStore(hyp_[nDecodedFrames_ - nPrunedFrames_ + 1], true);
+  ++nDecodedFrames_;
+}
+
+std::vector<DecodeResult> GraphDecoder::getAllFinalHypothesis() const {
+  int finalFrame = nDecodedFrames_ - nPrunedFrames_;
+  if (finalFrame < 1) {
+    return std::vector<DecodeResult>{};
+  }
+
+  return getAllHypothesis(hyp_[finalFrame], finalFrame);
+}
+
+DecodeResult GraphDecoder::getBestHypothesis(int lookBack) const {
+  if (nDecodedFrames_ - nPrunedFrames_ - lookBack < 1) {
+    return DecodeResult();
+  }
+
+  const GraphDecoderState* bestNode =
+      findBestAncestor(hyp_[nDecodedFrames_ - nPrunedFrames_], lookBack);
+  return getHypothesis(bestNode, nDecodedFrames_ - nPrunedFrames_ - lookBack);
+}
+
+CompactDecodeResult GraphDecoder::getBestCompactHypothesis(
+    int lookBack) const {
+  if (nDecodedFrames_ - nPrunedFrames_ - lookBack < 1) {
+    return CompactDecodeResult();
+  }
+
+  const GraphDecoderState* bestNode =
+      findBestAncestor(hyp_[nDecodedFrames_ - nPrunedFrames_], lookBack);
+  return getCompactHypothesis(
+      bestNode, nDecodedFrames_ - nPrunedFrames_ - lookBack);
+}
+
+int GraphDecoder::nHypothesis() const {
+  int finalFrame = nDecodedFrames_ - nPrunedFrames_;
+  return hyp_[finalFrame].size();
+}
+
+int GraphDecoder::nDecodedFramesInBuffer() const {
+  return nDecodedFrames_ - nPrunedFrames_ + 1;
+}
+
+void GraphDecoder::prune(int lookBack) {
+  if (nDecodedFrames_ - nPrunedFrames_ - lookBack < 1) {
+    return; // Not enough decoded frames to prune
+  }
+
+  /* (1) Find the last emitted word in the best path */
+  const GraphDecoderState* bestNode =
+      findBestAncestor(hyp_[nDecodedFrames_ - nPrunedFrames_], lookBack);
+  if (!bestNode) {
+    return; // Not enough decoded frames to prune
+  }
+
+  int startFrame = nDecodedFrames_ - nPrunedFrames_ - lookBack;
+  if (startFrame < 1) {
+    return; // Not enough decoded frames to prune
+  }
+
+  /* (2) Move things from back of hyp_ to front and normalize scores */
+  pruneAndNormalize(hyp_, startFrame, lookBack);
+
+  /* (3) Release the frames which will not be back-tracked any more at once */
+  hyp_.release(lookBack + 1);
+
+  nPrunedFrames_ = nDecodedFrames_ - lookBack;
+}
+
+} // namespace w2l
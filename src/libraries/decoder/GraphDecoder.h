@@ -0,0 +1,175 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <utility>
+#include <vector>
+
+#include "libraries/decoder/Decoder.h"
+#include "libraries/decoder/SearchGraph.h"
+
+namespace w2l {
+/**
+ * GraphDecoderState stores information for each hypothesis in the beam.
+ */
+struct GraphDecoderState {
+  const SearchGraphNode* node; // Node in the search graph
+  const GraphDecoderState* parent; // Parent hypothesis
+  double score; // Score so far
+  double lmScore; // Part of the score from the LM and word insertions
+  int token; // Label of token
+  int word; // Label of word (-1 if incomplete)
+  bool prevBlank; // If previous hypothesis is blank (for CTC only)
+
+  GraphDecoderState(
+      const SearchGraphNode* node,
+      const GraphDecoderState* parent,
+      const double score,
+      const double lmScore,
+      const int token,
+      const int word,
+      const bool prevBlank = false)
+      : node(node),
+        parent(parent),
+        score(score),
+        lmScore(lmScore),
+        token(token),
+        word(word),
+        prevBlank(prevBlank) {}
+
+  GraphDecoderState()
+      : node(nullptr),
+        parent(nullptr),
+        score(0),
+        lmScore(0),
+        token(-1),
+        word(-1),
+        prevBlank(false) {}
+
+  int getWord() const {
+    return word;
+  }
+
+  bool isComplete() const {
+    return !parent || parent->word >= 0;
+  }
+};
+
+/**
+ * GraphDecoder maximizes the same score as LexiconDecoder with a word n-gram
+ * LM, but searches a SearchGraph, where the lexicon is already composed with
+ * the LM: expanding a hypothesis follows an arc with its LM weight, and a word
+ * leads to the root of its new context, without any LM query or LM state. At
+ * a word boundary, the arcs of the backoff contexts are tried too, with their
+ * backoff weights, so that a word may also be scored through a backoff when
+ * its context has an explicit n-gram for it. Partial words are scored by the
+ * best word they can reach in their context, as with the LM lookahead.
+ *
+ * Words are only generated from the graph: OOV words of the lexicon are
+ * scored by the LM as <unk>, and `unkScore` is not used.
+ */
+class GraphDecoder : public Decoder {
+ public:
+  GraphDecoder(
+      const DecoderOptions& opt,
+      const SearchGraphPtr& graph,
+      const int sil,
+      const int blank,
+      const std::vector<float>& transitions)
+      : Decoder(opt),
+        graph_(graph),
+        sil_(sil),
+        blank_(blank),
+        transitions_(transitions) {}
+
+  void decodeBegin() override;
+
+  void decodeStep(const float* emissions, int T, int N) override;
+
+  void decodeEnd() override;
+
+  int nHypothesis() const;
+
+  void prune(int lookBack = 0) override;
+
+  int nDecodedFramesInBuffer() const override;
+
+  DecodeResult getBestHypothesis(int lookBack = 0) const override;
+
+  CompactDecodeResult getBestCompactHypothesis(
+      int lookBack = 0) const override;
+
+  std::vector<DecodeResult> getAllFinalHypothesis() const override;
+
+ protected:
+  SearchGraphPtr graph_;
+  // Index of silence label
+  int sil_;
+  // Index of blank label (for CTC)
+  int blank_;
+  // Transitions by previous token (for ASG criterion)
+  TransitionMatrix transitions_;
+
+  // All the hypothesis new candidates (can be larger than beamsize) proposed
+  // based on the ones from previous frame
+  CandidateBuffer<GraphDecoderState> candidates_;
+
+  // This vector is designed for efficient sorting of the candidates_, so
+  // instead of moving around objects, we only need to sort pointers
+  std::vector<GraphDecoderState*> candidatePtrs_;
+
+  // Hash index on (node, token, prevBlank) of candidates_, used to merge
+  // candidates while they are proposed
+  CandidateHashIndex candidatesIndex_;
+
+  // Best candidate score of current frame
+  double candidatesBestScore_;
+
+  // Hypothesis for all the frames so far, the storage of each frame is reused
+  // across frames and utterances
+  HypothesisArena<GraphDecoderState> hyp_;
+
+  // These 2 variables are used for online decoding, for hypothesis pruning
+  int nDecodedFrames_; // Total number of decoded frames.
+  int nPrunedFrames_; // Total number of pruned frames from hyp_.
+
+  // Indices of the tokens sorted by their emission score in the current frame
+  std::vector<size_t> tokenIdx_;
+
+  // (node, weight) of the nodes the arcs of a hypothesis are taken from: its
+  // own node, and at a word boundary its backoff roots with the backoff
+  // weights to reach them
+  std::vector<std::pair<const SearchGraphNode*, float>> sources_;
+
+  // Expand the hypothesis of the last decoded frame with one frame of N
+  // emissions. `hyp_` must already hold the storage for the next frame.
+  void decodeFrame(const float* emissions, int N);
+
+  // Reset candidates buffer for decoding a new input frame
+  void candidatesReset();
+
+  // Add a new candidate to the buffer, or merge it with the candidate getting
+  // into the same state
+  void candidatesAdd(
+      const SearchGraphNode* node,
+      const GraphDecoderState* parent,
+      const double score,
+      const double lmScore,
+      const int token,
+      const int word,
+      const bool prevBlank);
+
+  // Sort candidates proposed in the current frame and place them into the
+  // `hyp_` buffer
+  void candidatesStore(
+      std::vector<GraphDecoderState>& nextHyp,
+      const bool isSort);
+};
+
+} // namespace w2l
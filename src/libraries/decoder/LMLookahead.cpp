@@ -0,0 +1,77 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "libraries/decoder/LMLookahead.h"
+
+#include <algorithm>
+
+namespace w2l {
+
+LMLookahead::LMLookahead(
+    const FlatTriePtr& lexicon,
+    const LMPtr& lm,
+    const int maxWords,
+    const int cacheSize)
+    : lexicon_(lexicon),
+      lm_(lm),
+      maxWords_(maxWords),
+      cacheSize_(cacheSize),
+      nWords_(lexicon->nNodes()) {
+  // The children of a node come after it (breadth-first order)
+  const FlatTrieNode* root = lexicon_->getRoot();
+  for (int i = lexicon_->nNodes() - 1; i >= 0; i--) {
+    const FlatTrieNode& node = root[i];
+    nWords_[i] = node.nLabels;
+    for (int c = 0; c < node.nChildren; c++) {
+      nWords_[i] += nWords_[node.firstChild + c];
+    }
+  }
+}
+
+float LMLookahead::score(
+    const LMStatePtr& state,
+    const FlatTrieNode* node,
+    DecoderStats& stats) {
+  const FlatTrieNode* root = lexicon_->getRoot();
+  if (node == root) {
+    return 0;
+  }
+  const int offset = node - root;
+  if (nWords_[offset] > maxWords_) {
+    return node->maxScore;
+  }
+  const auto key = std::make_pair(state.get(), offset);
+  auto it = cache_.find(key);
+  if (it != cache_.end()) {
+    return it->second;
+  }
+
+  float best = kNegativeInfinity;
+  const int* labels = lexicon_->labels(node);
+  for (int i = 0; i < node->nLabels; i++) {
+    countLMQuery(stats, state, labels[i]);
+    best = std::max(best, lm_->score(state, labels[i]).second);
+  }
+  for (int c = 0; c < node->nChildren; c++) {
+    best = std::max(best, score(state, root + node->firstChild + c, stats));
+  }
+
+  if (cache_.size() >= cacheSize_) {
+    clear();
+  }
+  cache_.emplace(key, best);
+  states_.emplace(state.get(), state);
+  return best;
+}
+
+void LMLookahead::clear() {
+  cache_.clear();
+  states_.clear();
+}
+
+} // namespace w2l
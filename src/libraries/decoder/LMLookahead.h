@@ -0,0 +1,70 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "libraries/decoder/Trie.h"
+#include "libraries/decoder/Utils.h"
+
+namespace w2l {
+
+/**
+ * LMLookahead scores the partial words of a lexicon decoder with a word LM in
+ * their context: the lookahead of a lexicon node after an LM state is the best
+ * LM score, from this state, of the words below the node. It replaces the
+ * smeared scores of the trie, which do not depend on the word history, so
+ * that the hypothesis heading to words unlikely in their context are pruned
+ * before the words end, and a narrower beam can be used.
+ *
+ * The lookahead of a node queries the LM for all the words below it: nodes
+ * with more than `maxWords` words below them (the ones close to the root)
+ * keep their smeared score. The lookaheads are computed lazily and cached by
+ * (LM state, node), the cache being cleared when it holds `cacheSize` of them.
+ * A lookahead is not thread-safe: each decoder has its own.
+ */
+class LMLookahead {
+ public:
+  LMLookahead(
+      const FlatTriePtr& lexicon,
+      const LMPtr& lm,
+      const int maxWords,
+      const int cacheSize);
+
+  /* Lookahead of `node` after `state`, 0 at the root; LM queries go to stats */
+  float score(
+      const LMStatePtr& state,
+      const FlatTrieNode* node,
+      DecoderStats& stats);
+
+  /* Drop the cached lookaheads and the LM states they hold */
+  void clear();
+
+ private:
+  struct KeyHash {
+    size_t operator()(const std::pair<const LMState*, int>& key) const {
+      return hashCombine(std::hash<const LMState*>()(key.first), key.second);
+    }
+  };
+
+  FlatTriePtr lexicon_;
+  LMPtr lm_;
+  int maxWords_;
+  int cacheSize_;
+  // Number of words below each node, by node offset
+  std::vector<int> nWords_;
+  // Lookaheads by (state, node offset), and the states they were computed
+  // after, kept alive so that their address is not reused by another state
+  std::unordered_map<std::pair<const LMState*, int>, float, KeyHash> cache_;
+  std::unordered_map<const LMState*, LMStatePtr> states_;
+};
+
+} // namespace w2l
@@ -9,73 +9,146 @@
 #include <stdlib.h>
 #include <algorithm>
 #include <cmath>
+#include <cstring>
 #include <functional>
+#include <istream>
 #include <numeric>
+#include <ostream>
 #include <unordered_map>
 
+#include "libraries/common/TaskScheduler.h"
 #include "libraries/decoder/LexiconDecoder.h"
+#include "libraries/lm/ZeroLM.h"
 
 namespace w2l {
 
+namespace {
+// Fewest hypothesis per task of the parallel expansion of a frame, below
+// which the cost of the tasks and of the merge outweighs their work
+constexpr int kMinShardHypothesis = 32;
+
+constexpr const char kSnapshotMagic[8] =
+    {'W', '2', 'L', 'D', 'S', 'N', 'A', 'P'};
+constexpr int kSnapshotVersion = 1;
+
+// Header of a LexiconDecoder snapshot, followed by the LM states, then for
+// each frame of the buffer its number of hypothesis and their
+// SnapshotHypothesis. Data is stored in the native byte order. The padding of
+// both structs is explicit, so that value-initialization zeroes all the bytes
+// written.
+struct SnapshotHeader {
+  char magic[8];
+  int version;
+  int nLexiconNodes; // Checked against the lexicon of the decoder
+  int nDecodedFrames;
+  int nPrunedFrames;
+  int nStableFrames;
+  int nLmStates;
+  float beamThreshold;
+  int padding; // Aligns stats
+  DecoderStats stats;
+};
+static_assert(
+    sizeof(SnapshotHeader) ==
+        8 + 7 * sizeof(int) + sizeof(float) + sizeof(DecoderStats),
+    "SnapshotHeader has implicit padding");
+
+// A hypothesis, whose pointers are replaced by indices
+struct SnapshotHypothesis {
+  double score;
+  double lmScore;
+  int lmState; // In the LM states of the snapshot
+  int lex; // Offset from the root of the lexicon
+  int parent; // In the previous frame, -1 if none
+  int token;
+  int word;
+  int biasState;
+  bool prevBlank;
+  char padding[3];
+};
+static_assert(
+    sizeof(SnapshotHypothesis) ==
+        2 * sizeof(double) + 7 * sizeof(int) + sizeof(bool) + 3,
+    "SnapshotHypothesis has implicit padding");
+
+void checkSnapshot(bool condition, const char* what) {
+  if (!condition) {
+    throw std::runtime_error(
+        std::string("[LexiconDecoder] Invalid snapshot: ") + what);
+  }
+}
+} // namespace
+
 void LexiconDecoder::candidatesReset() {
+  beam_.stepBegin();
   candidatesBestScore_ = kNegativeInfinity;
   candidates_.clear();
   candidatePtrs_.clear();
-}
-
-void LexiconDecoder::mergeCandidates() {
-  auto compareNodesShortList = [](const LexiconDecoderState* node1,
-                                  const LexiconDecoderState* node2) {
-    int lmCmp = node1->lmState->compare(node2->lmState);
-    if (lmCmp != 0) {
-      return lmCmp > 0;
-    } else if (node1->lex != node2->lex) {
-      /* same LmState */
-      return node1->lex > node2->lex;
-    } else if (node1->token != node2->token) {
-      return node1->token > node2->token;
-    } else if (node1->prevBlank != node2->prevBlank) {
-      return node1->prevBlank > node2->prevBlank;
-    } else {
-      /* same LmState, same lex */
-      return node1->score > node2->score;
-    }
-  };
-  std::sort(
-      candidatePtrs_.begin(), candidatePtrs_.end(), compareNodesShortList);
-
-  int nHypAfterMerging = 1;
-  for (int i = 1; i < candidatePtrs_.size(); i++) {
-    if (candidatePtrs_[i]->lmState->compare(
-            candidatePtrs_[nHypAfterMerging - 1]->lmState) ||
-        candidatePtrs_[i]->lex != candidatePtrs_[nHypAfterMerging - 1]->lex ||
-        candidatePtrs_[i]->token !=
-            candidatePtrs_[nHypAfterMerging - 1]->token ||
-        candidatePtrs_[i]->prevBlank !=
-            candidatePtrs_[nHypAfterMerging - 1]->prevBlank) {
-      candidatePtrs_[nHypAfterMerging] = candidatePtrs_[i];
-      nHypAfterMerging++;
-    } else {
-      mergeStates(
-          candidatePtrs_[nHypAfterMerging - 1], candidatePtrs_[i], opt_.logAdd);
-    }
-  }
-
-  candidatePtrs_.resize(nHypAfterMerging);
+  candidatesIndex_.clear();
 }
 
 void LexiconDecoder::candidatesAdd(
     const LMStatePtr& lmState,
-    const TrieNode* lex,
+    const FlatTrieNode* lex,
     const LexiconDecoderState* parent,
     const double score,
+    const double lmScore,
     const int token,
     const int word,
-    const bool prevBlank) {
-  if (isValidCandidate(candidatesBestScore_, score, opt_.beamThreshold)) {
-    candidates_.emplace_back(
-        lmState, lex, parent, score, token, word, prevBlank);
+    const bool prevBlank,
+    const int biasState,
+    CandidateShard* shard) {
+  auto& candidates = shard ? shard->candidates : candidates_;
+  auto& candidatesIndex = shard ? shard->index : candidatesIndex_;
+  auto& stats = shard ? shard->stats : stats_;
+  ++stats.candidates;
+  if (!isValidCandidate(
+          shard ? shard->bestScore : candidatesBestScore_,
+          score,
+          beam_.threshold())) {
+    return;
+  }
+
+  /* Merge hypothesis getting into the same state from different paths */
+  size_t hash = hashCombine(
+      hashCombine(
+          hashCombine(
+              std::hash<const LMState*>()(lmState.get()),
+              std::hash<const FlatTrieNode*>()(lex)),
+          2 * token + prevBlank),
+      biasState);
+  int position = candidatesIndex.findOrInsert(
+      hash, candidates.size(), [&](const int idx) {
+        const LexiconDecoderState& candidate = candidates[idx];
+        return candidate.lmState->compare(lmState) == 0 &&
+            candidate.lex == lex && candidate.token == token &&
+            candidate.prevBlank == prevBlank &&
+            candidate.biasState == biasState;
+      });
+  if (position < 0) {
+    candidates.emplace_back(
+        lmState,
+        lex,
+        parent,
+        score,
+        lmScore,
+        token,
+        word,
+        prevBlank,
+        biasState);
+    return;
   }
+
+  ++stats.merged;
+  LexiconDecoderState& merged = candidates[position];
+  LexiconDecoderState proposed(
+      lmState, lex, parent, score, lmScore, token, word, prevBlank, biasState);
+  if (proposed.score > merged.score) {
+    // Keep the path of the best scoring hypothesis
+    std::swap(merged, proposed);
+  }
+  mergeStates(&merged, &proposed, opt_.logAdd);
+  candidates.updateScore(position);
 }
 
 void LexiconDecoder::candidatesStore(
@@ -86,185 +159,341 @@ void LexiconDecoder::candidatesStore(
     return;
   }
 
-  /* Select valid candidates */
+  /* Select valid candidates (already merged in `candidatesAdd()`) */
+  beam_.stepEnd(candidates_.scores(), candidates_.size(), candidatesBestScore_);
   pruneCandidates(
-      candidatePtrs_, candidates_, candidatesBestScore_ - opt_.beamThreshold);
-
-  /* Sort by (lmState, lex, score) and copy into next hypothesis */
-  mergeCandidates();
+      candidatePtrs_, candidates_, candidatesBestScore_ - beam_.threshold());
 
   /* Sort hypothesis and select top-K */
-  storeTopCandidates(nextHyp, candidatePtrs_, opt_.beamSize, returnSorted);
+  storeTopCandidates(
+      nextHyp, candidates_, candidatePtrs_, opt_.beamSize, returnSorted);
+  stats_.stored += nextHyp.size();
+}
+
+template <CriterionType kCriterion>
+LexiconDecoder::DecodeFrameFn LexiconDecoder::decodeFrameFor(
+    const bool isLmToken,
+    const bool isZeroLm) {
+  if (isZeroLm) {
+    return isLmToken
+        ? &LexiconDecoder::decodeFrameImpl<kCriterion, true, true>
+        : &LexiconDecoder::decodeFrameImpl<kCriterion, false, true>;
+  }
+  return isLmToken
+      ? &LexiconDecoder::decodeFrameImpl<kCriterion, true, false>
+      : &LexiconDecoder::decodeFrameImpl<kCriterion, false, false>;
+}
+
+void LexiconDecoder::selectDecodeFrame() {
+  // The inline ZeroLM queries share the LM states, they are not thread-safe
+  const bool isZeroLm = dynamic_cast<const ZeroLM*>(lm_.get()) != nullptr &&
+      opt_.expandThreads <= 1;
+  switch (opt_.criterionType) {
+    case CriterionType::ASG:
+      decodeFrame_ = decodeFrameFor<CriterionType::ASG>(isLmToken_, isZeroLm);
+      break;
+    case CriterionType::CTC:
+      decodeFrame_ = decodeFrameFor<CriterionType::CTC>(isLmToken_, isZeroLm);
+      break;
+    default:
+      decodeFrame_ = decodeFrameFor<CriterionType::S2S>(isLmToken_, isZeroLm);
+  }
 }
 
 void LexiconDecoder::decodeBegin() {
+  useNextLexicon();
+  beam_.reset();
+  stats_ = DecoderStats();
   hyp_.clear();
-  hyp_.emplace(0, std::vector<LexiconDecoderState>());
+  if (lookahead_) {
+    lookahead_->clear();
+  }
+  hyp_.reserveFrames(2);
 
   /* note: the lm reset itself with :start() */
   hyp_[0].emplace_back(
-      lm_->start(0), lexicon_->getRoot(), nullptr, 0.0, sil_, -1);
+      lm_->start(0), lexicon_->getRoot(), nullptr, 0.0, 0.0, sil_, -1);
   nDecodedFrames_ = 0;
   nPrunedFrames_ = 0;
+  nStableFrames_ = 0;
 }
 
 void LexiconDecoder::decodeStep(const float* emissions, int T, int N) {
-  int startFrame = nDecodedFrames_ - nPrunedFrames_;
   // Extend hyp_ buffer
-  if (hyp_.size() < startFrame + T + 2) {
-    for (int i = hyp_.size(); i < startFrame + T + 2; i++) {
-      hyp_.emplace(i, std::vector<LexiconDecoderState>());
-    }
-  }
+  hyp_.reserveFrames(nDecodedFrames_ - nPrunedFrames_ + T + 2);
 
-  std::vector<size_t> idx(N);
   for (int t = 0; t < T; t++) {
-    std::iota(idx.begin(), idx.end(), 0);
-    if (N > opt_.beamSizeToken) {
-      std::partial_sort(
-          idx.begin(),
-          idx.begin() + opt_.beamSizeToken,
-          idx.end(),
-          [&t, &N, &emissions](const size_t& l, const size_t& r) {
-            return emissions[t * N + l] > emissions[t * N + r];
-          });
+    decodeFrame(emissions + t * N, N);
+    updateLMCache(lm_, hyp_[nDecodedFrames_ - nPrunedFrames_]);
+  }
+  stats_.updatePeakBytes(hyp_.bytes() + candidates_.bytes());
+  reportStableWords();
+}
+
+template <CriterionType kCriterion, bool kIsLmToken, bool kZeroLm>
+void LexiconDecoder::decodeFrameImpl(const float* emissions, int N) {
+  const int frame = nDecodedFrames_ - nPrunedFrames_;
+
+  // A blank frame only goes through the blank transition (3)
+  const bool blankOnly = isBlankFrame(emissions, blank_, opt_);
+  if (blankOnly) {
+    tokenIdx_.clear();
+  } else {
+    selectTokens(emissions, N, tokenIdx_);
+  }
+
+  /* (0) Find the children of (1) and score their LM queries at once */
+  lexChildren_.clear();
+  lexChildrenOffsets_.assign(1, 0);
+  lmQueryOffsets_.clear();
+  for (const LexiconDecoderState& prevHyp : hyp_[frame]) {
+    lmQueryOffsets_.push_back(lmQueries_.states.size());
+    for (const int n : tokenIdx_) {
+      const FlatTrieNode* lex = lexicon_->findChild(prevHyp.lex, n);
+      if (!lex) {
+        continue;
+      }
+      ++stats_.trieExpansions;
+      lexChildren_.emplace_back(n, lex);
+      if (kZeroLm) {
+        continue;
+      } else if (kIsLmToken) {
+        lmQueries_.add(prevHyp.lmState, n);
+        continue;
+      }
+      const int* labels = lexicon_->labels(lex);
+      for (int i = 0; i < lex->nLabels; i++) {
+        lmQueries_.add(prevHyp.lmState, labels[i]);
+      }
+      if (lex->nLabels == 0 && (opt_.unkScore > kNegativeInfinity)) {
+        lmQueries_.add(prevHyp.lmState, unk_);
+      }
     }
+    lexChildrenOffsets_.push_back(lexChildren_.size());
+  }
+  if (!kZeroLm) {
+    lmQueries_.score(*lm_, stats_);
+  }
 
-    candidatesReset();
-    for (const LexiconDecoderState& prevHyp : hyp_[startFrame + t]) {
-      const TrieNode* prevLex = prevHyp.lex;
-      const int prevIdx = prevHyp.token;
-      const float lexMaxScore =
-          prevLex == lexicon_->getRoot() ? 0 : prevLex->maxScore;
-
-      /* (1) Try children */
-      for (int r = 0; r < std::min(opt_.beamSizeToken, N); ++r) {
-        int n = idx[r];
-        auto iter = prevLex->children.find(n);
-        if (iter == prevLex->children.end()) {
-          continue;
-        }
-        const TrieNodePtr& lex = iter->second;
-        double score = prevHyp.score + emissions[t * N + n];
-        if (nDecodedFrames_ + t > 0 &&
-            opt_.criterionType == CriterionType::ASG) {
-          score += transitions_[n * N + prevIdx];
-        }
-        if (n == sil_) {
-          score += opt_.silScore;
-        }
+  candidatesReset();
+  const int nHyp = hyp_[frame].size();
+  // The cache of the LM lookahead is not thread-safe
+  const int nShards = lookahead_
+      ? 1
+      : std::min(opt_.expandThreads, nHyp / kMinShardHypothesis);
+  if (nShards > 1) {
+    expandInShards<kCriterion, kIsLmToken, kZeroLm>(
+        frame, emissions, N, blankOnly, nShards);
+  } else {
+    for (int h = 0; h < nHyp; h++) {
+      expandHypothesis<kCriterion, kIsLmToken, kZeroLm>(
+          frame, h, emissions, N, blankOnly, nullptr);
+    }
+  }
 
-        LMStatePtr lmState;
-        double lmScore = 0.;
+  candidatesStore(hyp_[frame + 1], false);
+  lmQueries_.clear();
+  ++nDecodedFrames_;
+  ++stats_.frames;
+}
 
-        if (isLmToken_) {
-          auto lmReturn = lm_->score(prevHyp.lmState, n);
-          lmState = lmReturn.first;
-          lmScore = lmReturn.second;
-        }
+template <CriterionType kCriterion, bool kIsLmToken, bool kZeroLm>
+void LexiconDecoder::expandInShards(
+    const int frame,
+    const float* emissions,
+    const int N,
+    const bool blankOnly,
+    const int nShards) {
+  const int nHyp = hyp_[frame].size();
+  const int shardSize = (nHyp + nShards - 1) / nShards;
+  if (shards_.size() < nShards) {
+    shards_.resize(nShards);
+  }
+  TaskScheduler::get().parallelFor(nShards, [&](int64_t s) {
+    CandidateShard& shard = shards_[s];
+    shard.candidates.clear();
+    shard.index.clear();
+    shard.bestScore = kNegativeInfinity;
+    shard.stats = DecoderStats();
+    const int end = std::min<int>(nHyp, (s + 1) * shardSize);
+    for (int h = s * shardSize; h < end; h++) {
+      expandHypothesis<kCriterion, kIsLmToken, kZeroLm>(
+          frame, h, emissions, N, blankOnly, &shard);
+    }
+  });
+
+  /* Merge the candidates of the tasks, as if proposed by a single one */
+  const int64_t nCandidates = stats_.candidates;
+  int64_t nProposed = 0;
+  for (int s = 0; s < nShards; s++) {
+    CandidateShard& shard = shards_[s];
+    for (int i = 0; i < shard.candidates.size(); i++) {
+      const LexiconDecoderState& candidate = shard.candidates[i];
+      candidatesAdd(
+          candidate.lmState,
+          candidate.lex,
+          candidate.parent,
+          candidate.score,
+          candidate.lmScore,
+          candidate.token,
+          candidate.word,
+          candidate.prevBlank,
+          candidate.biasState);
+    }
+    nProposed += shard.stats.candidates;
+    stats_.merged += shard.stats.merged;
+    // Release the LM states held by the shard
+    shard.candidates.clear();
+  }
+  stats_.candidates = nCandidates + nProposed;
+}
 
-        // We eat-up a new token
-        if (opt_.criterionType != CriterionType::CTC || prevHyp.prevBlank ||
-            n != prevIdx) {
-          if (!lex->children.empty()) {
-            if (!isLmToken_) {
-              lmState = prevHyp.lmState;
-              lmScore = lex->maxScore - lexMaxScore;
-            }
-            candidatesAdd(
-                lmState,
-                lex.get(),
-                &prevHyp,
-                score + opt_.lmWeight * lmScore,
-                n,
-                -1,
-                false // prevBlank
-            );
-          }
-        }
+template <CriterionType kCriterion, bool kIsLmToken, bool kZeroLm>
+void LexiconDecoder::expandHypothesis(
+    const int frame,
+    const int h,
+    const float* emissions,
+    const int N,
+    const bool blankOnly,
+    CandidateShard* shard) {
+  const LexiconDecoderState& prevHyp = hyp_[frame][h];
+  const FlatTrieNode* prevLex = prevHyp.lex;
+  const int prevIdx = prevHyp.token;
+  const float lexMaxScore =
+      kIsLmToken ? 0 : lexiconScore(prevHyp.lmState, prevLex);
+  int lmQuery = kZeroLm ? 0 : lmQueryOffsets_[h];
+
+  /* (1) Try children */
+  for (int c = lexChildrenOffsets_[h]; c < lexChildrenOffsets_[h + 1]; c++) {
+    const int n = lexChildren_[c].first;
+    const FlatTrieNode* lex = lexChildren_[c].second;
+    double score = prevHyp.score + emissions[n];
+    if (nDecodedFrames_ > 0 && kCriterion == CriterionType::ASG) {
+      score += transitions_.from(prevIdx)[n];
+    }
+    if (n == sil_) {
+      score += opt_.silScore;
+    }
 
-        // If we got a true word
-        for (auto label : lex->labels) {
-          if (!isLmToken_) {
-            auto lmReturn = lm_->score(prevHyp.lmState, label);
-            lmState = lmReturn.first;
-            lmScore = lmReturn.second - lexMaxScore;
-          }
-          candidatesAdd(
-              lmState,
-              lexicon_->getRoot(),
-              &prevHyp,
-              score + opt_.lmWeight * lmScore + opt_.wordScore,
-              n,
-              label,
-              false // prevBlank
-          );
-        }
+    LMStatePtr lmState;
+    double lmScore = 0.;
 
-        // If we got an unknown word
-        if (lex->labels.empty() && (opt_.unkScore > kNegativeInfinity)) {
-          if (!isLmToken_) {
-            auto lmReturn = lm_->score(prevHyp.lmState, unk_);
-            lmState = lmReturn.first;
-            lmScore = lmReturn.second - lexMaxScore;
-          }
-          candidatesAdd(
-              lmState,
-              lexicon_->getRoot(),
-              &prevHyp,
-              score + opt_.lmWeight * lmScore + opt_.unkScore,
-              n,
-              unk_,
-              false // prevBlank
-          );
-        }
-      }
+    if (kIsLmToken) {
+      auto lmReturn = nextLmQuery<kZeroLm>(lmQuery, prevHyp.lmState, n);
+      lmState = lmReturn.first;
+      lmScore = lmReturn.second;
+    }
 
-      /* (2) Try same lexicon node */
-      if (opt_.criterionType != CriterionType::CTC || !prevHyp.prevBlank) {
-        int n = prevIdx;
-        double score = prevHyp.score + emissions[t * N + n];
-        if (nDecodedFrames_ + t > 0 &&
-            opt_.criterionType == CriterionType::ASG) {
-          score += transitions_[n * N + prevIdx];
+    // We eat-up a new token
+    if (kCriterion != CriterionType::CTC || prevHyp.prevBlank ||
+        n != prevIdx) {
+      if (lex->nChildren > 0) {
+        if (!kIsLmToken) {
+          lmState = prevHyp.lmState;
+          lmScore = lexiconScore(prevHyp.lmState, lex) - lexMaxScore;
         }
-        if (n == sil_) {
-          score += opt_.silScore;
-        }
-
         candidatesAdd(
-            prevHyp.lmState,
-            prevLex,
+            lmState,
+            lex,
             &prevHyp,
-            score,
+            score + opt_.lmWeight * lmScore,
+            prevHyp.lmScore + opt_.lmWeight * lmScore,
             n,
             -1,
-            false // prevBlank
-        );
+            false, // prevBlank
+            prevHyp.biasState,
+            shard);
       }
+    }
 
-      /* (3) CTC only, try blank */
-      if (opt_.criterionType == CriterionType::CTC) {
-        int n = blank_;
-        double score = prevHyp.score + emissions[t * N + n];
-        candidatesAdd(
-            prevHyp.lmState,
-            prevLex,
-            &prevHyp,
-            score,
-            n,
-            -1,
-            true // prevBlank
-        );
+    // If we got a true word
+    const int* labels = lexicon_->labels(lex);
+    for (int i = 0; i < lex->nLabels; i++) {
+      int label = labels[i];
+      if (!kIsLmToken) {
+        auto lmReturn = nextLmQuery<kZeroLm>(lmQuery, prevHyp.lmState, label);
+        lmState = lmReturn.first;
+        lmScore = lmReturn.second - lexMaxScore;
       }
-      // finish proposing
+      auto bias = nextBias(prevHyp.biasState, label);
+      candidatesAdd(
+          lmState,
+          lexicon_->getRoot(),
+          &prevHyp,
+          score + opt_.lmWeight * lmScore + opt_.wordScore + bias.second,
+          prevHyp.lmScore + opt_.lmWeight * lmScore + opt_.wordScore +
+              bias.second,
+          n,
+          label,
+          false, // prevBlank
+          bias.first,
+          shard);
     }
 
-    candidatesStore(hyp_[startFrame + t + 1], false);
-    updateLMCache(lm_, hyp_[startFrame + t + 1]);
+    // If we got an unknown word
+    if (lex->nLabels == 0 && (opt_.unkScore > kNegativeInfinity)) {
+      if (!kIsLmToken) {
+        auto lmReturn = nextLmQuery<kZeroLm>(lmQuery, prevHyp.lmState, unk_);
+        lmState = lmReturn.first;
+        lmScore = lmReturn.second - lexMaxScore;
+      }
+      auto bias = nextBias(prevHyp.biasState, unk_);
+      candidatesAdd(
+          lmState,
+          lexicon_->getRoot(),
+          &prevHyp,
+          score + opt_.lmWeight * lmScore + opt_.unkScore + bias.second,
+          prevHyp.lmScore + opt_.lmWeight * lmScore + opt_.unkScore +
+              bias.second,
+          n,
+          unk_,
+          false, // prevBlank
+          bias.first,
+          shard);
+    }
   }
 
-  nDecodedFrames_ += T;
+  /* (2) Try same lexicon node */
+  if (!blankOnly &&
+      (kCriterion != CriterionType::CTC || !prevHyp.prevBlank)) {
+    int n = prevIdx;
+    double score = prevHyp.score + emissions[n];
+    if (nDecodedFrames_ > 0 && kCriterion == CriterionType::ASG) {
+      score += transitions_.from(prevIdx)[n];
+    }
+    if (n == sil_) {
+      score += opt_.silScore;
+    }
+
+    candidatesAdd(
+        prevHyp.lmState,
+        prevLex,
+        &prevHyp,
+        score,
+        prevHyp.lmScore,
+        n,
+        -1,
+        false, // prevBlank
+        prevHyp.biasState,
+        shard);
+  }
+
+  /* (3) CTC only, try blank */
+  if (kCriterion == CriterionType::CTC) {
+    int n = blank_;
+    double score = prevHyp.score + emissions[n];
+    candidatesAdd(
+        prevHyp.lmState,
+        prevLex,
+        &prevHyp,
+        score,
+        prevHyp.lmScore,
+        n,
+        -1,
+        true, // prevBlank
+        prevHyp.biasState,
+        shard);
+  }
 }
 
 void LexiconDecoder::decodeEnd() {
@@ -279,20 +508,23 @@ void LexiconDecoder::decodeEnd() {
   }
   for (const LexiconDecoderState& prevHyp :
        hyp_[nDecodedFrames_ - nPrunedFrames_]) {
-    const TrieNode* prevLex = prevHyp.lex;
+    const FlatTrieNode* prevLex = prevHyp.lex;
     const LMStatePtr& prevLmState = prevHyp.lmState;
 
     if (!hasNiceEnding || prevHyp.lex == lexicon_->getRoot()) {
+      ++stats_.lmQueries;
       auto lmStateScorePair = lm_->finish(prevLmState);
+      const float bias = biasing_ ? biasing_->finish(prevHyp.biasState) : 0;
       candidatesAdd(
           lmStateScorePair.first,
           prevLex,
           &prevHyp,
-          prevHyp.score + opt_.lmWeight * lmStateScorePair.second,
+          prevHyp.score + opt_.lmWeight * lmStateScorePair.second + bias,
+          prevHyp.lmScore + opt_.lmWeight * lmStateScorePair.second + bias,
           sil_,
           -1,
-          false // prevBlank
-      );
+          false, // prevBlank
+          prevHyp.biasState);
     }
   }
 
@@ -306,7 +538,7 @@ std::vector<DecodeResult> LexiconDecoder::getAllFinalHypothesis() const {
     return std::vector<DecodeResult>{};
   }
 
-  return getAllHypothesis(hyp_.find(finalFrame)->second, finalFrame);
+  return getAllHypothesis(hyp_[finalFrame], finalFrame);
 }
 
 DecodeResult LexiconDecoder::getBestHypothesis(int lookBack) const {
@@ -314,14 +546,319 @@ DecodeResult LexiconDecoder::getBestHypothesis(int lookBack) const {
     return DecodeResult();
   }
 
-  const LexiconDecoderState* bestNode = findBestAncestor(
-      hyp_.find(nDecodedFrames_ - nPrunedFrames_)->second, lookBack);
+  const LexiconDecoderState* bestNode =
+      findBestAncestor(hyp_[nDecodedFrames_ - nPrunedFrames_], lookBack);
   return getHypothesis(bestNode, nDecodedFrames_ - nPrunedFrames_ - lookBack);
 }
 
+CompactDecodeResult LexiconDecoder::getBestCompactHypothesis(
+    int lookBack) const {
+  if (nDecodedFrames_ - nPrunedFrames_ - lookBack < 1) {
+    return CompactDecodeResult();
+  }
+
+  const LexiconDecoderState* bestNode =
+      findBestAncestor(hyp_[nDecodedFrames_ - nPrunedFrames_], lookBack);
+  return getCompactHypothesis(
+      bestNode, nDecodedFrames_ - nPrunedFrames_ - lookBack);
+}
+
+DecodeResult LexiconDecoder::getStablePrefix() const {
+  const int finalFrame = nDecodedFrames_ - nPrunedFrames_;
+  int lookBack = 0;
+  const LexiconDecoderState* ancestor =
+      findCommonAncestor(hyp_[finalFrame], lookBack, finalFrame);
+  return getHypothesis(ancestor, finalFrame - lookBack);
+}
+
+DecodeResult LexiconDecoder::getPartialHypothesis() const {
+  const int finalFrame = nDecodedFrames_ - nPrunedFrames_;
+  // The first frame of the buffer is the root, or a frame already reported
+  const int stableFrame = std::max(0, nStableFrames_ - nPrunedFrames_);
+  auto best = getBestHypothesis();
+  if (static_cast<int>(best.words.size()) != finalFrame + 1) {
+    return DecodeResult();
+  }
+
+  DecodeResult res(finalFrame - stableFrame);
+  res.score = best.score;
+  std::copy(
+      best.words.begin() + stableFrame + 1,
+      best.words.end(),
+      res.words.begin());
+  std::copy(
+      best.tokens.begin() + stableFrame + 1,
+      best.tokens.end(),
+      res.tokens.begin());
+  return res;
+}
+
+void LexiconDecoder::pruneStable() {
+  // prune() keeps at least these frames, back to the last word of the best
+  // hypothesis
+  prune(nDecodedFrames_ - nStableFrames_);
+}
+
+WordLattice LexiconDecoder::getLattice() const {
+  const int finalFrame = nDecodedFrames_ - nPrunedFrames_;
+  std::vector<const LexiconDecoderState*> nodes;
+  std::vector<int> frames;
+  std::unordered_map<const LexiconDecoderState*, int> nodeIds;
+  std::vector<WordLatticeArc> arcs;
+  auto addNode = [&](const LexiconDecoderState* state, int frame) {
+    nodeIds[state] = nodes.size();
+    nodes.push_back(state);
+    frames.push_back(frame);
+    return static_cast<int>(nodes.size()) - 1;
+  };
+
+  /* (1) Back-track each hypothesis until its history is already in */
+  std::vector<int> finals;
+  for (const LexiconDecoderState& hyp : hyp_[finalFrame]) {
+    const LexiconDecoderState* node = &hyp;
+    int nodeId = addNode(node, finalFrame);
+    int frame = finalFrame;
+    finals.push_back(nodeId);
+
+    while (node->parent) {
+      // Skip the middle of the word
+      const LexiconDecoderState* prevNode = node->parent;
+      --frame;
+      while (prevNode->parent && prevNode->getWord() < 0) {
+        prevNode = prevNode->parent;
+        --frame;
+      }
+
+      auto it = nodeIds.find(prevNode);
+      bool isKnown = it != nodeIds.end();
+      int prevNodeId = isKnown ? it->second : addNode(prevNode, frame);
+      double lmScore = node->lmScore - prevNode->lmScore;
+      arcs.push_back(WordLatticeArc{prevNodeId,
+                                    nodeId,
+                                    node->getWord(),
+                                    node->score - prevNode->score - lmScore,
+                                    lmScore});
+      if (isKnown) {
+        break;
+      }
+      node = prevNode;
+      nodeId = prevNodeId;
+    }
+  }
+
+  /* (2) Number the nodes in time order */
+  std::vector<int> order(nodes.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](int l, int r) {
+    return frames[l] < frames[r];
+  });
+  std::vector<int> newIds(nodes.size());
+  WordLattice lattice;
+  lattice.frames.resize(nodes.size());
+  for (int i = 0; i < order.size(); i++) {
+    newIds[order[i]] = i;
+    lattice.frames[i] = frames[order[i]];
+    if (!nodes[order[i]]->parent) {
+      lattice.starts.push_back(i);
+    }
+  }
+  for (auto& arc : arcs) {
+    arc.from = newIds[arc.from];
+    arc.to = newIds[arc.to];
+  }
+  std::sort(
+      arcs.begin(),
+      arcs.end(),
+      [](const WordLatticeArc& l, const WordLatticeArc& r) {
+        return l.from < r.from || (l.from == r.from && l.to < r.to);
+      });
+  lattice.arcs = std::move(arcs);
+  for (int finalId : finals) {
+    lattice.finals.push_back(newIds[finalId]);
+  }
+  return lattice;
+}
+
+void LexiconDecoder::snapshot(std::ostream& out) const {
+  const int nFrames = nDecodedFrames_ - nPrunedFrames_ + 1;
+
+  /* (1) Number the LM states and replace the pointers of the hypothesis */
+  std::unordered_map<const LMState*, int> lmStateIds;
+  std::vector<LMStatePtr> lmStates;
+  std::vector<std::vector<SnapshotHypothesis>> frames(nFrames);
+  for (int frame = 0; frame < nFrames; frame++) {
+    for (const LexiconDecoderState& hyp : hyp_[frame]) {
+      auto it = lmStateIds.emplace(hyp.lmState.get(), lmStates.size()).first;
+      if (it->second == lmStates.size()) {
+        lmStates.push_back(hyp.lmState);
+      }
+      SnapshotHypothesis record{};
+      record.score = hyp.score;
+      record.lmScore = hyp.lmScore;
+      record.lmState = it->second;
+      record.lex = hyp.lex - lexicon_->getRoot();
+      // Parents are in the previous frame, which is contiguous
+      record.parent = hyp.parent ? hyp.parent - hyp_[frame - 1].data() : -1;
+      record.token = hyp.token;
+      record.word = hyp.word;
+      record.biasState = hyp.biasState;
+      record.prevBlank = hyp.prevBlank;
+      frames[frame].push_back(record);
+    }
+  }
+
+  /* (2) Write them */
+  SnapshotHeader header{};
+  std::memcpy(header.magic, kSnapshotMagic, sizeof(header.magic));
+  header.version = kSnapshotVersion;
+  header.nLexiconNodes = lexicon_->nNodes();
+  header.nDecodedFrames = nDecodedFrames_;
+  header.nPrunedFrames = nPrunedFrames_;
+  header.nStableFrames = nStableFrames_;
+  header.nLmStates = lmStates.size();
+  header.beamThreshold = beam_.threshold();
+  header.stats = stats_;
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  for (const auto& state : lmStates) {
+    lm_->saveState(state, out);
+  }
+  for (const auto& records : frames) {
+    const int nHyp = records.size();
+    out.write(reinterpret_cast<const char*>(&nHyp), sizeof(nHyp));
+    out.write(
+        reinterpret_cast<const char*>(records.data()),
+        nHyp * sizeof(SnapshotHypothesis));
+  }
+  if (!out) {
+    throw std::runtime_error("[LexiconDecoder] Failed writing a snapshot");
+  }
+}
+
+void LexiconDecoder::restore(std::istream& in) {
+  SnapshotHeader header;
+  in.read(reinterpret_cast<char*>(&header), sizeof(header));
+  checkSnapshot(static_cast<bool>(in), "truncated");
+  checkSnapshot(
+      std::memcmp(header.magic, kSnapshotMagic, sizeof(header.magic)) == 0,
+      "bad header");
+  checkSnapshot(header.version == kSnapshotVersion, "unsupported version");
+  checkSnapshot(
+      header.nLexiconNodes == lexicon_->nNodes(), "for another lexicon");
+  const int nFrames = header.nDecodedFrames - header.nPrunedFrames + 1;
+  checkSnapshot(nFrames >= 1 && header.nLmStates >= 0, "bad header");
+
+  std::vector<LMStatePtr> lmStates(header.nLmStates);
+  for (auto& state : lmStates) {
+    state = lm_->loadState(in);
+  }
+
+  beam_.reset();
+  beam_.setThreshold(header.beamThreshold);
+  stats_ = header.stats;
+  hyp_.clear();
+  if (lookahead_) {
+    lookahead_->clear();
+  }
+  hyp_.reserveFrames(nFrames + 1);
+  std::vector<SnapshotHypothesis> records;
+  for (int frame = 0; frame < nFrames; frame++) {
+    int nHyp = 0;
+    in.read(reinterpret_cast<char*>(&nHyp), sizeof(nHyp));
+    checkSnapshot(in && nHyp >= 0, "truncated");
+    records.resize(nHyp);
+    in.read(
+        reinterpret_cast<char*>(records.data()),
+        nHyp * sizeof(SnapshotHypothesis));
+    checkSnapshot(static_cast<bool>(in), "truncated");
+
+    const int nParents = frame > 0 ? hyp_[frame - 1].size() : 0;
+    auto& hyp = hyp_[frame];
+    hyp.reserve(nHyp);
+    for (const auto& record : records) {
+      checkSnapshot(
+          record.lmState >= 0 && record.lmState < lmStates.size() &&
+              record.lex >= 0 && record.lex < lexicon_->nNodes() &&
+              record.parent >= -1 && record.parent < nParents,
+          "bad hypothesis");
+      hyp.emplace_back(
+          lmStates[record.lmState],
+          lexicon_->getRoot() + record.lex,
+          record.parent < 0 ? nullptr : &hyp_[frame - 1][record.parent],
+          record.score,
+          record.lmScore,
+          record.token,
+          record.word,
+          record.prevBlank,
+          record.biasState);
+    }
+  }
+  nDecodedFrames_ = header.nDecodedFrames;
+  nPrunedFrames_ = header.nPrunedFrames;
+  nStableFrames_ = header.nStableFrames;
+  updateLMCache(lm_, hyp_[nFrames - 1]);
+}
+
+void LexiconDecoder::setBiasing(const BiasingTriePtr& biasing) {
+  biasing_ = biasing;
+}
+
+void LexiconDecoder::setLexicon(const FlatTriePtr& lexicon) {
+  nextLexicon_ = lexicon;
+}
+
+void LexiconDecoder::useNextLexicon() {
+  if (!nextLexicon_) {
+    return;
+  }
+  lexicon_ = std::move(nextLexicon_);
+  nextLexicon_ = nullptr;
+  // The lookahead scores the nodes of the lexicon
+  if (lookahead_) {
+    lookahead_ = std::make_shared<LMLookahead>(
+        lexicon_, lm_, opt_.lmLookaheadWords, opt_.lmLookaheadCacheSize);
+  }
+}
+
+void LexiconDecoder::setStableWordsCallback(
+    const StableWordsCallback& callback) {
+  stableWordsCallback_ = callback;
+}
+
+void LexiconDecoder::reportStableWords() {
+  if (!stableWordsCallback_ || nDecodedFrames_ <= nStableFrames_) {
+    return;
+  }
+
+  /* (1) Look for an ancestor only among the frames not reported yet */
+  int lookBack = 0;
+  const LexiconDecoderState* node = findCommonAncestor(
+      hyp_[nDecodedFrames_ - nPrunedFrames_],
+      lookBack,
+      nDecodedFrames_ - nStableFrames_ - 1);
+  if (!node) {
+    return;
+  }
+
+  /* (2) Collect the new words on its path */
+  const int stableFrame = nDecodedFrames_ - lookBack;
+  std::vector<int> words;
+  for (int frame = stableFrame; node && frame > nStableFrames_; frame--) {
+    if (node->getWord() >= 0) {
+      words.push_back(node->getWord());
+    }
+    node = node->parent;
+  }
+  std::reverse(words.begin(), words.end());
+
+  nStableFrames_ = stableFrame;
+  if (!words.empty()) {
+    stableWordsCallback_(words);
+  }
+}
+
 int LexiconDecoder::nHypothesis() const {
   int finalFrame = nDecodedFrames_ - nPrunedFrames_;
-  return hyp_.find(finalFrame)->second.size();
+  return hyp_[finalFrame].size();
 }
 
 int LexiconDecoder::nDecodedFramesInBuffer() const {
@@ -334,8 +871,8 @@ void LexiconDecoder::prune(int lookBack) {
   }
 
   /* (1) Find the last emitted word in the best path */
-  const LexiconDecoderState* bestNode = findBestAncestor(
-      hyp_.find(nDecodedFrames_ - nPrunedFrames_)->second, lookBack);
+  const LexiconDecoderState* bestNode =
+      findBestAncestor(hyp_[nDecodedFrames_ - nPrunedFrames_], lookBack);
   if (!bestNode) {
     return; // Not enough decoded frames to prune
   }
@@ -348,6 +885,12 @@ void LexiconDecoder::prune(int lookBack) {
   /* (2) Move things from back of hyp_ to front and normalize scores */
   pruneAndNormalize(hyp_, startFrame, lookBack);
 
+  /* (3) Release the frames which will not be back-tracked any more at once */
+  hyp_.release(lookBack + 1);
+
+  /* (4) Release the LM states no hypothesis can reach any more */
+  releaseLMStates(hyp_, lookBack + 1);
+
   nPrunedFrames_ = nDecodedFrames_ - lookBack;
 }
 
@@ -8,9 +8,13 @@
 
 #pragma once
 
+#include <functional>
+#include <iosfwd>
 #include <unordered_map>
 
+#include "libraries/decoder/BiasingTrie.h"
 #include "libraries/decoder/Decoder.h"
+#include "libraries/decoder/LMLookahead.h"
 #include "libraries/decoder/Trie.h"
 #include "libraries/lm/LM.h"
 
@@ -20,37 +24,45 @@ namespace w2l {
  */
 struct LexiconDecoderState {
   LMStatePtr lmState; // Language model state
-  const TrieNode* lex; // Trie node in the lexicon
+  const FlatTrieNode* lex; // Trie node in the lexicon
   const LexiconDecoderState* parent; // Parent hypothesis
   double score; // Score so far
+  double lmScore; // Part of the score from the LM and word insertions
   int token; // Label of token
   int word; // Label of word (-1 if incomplete)
   bool prevBlank; // If previous hypothesis is blank (for CTC only)
+  int biasState; // State in the phrases of the biasing trie (0 if none)
 
   LexiconDecoderState(
       const LMStatePtr& lmState,
-      const TrieNode* lex,
+      const FlatTrieNode* lex,
       const LexiconDecoderState* parent,
       const double score,
+      const double lmScore,
       const int token,
       const int word,
-      const bool prevBlank = false)
+      const bool prevBlank = false,
+      const int biasState = 0)
       : lmState(lmState),
         lex(lex),
         parent(parent),
         score(score),
+        lmScore(lmScore),
         token(token),
         word(word),
-        prevBlank(prevBlank) {}
+        prevBlank(prevBlank),
+        biasState(biasState) {}
 
   LexiconDecoderState()
       : lmState(nullptr),
         lex(nullptr),
         parent(nullptr),
         score(0),
+        lmScore(0),
         token(-1),
         word(-1),
-        prevBlank(false) {}
+        prevBlank(false),
+        biasState(0) {}
 
   int getWord() const {
     return word;
@@ -61,6 +73,12 @@ struct LexiconDecoderState {
   }
 };
 
+/**
+ * Callback receiving the words which became stable during the last
+ * `decodeStep()`, in order.
+ */
+using StableWordsCallback = std::function<void(const std::vector<int>&)>;
+
 /**
  * Decoder implements a beam seach decoder that finds the word transcription
  * W maximizing:
@@ -73,6 +91,15 @@ struct LexiconDecoderState {
  * score of the transcription W. Note that the lexicon is used to limit the
  * search space and all candidate words are generated from it if unkScore is
  * -inf, otherwise <UNK> will be generated for OOVs.
+ *
+ * The lexicon is searched through its FlatTrie representation. It can be
+ * compiled once and shared among decoders, or built by the decoder itself from
+ * a smeared Trie.
+ *
+ * For the latency of a single stream, a large beam can be expanded by several
+ * tasks of the TaskScheduler (`expandThreads`), each proposing the candidates
+ * of a range of the hypothesis to its own buffer. The buffers are merged in
+ * order, which gives the same beam as the serial expansion with max merging.
  */
 class LexiconDecoder : public Decoder {
  public:
@@ -85,6 +112,25 @@ class LexiconDecoder : public Decoder {
       const int unk,
       const std::vector<float>& transitions,
       const bool isLmToken)
+      : LexiconDecoder(
+            opt,
+            std::make_shared<FlatTrie>(*lexicon),
+            lm,
+            sil,
+            blank,
+            unk,
+            transitions,
+            isLmToken) {}
+
+  LexiconDecoder(
+      const DecoderOptions& opt,
+      const FlatTriePtr& lexicon,
+      const LMPtr& lm,
+      const int sil,
+      const int blank,
+      const int unk,
+      const std::vector<float>& transitions,
+      const bool isLmToken)
       : Decoder(opt),
         lexicon_(lexicon),
         lm_(lm),
@@ -92,7 +138,13 @@ class LexiconDecoder : public Decoder {
         blank_(blank),
         unk_(unk),
         transitions_(transitions),
-        isLmToken_(isLmToken) {}
+        isLmToken_(isLmToken) {
+    if (opt.lmLookaheadWords > 0 && !isLmToken) {
+      lookahead_ = std::make_shared<LMLookahead>(
+          lexicon, lm, opt.lmLookaheadWords, opt.lmLookaheadCacheSize);
+    }
+    selectDecodeFrame();
+  }
 
   void decodeBegin() override;
 
@@ -108,11 +160,78 @@ class LexiconDecoder : public Decoder {
 
   DecodeResult getBestHypothesis(int lookBack = 0) const override;
 
+  CompactDecodeResult getBestCompactHypothesis(
+      int lookBack = 0) const override;
+
+  /*
+   * Get the transcription up to the latest common ancestor of all the
+   * hypothesis in the beam, which can not change any more whatever comes next.
+   * It is empty if the hypothesis of the buffer do not share any ancestor.
+   */
+  DecodeResult getStablePrefix() const;
+
+  /*
+   * Get the best hypothesis over the frames after the last ones reported to
+   * the stable words callback, i.e. the part of the transcription which may
+   * still change. Its words follow the reported ones.
+   */
+  DecodeResult getPartialHypothesis() const;
+
+  /*
+   * Prune the frames reported to the stable words callback, which no
+   * hypothesis can change any more, so that the buffer of a stream only
+   * holds its unstable frames.
+   */
+  void pruneStable();
+
+  /*
+   * Get the word lattice of all the hypothesis in the beam, their final nodes
+   * being in the order of `getAllFinalHypothesis()`. Scores of the arcs are
+   * only consistent within the frames decoded since the last `prune()`.
+   */
+  WordLattice getLattice() const;
+
+  /*
+   * Set a callback to be called at the end of `decodeStep()` with the words
+   * which have become stable since the last call, so that online decoding can
+   * emit words before `decodeEnd()`.
+   */
+  void setStableWordsCallback(const StableWordsCallback& callback);
+
+  /*
+   * Boost the phrases of `biasing` in the next utterances, nullptr to stop.
+   * The bonuses are added to the scores as they are, without the LM weight.
+   */
+  void setBiasing(const BiasingTriePtr& biasing);
+
+  /*
+   * Search `lexicon` from the next `decodeBegin()`, e.g. one compiled from a
+   * fork of the Trie with new words (see Trie::fork()): the utterance being
+   * decoded, or restored from a snapshot, keeps the lexicon its hypotheses
+   * point into.
+   */
+  void setLexicon(const FlatTriePtr& lexicon);
+
+  /*
+   * Write the state of the utterance being decoded to `out`: the hypothesis
+   * of the frames in the buffer, i.e. of the last ones after `prune()`, and
+   * their LM states (see LM::saveState()). A decoder with the same options,
+   * lexicon, LM and biasing phrases, in this process or another one, resumes
+   * the utterance with `restore()` without replaying its emissions.
+   */
+  void snapshot(std::ostream& out) const;
+
+  /*
+   * Resume the utterance saved by `snapshot()` from `in`, in place of
+   * `decodeBegin()`. Throws if `in` is not a valid snapshot for the lexicon.
+   */
+  void restore(std::istream& in);
+
   std::vector<DecodeResult> getAllFinalHypothesis() const override;
 
  protected:
   // Lexicon trie to restrict beam-search decoder
-  TriePtr lexicon_;
+  FlatTriePtr lexicon_;
   LMPtr lm_;
   // Index of silence label
   int sil_;
@@ -120,51 +239,171 @@ class LexiconDecoder : public Decoder {
   int blank_;
   // Index of unknown word
   int unk_;
-  // matrix of transitions (for ASG criterion)
-  std::vector<float> transitions_;
+  // Transitions by previous token (for ASG criterion)
+  TransitionMatrix transitions_;
   // if LM is token-level (operates on the same level as acoustic model)
   // or it is word-level (in case of false)
   bool isLmToken_;
+  // LM lookahead of the partial words, if enabled in the options
+  std::shared_ptr<LMLookahead> lookahead_;
+  // Phrases boosted for the session, if any
+  BiasingTriePtr biasing_;
+  // Lexicon set for the next utterances, if any
+  FlatTriePtr nextLexicon_;
 
   // All the hypothesis new candidates (can be larger than beamsize) proposed
   // based on the ones from previous frame
-  std::vector<LexiconDecoderState> candidates_;
+  CandidateBuffer<LexiconDecoderState> candidates_;
 
-  // This vector is designed for efficient sorting and merging the candidates_,
-  // so instead of moving around objects, we only need to sort pointers
+  // This vector is designed for efficient sorting of the candidates_, so
+  // instead of moving around objects, we only need to sort pointers
   std::vector<LexiconDecoderState*> candidatePtrs_;
 
+  // Hash index on (lmState, lex, token, prevBlank, biasState) of candidates_,
+  // used to merge candidates while they are proposed
+  CandidateHashIndex candidatesIndex_;
+
   // Best candidate score of current frame
   double candidatesBestScore_;
 
-  // Vector of hypothesis for all the frames so far
-  std::unordered_map<int, std::vector<LexiconDecoderState>> hyp_;
+  // Hypothesis for all the frames so far, the storage of each frame is reused
+  // across frames and utterances
+  HypothesisArena<LexiconDecoderState> hyp_;
 
   // These 2 variables are used for online decoding, for hypothesis pruning
   int nDecodedFrames_; // Total number of decoded frames.
   int nPrunedFrames_; // Total number of pruned frames from hyp_.
 
+  // Words up to this frame have been reported to stableWordsCallback_
+  int nStableFrames_;
+  StableWordsCallback stableWordsCallback_;
+
+  // Indices of the tokens sorted by their emission score in the current frame
+  std::vector<size_t> tokenIdx_;
+
+  // (token, child) pairs of the lexicon nodes of the current frame, the
+  // ones of hypothesis h being in [lexChildrenOffsets_[h],
+  // lexChildrenOffsets_[h + 1]), and their LM queries scored at once, the
+  // ones of hypothesis h starting at lmQueryOffsets_[h]
+  std::vector<std::pair<int, const FlatTrieNode*>> lexChildren_;
+  std::vector<int> lexChildrenOffsets_;
+  std::vector<int> lmQueryOffsets_;
+  LMQueryBatch lmQueries_;
+
+  // Candidates proposed by a task of the parallel expansion of a frame, from
+  // a range of the hypothesis, before they are merged into candidates_
+  struct CandidateShard {
+    CandidateBuffer<LexiconDecoderState> candidates;
+    CandidateHashIndex index;
+    double bestScore;
+    DecoderStats stats;
+  };
+  std::vector<CandidateShard> shards_;
+
+  // Expand the hypothesis of the last decoded frame with one frame of N
+  // emissions. `hyp_` must already hold the storage for the next frame, and
+  // the LM cache is left to the caller to update.
+  void decodeFrame(const float* emissions, int N) {
+    (this->*decodeFrame_)(emissions, N);
+  }
+
+  // decodeFrame() specialized for a criterion, a token or word LM, and the
+  // ZeroLM, so that the inner loops do not branch on them. ZeroLM queries
+  // are answered inline rather than batched: the lexicon search is then a
+  // pure trie search.
+  template <CriterionType kCriterion, bool kIsLmToken, bool kZeroLm>
+  void decodeFrameImpl(const float* emissions, int N);
+
+  // Propose the candidates of hypothesis h of `frame` to `shard`, or to
+  // candidates_ if nullptr. The LM queries of the frame must be scored.
+  template <CriterionType kCriterion, bool kIsLmToken, bool kZeroLm>
+  void expandHypothesis(
+      const int frame,
+      const int h,
+      const float* emissions,
+      const int N,
+      const bool blankOnly,
+      CandidateShard* shard);
+
+  // Expand the hypothesis of `frame` in `nShards` tasks of the TaskScheduler,
+  // then merge their candidates into candidates_ in the order of the
+  // hypothesis, as a serial expansion proposes them
+  template <CriterionType kCriterion, bool kIsLmToken, bool kZeroLm>
+  void expandInShards(
+      const int frame,
+      const float* emissions,
+      const int N,
+      const bool blankOnly,
+      const int nShards);
+
+  using DecodeFrameFn = void (LexiconDecoder::*)(const float*, int);
+
+  // Specialization of decodeFrame() for the options and LM of the decoder
+  DecodeFrameFn decodeFrame_;
+
+  template <CriterionType kCriterion>
+  static DecodeFrameFn decodeFrameFor(
+      const bool isLmToken,
+      const bool isZeroLm);
+
+  void selectDecodeFrame();
+
+  // Score of the partial words of lexicon node `lex` after `state`: its LM
+  // lookahead if enabled, otherwise its smeared score
+  float lexiconScore(const LMStatePtr& state, const FlatTrieNode* lex) {
+    if (lex == lexicon_->getRoot()) {
+      return 0;
+    }
+    return lookahead_ ? lookahead_->score(state, lex, stats_) : lex->maxScore;
+  }
+
+  // Result of LM query `query` of the frame, from `state` with `token`,
+  // moving `query` to the next one
+  template <bool kZeroLm>
+  std::pair<LMStatePtr, float>
+  nextLmQuery(int& query, const LMStatePtr& state, const int token) {
+    if (kZeroLm) {
+      countLMQuery(stats_, state, token);
+      return std::make_pair(state->child<LMState>(token), 0.0f);
+    }
+    return lmQueries_.result(query++);
+  }
+
+  // Biasing state after `word` from `state`, and the bonus of the word
+  std::pair<int, float> nextBias(const int state, const int word) const {
+    return biasing_ ? biasing_->next(state, word) : std::make_pair(state, 0.0f);
+  }
+
+  // Call stableWordsCallback_ with the words which have become stable
+  void reportStableWords();
+
+  // Switch to the lexicon of setLexicon(), at the start of an utterance
+  void useNextLexicon();
+
   // Reset candidates buffer for decoding a new input frame
   void candidatesReset();
 
-  // Add a new candidate to the buffer
+  // Add a new candidate to the buffer, or merge it with the candidate getting
+  // into the same state. The candidate goes to `shard` instead if not null.
   void candidatesAdd(
       const LMStatePtr& lmState,
-      const TrieNode* lex,
+      const FlatTrieNode* lex,
       const LexiconDecoderState* parent,
       const double score,
+      const double lmScore,
       const int token,
       const int label,
-      const bool prevBlank);
+      const bool prevBlank,
+      const int biasState,
+      CandidateShard* shard = nullptr);
 
-  // Merge and sort candidates proposed in the current frame and place them into
-  // the `hyp_` buffer
+  // Sort candidates proposed in the current frame and place them into the
+  // `hyp_` buffer
   void candidatesStore(
       std::vector<LexiconDecoderState>& nextHyp,
       const bool isSort);
 
-  // Merge hypothesis getting into same state from different path
-  void mergeCandidates();
+  friend class BatchLexiconDecoder;
 };
 
 } // namespace w2l
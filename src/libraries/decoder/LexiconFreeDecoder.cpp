@@ -17,6 +17,7 @@
 namespace w2l {
 
 void LexiconFreeDecoder::candidatesReset() {
+  beam_.stepBegin();
   candidatesBestScore_ = kNegativeInfinity;
   candidates_.clear();
   candidatePtrs_.clear();
@@ -55,6 +56,7 @@ void LexiconFreeDecoder::mergeCandidates() {
     }
   }
 
+  stats_.merged += candidatePtrs_.size() - nHypAfterMerging;
   candidatePtrs_.resize(nHypAfterMerging);
 }
 
@@ -64,7 +66,8 @@ void LexiconFreeDecoder::candidatesAdd(
     const double score,
     const int token,
     const bool prevBlank) {
-  if (isValidCandidate(candidatesBestScore_, score, opt_.beamThreshold)) {
+  ++stats_.candidates;
+  if (isValidCandidate(candidatesBestScore_, score, beam_.threshold())) {
     candidates_.emplace_back(
         LexiconFreeDecoderState(lmState, parent, score, token, prevBlank));
   }
@@ -79,17 +82,22 @@ void LexiconFreeDecoder::candidatesStore(
   }
 
   /* Select valid candidates */
+  beam_.stepEnd(candidates_.scores(), candidates_.size(), candidatesBestScore_);
   pruneCandidates(
-      candidatePtrs_, candidates_, candidatesBestScore_ - opt_.beamThreshold);
+      candidatePtrs_, candidates_, candidatesBestScore_ - beam_.threshold());
 
   /* Sort by (LmState, lex, score) and copy into next hypothesis */
   mergeCandidates();
 
   /* Sort hypothesis and select top-K */
-  storeTopCandidates(nextHyp, candidatePtrs_, opt_.beamSize, returnSorted);
+  storeTopCandidates(
+      nextHyp, candidates_, candidatePtrs_, opt_.beamSize, returnSorted);
+  stats_.stored += nextHyp.size();
 }
 
 void LexiconFreeDecoder::decodeBegin() {
+  beam_.reset();
+  stats_ = DecoderStats();
   hyp_.clear();
   hyp_.emplace(0, std::vector<LexiconFreeDecoderState>());
 
@@ -99,6 +107,14 @@ void LexiconFreeDecoder::decodeBegin() {
   nPrunedFrames_ = 0;
 }
 
+bool LexiconFreeDecoder::eatsNewToken(
+    const LexiconFreeDecoderState& prevHyp,
+    const int n) const {
+  return (opt_.criterionType == CriterionType::ASG && n != prevHyp.token) ||
+      (opt_.criterionType == CriterionType::CTC && n != blank_ &&
+       (n != prevHyp.token || prevHyp.prevBlank));
+}
+
 void LexiconFreeDecoder::decodeStep(const float* emissions, int T, int N) {
   int startFrame = nDecodedFrames_ - nPrunedFrames_;
   // Extend hyp_ buffer
@@ -108,39 +124,42 @@ void LexiconFreeDecoder::decodeStep(const float* emissions, int T, int N) {
     }
   }
 
-  std::vector<size_t> idx(N);
+  std::vector<size_t> idx;
   // Looping over all the frames
   for (int t = 0; t < T; t++) {
-    std::iota(idx.begin(), idx.end(), 0);
-    if (N > opt_.beamSizeToken) {
-      std::partial_sort(
-          idx.begin(),
-          idx.begin() + opt_.beamSizeToken,
-          idx.end(),
-          [&t, &N, &emissions](const size_t& l, const size_t& r) {
-            return emissions[t * N + l] > emissions[t * N + r];
-          });
+    // A blank frame only goes through the blank transition
+    if (isBlankFrame(emissions + t * N, blank_, opt_)) {
+      idx.assign(1, blank_);
+    } else {
+      selectTokens(emissions + t * N, N, idx);
     }
 
+    // Score the LM queries for all the hypothesis at once
+    for (const LexiconFreeDecoderState& prevHyp : hyp_[startFrame + t]) {
+      for (const int n : idx) {
+        if (eatsNewToken(prevHyp, n)) {
+          lmQueries_.add(prevHyp.lmState, n);
+        }
+      }
+    }
+    lmQueries_.score(*lm_, stats_);
+
     candidatesReset();
     for (const LexiconFreeDecoderState& prevHyp : hyp_[startFrame + t]) {
       const int prevIdx = prevHyp.token;
 
-      for (int r = 0; r < std::min(opt_.beamSizeToken, N); ++r) {
-        int n = idx[r];
+      for (const int n : idx) {
         double score = prevHyp.score + emissions[t * N + n];
         if (nDecodedFrames_ + t > 0 &&
             opt_.criterionType == CriterionType::ASG) {
-          score += transitions_[n * N + prevIdx];
+          score += transitions_.from(prevIdx)[n];
         }
         if (n == sil_) {
           score += opt_.silScore;
         }
 
-        if ((opt_.criterionType == CriterionType::ASG && n != prevIdx) ||
-            (opt_.criterionType == CriterionType::CTC && n != blank_ &&
-             (n != prevIdx || prevHyp.prevBlank))) {
-          auto lmReturn = lm_->score(prevHyp.lmState, n);
+        if (eatsNewToken(prevHyp, n)) {
+          auto lmReturn = lmQueries_.next();
           score += lmReturn.second * opt_.lmWeight;
 
           candidatesAdd(
@@ -171,9 +190,12 @@ void LexiconFreeDecoder::decodeStep(const float* emissions, int T, int N) {
     }
 
     candidatesStore(hyp_[startFrame + t + 1], false);
+    lmQueries_.clear();
     updateLMCache(lm_, hyp_[startFrame + t + 1]);
   }
   nDecodedFrames_ += T;
+  stats_.frames += T;
+  stats_.updatePeakBytes(hypothesisBytes(hyp_) + candidates_.bytes());
 }
 
 void LexiconFreeDecoder::decodeEnd() {
@@ -182,6 +204,7 @@ void LexiconFreeDecoder::decodeEnd() {
        hyp_[nDecodedFrames_ - nPrunedFrames_]) {
     const LMStatePtr& prevLmState = prevHyp.lmState;
 
+    ++stats_.lmQueries;
     auto lmReturn = lm_->finish(prevLmState);
     candidatesAdd(
         lmReturn.first,
@@ -209,6 +232,16 @@ DecodeResult LexiconFreeDecoder::getBestHypothesis(int lookBack) const {
   return getHypothesis(bestNode, nDecodedFrames_ - nPrunedFrames_ - lookBack);
 }
 
+CompactDecodeResult LexiconFreeDecoder::getBestCompactHypothesis(
+    int lookBack) const {
+  int finalFrame = nDecodedFrames_ - nPrunedFrames_;
+  const LexiconFreeDecoderState* bestNode =
+      findBestAncestor(hyp_.find(finalFrame)->second, lookBack);
+
+  return getCompactHypothesis(
+      bestNode, nDecodedFrames_ - nPrunedFrames_ - lookBack);
+}
+
 int LexiconFreeDecoder::nHypothesis() const {
   int finalFrame = nDecodedFrames_ - nPrunedFrames_;
   return hyp_.find(finalFrame)->second.size();
@@ -239,6 +272,16 @@ void LexiconFreeDecoder::prune(int lookBack) {
   /* (2) Move things from back of hyp_ to front and normalize scores */
   pruneAndNormalize(hyp_, startFrame, lookBack);
 
+  /* (3) Release the frames which will not be back-tracked any more */
+  for (auto& frame : hyp_) {
+    if (frame.first > lookBack) {
+      frame.second.clear();
+    }
+  }
+
+  /* (4) Release the LM states no hypothesis can reach any more */
+  releaseLMStates(hyp_, lookBack + 1);
+
   nPrunedFrames_ = nDecodedFrames_ - lookBack;
 }
 
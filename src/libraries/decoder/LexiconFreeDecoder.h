@@ -91,15 +91,18 @@ class LexiconFreeDecoder : public Decoder {
 
   DecodeResult getBestHypothesis(int lookBack = 0) const override;
 
+  CompactDecodeResult getBestCompactHypothesis(
+      int lookBack = 0) const override;
+
   std::vector<DecodeResult> getAllFinalHypothesis() const override;
 
  protected:
   LMPtr lm_;
-  std::vector<float> transitions_;
+  TransitionMatrix transitions_;
 
   // All the hypothesis new candidates (can be larger than beamsize) proposed
   // based on the ones from previous frame
-  std::vector<LexiconFreeDecoderState> candidates_;
+  CandidateBuffer<LexiconFreeDecoderState> candidates_;
 
   // This vector is designed for efficient sorting and merging the candidates_,
   // so instead of moving around objects, we only need to sort pointers
@@ -121,6 +124,13 @@ class LexiconFreeDecoder : public Decoder {
   int nDecodedFrames_; // Total number of decoded frames.
   int nPrunedFrames_; // Total number of pruned frames from hyp_.
 
+  // LM queries of the current frame, scored at once
+  LMQueryBatch lmQueries_;
+
+  // True if token `n` extends the transcription of `prevHyp`, i.e. is scored
+  // by the LM
+  bool eatsNewToken(const LexiconFreeDecoderState& prevHyp, const int n) const;
+
   // Reset candidates buffer for decoding a new input frame
   void candidatesReset();
 
@@ -17,37 +17,11 @@
 namespace w2l {
 
 void LexiconFreeSeq2SeqDecoder::candidatesReset() {
+  beam_.stepBegin();
   candidatesBestScore_ = kNegativeInfinity;
   candidates_.clear();
   candidatePtrs_.clear();
-}
-
-void LexiconFreeSeq2SeqDecoder::mergeCandidates() {
-  auto compareNodesShortList = [](const LexiconFreeSeq2SeqDecoderState* node1,
-                                  const LexiconFreeSeq2SeqDecoderState* node2) {
-    int lmCmp = node1->lmState->compare(node2->lmState);
-    if (lmCmp != 0) {
-      return lmCmp > 0;
-    } else { /* same LmState */
-      return node1->score > node2->score;
-    }
-  };
-  std::sort(
-      candidatePtrs_.begin(), candidatePtrs_.end(), compareNodesShortList);
-
-  int nHypAfterMerging = 1;
-  for (int i = 1; i < candidatePtrs_.size(); i++) {
-    if (candidatePtrs_[i]->lmState->compare(
-            candidatePtrs_[nHypAfterMerging - 1]->lmState)) {
-      candidatePtrs_[nHypAfterMerging] = candidatePtrs_[i];
-      nHypAfterMerging++;
-    } else {
-      mergeStates(
-          candidatePtrs_[nHypAfterMerging - 1], candidatePtrs_[i], opt_.logAdd);
-    }
-  }
-
-  candidatePtrs_.resize(nHypAfterMerging);
+  candidatesIndex_.clear();
 }
 
 void LexiconFreeSeq2SeqDecoder::candidatesAdd(
@@ -56,10 +30,41 @@ void LexiconFreeSeq2SeqDecoder::candidatesAdd(
     const double score,
     const int token,
     const AMStatePtr& amState) {
-  if (isValidCandidate(candidatesBestScore_, score, opt_.beamThreshold)) {
+  ++stats_.candidates;
+  if (!isValidCandidate(candidatesBestScore_, score, beam_.threshold())) {
+    return;
+  }
+
+  // A complete hypothesis carried to the next step keeps its tokens
+  const size_t prefixHash = parent->token == eos_
+      ? parent->prefixHash
+      : hashCombine(parent->prefixHash, token);
+
+  /* Merge hypothesis getting into the same state from different paths */
+  size_t hash =
+      hashCombine(prefixHash, std::hash<const LMState*>()(lmState.get()));
+  int position = candidatesIndex_.findOrInsert(
+      hash, candidates_.size(), [&](const int idx) {
+        const LexiconFreeSeq2SeqDecoderState& candidate = candidates_[idx];
+        return candidate.prefixHash == prefixHash &&
+            candidate.lmState->compare(lmState) == 0;
+      });
+  if (position < 0) {
     candidates_.emplace_back(
-        LexiconFreeSeq2SeqDecoderState(lmState, parent, score, token, amState));
+        lmState, parent, score, token, amState, prefixHash);
+    return;
+  }
+
+  ++stats_.merged;
+  LexiconFreeSeq2SeqDecoderState& merged = candidates_[position];
+  LexiconFreeSeq2SeqDecoderState proposed(
+      lmState, parent, score, token, amState, prefixHash);
+  if (proposed.score > merged.score) {
+    // Keep the path of the best scoring hypothesis
+    std::swap(merged, proposed);
   }
+  mergeStates(&merged, &proposed, opt_.logAdd);
+  candidates_.updateScore(position);
 }
 
 void LexiconFreeSeq2SeqDecoder::candidatesStore(
@@ -70,15 +75,15 @@ void LexiconFreeSeq2SeqDecoder::candidatesStore(
     return;
   }
 
-  /* Select valid candidates */
+  /* Select valid candidates (already merged in `candidatesAdd()`) */
+  beam_.stepEnd(candidates_.scores(), candidates_.size(), candidatesBestScore_);
   pruneCandidates(
-      candidatePtrs_, candidates_, candidatesBestScore_ - opt_.beamThreshold);
-
-  /* Sort by (LmState, lex, score) and copy into next hypothesis */
-  mergeCandidates();
+      candidatePtrs_, candidates_, candidatesBestScore_ - beam_.threshold());
 
   /* Sort hypothesis and select top-K */
-  storeTopCandidates(nextHyp, candidatePtrs_, opt_.beamSize, isSort);
+  storeTopCandidates(
+      nextHyp, candidates_, candidatePtrs_, opt_.beamSize, isSort);
+  stats_.stored += nextHyp.size();
 }
 
 void LexiconFreeSeq2SeqDecoder::decodeStep(
@@ -93,6 +98,8 @@ void LexiconFreeSeq2SeqDecoder::decodeStep(
   }
 
   // Start from here.
+  beam_.reset();
+  stats_ = DecoderStats();
   hyp_[0].clear();
   hyp_[0].emplace_back(lm_->start(0), nullptr, 0.0, -1, nullptr);
 
@@ -122,7 +129,7 @@ void LexiconFreeSeq2SeqDecoder::decodeStep(
     std::tie(amScores, outStates) =
         amUpdateFunc_(emissions, N, T, rawY_, rawPrevStates_, t);
 
-    std::vector<size_t> idx(amScores.back().size());
+    std::vector<size_t> idx;
 
     // Generate new hypothesis
     for (int hypo = 0, validHypo = 0; hypo < hyp_[t].size(); hypo++) {
@@ -139,24 +146,17 @@ void LexiconFreeSeq2SeqDecoder::decodeStep(
         continue;
       }
 
-      std::iota(idx.begin(), idx.end(), 0);
-      if (amScores[validHypo].size() > opt_.beamSizeToken) {
-        std::partial_sort(
-            idx.begin(),
-            idx.begin() + opt_.beamSizeToken,
-            idx.end(),
-            [&amScores, &validHypo](const size_t& l, const size_t& r) {
-              return amScores[validHypo][l] > amScores[validHypo][r];
-            });
-      }
+      selectTopTokens(
+          amScores[validHypo].data(),
+          amScores[validHypo].size(),
+          opt_.beamSizeToken,
+          idx);
 
-      for (int r = 0;
-           r < std::min(amScores[validHypo].size(), (size_t)opt_.beamSizeToken);
-           r++) {
-        int n = idx[r];
+      for (const int n : idx) {
         double score = prevHyp.score + amScores[validHypo][n];
 
         if (n == eos_) { /* (1) Try eos */
+          ++stats_.lmQueries;
           auto lmScoreReturn = lm_->finish(prevHyp.lmState);
 
           candidatesAdd(
@@ -166,6 +166,7 @@ void LexiconFreeSeq2SeqDecoder::decodeStep(
               n,
               nullptr);
         } else { /* (2) Try normal token */
+          countLMQuery(stats_, prevHyp.lmState, n);
           auto lmScoreReturn = lm_->score(prevHyp.lmState, n);
           candidatesAdd(
               lmScoreReturn.first,
@@ -179,9 +180,23 @@ void LexiconFreeSeq2SeqDecoder::decodeStep(
     }
     candidatesStore(hyp_[t + 1], true);
     updateLMCache(lm_, hyp_[t + 1]);
-
+    ++stats_.frames;
+
+    if (opt_.earlyStopping != EarlyStopping::NONE &&
+        canStopSearch(
+            hyp_[t + 1],
+            t + 1,
+            maxOutputLength_,
+            eos_,
+            opt_,
+            0, // stepBonus
+            [](const LexiconFreeSeq2SeqDecoderState&) { return 0.0; })) {
+      ++t;
+      break;
+    }
   } // End of decoding
 
+  stats_.updatePeakBytes(hypothesisBytes(hyp_) + candidates_.bytes());
   while (t > 0 && hyp_[t].empty()) {
     --t;
   }
@@ -189,6 +204,7 @@ void LexiconFreeSeq2SeqDecoder::decodeStep(
   for (int i = 0; i < hyp_[t].size(); i++) {
     hyp_[maxOutputLength_ + 1][i] = std::move(hyp_[t][i]);
   }
+  sortByNormalizedScore(hyp_[maxOutputLength_ + 1], t, eos_, opt_);
 }
 
 std::vector<DecodeResult> LexiconFreeSeq2SeqDecoder::getAllFinalHypothesis()
@@ -35,25 +35,29 @@ struct LexiconFreeSeq2SeqDecoderState {
   double score; // Score so far
   int token; // Label of token
   AMStatePtr amState; // Acoustic model state
+  size_t prefixHash; // Rolling hash of the tokens of the hypothesis
 
   LexiconFreeSeq2SeqDecoderState(
       const LMStatePtr& lmState,
       const LexiconFreeSeq2SeqDecoderState* parent,
       const double score,
       const int token,
-      const AMStatePtr& amState = nullptr)
+      const AMStatePtr& amState = nullptr,
+      const size_t prefixHash = 0)
       : lmState(lmState),
         parent(parent),
         score(score),
         token(token),
-        amState(amState) {}
+        amState(amState),
+        prefixHash(prefixHash) {}
 
   LexiconFreeSeq2SeqDecoderState()
       : lmState(nullptr),
         parent(nullptr),
         score(0),
         token(-1),
-        amState(nullptr) {}
+        amState(nullptr),
+        prefixHash(0) {}
 
   int getWord() const {
     return -1;
@@ -70,6 +74,10 @@ struct LexiconFreeSeq2SeqDecoderState {
  * constrained by a lexicon, and thus the language model must operate at
  * token-level.
  *
+ * Hypothesis with the same tokens and LM state are merged as they are
+ * proposed, through a hash index on a rolling hash of their tokens, so that
+ * the beam, and thus the AM updates of a step, hold each prefix once.
+ *
  * TODO: Doesn't support online decoding now.
  *
  */
@@ -105,8 +113,11 @@ class LexiconFreeSeq2SeqDecoder : public Decoder {
   std::vector<AMStatePtr> rawPrevStates_;
   int maxOutputLength_;
 
-  std::vector<LexiconFreeSeq2SeqDecoderState> candidates_;
+  CandidateBuffer<LexiconFreeSeq2SeqDecoderState> candidates_;
   std::vector<LexiconFreeSeq2SeqDecoderState*> candidatePtrs_;
+  // Hash index on (prefixHash, lmState) of candidates_, used to merge
+  // candidates while they are proposed
+  CandidateHashIndex candidatesIndex_;
   double candidatesBestScore_;
 
   std::unordered_map<int, std::vector<LexiconFreeSeq2SeqDecoderState>> hyp_;
@@ -123,8 +134,6 @@ class LexiconFreeSeq2SeqDecoder : public Decoder {
   void candidatesStore(
       std::vector<LexiconFreeSeq2SeqDecoderState>& nextHyp,
       const bool isSort);
-
-  void mergeCandidates();
 };
 
 } // namespace w2l
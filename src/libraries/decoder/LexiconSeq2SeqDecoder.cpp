@@ -22,6 +22,7 @@
 namespace w2l {
 
 void LexiconSeq2SeqDecoder::candidatesReset() {
+  beam_.stepBegin();
   candidatesBestScore_ = kNegativeInfinity;
   candidates_.clear();
   candidatePtrs_.clear();
@@ -60,6 +61,7 @@ void LexiconSeq2SeqDecoder::mergeCandidates() {
     }
   }
 
+  stats_.merged += candidatePtrs_.size() - nHypAfterMerging;
   candidatePtrs_.resize(nHypAfterMerging);
 }
 
@@ -71,7 +73,8 @@ void LexiconSeq2SeqDecoder::candidatesAdd(
     const int token,
     const int word,
     const AMStatePtr& amState) {
-  if (isValidCandidate(candidatesBestScore_, score, opt_.beamThreshold)) {
+  ++stats_.candidates;
+  if (isValidCandidate(candidatesBestScore_, score, beam_.threshold())) {
     candidates_.emplace_back(LexiconSeq2SeqDecoderState(
         lmState, lex, parent, score, token, word, amState));
   }
@@ -86,14 +89,17 @@ void LexiconSeq2SeqDecoder::candidatesStore(
   }
 
   /* Select valid candidates */
+  beam_.stepEnd(candidates_.scores(), candidates_.size(), candidatesBestScore_);
   pruneCandidates(
-      candidatePtrs_, candidates_, candidatesBestScore_ - opt_.beamThreshold);
+      candidatePtrs_, candidates_, candidatesBestScore_ - beam_.threshold());
 
   /* Sort by (LmState, lex, score) and copy into next hypothesis */
   mergeCandidates();
 
   /* Sort hypothesis and select top-K */
-  storeTopCandidates(nextHyp, candidatePtrs_, opt_.beamSize, isSort);
+  storeTopCandidates(
+      nextHyp, candidates_, candidatePtrs_, opt_.beamSize, isSort);
+  stats_.stored += nextHyp.size();
 }
 
 void LexiconSeq2SeqDecoder::decodeStep(const float* emissions, int T, int N) {
@@ -105,6 +111,8 @@ void LexiconSeq2SeqDecoder::decodeStep(const float* emissions, int T, int N) {
   }
 
   // Start from here.
+  beam_.reset();
+  stats_ = DecoderStats();
   hyp_[0].clear();
   hyp_[0].emplace_back(
       lm_->start(0), lexicon_->getRoot(), nullptr, 0.0, -1, -1, nullptr);
@@ -140,7 +148,7 @@ void LexiconSeq2SeqDecoder::decodeStep(const float* emissions, int T, int N) {
     std::tie(amScores, outStates) =
         amUpdateFunc_(emissions, N, T, rawY_, rawPrevStates_, t);
 
-    std::vector<size_t> idx(amScores.back().size());
+    std::vector<size_t> idx;
 
     // Generate new hypothesis
     for (int hypo = 0, validHypo = 0; hypo < hyp_[t].size(); hypo++) {
@@ -168,25 +176,18 @@ void LexiconSeq2SeqDecoder::decodeStep(const float* emissions, int T, int N) {
       const float lexMaxScore =
           prevLex == lexicon_->getRoot() ? 0 : prevLex->maxScore;
 
-      std::iota(idx.begin(), idx.end(), 0);
-      if (amScores[validHypo].size() > opt_.beamSizeToken) {
-        std::partial_sort(
-            idx.begin(),
-            idx.begin() + opt_.beamSizeToken,
-            idx.end(),
-            [&amScores, &validHypo](const size_t& l, const size_t& r) {
-              return amScores[validHypo][l] > amScores[validHypo][r];
-            });
-      }
+      selectTopTokens(
+          amScores[validHypo].data(),
+          amScores[validHypo].size(),
+          opt_.beamSizeToken,
+          idx);
 
-      for (int r = 0;
-           r < std::min(amScores[validHypo].size(), (size_t)opt_.beamSizeToken);
-           r++) {
-        int n = idx[r];
+      for (const int n : idx) {
         double score = prevHyp.score + amScores[validHypo][n];
 
         /* (1) Try eos */
         if (n == eos_ && (prevLex == lexicon_->getRoot())) {
+          ++stats_.lmQueries;
           auto lmReturn = lm_->finish(prevHyp.lmState);
           LMStatePtr lmState = lmReturn.first;
           double lmScore;
@@ -209,10 +210,12 @@ void LexiconSeq2SeqDecoder::decodeStep(const float* emissions, int T, int N) {
         if (n != eos_) {
           auto searchLex = prevLex->children.find(n);
           if (searchLex != prevLex->children.end()) {
+            ++stats_.trieExpansions;
             auto lex = searchLex->second;
             LMStatePtr lmState;
             double lmScore;
             if (isLmToken_) {
+              countLMQuery(stats_, prevHyp.lmState, n);
               auto lmReturn = lm_->score(prevHyp.lmState, n);
               lmState = lmReturn.first;
               lmScore = lmReturn.second;
@@ -232,6 +235,7 @@ void LexiconSeq2SeqDecoder::decodeStep(const float* emissions, int T, int N) {
             if (lex->labels.size() > 0) {
               for (auto word : lex->labels) {
                 if (!isLmToken_) {
+                  countLMQuery(stats_, prevHyp.lmState, word);
                   auto lmReturn = lm_->score(prevHyp.lmState, word);
                   lmState = lmReturn.first;
                   lmScore = lmReturn.second - lexMaxScore;
@@ -256,8 +260,30 @@ void LexiconSeq2SeqDecoder::decodeStep(const float* emissions, int T, int N) {
     }
     candidatesStore(hyp_[t + 1], true);
     updateLMCache(lm_, hyp_[t + 1]);
+    ++stats_.frames;
+
+    // The smeared LM score of a partial word is refunded with the word
+    auto pending = [this](const LexiconSeq2SeqDecoderState& hyp) {
+      if (isLmToken_ || hyp.lex == lexicon_->getRoot()) {
+        return 0.0;
+      }
+      return std::max<double>(0, -opt_.lmWeight * hyp.lex->maxScore);
+    };
+    if (opt_.earlyStopping != EarlyStopping::NONE &&
+        canStopSearch(
+            hyp_[t + 1],
+            t + 1,
+            maxOutputLength_,
+            eos_,
+            opt_,
+            opt_.wordScore, // stepBonus
+            pending)) {
+      ++t;
+      break;
+    }
   } // End of decoding
 
+  stats_.updatePeakBytes(hypothesisBytes(hyp_) + candidates_.bytes());
   while (t > 0 && hyp_[t].empty()) {
     --t;
   }
@@ -265,6 +291,7 @@ void LexiconSeq2SeqDecoder::decodeStep(const float* emissions, int T, int N) {
   for (int i = 0; i < hyp_[t].size(); i++) {
     hyp_[maxOutputLength_ + 1][i] = std::move(hyp_[t][i]);
   }
+  sortByNormalizedScore(hyp_[maxOutputLength_ + 1], t, eos_, opt_);
 }
 
 std::vector<DecodeResult> LexiconSeq2SeqDecoder::getAllFinalHypothesis() const {
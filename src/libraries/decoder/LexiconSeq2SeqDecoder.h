@@ -110,6 +110,15 @@ class LexiconSeq2SeqDecoder : public Decoder {
 
   std::vector<DecodeResult> getAllFinalHypothesis() const override;
 
+  /*
+   * Search `lexicon` in the next calls of `decodeStep()`, e.g. a fork of the
+   * trie with new words (see Trie::fork()), which leaves the current one to
+   * the decoders still searching it.
+   */
+  void setLexicon(const TriePtr& lexicon) {
+    lexicon_ = lexicon;
+  }
+
  protected:
   LMPtr lm_;
   TriePtr lexicon_;
@@ -120,7 +129,7 @@ class LexiconSeq2SeqDecoder : public Decoder {
   int maxOutputLength_;
   bool isLmToken_;
 
-  std::vector<LexiconSeq2SeqDecoderState> candidates_;
+  CandidateBuffer<LexiconSeq2SeqDecoderState> candidates_;
   std::vector<LexiconSeq2SeqDecoderState*> candidatePtrs_;
   double candidatesBestScore_;
 
@@ -0,0 +1,391 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <stdio.h>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+
+#include "libraries/decoder/SearchGraph.h"
+
+namespace w2l {
+
+namespace {
+
+constexpr const char kSearchGraphMagic[8] =
+    {'W', '2', 'L', 'G', 'R', 'A', 'P', 'H'};
+constexpr int kSearchGraphVersion = 1;
+
+// Score of the words missing from an LM without <unk>, as in KenLM
+constexpr float kUnkLogProb = -100;
+
+// Header of the binary SearchGraph file, followed by the roots, the nodes, the
+// arcs and the words arrays. Data is stored in the native byte order.
+struct SearchGraphHeader {
+  char magic[8];
+  int version;
+  int nRoots;
+  int nNodes;
+  int nArcs;
+  int nWords;
+  int start;
+};
+
+struct NGram {
+  float logProb;
+  float backoff;
+};
+
+// Node of the tree of a context while it is built
+struct TreeNode {
+  std::map<int, int> children; // Sorted by token
+  std::vector<SearchGraphWord> words; // `next` is the context of the word
+  int parent = -1;
+  float potential = -std::numeric_limits<float>::infinity();
+};
+
+} // namespace
+
+std::shared_ptr<SearchGraph> SearchGraph::compile(
+    const std::string& arpaPath,
+    const std::vector<std::string>& words,
+    const std::vector<std::vector<std::vector<int>>>& spellings) {
+  /* (1) Read the n-grams of the ARPA file */
+  std::ifstream in(arpaPath);
+  if (!in) {
+    throw std::runtime_error(
+        "[SearchGraph] Cannot read ARPA file: " + arpaPath);
+  }
+  std::unordered_map<std::string, int> vocab;
+  auto vocabIndex = [&vocab](const std::string& word) {
+    return vocab.emplace(word, vocab.size()).first->second;
+  };
+  std::map<std::vector<int>, NGram> ngrams;
+  int order = 0, maxOrder = 0;
+  std::string line;
+  while (std::getline(in, line)) {
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    if (line.empty()) {
+      continue;
+    } else if (line[0] == '\\') {
+      if (line == "\\end\\") {
+        break;
+      }
+      // 0 for the \data\ section
+      if (sscanf(line.c_str(), "\\%d-grams:", &order) != 1) {
+        order = 0;
+      }
+      continue;
+    } else if (order == 0) {
+      continue;
+    }
+    std::istringstream fields(line);
+    NGram ngram{0, 0};
+    std::vector<std::string> tokens(order);
+    fields >> ngram.logProb;
+    for (auto& token : tokens) {
+      fields >> token;
+    }
+    if (!fields) {
+      throw std::runtime_error("[SearchGraph] Invalid ARPA line: " + line);
+    }
+    if (!(fields >> ngram.backoff)) {
+      ngram.backoff = 0;
+    }
+    std::vector<int> key;
+    for (const auto& token : tokens) {
+      key.push_back(vocabIndex(token));
+    }
+    ngrams[key] = ngram;
+    maxOrder = std::max(maxOrder, order);
+  }
+  if (ngrams.empty()) {
+    throw std::runtime_error("[SearchGraph] No n-gram in " + arpaPath);
+  }
+  const int bos = vocabIndex("<s>");
+  const int eos = vocabIndex("</s>");
+  const int unk = vocabIndex("<unk>");
+  ngrams.emplace(std::vector<int>{unk}, NGram{kUnkLogProb, 0});
+
+  /* (2) Map the LM words to the lexicon, the missing ones to <unk> */
+  std::vector<std::vector<int>> lexiconWords(vocab.size());
+  for (int i = 0; i < words.size() && i < spellings.size(); i++) {
+    if (spellings[i].empty()) {
+      continue;
+    }
+    auto it = vocab.find(words[i]);
+    int lmWord = it == vocab.end() || it->second == bos || it->second == eos
+        ? unk
+        : it->second;
+    lexiconWords[lmWord].push_back(i);
+  }
+
+  /* (3) Number the contexts, the n-grams extended by others, shortest first */
+  std::set<std::vector<int>> prefixes;
+  for (const auto& ngram : ngrams) {
+    if (ngram.first.size() > 1 && ngram.first[ngram.first.size() - 2] != eos) {
+      prefixes.emplace(ngram.first.begin(), ngram.first.end() - 1);
+    }
+  }
+  std::map<std::vector<int>, int> contextIds{{std::vector<int>(), 0}};
+  std::vector<const std::vector<int>*> contexts{&contextIds.begin()->first};
+  for (int n = 1; n < maxOrder; n++) {
+    for (const auto& prefix : prefixes) {
+      if (prefix.size() == n) {
+        auto it = contextIds.emplace(prefix, contexts.size()).first;
+        contexts.push_back(&it->first);
+      }
+    }
+  }
+  // The longest suffix of `history` which is a context. The n-grams which
+  // are not contexts are only followed by backoffs: their backoff weights are
+  // added to `weight` and they are skipped.
+  auto contextOf = [&contextIds, &ngrams](
+                       std::vector<int> history, float& weight) {
+    while (!history.empty()) {
+      auto it = contextIds.find(history);
+      if (it != contextIds.end()) {
+        return it->second;
+      }
+      auto ngram = ngrams.find(history);
+      if (ngram != ngrams.end()) {
+        weight += ngram->second.backoff;
+      }
+      history.erase(history.begin());
+    }
+    return 0;
+  };
+
+  std::vector<std::vector<std::pair<int, float>>> successors(contexts.size());
+  for (const auto& ngram : ngrams) {
+    const int word = ngram.first.back();
+    if (word == bos || word == eos) {
+      continue;
+    }
+    auto it = contextIds.find(
+        std::vector<int>(ngram.first.begin(), ngram.first.end() - 1));
+    if (it != contextIds.end()) {
+      successors[it->second].emplace_back(word, ngram.second.logProb);
+    }
+  }
+
+  std::shared_ptr<SearchGraph> graph(new SearchGraph());
+  for (int c = 0; c < contexts.size(); c++) {
+    const std::vector<int>& context = *contexts[c];
+    SearchGraphRoot root{-1, -1, 0, 0};
+    if (c > 0) {
+      auto ngram = ngrams.find(context);
+      root.backoffWeight = ngram != ngrams.end() ? ngram->second.backoff : 0;
+      root.backoff = contextOf(
+          std::vector<int>(context.begin() + 1, context.end()),
+          root.backoffWeight);
+    }
+    std::vector<int> history(context);
+    history.push_back(eos);
+    auto it = ngrams.find(history);
+    if (it != ngrams.end()) {
+      root.finalWeight = it->second.logProb;
+    } else if (c > 0) {
+      // The backoff context is shorter, hence already done
+      root.finalWeight = root.backoffWeight +
+          graph->rootStorage_[root.backoff].finalWeight;
+    } else {
+      root.finalWeight = ngrams.at({unk}).logProb;
+    }
+    graph->rootStorage_.push_back(root);
+  }
+
+  /* (4) Build the tree of each context, with its weights pushed */
+  for (int c = 0; c < contexts.size(); c++) {
+    std::vector<TreeNode> tree(1);
+    for (const auto& successor : successors[c]) {
+      std::vector<int> history(*contexts[c]);
+      history.push_back(successor.first);
+      float weight = successor.second;
+      const int next = contextOf(history, weight);
+      for (const int word : lexiconWords[successor.first]) {
+        for (const auto& spelling : spellings[word]) {
+          if (spelling.empty()) {
+            continue;
+          }
+          int node = 0;
+          for (const int token : spelling) {
+            auto child = tree[node].children.find(token);
+            if (child != tree[node].children.end()) {
+              node = child->second;
+              continue;
+            }
+            tree[node].children[token] = tree.size();
+            tree.emplace_back();
+            tree.back().parent = node;
+            node = tree.size() - 1;
+          }
+          auto& nodeWords = tree[node].words;
+          auto isWord = [word](const SearchGraphWord& w) {
+            return w.word == word;
+          };
+          if (std::none_of(nodeWords.begin(), nodeWords.end(), isWord)) {
+            nodeWords.push_back(SearchGraphWord{word, next, weight});
+            tree[node].potential = std::max(tree[node].potential, weight);
+          }
+        }
+      }
+    }
+    // Children are created after their parent
+    for (int i = tree.size() - 1; i > 0; i--) {
+      TreeNode& parent = tree[tree[i].parent];
+      parent.potential = std::max(parent.potential, tree[i].potential);
+    }
+    tree[0].potential = 0;
+
+    // Breadth-first, so that the nodes of a tree are adjacent
+    const int base = graph->nodeStorage_.size();
+    graph->rootStorage_[c].node = base;
+    std::vector<int> queue{0};
+    for (size_t i = 0; i < queue.size(); i++) {
+      const TreeNode& treeNode = tree[queue[i]];
+      SearchGraphNode node;
+      node.firstArc = graph->arcStorage_.size();
+      node.nArcs = treeNode.children.size();
+      node.firstWord = graph->wordStorage_.size();
+      node.nWords = treeNode.words.size();
+      node.root = c;
+      graph->nodeStorage_.push_back(node);
+      for (const auto& child : treeNode.children) {
+        graph->arcStorage_.push_back(SearchGraphArc{
+            child.first,
+            base + static_cast<int>(queue.size()),
+            tree[child.second].potential - treeNode.potential});
+        queue.push_back(child.second);
+      }
+      for (SearchGraphWord word : treeNode.words) {
+        word.weight -= treeNode.potential;
+        graph->wordStorage_.push_back(word);
+      }
+    }
+  }
+  for (auto& word : graph->wordStorage_) {
+    word.next = graph->rootStorage_[word.next].node;
+  }
+  // The backoff weight of <s> if it is not a context is the same for all the
+  // hypothesis
+  float startWeight = 0;
+  graph->start_ = graph->rootStorage_[contextOf({bos}, startWeight)].node;
+
+  graph->setStorage();
+  return graph;
+}
+
+void SearchGraph::setStorage() {
+  roots_ = rootStorage_.data();
+  nodes_ = nodeStorage_.data();
+  arcs_ = arcStorage_.data();
+  words_ = wordStorage_.data();
+  nRoots_ = rootStorage_.size();
+  nNodes_ = nodeStorage_.size();
+  nArcs_ = arcStorage_.size();
+  nWords_ = wordStorage_.size();
+}
+
+std::shared_ptr<SearchGraph> SearchGraph::load(const std::string& path) {
+  std::shared_ptr<SearchGraph> graph(new SearchGraph());
+  graph->file_ = std::make_shared<MemoryMappedFile>(path);
+  const char* data = graph->file_->data();
+  size_t size = graph->file_->size();
+
+  SearchGraphHeader header;
+  if (size < sizeof(header)) {
+    throw std::runtime_error("[SearchGraph] Truncated graph file: " + path);
+  }
+  std::memcpy(&header, data, sizeof(header));
+  if (std::memcmp(header.magic, kSearchGraphMagic, sizeof(header.magic)) !=
+          0 ||
+      header.version != kSearchGraphVersion) {
+    throw std::runtime_error("[SearchGraph] Invalid graph file: " + path);
+  }
+  size_t expectedSize = sizeof(header) +
+      header.nRoots * sizeof(SearchGraphRoot) +
+      header.nNodes * sizeof(SearchGraphNode) +
+      header.nArcs * sizeof(SearchGraphArc) +
+      header.nWords * sizeof(SearchGraphWord);
+  if (header.nRoots < 1 || header.start < 0 ||
+      header.start >= header.nNodes || size != expectedSize) {
+    throw std::runtime_error("[SearchGraph] Corrupted graph file: " + path);
+  }
+
+  // All the sections are 4-byte aligned as the header size is a multiple of 4
+  // and mmap returns page-aligned memory.
+  graph->nRoots_ = header.nRoots;
+  graph->nNodes_ = header.nNodes;
+  graph->nArcs_ = header.nArcs;
+  graph->nWords_ = header.nWords;
+  graph->start_ = header.start;
+  data += sizeof(header);
+  graph->roots_ = reinterpret_cast<const SearchGraphRoot*>(data);
+  data += header.nRoots * sizeof(SearchGraphRoot);
+  graph->nodes_ = reinterpret_cast<const SearchGraphNode*>(data);
+  data += header.nNodes * sizeof(SearchGraphNode);
+  graph->arcs_ = reinterpret_cast<const SearchGraphArc*>(data);
+  data += header.nArcs * sizeof(SearchGraphArc);
+  graph->words_ = reinterpret_cast<const SearchGraphWord*>(data);
+  return graph;
+}
+
+void SearchGraph::save(const std::string& path) const {
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  if (!out) {
+    throw std::runtime_error("[SearchGraph] Cannot write graph file: " + path);
+  }
+  SearchGraphHeader header;
+  std::memcpy(header.magic, kSearchGraphMagic, sizeof(header.magic));
+  header.version = kSearchGraphVersion;
+  header.nRoots = nRoots_;
+  header.nNodes = nNodes_;
+  header.nArcs = nArcs_;
+  header.nWords = nWords_;
+  header.start = start_;
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  out.write(
+      reinterpret_cast<const char*>(roots_), nRoots_ * sizeof(SearchGraphRoot));
+  out.write(
+      reinterpret_cast<const char*>(nodes_), nNodes_ * sizeof(SearchGraphNode));
+  out.write(
+      reinterpret_cast<const char*>(arcs_), nArcs_ * sizeof(SearchGraphArc));
+  out.write(
+      reinterpret_cast<const char*>(words_), nWords_ * sizeof(SearchGraphWord));
+  if (!out) {
+    throw std::runtime_error(
+        "[SearchGraph] Failed writing graph file: " + path);
+  }
+}
+
+const SearchGraphArc* SearchGraph::findArc(
+    const SearchGraphNode* node,
+    int token) const {
+  const SearchGraphArc* begin = arcs_ + node->firstArc;
+  const SearchGraphArc* end = begin + node->nArcs;
+  const SearchGraphArc* arc = std::lower_bound(
+      begin, end, token, [](const SearchGraphArc& a, int t) {
+        return a.token < t;
+      });
+  if (arc == end || arc->token != token) {
+    return nullptr;
+  }
+  return arc;
+}
+
+} // namespace w2l
@@ -0,0 +1,177 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "libraries/common/MemoryMappedFile.h"
+
+namespace w2l {
+
+/**
+ * SearchGraphNode is a state of the SearchGraph: a prefix of the spellings of
+ * the words which can follow an n-gram context. Arcs and words are referred to
+ * by offsets into the arrays of the SearchGraph.
+ */
+struct SearchGraphNode {
+  // Outgoing token arcs, sorted by token, in [firstArc, firstArc + nArcs)
+  int firstArc;
+  int nArcs;
+
+  // Words spelled by the path to the node, in [firstWord, firstWord + nWords)
+  int firstWord;
+  int nWords;
+
+  // Index of the root (n-gram context) of the tree of the node
+  int root;
+};
+
+/* A token arc, and the LM weight pushed on it */
+struct SearchGraphArc {
+  int token;
+  int next; // Destination node
+  float weight;
+};
+
+/* A word emitted at a node, going to the root of its new context */
+struct SearchGraphWord {
+  int word;
+  int next; // Destination node, the root of a tree
+  float weight;
+};
+
+/**
+ * SearchGraphRoot is an n-gram context of the SearchGraph: the root node of
+ * its tree, its backoff context and the weights to back off and to end the
+ * sentence there.
+ */
+struct SearchGraphRoot {
+  int node;
+  int backoff; // Root index of the backoff context, -1 for the empty context
+  float backoffWeight;
+  float finalWeight;
+};
+
+/**
+ * SearchGraph is a word n-gram LM composed with the lexicon ahead of time,
+ * so that a decoder only walks arcs with precomputed weights instead of
+ * querying the LM at each word boundary (see GraphDecoder).
+ *
+ * Each context of the LM (an n-gram extended by longer n-grams, plus the empty
+ * context) has a tree of the spellings of the words with an explicit n-gram
+ * after it, which is deterministic by construction. The LM scores are
+ * pushed toward the root of each tree, as trie smearing with the MAX mode
+ * does: the weights along a word add up to its LM score, and the weight of a
+ * partial word is the best score it can still reach. A word leads to the root
+ * of the longest context it ends, the backoff weights of the longer n-grams
+ * it ends being added to it. The words of a context missing from its tree are
+ * reached by backing off to the tree of the shorter context, with the backoff
+ * weight of the ARPA, at word boundaries only.
+ *
+ * Lexicon words missing from the LM are scored as <unk> (-100 if the LM has
+ * no <unk>, as KenLM does). Scores are log10, as the ones of KenLM. The graph
+ * holds a tree per context: the LM should be pruned beforehand.
+ *
+ * As FlatTrie, nodes only refer to each other by offsets, so that a graph can
+ * be saved in a binary file and memory-mapped back read-only.
+ */
+class SearchGraph {
+ public:
+  SearchGraph(const SearchGraph&) = delete;
+  SearchGraph& operator=(const SearchGraph&) = delete;
+
+  /**
+   * Compile the ARPA LM `arpaPath` with the lexicon: `words[i]` is the word
+   * with index i and `spellings[i]` its spellings as token sequences.
+   */
+  static std::shared_ptr<SearchGraph> compile(
+      const std::string& arpaPath,
+      const std::vector<std::string>& words,
+      const std::vector<std::vector<std::vector<int>>>& spellings);
+
+  /* Memory-map a graph saved with `save()` */
+  static std::shared_ptr<SearchGraph> load(const std::string& path);
+
+  /* Save the graph in the binary format read by `load()` */
+  void save(const std::string& path) const;
+
+  /* The root of the sentence start context */
+  const SearchGraphNode* getStart() const {
+    return nodes_ + start_;
+  }
+
+  const SearchGraphNode* getNode(int idx) const {
+    return nodes_ + idx;
+  }
+
+  const SearchGraphRoot& getRoot(const SearchGraphNode* node) const {
+    return roots_[node->root];
+  }
+
+  /* Root of the backoff context of root `node`, nullptr if there is none */
+  const SearchGraphNode* getBackoff(const SearchGraphNode* node) const {
+    int backoff = roots_[node->root].backoff;
+    return backoff < 0 ? nullptr : nodes_ + roots_[backoff].node;
+  }
+
+  /* Return true if `node` is the root of its tree, i.e. a word boundary */
+  bool isRoot(const SearchGraphNode* node) const {
+    return roots_[node->root].node == node - nodes_;
+  }
+
+  /* Return the arc of `node` with `token`, or nullptr if missing */
+  const SearchGraphArc* findArc(const SearchGraphNode* node, int token) const;
+
+  /* Words emitted at `node` (`node->nWords` of them) */
+  const SearchGraphWord* words(const SearchGraphNode* node) const {
+    return words_ + node->firstWord;
+  }
+
+  int nNodes() const {
+    return nNodes_;
+  }
+
+  int nArcs() const {
+    return nArcs_;
+  }
+
+  int nRoots() const {
+    return nRoots_;
+  }
+
+ private:
+  SearchGraph() = default;
+
+  // Storage, when the graph is compiled in memory
+  std::vector<SearchGraphRoot> rootStorage_;
+  std::vector<SearchGraphNode> nodeStorage_;
+  std::vector<SearchGraphArc> arcStorage_;
+  std::vector<SearchGraphWord> wordStorage_;
+  // Storage, when the graph is memory-mapped
+  MemoryMappedFilePtr file_;
+
+  const SearchGraphRoot* roots_ = nullptr;
+  const SearchGraphNode* nodes_ = nullptr;
+  const SearchGraphArc* arcs_ = nullptr;
+  const SearchGraphWord* words_ = nullptr;
+  int nRoots_ = 0;
+  int nNodes_ = 0;
+  int nArcs_ = 0;
+  int nWords_ = 0;
+  int start_ = 0;
+
+  // Point the arrays to the storage of a compiled graph
+  void setStorage();
+};
+
+using SearchGraphPtr = std::shared_ptr<SearchGraph>;
+
+} // namespace w2l
@@ -8,8 +8,15 @@
 
 #include <math.h>
 #include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <iostream>
 #include <limits>
+#include <stdexcept>
+#include <utility>
 
 #include "libraries/decoder/Trie.h"
 
@@ -17,12 +24,49 @@ namespace w2l {
 
 const double kMinusLogThreshold = -39.14;
 
+namespace {
+
+constexpr const char kFlatTrieMagic[8] = {'W', '2', 'L', 'T', 'R', 'I', 'E', 0};
+constexpr int kFlatTrieVersion = 2;
+constexpr size_t kFingerprintSize = 16;
+
+// Header of the binary FlatTrie file, followed by the nodes, the labels and
+// the scores arrays. Data is stored in the native byte order.
+struct FlatTrieHeader {
+  char magic[8];
+  int version;
+  int nNodes;
+  int nLabels;
+  int reserved = 0;
+  // Of what the trie was built from, padded with zeros
+  char fingerprint[kFingerprintSize];
+};
+
+// The versions of the tries, unique in the process
+std::atomic<uint64_t> nextTrieVersion(1);
+
+/* Make `node` one of the trie of `version`, copying it if it's shared */
+void ownNode(TrieNodePtr& node, uint64_t version) {
+  if (node->version != version) {
+    node = std::make_shared<TrieNode>(*node);
+    node->version = version;
+  }
+}
+
+} // namespace
+
+Trie::Trie(int maxChildren, int rootIdx)
+    : maxChildren_(maxChildren), version_(nextTrieVersion++) {
+  root_ = std::make_shared<TrieNode>(rootIdx, version_);
+}
+
 const TrieNode* Trie::getRoot() const {
   return root_.get();
 }
 
 TrieNodePtr
 Trie::insert(const std::vector<int>& indices, int label, float score) {
+  ownNode(root_, version_);
   TrieNodePtr node = root_;
   for (int i = 0; i < indices.size(); i++) {
     int idx = indices[i];
@@ -30,10 +74,13 @@ Trie::insert(const std::vector<int>& indices, int label, float score) {
       throw std::out_of_range(
           "[Trie] Invalid letter index: " + std::to_string(idx));
     }
-    if (node->children.find(idx) == node->children.end()) {
-      node->children[idx] = std::make_shared<TrieNode>(idx);
+    auto& child = node->children[idx];
+    if (!child) {
+      child = std::make_shared<TrieNode>(idx, version_);
+    } else {
+      ownNode(child, version_);
     }
-    node = node->children[idx];
+    node = child;
   }
   if (node->labels.size() < kTrieMaxLabel) {
     node->labels.push_back(label);
@@ -74,14 +121,14 @@ double TrieLogAdd(double log_a, double log_b) {
   }
 }
 
-void smearNode(TrieNodePtr node, SmearingMode smearMode) {
+/* Smear `node` from its labels and the scores of its (smeared) children */
+void smearScores(TrieNode* node, SmearingMode smearMode) {
   node->maxScore = -std::numeric_limits<float>::infinity();
   for (auto score : node->scores) {
     node->maxScore = TrieLogAdd(node->maxScore, score);
   }
-  for (auto child : node->children) {
-    auto childNode = child.second;
-    smearNode(childNode, smearMode);
+  for (const auto& child : node->children) {
+    const auto& childNode = child.second;
     if (smearMode == SmearingMode::LOGADD) {
       node->maxScore = TrieLogAdd(node->maxScore, childNode->maxScore);
     } else if (
@@ -92,10 +139,212 @@ void smearNode(TrieNodePtr node, SmearingMode smearMode) {
   }
 }
 
+void smearNode(TrieNodePtr& node, SmearingMode smearMode, uint64_t version) {
+  ownNode(node, version);
+  for (auto& child : node->children) {
+    smearNode(child.second, smearMode, version);
+  }
+  smearScores(node.get(), smearMode);
+}
+
 void Trie::smear(SmearingMode smearMode) {
   if (smearMode != SmearingMode::NONE) {
-    smearNode(root_, smearMode);
+    smearNode(root_, smearMode, version_);
   }
 }
 
+void Trie::smearPath(
+    const std::vector<int>& indices,
+    const SmearingMode smearMode) {
+  if (smearMode == SmearingMode::NONE) {
+    return;
+  }
+  ownNode(root_, version_);
+  std::vector<TrieNode*> path{root_.get()};
+  for (auto idx : indices) {
+    auto child = path.back()->children.find(idx);
+    if (child == path.back()->children.end()) {
+      throw std::invalid_argument("[Trie] smearPath: token not in the trie");
+    }
+    ownNode(child->second, version_);
+    path.push_back(child->second.get());
+  }
+  for (auto node = path.rbegin(); node != path.rend(); ++node) {
+    smearScores(*node, smearMode);
+  }
+}
+
+std::shared_ptr<Trie> Trie::fork() {
+  auto trie = std::make_shared<Trie>(*this);
+  version_ = nextTrieVersion++;
+  trie->version_ = nextTrieVersion++;
+  return trie;
+}
+
+FlatTrie::FlatTrie(const Trie& trie) {
+  // Breadth-first traversal, so that the children of each node are adjacent
+  std::vector<const TrieNode*> queue{trie.getRoot()};
+  for (size_t i = 0; i < queue.size(); i++) {
+    const TrieNode* node = queue[i];
+
+    FlatTrieNode flatNode;
+    flatNode.maxScore = node->maxScore;
+    flatNode.idx = node->idx;
+    flatNode.firstChild = queue.size();
+    flatNode.nChildren = node->children.size();
+    flatNode.firstLabel = labelStorage_.size();
+    flatNode.nLabels = node->labels.size();
+    nodeStorage_.push_back(flatNode);
+
+    labelStorage_.insert(
+        labelStorage_.end(), node->labels.begin(), node->labels.end());
+    scoreStorage_.insert(
+        scoreStorage_.end(), node->scores.begin(), node->scores.end());
+
+    std::vector<std::pair<int, const TrieNode*>> children;
+    children.reserve(node->children.size());
+    for (const auto& child : node->children) {
+      children.emplace_back(child.first, child.second.get());
+    }
+    std::sort(children.begin(), children.end());
+    for (const auto& child : children) {
+      queue.push_back(child.second);
+    }
+  }
+
+  nodes_ = nodeStorage_.data();
+  labels_ = labelStorage_.data();
+  scores_ = scoreStorage_.data();
+  nNodes_ = nodeStorage_.size();
+  nLabels_ = labelStorage_.size();
+}
+
+std::shared_ptr<FlatTrie> FlatTrie::load(const std::string& path) {
+  std::shared_ptr<FlatTrie> trie(new FlatTrie());
+  trie->file_ = std::make_shared<MemoryMappedFile>(path);
+  const char* data = trie->file_->data();
+  size_t size = trie->file_->size();
+
+  FlatTrieHeader header;
+  if (size < sizeof(header)) {
+    throw std::runtime_error("[FlatTrie] Truncated trie file: " + path);
+  }
+  std::memcpy(&header, data, sizeof(header));
+  if (std::memcmp(header.magic, kFlatTrieMagic, sizeof(header.magic)) != 0 ||
+      header.version != kFlatTrieVersion) {
+    throw std::runtime_error("[FlatTrie] Invalid trie file: " + path);
+  }
+  if (header.nNodes < 1 || header.nLabels < 0 ||
+      size !=
+          sizeof(header) + size_t(header.nNodes) * sizeof(FlatTrieNode) +
+              size_t(header.nLabels) * (sizeof(int) + sizeof(float))) {
+    throw std::runtime_error("[FlatTrie] Corrupted trie file: " + path);
+  }
+
+  // All the sections are 4-byte aligned as the header size is a multiple of 4
+  // and mmap returns page-aligned memory.
+  trie->nNodes_ = header.nNodes;
+  trie->nLabels_ = header.nLabels;
+  data += sizeof(header);
+  trie->nodes_ = reinterpret_cast<const FlatTrieNode*>(data);
+  data += header.nNodes * sizeof(FlatTrieNode);
+  trie->labels_ = reinterpret_cast<const int*>(data);
+  data += header.nLabels * sizeof(int);
+  trie->scores_ = reinterpret_cast<const float*>(data);
+  trie->fingerprint_.assign(
+      header.fingerprint,
+      strnlen(header.fingerprint, sizeof(header.fingerprint)));
+
+  // The offsets are followed without bound checks when searching
+  for (int i = 0; i < header.nNodes; ++i) {
+    const FlatTrieNode& node = trie->nodes_[i];
+    if (node.firstChild < 0 || node.nChildren < 0 ||
+        int64_t(node.firstChild) + node.nChildren > header.nNodes ||
+        node.firstLabel < 0 || node.nLabels < 0 ||
+        int64_t(node.firstLabel) + node.nLabels > header.nLabels) {
+      throw std::runtime_error(
+          "[FlatTrie] Corrupted node " + std::to_string(i) +
+          " in trie file: " + path);
+    }
+  }
+  return trie;
+}
+
+void FlatTrie::save(const std::string& path, const std::string& fingerprint)
+    const {
+  if (fingerprint.size() > kFingerprintSize) {
+    throw std::invalid_argument(
+        "[FlatTrie] Fingerprint longer than 16 characters: " + fingerprint);
+  }
+  // Written next to the file and renamed over it, so that the processes
+  // mapping a previous version keep reading it
+  const std::string tmpPath = path + ".tmp";
+  std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+  if (!out) {
+    throw std::runtime_error("[FlatTrie] Cannot write trie file: " + tmpPath);
+  }
+  FlatTrieHeader header;
+  std::memcpy(header.magic, kFlatTrieMagic, sizeof(header.magic));
+  header.version = kFlatTrieVersion;
+  header.nNodes = nNodes_;
+  header.nLabels = nLabels_;
+  std::memset(header.fingerprint, 0, sizeof(header.fingerprint));
+  std::memcpy(header.fingerprint, fingerprint.data(), fingerprint.size());
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  out.write(
+      reinterpret_cast<const char*>(nodes_), nNodes_ * sizeof(FlatTrieNode));
+  out.write(reinterpret_cast<const char*>(labels_), nLabels_ * sizeof(int));
+  out.write(reinterpret_cast<const char*>(scores_), nLabels_ * sizeof(float));
+  out.close();
+  if (!out || std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+    std::remove(tmpPath.c_str());
+    throw std::runtime_error("[FlatTrie] Failed writing trie file: " + path);
+  }
+}
+
+std::shared_ptr<FlatTrie> FlatTrie::clone(HugePages hugePages) const {
+  std::shared_ptr<FlatTrie> trie(new FlatTrie());
+  size_t nodeBytes = nNodes_ * sizeof(FlatTrieNode);
+  size_t labelBytes = nLabels_ * sizeof(int);
+  size_t scoreBytes = nLabels_ * sizeof(float);
+  // Laid out as in the saved files, the sections staying 4-byte aligned
+  trie->pages_ = allocatePages(nodeBytes + labelBytes + scoreBytes, hugePages);
+  char* data = trie->pages_.get();
+  std::memcpy(data, nodes_, nodeBytes);
+  std::memcpy(data + nodeBytes, labels_, labelBytes);
+  std::memcpy(data + nodeBytes + labelBytes, scores_, scoreBytes);
+
+  trie->nNodes_ = nNodes_;
+  trie->nLabels_ = nLabels_;
+  trie->fingerprint_ = fingerprint_;
+  trie->nodes_ = reinterpret_cast<const FlatTrieNode*>(data);
+  trie->labels_ = reinterpret_cast<const int*>(data + nodeBytes);
+  trie->scores_ =
+      reinterpret_cast<const float*>(data + nodeBytes + labelBytes);
+  return trie;
+}
+
+const FlatTrieNode* FlatTrie::findChild(const FlatTrieNode* node, int idx)
+    const {
+  const FlatTrieNode* begin = nodes_ + node->firstChild;
+  const FlatTrieNode* end = begin + node->nChildren;
+  const FlatTrieNode* child = std::lower_bound(
+      begin, end, idx, [](const FlatTrieNode& n, int i) { return n.idx < i; });
+  if (child == end || child->idx != idx) {
+    return nullptr;
+  }
+  return child;
+}
+
+const FlatTrieNode* FlatTrie::search(const std::vector<int>& indices) const {
+  const FlatTrieNode* node = getRoot();
+  for (auto idx : indices) {
+    node = findChild(node, idx);
+    if (!node) {
+      return nullptr;
+    }
+  }
+  return node;
+}
+
 } // namespace w2l
@@ -7,10 +7,15 @@
  */
 
 #pragma once
+#include <cstdint>
 #include <memory>
+#include <string>
 #include <unordered_map>
 #include <vector>
 
+#include "libraries/common/MemoryMappedFile.h"
+#include "libraries/common/Numa.h"
+
 namespace w2l {
 
 constexpr int kTrieMaxLabel = 6;
@@ -25,10 +30,11 @@ enum class SmearingMode {
  * TrieNode is the trie node structure in Trie.
  */
 struct TrieNode {
-  explicit TrieNode(int idx)
+  explicit TrieNode(int idx, uint64_t version = 0)
       : children(std::unordered_map<int, std::shared_ptr<TrieNode>>()),
         idx(idx),
-        maxScore(0) {
+        maxScore(0),
+        version(version) {
     labels.reserve(kTrieMaxLabel);
     scores.reserve(kTrieMaxLabel);
   }
@@ -49,6 +55,10 @@ struct TrieNode {
   // Maximum score of all the labels if this node is a leaf,
   // otherwise it will be the value after trie smearing.
   float maxScore;
+
+  // Version of the trie which created the node: the tries forked from it copy
+  // the node before changing it
+  uint64_t version;
 };
 
 using TrieNodePtr = std::shared_ptr<TrieNode>;
@@ -60,8 +70,7 @@ using TrieNodePtr = std::shared_ptr<TrieNode>;
  */
 class Trie {
  public:
-  Trie(int maxChildren, int rootIdx)
-      : root_(std::make_shared<TrieNode>(rootIdx)), maxChildren_(maxChildren) {}
+  Trie(int maxChildren, int rootIdx);
 
   /* Return the root node pointer */
   const TrieNode* getRoot() const;
@@ -82,12 +91,147 @@ class Trie {
    */
   void smear(const SmearingMode smear_mode);
 
+  /**
+   * Smear the nodes on the path of a token again, from its end up to the
+   * root, after `insert()` added a word to a smeared trie: the other nodes
+   * keep their scores, so this gives the scores of `smear()` over the whole
+   * trie in the time of a few lookups.
+   */
+  void smearPath(const std::vector<int>& indices, const SmearingMode smearMode);
+
+  /**
+   * Return a trie with the words of this one, which shares all their nodes
+   * until it's updated. From then on, both tries copy a shared node before
+   * `insert()` or `smearPath()` change it, so that the words can be added to
+   * the fork while decoders still search this trie, e.g. to compile a new
+   * FlatTrie without smearing the whole lexicon again.
+   */
+  std::shared_ptr<Trie> fork();
+
  private:
   TrieNodePtr root_;
   int maxChildren_; // The maximum number of childern for each node. It is
                     // usually the size of letters or phonmes.
+  // Version of the nodes the trie owns, and may change in place
+  uint64_t version_;
 };
 
 using TriePtr = std::shared_ptr<Trie>;
 
+/**
+ * FlatTrieNode is the node structure in FlatTrie. Children and labels are
+ * referred to by offsets into the arrays of the FlatTrie.
+ */
+struct FlatTrieNode {
+  // Maximum score of all the labels if this node is a leaf, otherwise the
+  // value after trie smearing.
+  float maxScore;
+
+  // Node index
+  int idx;
+
+  // Children are stored contiguously, sorted by their index, in
+  // [firstChild, firstChild + nChildren)
+  int firstChild;
+  int nChildren;
+
+  // Labels and scores are stored in [firstLabel, firstLabel + nLabels)
+  int firstLabel;
+  int nLabels;
+};
+
+/**
+ * FlatTrie is an immutable copy of a (smeared) Trie designed for fast search.
+ * All the nodes live in a single array in breadth-first order, so that the
+ * children of a node are adjacent and sorted by index: finding a child is a
+ * binary search over a few cache lines instead of a hash lookup followed by a
+ * pointer chase. Nodes are passed around as `const FlatTrieNode*` handles.
+ *
+ * As nodes only refer to each other by offsets, a FlatTrie can be saved in a
+ * binary file and memory-mapped back read-only: loading is then instantaneous
+ * and the pages are shared by all the decoder threads and processes using the
+ * same file.
+ */
+class FlatTrie {
+ public:
+  /* Compile a trie, which should already be smeared if smearing is used */
+  explicit FlatTrie(const Trie& trie);
+
+  FlatTrie(const FlatTrie&) = delete;
+  FlatTrie& operator=(const FlatTrie&) = delete;
+
+  /* Memory-map a trie saved with `save()`, checking all its offsets */
+  static std::shared_ptr<FlatTrie> load(const std::string& path);
+
+  /**
+   * Save the trie in the binary format read by `load()`, along with the
+   * `fingerprint` (at most 16 characters, e.g. a `hashKey()`) of what it was
+   * built from, to tell whether the file is stale.
+   */
+  void save(const std::string& path, const std::string& fingerprint = "")
+      const;
+
+  /* The fingerprint the trie was saved with, empty if compiled in memory */
+  const std::string& fingerprint() const {
+    return fingerprint_;
+  }
+
+  /**
+   * Copy the trie in pages allocated and touched by the calling thread, and
+   * so on its NUMA node or following its memory policy, backed as
+   * `hugePages` says.
+   */
+  std::shared_ptr<FlatTrie> clone(HugePages hugePages = HugePages::NONE) const;
+
+  /* Return the root node */
+  const FlatTrieNode* getRoot() const {
+    return nodes_;
+  }
+
+  /* Return the child of `node` with index `idx`, or nullptr if missing */
+  const FlatTrieNode* findChild(const FlatTrieNode* node, int idx) const;
+
+  /* Labels of the words ending at `node` (`node->nLabels` of them) */
+  const int* labels(const FlatTrieNode* node) const {
+    return labels_ + node->firstLabel;
+  }
+
+  /* Scores of the words ending at `node` (`node->nLabels` of them) */
+  const float* scores(const FlatTrieNode* node) const {
+    return scores_ + node->firstLabel;
+  }
+
+  /* Return the node for a given token sequence, or nullptr if missing */
+  const FlatTrieNode* search(const std::vector<int>& indices) const;
+
+  int nNodes() const {
+    return nNodes_;
+  }
+
+  int nLabels() const {
+    return nLabels_;
+  }
+
+ private:
+  FlatTrie() = default;
+
+  // Storage, when the trie is compiled in memory
+  std::vector<FlatTrieNode> nodeStorage_;
+  std::vector<int> labelStorage_;
+  std::vector<float> scoreStorage_;
+  // Storage, when the trie is memory-mapped
+  MemoryMappedFilePtr file_;
+  // Storage, when the trie is cloned
+  std::shared_ptr<char> pages_;
+
+  const FlatTrieNode* nodes_ = nullptr;
+  const int* labels_ = nullptr;
+  const float* scores_ = nullptr;
+  int nNodes_ = 0;
+  int nLabels_ = 0;
+  std::string fingerprint_;
+};
+
+using FlatTriePtr = std::shared_ptr<FlatTrie>;
+
 } // namespace w2l
@@ -6,10 +6,58 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <numeric>
+#include <stdexcept>
+
+#include "libraries/common/Utils.h"
 #include "libraries/decoder/Utils.h"
 
+#if defined(__x86_64__) && defined(__GNUC__)
+#define W2L_DECODER_X86_KERNELS
+#include <immintrin.h>
+#endif
+
 namespace w2l {
 
+namespace {
+
+void halvesToFloatsScalar(const uint16_t* halves, int n, float* values) {
+  for (int i = 0; i < n; i++) {
+    values[i] = halfToFloat(halves[i]);
+  }
+}
+
+#ifdef W2L_DECODER_X86_KERNELS
+__attribute__((target("avx,f16c"))) void
+halvesToFloatsF16c(const uint16_t* halves, int n, float* values) {
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128i packed =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(halves + i));
+    _mm256_storeu_ps(values + i, _mm256_cvtph_ps(packed));
+  }
+  halvesToFloatsScalar(halves + i, n - i, values + i);
+}
+#endif
+
+using HalvesToFloatsFn = void (*)(const uint16_t*, int, float*);
+
+HalvesToFloatsFn selectHalvesToFloats() {
+#ifdef W2L_DECODER_X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c")) {
+    return halvesToFloatsF16c;
+  }
+#endif
+  return halvesToFloatsScalar;
+}
+
+} // namespace
+
 bool isValidCandidate(
     double& bestScore,
     const double score,
@@ -21,4 +69,278 @@ bool isValidCandidate(
   return score >= bestScore - beamThreshold;
 }
 
+void selectTopTokens(
+    const float* scores,
+    const int N,
+    const int beamSizeToken,
+    std::vector<size_t>& tokenIdx) {
+  const int K = std::max(std::min(beamSizeToken, N), 0);
+  tokenIdx.resize(K);
+  std::iota(tokenIdx.begin(), tokenIdx.end(), 0);
+  if (N <= K) {
+    return;
+  }
+
+  // The worst token of the shortlist is kept on top of the heap
+  auto isBetter = [scores](const size_t& l, const size_t& r) {
+    return scores[l] > scores[r] || (scores[l] == scores[r] && l < r);
+  };
+  std::make_heap(tokenIdx.begin(), tokenIdx.end(), isBetter);
+  for (size_t n = K; n < N; n++) {
+    // Tokens coming later lose ties
+    if (scores[n] > scores[tokenIdx.front()]) {
+      std::pop_heap(tokenIdx.begin(), tokenIdx.end(), isBetter);
+      tokenIdx.back() = n;
+      std::push_heap(tokenIdx.begin(), tokenIdx.end(), isBetter);
+    }
+  }
+  std::sort_heap(tokenIdx.begin(), tokenIdx.end(), isBetter);
+}
+
+void halvesToFloats(const uint16_t* halves, int n, float* values) {
+  static const HalvesToFloatsFn convert = selectHalvesToFloats();
+  convert(halves, n, values);
+}
+
+void SparseEmissions::addFrame(
+    const int* frameTokens,
+    const float* frameScores,
+    int size,
+    float floor) {
+  tokens.insert(tokens.end(), frameTokens, frameTokens + size);
+  scores.insert(scores.end(), frameScores, frameScores + size);
+  offsets.push_back(tokens.size());
+  floors.push_back(floor);
+  T++;
+}
+
+void SparseEmissions::densify(int t, float* frame) const {
+  std::fill(frame, frame + N, floors[t]);
+  for (int i = offsets[t]; i < offsets[t + 1]; i++) {
+    frame[tokens[i]] = scores[i];
+  }
+}
+
+SparseEmissions sparsifyEmissions(
+    const float* emissions,
+    const int T,
+    const int N,
+    const int K,
+    const int blank) {
+  SparseEmissions sparse;
+  sparse.N = N;
+  std::vector<size_t> tokenIdx;
+  std::vector<int> frameTokens;
+  std::vector<float> frameScores;
+  for (int t = 0; t < T; t++) {
+    const float* frame = emissions + t * N;
+    selectTopTokens(frame, N, K, tokenIdx);
+    // selectTopTokens keeps the index order if all the tokens are kept
+    std::stable_sort(
+        tokenIdx.begin(), tokenIdx.end(), [frame](size_t l, size_t r) {
+          return frame[l] > frame[r];
+        });
+    float floor = tokenIdx.empty() ? kNegativeInfinity : frame[tokenIdx.back()];
+    if (blank >= 0 &&
+        std::find(tokenIdx.begin(), tokenIdx.end(), blank) == tokenIdx.end()) {
+      tokenIdx.push_back(blank);
+    }
+    frameTokens.assign(tokenIdx.begin(), tokenIdx.end());
+    frameScores.clear();
+    for (const int n : frameTokens) {
+      frameScores.push_back(frame[n]);
+    }
+    sparse.addFrame(
+        frameTokens.data(), frameScores.data(), frameTokens.size(), floor);
+  }
+  return sparse;
+}
+
+DecoderStats& DecoderStats::operator+=(const DecoderStats& other) {
+  frames += other.frames;
+  candidates += other.candidates;
+  merged += other.merged;
+  stored += other.stored;
+  lmQueries += other.lmQueries;
+  lmCacheHits += other.lmCacheHits;
+  trieExpansions += other.trieExpansions;
+  peakHypothesisBytes =
+      std::max(peakHypothesisBytes, other.peakHypothesisBytes);
+  return *this;
+}
+
+void LMQueryBatch::score(LM& lm, DecoderStats& stats) {
+  for (int i = 0; i < states.size(); i++) {
+    countLMQuery(stats, states[i], tokens[i]);
+  }
+  lm.scoreBatch(states, tokens, outStates, scores);
+  nextResult = 0;
+}
+
+void LMQueryBatch::clear() {
+  states.clear();
+  tokens.clear();
+  outStates.clear();
+  scores.clear();
+  nextResult = 0;
+}
+
+bool isBlankFrame(
+    const float* emissions,
+    const int blank,
+    const DecoderOptions& opt) {
+  return opt.criterionType == CriterionType::CTC &&
+      opt.blankSkipThreshold > 0 && blank >= 0 &&
+      emissions[blank] >= std::log(opt.blankSkipThreshold);
+}
+
+TransitionMatrix::TransitionMatrix(const std::vector<float>& transitions)
+    : scores_(transitions.size()),
+      N_(std::lround(std::sqrt(transitions.size()))) {
+  if (N_ * N_ != transitions.size()) {
+    throw std::invalid_argument(
+        "[Decoder] The transitions should be a square matrix");
+  }
+  for (int i = 0; i < N_; i++) {
+    for (int j = 0; j < N_; j++) {
+      scores_[j * N_ + i] = transitions[i * N_ + j];
+    }
+  }
+}
+
+namespace {
+// Bounds of the adaptive beam threshold relatively to `beamThreshold`
+constexpr float kAdaptiveBeamMinRatio = 0.05;
+// Growth of the adaptive beam threshold at each step within the target
+constexpr float kAdaptiveBeamGrowth = 1.25;
+} // namespace
+
+AdaptiveBeam::AdaptiveBeam(const DecoderOptions& opt)
+    : maxThreshold_(opt.beamThreshold),
+      minThreshold_(opt.beamThreshold * kAdaptiveBeamMinRatio),
+      targetCandidates_(opt.targetCandidates),
+      stepTimeBudget_(opt.stepTimeBudget),
+      threshold_(opt.beamThreshold) {}
+
+void AdaptiveBeam::reset() {
+  threshold_ = maxThreshold_;
+}
+
+void AdaptiveBeam::stepBegin() {
+  if (stepTimeBudget_ > 0) {
+    stepStart_ = std::chrono::steady_clock::now();
+  }
+}
+
+void AdaptiveBeam::stepEnd(
+    const double* scores,
+    const int nCandidates,
+    double bestScore) {
+  if (targetCandidates_ <= 0 && stepTimeBudget_ <= 0) {
+    return;
+  }
+
+  /* (1) Find how many candidates we can afford */
+  int target = targetCandidates_ > 0 ? targetCandidates_ : nCandidates;
+  if (stepTimeBudget_ > 0) {
+    double elapsed = std::chrono::duration<double, std::milli>(
+                         std::chrono::steady_clock::now() - stepStart_)
+                         .count();
+    if (elapsed > stepTimeBudget_) {
+      // The cost of a step is about linear in the number of candidates
+      target = std::min(
+          target, static_cast<int>(nCandidates * stepTimeBudget_ / elapsed));
+    }
+  }
+
+  /* (2) Narrow the beam to the target-th best score, or widen it back */
+  if (target > 0 && nCandidates > target) {
+    scores_.assign(scores, scores + nCandidates);
+    std::nth_element(
+        scores_.begin(),
+        scores_.begin() + target - 1,
+        scores_.end(),
+        std::greater<double>());
+    threshold_ = bestScore - scores_[target - 1];
+  } else {
+    threshold_ *= kAdaptiveBeamGrowth;
+  }
+  threshold_ = std::max(minThreshold_, std::min(maxThreshold_, threshold_));
+}
+
+CompactDecodeResult::CompactDecodeResult(const DecodeResult& result)
+    : score(result.score), length(result.tokens.size()) {
+  for (int frame = 0; frame < length; frame++) {
+    if (tokens.empty() || result.tokens[frame] != tokens.back()) {
+      tokenFrames.push_back(frame);
+      tokens.push_back(result.tokens[frame]);
+    }
+    if (result.words[frame] >= 0) {
+      wordFrames.push_back(frame);
+      words.push_back(result.words[frame]);
+    }
+  }
+}
+
+int CompactDecodeResult::tokenAt(int frame) const {
+  if (frame < 0 || frame >= length || tokenFrames.empty() ||
+      frame < tokenFrames.front()) {
+    return -1;
+  }
+  auto it = std::upper_bound(tokenFrames.begin(), tokenFrames.end(), frame);
+  return tokens[it - tokenFrames.begin() - 1];
+}
+
+int CompactDecodeResult::wordAt(int frame) const {
+  auto it = std::lower_bound(wordFrames.begin(), wordFrames.end(), frame);
+  if (it == wordFrames.end() || *it != frame) {
+    return -1;
+  }
+  return words[it - wordFrames.begin()];
+}
+
+DecodeResult CompactDecodeResult::expand() const {
+  DecodeResult res(length);
+  res.score = score;
+  for (int i = 0; i < tokens.size(); i++) {
+    int end = i + 1 < tokenFrames.size() ? tokenFrames[i + 1] : length;
+    std::fill(
+        res.tokens.begin() + tokenFrames[i],
+        res.tokens.begin() + end,
+        tokens[i]);
+  }
+  for (int i = 0; i < words.size(); i++) {
+    res.words[wordFrames[i]] = words[i];
+  }
+  return res;
+}
+
+void CandidateHashIndex::clear() {
+  if (size_ > 0) {
+    std::fill(positions_.begin(), positions_.end(), -1);
+    size_ = 0;
+  }
+}
+
+void CandidateHashIndex::grow() {
+  std::vector<size_t> hashes(std::max<size_t>(64, 2 * positions_.size()));
+  std::vector<int> positions(hashes.size(), -1);
+
+  size_t mask = positions.size() - 1;
+  for (size_t i = 0; i < positions_.size(); i++) {
+    if (positions_[i] < 0) {
+      continue;
+    }
+    size_t slot = hashes_[i] & mask;
+    while (positions[slot] >= 0) {
+      slot = (slot + 1) & mask;
+    }
+    positions[slot] = positions_[i];
+    hashes[slot] = hashes_[i];
+  }
+
+  hashes_.swap(hashes);
+  positions_.swap(positions);
+}
+
 } // namespace w2l
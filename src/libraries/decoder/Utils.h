@@ -9,8 +9,13 @@
 #pragma once
 
 #include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <cstdint>
+#include <limits>
 #include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
 #include "libraries/lm/LM.h"
@@ -22,6 +27,10 @@ const int kLookBackLimit = 100;
 
 enum class CriterionType { ASG = 0, CTC = 1, S2S = 2 };
 
+// When seq2seq decoders stop before all the hypothesis end (see
+// canStopSearch())
+enum class EarlyStopping { NONE = 0, BOUND = 1, HEURISTIC = 2 };
+
 struct DecoderOptions {
   int beamSize; // Maximum number of hypothesis we hold after each step
   int beamSizeToken; // Maximum number of tokens we consider at each step
@@ -33,6 +42,24 @@ struct DecoderOptions {
   float eosScore; // Score for inserting an EOS
   bool logAdd; // If or not use logadd when merging hypothesis
   CriterionType criterionType; // CTC or ASG
+  // Adaptive beam (see AdaptiveBeam), disabled if both are 0
+  int targetCandidates = 0; // Number of candidates to aim at for each step
+  float stepTimeBudget = 0; // Time budget in milliseconds for each step
+  // CTC only: blank posterior above which a frame only extends the
+  // hypothesis with blank (see isBlankFrame), disabled if 0
+  float blankSkipThreshold = 0;
+  // Lexicon decoders with a word LM only: LM lookahead (see LMLookahead) on
+  // the lexicon nodes with at most this many words below them, disabled if 0
+  int lmLookaheadWords = 0;
+  int lmLookaheadCacheSize = 1 << 20; // Cached lookaheads of a decoder
+  // LexiconDecoder only: number of tasks of the TaskScheduler expanding the
+  // beam of each frame, for the low latency of a single stream (1: serial)
+  int expandThreads = 1;
+  // Seq2seq decoders only: stop the search once the best complete hypothesis
+  // can not be beaten any more, and rank the final hypothesis by
+  // score / length^lengthNormalization (see canStopSearch())
+  EarlyStopping earlyStopping = EarlyStopping::NONE;
+  float lengthNormalization = 0;
 
   DecoderOptions(
       const int beamSize,
@@ -59,6 +86,41 @@ struct DecoderOptions {
   DecoderOptions() {}
 };
 
+/**
+ * DecoderStats counts the work of a decoder on the current input, to tune the
+ * beam options. Each candidate proposed is either merged with another one
+ * getting into the same state, pruned (by the beam threshold or the beam
+ * size), or stored in the beam. LM cache hits are the queries whose output
+ * state had already been created in the LM state tree (KenLM, ZeroLM).
+ */
+struct DecoderStats {
+  int64_t frames = 0; // Decoded frames (output steps for seq2seq decoders)
+  int64_t candidates = 0;
+  int64_t merged = 0;
+  int64_t stored = 0;
+  int64_t lmQueries = 0;
+  int64_t lmCacheHits = 0;
+  int64_t trieExpansions = 0; // Lexicon children visited
+  size_t peakHypothesisBytes = 0; // Storage of the beam and the candidates
+
+  int64_t pruned() const {
+    return candidates - merged - stored;
+  }
+
+  void updatePeakBytes(const size_t bytes) {
+    peakHypothesisBytes = std::max(peakHypothesisBytes, bytes);
+  }
+
+  DecoderStats& operator+=(const DecoderStats& other);
+};
+
+/* Count an LM query of `token` from `state`, before it is scored */
+inline void
+countLMQuery(DecoderStats& stats, const LMStatePtr& state, const int token) {
+  ++stats.lmQueries;
+  stats.lmCacheHits += state->children.count(token);
+}
+
 struct DecodeResult {
   double score;
   std::vector<int> words;
@@ -68,6 +130,57 @@ struct DecodeResult {
       : score(0), words(length, -1), tokens(length, -1) {}
 };
 
+/**
+ * CompactDecodeResult holds the same hypothesis as DecodeResult, but only
+ * stores the frames where the token changes (run-length encoding) and where
+ * words are emitted. Its size depends on the length of the transcription
+ * rather than on the number of frames, which matters for long streams. The
+ * per-frame view is queried with `tokenAt()` / `wordAt()` or built at once
+ * with `expand()`.
+ */
+struct CompactDecodeResult {
+  double score;
+  int length; // Number of frames
+  std::vector<int> tokenFrames; // First frame of each run of tokens
+  std::vector<int> tokens; // Token of each run
+  std::vector<int> wordFrames; // Frame of each emitted word
+  std::vector<int> words;
+
+  CompactDecodeResult() : score(0), length(0) {}
+
+  explicit CompactDecodeResult(const DecodeResult& result);
+
+  /* Token (or -1) at a given frame */
+  int tokenAt(int frame) const;
+
+  /* Word emitted (or -1) at a given frame */
+  int wordAt(int frame) const;
+
+  DecodeResult expand() const;
+};
+
+struct WordLatticeArc {
+  int from; // Source node
+  int to; // Destination node
+  int word; // Label of word (-1 if no word ends, e.g. at the end of stream)
+  double amScore; // Acoustic score, including transitions and silence scores
+  double lmScore; // Weighted LM score, including word insertion scores
+};
+
+/**
+ * WordLattice is a DAG of the words in the hypothesis of a beam, where the
+ * hypothesis share the nodes and arcs of their common history. Each node is a
+ * point in time where a word ends, arcs carry the word and its scores, so that
+ * an N-best list of the beam can be rescored without decoding again. Nodes are
+ * numbered in topological (time) order and arcs are sorted by source node.
+ */
+struct WordLattice {
+  std::vector<int> frames; // Frame of each node
+  std::vector<WordLatticeArc> arcs;
+  std::vector<int> starts; // Nodes without incoming arcs
+  std::vector<int> finals; // Final node of each hypothesis of the beam
+};
+
 template <class DecoderState>
 void mergeStates(
     DecoderState* oldNode,
@@ -87,47 +200,313 @@ bool isValidCandidate(
     const double score,
     const double beamThreshold);
 
+/**
+ * Fill `tokenIdx` with the indices of the `beamSizeToken` best tokens of a
+ * frame `scores[0..N)`, best first and ties broken by index. The row is
+ * scanned once against a heap of the current shortlist, so that most tokens
+ * cost a single comparison with its worst entry. If `N <= beamSizeToken`,
+ * all the tokens are kept in index order.
+ */
+void selectTopTokens(
+    const float* scores,
+    const int N,
+    const int beamSizeToken,
+    std::vector<size_t>& tokenIdx);
+
+/**
+ * Convert `n` IEEE half-precision floats to floats, with the F16C
+ * instructions when the CPU has them
+ */
+void halvesToFloats(const uint16_t* halves, int n, float* values);
+
+/**
+ * SparseEmissions holds the K best tokens of each frame of a T x N emission
+ * matrix with their scores, so that only O(T * K) values have to be moved
+ * from the device computing the emissions to the decoder. The tokens of a
+ * frame are sorted best first, and may include the blank beyond the K best.
+ * The tokens which are not listed score the `floor` of their frame, the
+ * worst of its K best scores.
+ */
+struct SparseEmissions {
+  int T = 0;
+  int N = 0;
+  std::vector<int> offsets{0}; // Frame t: [offsets[t], offsets[t + 1])
+  std::vector<int> tokens;
+  std::vector<float> scores;
+  std::vector<float> floors;
+
+  /* Append a frame, whose `size` tokens and scores are sorted best first */
+  void addFrame(const int* tokens, const float* scores, int size, float floor);
+
+  /* Write the N scores of frame `t` to `frame` */
+  void densify(int t, float* frame) const;
+};
+
+/**
+ * Sparsify the T x N `emissions`, keeping the `K` best tokens of each frame
+ * (see selectTopTokens), and the `blank` token if >= 0.
+ */
+SparseEmissions sparsifyEmissions(
+    const float* emissions,
+    const int T,
+    const int N,
+    const int K,
+    const int blank);
+
+/**
+ * CTC only: true if the blank posterior of a frame of log-probabilities
+ * `emissions` is above `opt.blankSkipThreshold`. Such a frame is decoded
+ * with the blank transition only: the hypothesis are carried over with the
+ * blank score, skipping the expansion with the other tokens.
+ */
+bool isBlankFrame(
+    const float* emissions,
+    const int blank,
+    const DecoderOptions& opt);
+
+/**
+ * TransitionMatrix holds the ASG transition scores by previous token: the
+ * scores from a token to all the others are contiguous, as a decoder reads
+ * them when it expands a hypothesis, instead of being N floats apart as in
+ * the N x N matrix of the criterion, whose (i, j) entry at `i * N + j`
+ * scores the transition from token j to token i.
+ */
+class TransitionMatrix {
+ public:
+  TransitionMatrix() = default;
+
+  /* Transpose `transitions` (N x N, or empty without transitions) */
+  explicit TransitionMatrix(const std::vector<float>& transitions);
+
+  /* Scores of the transitions from `prevToken`, indexed by the next token */
+  const float* from(const int prevToken) const {
+    return scores_.data() + prevToken * N_;
+  }
+
+  bool empty() const {
+    return scores_.empty();
+  }
+
+ private:
+  std::vector<float> scores_;
+  int N_ = 0;
+};
+
+/**
+ * AdaptiveBeam adjusts the beam threshold of a decoder step by step. After
+ * each step, if more candidates than targeted were proposed, the threshold of
+ * the next step is narrowed to the gap between the best score and the score
+ * of the target-th candidate, otherwise it is widened back progressively up
+ * to `beamThreshold`. The target is `targetCandidates`, and / or the number
+ * of candidates which can be proposed within `stepTimeBudget` given the
+ * duration of the last step. With both options at 0, the threshold is fixed.
+ */
+class AdaptiveBeam {
+ public:
+  explicit AdaptiveBeam(const DecoderOptions& opt);
+
+  /* Current beam threshold */
+  float threshold() const {
+    return threshold_;
+  }
+
+  /* Restore the initial threshold before decoding a new input */
+  void reset();
+
+  /* Resume with a threshold saved from threshold(), e.g. in a snapshot */
+  void setThreshold(float threshold) {
+    threshold_ = threshold;
+  }
+
+  /* Start timing the proposal of candidates of a new step */
+  void stepBegin();
+
+  /* Adapt the threshold given the scores of all the candidates of the step */
+  void stepEnd(const double* scores, const int nCandidates, double bestScore);
+
+ private:
+  float maxThreshold_;
+  float minThreshold_;
+  int targetCandidates_;
+  float stepTimeBudget_;
+
+  float threshold_;
+  std::chrono::steady_clock::time_point stepStart_;
+  std::vector<double> scores_;
+};
+
+/**
+ * CandidateBuffer holds the candidates proposed in the current frame. Next to
+ * the (fat) decoder states it keeps their initial scores in a dense array,
+ * i.e. a structure of arrays, so that the beam-threshold filter only scans
+ * contiguous floating-point values. Its interface mirrors the subset of
+ * `std::vector` used by the decoders.
+ */
+template <class DecoderState>
+class CandidateBuffer {
+ public:
+  template <class... Args>
+  void emplace_back(Args&&... args) {
+    states_.emplace_back(std::forward<Args>(args)...);
+    scores_.push_back(states_.back().score);
+  }
+
+  void clear() {
+    states_.clear();
+    scores_.clear();
+  }
+
+  bool empty() const {
+    return states_.empty();
+  }
+
+  size_t size() const {
+    return states_.size();
+  }
+
+  DecoderState* states() {
+    return states_.data();
+  }
+
+  DecoderState& operator[](const int idx) {
+    return states_[idx];
+  }
+
+  /* Refresh the dense score after the state has been modified in place */
+  void updateScore(const int idx) {
+    scores_[idx] = states_[idx].score;
+  }
+
+  const double* scores() const {
+    return scores_.data();
+  }
+
+  // Scratch space for top-K selection over (score, candidate) pairs
+  std::vector<std::pair<double, DecoderState*>>& ranked() {
+    return ranked_;
+  }
+
+  /* Bytes allocated for the candidates */
+  size_t bytes() const {
+    return states_.capacity() * sizeof(DecoderState) +
+        scores_.capacity() * sizeof(double) +
+        ranked_.capacity() * sizeof(std::pair<double, DecoderState*>);
+  }
+
+ private:
+  std::vector<DecoderState> states_;
+  std::vector<double> scores_;
+  std::vector<std::pair<double, DecoderState*>> ranked_;
+};
+
+/**
+ * CandidateHashIndex is an open-addressing (linear probing) hash table which
+ * maps the merging key of a candidate to its position in the candidate buffer.
+ * It lets decoders merge hypothesis getting into the same state as soon as
+ * they are proposed, in linear time, instead of sorting all the candidates of
+ * a frame. Only hashes and positions are stored, key equality is checked by
+ * the caller, and the table memory is kept across frames.
+ */
+class CandidateHashIndex {
+ public:
+  /* Remove all the entries */
+  void clear();
+
+  /**
+   * Look for an entry with the given hash for which `isSame(position)` holds.
+   * Return its position if found, otherwise insert `newPosition` and return -1.
+   */
+  template <class IsSame>
+  int findOrInsert(const size_t hash, const int newPosition, IsSame isSame) {
+    if (2 * (size_ + 1) > positions_.size()) {
+      grow();
+    }
+    size_t mask = positions_.size() - 1;
+    for (size_t slot = hash & mask;; slot = (slot + 1) & mask) {
+      if (positions_[slot] < 0) {
+        positions_[slot] = newPosition;
+        hashes_[slot] = hash;
+        ++size_;
+        return -1;
+      }
+      if (hashes_[slot] == hash && isSame(positions_[slot])) {
+        return positions_[slot];
+      }
+    }
+  }
+
+ private:
+  std::vector<size_t> hashes_;
+  std::vector<int> positions_; // -1 for empty slots
+  int size_ = 0;
+
+  void grow();
+};
+
+/* Combine a hash value with the one of another key field */
+inline size_t hashCombine(const size_t seed, const size_t value) {
+  return seed ^ (value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2));
+}
+
 template <class DecoderState>
 void pruneCandidates(
     std::vector<DecoderState*>& candidatePtrs,
-    std::vector<DecoderState>& candidates,
+    CandidateBuffer<DecoderState>& candidates,
     const float threshold) {
-  for (auto& candidate : candidates) {
-    if (candidate.score >= threshold) {
-      candidatePtrs.emplace_back(&candidate);
-    }
+  // Branch-free compaction over the dense score array: the comparison is
+  // vectorized by the compiler and no misprediction is paid per candidate.
+  const int nCandidates = candidates.size();
+  const double* scores = candidates.scores();
+  DecoderState* states = candidates.states();
+  int offset = candidatePtrs.size();
+  candidatePtrs.resize(offset + nCandidates);
+  for (int i = 0; i < nCandidates; i++) {
+    candidatePtrs[offset] = states + i;
+    offset += scores[i] >= threshold;
   }
+  candidatePtrs.resize(offset);
 }
 
 template <class DecoderState>
 void storeTopCandidates(
     std::vector<DecoderState>& nextHyp,
+    CandidateBuffer<DecoderState>& candidates,
     std::vector<DecoderState*>& candidatePtrs,
     const int beamSize,
     const bool returnSorted) {
-  auto compareNodes = [](const DecoderState* node1, const DecoderState* node2) {
-    return node1->score > node2->score;
+  // Select on (score, pointer) pairs stored contiguously, so that the
+  // comparisons do not chase a pointer to a different state each time.
+  using ScoredCandidate = std::pair<double, DecoderState*>;
+  auto compareNodes = [](const ScoredCandidate& node1,
+                         const ScoredCandidate& node2) {
+    return node1.first > node2.first;
   };
 
   int nValidHyp = candidatePtrs.size();
   int finalSize = std::min(nValidHyp, beamSize);
+  std::vector<ScoredCandidate>& scoredCandidates = candidates.ranked();
+  scoredCandidates.resize(nValidHyp);
+  for (int i = 0; i < nValidHyp; i++) {
+    scoredCandidates[i] =
+        ScoredCandidate(candidatePtrs[i]->score, candidatePtrs[i]);
+  }
   if (!returnSorted && nValidHyp > beamSize) {
     std::nth_element(
-        candidatePtrs.begin(),
-        candidatePtrs.begin() + finalSize,
-        candidatePtrs.begin() + nValidHyp,
+        scoredCandidates.begin(),
+        scoredCandidates.begin() + finalSize,
+        scoredCandidates.begin() + nValidHyp,
         compareNodes);
   } else if (returnSorted) {
     std::partial_sort(
-        candidatePtrs.begin(),
-        candidatePtrs.begin() + finalSize,
-        candidatePtrs.begin() + nValidHyp,
+        scoredCandidates.begin(),
+        scoredCandidates.begin() + finalSize,
+        scoredCandidates.begin() + nValidHyp,
         compareNodes);
   }
 
   nextHyp.resize(finalSize);
   for (int i = 0; i < finalSize; i++) {
-    nextHyp[i] = std::move(*candidatePtrs[i]);
+    nextHyp[i] = std::move(*scoredCandidates[i].second);
   }
 }
 
@@ -152,6 +531,38 @@ DecodeResult getHypothesis(const DecoderState* node, const int finalFrame) {
   return res;
 }
 
+template <class DecoderState>
+CompactDecodeResult getCompactHypothesis(
+    const DecoderState* node,
+    const int finalFrame) {
+  CompactDecodeResult res;
+  if (!node) {
+    return res;
+  }
+  res.score = node->score;
+  res.length = finalFrame + 1;
+
+  /* Collect the change points backward then reverse them */
+  for (int frame = finalFrame; node; frame--, node = node->parent) {
+    if (res.tokens.empty() || node->token != res.tokens.back()) {
+      res.tokenFrames.push_back(frame);
+      res.tokens.push_back(node->token);
+    } else {
+      res.tokenFrames.back() = frame;
+    }
+    if (node->getWord() >= 0) {
+      res.wordFrames.push_back(frame);
+      res.words.push_back(node->getWord());
+    }
+  }
+  std::reverse(res.tokenFrames.begin(), res.tokenFrames.end());
+  std::reverse(res.tokens.begin(), res.tokens.end());
+  std::reverse(res.wordFrames.begin(), res.wordFrames.end());
+  std::reverse(res.words.begin(), res.words.end());
+
+  return res;
+}
+
 template <class DecoderState>
 std::vector<DecodeResult> getAllHypothesis(
     const std::vector<DecoderState>& finalHyps,
@@ -212,9 +623,152 @@ const DecoderState* findBestAncestor(
   return bestNode;
 }
 
+/*
+ * Find the latest hypothesis which is an ancestor of all the hypothesis in
+ * `finalHyps`, i.e. the point before which the transcription can not change
+ * any more. Returns nullptr if there is no such ancestor within `maxLookBack`
+ * frames, otherwise `lookBack` is set to the number of frames it is behind.
+ */
+template <class DecoderState>
+const DecoderState* findCommonAncestor(
+    const std::vector<DecoderState>& finalHyps,
+    int& lookBack,
+    const int maxLookBack) {
+  std::vector<const DecoderState*> nodes;
+  nodes.reserve(finalHyps.size());
+  for (const DecoderState& hyp : finalHyps) {
+    nodes.push_back(&hyp);
+  }
+
+  int n = 0;
+  while (!nodes.empty()) {
+    // Hypothesis of one frame all share the parents from the previous one
+    std::sort(nodes.begin(), nodes.end());
+    nodes.erase(std::unique(nodes.begin(), nodes.end()), nodes.end());
+    if (!nodes.front()) {
+      break; // Reached the beginning of the buffer
+    }
+    if (nodes.size() == 1) {
+      lookBack = n;
+      return nodes.front();
+    }
+    if (n == maxLookBack) {
+      break;
+    }
+
+    for (const DecoderState*& node : nodes) {
+      node = node->parent;
+    }
+    n++;
+  }
+  return nullptr;
+}
+
+/**
+ * LMQueryBatch gathers the LM queries of a decoder step, so that they are
+ * scored with a single LM::scoreBatch() call. The results are then handed
+ * back with next() in the order the queries were added, or with result() by
+ * their index.
+ */
+struct LMQueryBatch {
+  std::vector<LMStatePtr> states;
+  std::vector<int> tokens;
+  std::vector<LMStatePtr> outStates;
+  std::vector<float> scores;
+  int nextResult = 0;
+
+  void add(const LMStatePtr& state, const int token) {
+    states.push_back(state);
+    tokens.push_back(token);
+  }
+
+  /* Score all the queries added so far, counting them in `stats` */
+  void score(LM& lm, DecoderStats& stats);
+
+  /* Result of the next query, in the order of add() */
+  std::pair<LMStatePtr, float> next() {
+    return result(nextResult++);
+  }
+
+  /* Result of the i-th query added, which can be taken only once */
+  std::pair<LMStatePtr, float> result(const int i) {
+    return std::make_pair(std::move(outStates[i]), scores[i]);
+  }
+
+  /* Drop the queries and results, keeping the storage */
+  void clear();
+};
+
+/**
+ * HypothesisArena stores the hypothesis of each frame in a frame-indexed
+ * buffer. The per-frame vectors are never freed: clearing a frame only
+ * destroys the states it holds and keeps the memory, so that after the first
+ * few frames (or the first utterance) the decoder no longer allocates while
+ * storing its beam.
+ */
+template <class DecoderState>
+class HypothesisArena {
+ public:
+  /* Make sure frames [0, nFrames) can be accessed */
+  void reserveFrames(const int nFrames) {
+    if (frames_.size() < nFrames) {
+      frames_.resize(nFrames);
+    }
+  }
+
+  /* Release the states of all the frames but keep their storage */
+  void clear() {
+    release(0);
+  }
+
+  /* Release the states of frames [startFrame, size()) in bulk */
+  void release(const int startFrame) {
+    for (int i = startFrame; i < frames_.size(); i++) {
+      frames_[i].clear();
+    }
+  }
+
+  int size() const {
+    return frames_.size();
+  }
+
+  std::vector<DecoderState>& operator[](const int frame) {
+    return frames_[frame];
+  }
+
+  const std::vector<DecoderState>& operator[](const int frame) const {
+    return frames_[frame];
+  }
+
+  /* Bytes allocated for the states of all the frames */
+  size_t bytes() const {
+    size_t total = 0;
+    for (const auto& frame : frames_) {
+      total += frame.capacity() * sizeof(DecoderState);
+    }
+    return total;
+  }
+
+ private:
+  // Moving the outer vector keeps the inner buffers, so parent pointers into
+  // previous frames stay valid when more frames are reserved.
+  std::vector<std::vector<DecoderState>> frames_;
+};
+
+/* Bytes allocated for the states of a frame-indexed hypothesis map */
 template <class DecoderState>
+size_t hypothesisBytes(
+    const std::unordered_map<int, std::vector<DecoderState>>& hypothesis) {
+  size_t total = 0;
+  for (const auto& frame : hypothesis) {
+    total += frame.second.capacity() * sizeof(DecoderState);
+  }
+  return total;
+}
+
+template <class HypothesisBuffer>
 void pruneAndNormalize(
-    std::unordered_map<int, std::vector<DecoderState>>& hypothesis,
+    HypothesisBuffer& hypothesis,
     const int startFrame,
     const int lookBack) {
   // (1) Move things from back of hypothesis to front.
@@ -223,7 +777,7 @@ void pruneAndNormalize(
   }
 
   // (2) Avoid further back-tracking
-  for (DecoderState& hyp : hypothesis[0]) {
+  for (auto& hyp : hypothesis[0]) {
     hyp.parent = nullptr;
   }
 
@@ -241,6 +795,123 @@ void pruneAndNormalize(
   }
 }
 
+/**
+ * Release the LM states which can not be reached from the hypothesis of the
+ * first `nFrames` frames any more (see LMState::releaseUnusedChildren()).
+ */
+template <class HypothesisBuffer>
+void releaseLMStates(HypothesisBuffer& hypothesis, const int nFrames) {
+  std::unordered_set<LMState*> visited;
+  for (int i = 0; i < nFrames; i++) {
+    for (const auto& hyp : hypothesis[i]) {
+      if (hyp.lmState && visited.insert(hyp.lmState.get()).second) {
+        hyp.lmState->releaseUnusedChildren();
+      }
+    }
+  }
+}
+
+/* Score of a hypothesis of `length` tokens, normalized by its length */
+inline double
+normalizedScore(const double score, const int length, const float alpha) {
+  return alpha == 0 ? score : score / std::pow(std::max(length, 1), alpha);
+}
+
+/**
+ * Number of tokens of hypothesis `hyp` of the seq2seq decoders after `nSteps`
+ * steps, EOS included: complete hypothesis are carried to the next steps
+ * with another EOS, which are not counted.
+ */
+template <class DecoderState>
+int outputLength(const DecoderState* hyp, const int nSteps, const int eos) {
+  int length = nSteps;
+  while (hyp->token == eos && hyp->parent && hyp->parent->token == eos) {
+    --length;
+    hyp = hyp->parent;
+  }
+  return length;
+}
+
+/**
+ * Early stopping of the seq2seq decoders: return true if no open hypothesis
+ * of `hyps`, the beam after `nSteps` steps, can end with a better normalized
+ * score (see normalizedScore()) than the best complete one, so that the
+ * search can stop before all the hypothesis end.
+ *
+ * With EarlyStopping::BOUND, this holds as long as the AM and LM scores of
+ * the tokens are log-probabilities (<= 0, with lmWeight >= 0): an open
+ * hypothesis can then at most gain `pending(hyp)` (e.g. the smeared LM score
+ * of a partial word, refunded with the word), `stepBonus` (e.g. the word
+ * score) at each of the steps left and the EOS score, at its most favorable
+ * length. With EarlyStopping::HEURISTIC, open hypothesis are ranked as if
+ * they ended with EOS right away, which stops much earlier but may miss a
+ * better hypothesis.
+ */
+template <class DecoderState, class PendingFn>
+bool canStopSearch(
+    const std::vector<DecoderState>& hyps,
+    const int nSteps,
+    const int maxOutputLength,
+    const int eos,
+    const DecoderOptions& opt,
+    const double stepBonus,
+    const PendingFn& pending) {
+  const float alpha = opt.lengthNormalization;
+  double bestComplete = -std::numeric_limits<double>::infinity();
+  double bestOpen = -std::numeric_limits<double>::infinity();
+  for (const DecoderState& hyp : hyps) {
+    if (hyp.token == eos) {
+      bestComplete = std::max(
+          bestComplete,
+          normalizedScore(hyp.score, outputLength(&hyp, nSteps, eos), alpha));
+      continue;
+    }
+    double bound;
+    if (opt.earlyStopping == EarlyStopping::HEURISTIC) {
+      bound = normalizedScore(hyp.score + opt.eosScore, nSteps + 1, alpha);
+    } else {
+      const double gain = pending(hyp) + std::max(0.0f, opt.eosScore) +
+          (maxOutputLength - nSteps) * std::max(0.0, stepBonus);
+      const double score = hyp.score + gain;
+      // A negative score is the least penalized at the longest length
+      bound = normalizedScore(
+          score, score < 0 ? maxOutputLength : nSteps + 1, alpha);
+    }
+    bestOpen = std::max(bestOpen, bound);
+  }
+  return bestComplete > -std::numeric_limits<double>::infinity() &&
+      bestComplete >= bestOpen;
+}
+
+/**
+ * Sort the final hypothesis `hyps` of a seq2seq decoder after `nSteps` steps
+ * by their normalized score (see normalizedScore()), if length
+ * normalization is enabled.
+ */
+template <class DecoderState>
+void sortByNormalizedScore(
+    std::vector<DecoderState>& hyps,
+    const int nSteps,
+    const int eos,
+    const DecoderOptions& opt) {
+  if (opt.lengthNormalization == 0) {
+    return;
+  }
+  std::vector<std::pair<double, int>> order;
+  for (int i = 0; i < hyps.size(); i++) {
+    const int length = outputLength(&hyps[i], nSteps, eos);
+    order.emplace_back(
+        -normalizedScore(hyps[i].score, length, opt.lengthNormalization), i);
+  }
+  std::sort(order.begin(), order.end());
+  std::vector<DecoderState> sorted;
+  sorted.reserve(hyps.size());
+  for (const auto& entry : order) {
+    sorted.push_back(std::move(hyps[entry.second]));
+  }
+  hyps = std::move(sorted);
+}
+
 template <class DecoderState>
 void updateLMCache(const LMPtr& lm, std::vector<DecoderState>& hypothesis) {
   // For ConvLM update cache
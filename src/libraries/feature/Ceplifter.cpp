@@ -37,11 +37,17 @@ void Ceplifter<T>::applyInPlace(std::vector<T>& input) const {
     throw std::invalid_argument(
         "Ceplifter: input size is not divisible by numFilters");
   }
-  size_t n = 0;
-  for (auto& in : input) {
-    in *= coefs_[n++];
-    if (n == numFilters_) {
-      n = 0;
+  apply(input.data(), input.size() / numFilters_, input.data());
+}
+
+template <typename T>
+void Ceplifter<T>::apply(const T* input, int64_t nFrames, T* output) const {
+  for (int64_t f = 0; f < nFrames; ++f) {
+    const T* in = input + f * numFilters_;
+    T* out = output + f * numFilters_;
+#pragma omp simd
+    for (int64_t n = 0; n < numFilters_; ++n) {
+      out[n] = in[n] * coefs_[n];
     }
   }
 }
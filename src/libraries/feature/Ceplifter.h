@@ -24,6 +24,10 @@ class Ceplifter {
 
   void applyInPlace(std::vector<T>& input) const;
 
+  // input, output - `nFrames` frames of `numfilters` coefficients, which may
+  //     be the same buffer
+  void apply(const T* input, int64_t nFrames, T* output) const;
+
  private:
   int64_t numFilters_; // number of filterbank channels
   int64_t lifterParam_; // liftering parameter
@@ -8,22 +8,33 @@
 
 #include "Dct.h"
 
+#include <algorithm>
 #include <cmath>
 #include <cstddef>
 #include <numeric>
+#include <stdexcept>
 
 #include "SpeechUtils.h"
 
 namespace w2l {
 
+namespace {
+// Below this number of frames, e.g. for the chunks of a streaming featurizer,
+// the product is computed directly rather than through BLAS
+constexpr int64_t kMaxDirectFrames = 16;
+} // namespace
+
 template <typename T>
-Dct<T>::Dct(int64_t numfilters, int64_t numceps)
+Dct<T>::Dct(int64_t numfilters, int64_t numceps, int64_t lifterparam)
     : numFilters_(numfilters),
       numCeps_(numceps),
       dctMat_(numfilters * numceps) {
   for (size_t f = 0; f < numFilters_; ++f) {
     for (size_t c = 0; c < numCeps_; ++c) {
-      dctMat_[f * numCeps_ + c] = std::sqrt(2.0 / numFilters_) *
+      double lifter = lifterparam > 0
+          ? 1.0 + 0.5 * lifterparam * std::sin(M_PI * c / lifterparam)
+          : 1.0;
+      dctMat_[f * numCeps_ + c] = lifter * std::sqrt(2.0 / numFilters_) *
           std::cos(M_PI * c * (f + 0.5) / numFilters_);
     }
   }
@@ -31,7 +42,34 @@ Dct<T>::Dct(int64_t numfilters, int64_t numceps)
 
 template <typename T>
 std::vector<T> Dct<T>::apply(const std::vector<T>& input) const {
-  return cblasGemm(input, dctMat_, numCeps_, numFilters_);
+  if (input.empty() || input.size() % numFilters_ != 0) {
+    throw std::invalid_argument(
+        "Dct: input size is not divisible by numFilters");
+  }
+  std::vector<T> output(input.size() / numFilters_ * numCeps_);
+  apply(input.data(), input.size() / numFilters_, output.data());
+  return output;
+}
+
+template <typename T>
+void Dct<T>::apply(const T* input, int64_t nFrames, T* output) const {
+  if (nFrames > kMaxDirectFrames) {
+    cblasGemm(input, dctMat_.data(), output, nFrames, numCeps_, numFilters_);
+    return;
+  }
+  for (int64_t i = 0; i < nFrames; ++i) {
+    const T* in = input + i * numFilters_;
+    T* out = output + i * numCeps_;
+    std::fill(out, out + numCeps_, T(0));
+    for (int64_t f = 0; f < numFilters_; ++f) {
+      const T* row = dctMat_.data() + f * numCeps_;
+      T x = in[f];
+#pragma omp simd
+      for (int64_t c = 0; c < numCeps_; ++c) {
+        out[c] += x * row[c];
+      }
+    }
+  }
 }
 
 template class Dct<float>;
@@ -16,13 +16,19 @@ namespace w2l {
 // Compute Discrete Cosine Transform
 //    c(i) = sqrt(2/N)  SUM_j (m(j) * cos(pi * i * (j - 0.5)/ N))
 //      where j in [1, N], m - log filterbank amplitudes
+// If `lifterparam` > 0, the coefficients are liftered as by Ceplifter, the
+// lifter weights being folded into the DCT matrix.
 template <typename T>
 class Dct {
  public:
-  Dct(int64_t numfilters, int64_t numceps);
+  Dct(int64_t numfilters, int64_t numceps, int64_t lifterparam = 0);
 
   std::vector<T> apply(const std::vector<T>& input) const;
 
+  // input - `nFrames` frames of `numfilters` channels
+  // output - `nFrames` frames of `numceps` coefficients
+  void apply(const T* input, int64_t nFrames, T* output) const;
+
  private:
   int64_t numFilters_; // Number of filterbank channels
   int64_t numCeps_; // Number of cepstral coefficients
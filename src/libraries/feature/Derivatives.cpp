@@ -8,13 +8,55 @@
 
 #include "Derivatives.h"
 
+#include <algorithm>
 #include <cstddef>
 #include <stdexcept>
 
 #include "SpeechUtils.h"
+#include "libraries/common/TaskScheduler.h"
 
 namespace w2l {
 
+namespace {
+// Frames of the derivatives computed by each task of apply(), which recomputes
+// the deltas of accWindow_ frames on each side of its block
+constexpr int64_t kFramesPerBlock = 256;
+
+// Derivatives of the frames [begin, end) of the `numframes` frames of
+// `numfeat` features of `input`, with a window length of W if W > 0 and of
+// `windowlen` otherwise. Frame i is accumulated in `output` + (i - begin) *
+// `outStride`, which must be zero. The lags of a frame are clamped at the
+// boundaries once per frame, so that the innermost loop runs over the
+// contiguous features.
+template <typename T, int64_t W = 0>
+void derivativeKernel(
+    const T* input,
+    int64_t numframes,
+    int64_t begin,
+    int64_t end,
+    int64_t numfeat,
+    T* output,
+    int64_t outStride,
+    int64_t windowlen = W) {
+  const int64_t window = W > 0 ? W : windowlen;
+  T denominator = (window * (window + 1) * (2 * window + 1)) / 3.0;
+  for (int64_t i = begin; i < end; ++i) {
+    T* out = output + (i - begin) * outStride;
+    for (int64_t d = 1; d <= window; ++d) {
+      const T* next = input + std::min(i + d, numframes - 1) * numfeat;
+      const T* prev = input + std::max<int64_t>(i - d, 0) * numfeat;
+#pragma omp simd
+      for (int64_t j = 0; j < numfeat; ++j) {
+        out[j] += d * (next[j] - prev[j]);
+      }
+    }
+    for (int64_t j = 0; j < numfeat; ++j) {
+      out[j] /= denominator;
+    }
+  }
+}
+} // namespace
+
 template <typename T>
 Derivatives<T>::Derivatives(int64_t deltawindow, int64_t accwindow)
     : deltaWindow_(deltawindow), accWindow_(accwindow) {}
@@ -31,61 +73,117 @@ std::vector<T> Derivatives<T>::apply(
   if (deltaWindow_ <= 0) {
     return input;
   }
+  int64_t numframes = input.size() / numfeat;
+  std::vector<T> output(numframes * outputFeatures(numfeat));
+  apply(input.data(), numframes, numfeat, output.data());
+  return output;
+}
 
-  auto deltas = computeDerivative(input, deltaWindow_, numfeat);
-  size_t szMul = 2;
-  std::vector<T> doubledeltas;
-  if (accWindow_ > 0) {
-    // Compute double deltas (only if required)
-    szMul = 3;
-    doubledeltas = computeDerivative(deltas, accWindow_, numfeat);
+template <typename T>
+void Derivatives<T>::apply(
+    const T* input,
+    int64_t numframes,
+    int64_t numfeat,
+    T* output) const {
+  if (deltaWindow_ <= 0) {
+    std::copy(input, input + numframes * numfeat, output);
+    return;
   }
-  std::vector<T> output(input.size() * szMul);
-  int64_t numframes = input.size() / numfeat;
-  for (size_t i = 0; i < numframes; ++i) {
-    size_t curInIdx = i * numfeat;
-    size_t curOutIdx = curInIdx * szMul;
-    // copy input
-    std::copy(
-        input.data() + curInIdx,
-        input.data() + curInIdx + numfeat,
-        output.data() + curOutIdx);
-    // copy deltas
-    std::copy(
-        deltas.data() + curInIdx,
-        deltas.data() + curInIdx + numfeat,
-        output.data() + curOutIdx + numfeat);
-    // copy double-deltas
+
+  int64_t accWindow = accWindow_ > 0 ? accWindow_ : 0;
+  int64_t outStride = outputFeatures(numfeat);
+  int64_t numBlocks = (numframes + kFramesPerBlock - 1) / kFramesPerBlock;
+
+  // The blocks of frames are independent, given the deltas of the frames of
+  // the context of their double deltas
+  TaskScheduler::get().parallelFor(numBlocks, [&](int64_t b) {
+    int64_t begin = b * kFramesPerBlock;
+    int64_t end = std::min(begin + kFramesPerBlock, numframes);
+    int64_t deltasBegin = std::max(begin - accWindow, int64_t(0));
+    int64_t deltasEnd = std::min(end + accWindow, numframes);
+    int64_t deltasSize = (deltasEnd - deltasBegin) * numfeat;
+    T* deltas = threadScratch<T>(ScratchSlot::DELTAS, deltasSize);
+    std::fill(deltas, deltas + deltasSize, 0.0);
+    computeDerivative(
+        input,
+        numframes,
+        deltasBegin,
+        deltasEnd,
+        deltaWindow_,
+        numfeat,
+        deltas,
+        numfeat);
+    for (int64_t i = begin; i < end; ++i) {
+      T* out = output + i * outStride;
+      // copy input
+      std::copy(input + i * numfeat, input + (i + 1) * numfeat, out);
+      // copy deltas
+      auto curDeltas = deltas + (i - deltasBegin) * numfeat;
+      std::copy(curDeltas, curDeltas + numfeat, out + numfeat);
+      if (accWindow_ > 0) {
+        std::fill(out + 2 * numfeat, out + 3 * numfeat, 0.0);
+      }
+    }
+    // compute double-deltas (only if required), clamped at the boundaries of
+    // the signal, which are the ones of `deltas` wherever they are reached
     if (accWindow_ > 0) {
-      std::copy(
-          doubledeltas.data() + curInIdx,
-          doubledeltas.data() + curInIdx + numfeat,
-          output.data() + curOutIdx + 2 * numfeat);
+      computeDerivative(
+          deltas,
+          deltasEnd - deltasBegin,
+          begin - deltasBegin,
+          end - deltasBegin,
+          accWindow_,
+          numfeat,
+          output + begin * outStride + 2 * numfeat,
+          outStride);
     }
+  });
+}
+
+template <typename T>
+int64_t Derivatives<T>::outputFeatures(int64_t numfeat) const {
+  if (deltaWindow_ <= 0) {
+    return numfeat;
   }
-  return output;
+  return numfeat * (accWindow_ > 0 ? 3 : 2);
 }
 
 template <typename T>
-std::vector<T> Derivatives<T>::computeDerivative(
-    const std::vector<T>& input,
+int64_t Derivatives<T>::context() const {
+  if (deltaWindow_ <= 0) {
+    return 0;
+  }
+  return deltaWindow_ + std::max<int64_t>(accWindow_, 0);
+}
+
+template <typename T>
+void Derivatives<T>::computeDerivative(
+    const T* input,
+    int64_t numframes,
+    int64_t begin,
+    int64_t end,
     int64_t windowlen,
-    int64_t numfeat) const {
-  int64_t numframes = input.size() / numfeat;
-  std::vector<T> output(input.size(), 0.0);
-  T denominator = (windowlen * (windowlen + 1) * (2 * windowlen + 1)) / 3.0;
-  for (size_t i = 0; i < numframes; ++i) {
-    for (size_t j = 0; j < numfeat; ++j) {
-      size_t curIdx = i * numfeat + j;
-      for (size_t d = 1; d <= windowlen; ++d) {
-        output[curIdx] += d *
-            (input[curIdx + std::min((numframes - i - 1), d) * numfeat] -
-             input[curIdx - std::min(i, d) * numfeat]);
-      }
-      output[curIdx] /= denominator;
-    }
+    int64_t numfeat,
+    T* output,
+    int64_t outStride) const {
+  // The usual window lengths are compile-time constants of the kernel
+  switch (windowlen) {
+    case 1:
+      derivativeKernel<T, 1>(
+          input, numframes, begin, end, numfeat, output, outStride);
+      break;
+    case 2:
+      derivativeKernel<T, 2>(
+          input, numframes, begin, end, numfeat, output, outStride);
+      break;
+    case 3:
+      derivativeKernel<T, 3>(
+          input, numframes, begin, end, numfeat, output, outStride);
+      break;
+    default:
+      derivativeKernel<T>(
+          input, numframes, begin, end, numfeat, output, outStride, windowlen);
   }
-  return output;
 }
 
 template class Derivatives<float>;
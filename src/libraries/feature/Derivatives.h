@@ -25,14 +25,33 @@ class Derivatives {
 
   std::vector<T> apply(const std::vector<T>& input, int64_t numfeat) const;
 
+  // input - `numframes` frames of `numfeat` features
+  // output - `numframes` frames of outputFeatures(`numfeat`) features: the
+  //     input features, then their deltas and double deltas, if any
+  void apply(const T* input, int64_t numframes, int64_t numfeat, T* output)
+      const;
+
+  // Number of features of a frame of `numfeat` features with its derivatives
+  int64_t outputFeatures(int64_t numfeat) const;
+
+  // Number of frames on each side of a frame which its output depends on
+  int64_t context() const;
+
  private:
   int64_t deltaWindow_; // delta derivatives lag size
   int64_t accWindow_; // acceleration derivatives lag size
 
-  // Helper function to compute derivatives of single order
-  std::vector<T> computeDerivative(
-      const std::vector<T>& input,
+  // Helper function to compute derivatives of single order of the frames
+  // [begin, end) of the `numframes` frames of `input`, frame i being written
+  // at `output` + (i - begin) * `outStride`
+  void computeDerivative(
+      const T* input,
+      int64_t numframes,
+      int64_t begin,
+      int64_t end,
       int64_t windowlen,
-      int64_t numfeat) const;
+      int64_t numfeat,
+      T* output,
+      int64_t outStride) const;
 };
 } // namespace w2l
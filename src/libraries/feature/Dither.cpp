@@ -9,28 +9,123 @@
 #include "Dither.h"
 
 #include <time.h>
+#include <algorithm>
 
 namespace w2l {
 
+namespace {
+
+// Philox4x32-10 of Salmon et al., "Parallel Random Numbers: As Easy as 1, 2,
+// 3", SC 2011
+constexpr uint32_t kPhiloxM0 = 0xD2511F53;
+constexpr uint32_t kPhiloxM1 = 0xCD9E8D57;
+constexpr uint32_t kPhiloxW0 = 0x9E3779B9;
+constexpr uint32_t kPhiloxW1 = 0xBB67AE85;
+constexpr int kPhiloxRounds = 10;
+
+// Blocks of 4 noise samples computed at a time, one per SIMD lane
+constexpr int64_t kNoiseBlocks = 64;
+
+// noise - the 4 * kNoiseBlocks uniforms in [0, 1) of the blocks starting at
+//     `block`, i.e. the noise samples starting at 4 * `block`
+template <typename T>
+void philoxUniforms(uint64_t seed, uint64_t block, T* noise) {
+  uint32_t c0[kNoiseBlocks], c1[kNoiseBlocks], c2[kNoiseBlocks],
+      c3[kNoiseBlocks];
+#pragma omp simd
+  for (int64_t b = 0; b < kNoiseBlocks; ++b) {
+    uint64_t counter = block + b;
+    c0[b] = static_cast<uint32_t>(counter);
+    c1[b] = static_cast<uint32_t>(counter >> 32);
+    c2[b] = 0;
+    c3[b] = 0;
+  }
+  uint32_t k0 = static_cast<uint32_t>(seed);
+  uint32_t k1 = static_cast<uint32_t>(seed >> 32);
+  for (int r = 0; r < kPhiloxRounds; ++r) {
+#pragma omp simd
+    for (int64_t b = 0; b < kNoiseBlocks; ++b) {
+      uint64_t p0 = static_cast<uint64_t>(kPhiloxM0) * c0[b];
+      uint64_t p1 = static_cast<uint64_t>(kPhiloxM1) * c2[b];
+      uint32_t x0 = static_cast<uint32_t>(p1 >> 32) ^ c1[b] ^ k0;
+      uint32_t x2 = static_cast<uint32_t>(p0 >> 32) ^ c3[b] ^ k1;
+      c1[b] = static_cast<uint32_t>(p1);
+      c3[b] = static_cast<uint32_t>(p0);
+      c0[b] = x0;
+      c2[b] = x2;
+    }
+    k0 += kPhiloxW0;
+    k1 += kPhiloxW1;
+  }
+  // The 24 high bits are exact in float, and the results below 1 once
+  // rounded
+  const T scale = 1.0 / (1 << 24);
+#pragma omp simd
+  for (int64_t b = 0; b < kNoiseBlocks; ++b) {
+    noise[4 * b] = (c0[b] >> 8) * scale;
+    noise[4 * b + 1] = (c1[b] >> 8) * scale;
+    noise[4 * b + 2] = (c2[b] >> 8) * scale;
+    noise[4 * b + 3] = (c3[b] >> 8) * scale;
+  }
+}
+
+} // namespace
+
 template <typename T>
 Dither<T>::Dither(T ditherVal)
-    : ditherVal_(ditherVal), rng_((ditherVal > 0.0) ? 123456 : time(nullptr)){};
+    : ditherVal_(ditherVal),
+      seed_((ditherVal > 0.0) ? 123456 : time(nullptr)),
+      offset_(0) {}
 
 template <typename T>
 std::vector<T> Dither<T>::apply(const std::vector<T>& input) {
-  auto output(input);
-  applyInPlace(output);
+  std::vector<T> output(input.size());
+  apply(input.data(), input.size(), output.data());
   return output;
 }
 
 template <typename T>
 void Dither<T>::applyInPlace(std::vector<T>& input) {
-  std::uniform_real_distribution<T> distribution(0.0, 1.0);
-  for (auto& i : input) {
-    i += ditherVal_ * distribution(rng_);
+  applyInPlace(input.data(), input.size());
+}
+
+template <typename T>
+void Dither<T>::applyInPlace(T* input, int64_t size) {
+  apply(input, size, input);
+}
+
+template <typename T>
+void Dither<T>::apply(const T* input, int64_t size, T* output) {
+  apply(input, size, output, advance(size));
+}
+
+template <typename T>
+void Dither<T>::apply(
+    const T* input,
+    int64_t size,
+    T* output,
+    uint64_t offset) const {
+  T noise[4 * kNoiseBlocks];
+  int64_t skip = offset % 4; // noise samples before `offset` in its block
+  for (uint64_t block = offset / 4; size > 0; block += kNoiseBlocks) {
+    philoxUniforms(seed_, block, noise);
+    int64_t n = std::min(4 * kNoiseBlocks - skip, size);
+#pragma omp simd
+    for (int64_t i = 0; i < n; ++i) {
+      output[i] = input[i] + ditherVal_ * noise[skip + i];
+    }
+    input += n;
+    output += n;
+    size -= n;
+    skip = 0;
   }
 }
 
+template <typename T>
+uint64_t Dither<T>::advance(uint64_t size) {
+  return offset_.fetch_add(size);
+}
+
 template class Dither<float>;
 template class Dither<double>;
 } // namespace w2l
@@ -8,17 +8,22 @@
 
 #pragma once
 
-#include <random>
+#include <stdint.h>
+#include <atomic>
 #include <vector>
 
 namespace w2l {
 
 // Dither the signal by adding small amount of random noise to the signal
-//    s'(n) = s(n) + q * RND()  where RND() is uniformly distributed in [-1, 1)
+//    s'(n) = s(n) + q * RND()  where RND() is uniformly distributed in [0, 1)
 //      and `q` is the dithering constant
 // Similar to HTK, positive value of `q` causes the same noise signal to be
 // added everytime and with negative value of `q`, noise is random and the same
 // file may produce slightly different results in different trials
+//
+// The noise is a stream drawn from a counter-based generator (Philox4x32-10):
+// its sample at offset `i` only depends on the seed and `i`, so that any range
+// of it is computed directly, in SIMD batches, by any thread.
 
 template <typename T>
 class Dither {
@@ -29,8 +34,22 @@ class Dither {
 
   void applyInPlace(std::vector<T>& input);
 
+  void applyInPlace(T* input, int64_t size);
+
+  // output - the `size` dithered samples of `input`, which may be the same
+  //     buffer, with the next `size` samples of the noise
+  void apply(const T* input, int64_t size, T* output);
+
+  // Same, with the noise samples [offset, offset + size)
+  void apply(const T* input, int64_t size, T* output, uint64_t offset) const;
+
+  // Returns the offset of the next `size` samples of the noise, which the
+  // next calls of apply() without offset won't use. Thread-safe.
+  uint64_t advance(uint64_t size);
+
  private:
   T ditherVal_;
-  std::mt19937 rng_; // Standard mersenne_twister_engine
+  uint64_t seed_;
+  std::atomic<uint64_t> offset_; // of the noise of the next apply()
 };
 } // namespace w2l
@@ -80,6 +80,11 @@ struct FeatureParams {
   // If true, remove DC offset from the signal frames
   bool zeroMeanFrame;
 
+  // If true, the log filterbank energies of float features are computed with
+  // a vectorized approximation within 1 ulp, see logArray(), instead of being
+  // bit-exact with std::log
+  bool fastLog;
+
   FeatureParams(
       int64_t samplingfreq = 16000,
       int64_t framesizems = 25,
@@ -98,7 +103,8 @@ struct FeatureParams {
       bool usepower = true,
       bool usenergy = true,
       bool rawenergy = true,
-      bool zeromeanframe = true)
+      bool zeromeanframe = true,
+      bool fastlog = false)
       : samplingFreq(samplingfreq),
         frameSizeMs(framesizems),
         frameStrideMs(framestridems),
@@ -116,7 +122,8 @@ struct FeatureParams {
         usePower(usepower),
         useEnergy(usenergy),
         rawEnergy(rawenergy),
-        zeroMeanFrame(zeromeanframe) {}
+        zeroMeanFrame(zeromeanframe),
+        fastLog(fastlog) {}
 
   // frame size (no of samples)
   // the last frame is discarded, if less than the frame size
@@ -8,7 +8,9 @@
 
 #include "Mfcc.h"
 
+#include <cmath>
 #include <cstddef>
+#include <stdexcept>
 
 #include "SpeechUtils.h"
 
@@ -17,49 +19,54 @@ namespace w2l {
 template <typename T>
 Mfcc<T>::Mfcc(const FeatureParams& params)
     : Mfsc<T>(params),
-      dct_(params.numFilterbankChans, params.numCepstralCoeffs),
-      ceplifter_(params.numCepstralCoeffs, params.lifterParam),
+      dct_(
+          params.numFilterbankChans,
+          params.numCepstralCoeffs,
+          params.lifterParam),
       derivatives_(params.deltaWindow, params.accWindow) {
   validateMfccParams();
 }
 
 template <typename T>
-std::vector<T> Mfcc<T>::apply(const std::vector<T>& input) {
-  auto frames = frameSignal(input, this->featParams_);
-  if (frames.empty()) {
-    return {};
-  }
-
-  int64_t nSamples = this->featParams_.numFrameSizeSamples();
-  int64_t nFrames = frames.size() / nSamples;
-
-  std::vector<T> energy(nFrames);
-  if (this->featParams_.useEnergy && this->featParams_.rawEnergy) {
-    for (size_t f = 0; f < nFrames; ++f) {
-      auto begin = frames.data() + f * nSamples;
-      energy[f] =
-          std::log(std::inner_product(begin, begin + nSamples, begin, 0.0));
-    }
-  }
-  auto mfscfeat = this->mfscImpl(frames);
-  auto cep = dct_.apply(mfscfeat);
-  ceplifter_.applyInPlace(cep);
+void Mfcc<T>::frameFeatures(const T* signal, int64_t nFrames, T* output) {
+  double* energy = this->featParams_.useEnergy
+      ? threadScratch<double>(ScratchSlot::FRAME_ENERGY, nFrames)
+      : nullptr;
+  T* mfscFeat = threadScratch<T>(
+      ScratchSlot::FILTERBANK, nFrames * this->featParams_.numFilterbankChans);
+  this->mfscImpl(signal, nFrames, mfscFeat, energy);
+  // Liftered by the DCT
+  dct_.apply(mfscFeat, nFrames, output);
 
   auto nFeat = this->featParams_.numCepstralCoeffs;
   if (this->featParams_.useEnergy) {
-    if (!this->featParams_.rawEnergy) {
-      for (size_t f = 0; f < nFrames; ++f) {
-        auto begin = frames.data() + f * nSamples;
-        energy[f] =
-            std::log(std::inner_product(begin, begin + nSamples, begin, 0.0));
-      }
-    }
     // Replace C0 with energy
-    for (size_t f = 0; f < nFrames; ++f) {
-      cep[f * nFeat] = energy[f];
+    for (int64_t f = 0; f < nFrames; ++f) {
+      output[f * nFeat] = std::log(energy[f]);
     }
   }
-  return derivatives_.apply(cep, nFeat);
+}
+
+template <typename T>
+void Mfcc<T>::applyDerivatives(const T* input, int64_t nFrames, T* output)
+    const {
+  derivatives_.apply(
+      input, nFrames, this->featParams_.numCepstralCoeffs, output);
+}
+
+template <typename T>
+int64_t Mfcc<T>::frameFeatureSize() const {
+  return this->featParams_.numCepstralCoeffs;
+}
+
+template <typename T>
+int64_t Mfcc<T>::featureSize() const {
+  return derivatives_.outputFeatures(frameFeatureSize());
+}
+
+template <typename T>
+int64_t Mfcc<T>::derivativesContext() const {
+  return derivatives_.context();
 }
 
 template <typename T>
@@ -8,7 +8,6 @@
 
 #pragma once
 
-#include "Ceplifter.h"
 #include "Dct.h"
 #include "Derivatives.h"
 #include "FeatureParams.h"
@@ -57,16 +56,27 @@ class Mfcc : public Mfsc<T> {
 
   virtual ~Mfcc() {}
 
-  // input - input speech signal (T)
-  // Returns - MFCC features (Col Major : FEAT X FRAMESZ)
-  std::vector<T> apply(const std::vector<T>& input) override;
+  using PowerSpectrum<T>::frameFeatures;
+  using PowerSpectrum<T>::applyDerivatives;
+
+  // signal - input speech signal from the start of its first frame
+  // output - MFCC features without derivatives (Col Major : FEAT X NFRAMES)
+  void frameFeatures(const T* signal, int64_t nFrames, T* output) override;
+
+  void applyDerivatives(const T* input, int64_t nFrames, T* output)
+      const override;
+
+  int64_t frameFeatureSize() const override;
+
+  int64_t featureSize() const override;
+
+  int64_t derivativesContext() const override;
 
   int64_t outputSize(int64_t inputSz) override;
 
  private:
   // The following classes are defined in the order they are applied
-  Dct<T> dct_;
-  Ceplifter<T> ceplifter_;
+  Dct<T> dct_; // with the lifter of the cepstral coefficients
   Derivatives<T> derivatives_;
 
   void validateMfccParams() const;
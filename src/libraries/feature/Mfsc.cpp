@@ -9,8 +9,10 @@
 #include "Mfsc.h"
 
 #include <algorithm>
+#include <cmath>
 #include <cstddef>
-#include <numeric>
+#include <limits>
+#include <stdexcept>
 
 #include "SpeechUtils.h"
 
@@ -31,67 +33,76 @@ Mfsc<T>::Mfsc(const FeatureParams& params)
 }
 
 template <typename T>
-std::vector<T> Mfsc<T>::apply(const std::vector<T>& input) {
-  auto frames = frameSignal(input, this->featParams_);
-  if (frames.empty()) {
-    return {};
+void Mfsc<T>::frameFeatures(const T* signal, int64_t nFrames, T* output) {
+  if (!this->featParams_.useEnergy) {
+    mfscImpl(signal, nFrames, output);
+    return;
   }
-
-  int64_t nSamples = this->featParams_.numFrameSizeSamples();
-  int64_t nFrames = frames.size() / nSamples;
-
-  std::vector<T> energy(nFrames);
-  if (this->featParams_.useEnergy && this->featParams_.rawEnergy) {
-    for (size_t f = 0; f < nFrames; ++f) {
-      auto begin = frames.data() + f * nSamples;
-      energy[f] = std::log(std::max(
-          std::inner_product(
-              begin, begin + nSamples, begin, static_cast<T>(0.0)),
-          std::numeric_limits<T>::min()));
-    }
-  }
-  auto mfscFeat = mfscImpl(frames);
+  // The log energy is written before the filterbank energies of each frame
   auto numFeat = this->featParams_.numFilterbankChans;
-  if (this->featParams_.useEnergy) {
-    if (!this->featParams_.rawEnergy) {
-      for (size_t f = 0; f < nFrames; ++f) {
-        auto begin = frames.data() + f * nSamples;
-        energy[f] = std::log(std::max(
-            std::inner_product(
-                begin, begin + nSamples, begin, static_cast<T>(0.0)),
-            std::numeric_limits<T>::min()));
-      }
-    }
-    std::vector<T> newMfscFeat(mfscFeat.size() + nFrames);
-    for (size_t f = 0; f < nFrames; ++f) {
-      size_t start = f * numFeat;
-      newMfscFeat[start + f] = energy[f];
-      std::copy(
-          mfscFeat.data() + start,
-          mfscFeat.data() + start + numFeat,
-          newMfscFeat.data() + start + f + 1);
-    }
-    std::swap(mfscFeat, newMfscFeat);
-    ++numFeat;
+  double* energy = threadScratch<double>(ScratchSlot::FRAME_ENERGY, nFrames);
+  mfscImpl(signal, nFrames, output + 1, energy, numFeat + 1);
+  T* logEnergy = threadScratch<T>(ScratchSlot::FILTERBANK, nFrames);
+  for (int64_t f = 0; f < nFrames; ++f) {
+    logEnergy[f] =
+        std::max(static_cast<T>(energy[f]), std::numeric_limits<T>::min());
   }
+  logArray(logEnergy, nFrames, logEnergy, this->featParams_.fastLog);
+  for (int64_t f = 0; f < nFrames; ++f) {
+    output[f * (numFeat + 1)] = logEnergy[f];
+  }
+}
+
+template <typename T>
+void Mfsc<T>::applyDerivatives(const T* input, int64_t nFrames, T* output)
+    const {
   // Derivatives will not be computed if windowsize < 0
-  return derivatives_.apply(mfscFeat, numFeat);
+  derivatives_.apply(input, nFrames, frameFeatureSize(), output);
+}
+
+template <typename T>
+int64_t Mfsc<T>::frameFeatureSize() const {
+  return this->featParams_.numFilterbankChans +
+      (this->featParams_.useEnergy ? 1 : 0);
+}
+
+template <typename T>
+int64_t Mfsc<T>::featureSize() const {
+  return derivatives_.outputFeatures(frameFeatureSize());
 }
 
 template <typename T>
-std::vector<T> Mfsc<T>::mfscImpl(std::vector<T>& frames) {
-  auto powspectrum = this->powSpectrumImpl(frames);
+int64_t Mfsc<T>::derivativesContext() const {
+  return derivatives_.context();
+}
+
+template <typename T>
+void Mfsc<T>::mfscImpl(
+    const T* signal,
+    int64_t nFrames,
+    T* output,
+    double* frameEnergy /* = nullptr */,
+    int64_t outStride /* = 0 */) {
+  int64_t K = this->featParams_.filterFreqResponseLen();
+  int64_t numFeat = this->featParams_.numFilterbankChans;
+  if (outStride <= 0) {
+    outStride = numFeat;
+  }
+  T* powspectrum = threadScratch<T>(ScratchSlot::POW_SPECTRUM, nFrames * K);
+  this->powSpectrumImpl(signal, nFrames, powspectrum, frameEnergy);
   if (this->featParams_.usePower) {
-    std::transform(
-        powspectrum.begin(), powspectrum.end(), powspectrum.begin(), [](T x) {
-          return x * x;
-        });
+#pragma omp simd
+    for (int64_t i = 0; i < nFrames * K; ++i) {
+      powspectrum[i] *= powspectrum[i];
+    }
+  }
+  // The log of the filterbank energies of a frame is taken while they're in
+  // cache
+  for (int64_t f = 0; f < nFrames; ++f) {
+    T* out = output + f * outStride;
+    triFltBank_.apply(powspectrum + f * K, 1, out, this->featParams_.melFloor);
+    logArray(out, numFeat, out, this->featParams_.fastLog);
   }
-  auto triflt = triFltBank_.apply(powspectrum, this->featParams_.melFloor);
-  std::transform(triflt.begin(), triflt.end(), triflt.begin(), [](T x) {
-    return std::log(x);
-  });
-  return triflt;
 }
 
 template <typename T>
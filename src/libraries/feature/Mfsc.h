@@ -25,16 +25,36 @@ class Mfsc : public PowerSpectrum<T> {
 
   virtual ~Mfsc() {}
 
-  // input - input speech signal (T)
-  // Returns - MFSC feature (Col Major : FEAT X FRAMESZ)
-  std::vector<T> apply(const std::vector<T>& input) override;
+  using PowerSpectrum<T>::frameFeatures;
+  using PowerSpectrum<T>::applyDerivatives;
+
+  // signal - input speech signal from the start of its first frame
+  // output - MFSC feature without derivatives (Col Major : FEAT X NFRAMES)
+  void frameFeatures(const T* signal, int64_t nFrames, T* output) override;
+
+  void applyDerivatives(const T* input, int64_t nFrames, T* output)
+      const override;
+
+  int64_t frameFeatureSize() const override;
+
+  int64_t featureSize() const override;
+
+  int64_t derivativesContext() const override;
 
   int64_t outputSize(int64_t inputSz) override;
 
  protected:
-  // Helper function which takes input as signal after dividing the signal into
-  // frames. Main purpose of this function is to reuse it in MFCC code
-  std::vector<T> mfscImpl(std::vector<T>& frames);
+  // Helper function which takes the frames of the signal as frameFeatures().
+  // Main purpose of this function is to reuse it in MFCC code.
+  // output - the log filterbank energies of each frame, `outStride` apart
+  //     (numFilterbankChans if <= 0)
+  // frameEnergy - as for powSpectrumImpl()
+  void mfscImpl(
+      const T* signal,
+      int64_t nFrames,
+      T* output,
+      double* frameEnergy = nullptr,
+      int64_t outStride = 0);
   void validateMfscParams() const;
 
  private:
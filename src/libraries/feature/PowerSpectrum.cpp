@@ -9,82 +9,376 @@
 #include "PowerSpectrum.h"
 
 #include <algorithm>
+#include <cmath>
 #include <cstddef>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
 #include <unordered_map>
 
 #include "SpeechUtils.h"
+#include "libraries/common/TaskScheduler.h"
 
 namespace w2l {
 
+namespace {
+// Frames transformed by a single execution of the batch plan
+constexpr int64_t kFftBatchSize = 16;
+// Frames are kFftAlign elements apart in the FFT buffers, so that each of
+// them is as aligned as the buffers the plans were made with
+constexpr int64_t kFftAlign = 8;
+
+/* The FFTW interface of the precision of T */
+template <typename T>
+struct Fftw;
+
+template <>
+struct Fftw<float> {
+  using Plan = fftwf_plan;
+  using Complex = fftwf_complex;
+
+  static void* malloc(size_t size) {
+    return fftwf_malloc(size);
+  }
+  static void free(void* ptr) {
+    fftwf_free(ptr);
+  }
+  static Plan planR2c(int n, float* in, Complex* out) {
+    return fftwf_plan_dft_r2c_1d(n, in, out, FFTW_MEASURE);
+  }
+  static Plan planManyR2c(
+      int n,
+      int howMany,
+      float* in,
+      int inDist,
+      Complex* out,
+      int outDist) {
+    return fftwf_plan_many_dft_r2c(
+        1,
+        &n,
+        howMany,
+        in,
+        nullptr,
+        1,
+        inDist,
+        out,
+        nullptr,
+        1,
+        outDist,
+        FFTW_MEASURE);
+  }
+  static void execute(const Plan plan, float* in, Complex* out) {
+    fftwf_execute_dft_r2c(plan, in, out);
+  }
+  static void destroy(Plan plan) {
+    fftwf_destroy_plan(plan);
+  }
+};
+
+template <>
+struct Fftw<double> {
+  using Plan = fftw_plan;
+  using Complex = fftw_complex;
+
+  static void* malloc(size_t size) {
+    return fftw_malloc(size);
+  }
+  static void free(void* ptr) {
+    fftw_free(ptr);
+  }
+  static Plan planR2c(int n, double* in, Complex* out) {
+    return fftw_plan_dft_r2c_1d(n, in, out, FFTW_MEASURE);
+  }
+  static Plan planManyR2c(
+      int n,
+      int howMany,
+      double* in,
+      int inDist,
+      Complex* out,
+      int outDist) {
+    return fftw_plan_many_dft_r2c(
+        1,
+        &n,
+        howMany,
+        in,
+        nullptr,
+        1,
+        inDist,
+        out,
+        nullptr,
+        1,
+        outDist,
+        FFTW_MEASURE);
+  }
+  static void execute(const Plan plan, double* in, Complex* out) {
+    fftw_execute_dft_r2c(plan, in, out);
+  }
+  static void destroy(Plan plan) {
+    fftw_destroy_plan(plan);
+  }
+};
+
+template <typename T>
+struct FftwDeleter {
+  void operator()(void* ptr) const {
+    Fftw<T>::free(ptr);
+  }
+};
+
+template <typename T, typename U>
+using FftwBuffer = std::unique_ptr<U[], FftwDeleter<T>>;
+
+// `size` elements U allocated by the FFTW of the precision of T
+template <typename T, typename U>
+FftwBuffer<T, U> fftwAlloc(int64_t size) {
+  auto ptr = static_cast<U*>(Fftw<T>::malloc(sizeof(U) * size));
+  if (!ptr) {
+    throw std::bad_alloc();
+  }
+  return FftwBuffer<T, U>(ptr);
+}
+
+// The FFT buffers of a thread, of at least the sizes of the last call of get()
+template <typename T>
+struct FftScratch {
+  FftwBuffer<T, T> in;
+  FftwBuffer<T, typename Fftw<T>::Complex> out;
+  int64_t inSize = 0;
+  int64_t outSize = 0;
+
+  static FftScratch& get(int64_t inSize, int64_t outSize) {
+    static thread_local FftScratch scratch;
+    if (scratch.inSize < inSize) {
+      scratch.in = fftwAlloc<T, T>(inSize);
+      scratch.inSize = inSize;
+    }
+    if (scratch.outSize < outSize) {
+      scratch.out = fftwAlloc<T, typename Fftw<T>::Complex>(outSize);
+      scratch.outSize = outSize;
+    }
+    return scratch;
+  }
+};
+
+// Only the execution of FFTW plans is thread-safe, not their creation or
+// destruction
+std::mutex& fftwPlannerMutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+} // namespace
+
 template <typename T>
 PowerSpectrum<T>::PowerSpectrum(const FeatureParams& params)
     : featParams_(params),
       dither_(params.ditherVal),
-      preEmphasis_(params.preemCoef, params.numFrameSizeSamples()),
       windowing_(params.numFrameSizeSamples(), params.windowType) {
   validatePowSpecParams();
-  auto nFFt = featParams_.nFft();
-  inFftBuf_.resize(nFFt, 0.0);
-  outFftBuf_.resize(2 * nFFt);
-  fftPlan_ = fftw_plan_dft_r2c_1d(
-      nFFt, inFftBuf_.data(), (fftw_complex*)outFftBuf_.data(), FFTW_MEASURE);
+  int nFft = featParams_.nFft();
+  int64_t K = featParams_.filterFreqResponseLen();
+  fftInDist_ = (nFft + kFftAlign - 1) / kFftAlign * kFftAlign;
+  fftOutDist_ = (K + kFftAlign - 1) / kFftAlign * kFftAlign;
+
+  // FFTW_MEASURE overwrites the buffers, which are only used for planning
+  auto inFftBuf = fftwAlloc<T, T>(kFftBatchSize * fftInDist_);
+  auto outFftBuf =
+      fftwAlloc<T, typename Fftw<T>::Complex>(kFftBatchSize * fftOutDist_);
+  std::lock_guard<std::mutex> lock(fftwPlannerMutex());
+  fftPlan_ = Fftw<T>::planR2c(nFft, inFftBuf.get(), outFftBuf.get());
+  fftBatchPlan_ = Fftw<T>::planManyR2c(
+      nFft,
+      kFftBatchSize,
+      inFftBuf.get(),
+      fftInDist_,
+      outFftBuf.get(),
+      fftOutDist_);
 }
 
 template <typename T>
 std::vector<T> PowerSpectrum<T>::apply(const std::vector<T>& input) {
-  auto frames = frameSignal(input, featParams_);
-  if (frames.empty()) {
-    return {};
+  int64_t nFrames = featParams_.numFrames(input.size());
+  std::vector<T> output(nFrames * featureSize());
+  apply(input.data(), input.size(), output.data());
+  return output;
+}
+
+template <typename T>
+void PowerSpectrum<T>::apply(const T* input, int64_t size, T* output) {
+  int64_t nFrames = featParams_.numFrames(size);
+  if (nFrames == 0) {
+    return;
   }
-  return powSpectrumImpl(frames);
+  if (featureSize() == frameFeatureSize()) {
+    frameFeatures(input, nFrames, output); // no derivatives
+    return;
+  }
+  T* frameFeat = threadScratch<T>(
+      ScratchSlot::FRAME_FEATURES, nFrames * frameFeatureSize());
+  frameFeatures(input, nFrames, frameFeat);
+  applyDerivatives(frameFeat, nFrames, output);
+}
+
+template <typename T>
+std::vector<T> PowerSpectrum<T>::frameFeatures(
+    const T* signal,
+    int64_t nFrames) {
+  std::vector<T> output(nFrames * frameFeatureSize());
+  frameFeatures(signal, nFrames, output.data());
+  return output;
+}
+
+template <typename T>
+void PowerSpectrum<T>::frameFeatures(
+    const T* signal,
+    int64_t nFrames,
+    T* output) {
+  powSpectrumImpl(signal, nFrames, output);
+}
+
+template <typename T>
+std::vector<T> PowerSpectrum<T>::applyDerivatives(
+    const std::vector<T>& input) const {
+  int64_t nFrames = input.size() / frameFeatureSize();
+  std::vector<T> output(nFrames * featureSize());
+  applyDerivatives(input.data(), nFrames, output.data());
+  return output;
+}
+
+template <typename T>
+void PowerSpectrum<T>::applyDerivatives(
+    const T* input,
+    int64_t nFrames,
+    T* output) const {
+  std::copy(input, input + nFrames * frameFeatureSize(), output);
 }
 
 template <typename T>
-std::vector<T> PowerSpectrum<T>::powSpectrumImpl(std::vector<T>& frames) {
+int64_t PowerSpectrum<T>::frameFeatureSize() const {
+  return featParams_.powSpecFeatSz();
+}
+
+template <typename T>
+int64_t PowerSpectrum<T>::featureSize() const {
+  return featParams_.powSpecFeatSz();
+}
+
+template <typename T>
+int64_t PowerSpectrum<T>::derivativesContext() const {
+  return 0;
+}
+
+template <typename T>
+void PowerSpectrum<T>::powSpectrumImpl(
+    const T* signal,
+    int64_t nFrames,
+    T* output,
+    double* frameEnergy /* = nullptr */) {
   int64_t nSamples = featParams_.numFrameSizeSamples();
-  int64_t nFrames = frames.size() / nSamples;
-  int64_t nFft = featParams_.nFft();
+  int64_t stride = featParams_.numFrameStrideSamples();
   int64_t K = featParams_.filterFreqResponseLen();
+  T* scratch = featParams_.ditherVal != 0.0
+      ? threadScratch<T>(ScratchSlot::DITHER, nSamples)
+      : nullptr;
+  // Frame f is dithered with the noise samples starting at `noiseOffset` +
+  // f * nSamples: the same for every signal with a positive `ditherVal`, as
+  // documented by Dither, whatever the thread and the order of the signals
+  uint64_t noiseOffset = featParams_.ditherVal < 0.0
+      ? dither_.advance(nFrames * nSamples)
+      : 0;
 
+  auto& fftBuf = FftScratch<T>::get(
+      kFftBatchSize * fftInDist_, kFftBatchSize * fftOutDist_);
+  T* inFftBuf = fftBuf.in.get();
+  auto outFftBuf = fftBuf.out.get();
+  // The zero padding of the frames is preserved by the r2c transforms. The
+  // buffers of the thread may have been used with other sizes.
+  std::fill(inFftBuf, inFftBuf + kFftBatchSize * fftInDist_, 0);
+  for (int64_t f = 0; f < nFrames; f += kFftBatchSize) {
+    int64_t batchSz = std::min(kFftBatchSize, nFrames - f);
+    for (int64_t b = 0; b < batchSz; ++b) {
+      double energy = processFrame(
+          signal + (f + b) * stride,
+          scratch,
+          noiseOffset + (f + b) * nSamples,
+          inFftBuf + b * fftInDist_,
+          frameEnergy != nullptr);
+      if (frameEnergy) {
+        frameEnergy[f + b] = energy;
+      }
+    }
+    if (batchSz == kFftBatchSize) {
+      Fftw<T>::execute(fftBatchPlan_, inFftBuf, outFftBuf);
+    } else {
+      for (int64_t b = 0; b < batchSz; ++b) {
+        Fftw<T>::execute(
+            fftPlan_, inFftBuf + b * fftInDist_, outFftBuf + b * fftOutDist_);
+      }
+    }
+
+    // The r2c transforms only output the K non-redundant bins
+    for (int64_t b = 0; b < batchSz; ++b) {
+      auto out = outFftBuf + b * fftOutDist_;
+      T* dft = output + (f + b) * K;
+      for (int64_t i = 0; i < K; ++i) {
+        dft[i] = std::sqrt(out[i][0] * out[i][0] + out[i][1] * out[i][1]);
+      }
+    }
+  }
+}
+
+template <typename T>
+double PowerSpectrum<T>::processFrame(
+    const T* samples,
+    T* scratch,
+    uint64_t noiseOffset,
+    T* output,
+    bool computeEnergy) {
+  int64_t nSamples = featParams_.numFrameSizeSamples();
+  T scale = kSignalScale;
+  double energy = 0.0;
+  if (computeEnergy && featParams_.rawEnergy) {
+#pragma omp simd reduction(+ : energy)
+    for (int64_t i = 0; i < nSamples; ++i) {
+      T x = scale * samples[i];
+      energy += x * x;
+    }
+  }
+  // The frames overlap in the signal, so each one is dithered in `scratch`
   if (featParams_.ditherVal != 0.0) {
-    frames = dither_.apply(frames);
+    for (int64_t i = 0; i < nSamples; ++i) {
+      scratch[i] = scale * samples[i];
+    }
+    dither_.apply(scratch, nSamples, scratch, noiseOffset);
+    samples = scratch;
+    scale = 1;
   }
+  T mean = 0;
   if (featParams_.zeroMeanFrame) {
-    for (size_t f = 0; f < nFrames; ++f) {
-      auto begin = frames.data() + f * nSamples;
-      T mean = std::accumulate(begin, begin + nSamples, 0.0);
-      mean /= nSamples;
-      std::transform(
-          begin, begin + nSamples, begin, [mean](T x) { return x - mean; });
+    double sum = 0.0;
+#pragma omp simd reduction(+ : sum)
+    for (int64_t i = 0; i < nSamples; ++i) {
+      sum += scale * samples[i];
     }
+    mean = sum;
+    mean /= nSamples;
   }
-  if (featParams_.preemCoef != 0) {
-    preEmphasis_.applyInPlace(frames);
-  }
-  windowing_.applyInPlace(frames);
-  std::vector<T> dft(K * nFrames);
-  for (size_t f = 0; f < nFrames; ++f) {
-    auto begin = frames.data() + f * nSamples;
-    {
-      std::lock_guard<std::mutex> lock(fftMutex_);
-      std::copy(begin, begin + nSamples, inFftBuf_.data());
-      std::fill(outFftBuf_.begin(), outFftBuf_.end(), 0.0);
-      fftw_execute(fftPlan_);
-
-      // Copy stuff to the redundant part
-      for (size_t i = K; i < nFft; ++i) {
-        outFftBuf_[2 * i] = outFftBuf_[2 * nFft - 2 * i];
-        outFftBuf_[2 * i + 1] = -outFftBuf_[2 * nFft - 2 * i + 1];
-      }
-
-      for (size_t i = 0; i < K; ++i) {
-        dft[f * K + i] = std::sqrt(
-            outFftBuf_[2 * i] * outFftBuf_[2 * i] +
-            outFftBuf_[2 * i + 1] * outFftBuf_[2 * i + 1]);
-      }
+  // Zero-mean, pre-emphasis and windowing in a single pass
+  T preemCoef = featParams_.preemCoef;
+  const T* window = windowing_.coefs().data();
+  output[0] = (scale * samples[0] - mean) * (1 - preemCoef) * window[0];
+#pragma omp simd
+  for (int64_t i = 1; i < nSamples; ++i) {
+    output[i] = ((scale * samples[i] - mean) -
+                 preemCoef * (scale * samples[i - 1] - mean)) *
+        window[i];
+  }
+  if (computeEnergy && !featParams_.rawEnergy) {
+#pragma omp simd reduction(+ : energy)
+    for (int64_t i = 0; i < nSamples; ++i) {
+      energy += output[i] * output[i];
     }
   }
-  return dft;
+  return energy;
 }
 
 template <typename T>
@@ -98,20 +392,12 @@ std::vector<T> PowerSpectrum<T>::batchApply(
         "PowerSpectrum: input size is not divisible by batchSz");
   }
   int64_t N = input.size() / batchSz;
-  int64_t outputSz = outputSize(N);
+  int64_t outputSz = featParams_.numFrames(N) * featureSize();
   std::vector<T> feat(outputSz * batchSz);
 
-#pragma omp parallel for num_threads(batchSz)
-  for (int64_t b = 0; b < batchSz; ++b) {
-    auto start = input.begin() + b * N;
-    std::vector<T> inputBuf(start, start + N);
-    auto curFeat = apply(inputBuf);
-    if (outputSz != curFeat.size()) {
-      throw std::logic_error("PowerSpectrum: apply() returned wrong size");
-    }
-    std::copy(
-        curFeat.begin(), curFeat.end(), feat.begin() + b * curFeat.size());
-  }
+  TaskScheduler::get().parallelFor(batchSz, [&](int64_t b) {
+    apply(input.data() + b * N, N, feat.data() + b * outputSz);
+  });
   return feat;
 }
 
@@ -137,12 +423,16 @@ void PowerSpectrum<T>::validatePowSpecParams() const {
     throw std::invalid_argument("PowerSpectrum: frameSizeMs is too low");
   } else if (featParams_.numFrameStrideSamples() <= 0) {
     throw std::invalid_argument("PowerSpectrum: frameStrideMs is too low");
+  } else if (featParams_.preemCoef < 0.0 || featParams_.preemCoef >= 1.0) {
+    throw std::invalid_argument("PowerSpectrum: preemCoef must be in [0, 1)");
   }
 }
 
 template <typename T>
 PowerSpectrum<T>::~PowerSpectrum() {
-  fftw_destroy_plan(fftPlan_);
+  std::lock_guard<std::mutex> lock(fftwPlannerMutex());
+  Fftw<T>::destroy(fftPlan_);
+  Fftw<T>::destroy(fftBatchPlan_);
 }
 
 template class PowerSpectrum<float>;
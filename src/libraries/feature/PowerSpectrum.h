@@ -8,17 +8,30 @@
 
 #pragma once
 
-#include <mutex>
-
 #include <fftw3.h>
 
 #include "Dither.h"
 #include "FeatureParams.h"
-#include "PreEmphasis.h"
 #include "Windowing.h"
 
 namespace w2l {
 
+namespace detail {
+// FFTW plans of the precision of T
+template <typename T>
+struct FftwPlan;
+
+template <>
+struct FftwPlan<float> {
+  using type = fftwf_plan;
+};
+
+template <>
+struct FftwPlan<double> {
+  using type = fftw_plan;
+};
+} // namespace detail
+
 // Computes Power Spectrum features for a speech signal.
 template <typename T>
 class PowerSpectrum {
@@ -29,7 +42,12 @@ class PowerSpectrum {
 
   // input - input speech signal (T)
   // Returns - Power spectrum (Col Major : FEAT X FRAMESZ)
-  virtual std::vector<T> apply(const std::vector<T>& input);
+  std::vector<T> apply(const std::vector<T>& input);
+
+  // As apply(), writing the outputSize(`size`) features of the `size` samples
+  // of `input` to `output`. Its intermediate buffers are the ones of
+  // threadScratch(), so that featurizing doesn't allocate once they've grown.
+  void apply(const T* input, int64_t size, T* output);
 
   // input - input speech signal (Col Major : T X BATCHSZ)
   // Returns - Output features (Col Major : FEAT X FRAMESZ X BATCHSZ)
@@ -39,23 +57,71 @@ class PowerSpectrum {
 
   FeatureParams getFeatureParams() const;
 
+  // apply() is frameFeatures() of all the frames of the signal, then
+  // applyDerivatives(), so that a signal can also be featurized by chunks of
+  // frames. The frames are read in place from the signal.
+  // signal - input speech signal from the start of its first frame, frame f
+  //     being the FRAMESZ samples from f * numFrameStrideSamples()
+  // Returns - features of each frame (Col Major : FEAT X NFRAMES)
+  std::vector<T> frameFeatures(const T* signal, int64_t nFrames);
+
+  // output - the frameFeatureSize() features of each frame
+  virtual void frameFeatures(const T* signal, int64_t nFrames, T* output);
+
+  // input - features of consecutive frames (Col Major : FEAT X NFRAMES)
+  // Returns - features with their derivatives, if any
+  std::vector<T> applyDerivatives(const std::vector<T>& input) const;
+
+  // input - frameFeatureSize() features of each of the `nFrames` frames
+  // output - featureSize() features of each frame
+  virtual void applyDerivatives(const T* input, int64_t nFrames, T* output)
+      const;
+
+  // Number of features of a frame, before and after its derivatives
+  virtual int64_t frameFeatureSize() const;
+  virtual int64_t featureSize() const;
+
+  // Number of neighbour frames on each side of a frame which its derivatives
+  // depend on
+  virtual int64_t derivativesContext() const;
+
  protected:
   FeatureParams featParams_;
 
-  // Helper function which takes input as signal after dividing the signal into
-  // frames. Main purpose of this function is to reuse it in MFSC, MFCC code
-  std::vector<T> powSpectrumImpl(std::vector<T>& frames);
+  // Helper function which takes the frames of the signal as frameFeatures().
+  // Main purpose of this function is to reuse it in MFSC, MFCC code.
+  // output - the powSpecFeatSz() bins of each frame
+  // frameEnergy - if not null, filled with the energy of each frame, before
+  //     its processing if featParams_.rawEnergy and after it otherwise
+  void powSpectrumImpl(
+      const T* signal,
+      int64_t nFrames,
+      T* output,
+      double* frameEnergy = nullptr);
 
   void validatePowSpecParams() const;
 
  private:
-  // The following classes are defined in the order they are applied
+  // Write the scaled, dithered, zero-mean, pre-emphasised and windowed
+  // samples of the frame starting at `samples` to `output`, while the frame is
+  // in cache. `scratch` holds the frame dithered with the noise samples
+  // starting at `noiseOffset`. Returns - the energy of the frame as for
+  // powSpectrumImpl() if `computeEnergy`
+  double processFrame(
+      const T* samples,
+      T* scratch,
+      uint64_t noiseOffset,
+      T* output,
+      bool computeEnergy);
+
   Dither<T> dither_;
-  PreEmphasis<T> preEmphasis_;
   Windowing<T> windowing_;
 
-  fftw_plan fftPlan_;
-  std::vector<double> inFftBuf_, outFftBuf_;
-  std::mutex fftMutex_;
+  // Plans of the FFT of one frame and of kFftBatchSize frames, in the
+  // precision of T. They are shared by the threads, which execute them on
+  // their own buffers.
+  typename detail::FftwPlan<T>::type fftPlan_;
+  typename detail::FftwPlan<T>::type fftBatchPlan_;
+  int64_t fftInDist_, fftOutDist_;
 };
 } // namespace w2l
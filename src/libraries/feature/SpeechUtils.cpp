@@ -8,7 +8,10 @@
 
 #include "SpeechUtils.h"
 
+#include <array>
+#include <cmath>
 #include <cstddef>
+#include <cstring>
 #include <stdexcept>
 
 extern "C" {
@@ -28,9 +31,7 @@ std::vector<T> frameSignal(
   auto frameSize = params.numFrameSizeSamples();
   auto frameStride = params.numFrameStrideSamples();
   int64_t numframes = params.numFrames(input.size());
-  // HTK: Values coming out of rasta treat samples as integers,
-  // not range -1..1, hence scale up here to match (approx)
-  T scale = 32768.0;
+  T scale = kSignalScale;
   std::vector<T> frames(numframes * frameSize);
   for (size_t f = 0; f < numframes; ++f) {
     for (size_t i = 0; i < frameSize; ++i) {
@@ -40,10 +41,10 @@ std::vector<T> frameSignal(
   return frames;
 }
 
-template <>
-std::vector<float> cblasGemm(
-    const std::vector<float>& matA,
-    const std::vector<float>& matB,
+template <typename T>
+std::vector<T> cblasGemm(
+    const std::vector<T>& matA,
+    const std::vector<T>& matB,
     int n,
     int k) {
   if (n <= 0 || k <= 0 || matA.empty() || (matA.size() % k != 0) ||
@@ -53,8 +54,19 @@ std::vector<float> cblasGemm(
 
   int m = matA.size() / k;
 
-  std::vector<float> matC(m * n);
+  std::vector<T> matC(m * n);
+  cblasGemm(matA.data(), matB.data(), matC.data(), m, n, k);
+  return matC;
+}
 
+template <>
+void cblasGemm(
+    const float* matA,
+    const float* matB,
+    float* matC,
+    int m,
+    int n,
+    int k) {
   cblas_sgemm(
       CblasRowMajor,
       CblasNoTrans,
@@ -63,31 +75,23 @@ std::vector<float> cblasGemm(
       n,
       k,
       1.0, // alpha
-      matA.data(),
+      matA,
       k,
-      matB.data(),
+      matB,
       n,
       0.0, // beta
-      matC.data(),
+      matC,
       n);
-  return matC;
-};
+}
 
 template <>
-std::vector<double> cblasGemm(
-    const std::vector<double>& matA,
-    const std::vector<double>& matB,
+void cblasGemm(
+    const double* matA,
+    const double* matB,
+    double* matC,
+    int m,
     int n,
     int k) {
-  if (n <= 0 || k <= 0 || matA.empty() || (matA.size() % k != 0) ||
-      (matB.size() != n * k)) {
-    throw std::invalid_argument("cblasGemm: invalid arguments");
-  }
-
-  int m = matA.size() / k;
-
-  std::vector<double> matC(m * n);
-
   cblas_dgemm(
       CblasRowMajor,
       CblasNoTrans,
@@ -96,16 +100,83 @@ std::vector<double> cblasGemm(
       n,
       k,
       1.0, // alpha
-      matA.data(),
+      matA,
       k,
-      matB.data(),
+      matB,
       n,
       0.0, // beta
-      matC.data(),
+      matC,
       n);
+}
 
-  return matC;
-};
+template <typename T>
+T* threadScratch(ScratchSlot slot, size_t size) {
+  static thread_local std::array<
+      std::vector<T>,
+      static_cast<size_t>(ScratchSlot::NUM_SLOTS)>
+      buffers;
+  auto& buffer = buffers[static_cast<size_t>(slot)];
+  if (buffer.size() < size) {
+    buffer.resize(size);
+  }
+  return buffer.data();
+}
+
+template <>
+void logArray(const float* input, int64_t size, float* output, bool fast) {
+  if (!fast) {
+    for (int64_t i = 0; i < size; ++i) {
+      output[i] = std::log(input[i]);
+    }
+    return;
+  }
+  // The bits of the floats are copied in blocks, for the loops to vectorize
+  constexpr int64_t kBlockSize = 64;
+  uint32_t bits[kBlockSize];
+  float exponent[kBlockSize], mantissa[kBlockSize];
+  for (int64_t begin = 0; begin < size; begin += kBlockSize) {
+    int64_t n = std::min(kBlockSize, size - begin);
+    std::memcpy(bits, input + begin, n * sizeof(float));
+    // input = mantissa * 2^exponent, with mantissa in [sqrt(1/2), sqrt(2)):
+    // the mantissa of the float, in [1/2, 1), is doubled if below sqrt(1/2),
+    // comparing the bits of the positive floats as integers
+#pragma omp simd
+    for (int64_t i = 0; i < n; ++i) {
+      uint32_t m = (bits[i] & 0x007fffff) | 0x3f000000;
+      uint32_t small = m < 0x3f3504f3;
+      int32_t e = static_cast<int32_t>((bits[i] >> 23) - small) - 126;
+      exponent[i] = static_cast<float>(e);
+      bits[i] = m + (small << 23);
+    }
+    std::memcpy(mantissa, bits, n * sizeof(float));
+#pragma omp simd
+    for (int64_t i = 0; i < n; ++i) {
+      float e = exponent[i];
+      float x = mantissa[i] - 1.0f;
+      float z = x * x;
+      float y = 7.0376836292E-2f;
+      y = y * x - 1.1514610310E-1f;
+      y = y * x + 1.1676998740E-1f;
+      y = y * x - 1.2420140846E-1f;
+      y = y * x + 1.4249322787E-1f;
+      y = y * x - 1.6668057665E-1f;
+      y = y * x + 2.0000714765E-1f;
+      y = y * x - 2.4999993993E-1f;
+      y = y * x + 3.3333331174E-1f;
+      y = y * x * z;
+      y += -2.12194440E-4f * e;
+      y += -0.5f * z;
+      output[begin + i] = x + y + 0.693359375f * e;
+    }
+  }
+}
+
+template <>
+void logArray(const double* input, int64_t size, double* output, bool) {
+  for (int64_t i = 0; i < size; ++i) {
+    output[i] = std::log(input[i]);
+  }
+}
 
 template std::vector<float> frameSignal(
     const std::vector<float>&,
@@ -113,4 +184,12 @@ template std::vector<float> frameSignal(
 template std::vector<double> frameSignal(
     const std::vector<double>&,
     const FeatureParams&);
+
+template std::vector<float>
+cblasGemm(const std::vector<float>&, const std::vector<float>&, int, int);
+template std::vector<double>
+cblasGemm(const std::vector<double>&, const std::vector<double>&, int, int);
+
+template float* threadScratch(ScratchSlot, size_t);
+template double* threadScratch(ScratchSlot, size_t);
 } // namespace w2l
@@ -8,12 +8,18 @@
 
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <vector>
 
 #include "FeatureParams.h"
 
 namespace w2l {
 
+// HTK: Values coming out of rasta treat samples as integers,
+// not range -1..1, hence the signal is scaled up to match (approx)
+constexpr double kSignalScale = 32768.0;
+
 // Convert the speech signal into frames
 template <typename T>
 std::vector<T> frameSignal(
@@ -25,4 +31,35 @@ template <typename T>
 std::vector<T>
 cblasGemm(const std::vector<T>& matA, const std::vector<T>& matB, int n, int k);
 
+// row major;  matA - m x k , matB - k x n, matC - m x n
+template <typename T>
+void cblasGemm(const T* matA, const T* matB, T* matC, int m, int n, int k);
+
+// output - the natural logarithm of the `size` values of `input`, which may be
+//     the same buffer. The values must be positive normal numbers. If `fast`,
+//     the float logarithm is a vectorized polynomial approximation (Cephes
+//     logf), within 1 ulp of the exact logarithm; the double one is always
+//     std::log.
+template <typename T>
+void logArray(const T* input, int64_t size, T* output, bool fast);
+
+// Buffers of the stages of the features, which use one each since they're
+// nested (e.g. the filterbank of the power spectrum)
+enum class ScratchSlot {
+  POW_SPECTRUM,
+  FILTERBANK,
+  FRAME_ENERGY,
+  FRAME_FEATURES,
+  DELTAS,
+  DITHER,
+  NUM_SLOTS
+};
+
+// A buffer of at least `size` elements of the calling thread, reused by the
+// next calls for `slot`: the buffers grow to the largest signal featurized by
+// the thread, after which featurizing doesn't allocate. Its content is
+// undefined.
+template <typename T>
+T* threadScratch(ScratchSlot slot, size_t size);
+
 } // namespace w2l
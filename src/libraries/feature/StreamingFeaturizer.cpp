@@ -0,0 +1,98 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "StreamingFeaturizer.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace w2l {
+
+template <typename T>
+StreamingFeaturizer<T>::StreamingFeaturizer(
+    std::shared_ptr<PowerSpectrum<T>> featurizer)
+    : featurizer_(featurizer) {
+  if (!featurizer_) {
+    throw std::invalid_argument("StreamingFeaturizer: null featurizer");
+  }
+  featParams_ = featurizer_->getFeatureParams();
+  reset();
+}
+
+template <typename T>
+void StreamingFeaturizer<T>::reset() {
+  signal_.clear();
+  signalSkip_ = 0;
+  frameFeat_.clear();
+  frameFeatSz_ = 0;
+  frameFeatStart_ = 0;
+  numFrames_ = 0;
+  numEmitted_ = 0;
+}
+
+template <typename T>
+std::vector<T> StreamingFeaturizer<T>::apply(const std::vector<T>& input) {
+  int64_t skip = std::min<int64_t>(signalSkip_, input.size());
+  signalSkip_ -= skip;
+  signal_.insert(signal_.end(), input.begin() + skip, input.end());
+  int64_t nFrames = featParams_.numFrames(signal_.size());
+  if (nFrames > 0) {
+    auto feat = featurizer_->frameFeatures(signal_.data(), nFrames);
+    frameFeatSz_ = feat.size() / nFrames;
+    frameFeat_.insert(frameFeat_.end(), feat.begin(), feat.end());
+    numFrames_ += nFrames;
+    // The next frame may start after the end of the signal if the stride is
+    // larger than the frames
+    int64_t consumed = nFrames * featParams_.numFrameStrideSamples();
+    int64_t erased = std::min<int64_t>(consumed, signal_.size());
+    signal_.erase(signal_.begin(), signal_.begin() + erased);
+    signalSkip_ = consumed - erased;
+  }
+  return emit(numFrames_ - featurizer_->derivativesContext());
+}
+
+template <typename T>
+std::vector<T> StreamingFeaturizer<T>::finish() {
+  auto output = emit(numFrames_);
+  reset();
+  return output;
+}
+
+template <typename T>
+std::vector<T> StreamingFeaturizer<T>::emit(int64_t end) {
+  if (end <= numEmitted_) {
+    return {};
+  }
+  // The derivatives of [numEmitted_, end) only depend on the frames from
+  // numEmitted_ - context, and they are clamped at the boundaries of the
+  // input of applyDerivatives() as at the ones of the signal
+  int64_t context = featurizer_->derivativesContext();
+  int64_t start = std::max(numEmitted_ - context, frameFeatStart_);
+  int64_t stop = std::min(end + context, numFrames_);
+  std::vector<T> feat(
+      frameFeat_.begin() + (start - frameFeatStart_) * frameFeatSz_,
+      frameFeat_.begin() + (stop - frameFeatStart_) * frameFeatSz_);
+  feat = featurizer_->applyDerivatives(feat);
+  int64_t featSz = feat.size() / (stop - start);
+  std::vector<T> output(
+      feat.begin() + (numEmitted_ - start) * featSz,
+      feat.begin() + (end - start) * featSz);
+  numEmitted_ = end;
+
+  // Drop the frames out of the context of the next ones
+  int64_t keepFrom = std::max(numEmitted_ - context, frameFeatStart_);
+  frameFeat_.erase(
+      frameFeat_.begin(),
+      frameFeat_.begin() + (keepFrom - frameFeatStart_) * frameFeatSz_);
+  frameFeatStart_ = keepFrom;
+  return output;
+}
+
+template class StreamingFeaturizer<float>;
+template class StreamingFeaturizer<double>;
+} // namespace w2l
@@ -0,0 +1,61 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "PowerSpectrum.h"
+
+namespace w2l {
+
+// Computes the features of a PowerSpectrum, Mfsc or Mfcc for a speech signal
+// given by chunks, with the same output as apply() on the whole signal. The
+// samples of the partial last frame are kept for the next chunk, and the
+// features of the last frames until their derivatives are complete.
+// Example usage:
+//   StreamingFeaturizer<float> stream(std::make_shared<Mfcc<float>>(params));
+//   for (const auto& chunk : chunks) {
+//     auto newFeatures = stream.apply(chunk);
+//   }
+//   auto lastFeatures = stream.finish();
+
+template <typename T>
+class StreamingFeaturizer {
+ public:
+  explicit StreamingFeaturizer(std::shared_ptr<PowerSpectrum<T>> featurizer);
+
+  // input - next chunk of the speech signal (T)
+  // Returns - features of the frames completed since the previous call,
+  //     less the ones the derivatives of which need frames still to come
+  //     (Col Major : FEAT X NEWFRAMES)
+  std::vector<T> apply(const std::vector<T>& input);
+
+  // Returns - features of the remaining frames, the signal being over. The
+  //     featurizer is then ready for a new signal.
+  std::vector<T> finish();
+
+  void reset();
+
+ private:
+  std::shared_ptr<PowerSpectrum<T>> featurizer_;
+  FeatureParams featParams_;
+
+  std::vector<T> signal_; // samples from the start of the next frame
+  int64_t signalSkip_; // samples to skip before the start of the next frame
+  std::vector<T> frameFeat_; // frameFeatures() from frame frameFeatStart_
+  int64_t frameFeatSz_;
+  int64_t frameFeatStart_;
+  int64_t numFrames_; // frames of the signal so far
+  int64_t numEmitted_; // frames whose features were returned
+
+  // Return the features of the frames [numEmitted_, end)
+  std::vector<T> emit(int64_t end);
+};
+} // namespace w2l
@@ -13,8 +13,6 @@
 #include <cstddef>
 #include <stdexcept>
 
-#include "SpeechUtils.h"
-
 namespace w2l {
 
 template <typename T>
@@ -51,20 +49,61 @@ TriFilterbank<T>::TriFilterbank(
       H_[i * numFilters_ + j] = std::max(std::min(hislope, loslope), minH);
     }
   }
+
+  // Each triangle only spans a few bins of the filterLen_ ones
+  for (size_t j = 0; j < numFilters_; ++j) {
+    int64_t start = filterLen_, end = 0;
+    for (size_t i = 0; i < filterLen_; ++i) {
+      if (H_[i * numFilters_ + j] != 0) {
+        start = std::min<int64_t>(start, i);
+        end = i + 1;
+      }
+    }
+    start = std::min(start, end);
+    bandStart_.push_back(start);
+    bandLen_.push_back(end - start);
+    bandOffset_.push_back(bandWeights_.size());
+    for (int64_t i = start; i < end; ++i) {
+      bandWeights_.push_back(H_[i * numFilters_ + j]);
+    }
+  }
 }
 
 template <typename T>
 std::vector<T> TriFilterbank<T>::apply(
     const std::vector<T>& input,
     T melfloor /* = 0.0 */) const {
-  std::vector<T> output = cblasGemm(input, H_, numFilters_, filterLen_);
-  std::transform(
-      output.begin(), output.end(), output.begin(), [melfloor](T n) -> T {
-        return std::max(n, melfloor);
-      });
+  if (input.size() % filterLen_ != 0) {
+    throw std::invalid_argument(
+        "TriFilterbank: input size is not divisible by filterLen");
+  }
+  int64_t nFrames = input.size() / filterLen_;
+  std::vector<T> output(nFrames * numFilters_);
+  apply(input.data(), nFrames, output.data(), melfloor);
   return output;
 }
 
+template <typename T>
+void TriFilterbank<T>::apply(
+    const T* input,
+    int64_t nFrames,
+    T* output,
+    T melfloor /* = 0.0 */) const {
+  for (int64_t f = 0; f < nFrames; ++f) {
+    const T* frame = input + f * filterLen_;
+    for (int64_t j = 0; j < numFilters_; ++j) {
+      const T* in = frame + bandStart_[j];
+      const T* weights = bandWeights_.data() + bandOffset_[j];
+      T sum = 0;
+#pragma omp simd reduction(+ : sum)
+      for (int64_t i = 0; i < bandLen_[j]; ++i) {
+        sum += in[i] * weights[i];
+      }
+      output[f * numFilters_ + j] = std::max(sum, melfloor);
+    }
+  }
+}
+
 template <typename T>
 std::vector<T> TriFilterbank<T>::filterbank() const {
   return H_;
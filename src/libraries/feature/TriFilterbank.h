@@ -28,6 +28,11 @@ class TriFilterbank {
 
   std::vector<T> apply(const std::vector<T>& input, T melfloor = 0.0) const;
 
+  // input - `nFrames` frames of `filterlen` bins
+  // output - `nFrames` frames of `numfilters` channels
+  void apply(const T* input, int64_t nFrames, T* output, T melfloor = 0.0)
+      const;
+
   // Returns triangular filterbank matrix
   std::vector<T> filterbank() const;
 
@@ -40,6 +45,12 @@ class TriFilterbank {
   FrequencyScale freqScale_; // frequency warp type Ex. FrequencyScale::MEL
   std::vector<T> H_; // (numFilters_ x filterLen_) triangular filterbank matrix
 
+  // The non-zero band of each filter: filter j weights the bins
+  // [bandStart_[j], bandStart_[j] + bandLen_[j]) by the bandLen_[j] weights
+  // from bandWeights_[bandOffset_[j]]
+  std::vector<int64_t> bandStart_, bandLen_, bandOffset_;
+  std::vector<T> bandWeights_;
+
   T hertzToWarpedScale(T hz, FrequencyScale freqscale) const;
   T warpedToHertzScale(T wrp, FrequencyScale freqscale) const;
 };
@@ -59,6 +59,11 @@ void Windowing<T>::applyInPlace(std::vector<T>& input) const {
   }
 }
 
+template <typename T>
+const std::vector<T>& Windowing<T>::coefs() const {
+  return coefs_;
+}
+
 template class Windowing<float>;
 template class Windowing<double>;
 } // namespace w2l
@@ -26,6 +26,9 @@ class Windowing {
 
   void applyInPlace(std::vector<T>& input) const;
 
+  // Returns - window coefficients w(n) (N)
+  const std::vector<T>& coefs() const;
+
  private:
   int64_t windowLength_;
   WindowType windowType_;
@@ -9,10 +9,13 @@
 
 #include "libraries/lm/ConvLM.h"
 
+#include <algorithm>
 #include <cmath>
 #include <cstring>
 #include <iostream>
 
+#include "libraries/common/Utils.h"
+
 namespace w2l {
 
 ConvLM::ConvLM(
@@ -21,11 +24,15 @@ ConvLM::ConvLM(
     const Dictionary& usrTknDict,
     int lmMemory,
     int beamSize,
-    int historySize)
+    int historySize,
+    bool asyncUpdate,
+    ConvLMCacheType cacheType)
     : lmMemory_(lmMemory),
       beamSize_(beamSize),
+      cacheType_(cacheType),
       getConvLmScoreFunc_(getConvLmScoreFunc),
-      maxHistorySize_(historySize) {
+      maxHistorySize_(historySize),
+      asyncUpdate_(asyncUpdate) {
   if (historySize < 1) {
     throw std::invalid_argument("[ConvLM] History size is too small.");
   }
@@ -42,19 +49,71 @@ ConvLM::ConvLM(
   /* Create index map */
   usrToLmIdxMap_.resize(usrTknDict.indexSize());
   for (int i = 0; i < usrTknDict.indexSize(); i++) {
-    auto token = usrTknDict.getEntry(i);
-    int lmIdx = vocab_.getIndex(token.c_str());
+    int lmIdx = vocab_.getIndex(usrTknDict.getEntry(i));
     usrToLmIdxMap_[i] = lmIdx;
   }
 
   /* Refresh cache */
   cacheIndices_.reserve(beamSize_);
-  cache_.resize(beamSize_, std::vector<float>(vocabSize_));
+  rowSize_ = vocabSize_;
+  resizeCache();
   slot_.reserve(beamSize_);
   batchedTokens_.resize(beamSize_ * maxHistorySize_);
 }
 
+void ConvLM::setCandidateScoring(
+    const GetConvLmCandidateScoreFunc& getCandidateScoreFunc,
+    int shortlistSize) {
+  if (shortlistSize < 1 || shortlistSize > vocabSize_) {
+    throw std::invalid_argument(
+        "[ConvLM] Invalid shortlist size: " + std::to_string(shortlistSize));
+  }
+  waitForUpdate();
+  cacheIndices_.clear();
+  getCandidateScoreFunc_ = getCandidateScoreFunc;
+  rowSize_ = shortlistSize;
+  tailCache_.assign(beamSize_, {});
+  resizeCache();
+}
+
+void ConvLM::resizeCache() {
+  size_t size = static_cast<size_t>(beamSize_) * rowSize_;
+  cache_.clear();
+  halfCache_.clear();
+  int8Cache_.clear();
+  switch (cacheType_) {
+    case ConvLMCacheType::FP32:
+      cache_.resize(size);
+      cache_.shrink_to_fit();
+      break;
+    case ConvLMCacheType::FP16:
+      halfCache_.resize(size);
+      halfCache_.shrink_to_fit();
+      break;
+    case ConvLMCacheType::INT8:
+      int8Cache_.resize(size);
+      int8Cache_.shrink_to_fit();
+      int8Ranges_.resize(beamSize_);
+      int8Fallback_.assign(beamSize_, {});
+      break;
+  }
+}
+
+ConvLM::~ConvLM() {
+  if (pendingUpdate_.valid()) {
+    pendingUpdate_.wait();
+  }
+}
+
+void ConvLM::waitForUpdate() {
+  if (pendingUpdate_.valid()) {
+    // Rethrows the exception of the forward, if any
+    pendingUpdate_.get();
+  }
+}
+
 LMStatePtr ConvLM::start(bool startWithNothing) {
+  waitForUpdate();
   cacheIndices_.clear();
   auto outState = std::make_shared<ConvLMState>(1);
   if (!startWithNothing) {
@@ -70,6 +129,7 @@ LMStatePtr ConvLM::start(bool startWithNothing) {
 std::pair<LMStatePtr, float> ConvLM::scoreWithLmIdx(
     const LMStatePtr& state,
     const int tokenIdx) {
+  waitForUpdate();
   auto rawInState = std::static_pointer_cast<ConvLMState>(state).get();
   int inStateLength = rawInState->length;
   std::shared_ptr<ConvLMState> outState;
@@ -105,7 +165,7 @@ std::pair<LMStatePtr, float> ConvLM::scoreWithLmIdx(
       throw std::logic_error(
           "[ConvLM] Invalid cache access: " + std::to_string(cacheInd));
     }
-    score = cache_[cacheInd][tokenIdx];
+    score = rowScore(cacheInd, rawInState, tokenIdx);
   } else {
     // Cache miss
     if (cacheIndices_.size() == beamSize_) {
@@ -115,9 +175,15 @@ std::pair<LMStatePtr, float> ConvLM::scoreWithLmIdx(
     cacheIndices_[rawInState] = newIdx;
 
     std::vector<int> lastTokenPositions = {rawInState->length - 1};
-    cache_[newIdx] =
-        getConvLmScoreFunc_(rawInState->tokens, lastTokenPositions, -1, 1)[0];
-    score = cache_[newIdx][tokenIdx];
+    auto prob =
+        forwardRows(rawInState->tokens, lastTokenPositions, -1, 1)[0];
+    if (prob.size() != rowSize_) {
+      throw std::logic_error(
+          "[ConvLM] Probability size " + std::to_string(prob.size()) +
+          " mismatch with vocab size " + std::to_string(rowSize_));
+    }
+    storeCache(newIdx, prob.data());
+    score = rowScore(newIdx, rawInState, tokenIdx);
   }
   if (std::isnan(score) || !std::isfinite(score)) {
     throw std::runtime_error(
@@ -140,7 +206,32 @@ std::pair<LMStatePtr, float> ConvLM::finish(const LMStatePtr& state) {
   return scoreWithLmIdx(state, vocab_.getIndex(kLmEosToken));
 }
 
+void ConvLM::saveState(const LMStatePtr& state, std::ostream& out) const {
+  auto convState = std::static_pointer_cast<ConvLMState>(state);
+  out.write(
+      reinterpret_cast<const char*>(&convState->length),
+      sizeof(convState->length));
+  out.write(
+      reinterpret_cast<const char*>(convState->tokens.data()),
+      convState->length * sizeof(int));
+}
+
+LMStatePtr ConvLM::loadState(std::istream& in) {
+  int length = 0;
+  in.read(reinterpret_cast<char*>(&length), sizeof(length));
+  if (!in || length < 0) {
+    throw std::runtime_error("[ConvLM] Failed reading an LM state");
+  }
+  auto state = std::make_shared<ConvLMState>(length);
+  in.read(reinterpret_cast<char*>(state->tokens.data()), length * sizeof(int));
+  if (!in) {
+    throw std::runtime_error("[ConvLM] Failed reading an LM state");
+  }
+  return state;
+}
+
 void ConvLM::updateCache(std::vector<LMStatePtr> states) {
+  waitForUpdate();
   int longestHistory = -1, nStates = states.size();
   if (nStates > beamSize_) {
     throw std::invalid_argument(
@@ -165,7 +256,9 @@ void ConvLM::updateCache(std::vector<LMStatePtr> states) {
     if (!slot_[i]) {
       continue;
     }
-    cache_[cacheSize] = cache_[i];
+    if (cacheSize != i) {
+      moveCache(i, cacheSize);
+    }
     cacheIndices_[slot_[i]] = cacheSize;
     ++cacheSize;
   }
@@ -180,10 +273,10 @@ void ConvLM::updateCache(std::vector<LMStatePtr> states) {
     maxBatchSize = nStates;
   }
 
-  // Run batch forward
+  // Select batches
+  pendingBatches_.clear();
   int batchStart = 0;
   while (batchStart < nStates) {
-    // Select batch
     int nBatchStates = 0;
     std::vector<int> lastTokenPositions;
     for (int i = batchStart; (nBatchStates < maxBatchSize) && (i < nStates);
@@ -210,29 +303,171 @@ void ConvLM::updateCache(std::vector<LMStatePtr> states) {
       break;
     }
 
-    // Feed forward
     if (nBatchStates < 1 || longestHistory < 1) {
       throw std::logic_error(
           "[ConvLM] Invalid batch: [" + std::to_string(nBatchStates) + " x " +
           std::to_string(longestHistory) + "]");
     }
-    auto batchedProb = getConvLmScoreFunc_(
-        batchedTokens_, lastTokenPositions, longestHistory, nBatchStates);
+    pendingBatches_.push_back(ForwardBatch{
+        std::vector<int>(
+            batchedTokens_.begin(),
+            batchedTokens_.begin() + nBatchStates * longestHistory),
+        std::move(lastTokenPositions),
+        longestHistory,
+        nBatchStates,
+        cacheSize});
+    cacheSize += nBatchStates;
+  }
+
+  // Run batch forward
+  if (asyncUpdate_ && !pendingBatches_.empty()) {
+    pendingUpdate_ =
+        std::async(std::launch::async, &ConvLM::forwardBatches, this);
+  } else {
+    forwardBatches();
+  }
+}
+
+void ConvLM::forwardBatches() {
+  for (const auto& batch : pendingBatches_) {
+    // Feed forward
+    auto batchedProb = forwardRows(
+        batch.tokens,
+        batch.lastTokenPositions,
+        batch.sampleSize,
+        batch.batchSize);
 
     // Place probabilities in cache
-    for (int i = 0; i < nBatchStates; i++, cacheSize++) {
-      if (batchedProb[i].size() != vocabSize_) {
+    for (int i = 0; i < batch.batchSize; i++) {
+      if (batchedProb[i].size() != rowSize_) {
         throw std::logic_error(
             "[ConvLM] Batch probability size " +
             std::to_string(batchedProb[i].size()) +
-            " mismatch with vocab size " + std::to_string(vocabSize_));
+            " mismatch with vocab size " + std::to_string(rowSize_));
       }
-      std::memcpy(
-          cache_[cacheSize].data(),
-          batchedProb[i].data(),
-          vocabSize_ * sizeof(float));
+      storeCache(batch.cacheStart + i, batchedProb[i].data());
     }
   }
 }
 
+std::vector<std::vector<float>> ConvLM::forwardRows(
+    const std::vector<int>& tokens,
+    const std::vector<int>& lastTokenPositions,
+    int sampleSize,
+    int batchSize) {
+  if (!getCandidateScoreFunc_) {
+    return getConvLmScoreFunc_(
+        tokens, lastTokenPositions, sampleSize, batchSize);
+  }
+  return getCandidateScoreFunc_(
+      tokens,
+      lastTokenPositions,
+      std::vector<std::vector<int>>(batchSize),
+      rowSize_,
+      sampleSize,
+      batchSize);
+}
+
+float ConvLM::rowScore(int row, const ConvLMState* state, int tokenIdx) {
+  if (tokenIdx < rowSize_) {
+    return cachedScore(row, tokenIdx);
+  }
+  auto& tail = tailCache_[row];
+  auto it = tail.find(tokenIdx);
+  if (it != tail.end()) {
+    return it->second;
+  }
+  std::vector<int> lastTokenPositions = {state->length - 1};
+  float score = getCandidateScoreFunc_(
+      state->tokens, lastTokenPositions, {{tokenIdx}}, 0, -1, 1)[0][0];
+  tail.emplace(tokenIdx, score);
+  return score;
+}
+
+float ConvLM::cachedScore(int row, int tokenIdx) const {
+  size_t offset = static_cast<size_t>(row) * rowSize_ + tokenIdx;
+  switch (cacheType_) {
+    case ConvLMCacheType::FP16:
+      return halfToFloat(halfCache_[offset]);
+    case ConvLMCacheType::INT8:
+      if (!int8Fallback_[row].empty()) {
+        return int8Fallback_[row][tokenIdx];
+      }
+      return int8Ranges_[row].first +
+          int8Ranges_[row].second * int8Cache_[offset];
+    default:
+      return cache_[offset];
+  }
+}
+
+void ConvLM::storeCache(int row, const float* probs) {
+  size_t offset = static_cast<size_t>(row) * rowSize_;
+  if (!tailCache_.empty()) {
+    tailCache_[row].clear();
+  }
+  switch (cacheType_) {
+    case ConvLMCacheType::FP32:
+      std::memcpy(cache_.data() + offset, probs, rowSize_ * sizeof(float));
+      break;
+    case ConvLMCacheType::FP16:
+      for (int i = 0; i < rowSize_; i++) {
+        halfCache_[offset + i] = floatToHalf(probs[i]);
+      }
+      break;
+    case ConvLMCacheType::INT8: {
+      auto range = std::minmax_element(probs, probs + rowSize_);
+      float minProb = *range.first;
+      float step = (*range.second - minProb) / 255;
+      // An infinite or NaN log-prob (which minmax_element may not even see)
+      // would make the step or the quantized values NaN
+      bool finite = std::isfinite(step) &&
+          std::all_of(probs, probs + rowSize_, [](float p) {
+            return std::isfinite(p);
+          });
+      if (!finite) {
+        int8Fallback_[row].assign(probs, probs + rowSize_);
+        break;
+      }
+      int8Fallback_[row].clear();
+      int8Ranges_[row] = std::make_pair(minProb, step);
+      for (int i = 0; i < rowSize_; i++) {
+        int8Cache_[offset + i] = step > 0
+            ? static_cast<uint8_t>(std::lround((probs[i] - minProb) / step))
+            : 0;
+      }
+      break;
+    }
+  }
+}
+
+void ConvLM::moveCache(int from, int to) {
+  size_t fromOffset = static_cast<size_t>(from) * rowSize_;
+  size_t toOffset = static_cast<size_t>(to) * rowSize_;
+  if (!tailCache_.empty()) {
+    tailCache_[to] = std::move(tailCache_[from]);
+    tailCache_[from].clear();
+  }
+  switch (cacheType_) {
+    case ConvLMCacheType::FP32:
+      std::copy_n(
+          cache_.begin() + fromOffset, rowSize_, cache_.begin() + toOffset);
+      break;
+    case ConvLMCacheType::FP16:
+      std::copy_n(
+          halfCache_.begin() + fromOffset,
+          rowSize_,
+          halfCache_.begin() + toOffset);
+      break;
+    case ConvLMCacheType::INT8:
+      std::copy_n(
+          int8Cache_.begin() + fromOffset,
+          rowSize_,
+          int8Cache_.begin() + toOffset);
+      int8Ranges_[to] = int8Ranges_[from];
+      int8Fallback_[to] = std::move(int8Fallback_[from]);
+      int8Fallback_[from].clear();
+      break;
+  }
+}
+
 } // namespace w2l
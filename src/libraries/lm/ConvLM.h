@@ -8,7 +8,9 @@
  */
 #pragma once
 
+#include <cstdint>
 #include <functional>
+#include <future>
 
 #include "libraries/common/Defines.h"
 #include "libraries/common/Dictionary.h"
@@ -19,6 +21,20 @@ namespace w2l {
 using GetConvLmScoreFunc = std::function<std::vector<std::vector<
     float>>(const std::vector<int>&, const std::vector<int>&, int, int)>;
 
+/**
+ * Scores of the tokens [0, shortlistSize) followed by the ones of
+ * candidates[b] for each sample b (arguments: inputs, lastTokenPositions,
+ * candidates, shortlistSize, sampleSize, batchSize)
+ */
+using GetConvLmCandidateScoreFunc = std::function<std::vector<std::vector<
+    float>>(
+    const std::vector<int>&,
+    const std::vector<int>&,
+    const std::vector<std::vector<int>>&,
+    int,
+    int,
+    int)>;
+
 struct ConvLMState : LMState {
   std::vector<int> tokens;
   int length;
@@ -28,6 +44,25 @@ struct ConvLMState : LMState {
       : tokens(std::vector<int>(size)), length(size) {}
 };
 
+/**
+ * Precision of the distributions cached by ConvLM: FP16 halves the memory of
+ * the cache, INT8 (linear quantization between the min and the max of each
+ * distribution) divides it by four. An INT8 row with a non-finite log-prob,
+ * which has no quantization range, is kept in FP32.
+ */
+enum class ConvLMCacheType { FP32, FP16, INT8 };
+
+/**
+ * ConvLM scores with a convolutional LM forwarded by `getConvLmScoreFunc`,
+ * caching the distributions of the states of the beam. If `asyncUpdate` is
+ * set, updateCache() returns as soon as the missing states are batched and
+ * runs their forward in the background, and the first access to the cache
+ * waits for it. In the decoders, this first access is the LM scoring of the
+ * next frame: the forward only overlaps with the token selection, the trie
+ * lookups and the gathering of the LM queries of that frame, not with its
+ * beam expansion. `getConvLmScoreFunc` must then be callable from another
+ * thread (e.g. select its own device).
+ */
 class ConvLM : public LM {
  public:
   ConvLM(
@@ -36,7 +71,11 @@ class ConvLM : public LM {
       const Dictionary& usrTknDict,
       int lmMemory = 10000,
       int beamSize = 2500,
-      int historySize = 49);
+      int historySize = 49,
+      bool asyncUpdate = false,
+      ConvLMCacheType cacheType = ConvLMCacheType::FP32);
+
+  ~ConvLM() override;
 
   LMStatePtr start(bool startWithNothing) override;
 
@@ -48,24 +87,95 @@ class ConvLM : public LM {
 
   void updateCache(std::vector<LMStatePtr> states) override;
 
+  void saveState(const LMStatePtr& state, std::ostream& out) const override;
+
+  LMStatePtr loadState(std::istream& in) override;
+
+  /**
+   * Only caches the scores of the first `shortlistSize` tokens of the LM
+   * vocabulary for each state, forwarded by `getCandidateScoreFunc` instead
+   * of the full distributions. The score of another token is computed the
+   * first time the state is queried with it and cached with the state's row.
+   * For an adaptive softmax LM whose head holds the shortlist, this divides
+   * the compute and the memory of the cache by about vocabSize / shortlistSize.
+   */
+  void setCandidateScoring(
+      const GetConvLmCandidateScoreFunc& getCandidateScoreFunc,
+      int shortlistSize);
+
  private:
   // This cache is also not thread-safe!
   int lmMemory_;
   int beamSize_;
   std::unordered_map<ConvLMState*, int> cacheIndices_;
-  std::vector<std::vector<float>> cache_;
+  // beamSize_ x vocabSize_ distributions, only the one of cacheType_ is used
+  ConvLMCacheType cacheType_;
+  std::vector<float> cache_;
+  std::vector<uint16_t> halfCache_;
+  std::vector<uint8_t> int8Cache_;
+  // (min, step) of the quantization of each INT8 row
+  std::vector<std::pair<float, float>> int8Ranges_;
+  // INT8 rows with a non-finite log-prob, kept in FP32 (empty otherwise)
+  std::vector<std::vector<float>> int8Fallback_;
+  // Number of tokens of each row: vocabSize_, or the shortlist size
+  int rowSize_;
+  // Scores of the tokens out of the shortlist queried for each row
+  std::vector<std::unordered_map<int, float>> tailCache_;
   std::vector<ConvLMState*> slot_;
   std::vector<int> batchedTokens_;
 
   Dictionary vocab_;
   GetConvLmScoreFunc getConvLmScoreFunc_;
+  GetConvLmCandidateScoreFunc getCandidateScoreFunc_;
 
   int vocabSize_;
   int maxHistorySize_;
 
+  // States batched by updateCache() to be forwarded into cache_ rows
+  // [cacheStart, cacheStart + batchSize)
+  struct ForwardBatch {
+    std::vector<int> tokens;
+    std::vector<int> lastTokenPositions;
+    int sampleSize;
+    int batchSize;
+    int cacheStart;
+  };
+  bool asyncUpdate_;
+  std::vector<ForwardBatch> pendingBatches_;
+  std::future<void> pendingUpdate_;
+
   std::pair<LMStatePtr, float> scoreWithLmIdx(
       const LMStatePtr& state,
       const int tokenIdx);
+
+  // Read token `tokenIdx` of cache row `row`
+  float cachedScore(int row, int tokenIdx) const;
+
+  // Read token `tokenIdx` of the row of `state`, scoring it if it is out of
+  // the shortlist and wasn't queried yet
+  float rowScore(int row, const ConvLMState* state, int tokenIdx);
+
+  // Forward a batch of histories into rowSize_ log-probs each
+  std::vector<std::vector<float>> forwardRows(
+      const std::vector<int>& tokens,
+      const std::vector<int>& lastTokenPositions,
+      int sampleSize,
+      int batchSize);
+
+  // Allocate beamSize_ rows of rowSize_ tokens for cacheType_
+  void resizeCache();
+
+  // Store a distribution of rowSize_ log-probs in cache row `row`
+  void storeCache(int row, const float* probs);
+
+  // Copy cache row `from` to row `to`
+  void moveCache(int from, int to);
+
+  // Forward pendingBatches_ and place their probabilities in cache_
+  void forwardBatches();
+
+  // Wait for the forward started by an asynchronous updateCache(), if any
+  void waitForUpdate();
 };
 
 } // namespace w2l
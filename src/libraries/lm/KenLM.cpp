@@ -8,15 +8,110 @@
 
 #include "libraries/lm/KenLM.h"
 
+#include <algorithm>
+#include <istream>
+#include <ostream>
 #include <stdexcept>
 
 #include <lm/model.hh>
 
 namespace w2l {
 
-KenLM::KenLM(const std::string& path, const Dictionary& usrTknDict) {
+namespace {
+// Number of independently locked shards of KenLMScoreCache
+constexpr size_t kCacheShards = 64;
+
+// Models alive in the process, by path, load method and replica, see
+// KenLM::loadModel()
+std::mutex& loadedModelsMutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+
+std::unordered_map<std::string, std::weak_ptr<lm::base::Model>>&
+loadedModels() {
+  static std::unordered_map<std::string, std::weak_ptr<lm::base::Model>>
+      models;
+  return models;
+}
+
+// Non-virtual lookup of the concrete KenLM models
+template <class Model>
+float fullScore(
+    const Model& model,
+    const lm::ngram::State& inState,
+    lm::WordIndex word,
+    lm::ngram::State* outState) {
+  return model.FullScore(inState, word, *outState).prob;
+}
+
+// Virtual lookup for the other models
+float fullScore(
+    const lm::base::Model& model,
+    const lm::ngram::State& inState,
+    lm::WordIndex word,
+    lm::ngram::State* outState) {
+  return model.BaseScore(&inState, word, outState);
+}
+
+template <class Model>
+bool isModel(const lm::base::Model* model) {
+  return dynamic_cast<const Model*>(model) != nullptr;
+}
+} // namespace
+
+KenLMScoreCache::KenLMScoreCache(size_t capacity)
+    : shardCapacity_(std::max<size_t>(capacity / kCacheShards, 1)),
+      shards_(kCacheShards) {}
+
+size_t KenLMScoreCache::KeyHash::operator()(const Key& key) const {
+  return lm::ngram::hash_value(key.state, key.word);
+}
+
+KenLMScoreCache::Shard& KenLMScoreCache::getShard(const Key& key) {
+  // Use the high bits, the low ones pick the bucket within the shard
+  return shards_[(KeyHash()(key) >> 32) % shards_.size()];
+}
+
+bool KenLMScoreCache::find(
+    const lm::ngram::State& inState,
+    lm::WordIndex word,
+    lm::ngram::State* outState,
+    float* score) {
+  Key key{inState, word};
+  Shard& shard = getShard(key);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto it = shard.entries.find(key);
+  if (it == shard.entries.end()) {
+    return false;
+  }
+  *outState = it->second.state;
+  *score = it->second.score;
+  return true;
+}
+
+void KenLMScoreCache::insert(
+    const lm::ngram::State& inState,
+    lm::WordIndex word,
+    const lm::ngram::State& outState,
+    float score) {
+  Key key{inState, word};
+  Shard& shard = getShard(key);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  if (shard.entries.size() >= shardCapacity_) {
+    shard.entries.clear();
+  }
+  shard.entries.emplace(key, Value{outState, score});
+}
+
+KenLM::KenLM(
+    const std::string& path,
+    const Dictionary& usrTknDict,
+    size_t cacheSize,
+    KenLMLoadMethod loadMethod,
+    int replica) {
   // Load LM
-  model_.reset(lm::ngram::LoadVirtual(path.c_str()));
+  model_ = loadModel(path, loadMethod, replica);
   if (!model_) {
     throw std::runtime_error("[KenLM] LM loading failed.");
   }
@@ -32,6 +127,73 @@ KenLM::KenLM(const std::string& path, const Dictionary& usrTknDict) {
     int lmIdx = vocab_->Index(token.c_str());
     usrToLmIdxMap_[i] = lmIdx;
   }
+
+  if (cacheSize > 0) {
+    cache_.reset(new KenLMScoreCache(cacheSize));
+  }
+
+  // Pick the batch scorer of the concrete model
+  const lm::base::Model* model = model_.get();
+  if (isModel<lm::ngram::ProbingModel>(model)) {
+    batchScorer_ = &KenLM::scoreBatchWith<lm::ngram::ProbingModel>;
+  } else if (isModel<lm::ngram::RestProbingModel>(model)) {
+    batchScorer_ = &KenLM::scoreBatchWith<lm::ngram::RestProbingModel>;
+  } else if (isModel<lm::ngram::TrieModel>(model)) {
+    batchScorer_ = &KenLM::scoreBatchWith<lm::ngram::TrieModel>;
+  } else if (isModel<lm::ngram::QuantTrieModel>(model)) {
+    batchScorer_ = &KenLM::scoreBatchWith<lm::ngram::QuantTrieModel>;
+  } else if (isModel<lm::ngram::ArrayTrieModel>(model)) {
+    batchScorer_ = &KenLM::scoreBatchWith<lm::ngram::ArrayTrieModel>;
+  } else if (isModel<lm::ngram::QuantArrayTrieModel>(model)) {
+    batchScorer_ = &KenLM::scoreBatchWith<lm::ngram::QuantArrayTrieModel>;
+  } else {
+    batchScorer_ = &KenLM::scoreBatchWith<lm::base::Model>;
+  }
+}
+
+std::shared_ptr<lm::base::Model> KenLM::loadModel(
+    const std::string& path,
+    KenLMLoadMethod loadMethod,
+    int replica) {
+  std::lock_guard<std::mutex> lock(loadedModelsMutex());
+  // A model loaded with another method isn't the one requested, e.g. a
+  // LAZY memory map for a READ copy
+  auto& loadedModel = loadedModels()
+      [path + "#" + std::to_string(static_cast<int>(loadMethod)) + "#" +
+       std::to_string(replica)];
+  auto model = loadedModel.lock();
+  if (!model) {
+    lm::ngram::Config config;
+    switch (loadMethod) {
+      case KenLMLoadMethod::LAZY:
+        config.load_method = util::LAZY;
+        break;
+      case KenLMLoadMethod::POPULATE:
+        config.load_method = util::POPULATE_OR_READ;
+        break;
+      case KenLMLoadMethod::READ:
+        config.load_method = util::READ;
+        break;
+    }
+    model.reset(lm::ngram::LoadVirtual(path.c_str(), config));
+    loadedModel = model;
+  }
+  return model;
+}
+
+float KenLM::baseScore(
+    const lm::ngram::State& inState,
+    lm::WordIndex word,
+    lm::ngram::State* outState) {
+  float score;
+  if (cache_ && cache_->find(inState, word, outState, &score)) {
+    return score;
+  }
+  score = model_->BaseScore(&inState, word, outState);
+  if (cache_) {
+    cache_->insert(inState, word, *outState, score);
+  }
+  return score;
 }
 
 LMStatePtr KenLM::start(bool startWithNothing) {
@@ -54,17 +216,69 @@ std::pair<LMStatePtr, float> KenLM::score(
   }
   auto inState = std::static_pointer_cast<KenLMState>(state);
   auto outState = inState->child<KenLMState>(usrTokenIdx);
-  float score = model_->BaseScore(
-      inState->ken(), usrToLmIdxMap_[usrTokenIdx], outState->ken());
+  float score =
+      baseScore(inState->ken_, usrToLmIdxMap_[usrTokenIdx], outState->ken());
   return std::make_pair(std::move(outState), score);
 }
 
+void KenLM::scoreBatch(
+    const std::vector<LMStatePtr>& states,
+    const std::vector<int>& usrTokenIdx,
+    std::vector<LMStatePtr>& outStates,
+    std::vector<float>& scores) {
+  (this->*batchScorer_)(states, usrTokenIdx, outStates, scores);
+}
+
+template <class Model>
+void KenLM::scoreBatchWith(
+    const std::vector<LMStatePtr>& states,
+    const std::vector<int>& usrTokenIdx,
+    std::vector<LMStatePtr>& outStates,
+    std::vector<float>& scores) {
+  const Model& model = static_cast<const Model&>(*model_);
+  outStates.resize(states.size());
+  scores.resize(states.size());
+  for (int i = 0; i < states.size(); i++) {
+    const int usrIdx = usrTokenIdx[i];
+    if (usrIdx < 0 || usrIdx >= usrToLmIdxMap_.size()) {
+      throw std::runtime_error(
+          "[KenLM] Invalid user token index: " + std::to_string(usrIdx));
+    }
+    auto inState = static_cast<KenLMState*>(states[i].get());
+    auto outState = inState->child<KenLMState>(usrIdx);
+    const lm::WordIndex word = usrToLmIdxMap_[usrIdx];
+    if (!cache_ ||
+        !cache_->find(inState->ken_, word, outState->ken(), &scores[i])) {
+      scores[i] = fullScore(model, inState->ken_, word, outState->ken());
+      if (cache_) {
+        cache_->insert(inState->ken_, word, outState->ken_, scores[i]);
+      }
+    }
+    outStates[i] = std::move(outState);
+  }
+}
+
 std::pair<LMStatePtr, float> KenLM::finish(const LMStatePtr& state) {
   auto inState = std::static_pointer_cast<KenLMState>(state);
   auto outState = inState->child<KenLMState>(-1);
   float score =
-      model_->BaseScore(inState->ken(), vocab_->EndSentence(), outState->ken());
+      baseScore(inState->ken_, vocab_->EndSentence(), outState->ken());
   return std::make_pair(std::move(outState), score);
 }
 
+void KenLM::saveState(const LMStatePtr& state, std::ostream& out) const {
+  // lm::ngram::State is a plain array of words and backoffs
+  const auto& ken = std::static_pointer_cast<KenLMState>(state)->ken_;
+  out.write(reinterpret_cast<const char*>(&ken), sizeof(ken));
+}
+
+LMStatePtr KenLM::loadState(std::istream& in) {
+  auto state = std::make_shared<KenLMState>();
+  in.read(reinterpret_cast<char*>(state->ken()), sizeof(state->ken_));
+  if (!in) {
+    throw std::runtime_error("[KenLM] Failed reading an LM state");
+  }
+  return state;
+}
+
 } // namespace w2l
@@ -8,6 +8,9 @@
 
 #pragma once
 
+#include <mutex>
+#include <unordered_map>
+
 #include "libraries/common/Dictionary.h"
 #include "libraries/lm/LM.h"
 
@@ -27,12 +30,98 @@ struct KenLMState : LMState {
   }
 };
 
+/**
+ * KenLMScoreCache memoizes KenLM lookups keyed on (context, word), where the
+ * context is the KenLM state itself rather than an LMState of a decoder, so
+ * that all the decoders sharing a KenLM reuse each other's lookups. It is
+ * split into independently locked shards to be queried concurrently; a shard
+ * which reaches its share of the capacity is cleared.
+ */
+class KenLMScoreCache {
+ public:
+  explicit KenLMScoreCache(size_t capacity);
+
+  /* Return true and fill `outState` and `score` if (inState, word) is cached */
+  bool find(
+      const lm::ngram::State& inState,
+      lm::WordIndex word,
+      lm::ngram::State* outState,
+      float* score);
+
+  void insert(
+      const lm::ngram::State& inState,
+      lm::WordIndex word,
+      const lm::ngram::State& outState,
+      float score);
+
+ private:
+  struct Key {
+    lm::ngram::State state;
+    lm::WordIndex word;
+
+    bool operator==(const Key& other) const {
+      return word == other.word && state == other.state;
+    }
+  };
+
+  struct KeyHash {
+    size_t operator()(const Key& key) const;
+  };
+
+  struct Value {
+    lm::ngram::State state;
+    float score;
+  };
+
+  struct Shard {
+    std::mutex mutex;
+    std::unordered_map<Key, Value, KeyHash> entries;
+  };
+
+  Shard& getShard(const Key& key);
+
+  size_t shardCapacity_;
+  std::vector<Shard> shards_;
+};
+
+/**
+ * How a KenLM binary is brought in memory: LAZY memory-maps it and pages it
+ * in on demand, POPULATE memory-maps and prefaults it (or reads it if it
+ * can't), READ copies it in anonymous memory. ARPA files are always read.
+ */
+enum class KenLMLoadMethod { LAZY, POPULATE, READ };
+
 /**
  * KenLM extends LM by using the toolkit https://kheafield.com/code/kenlm/.
  */
 class KenLM : public LM {
  public:
-  KenLM(const std::string& path, const Dictionary& usrTknDict);
+  /**
+   * If `cacheSize` > 0, the lookups are memoized in a KenLMScoreCache of
+   * `cacheSize` entries shared by all the threads using this LM. The model
+   * itself is obtained from loadModel(), so that KenLMs built on the same
+   * path, `loadMethod` and `replica` are lightweight views of a single
+   * model.
+   */
+  KenLM(
+      const std::string& path,
+      const Dictionary& usrTknDict,
+      size_t cacheSize = 0,
+      KenLMLoadMethod loadMethod = KenLMLoadMethod::POPULATE,
+      int replica = 0);
+
+  /**
+   * Return the model at `path`, loading it only if no model of that path,
+   * `loadMethod` and `replica` is alive in the process: a model loaded with
+   * another method is never returned. Replicas are loaded separately, e.g.
+   * one per NUMA node by a thread bound to it, which only makes distinct
+   * copies with the READ method. A memory-mapped model is also shared with
+   * the other processes mapping it, through the page cache.
+   */
+  static std::shared_ptr<lm::base::Model> loadModel(
+      const std::string& path,
+      KenLMLoadMethod loadMethod,
+      int replica = 0);
 
   LMStatePtr start(bool startWithNothing) override;
 
@@ -42,9 +131,45 @@ class KenLM : public LM {
 
   std::pair<LMStatePtr, float> finish(const LMStatePtr& state) override;
 
+  void saveState(const LMStatePtr& state, std::ostream& out) const override;
+
+  LMStatePtr loadState(std::istream& in) override;
+
+  void scoreBatch(
+      const std::vector<LMStatePtr>& states,
+      const std::vector<int>& usrTokenIdx,
+      std::vector<LMStatePtr>& outStates,
+      std::vector<float>& scores) override;
+
  private:
   std::shared_ptr<lm::base::Model> model_;
   const lm::base::Vocabulary* vocab_;
+  std::unique_ptr<KenLMScoreCache> cache_;
+
+  /* Score `word` after `inState` into `outState`, through the cache if any */
+  float baseScore(
+      const lm::ngram::State& inState,
+      lm::WordIndex word,
+      lm::ngram::State* outState);
+
+  /*
+   * scoreBatch() with the concrete type of model_, whose lookups are then
+   * non-virtual and can be inlined in the loop over the batch. batchScorer_
+   * is the instance picked for model_ at construction.
+   */
+  template <class Model>
+  void scoreBatchWith(
+      const std::vector<LMStatePtr>& states,
+      const std::vector<int>& usrTokenIdx,
+      std::vector<LMStatePtr>& outStates,
+      std::vector<float>& scores);
+
+  using BatchScorer = void (KenLM::*)(
+      const std::vector<LMStatePtr>&,
+      const std::vector<int>&,
+      std::vector<LMStatePtr>&,
+      std::vector<float>&);
+  BatchScorer batchScorer_;
 };
 
 using KenLMPtr = std::shared_ptr<KenLM>;
@@ -9,7 +9,10 @@
 #pragma once
 
 #include <cstring>
+#include <iosfwd>
 #include <memory>
+#include <stdexcept>
+#include <tuple>
 #include <unordered_map>
 #include <utility>
 #include <vector>
@@ -31,6 +34,23 @@ struct LMState {
     }
   }
 
+  /**
+   * Release the subtrees of children which can not be reached any more, i.e.
+   * which are only held by the tree and have no such descendant. Decoders
+   * call it on their live states when pruning, so that the tree of a
+   * streaming utterance does not keep the states which left the beam.
+   */
+  void releaseUnusedChildren() {
+    for (auto it = children.begin(); it != children.end();) {
+      it->second->releaseUnusedChildren();
+      if (it->second.use_count() == 1 && it->second->children.empty()) {
+        it = children.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
   /* Compare two language model states. */
   int compare(const std::shared_ptr<LMState>& state) const {
     LMState* inState = state.get();
@@ -72,9 +92,41 @@ class LM {
   /* Query the language model and finish decoding. */
   virtual std::pair<LMStatePtr, float> finish(const LMStatePtr& state) = 0;
 
+  /**
+   * Query the language model for a batch of (state, token) pairs at once,
+   * filling `outStates` and `scores` in the same order. Language models can
+   * override it to avoid the per-query overhead of score().
+   */
+  virtual void scoreBatch(
+      const std::vector<LMStatePtr>& states,
+      const std::vector<int>& usrTokenIdx,
+      std::vector<LMStatePtr>& outStates,
+      std::vector<float>& scores) {
+    outStates.resize(states.size());
+    scores.resize(states.size());
+    for (int i = 0; i < states.size(); i++) {
+      std::tie(outStates[i], scores[i]) = score(states[i], usrTokenIdx[i]);
+    }
+  }
+
   /* Update LM caches (optional) given a bunch of new states generated */
   virtual void updateCache(std::vector<LMStatePtr> stateIdices) {}
 
+  /**
+   * Write the content of `state` to `out` in a binary form, which loadState()
+   * reads back into a new state of the same LM, possibly in another process.
+   * Decoders use them to snapshot a session. The children of the state are
+   * not saved.
+   */
+  virtual void saveState(const LMStatePtr& /* state */, std::ostream& /* out */)
+      const {
+    throw std::logic_error("[LM] Saving the states is not supported");
+  }
+
+  virtual LMStatePtr loadState(std::istream& /* in */) {
+    throw std::logic_error("[LM] Loading the states is not supported");
+  }
+
   virtual ~LM() = default;
 
  protected:
@@ -26,4 +26,12 @@ std::pair<LMStatePtr, float> ZeroLM::finish(const LMStatePtr& state) {
   return std::make_pair(state, 0.0);
 }
 
+void ZeroLM::saveState(
+    const LMStatePtr& /* unused */,
+    std::ostream& /* unused */) const {}
+
+LMStatePtr ZeroLM::loadState(std::istream& /* unused */) {
+  return std::make_shared<LMState>();
+}
+
 } // namespace w2l
@@ -25,6 +25,10 @@ class ZeroLM : public LM {
       const int usrTokenIdx) override;
 
   std::pair<LMStatePtr, float> finish(const LMStatePtr& state) override;
+
+  void saveState(const LMStatePtr& state, std::ostream& out) const override;
+
+  LMStatePtr loadState(std::istream& in) override;
 };
 
 } // namespace w2l
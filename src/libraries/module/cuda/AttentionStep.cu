@@ -0,0 +1,131 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "libraries/module/cuda/AttentionStep.cuh"
+
+#include <cmath>
+
+#include <cub/cub.cuh>
+
+namespace {
+
+constexpr int kWarpSize = 32;
+constexpr int kBlockSize = 256;
+constexpr int kWarps = kBlockSize / kWarpSize;
+
+/*
+ * B thread blocks
+ * kBlockSize threads/block
+ *
+ * Each warp computes the scores of some frames into `attention`, the block
+ * normalizes them, then each thread sums some dimensions of the values.
+ */
+template <class Float>
+__global__ void computeKernel(
+    int T,
+    int H,
+    int V,
+    Float scale,
+    const Float* _query,
+    const Float* _keys,
+    const Float* _values,
+    const Float* _bias,
+    Float* _attention,
+    Float* _summary) {
+  int b = blockIdx.x;
+  const auto* query = &_query[b * H];
+  const auto* keys = &_keys[b * T * H];
+  const auto* values = &_values[b * T * V];
+  const auto* bias = _bias ? &_bias[b * T] : nullptr;
+  auto* attention = &_attention[b * T];
+  auto* summary = &_summary[b * V];
+
+  using WarpReduce = cub::WarpReduce<Float>;
+  using BlockReduce = cub::BlockReduce<Float, kBlockSize>;
+  __shared__ typename WarpReduce::TempStorage warpStorage[kWarps];
+  __shared__ typename BlockReduce::TempStorage blockStorage;
+  __shared__ Float maxScore;
+  __shared__ Float sumExp;
+
+  int warp = threadIdx.x / kWarpSize;
+  int lane = threadIdx.x % kWarpSize;
+  for (int t = warp; t < T; t += kWarps) {
+    Float dot = 0;
+    for (int h = lane; h < H; h += kWarpSize) {
+      dot += query[h] * keys[t * H + h];
+    }
+    dot = WarpReduce(warpStorage[warp]).Sum(dot);
+    if (lane == 0) {
+      attention[t] = dot * scale + (bias ? bias[t] : 0);
+    }
+  }
+  __syncthreads();
+
+  Float threadMax = -INFINITY;
+  for (int t = threadIdx.x; t < T; t += kBlockSize) {
+    threadMax = max(threadMax, attention[t]);
+  }
+  Float result = BlockReduce(blockStorage).Reduce(threadMax, cub::Max());
+  if (threadIdx.x == 0) {
+    maxScore = result;
+  }
+  __syncthreads();
+
+  Float threadSum = 0;
+  for (int t = threadIdx.x; t < T; t += kBlockSize) {
+    attention[t] = exp(attention[t] - maxScore);
+    threadSum += attention[t];
+  }
+  result = BlockReduce(blockStorage).Sum(threadSum);
+  if (threadIdx.x == 0) {
+    sumExp = result;
+  }
+  __syncthreads();
+
+  for (int t = threadIdx.x; t < T; t += kBlockSize) {
+    attention[t] /= sumExp;
+  }
+  __syncthreads();
+
+  for (int v = threadIdx.x; v < V; v += kBlockSize) {
+    Float sum = 0;
+    for (int t = 0; t < T; ++t) {
+      sum += attention[t] * values[t * V + v];
+    }
+    summary[v] = sum;
+  }
+}
+
+} // namespace
+
+namespace w2l {
+namespace cuda {
+
+template <class Float>
+void AttentionStep<Float>::compute(
+    int B,
+    int T,
+    int H,
+    int V,
+    Float scale,
+    const Float* query,
+    const Float* keys,
+    const Float* values,
+    const Float* bias,
+    Float* attention,
+    Float* summary,
+    cudaStream_t stream) {
+  computeKernel<<<B, kBlockSize, 0, stream>>>(
+      T, H, V, scale, query, keys, values, bias, attention, summary);
+}
+
+template struct AttentionStep<float>;
+template struct AttentionStep<double>;
+
+} // namespace cuda
+} // namespace w2l
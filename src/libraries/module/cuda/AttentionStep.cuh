@@ -0,0 +1,50 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cuda_runtime.h>
+
+namespace w2l {
+namespace cuda {
+
+/// Computes one inference step of dot-product attention: the scores of the
+/// frames, their softmax and the weighted sum of the values, in one kernel.
+template <class Float>
+struct AttentionStep {
+  /**
+   * B: number of queries (batch size times beam size)
+   * T: input length
+   * H: query and key dimension, 0 if the scores are `bias` only
+   * V: value dimension
+   * scale: factor of the query-key products
+   * query: [B][H] queries
+   * keys: [B][T][H] keys
+   * values: [B][T][V] values
+   * bias: [B][T] added to the scores, may be null
+   * attention: [B][T] (out) softmax of the scores
+   * summary: [B][V] (out) attention-weighted sum of the values
+   * stream: CUDA stream
+   */
+  static void compute(
+      int B,
+      int T,
+      int H,
+      int V,
+      Float scale,
+      const Float* query,
+      const Float* keys,
+      const Float* values,
+      const Float* bias,
+      Float* attention,
+      Float* summary,
+      cudaStream_t stream);
+};
+
+} // namespace cuda
+} // namespace w2l
@@ -0,0 +1,214 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "libraries/module/cuda/LocationEnergies.cuh"
+
+#include <cmath>
+
+#include <cub/cub.cuh>
+
+namespace {
+
+constexpr int kWarpSize = 32;
+constexpr int kBlockSize = 256;
+constexpr int kWarps = kBlockSize / kWarpSize;
+constexpr int kTileFrames = 32;
+
+/* The hidden unit `a` of frame `t`, before the tanh */
+template <class Float>
+__device__ Float hiddenUnit(
+    int T,
+    int A,
+    int K,
+    int t,
+    int a,
+    Float base,
+    const Float* prevAttn,
+    const Float* filter) {
+  if (prevAttn) {
+    int half = (K - 1) / 2;
+    for (int k = max(0, half - t); k < min(K, T + half - t); ++k) {
+      base += filter[k * A + a] * prevAttn[t + k - half];
+    }
+  }
+  return base;
+}
+
+/*
+ * ceil(T / kWarps) x B thread blocks
+ * kBlockSize threads/block
+ *
+ * Each warp computes the energy of a frame, its lanes summing over the
+ * attention dimensions.
+ */
+template <class Float>
+__global__ void forwardKernel(
+    int T,
+    int A,
+    int K,
+    const Float* _keys,
+    const Float* _query,
+    const Float* _prevAttn,
+    const Float* filter,
+    const Float* filterBias,
+    const Float* weight,
+    Float* _energies) {
+  int b = blockIdx.y;
+  int warp = threadIdx.x / kWarpSize;
+  int lane = threadIdx.x % kWarpSize;
+  int t = blockIdx.x * kWarps + warp;
+  if (t >= T) {
+    return;
+  }
+  const auto* keys = &_keys[(b * T + t) * A];
+  const auto* query = &_query[b * A];
+  const auto* prevAttn = _prevAttn ? &_prevAttn[b * T] : nullptr;
+
+  using WarpReduce = cub::WarpReduce<Float>;
+  __shared__ typename WarpReduce::TempStorage warpStorage[kWarps];
+
+  Float energy = 0;
+  for (int a = lane; a < A; a += kWarpSize) {
+    Float hidden = hiddenUnit(
+        T,
+        A,
+        K,
+        t,
+        a,
+        keys[a] + query[a] + filterBias[a],
+        prevAttn,
+        filter);
+    energy += weight[a] * tanh(hidden);
+  }
+  energy = WarpReduce(warpStorage[warp]).Sum(energy);
+  if (lane == 0) {
+    _energies[b * T + t] = energy;
+  }
+}
+
+/*
+ * numTiles(T) x B thread blocks
+ * kBlockSize threads/block
+ *
+ * Each thread recomputes some hidden units over the kTileFrames frames of the
+ * tile, writes their gradients, and sums the gradients of the query and of
+ * the weight over the tile.
+ */
+template <class Float>
+__global__ void backwardKernel(
+    int T,
+    int A,
+    int K,
+    const Float* _gradEnergies,
+    const Float* _keys,
+    const Float* _query,
+    const Float* _prevAttn,
+    const Float* filter,
+    const Float* filterBias,
+    const Float* weight,
+    Float* _gradKeys,
+    Float* _gradQuery,
+    Float* _gradWeight) {
+  int b = blockIdx.y;
+  int tile = blockIdx.x;
+  int start = tile * kTileFrames;
+  int end = min(start + kTileFrames, T);
+  const auto* gradEnergies = &_gradEnergies[b * T];
+  const auto* keys = &_keys[b * T * A];
+  const auto* query = &_query[b * A];
+  const auto* prevAttn = _prevAttn ? &_prevAttn[b * T] : nullptr;
+  auto* gradKeys = &_gradKeys[b * T * A];
+  auto* gradQuery = &_gradQuery[(b * gridDim.x + tile) * A];
+  auto* gradWeight = &_gradWeight[(b * gridDim.x + tile) * A];
+
+  for (int a = threadIdx.x; a < A; a += kBlockSize) {
+    Float base = query[a] + filterBias[a];
+    Float sumQuery = 0;
+    Float sumWeight = 0;
+    for (int t = start; t < end; ++t) {
+      Float hidden = tanh(hiddenUnit(
+          T, A, K, t, a, base + keys[t * A + a], prevAttn, filter));
+      Float grad = gradEnergies[t];
+      Float gradHidden = grad * weight[a] * (1 - hidden * hidden);
+      gradKeys[t * A + a] = gradHidden;
+      sumQuery += gradHidden;
+      sumWeight += grad * hidden;
+    }
+    gradQuery[a] = sumQuery;
+    gradWeight[a] = sumWeight;
+  }
+}
+
+} // namespace
+
+namespace w2l {
+namespace cuda {
+
+template <class Float>
+void LocationEnergies<Float>::forward(
+    int B,
+    int T,
+    int A,
+    int K,
+    const Float* keys,
+    const Float* query,
+    const Float* prevAttn,
+    const Float* filter,
+    const Float* filterBias,
+    const Float* weight,
+    Float* energies,
+    cudaStream_t stream) {
+  dim3 blocks((T + kWarps - 1) / kWarps, B);
+  forwardKernel<<<blocks, kBlockSize, 0, stream>>>(
+      T, A, K, keys, query, prevAttn, filter, filterBias, weight, energies);
+}
+
+template <class Float>
+int LocationEnergies<Float>::numTiles(int T) {
+  return (T + kTileFrames - 1) / kTileFrames;
+}
+
+template <class Float>
+void LocationEnergies<Float>::backward(
+    int B,
+    int T,
+    int A,
+    int K,
+    const Float* gradEnergies,
+    const Float* keys,
+    const Float* query,
+    const Float* prevAttn,
+    const Float* filter,
+    const Float* filterBias,
+    const Float* weight,
+    Float* gradKeys,
+    Float* gradQuery,
+    Float* gradWeight,
+    cudaStream_t stream) {
+  dim3 blocks(numTiles(T), B);
+  backwardKernel<<<blocks, kBlockSize, 0, stream>>>(
+      T,
+      A,
+      K,
+      gradEnergies,
+      keys,
+      query,
+      prevAttn,
+      filter,
+      filterBias,
+      weight,
+      gradKeys,
+      gradQuery,
+      gradWeight);
+}
+
+template struct LocationEnergies<float>;
+template struct LocationEnergies<double>;
+
+} // namespace cuda
+} // namespace w2l
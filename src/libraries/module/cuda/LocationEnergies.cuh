@@ -0,0 +1,84 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cuda_runtime.h>
+
+namespace w2l {
+namespace cuda {
+
+/// Computes the energies of the neural location attention for one decoder
+/// step: weight' * tanh(keys + query + filterBias + the K-tap filter of each
+/// attention dimension over the previous attention, centered on the frame).
+/// The forward keeps none of the hidden units, and the backward recomputes
+/// them frame by frame.
+template <class Float>
+struct LocationEnergies {
+  /**
+   * B: number of queries (batch size times beam size)
+   * T: input length
+   * A: attention dimension
+   * K: filter size, odd
+   * keys: [B][T][A] projections of the encoder output
+   * query: [B][A] projections of the decoder state
+   * prevAttn: [B][T] previous attention, null for none
+   * filter: [K][A] filter of each dimension over the previous attention
+   * filterBias: [A] bias of the location term
+   * weight: [A] weight of the hidden units
+   * energies: [B][T] (out) energy of each frame
+   * stream: CUDA stream
+   */
+  static void forward(
+      int B,
+      int T,
+      int A,
+      int K,
+      const Float* keys,
+      const Float* query,
+      const Float* prevAttn,
+      const Float* filter,
+      const Float* filterBias,
+      const Float* weight,
+      Float* energies,
+      cudaStream_t stream);
+
+  /// The frames of the tiles over which `backward` sums the gradients
+  static int numTiles(int T);
+
+  /**
+   * B, T, A, K, keys, query, prevAttn, filter, filterBias, weight: as in
+   *   `forward`
+   * gradEnergies: [B][T] gradient of the energies
+   * gradKeys: [B][T][A] (out) gradient of the keys, which is the one of the
+   *   hidden units
+   * gradQuery: [B][numTiles(T)][A] (out) gradient of the query for each tile
+   * gradWeight: [B][numTiles(T)][A] (out) gradient of the weight for each
+   *   tile
+   * stream: CUDA stream
+   */
+  static void backward(
+      int B,
+      int T,
+      int A,
+      int K,
+      const Float* gradEnergies,
+      const Float* keys,
+      const Float* query,
+      const Float* prevAttn,
+      const Float* filter,
+      const Float* filterBias,
+      const Float* weight,
+      Float* gradKeys,
+      Float* gradQuery,
+      Float* gradWeight,
+      cudaStream_t stream);
+};
+
+} // namespace cuda
+} // namespace w2l
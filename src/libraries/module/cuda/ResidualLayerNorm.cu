@@ -0,0 +1,308 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "libraries/module/cuda/ResidualLayerNorm.cuh"
+
+#include <cmath>
+
+#include <cub/cub.cuh>
+
+namespace {
+
+constexpr int kBlockSize = 256;
+
+/*
+ * outer thread blocks
+ * kBlockSize threads/block
+ *
+ * For inner = 1: each block normalizes a group of N contiguous elements.
+ */
+template <class Float>
+__global__ void forwardBlockKernel(
+    int N,
+    Float eps,
+    const Float* _input,
+    const Float* _residual,
+    const Float* weight,
+    const Float* bias,
+    Float* _output,
+    Float* mean,
+    Float* rstd) {
+  int g = blockIdx.x;
+  const auto* input = &_input[g * N];
+  const auto* residual = &_residual[g * N];
+  auto* output = &_output[g * N];
+
+  using BlockReduce = cub::BlockReduce<double, kBlockSize>;
+  __shared__ typename BlockReduce::TempStorage storage;
+  __shared__ Float groupMean;
+  __shared__ Float groupRstd;
+
+  double sum = 0, sumSq = 0;
+  for (int n = threadIdx.x; n < N; n += kBlockSize) {
+    double x = input[n] + residual[n];
+    sum += x;
+    sumSq += x * x;
+  }
+  sum = BlockReduce(storage).Sum(sum);
+  __syncthreads();
+  sumSq = BlockReduce(storage).Sum(sumSq);
+  if (threadIdx.x == 0) {
+    double m = sum / N;
+    double var = max(sumSq / N - m * m, 0.0);
+    groupMean = m;
+    groupRstd = 1 / sqrt(var + eps);
+    mean[g] = groupMean;
+    rstd[g] = groupRstd;
+  }
+  __syncthreads();
+
+  Float w = *weight * groupRstd;
+  Float b = *bias - groupMean * w;
+  for (int n = threadIdx.x; n < N; n += kBlockSize) {
+    output[n] = (input[n] + residual[n]) * w + b;
+  }
+}
+
+/*
+ * ceil(inner * outer / kBlockSize) thread blocks
+ * kBlockSize threads/block
+ *
+ * For inner > 1: each thread normalizes a group of N elements of stride
+ * inner, so that the threads of a warp read contiguous elements.
+ */
+template <class Float>
+__global__ void forwardThreadKernel(
+    int inner,
+    int N,
+    int outer,
+    Float eps,
+    const Float* input,
+    const Float* residual,
+    const Float* weight,
+    const Float* bias,
+    Float* output,
+    Float* mean,
+    Float* rstd) {
+  int g = blockIdx.x * kBlockSize + threadIdx.x;
+  if (g >= inner * outer) {
+    return;
+  }
+  int offset = (g / inner) * N * inner + g % inner;
+
+  double sum = 0, sumSq = 0;
+  for (int n = 0, i = offset; n < N; ++n, i += inner) {
+    double x = input[i] + residual[i];
+    sum += x;
+    sumSq += x * x;
+  }
+  double m = sum / N;
+  double var = max(sumSq / N - m * m, 0.0);
+  Float groupMean = m;
+  Float groupRstd = 1 / sqrt(var + eps);
+  mean[g] = groupMean;
+  rstd[g] = groupRstd;
+
+  Float w = *weight * groupRstd;
+  Float b = *bias - groupMean * w;
+  for (int n = 0, i = offset; n < N; ++n, i += inner) {
+    output[i] = (input[i] + residual[i]) * w + b;
+  }
+}
+
+/*
+ * outer thread blocks
+ * kBlockSize threads/block
+ *
+ * With xhat the normalized values and gy the gradient of the output:
+ *   gradInput = rstd * weight * (gy - mean(gy) - xhat * mean(gy * xhat))
+ */
+template <class Float>
+__global__ void backwardBlockKernel(
+    int N,
+    const Float* _gradOutput,
+    const Float* _input,
+    const Float* _residual,
+    const Float* weight,
+    const Float* mean,
+    const Float* rstd,
+    Float* _gradInput,
+    Float* gradWeight,
+    Float* gradBias) {
+  int g = blockIdx.x;
+  const auto* gradOutput = &_gradOutput[g * N];
+  const auto* input = &_input[g * N];
+  const auto* residual = &_residual[g * N];
+  auto* gradInput = &_gradInput[g * N];
+
+  using BlockReduce = cub::BlockReduce<double, kBlockSize>;
+  __shared__ typename BlockReduce::TempStorage storage;
+  __shared__ Float meanGy;
+  __shared__ Float meanGyXhat;
+
+  Float groupMean = mean[g];
+  Float groupRstd = rstd[g];
+  double sumGy = 0, sumGyXhat = 0;
+  for (int n = threadIdx.x; n < N; n += kBlockSize) {
+    Float xhat = (input[n] + residual[n] - groupMean) * groupRstd;
+    sumGy += gradOutput[n];
+    sumGyXhat += gradOutput[n] * xhat;
+  }
+  sumGy = BlockReduce(storage).Sum(sumGy);
+  __syncthreads();
+  sumGyXhat = BlockReduce(storage).Sum(sumGyXhat);
+  if (threadIdx.x == 0) {
+    meanGy = sumGy / N;
+    meanGyXhat = sumGyXhat / N;
+    gradWeight[g] = sumGyXhat;
+    gradBias[g] = sumGy;
+  }
+  __syncthreads();
+
+  Float scale = *weight * groupRstd;
+  for (int n = threadIdx.x; n < N; n += kBlockSize) {
+    Float xhat = (input[n] + residual[n] - groupMean) * groupRstd;
+    gradInput[n] = scale * (gradOutput[n] - meanGy - xhat * meanGyXhat);
+  }
+}
+
+/*
+ * ceil(inner * outer / kBlockSize) thread blocks
+ * kBlockSize threads/block
+ *
+ * As `backwardBlockKernel`, a thread per group.
+ */
+template <class Float>
+__global__ void backwardThreadKernel(
+    int inner,
+    int N,
+    int outer,
+    const Float* gradOutput,
+    const Float* input,
+    const Float* residual,
+    const Float* weight,
+    const Float* mean,
+    const Float* rstd,
+    Float* gradInput,
+    Float* gradWeight,
+    Float* gradBias) {
+  int g = blockIdx.x * kBlockSize + threadIdx.x;
+  if (g >= inner * outer) {
+    return;
+  }
+  int offset = (g / inner) * N * inner + g % inner;
+
+  Float groupMean = mean[g];
+  Float groupRstd = rstd[g];
+  double sumGy = 0, sumGyXhat = 0;
+  for (int n = 0, i = offset; n < N; ++n, i += inner) {
+    Float xhat = (input[i] + residual[i] - groupMean) * groupRstd;
+    sumGy += gradOutput[i];
+    sumGyXhat += gradOutput[i] * xhat;
+  }
+  gradWeight[g] = sumGyXhat;
+  gradBias[g] = sumGy;
+
+  Float meanGy = sumGy / N;
+  Float meanGyXhat = sumGyXhat / N;
+  Float scale = *weight * groupRstd;
+  for (int n = 0, i = offset; n < N; ++n, i += inner) {
+    Float xhat = (input[i] + residual[i] - groupMean) * groupRstd;
+    gradInput[i] = scale * (gradOutput[i] - meanGy - xhat * meanGyXhat);
+  }
+}
+
+} // namespace
+
+namespace w2l {
+namespace cuda {
+
+template <class Float>
+void ResidualLayerNorm<Float>::forward(
+    int inner,
+    int N,
+    int outer,
+    Float eps,
+    const Float* input,
+    const Float* residual,
+    const Float* weight,
+    const Float* bias,
+    Float* output,
+    Float* mean,
+    Float* rstd,
+    cudaStream_t stream) {
+  if (inner == 1) {
+    forwardBlockKernel<<<outer, kBlockSize, 0, stream>>>(
+        N, eps, input, residual, weight, bias, output, mean, rstd);
+  } else {
+    int nBlocks = (inner * outer + kBlockSize - 1) / kBlockSize;
+    forwardThreadKernel<<<nBlocks, kBlockSize, 0, stream>>>(
+        inner,
+        N,
+        outer,
+        eps,
+        input,
+        residual,
+        weight,
+        bias,
+        output,
+        mean,
+        rstd);
+  }
+}
+
+template <class Float>
+void ResidualLayerNorm<Float>::backward(
+    int inner,
+    int N,
+    int outer,
+    const Float* gradOutput,
+    const Float* input,
+    const Float* residual,
+    const Float* weight,
+    const Float* mean,
+    const Float* rstd,
+    Float* gradInput,
+    Float* gradWeight,
+    Float* gradBias,
+    cudaStream_t stream) {
+  if (inner == 1) {
+    backwardBlockKernel<<<outer, kBlockSize, 0, stream>>>(
+        N,
+        gradOutput,
+        input,
+        residual,
+        weight,
+        mean,
+        rstd,
+        gradInput,
+        gradWeight,
+        gradBias);
+  } else {
+    int nBlocks = (inner * outer + kBlockSize - 1) / kBlockSize;
+    backwardThreadKernel<<<nBlocks, kBlockSize, 0, stream>>>(
+        inner,
+        N,
+        outer,
+        gradOutput,
+        input,
+        residual,
+        weight,
+        mean,
+        rstd,
+        gradInput,
+        gradWeight,
+        gradBias);
+  }
+}
+
+template struct ResidualLayerNorm<float>;
+template struct ResidualLayerNorm<double>;
+
+} // namespace cuda
+} // namespace w2l
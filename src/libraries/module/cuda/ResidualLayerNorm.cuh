@@ -0,0 +1,79 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cuda_runtime.h>
+
+namespace w2l {
+namespace cuda {
+
+/**
+ * Layer normalization of the sum of an input and a residual, with a scalar
+ * affine transform, in one pass for the statistics and one for the output.
+ * The tensors are [outer][N][inner]: each of the inner * outer groups of N
+ * elements is normalized on its own. The backward recomputes the normalized
+ * values from the input, the residual and the statistics of the forward.
+ */
+template <class Float>
+struct ResidualLayerNorm {
+  /**
+   * inner, N, outer: dimensions of the tensors
+   * eps: added to the variance
+   * input: [outer][N][inner]
+   * residual: [outer][N][inner] added to the input
+   * weight: [1] scale of the normalized values
+   * bias: [1] added to the scaled values
+   * output: [outer][N][inner] (out)
+   * mean: [outer][inner] (out) mean of each group
+   * rstd: [outer][inner] (out) inverse standard deviation of each group
+   * stream: CUDA stream
+   */
+  static void forward(
+      int inner,
+      int N,
+      int outer,
+      Float eps,
+      const Float* input,
+      const Float* residual,
+      const Float* weight,
+      const Float* bias,
+      Float* output,
+      Float* mean,
+      Float* rstd,
+      cudaStream_t stream);
+
+  /**
+   * inner, N, outer: dimensions of the tensors
+   * gradOutput: [outer][N][inner] gradient of the output
+   * input, residual, weight: as in `forward`
+   * mean, rstd: statistics from `forward`
+   * gradInput: [outer][N][inner] (out) gradient of the input, which is also
+   *   the one of the residual
+   * gradWeight: [outer][inner] (out) gradient of the weight for each group
+   * gradBias: [outer][inner] (out) gradient of the bias for each group
+   * stream: CUDA stream
+   */
+  static void backward(
+      int inner,
+      int N,
+      int outer,
+      const Float* gradOutput,
+      const Float* input,
+      const Float* residual,
+      const Float* weight,
+      const Float* mean,
+      const Float* rstd,
+      Float* gradInput,
+      Float* gradWeight,
+      Float* gradBias,
+      cudaStream_t stream);
+};
+
+} // namespace cuda
+} // namespace w2l
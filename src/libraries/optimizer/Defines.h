@@ -0,0 +1,31 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+namespace w2l {
+
+enum class OptimizerType {
+  SGD = 0,
+  ADAM = 1,
+  RMSPROP = 2,
+  ADADELTA = 3,
+};
+
+/// Hyper-parameters of an optimizer step, as in the flashlight optimizers
+struct OptimizerHyperParams {
+  float lr; // For Adam, corrected for the bias of the moments at this step
+  float momentum; // SGD
+  float beta1; // Adam
+  float beta2; // Adam
+  float rho; // RMSProp, Adadelta
+  float eps; // Adam, RMSProp, Adadelta
+  float weightDecay;
+};
+
+} // namespace w2l
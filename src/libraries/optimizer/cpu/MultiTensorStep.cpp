@@ -0,0 +1,138 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "libraries/optimizer/cpu/MultiTensorStep.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+namespace {
+
+using w2l::OptimizerHyperParams;
+using w2l::OptimizerType;
+
+constexpr int64_t kChunkSize = 65536;
+
+/* Update of an element `p` with gradient `g` and states `s1`, `s2` */
+template <OptimizerType Type, class Float>
+inline void update(
+    const OptimizerHyperParams& hp,
+    Float& p,
+    Float g,
+    Float& s1,
+    Float& s2) {
+  if (Type == OptimizerType::SGD) {
+    g += hp.weightDecay * p;
+    if (hp.momentum != 0) {
+      s1 = hp.momentum * s1 + g;
+      g = s1;
+    }
+    p -= hp.lr * g;
+    return;
+  }
+
+  p -= hp.weightDecay * p;
+  if (Type == OptimizerType::ADAM) {
+    s1 = hp.beta1 * s1 + (1 - hp.beta1) * g;
+    s2 = hp.beta2 * s2 + (1 - hp.beta2) * g * g;
+    p -= hp.lr * s1 / (std::sqrt(s2) + hp.eps);
+  } else if (Type == OptimizerType::RMSPROP) {
+    s1 = hp.rho * s1 + (1 - hp.rho) * g * g;
+    p -= hp.lr * g / (std::sqrt(s1) + hp.eps);
+  } else if (Type == OptimizerType::ADADELTA) {
+    s1 = hp.rho * s1 + (1 - hp.rho) * g * g;
+    Float delta = std::sqrt(s2 + hp.eps) / std::sqrt(s1 + hp.eps) * g;
+    p -= hp.lr * delta;
+    s2 = hp.rho * s2 + (1 - hp.rho) * delta * delta;
+  }
+}
+
+template <OptimizerType Type, class Float>
+void computeChunks(
+    const OptimizerHyperParams& hp,
+    const std::vector<std::pair<int, int64_t>>& chunks,
+    const int64_t* sizes,
+    const std::vector<int64_t>& offsets,
+    Float* const* params,
+    const Float* const* grads,
+    Float* state1,
+    Float* state2) {
+#pragma omp parallel for schedule(static)
+  for (int c = 0; c < chunks.size(); ++c) {
+    int tensor = chunks[c].first;
+    int64_t start = chunks[c].second;
+    int64_t end = std::min(start + kChunkSize, sizes[tensor]);
+    auto* param = params[tensor];
+    const auto* grad = grads[tensor];
+    auto* s1 = state1 ? state1 + offsets[tensor] : nullptr;
+    auto* s2 = state2 ? state2 + offsets[tensor] : nullptr;
+    for (int64_t i = start; i < end; ++i) {
+      Float unused1 = 0, unused2 = 0;
+      update<Type>(
+          hp, param[i], grad[i], s1 ? s1[i] : unused1, s2 ? s2[i] : unused2);
+    }
+  }
+}
+
+} // namespace
+
+namespace w2l {
+namespace cpu {
+
+template <class Float>
+void MultiTensorStep<Float>::compute(
+    OptimizerType type,
+    const OptimizerHyperParams& hp,
+    int nTensors,
+    const int64_t* sizes,
+    Float* const* params,
+    const Float* const* grads,
+    Float* state1,
+    Float* state2) {
+  // Chunks (tensor, first element) of the tensors with a gradient
+  std::vector<std::pair<int, int64_t>> chunks;
+  std::vector<int64_t> offsets(nTensors);
+  int64_t offset = 0;
+  for (int i = 0; i < nTensors; ++i) {
+    offsets[i] = offset;
+    offset += sizes[i];
+    if (!grads[i]) {
+      continue;
+    }
+    for (int64_t start = 0; start < sizes[i]; start += kChunkSize) {
+      chunks.emplace_back(i, start);
+    }
+  }
+
+  switch (type) {
+    case OptimizerType::SGD:
+      computeChunks<OptimizerType::SGD>(
+          hp, chunks, sizes, offsets, params, grads, state1, state2);
+      break;
+    case OptimizerType::ADAM:
+      computeChunks<OptimizerType::ADAM>(
+          hp, chunks, sizes, offsets, params, grads, state1, state2);
+      break;
+    case OptimizerType::RMSPROP:
+      computeChunks<OptimizerType::RMSPROP>(
+          hp, chunks, sizes, offsets, params, grads, state1, state2);
+      break;
+    case OptimizerType::ADADELTA:
+      computeChunks<OptimizerType::ADADELTA>(
+          hp, chunks, sizes, offsets, params, grads, state1, state2);
+      break;
+  }
+}
+
+template struct MultiTensorStep<float>;
+template struct MultiTensorStep<double>;
+
+} // namespace cpu
+} // namespace w2l
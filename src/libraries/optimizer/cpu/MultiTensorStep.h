@@ -0,0 +1,33 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include "libraries/optimizer/Defines.h"
+
+namespace w2l {
+namespace cpu {
+
+/// Check CUDA header for docs.
+template <class Float>
+struct MultiTensorStep {
+  static void compute(
+      OptimizerType type,
+      const OptimizerHyperParams& hp,
+      int nTensors,
+      const int64_t* sizes,
+      Float* const* params,
+      const Float* const* grads,
+      Float* state1,
+      Float* state2);
+};
+
+} // namespace cpu
+} // namespace w2l
@@ -0,0 +1,201 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "libraries/optimizer/cuda/MultiTensorStep.cuh"
+
+#include <vector>
+
+#include "libraries/common/Workspace.h"
+
+namespace {
+
+using w2l::OptimizerHyperParams;
+using w2l::OptimizerType;
+
+constexpr int kBlockSize = 256;
+constexpr int64_t kChunkSize = 65536;
+
+template <class Float>
+struct TensorInfo {
+  Float* param;
+  const Float* grad;
+  int64_t offset; // in the states
+  int64_t size;
+};
+
+struct ChunkInfo {
+  int tensor;
+  int64_t start;
+};
+
+int64_t countChunks(int nTensors, const int64_t* sizes) {
+  int64_t nChunks = 0;
+  for (int i = 0; i < nTensors; ++i) {
+    nChunks += (sizes[i] + kChunkSize - 1) / kChunkSize;
+  }
+  return nChunks;
+}
+
+template <class Float>
+struct WorkspacePtrs {
+  explicit WorkspacePtrs(void* workspace, int nTensors, int64_t nChunks) {
+    w2l::Workspace<> ws(workspace);
+    ws.request(&tensors, nTensors);
+    ws.request(&chunks, nChunks);
+    requiredSize = ws.requiredSize();
+  }
+
+  TensorInfo<Float>* tensors;
+  ChunkInfo* chunks;
+  size_t requiredSize;
+};
+
+/* Update of an element `p` with gradient `g` and states `s1`, `s2` */
+template <OptimizerType Type, class Float>
+__device__ void update(
+    const OptimizerHyperParams& hp,
+    Float& p,
+    Float g,
+    Float& s1,
+    Float& s2) {
+  if (Type == OptimizerType::SGD) {
+    g += hp.weightDecay * p;
+    if (hp.momentum != 0) {
+      s1 = hp.momentum * s1 + g;
+      g = s1;
+    }
+    p -= hp.lr * g;
+    return;
+  }
+
+  p -= hp.weightDecay * p;
+  if (Type == OptimizerType::ADAM) {
+    s1 = hp.beta1 * s1 + (1 - hp.beta1) * g;
+    s2 = hp.beta2 * s2 + (1 - hp.beta2) * g * g;
+    p -= hp.lr * s1 / (sqrt(s2) + hp.eps);
+  } else if (Type == OptimizerType::RMSPROP) {
+    s1 = hp.rho * s1 + (1 - hp.rho) * g * g;
+    p -= hp.lr * g / (sqrt(s1) + hp.eps);
+  } else if (Type == OptimizerType::ADADELTA) {
+    s1 = hp.rho * s1 + (1 - hp.rho) * g * g;
+    Float delta = sqrt(s2 + hp.eps) / sqrt(s1 + hp.eps) * g;
+    p -= hp.lr * delta;
+    s2 = hp.rho * s2 + (1 - hp.rho) * delta * delta;
+  }
+}
+
+/*
+ * nChunks thread blocks
+ * kBlockSize threads/block
+ */
+template <OptimizerType Type, class Float>
+__global__ void stepKernel(
+    OptimizerHyperParams hp,
+    Float* state1,
+    Float* state2,
+    WorkspacePtrs<Float> ws) {
+  auto chunk = ws.chunks[blockIdx.x];
+  auto tensor = ws.tensors[chunk.tensor];
+  int64_t end = min(chunk.start + kChunkSize, tensor.size);
+  auto* s1 = state1 ? state1 + tensor.offset : nullptr;
+  auto* s2 = state2 ? state2 + tensor.offset : nullptr;
+  for (int64_t i = chunk.start + threadIdx.x; i < end; i += blockDim.x) {
+    Float unused1 = 0, unused2 = 0;
+    update<Type>(
+        hp,
+        tensor.param[i],
+        tensor.grad[i],
+        s1 ? s1[i] : unused1,
+        s2 ? s2[i] : unused2);
+  }
+}
+
+} // namespace
+
+namespace w2l {
+namespace cuda {
+
+template <class Float>
+size_t MultiTensorStep<Float>::getWorkspaceSize(
+    int nTensors,
+    const int64_t* sizes) {
+  return WorkspacePtrs<Float>(nullptr, nTensors, countChunks(nTensors, sizes))
+      .requiredSize;
+}
+
+template <class Float>
+void MultiTensorStep<Float>::compute(
+    OptimizerType type,
+    const OptimizerHyperParams& hp,
+    int nTensors,
+    const int64_t* sizes,
+    Float* const* params,
+    const Float* const* grads,
+    Float* state1,
+    Float* state2,
+    void* workspace,
+    cudaStream_t stream) {
+  WorkspacePtrs<Float> ws(workspace, nTensors, countChunks(nTensors, sizes));
+
+  // The tables of the tensors and of the chunks of the tensors with a
+  // gradient, copied to the device at once
+  std::vector<TensorInfo<Float>> tensors(nTensors);
+  std::vector<ChunkInfo> chunks;
+  int64_t offset = 0;
+  for (int i = 0; i < nTensors; ++i) {
+    tensors[i] = {params[i], grads[i], offset, sizes[i]};
+    offset += sizes[i];
+    if (!grads[i]) {
+      continue;
+    }
+    for (int64_t start = 0; start < sizes[i]; start += kChunkSize) {
+      chunks.push_back({i, start});
+    }
+  }
+  if (chunks.empty()) {
+    return;
+  }
+  cudaMemcpyAsync(
+      ws.tensors,
+      tensors.data(),
+      nTensors * sizeof(TensorInfo<Float>),
+      cudaMemcpyHostToDevice,
+      stream);
+  cudaMemcpyAsync(
+      ws.chunks,
+      chunks.data(),
+      chunks.size() * sizeof(ChunkInfo),
+      cudaMemcpyHostToDevice,
+      stream);
+
+  int nChunks = chunks.size();
+  switch (type) {
+    case OptimizerType::SGD:
+      stepKernel<OptimizerType::SGD><<<nChunks, kBlockSize, 0, stream>>>(
+          hp, state1, state2, ws);
+      break;
+    case OptimizerType::ADAM:
+      stepKernel<OptimizerType::ADAM><<<nChunks, kBlockSize, 0, stream>>>(
+          hp, state1, state2, ws);
+      break;
+    case OptimizerType::RMSPROP:
+      stepKernel<OptimizerType::RMSPROP><<<nChunks, kBlockSize, 0, stream>>>(
+          hp, state1, state2, ws);
+      break;
+    case OptimizerType::ADADELTA:
+      stepKernel<OptimizerType::ADADELTA><<<nChunks, kBlockSize, 0, stream>>>(
+          hp, state1, state2, ws);
+      break;
+  }
+}
+
+template struct MultiTensorStep<float>;
+template struct MultiTensorStep<double>;
+
+} // namespace cuda
+} // namespace w2l
@@ -0,0 +1,64 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include <cuda_runtime.h>
+
+#include "libraries/optimizer/Defines.h"
+
+namespace w2l {
+namespace cuda {
+
+/**
+ * Updates a list of tensors of any sizes with one optimizer step, in a single
+ * kernel: the tensors are split into chunks of a fixed size, a chunk per
+ * thread block. The optimizer states of all the tensors are flat arrays,
+ * where the states of each tensor follow the ones of the previous tensor.
+ */
+template <class Float>
+struct MultiTensorStep {
+  /**
+   * nTensors: number of tensors
+   * sizes: [nTensors] number of elements of each tensor
+   */
+  static size_t getWorkspaceSize(int nTensors, const int64_t* sizes);
+
+  /**
+   * type: optimizer
+   * hp: hyper-parameters of the step
+   * nTensors: number of tensors
+   * sizes: [nTensors] (host) number of elements of each tensor
+   * params: [nTensors] (host) (in/out) tensors to update
+   * grads: [nTensors] (host) gradients of the tensors, null for the tensors
+   *   to leave unchanged
+   * state1: [sum(sizes)] (in/out) SGD velocity, Adam first moment, RMSProp
+   *   mean square, Adadelta mean squared gradient (null for SGD without
+   *   momentum)
+   * state2: [sum(sizes)] (in/out) Adam second moment, Adadelta mean squared
+   *   update (null for other optimizers)
+   * workspace: (in/out) internal workspace
+   * stream: CUDA stream
+   */
+  static void compute(
+      OptimizerType type,
+      const OptimizerHyperParams& hp,
+      int nTensors,
+      const int64_t* sizes,
+      Float* const* params,
+      const Float* const* grads,
+      Float* state1,
+      Float* state2,
+      void* workspace,
+      cudaStream_t stream);
+};
+
+} // namespace cuda
+} // namespace w2l
@@ -0,0 +1,114 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "module/CheckpointModule.h"
+
+#include <sstream>
+#include <stdexcept>
+
+using namespace fl;
+
+namespace w2l {
+
+namespace {
+
+std::vector<Variable> runSegment(
+    const std::vector<std::shared_ptr<Module>>& modules,
+    std::vector<Variable> values) {
+  for (const auto& module : modules) {
+    values = module->forward(values);
+  }
+  return values;
+}
+
+/* A seed for the random engine once the segment was run, derived from the
+ * seed of the segment so that the draws of the next layers still differ */
+unsigned long long resumeSeed(unsigned long long seed) {
+  return seed * 6364136223846793005ULL + 1442695040888963407ULL;
+}
+
+} // namespace
+
+CheckpointModule::CheckpointModule(
+    const std::vector<std::shared_ptr<Module>>& modules) {
+  if (modules.empty()) {
+    throw std::invalid_argument("CheckpointModule: empty segment");
+  }
+  for (const auto& module : modules) {
+    add(module);
+  }
+}
+
+std::vector<Variable> CheckpointModule::forward(
+    const std::vector<Variable>& inputs) {
+  if (!train_) {
+    return runSegment(modules_, inputs);
+  }
+
+  auto seed = af::randu(1, u64).scalar<unsigned long long>();
+  // The graph of the segment is freed once its outputs are copied
+  std::vector<Variable> detached;
+  bool calcGrad = false;
+  for (const auto& input : inputs) {
+    detached.emplace_back(input.array(), false);
+    calcGrad |= input.isCalcGrad();
+  }
+  af::setSeed(seed);
+  auto outputs = runSegment(modules_, detached);
+  af::setSeed(resumeSeed(seed));
+  if (outputs.size() != 1) {
+    throw std::invalid_argument(
+        "CheckpointModule: segments must have a single output");
+  }
+
+  // The params are only reached by the backward of the segment run again,
+  // but the output needs a gradient as soon as one of them does
+  std::vector<Variable> nodeInputs(inputs);
+  for (const auto& param : params()) {
+    calcGrad |= param.isCalcGrad();
+  }
+  if (calcGrad) {
+    nodeInputs.emplace_back(af::constant(0, 1), true);
+  }
+  int numInputs = inputs.size();
+  auto modules = modules_;
+  auto gradFunc = [modules, seed, numInputs](
+                      std::vector<Variable>& gradInputs,
+                      const Variable& gradOutput) {
+    std::vector<Variable> recomputed;
+    for (int i = 0; i < numInputs; ++i) {
+      recomputed.emplace_back(
+          gradInputs[i].array(), gradInputs[i].isCalcGrad());
+    }
+    af::setSeed(seed);
+    auto output = runSegment(modules, recomputed).front();
+    af::setSeed(resumeSeed(resumeSeed(seed)));
+    output.backward(gradOutput);
+    for (int i = 0; i < numInputs; ++i) {
+      if (recomputed[i].isGradAvailable()) {
+        gradInputs[i].addGrad(Variable(recomputed[i].grad().array(), false));
+      }
+    }
+  };
+  return {Variable(outputs.front().array(), nodeInputs, gradFunc)};
+}
+
+std::string CheckpointModule::prettyString() const {
+  std::ostringstream ss;
+  ss << "Checkpoint [input";
+  for (int i = 0; i < modules_.size(); ++i) {
+    ss << " -> (" << i << ")";
+  }
+  ss << " -> output]";
+  for (int i = 0; i < modules_.size(); ++i) {
+    ss << "\n\t(" << i << "): " << modules_[i]->prettyString();
+  }
+  return ss.str();
+}
+
+} // namespace w2l
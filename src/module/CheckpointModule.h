@@ -0,0 +1,52 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <flashlight/flashlight.h>
+
+namespace w2l {
+
+/**
+ * A segment of layers run in sequence whose activations aren't kept for the
+ * backward in train mode: only the inputs of the segment are, and the forward
+ * of the segment is run again in the backward to compute its gradients. This
+ * trades an extra forward of the segment for the memory of its activations.
+ *
+ * The random engine is reseeded for the forward of the segment so that the
+ * dropout masks are the same when it is run again; running statistics, such as
+ * the ones of batch normalization, are updated by both runs. In eval mode, the
+ * segment is run as a `fl::Sequential`.
+ *
+ * In architecture files, `CKPT N` followed by N layers (each possibly spanning
+ * several lines, such as residual blocks) makes a checkpointed segment.
+ */
+class CheckpointModule : public fl::Container {
+ private:
+  CheckpointModule() = default;
+
+  FL_SAVE_LOAD_WITH_BASE(fl::Container)
+
+ public:
+  explicit CheckpointModule(
+      const std::vector<std::shared_ptr<fl::Module>>& modules);
+
+  /* Only segments with a single output are checkpointed */
+  std::vector<fl::Variable> forward(
+      const std::vector<fl::Variable>& inputs) override;
+
+  std::string prettyString() const override;
+};
+
+} // namespace w2l
+
+CEREAL_REGISTER_TYPE(w2l::CheckpointModule)
@@ -8,12 +8,404 @@
 
 #include "module/ConvLmModule.h"
 
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <numeric>
 #include <string>
+#include <unordered_map>
 
-#include "common/FlashlightUtils.h"
+#include <glog/logging.h>
 
+#include "common/FlashlightUtils.h"
 
 namespace w2l {
+
+namespace {
+
+// Length of the histories forwarded to probe the layers of the network
+constexpr int kProbeLength = 48;
+
+/* Elements [begin, end) along `axis` */
+af::array sliceAxis(const af::array& a, int axis, int64_t begin, int64_t end) {
+  std::vector<af::index> idx(4);
+  idx[axis] = af::seq(begin, end - 1);
+  return a(idx[0], idx[1], idx[2], idx[3]);
+}
+
+af::array concatAxis(const std::vector<af::array>& arrays, int axis) {
+  if (arrays.size() == 1) {
+    return arrays[0];
+  }
+  std::vector<fl::Variable> vars;
+  vars.reserve(arrays.size());
+  for (const auto& a : arrays) {
+    vars.emplace_back(a, false);
+  }
+  return fl::concatenate(vars, axis).array();
+}
+
+/* The axis along which `a` and `b` differ, -1 if it's not a single one */
+int differingAxis(const af::dim4& a, const af::dim4& b) {
+  int axis = -1;
+  for (int i = 0; i < 4; ++i) {
+    if (a[i] != b[i]) {
+      if (axis >= 0) {
+        return -1;
+      }
+      axis = i;
+    }
+  }
+  return axis;
+}
+
+uint64_t extendHash(uint64_t hash, int token) {
+  return hash ^
+      (static_cast<uint64_t>(token) + 0x9e3779b97f4a7c15ULL + (hash << 6) +
+       (hash >> 2));
+}
+
+/**
+ * Scores ConvLM histories by extending the cached outputs of the layers at
+ * the positions of their prefixes (see buildIncrementalConvLmScoreFunction).
+ */
+class IncrementalConvLm {
+ public:
+  IncrementalConvLm(std::shared_ptr<fl::Sequential> network, size_t cacheSize)
+      : layers_(network->modules()), cacheSize_(cacheSize) {
+    probe();
+  }
+
+  /* false if the layers can't be run on the last positions of a history */
+  bool isIncremental() const {
+    return incremental_;
+  }
+
+  /* Number of tokens which the last output reads, if isIncremental() */
+  int historySize() const {
+    int size = 1;
+    for (int receptiveField : receptiveFields_) {
+      size += receptiveField - 1;
+    }
+    return size;
+  }
+
+  std::vector<std::vector<float>> score(
+      const std::vector<int>& inputs,
+      const std::vector<int>& lastTokenPositions,
+      int sampleSize,
+      int batchSize);
+
+ private:
+  // The outputs of each layer at the last position of a history
+  using Node = std::vector<af::array>;
+  using NodePtr = std::shared_ptr<Node>;
+
+  struct History {
+    const int* tokens;
+    int length;
+    std::vector<uint64_t> keys; // of each prefix
+    // The nodes of the positions [length - 1 - context.size(), length - 1)
+    std::vector<NodePtr> context;
+    NodePtr node;
+  };
+
+  std::vector<std::shared_ptr<fl::Module>> layers_;
+  // Of the input of each layer, and of the output of the last one
+  std::vector<int> timeAxes_;
+  std::vector<int> batchAxes_;
+  // Number of input positions which an output position of a layer reads
+  std::vector<int> receptiveFields_;
+  int maxReceptiveField_ = 1;
+  bool incremental_ = true;
+
+  size_t cacheSize_;
+  // The nodes used since the cache was last full, and the ones before
+  std::unordered_map<uint64_t, NodePtr> cache_;
+  std::unordered_map<uint64_t, NodePtr> oldCache_;
+
+  NodePtr find(uint64_t key);
+  void insert(uint64_t key, NodePtr node);
+
+  /* The output of each layer */
+  std::vector<af::array> forwardLayers(const af::array& tokens) const;
+
+  /* Sets the time and batch axes and the receptive fields of the layers */
+  void probe();
+
+  /* Forwards the whole histories, caching the nodes of all their positions */
+  void forwardFull(const std::vector<History*>& histories);
+
+  /* Forwards the last position of histories whose context is cached */
+  void forwardStep(const std::vector<History*>& histories);
+};
+
+IncrementalConvLm::NodePtr IncrementalConvLm::find(uint64_t key) {
+  auto it = cache_.find(key);
+  if (it != cache_.end()) {
+    return it->second;
+  }
+  it = oldCache_.find(key);
+  if (it == oldCache_.end()) {
+    return nullptr;
+  }
+  auto node = it->second;
+  insert(key, node);
+  return node;
+}
+
+void IncrementalConvLm::insert(uint64_t key, NodePtr node) {
+  if (cache_.size() >= cacheSize_) {
+    oldCache_ = std::move(cache_);
+    cache_.clear();
+  }
+  cache_[key] = std::move(node);
+}
+
+std::vector<af::array> IncrementalConvLm::forwardLayers(
+    const af::array& tokens) const {
+  std::vector<af::array> outputs;
+  outputs.reserve(layers_.size());
+  af::array x = tokens;
+  for (const auto& layer : layers_) {
+    x = layer->forward({fl::Variable(x, false)}).front().array();
+    outputs.push_back(x);
+  }
+  return outputs;
+}
+
+void IncrementalConvLm::probe() {
+  auto tokens = [](int64_t length, int64_t batchSize) {
+    return af::constant(1, length, batchSize, s32);
+  };
+  auto base = forwardLayers(tokens(kProbeLength, 1));
+  auto longer = forwardLayers(tokens(kProbeLength + 1, 1));
+  auto wider = forwardLayers(tokens(kProbeLength, 2));
+
+  timeAxes_ = {0};
+  batchAxes_ = {1};
+  for (size_t m = 0; m < layers_.size(); ++m) {
+    timeAxes_.push_back(differingAxis(base[m].dims(), longer[m].dims()));
+    batchAxes_.push_back(differingAxis(base[m].dims(), wider[m].dims()));
+    if (timeAxes_.back() < 0 || batchAxes_.back() < 0 ||
+        base[m].dims(timeAxes_.back()) != kProbeLength) {
+      incremental_ = false;
+      return;
+    }
+  }
+
+  // Perturbs a position of the input of each layer and looks for the output
+  // positions which change
+  af::array input = tokens(kProbeLength, 1);
+  for (size_t m = 0; m < layers_.size(); ++m) {
+    int inAxis = timeAxes_[m], outAxis = timeAxes_[m + 1];
+    int receptiveField = 1;
+    for (int q : {0, kProbeLength / 4, kProbeLength / 2}) {
+      std::vector<af::index> idx(4);
+      idx[inAxis] = q;
+      af::array perturbed = input.copy();
+      if (input.type() == s32) {
+        perturbed(idx[0], idx[1], idx[2], idx[3]) = 2;
+      } else {
+        auto frame = sliceAxis(input, inAxis, q, q + 1);
+        perturbed(idx[0], idx[1], idx[2], idx[3]) =
+            frame + af::randn(frame.dims(), frame.type());
+      }
+      auto output =
+          layers_[m]->forward({fl::Variable(perturbed, false)}).front().array();
+      af::array changed =
+          af::abs(output - base[m]) > 1e-5 * (1 + af::abs(base[m]));
+      for (int ax = 0; ax < 4; ++ax) {
+        if (ax != outAxis) {
+          changed = af::anyTrue(changed, ax);
+        }
+      }
+      auto changedFrames = afToVector<int>(af::flat(changed).as(s32));
+      for (int t = 0; t < kProbeLength; ++t) {
+        if (!changedFrames[t]) {
+          continue;
+        }
+        if (t < q || t == kProbeLength - 1) {
+          // Not causal, or its receptive field may be unbounded
+          incremental_ = false;
+          return;
+        }
+        receptiveField = std::max(receptiveField, t - q + 1);
+      }
+    }
+    receptiveFields_.push_back(receptiveField);
+    maxReceptiveField_ = std::max(maxReceptiveField_, receptiveField);
+    input = base[m];
+  }
+}
+
+std::vector<std::vector<float>> IncrementalConvLm::score(
+    const std::vector<int>& inputs,
+    const std::vector<int>& lastTokenPositions,
+    int sampleSize,
+    int batchSize) {
+  std::vector<History> histories(batchSize);
+  // Index in `histories` of the first history of each key
+  std::unordered_map<uint64_t, int> firstIndices;
+  std::vector<History*> toForward, toStep;
+  for (int b = 0; b < batchSize; ++b) {
+    auto& history = histories[b];
+    history.tokens = inputs.data() + b * sampleSize;
+    history.length = lastTokenPositions[b] + 1;
+    uint64_t hash = 0;
+    for (int t = 0; t < history.length; ++t) {
+      hash = extendHash(hash, history.tokens[t]);
+      history.keys.push_back(hash);
+    }
+    if (!firstIndices.emplace(hash, b).second) {
+      continue; // computed for the first history with this key
+    }
+    history.node = find(hash);
+    if (history.node) {
+      continue;
+    }
+
+    int position = history.length - 1;
+    int contextStart = std::max(0, position - maxReceptiveField_ + 1);
+    bool cached = position > 0;
+    for (int t = contextStart; t < position && cached; ++t) {
+      history.context.push_back(find(history.keys[t]));
+      cached = history.context.back() != nullptr;
+    }
+    if (cached) {
+      toStep.push_back(&history);
+    } else {
+      history.context.clear();
+      toForward.push_back(&history);
+    }
+  }
+  if (!toForward.empty()) {
+    forwardFull(toForward);
+  }
+  if (!toStep.empty()) {
+    forwardStep(toStep);
+  }
+
+  std::vector<af::array> distributions;
+  for (auto& history : histories) {
+    auto& first = histories[firstIndices[history.keys.back()]];
+    distributions.push_back(af::flat(first.node->back()));
+  }
+  auto scores = afToVector<float>(concatAxis(distributions, 1));
+  for (float score : scores) {
+    if (std::isnan(score)) {
+      throw std::runtime_error("[ConvLM] Encountered NaNs in propagation");
+    }
+  }
+  size_t vocabSize = scores.size() / batchSize;
+  std::vector<std::vector<float>> result(batchSize);
+  for (int b = 0; b < batchSize; ++b) {
+    result[b].assign(
+        scores.begin() + b * vocabSize, scores.begin() + (b + 1) * vocabSize);
+  }
+  return result;
+}
+
+void IncrementalConvLm::forwardFull(const std::vector<History*>& histories) {
+  int maxLength = 0;
+  for (const auto* history : histories) {
+    maxLength = std::max(maxLength, history->length);
+  }
+  // The layers being causal, padding the end doesn't change the outputs
+  std::vector<int> tokens;
+  tokens.reserve(maxLength * histories.size());
+  for (const auto* history : histories) {
+    tokens.insert(
+        tokens.end(), history->tokens, history->tokens + history->length);
+    tokens.resize(
+        tokens.size() + maxLength - history->length,
+        history->tokens[history->length - 1]);
+  }
+  auto outputs =
+      forwardLayers(af::array(maxLength, histories.size(), tokens.data()));
+
+  for (size_t i = 0; i < histories.size(); ++i) {
+    auto* history = histories[i];
+    std::vector<af::array> sampleOutputs;
+    for (size_t m = 0; m < layers_.size(); ++m) {
+      sampleOutputs.push_back(
+          sliceAxis(outputs[m], batchAxes_[m + 1], i, i + 1));
+    }
+    for (int t = 0; t < history->length; ++t) {
+      auto node = t + 1 < history->length ? find(history->keys[t]) : nullptr;
+      if (node) {
+        continue;
+      }
+      node = std::make_shared<Node>();
+      for (size_t m = 0; m < layers_.size(); ++m) {
+        node->push_back(
+            sliceAxis(sampleOutputs[m], timeAxes_[m + 1], t, t + 1));
+      }
+      insert(history->keys[t], node);
+      history->node = node;
+    }
+  }
+}
+
+void IncrementalConvLm::forwardStep(const std::vector<History*>& histories) {
+  size_t n = histories.size();
+  for (auto* history : histories) {
+    history->node = std::make_shared<Node>();
+  }
+  for (size_t m = 0; m < layers_.size(); ++m) {
+    int inAxis = timeAxes_[m], outAxis = timeAxes_[m + 1];
+    // Histories by length of the window of the input of the layer
+    std::map<int, std::vector<size_t>> windows;
+    for (size_t i = 0; i < n; ++i) {
+      windows[std::min(histories[i]->length, receptiveFields_[m])].push_back(i);
+    }
+
+    for (const auto& window : windows) {
+      int w = window.first;
+      const auto& group = window.second;
+      af::array input;
+      if (m == 0) {
+        std::vector<int> tokens;
+        for (auto i : group) {
+          const auto* history = histories[i];
+          tokens.insert(
+              tokens.end(),
+              history->tokens + history->length - w,
+              history->tokens + history->length);
+        }
+        input = af::array(w, group.size(), tokens.data());
+      } else {
+        std::vector<af::array> samples;
+        for (auto i : group) {
+          const auto* history = histories[i];
+          const auto& context = history->context;
+          std::vector<af::array> frames;
+          for (int k = static_cast<int>(context.size()) - (w - 1);
+               k < static_cast<int>(context.size());
+               ++k) {
+            frames.push_back(context[k]->at(m - 1));
+          }
+          frames.push_back(history->node->at(m - 1));
+          samples.push_back(concatAxis(frames, inAxis));
+        }
+        input = concatAxis(samples, batchAxes_[m]);
+      }
+
+      auto output =
+          layers_[m]->forward({fl::Variable(input, false)}).front().array();
+      output = sliceAxis(output, outAxis, w - 1, w);
+      for (size_t k = 0; k < group.size(); ++k) {
+        histories[group[k]]->node->push_back(
+            sliceAxis(output, batchAxes_[m + 1], k, k + 1));
+      }
+    }
+  }
+  for (auto* history : histories) {
+    insert(history->keys.back(), history->node);
+  }
+}
+
+} // namespace
 GetConvLmScoreFunc buildGetConvLmScoreFunction(
     std::shared_ptr<fl::Module> network) {
   auto getConvLmScoreFunc = [network](
@@ -58,4 +450,215 @@ GetConvLmScoreFunc buildGetConvLmScoreFunction(
 
   return getConvLmScoreFunc;
 }
+
+GetConvLmCandidateScoreFunc buildCandidateConvLmScoreFunction(
+    std::shared_ptr<fl::Module> network) {
+  auto seq = std::dynamic_pointer_cast<fl::Sequential>(network);
+  std::shared_ptr<fl::AdaptiveSoftMax> softmax;
+  if (seq && !seq->modules().empty()) {
+    softmax =
+        std::dynamic_pointer_cast<fl::AdaptiveSoftMax>(seq->modules().back());
+  }
+  // The network without its adaptive softmax
+  auto body = std::make_shared<fl::Sequential>();
+  if (softmax) {
+    const auto& modules = seq->modules();
+    for (size_t i = 0; i + 1 < modules.size(); ++i) {
+      body->add(modules[i]);
+    }
+  }
+  auto getFullScores = buildGetConvLmScoreFunction(network);
+
+  return [body, softmax, getFullScores](
+             const std::vector<int>& inputs,
+             const std::vector<int>& lastTokenPositions,
+             const std::vector<std::vector<int>>& candidates,
+             int shortlistSize,
+             int sampleSize,
+             int batchSize) {
+    sampleSize = sampleSize > 0 ? sampleSize : inputs.size();
+    if (sampleSize * batchSize > inputs.size() ||
+        candidates.size() < batchSize || lastTokenPositions.size() < batchSize) {
+      throw std::invalid_argument(
+          "[ConvLM] Incorrect sample size (" + std::to_string(sampleSize) +
+          ") or batch size (" + std::to_string(batchSize) + ").");
+    }
+    // The tokens to score for each sample
+    std::vector<std::vector<int>> requests(batchSize);
+    for (int b = 0; b < batchSize; ++b) {
+      requests[b].resize(std::max(shortlistSize, 0));
+      std::iota(requests[b].begin(), requests[b].end(), 0);
+      requests[b].insert(
+          requests[b].end(), candidates[b].begin(), candidates[b].end());
+    }
+
+    std::vector<std::vector<float>> scores(batchSize);
+    if (!softmax) {
+      auto fullScores =
+          getFullScores(inputs, lastTokenPositions, sampleSize, batchSize);
+      for (int b = 0; b < batchSize; ++b) {
+        for (int token : requests[b]) {
+          scores[b].push_back(fullScores[b].at(token));
+        }
+      }
+      return scores;
+    }
+
+    af::array inputData(sampleSize, batchSize, inputs.data());
+    auto output = body->forward({fl::input(inputData)})[0].array();
+    // The hidden vectors of the last positions, (c b)
+    std::vector<int> columns(batchSize);
+    for (int b = 0; b < batchSize; ++b) {
+      if (lastTokenPositions[b] < 0 || lastTokenPositions[b] >= output.dims(1)) {
+        throw std::logic_error(
+            "[ConvLM]: trying the access to batch idx " + std::to_string(b) +
+            " and time idx " + std::to_string(lastTokenPositions[b]));
+      }
+      columns[b] = b * output.dims(1) + lastTokenPositions[b];
+    }
+    auto hidden = af::moddims(
+        output, output.dims(0), output.dims(1) * output.dims(2))(
+        af::span, af::array(batchSize, columns.data()));
+
+    // The params of the softmax are the head followed by the two projections
+    // of each tail cluster
+    auto cutoff = softmax->getCutoff();
+    auto params = softmax->params();
+    auto headLogProbs =
+        fl::logSoftmax(fl::matmul(params[0], fl::Variable(hidden, false)), 0)
+            .array();
+    int64_t headSize = headLogProbs.dims(0);
+
+    // Gathered on the device, in the order of `destinations` (b, j)
+    std::vector<af::array> gathered;
+    std::vector<std::pair<int, int>> destinations;
+    std::vector<int> headIndices;
+    std::vector<std::vector<std::pair<int, int>>> tailRequests(
+        cutoff.size() - 1);
+    for (int b = 0; b < batchSize; ++b) {
+      for (int j = 0; j < requests[b].size(); ++j) {
+        int token = requests[b][j];
+        if (token < 0 || token >= cutoff.back()) {
+          throw std::out_of_range(
+              "[ConvLM] Invalid token: " + std::to_string(token));
+        }
+        if (token < cutoff[0]) {
+          headIndices.push_back(b * headSize + token);
+          destinations.emplace_back(b, j);
+        } else {
+          int cluster =
+              std::upper_bound(cutoff.begin(), cutoff.end(), token) -
+              cutoff.begin() - 1;
+          tailRequests[cluster].emplace_back(b, j);
+        }
+      }
+    }
+    if (!headIndices.empty()) {
+      gathered.push_back(af::lookup(
+          af::flat(headLogProbs),
+          af::array(headIndices.size(), headIndices.data())));
+    }
+    for (int i = 0; i < tailRequests.size(); ++i) {
+      if (tailRequests[i].empty()) {
+        continue;
+      }
+      // Only the samples with candidates in the cluster are projected
+      std::vector<int> samples;
+      for (const auto& request : tailRequests[i]) {
+        if (samples.empty() || samples.back() != request.first) {
+          samples.push_back(request.first);
+        }
+      }
+      auto sampleHidden = fl::Variable(
+          hidden(af::span, af::array(samples.size(), samples.data())), false);
+      auto tailLogProbs = fl::logSoftmax(
+                              fl::matmul(
+                                  params[2 + 2 * i],
+                                  fl::matmul(params[1 + 2 * i], sampleHidden)),
+                              0)
+                              .array();
+      int clusterSize = cutoff[i + 1] - cutoff[i];
+      std::vector<int> tailIndices, clusterIndices;
+      for (const auto& request : tailRequests[i]) {
+        int k = std::lower_bound(samples.begin(), samples.end(), request.first) -
+            samples.begin();
+        int token = requests[request.first][request.second];
+        tailIndices.push_back(k * clusterSize + token - cutoff[i]);
+        clusterIndices.push_back(request.first * headSize + cutoff[0] + i);
+        destinations.push_back(request);
+      }
+      gathered.push_back(
+          af::lookup(
+              af::flat(tailLogProbs),
+              af::array(tailIndices.size(), tailIndices.data())) +
+          af::lookup(
+              af::flat(headLogProbs),
+              af::array(clusterIndices.size(), clusterIndices.data())));
+    }
+
+    for (int b = 0; b < batchSize; ++b) {
+      scores[b].resize(requests[b].size());
+    }
+    if (gathered.empty()) {
+      return scores;
+    }
+    auto flatScores = afToVector<float>(concatAxis(gathered, 0));
+    for (size_t i = 0; i < flatScores.size(); ++i) {
+      if (std::isnan(flatScores[i])) {
+        throw std::runtime_error("[ConvLM] Encountered NaNs in propagation");
+      }
+      scores[destinations[i].first][destinations[i].second] = flatScores[i];
+    }
+    return scores;
+  };
+}
+
+GetConvLmScoreFunc buildIncrementalConvLmScoreFunction(
+    std::shared_ptr<fl::Module> network,
+    int cacheSize /* = 100000 */) {
+  auto seq = std::dynamic_pointer_cast<fl::Sequential>(network);
+  if (!seq) {
+    LOG(WARNING) << "[ConvLM] The network isn't sequential, it's forwarded "
+                 << "over the whole histories";
+    return buildGetConvLmScoreFunction(network);
+  }
+  auto lm = std::make_shared<IncrementalConvLm>(seq, cacheSize);
+  if (!lm->isIncremental()) {
+    LOG(WARNING) << "[ConvLM] The layers of the network aren't all causal "
+                 << "with a bounded receptive field, it's forwarded over the "
+                 << "whole histories";
+    return buildGetConvLmScoreFunction(network);
+  }
+  return [lm](
+             const std::vector<int>& inputs,
+             const std::vector<int>& lastTokenPositions,
+             int sampleSize,
+             int batchSize) {
+    sampleSize = sampleSize > 0 ? sampleSize : inputs.size();
+    if (sampleSize * batchSize > inputs.size() ||
+        lastTokenPositions.size() < batchSize) {
+      throw std::invalid_argument(
+          "[ConvLM] Incorrect sample size (" + std::to_string(sampleSize) +
+          ") or batch size (" + std::to_string(batchSize) + ").");
+    }
+    for (int b = 0; b < batchSize; ++b) {
+      if (lastTokenPositions[b] < 0 || lastTokenPositions[b] >= sampleSize) {
+        throw std::logic_error(
+            "[ConvLM]: trying the access to batch idx " + std::to_string(b) +
+            " and time idx " + std::to_string(lastTokenPositions[b]));
+      }
+    }
+    return lm->score(inputs, lastTokenPositions, sampleSize, batchSize);
+  };
+}
+
+int convLmHistorySize(std::shared_ptr<fl::Module> network, int defaultSize) {
+  auto seq = std::dynamic_pointer_cast<fl::Sequential>(network);
+  if (!seq) {
+    return defaultSize;
+  }
+  IncrementalConvLm lm(seq, 0);
+  return lm.isIncremental() ? lm.historySize() : defaultSize;
+}
+
 } // namespace w2l
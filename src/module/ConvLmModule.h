@@ -19,4 +19,58 @@ using GetConvLmScoreFunc = std::function<std::vector<std::vector<
 GetConvLmScoreFunc buildGetConvLmScoreFunction(
     std::shared_ptr<fl::Module> network);
 
+using GetConvLmCandidateScoreFunc = std::function<std::vector<std::vector<
+    float>>(
+    const std::vector<int>&,
+    const std::vector<int>&,
+    const std::vector<std::vector<int>>&,
+    int,
+    int,
+    int)>;
+
+/**
+ * Scores only some tokens of the vocabulary: for each sample b, the tokens
+ * [0, shortlistSize) followed by the ones of candidates[b] (arguments: inputs,
+ * lastTokenPositions, candidates, shortlistSize, sampleSize, batchSize).
+ *
+ * If the last layer of the network is an `fl::AdaptiveSoftMax`, the rest of
+ * the network is forwarded and the log-probabilities are computed from its
+ * head for the shortlist and the candidates of the head, and from the tail
+ * clusters holding candidates only for the samples which need them. With the
+ * frequent tokens first (as in fairseq vocabularies), a shortlist within the
+ * head costs a small fraction of the full distribution. For other networks,
+ * the scores are gathered from the full output.
+ */
+GetConvLmCandidateScoreFunc buildCandidateConvLmScoreFunction(
+    std::shared_ptr<fl::Module> network);
+
+/**
+ * Same scores as buildGetConvLmScoreFunction(), computing each position of a
+ * history once. The output of each layer of the network at the last position
+ * of the histories scored so far is cached, keyed by the history. A history
+ * extending a cached one by a token is scored by running each layer only on
+ * the last positions of its input which its receptive field covers.
+ *
+ * The layers' receptive fields and time axes are probed when the function is
+ * built: the network must be sequential and each of its layers causal with a
+ * bounded receptive field (e.g. the GCNN LMs). Otherwise, or for histories
+ * without a cached parent (e.g. truncated to the max history size), the whole
+ * history is forwarded.
+ *
+ * @param cacheSize Number of histories whose outputs are kept, at least (the
+ *   cache keeps the ones used since it last reached this size)
+ */
+GetConvLmScoreFunc buildIncrementalConvLmScoreFunction(
+    std::shared_ptr<fl::Module> network,
+    int cacheSize = 100000);
+
+/**
+ * Number of tokens of a history which the output of `network` at its last
+ * position depends on: 1 + the sum of (receptive field - 1) of its layers,
+ * probed as for buildIncrementalConvLmScoreFunction(). Histories longer than
+ * this score the same. Returns `defaultSize` if the network isn't sequential
+ * with causal layers of bounded receptive field.
+ */
+int convLmHistorySize(std::shared_ptr<fl::Module> network, int defaultSize);
+
 } // namespace w2l
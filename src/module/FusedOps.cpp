@@ -0,0 +1,124 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "module/FusedOps.h"
+
+#include <stdexcept>
+
+using namespace fl;
+
+namespace w2l {
+
+Variable residualLayerNorm(
+    const Variable& input,
+    const Variable& residual,
+    const Variable& weight,
+    const Variable& bias,
+    bool includeTime,
+    float eps /* = 1e-5 */) {
+  if (input.dims() != residual.dims()) {
+    throw std::invalid_argument("residualLayerNorm: mismatched dims");
+  } else if (weight.elements() != 1 || bias.elements() != 1) {
+    throw std::invalid_argument(
+        "residualLayerNorm: the affine transform must be scalar");
+  } else if (
+      input.type() != f32 || residual.type() != f32 ||
+      weight.type() != f32 || bias.type() != f32) {
+    throw std::invalid_argument("residualLayerNorm: inputs must be float32");
+  }
+
+  int inner = includeTime ? 1 : input.dims(0);
+  af::array output, mean, rstd;
+  detail::residualLayerNormForward(
+      input.array(),
+      residual.array(),
+      weight.array(),
+      bias.array(),
+      inner,
+      eps,
+      output,
+      mean,
+      rstd);
+
+  auto gradFunc = [inner, mean, rstd](
+                      std::vector<Variable>& inputs,
+                      const Variable& gradOutput) {
+    af::array gradInput, gradWeight, gradBias;
+    detail::residualLayerNormBackward(
+        gradOutput.array(),
+        inputs[0].array(),
+        inputs[1].array(),
+        inputs[2].array(),
+        mean,
+        rstd,
+        inner,
+        gradInput,
+        gradWeight,
+        gradBias);
+    inputs[0].addGrad(Variable(gradInput, false));
+    inputs[1].addGrad(Variable(gradInput, false));
+    inputs[2].addGrad(Variable(gradWeight, false));
+    inputs[3].addGrad(Variable(gradBias, false));
+  };
+  return Variable(output, {input, residual, weight, bias}, gradFunc);
+}
+
+Variable linearReluDropout(
+    const Variable& input,
+    const Variable& weight,
+    const Variable& bias,
+    double ratio,
+    bool train) {
+  auto dims = input.dims();
+  int inDim = weight.dims(1);
+  int outDim = weight.dims(0);
+  if (dims[0] != inDim || bias.elements() != outDim) {
+    throw std::invalid_argument("linearReluDropout: mismatched dims");
+  }
+
+  // A matrix product, then a single JIT kernel for the rest
+  auto flatInput = af::moddims(input.array(), inDim, input.elements() / inDim);
+  auto output = af::matmul(weight.array(), flatInput);
+  output = af::max(
+      output + af::tile(bias.array(), 1, output.dims(1)),
+      af::constant(0, output.dims(), output.type()));
+  float scale = 1;
+  if (train && ratio > 0) {
+    scale = 1.0 / (1.0 - ratio);
+    output = output * scale * (af::randu(output.dims()) > ratio);
+  }
+  output.eval();
+
+  auto gradFunc = [dims, scale, output](
+                      std::vector<Variable>& inputs,
+                      const Variable& gradOutput) {
+    // The output is positive exactly where the ReLU and the mask let the
+    // gradient through
+    auto grad = af::moddims(gradOutput.array(), output.dims()) * scale *
+        (output > 0);
+    auto& x = inputs[0];
+    auto& w = inputs[1];
+    if (x.isCalcGrad()) {
+      x.addGrad(
+          Variable(af::moddims(af::matmulTN(w.array(), grad), dims), false));
+    }
+    if (w.isCalcGrad()) {
+      auto flatInput =
+          af::moddims(x.array(), w.dims(1), x.elements() / w.dims(1));
+      w.addGrad(Variable(af::matmulNT(grad, flatInput), false));
+    }
+    inputs[2].addGrad(Variable(
+        af::moddims(af::sum(grad, 1), inputs[2].dims()), false));
+  };
+  auto outDims = dims;
+  outDims[0] = outDim;
+  return Variable(
+      af::moddims(output, outDims), {input, weight, bias}, gradFunc);
+}
+
+} // namespace w2l
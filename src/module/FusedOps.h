@@ -0,0 +1,74 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <flashlight/flashlight.h>
+
+namespace w2l {
+
+/**
+ * LayerNorm(`input` + `residual`) with a scalar affine transform (`weight`
+ * and `bias` of one element), as `fl::LayerNorm` with the default axis size.
+ * Input/Output Dim: T x W x C x B, normalized over [T, W, C] if
+ * `includeTime`, else over [W, C] for each frame. One kernel on CUDA for the
+ * forward and one for the backward, which keeps only the statistics of each
+ * group rather than the intermediate tensors. (type: float)
+ */
+fl::Variable residualLayerNorm(
+    const fl::Variable& input,
+    const fl::Variable& residual,
+    const fl::Variable& weight,
+    const fl::Variable& bias,
+    bool includeTime,
+    float eps = 1e-5);
+
+/**
+ * Dropout(ReLU(`weight` * `input` + `bias`)) as `fl::Linear`, `fl::ReLU` and
+ * `fl::Dropout`, with the bias, the ReLU and the dropout mask applied in one
+ * elementwise pass. Only the output is kept for the backward: the gradient
+ * flows where it is positive. `ratio` is ignored unless `train`.
+ */
+fl::Variable linearReluDropout(
+    const fl::Variable& input,
+    const fl::Variable& weight,
+    const fl::Variable& bias,
+    double ratio,
+    bool train);
+
+namespace detail {
+
+/* Backend implementations of `residualLayerNorm`, on groups of N elements of
+ * stride `inner`. Forward: also returns the mean and the inverse standard
+ * deviation of each group. Backward: the gradient of the input (which is the
+ * one of the residual), of the weight and of the bias. */
+void residualLayerNormForward(
+    const af::array& input,
+    const af::array& residual,
+    const af::array& weight,
+    const af::array& bias,
+    int inner,
+    float eps,
+    af::array& output,
+    af::array& mean,
+    af::array& rstd);
+
+void residualLayerNormBackward(
+    const af::array& gradOutput,
+    const af::array& input,
+    const af::array& residual,
+    const af::array& weight,
+    const af::array& mean,
+    const af::array& rstd,
+    int inner,
+    af::array& gradInput,
+    af::array& gradWeight,
+    af::array& gradBias);
+
+} // namespace detail
+} // namespace w2l
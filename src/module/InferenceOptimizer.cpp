@@ -0,0 +1,156 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "module/InferenceOptimizer.h"
+
+#include <glog/logging.h>
+
+#include "common/Utils.h"
+#include "module/SpecAugment.h"
+
+using namespace fl;
+
+namespace w2l {
+
+namespace {
+
+/* Tiles `a` to the dims of `like`, along the axes where `a` has size 1 */
+af::array tileTo(const af::array& a, const af::dim4& like) {
+  af::dim4 tiles(1, 1, 1, 1);
+  for (int ax = 0; ax < 4; ++ax) {
+    tiles[ax] = a.dims(ax) == 1 ? like[ax] : 1;
+  }
+  return af::tile(a, tiles);
+}
+
+/* Layers which are identities in eval mode */
+bool isIdentity(const std::shared_ptr<Module>& module) {
+  return std::dynamic_pointer_cast<Dropout>(module) ||
+      std::dynamic_pointer_cast<SpecAugment>(module);
+}
+
+std::shared_ptr<Module> foldWeightNorms(std::shared_ptr<Module> module) {
+  if (auto wn = std::dynamic_pointer_cast<WeightNorm>(module)) {
+    return foldWeightNorms(unwrapWeightNorm(*wn));
+  }
+  if (auto seq = std::dynamic_pointer_cast<Sequential>(module)) {
+    auto folded = std::make_shared<Sequential>();
+    for (const auto& m : seq->modules()) {
+      if (!isIdentity(m)) {
+        folded->add(foldWeightNorms(m));
+      }
+    }
+    return folded;
+  }
+  return module;
+}
+
+bool isConvLine(const std::vector<std::string>& params) {
+  if (params.empty()) {
+    return false;
+  }
+  if (params[0] == "WN" && params.size() > 2) {
+    return isConvLine(
+        std::vector<std::string>(params.begin() + 2, params.end()));
+  }
+  return params[0] == "C" || params[0] == "C1" || params[0] == "C2";
+}
+
+/* Folds `bn`, normalizing the channels of the output of `conv`, into `conv` */
+bool foldBatchNorm(Conv2D& conv, BatchNorm& bn) {
+  if (conv.params().size() != 2) {
+    return false; // no bias to take the shift
+  }
+  auto weight = conv.param(0).array();
+  auto bias = conv.param(1).array();
+  int64_t nChannels = weight.dims(3);
+
+  // In eval mode bn(x) = scale * x + shift for each channel
+  bn.eval();
+  auto probe = [&](float value) {
+    return bn.forward(Variable(af::constant(value, 1, 1, nChannels, 1), false))
+        .array();
+  };
+  af::array shift = probe(0.0);
+  af::array scale = probe(1.0) - shift;
+
+  conv.setParams(
+      Variable(
+          weight * tileTo(af::moddims(scale, 1, 1, 1, nChannels), weight.dims()),
+          false),
+      0);
+  conv.setParams(Variable(bias * scale + shift, false), 1);
+  return true;
+}
+
+} // namespace
+
+std::shared_ptr<Module> unwrapWeightNorm(const WeightNorm& wn) {
+  auto module = wn.module();
+  auto v = wn.param(0).array();
+  auto g = wn.param(1).array();
+  // `g` has a size of 1 on the axes over which `v` is normalized
+  af::array norm = v * v;
+  for (int ax = 0; ax < 4; ++ax) {
+    if (g.dims(ax) == 1) {
+      norm = af::sum(norm, ax);
+    }
+  }
+  auto weight = v * tileTo(g / af::sqrt(norm), v.dims());
+  module->setParams(Variable(weight, false), 0);
+  if (wn.params().size() > 2) {
+    module->setParams(Variable(wn.param(2).array(), false), 1);
+  }
+  return module;
+}
+
+std::shared_ptr<Sequential> optimizeForInference(
+    std::shared_ptr<Sequential> net,
+    const std::vector<std::string>& archLines) {
+  net->eval();
+  auto modules = net->modules();
+  bool withLines = archLines.size() == modules.size();
+  LOG_IF(WARNING, !withLines)
+      << "[optimizeForInference] the architecture doesn't have one line per "
+      << "layer of the network, batch normalizations won't be folded";
+
+  auto optimized = std::make_shared<Sequential>();
+  int nFoldedBatchNorms = 0, nRemoved = 0;
+  for (size_t i = 0; i < modules.size(); ++i) {
+    if (isIdentity(modules[i])) {
+      ++nRemoved;
+      continue;
+    }
+    auto module = foldWeightNorms(modules[i]);
+    optimized->add(module);
+    if (!withLines || i + 1 == modules.size()) {
+      continue;
+    }
+
+    auto params = splitOnWhitespace(archLines[i], true);
+    if (!isConvLine(params)) {
+      continue;
+    }
+    auto next = splitOnWhitespace(archLines[i + 1], true);
+    auto conv = std::dynamic_pointer_cast<Conv2D>(module);
+    auto bn = std::dynamic_pointer_cast<BatchNorm>(modules[i + 1]);
+    if (conv && bn && next.size() == 3 && next[0] == "BN" && next[2] == "2" &&
+        foldBatchNorm(*conv, *bn)) {
+      ++nFoldedBatchNorms;
+      ++i; // skip the batch normalization
+    }
+  }
+  optimized->eval();
+
+  VLOG(1) << "[optimizeForInference] " << modules.size() << " layers -> "
+          << optimized->modules().size() << " layers, " << nFoldedBatchNorms
+          << " batch normalizations folded, " << nRemoved << " layers removed";
+  return optimized;
+}
+
+} // namespace w2l
@@ -0,0 +1,49 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <flashlight/flashlight.h>
+
+namespace w2l {
+
+/**
+ * Rewrites a network built by `createW2lSeqModule` into a network computing
+ * the same function in eval mode with fewer layers:
+ * - weight normalized layers (WN) are replaced by their layer holding the
+ *   normalized weights,
+ * - batch normalizations over the channels (BN 2) following a convolution with
+ *   a bias are folded into the weights and bias of the convolution,
+ * - dropout (DO) and SpecAugment (SAUG), which are identities in eval mode, are
+ *   removed.
+ *
+ * Weight normalizations and dropouts nested in sequential layers are
+ * rewritten too. Batch normalizations are only folded when `archLines` has one
+ * line per layer of the network (no residual block).
+ *
+ * The returned network shares its layers with `net`, whose folded
+ * convolutions are modified in place: `net` shouldn't be used afterwards.
+ *
+ * @param net The network
+ * @param archLines The lines of its architecture, as `readW2lArch` returns
+ */
+std::shared_ptr<fl::Sequential> optimizeForInference(
+    std::shared_ptr<fl::Sequential> net,
+    const std::vector<std::string>& archLines);
+
+/**
+ * The layer of a weight normalization, with the normalized weights in place of
+ * its own.
+ */
+std::shared_ptr<fl::Module> unwrapWeightNorm(const fl::WeightNorm& wn);
+
+} // namespace w2l
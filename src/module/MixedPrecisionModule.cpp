@@ -0,0 +1,74 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "module/MixedPrecisionModule.h"
+
+using namespace fl;
+
+namespace w2l {
+
+MixedPrecisionModule::MixedPrecisionModule(std::shared_ptr<Module> module) {
+  add(std::move(module));
+}
+
+std::vector<Variable> MixedPrecisionModule::forward(
+    const std::vector<Variable>& inputs) {
+  auto module = modules_.front();
+  // The master weights, restored after the forward
+  auto params = module->params();
+  auto restoreParams = [&]() {
+    for (int i = 0; i < params.size(); ++i) {
+      module->setParams(params[i], i);
+    }
+  };
+  for (int i = 0; i < params.size(); ++i) {
+    module->setParams(params[i].as(f16), i);
+  }
+  std::vector<Variable> halfInputs;
+  for (const auto& input : inputs) {
+    halfInputs.push_back(input.as(f16));
+  }
+  std::vector<Variable> outputs;
+  try {
+    outputs = module->forward(halfInputs);
+  } catch (...) {
+    restoreParams();
+    throw;
+  }
+  restoreParams();
+  for (auto& output : outputs) {
+    output = output.as(f32);
+  }
+  return outputs;
+}
+
+std::string MixedPrecisionModule::prettyString() const {
+  return "MixedPrecision (fp16) " + modules_.front()->prettyString();
+}
+
+std::shared_ptr<Module> toMixedPrecision(std::shared_ptr<Module> net) {
+  auto seq = std::dynamic_pointer_cast<Sequential>(net);
+  if (!seq) {
+    return net;
+  }
+  auto mixed = std::make_shared<Sequential>();
+  for (const auto& module : seq->modules()) {
+    if (std::dynamic_pointer_cast<Linear>(module) ||
+        std::dynamic_pointer_cast<Conv2D>(module) ||
+        std::dynamic_pointer_cast<WeightNorm>(module)) {
+      mixed->add(std::make_shared<MixedPrecisionModule>(module));
+    } else if (std::dynamic_pointer_cast<Sequential>(module)) {
+      mixed->add(toMixedPrecision(module));
+    } else {
+      mixed->add(module);
+    }
+  }
+  return mixed;
+}
+
+} // namespace w2l
@@ -0,0 +1,50 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <flashlight/flashlight.h>
+
+namespace w2l {
+
+/**
+ * Runs a `Linear` or `Conv2D` layer, possibly weight normalized, in fp16 for
+ * mixed-precision training: its inputs and params are cast to fp16 for the
+ * forward and its outputs back to fp32. The params of the layer stay fp32,
+ * they are the master weights updated by the optimizers, and the casts pass
+ * the gradients through in the type of their inputs.
+ */
+class MixedPrecisionModule : public fl::Container {
+ private:
+  MixedPrecisionModule() = default;
+
+  FL_SAVE_LOAD_WITH_BASE(fl::Container)
+
+ public:
+  explicit MixedPrecisionModule(std::shared_ptr<fl::Module> module);
+
+  std::vector<fl::Variable> forward(
+      const std::vector<fl::Variable>& inputs) override;
+
+  std::string prettyString() const override;
+};
+
+/**
+ * Wraps the `Linear`, `Conv2D` and `WeightNorm` layers of a network, possibly
+ * nested in sequential layers, in `MixedPrecisionModule`s. The network shares
+ * the params of `net`. Returns `net` if it isn't sequential.
+ */
+std::shared_ptr<fl::Module> toMixedPrecision(std::shared_ptr<fl::Module> net);
+
+} // namespace w2l
+
+CEREAL_REGISTER_TYPE(w2l::MixedPrecisionModule)
@@ -0,0 +1,168 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "module/ModuleProfiler.h"
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+#include "libraries/common/Utils.h"
+
+using namespace fl;
+
+namespace w2l {
+
+namespace {
+
+size_t bytesInUse() {
+  size_t allocBytes, allocBuffers, lockBytes, lockBuffers;
+  af::deviceMemInfo(&allocBytes, &allocBuffers, &lockBytes, &lockBuffers);
+  return lockBytes;
+}
+
+double elapsedMs(af::timer start) {
+  af::sync();
+  return af::timer::stop(start) * 1000;
+}
+
+std::string dimsString(const af::dim4& dims) {
+  std::ostringstream ss;
+  ss << dims[0] << "x" << dims[1] << "x" << dims[2] << "x" << dims[3];
+  return ss.str();
+}
+
+double toMb(size_t bytes) {
+  return bytes / double(1 << 20);
+}
+
+} // namespace
+
+std::vector<LayerProfile> profileModule(
+    std::shared_ptr<Module> module,
+    const af::dim4& inputDims,
+    int iters /* = 5 */) {
+  if (iters < 1) {
+    throw std::invalid_argument("profileModule: iters should be positive");
+  }
+  std::vector<std::shared_ptr<Module>> layers;
+  auto seq = std::dynamic_pointer_cast<Sequential>(module);
+  if (seq) {
+    layers = seq->modules();
+  } else {
+    layers.push_back(module);
+  }
+  module->train();
+
+  std::vector<LayerProfile> profiles(layers.size());
+  for (size_t i = 0; i < layers.size(); ++i) {
+    // The first line of the layers spanning several ones
+    auto name = layers[i]->prettyString();
+    profiles[i].name = name.substr(0, name.find('\n'));
+    for (const auto& p : layers[i]->params()) {
+      profiles[i].numParams += p.elements();
+    }
+  }
+
+  for (int iter = 0; iter <= iters; ++iter) {
+    // Run 0 warms up the kernels and the allocator, only its memory is kept
+    bool timed = iter > 0;
+    std::vector<Variable> inputs, outputs;
+    af::deviceGC();
+    size_t baseBytes = bytesInUse();
+    auto input = Variable(af::randn(inputDims), false);
+    af::sync();
+    for (size_t i = 0; i < layers.size(); ++i) {
+      auto& prof = profiles[i];
+      // A leaf, so that the backward of the layer stops at its input
+      inputs.emplace_back(input.array(), true);
+      size_t before = bytesInUse();
+      auto start = af::timer::start();
+      outputs.push_back(layers[i]->forward({inputs.back()}).front());
+      double ms = elapsedMs(start);
+      if (timed) {
+        prof.fwdMs += ms / iters;
+      } else {
+        size_t after = bytesInUse();
+        prof.outputDims = outputs.back().dims();
+        prof.activationBytes = outputs.back().bytes();
+        prof.retainedBytes = after > before ? after - before : 0;
+        prof.peakBytes = after > baseBytes ? after - baseBytes : 0;
+      }
+      input = outputs.back();
+    }
+    for (size_t i = layers.size(); i-- > 0;) {
+      auto grad =
+          Variable(af::randn(outputs[i].dims(), outputs[i].type()), false);
+      auto start = af::timer::start();
+      outputs[i].backward(grad);
+      double ms = elapsedMs(start);
+      if (timed) {
+        profiles[i].bwdMs += ms / iters;
+      }
+      outputs[i] = Variable();
+      inputs[i] = Variable();
+    }
+    module->zeroGrad();
+  }
+  af::deviceGC();
+  return profiles;
+}
+
+std::string profileTable(const std::vector<LayerProfile>& profiles) {
+  std::ostringstream ss;
+  ss << format(
+            "%4s %10s %10s %10s %10s %10s %12s %-20s %s",
+            "#",
+            "fwd(ms)",
+            "bwd(ms)",
+            "act(MB)",
+            "kept(MB)",
+            "peak(MB)",
+            "params",
+            "output",
+            "layer")
+     << "\n";
+  LayerProfile total;
+  total.name = "total";
+  for (size_t i = 0; i < profiles.size(); ++i) {
+    const auto& p = profiles[i];
+    ss << format(
+              "%4zu %10.3f %10.3f %10.2f %10.2f %10.2f %12lld %-20s %s",
+              i,
+              p.fwdMs,
+              p.bwdMs,
+              toMb(p.activationBytes),
+              toMb(p.retainedBytes),
+              toMb(p.peakBytes),
+              static_cast<long long>(p.numParams),
+              dimsString(p.outputDims).c_str(),
+              p.name.c_str())
+       << "\n";
+    total.fwdMs += p.fwdMs;
+    total.bwdMs += p.bwdMs;
+    total.activationBytes += p.activationBytes;
+    total.retainedBytes += p.retainedBytes;
+    total.peakBytes = std::max(total.peakBytes, p.peakBytes);
+    total.numParams += p.numParams;
+  }
+  ss << format(
+      "%4s %10.3f %10.3f %10.2f %10.2f %10.2f %12lld %-20s %s",
+      "",
+      total.fwdMs,
+      total.bwdMs,
+      toMb(total.activationBytes),
+      toMb(total.retainedBytes),
+      toMb(total.peakBytes),
+      static_cast<long long>(total.numParams),
+      "",
+      total.name.c_str());
+  return ss.str();
+}
+
+} // namespace w2l
@@ -0,0 +1,52 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <flashlight/flashlight.h>
+
+namespace w2l {
+
+/* Measures of a layer of a network, see profileModule() */
+struct LayerProfile {
+  std::string name;
+  af::dim4 outputDims;
+  int64_t numParams = 0;
+  double fwdMs = 0;
+  double bwdMs = 0;
+  // Bytes of the output of the layer
+  size_t activationBytes = 0;
+  // Device bytes the layer keeps in use after its forward, for its backward
+  size_t retainedBytes = 0;
+  // Device bytes in use after the forward of the layer, those of the layers
+  // before it included, as when the whole network is trained
+  size_t peakBytes = 0;
+};
+
+/**
+ * Profiles the forward and the backward in train mode of each layer of
+ * `module` (the children of a `fl::Sequential`, as built from the lines of an
+ * architecture file, or `module` as a whole otherwise) on random inputs of
+ * `inputDims`. Each layer runs on the output of the previous one, detached,
+ * so that its backward is timed alone. Times are averaged over `iters` runs
+ * after a warmup one; the memory is the one in use on the device, as
+ * reported by `af::deviceMemInfo()`.
+ */
+std::vector<LayerProfile> profileModule(
+    std::shared_ptr<fl::Module> module,
+    const af::dim4& inputDims,
+    int iters = 5);
+
+/* One line per layer, with the totals last */
+std::string profileTable(const std::vector<LayerProfile>& profiles);
+
+} // namespace w2l
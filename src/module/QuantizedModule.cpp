@@ -0,0 +1,139 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "module/QuantizedModule.h"
+
+#include <stdexcept>
+
+#include "module/InferenceOptimizer.h"
+
+using namespace fl;
+
+namespace w2l {
+
+namespace {
+
+/* The int8 weights are stored as u8 offset by 128 */
+constexpr float kInt8Offset = 128;
+constexpr float kInt8Max = 127;
+
+/* Tiles the per-channel `scales` to the dims of the weights */
+af::array tileScales(const af::array& scales, const af::dim4& weightDims) {
+  af::dim4 tiles(1, 1, 1, 1);
+  for (int ax = 0; ax < 4; ++ax) {
+    tiles[ax] = scales.dims(ax) == 1 ? weightDims[ax] : 1;
+  }
+  return af::tile(scales, tiles);
+}
+
+bool isQuantizable(const std::shared_ptr<Module>& module) {
+  return std::dynamic_pointer_cast<Linear>(module) ||
+      std::dynamic_pointer_cast<Conv2D>(module) ||
+      std::dynamic_pointer_cast<WeightNorm>(module);
+}
+
+} // namespace
+
+QuantizationType parseQuantizationType(const std::string& type) {
+  if (type == "none") {
+    return QuantizationType::NONE;
+  } else if (type == "fp16") {
+    return QuantizationType::FP16;
+  } else if (type == "int8") {
+    return QuantizationType::INT8;
+  }
+  throw std::invalid_argument("Unknown quantization type: " + type);
+}
+
+QuantizedModule::QuantizedModule(
+    std::shared_ptr<Module> module,
+    QuantizationType type)
+    : module_(std::move(module)), type_(static_cast<int>(type)) {
+  if (auto wn = std::dynamic_pointer_cast<WeightNorm>(module_)) {
+    module_ = unwrapWeightNorm(*wn);
+  }
+  if (std::dynamic_pointer_cast<Linear>(module_)) {
+    channelAxis_ = 0; // weights are nOutput x nInput
+  } else if (std::dynamic_pointer_cast<Conv2D>(module_)) {
+    channelAxis_ = 3; // weights are xFilter x yFilter x nInput x nOutput
+  } else {
+    throw std::invalid_argument(
+        "[QuantizedModule] only Linear and Conv2D layers can be quantized");
+  }
+
+  auto weights = module_->param(0).array();
+  switch (type) {
+    case QuantizationType::FP16:
+      weights_ = weights.as(f16);
+      break;
+    case QuantizationType::INT8: {
+      auto absMax = af::abs(weights);
+      for (int ax = 0; ax < 4; ++ax) {
+        if (ax != channelAxis_) {
+          absMax = af::max(absMax, ax);
+        }
+      }
+      scales_ = absMax / kInt8Max;
+      scales_(scales_ == 0) = 1; // all zero channels
+      weights_ = (af::round(weights / tileScales(scales_, weights.dims())) +
+                  kInt8Offset)
+                     .as(u8);
+      break;
+    }
+    default:
+      throw std::invalid_argument("[QuantizedModule] invalid quantization type");
+  }
+  // The weights are only expanded for the forward
+  module_->setParams(Variable(), 0);
+  module_->eval();
+}
+
+af::array QuantizedModule::dequantize() const {
+  if (static_cast<QuantizationType>(type_) == QuantizationType::FP16) {
+    return weights_.as(f32);
+  }
+  return (weights_.as(f32) - kInt8Offset) *
+      tileScales(scales_, weights_.dims());
+}
+
+Variable QuantizedModule::forward(const Variable& input) {
+  module_->setParams(Variable(dequantize(), false), 0);
+  auto output = module_->forward({input}).front();
+  module_->setParams(Variable(), 0);
+  return output;
+}
+
+std::string QuantizedModule::prettyString() const {
+  auto type = static_cast<QuantizationType>(type_) == QuantizationType::FP16
+      ? "fp16"
+      : "int8";
+  return std::string("Quantized (") + type + ") " + module_->prettyString();
+}
+
+std::shared_ptr<Module> quantizeForInference(
+    std::shared_ptr<Module> net,
+    QuantizationType type) {
+  auto seq = std::dynamic_pointer_cast<Sequential>(net);
+  if (type == QuantizationType::NONE || !seq) {
+    return net;
+  }
+  auto quantized = std::make_shared<Sequential>();
+  for (const auto& module : seq->modules()) {
+    if (isQuantizable(module)) {
+      quantized->add(std::make_shared<QuantizedModule>(module, type));
+    } else if (std::dynamic_pointer_cast<Sequential>(module)) {
+      quantized->add(quantizeForInference(module, type));
+    } else {
+      quantized->add(module);
+    }
+  }
+  quantized->eval();
+  return quantized;
+}
+
+} // namespace w2l
@@ -0,0 +1,81 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include <flashlight/flashlight.h>
+
+namespace w2l {
+
+enum class QuantizationType {
+  NONE = 0,
+  FP16 = 1, // IEEE binary16 weights
+  INT8 = 2, // symmetric int8 weights with a scale per output channel
+};
+
+/* Parses "none", "fp16" or "int8" */
+QuantizationType parseQuantizationType(const std::string& type);
+
+/**
+ * A `Linear` or `Conv2D` layer in eval mode whose weights are stored in fp16
+ * or in int8 with a scale per output channel, a half or a quarter of their
+ * fp32 size, in memory and once saved. The weights are expanded to fp32 for
+ * the duration of each forward, so the output is the one of the layer with
+ * the rounded weights.
+ */
+class QuantizedModule : public fl::UnaryModule {
+ private:
+  QuantizedModule() = default;
+
+  // The layer, holding its bias but no weights
+  std::shared_ptr<fl::Module> module_;
+  int type_; // QuantizationType
+  int channelAxis_; // of the weights
+  af::array weights_; // f16, or u8 offset by 128
+  af::array scales_; // INT8: f32, 1 on all axes but the channel one
+
+  FL_SAVE_LOAD_WITH_BASE(
+      fl::UnaryModule,
+      module_,
+      type_,
+      channelAxis_,
+      weights_,
+      scales_)
+
+  /* The fp32 weights */
+  af::array dequantize() const;
+
+ public:
+  /**
+   * @param module A `Linear` or `Conv2D` layer, or one of them with weight
+   *   normalization, whose weights are copied
+   * @param type FP16 or INT8
+   */
+  QuantizedModule(std::shared_ptr<fl::Module> module, QuantizationType type);
+
+  fl::Variable forward(const fl::Variable& input) override;
+
+  std::string prettyString() const override;
+};
+
+/**
+ * Replaces the `Linear` and `Conv2D` layers of a network, possibly weight
+ * normalized and nested in sequential layers, by `QuantizedModule`s. Returns
+ * the network unchanged for `QuantizationType::NONE` or if it isn't
+ * sequential.
+ */
+std::shared_ptr<fl::Module> quantizeForInference(
+    std::shared_ptr<fl::Module> net,
+    QuantizationType type);
+
+} // namespace w2l
+
+CEREAL_REGISTER_TYPE(w2l::QuantizedModule)
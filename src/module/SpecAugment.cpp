@@ -45,44 +45,75 @@ fl::Variable SpecAugment::forward(const fl::Variable& input) {
         "input gradient calculation is not supported for SpecAugment.");
   }
 
-  auto output = fl::Variable(input.array(), false);
   if (!train_) {
-    return output;
+    return fl::Variable(input.array(), false);
   }
 
-  auto& opArr = output.array();
-
-  double replaceVal = (maskStrategy_ == MaskingStrategy::GLOBAL_MEAN)
-      ? af::mean<double>(input.array())
-      : 0.0;
-
-  auto numFreqChans = input.dims(1); // number of frequency channels
+  auto dims = input.dims();
+  auto numTimeSteps = dims[0]; // number of time steps
+  auto numFreqChans = dims[1]; // number of frequency channels
+  auto batchSz = dims[3];
   if (numFreqChans < freqMaskF_) {
     throw std::runtime_error("Invalid input frequency channels");
   }
-  for (int i = 0; i < numFreqMask_; ++i) {
-    auto f = generateRandomInt(0, freqMaskF_);
-    auto f0 = generateRandomInt(0, numFreqChans - f);
-    opArr(af::span, af::seq(f0, f0 + f), af::span, af::span) = replaceVal;
+
+  af::array opArr = input.array();
+  if (timeWarpW_ > 0 && numTimeSteps > 2 * timeWarpW_) {
+    opArr = timeWarp(opArr);
   }
 
-  auto numTimeSteps = input.dims(0); // number of time steps
+  auto freqMask = af::moddims(
+      randomMask(numFreqChans, freqMaskF_, numFreqMask_, batchSz),
+      af::dim4(1, numFreqChans, 1, batchSz));
   // an upper bound on the time mask
   int T = std::min(timeMaskT_, static_cast<int>(numTimeSteps * timeMaskP_));
-  if (T > 0) {
-    for (int i = 0; i < numTimeMask_; ++i) {
-      auto t = generateRandomInt(0, T);
-      auto t0 = generateRandomInt(0, numTimeSteps - t);
-      opArr(af::seq(t0, t0 + t), af::span, af::span, af::span) = replaceVal;
-    }
-  }
+  auto timeMask = randomMask(numTimeSteps, T, numTimeMask_, batchSz);
+  auto mask = af::tile(freqMask, numTimeSteps, 1, dims[2]) ||
+      af::tile(timeMask, 1, numFreqChans, dims[2]);
 
-  return output;
+  af::array replaceVal = (maskStrategy_ == MaskingStrategy::GLOBAL_MEAN)
+      ? af::tile(af::mean(af::flat(input.array())), dims)
+      : af::constant(0.0, dims, input.type());
+  return fl::Variable(af::select(mask, replaceVal, opArr), false);
 }
 
-int SpecAugment::generateRandomInt(int low, int high) {
-  std::uniform_int_distribution<int> uniformDist(low, high - 1);
-  return uniformDist(eng_);
+af::array SpecAugment::randomMask(
+    int64_t length,
+    int maxWidth,
+    int nMask,
+    int64_t batchSz) {
+  if (nMask <= 0 || maxWidth <= 0) {
+    return af::constant(0, length, 1, 1, batchSz, b8);
+  }
+  auto width = af::floor(af::randu(1, nMask, 1, batchSz) * maxWidth);
+  auto start = af::floor(af::randu(1, nMask, 1, batchSz) * (length - width));
+  auto end = af::tile(start + width, length);
+  start = af::tile(start, length);
+  auto idx = af::range(af::dim4(length, nMask, 1, batchSz), 0, f32);
+  return af::anyTrue((idx >= start) && (idx <= end), 1);
+}
+
+af::array SpecAugment::timeWarp(const af::array& input) const {
+  auto dims = input.dims();
+  auto numTimeSteps = dims[0];
+  auto batchSz = dims[3];
+  float W = timeWarpW_;
+  float last = numTimeSteps - 1;
+
+  auto w0 = W +
+      af::floor(af::randu(1, 1, 1, batchSz) * (numTimeSteps - 2 * timeWarpW_));
+  auto w = af::floor(af::randu(1, 1, 1, batchSz) * (2 * W + 1)) - W;
+  auto dest = af::tile(w0 + w, numTimeSteps);
+  w0 = af::tile(w0, numTimeSteps);
+
+  // The input frame read by each output frame: [0, dest] is stretched onto
+  // [0, w0] and [dest, last] onto [w0, last]
+  auto t = af::range(af::dim4(numTimeSteps, 1, 1, batchSz), 0, f32);
+  auto left = t * w0 / af::max(dest, 1.0);
+  auto right = w0 + (t - dest) * (last - w0) / af::max(last - dest, 1.0);
+  auto pos = af::select(t < dest, left, right);
+  return af::approx1(
+      input, af::tile(pos, 1, dims[1], dims[2]), AF_INTERP_LINEAR, 0.0);
 }
 
 std::string SpecAugment::prettyString() const {
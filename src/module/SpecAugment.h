@@ -8,8 +8,6 @@
 
 #pragma once
 
-#include <random>
-
 #include <flashlight/flashlight.h>
 
 namespace w2l {
@@ -21,6 +19,9 @@ namespace w2l {
  * We assume time axis is the 0th dimension, and freq axis is the 1st dimension
  * for the  input array
  *
+ * Each sample of the batch (3rd dimension) is warped and masked differently.
+ * The random draws and the masking run on the device, without host sync.
+ *
  * Example policies        tWarpW    fMaskF    nFMask tMaskT    tMaskP   nTMask
  * LibriSpeech basic (LB)    80        27        1     100       1.0       1
  * LibriSpeech double (LD)   80        27        2     100       1.0       2
@@ -59,7 +60,7 @@ class SpecAugment : public fl::UnaryModule {
   std::string prettyString() const override;
 
  private:
-  // Time Warping - NOT SUPPORTED CURRENTLY
+  // Time Warping, by linear interpolation of the frames
   //  Use timeWarpW_ = 0 to disable this
   int timeWarpW_;
 
@@ -74,10 +75,20 @@ class SpecAugment : public fl::UnaryModule {
   float timeMaskP_;
   int numTimeMask_;
 
-  std::mt19937 eng_{0};
   MaskingStrategy maskStrategy_;
 
-  int generateRandomInt(int low, int high);
+  /**
+   * `length` x 1 x 1 x `batchSz` mask of the union of `nMask` random intervals
+   * of each sample, of `w + 1` elements with `w` in [0, `maxWidth`)
+   */
+  static af::array
+  randomMask(int64_t length, int maxWidth, int nMask, int64_t batchSz);
+
+  /**
+   * Moves a random frame `w0` in [W, T - W) of each sample to `w0 + w`, with
+   * `w` in [-W, W], linearly stretching the frames on both sides
+   */
+  af::array timeWarp(const af::array& input) const;
 
   SpecAugment() = default;
 };
@@ -0,0 +1,343 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "module/StreamingW2lModule.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "common/Utils.h"
+#include "module/TDSBlock.h"
+
+using namespace fl;
+
+namespace w2l {
+
+namespace {
+
+/* Frames [begin, end) along `axis` */
+af::array
+sliceFrames(const af::array& input, int axis, int64_t begin, int64_t end) {
+  std::vector<af::index> idx(4);
+  idx[axis] = af::seq(begin, end - 1);
+  return input(idx[0], idx[1], idx[2], idx[3]);
+}
+
+af::array
+joinFrames(int axis, const af::array& first, const af::array& second) {
+  if (first.isempty()) {
+    return second;
+  }
+  if (second.isempty()) {
+    return first;
+  }
+  return af::join(axis, first, second);
+}
+
+void throwUnsupported(const std::string& line) {
+  throw std::invalid_argument(
+      "[StreamingW2lModule] can't stream the layer '" + line + "'");
+}
+
+/* The padding of a side, solving the 'SAME' padding of a stride of 1 */
+int sidePadding(int padding, int kernel, int stride, const std::string& line) {
+  if (padding != static_cast<int>(PaddingMode::SAME)) {
+    return padding;
+  }
+  // It depends on the input length for the other strides
+  if (stride != 1) {
+    throwUnsupported(line);
+  }
+  return (kernel - 1) / 2;
+}
+
+} // namespace
+
+StreamingW2lModule::StreamingW2lModule(
+    std::shared_ptr<Sequential> net,
+    const std::vector<std::string>& archLines)
+    : net_(std::move(net)), receptiveField_(1), stride_(1) {
+  net_->eval();
+  auto modules = net_->modules();
+  int timeAxis = 0;
+  for (const auto& line : archLines) {
+    if (layers_.size() == modules.size()) {
+      throwUnsupported(line);
+    }
+    Layer layer;
+    layer.module = modules[layers_.size()];
+    layer.timeAxis = timeAxis;
+    parseLayer(line, layer);
+    timeAxis = layer.outputTimeAxis;
+
+    int kernel = layer.kernel;
+    if (layer.kind == Layer::Kind::TDS) {
+      kernel = layer.module->param(0).dims(0);
+    }
+    receptiveField_ += (kernel - 1) * stride_;
+    stride_ *= layer.stride;
+    layers_.push_back(std::move(layer));
+  }
+  if (layers_.size() != modules.size()) {
+    throw std::invalid_argument(
+        "[StreamingW2lModule] the architecture doesn't match the network");
+  }
+}
+
+void StreamingW2lModule::parseLayer(const std::string& line, Layer& layer) {
+  auto params = splitOnWhitespace(line, true);
+  int timeAxis = layer.timeAxis;
+  layer.kind = Layer::Kind::FRAMEWISE;
+  layer.outputTimeAxis = timeAxis;
+
+  // The arguments of a temporal layer over the first axis
+  auto setTemporal = [&](int kernel, int stride, int padding, int dilation) {
+    if (timeAxis != 0) {
+      throwUnsupported(line);
+    }
+    layer.kind = Layer::Kind::TEMPORAL;
+    layer.kernel = dilation * (kernel - 1) + 1;
+    layer.stride = stride;
+    layer.padLeft = sidePadding(padding, layer.kernel, stride, line);
+    layer.padRight = layer.padLeft;
+  };
+  auto param = [&](size_t i, int defaultValue) {
+    return params.size() > i ? std::stoi(params[i]) : defaultValue;
+  };
+  auto includesTime = [&](size_t first) {
+    for (size_t i = first; i < params.size(); ++i) {
+      if (std::stoi(params[i]) == timeAxis) {
+        return true;
+      }
+    }
+    return false;
+  };
+
+  const auto& type = params[0];
+  if (type == "RO") {
+    for (int i = 0; i < 4; ++i) {
+      if (param(i + 1, i) == timeAxis) {
+        layer.outputTimeAxis = i;
+      }
+    }
+  } else if (type == "V") {
+    // Time stays on its axis, which forwardLayer() checks
+    if (param(timeAxis + 1, 0) > 0) {
+      throwUnsupported(line);
+    }
+  } else if (type == "PD") {
+    int padLeft = param(2 + 2 * timeAxis, 0);
+    int padRight = param(3 + 2 * timeAxis, 0);
+    if (padLeft > 0 || padRight > 0) {
+      layer.kind = Layer::Kind::TEMPORAL;
+      layer.padLeft = padLeft;
+      layer.padRight = padRight;
+      layer.padValue = std::stod(params[1]);
+    }
+  } else if (type == "C" || type == "C1") {
+    setTemporal(param(3, 1), param(4, 1), param(5, 0), param(6, 1));
+  } else if (type == "C2") {
+    setTemporal(param(3, 1), param(5, 1), param(7, 0), param(9, 1));
+  } else if (type == "M" || type == "A") {
+    setTemporal(param(1, 1), param(3, 1), param(5, 0), 1);
+    layer.padValue = type == "M" ? -INFINITY : 0.0;
+  } else if (type == "WN") {
+    if (params.size() < 3) {
+      throwUnsupported(line);
+    }
+    parseLayer(join(" ", params.begin() + 2, params.end()), layer);
+  } else if (type == "TDS") {
+    if (timeAxis != 0 || param(6, 1) != 0) {
+      throwUnsupported(line);
+    }
+    layer.kind = Layer::Kind::TDS;
+  } else if (type == "L") {
+    if (timeAxis == 0) {
+      throwUnsupported(line);
+    }
+  } else if (type == "LN") {
+    if (includesTime(1)) {
+      throwUnsupported(line);
+    }
+  } else if (type == "BN") {
+    if (includesTime(2)) {
+      throwUnsupported(line);
+    }
+  } else if (type == "PR") {
+    // The parameters are along the first axis
+    if (timeAxis == 0 && param(1, 1) > 1) {
+      throwUnsupported(line);
+    }
+  } else if (type == "GLU" || type == "LSM") {
+    if (param(1, 0) == timeAxis) {
+      throwUnsupported(line);
+    }
+  } else if (
+      type != "DO" && type != "SAUG" && type != "ELU" && type != "R" &&
+      type != "R6" && type != "LG" && type != "HT" && type != "T") {
+    throwUnsupported(line);
+  }
+}
+
+Variable StreamingW2lModule::forward(const Variable& input) {
+  auto out = input.array();
+  for (auto& layer : layers_) {
+    if (out.isempty()) {
+      return Variable();
+    }
+    out = forwardLayer(layer, out);
+  }
+  return out.isempty() ? Variable() : Variable(out, false);
+}
+
+Variable StreamingW2lModule::finish() {
+  af::array out;
+  for (auto& layer : layers_) {
+    if (layer.kind == Layer::Kind::TEMPORAL) {
+      if (!out.isempty()) {
+        out = forwardTemporal(layer, out);
+      }
+      if (layer.started && layer.padRight > 0) {
+        auto dims = layer.frameDims;
+        dims[layer.timeAxis] = layer.padRight;
+        auto padding = af::constant(layer.padValue, dims, layer.type);
+        out = joinFrames(
+            layer.outputTimeAxis, out, forwardTemporal(layer, padding));
+      }
+    } else if (layer.kind == Layer::Kind::TDS) {
+      auto tds = std::static_pointer_cast<TDSBlock>(layer.module);
+      if (!out.isempty()) {
+        out = tds->forwardStreaming(Variable(out, false)).array();
+      }
+      out = joinFrames(0, out, tds->finishStreaming().array());
+    } else if (!out.isempty()) {
+      out = forwardLayer(layer, out);
+    }
+  }
+  reset();
+  return out.isempty() ? Variable() : Variable(out, false);
+}
+
+void StreamingW2lModule::reset() {
+  for (auto& layer : layers_) {
+    if (layer.kind == Layer::Kind::TDS) {
+      std::static_pointer_cast<TDSBlock>(layer.module)->resetStreaming();
+    }
+    layer.started = false;
+    layer.buffer = af::array();
+  }
+}
+
+af::array StreamingW2lModule::forwardLayer(
+    Layer& layer,
+    const af::array& input) {
+  if (layer.kind == Layer::Kind::TEMPORAL) {
+    return forwardTemporal(layer, input);
+  }
+  if (layer.kind == Layer::Kind::TDS) {
+    return std::static_pointer_cast<TDSBlock>(layer.module)
+        ->forwardStreaming(Variable(input, false))
+        .array();
+  }
+  auto out = layer.module->forward({Variable(input, false)}).front().array();
+  // The frames must stay whole along their axis. A view keeping the number of
+  // frames can still split them if it changes the size of the frames
+  dim_t inInner = 1, outInner = 1;
+  for (int i = 0; i < layer.timeAxis; ++i) {
+    inInner *= input.dims(i);
+  }
+  for (int i = 0; i < layer.outputTimeAxis; ++i) {
+    outInner *= out.dims(i);
+  }
+  bool isView = dynamic_cast<fl::View*>(layer.module.get()) != nullptr;
+  if (out.dims(layer.outputTimeAxis) != input.dims(layer.timeAxis) ||
+      (isView && inInner != outInner)) {
+    throw std::invalid_argument(
+        "[StreamingW2lModule] a layer mixes the frames of the input");
+  }
+  return out;
+}
+
+af::array StreamingW2lModule::forwardTemporal(
+    Layer& layer,
+    const af::array& input) {
+  int axis = layer.timeAxis;
+  int64_t stride = layer.stride;
+  if (!layer.started) {
+    // The padding of the start of the stream
+    layer.frameDims = input.dims();
+    layer.frameDims[axis] = 1;
+    layer.type = input.type();
+    if (layer.padLeft > 0) {
+      auto dims = layer.frameDims;
+      dims[axis] = layer.padLeft;
+      layer.buffer = af::constant(layer.padValue, dims, layer.type);
+    }
+    layer.bufferStart = 0;
+    layer.received = layer.padLeft;
+    layer.next = 0;
+    layer.started = true;
+  }
+
+  // The frames before bufferStart are needed by no output
+  int64_t nFrames = input.dims(axis);
+  int64_t skip = std::min(
+      nFrames, std::max<int64_t>(0, layer.bufferStart - layer.received));
+  if (skip < nFrames) {
+    layer.buffer = joinFrames(
+        axis, layer.buffer, sliceFrames(input, axis, skip, nFrames));
+  }
+  layer.received += nFrames;
+  if (layer.received < layer.kernel) {
+    return af::array();
+  }
+  int64_t first = layer.next;
+  int64_t last = (layer.received - layer.kernel) / stride;
+  if (last < first) {
+    return af::array();
+  }
+
+  // The module pads its input too: its output `firstValid` is the first one
+  // which reads none of this padding, and the window is aligned for it to be
+  // the output `first` of the stream
+  int64_t firstValid = (layer.padLeft + stride - 1) / stride;
+  int64_t offset = firstValid * stride - layer.padLeft;
+  int64_t start = first * stride - offset;
+  int64_t end = last * stride + layer.kernel;
+  auto window = sliceFrames(
+      layer.buffer,
+      axis,
+      std::max(start, layer.bufferStart) - layer.bufferStart,
+      end - layer.bufferStart);
+  if (start < layer.bufferStart) {
+    // Frames before the stream, read by the outputs which are dropped only
+    auto dims = layer.frameDims;
+    dims[axis] = layer.bufferStart - start;
+    window = af::join(axis, af::constant(0.0, dims, layer.type), window);
+  }
+  auto out = layer.module->forward({Variable(window, false)}).front().array();
+  out = sliceFrames(
+      out, layer.outputTimeAxis, firstValid, firstValid + last - first + 1);
+
+  layer.next = last + 1;
+  int64_t nextStart = std::max<int64_t>(0, layer.next * stride - offset);
+  if (nextStart >= layer.received) {
+    layer.buffer = af::array();
+  } else {
+    layer.buffer = sliceFrames(
+        layer.buffer,
+        axis,
+        nextStart - layer.bufferStart,
+        layer.received - layer.bufferStart);
+  }
+  layer.bufferStart = nextStart;
+  return out;
+}
+
+} // namespace w2l
@@ -0,0 +1,108 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <flashlight/flashlight.h>
+
+namespace w2l {
+
+/**
+ * Runs a network built by `createW2lSeqModule` on the successive chunks of a
+ * stream, in eval mode, computing each output frame of each layer once.
+ *
+ * The layers convolving or pooling over time keep the input frames which their
+ * next outputs need, starting with the ones of their padding, and get the
+ * padding of the end of the stream in `finish`. The output of the chunks
+ * followed by the one of `finish` is thus the output of `forward` of the
+ * network over the whole stream. It lags the input by the right context of the
+ * network.
+ *
+ * The network may be made of convolutions and pooling over time (C, C1, C2,
+ * M, A, possibly weight normalized), padding (PD), TDS blocks normalizing each
+ * frame, and the layers which don't mix the frames: activations, dropout,
+ * SpecAugment, and linear layers, normalizations and reshapes keeping time on
+ * its own axis. The constructor throws for the other layers (RNNs,
+ * transformers, residual blocks, ...).
+ */
+class StreamingW2lModule {
+ public:
+  /**
+   * @param net The network, which is set to eval mode
+   * @param archLines The lines of its architecture, as `readW2lArch` returns
+   */
+  StreamingW2lModule(
+      std::shared_ptr<fl::Sequential> net,
+      const std::vector<std::string>& archLines);
+
+  /**
+   * Processes the next chunk of the stream. Returns the output frames which
+   * the stream so far completes, an empty Variable if none.
+   */
+  fl::Variable forward(const fl::Variable& input);
+
+  /* Returns the last output frames of the stream and resets the stream */
+  fl::Variable finish();
+
+  /* Drops the state of the current stream */
+  void reset();
+
+  /* Number of input frames which an output frame depends on */
+  int receptiveField() const {
+    return receptiveField_;
+  }
+
+  /* Number of input frames between two output frames */
+  int stride() const {
+    return stride_;
+  }
+
+ private:
+  struct Layer {
+    enum class Kind { FRAMEWISE, TEMPORAL, TDS };
+
+    Kind kind;
+    std::shared_ptr<fl::Module> module;
+    int timeAxis; // of the input
+    int outputTimeAxis;
+
+    // TEMPORAL: the dilated kernel size, the stride and the padding of time
+    int kernel = 1;
+    int stride = 1;
+    int padLeft = 0;
+    int padRight = 0;
+    double padValue = 0.0;
+
+    // TEMPORAL: the frames [bufferStart, received) of the padded input which
+    // the next outputs need, and the index of the next output
+    bool started = false;
+    af::array buffer;
+    af::dim4 frameDims;
+    af::dtype type;
+    int64_t bufferStart = 0;
+    int64_t received = 0;
+    int64_t next = 0;
+  };
+
+  std::shared_ptr<fl::Sequential> net_;
+  std::vector<Layer> layers_;
+  int receptiveField_;
+  int stride_;
+
+  /* Sets the kind, time axes and time parameters of a layer from its line */
+  static void parseLayer(const std::string& line, Layer& layer);
+
+  af::array forwardLayer(Layer& layer, const af::array& input);
+  af::array forwardTemporal(Layer& layer, const af::array& input);
+};
+
+} // namespace w2l
@@ -8,10 +8,27 @@
 
 #include <module/TDSBlock.h>
 
+#include <algorithm>
+
+#include "module/FusedOps.h"
+
 namespace w2l {
 
 using namespace fl;
 
+namespace {
+
+// The epsilon the LayerNorms of the block are constructed with, which the
+// fused ops use as well since fl::LayerNorm doesn't expose it
+constexpr float kLayerNormEps = 1e-5;
+
+bool isScalarLayerNorm(const std::shared_ptr<Module>& module) {
+  return std::dynamic_pointer_cast<LayerNorm>(module) &&
+      module->params().size() == 2 && module->param(0).elements() == 1;
+}
+
+} // namespace
+
 TDSBlock::TDSBlock(
     int channels,
     int kernelSize,
@@ -19,7 +36,10 @@ TDSBlock::TDSBlock(
     double dropout /* = 0 */,
     int innerLinearDim /* = 0 */,
     int rightPadding /* = -1 */,
-    bool lNormIncludeTime /* = true */) {
+    bool lNormIncludeTime /* = true */)
+    : rightPadding_(rightPadding),
+      lNormIncludeTime_(lNormIncludeTime),
+      dropout_(dropout) {
   Sequential conv;
   auto convPadding = static_cast<int>(fl::PaddingMode::SAME);
   if (rightPadding != -1) {
@@ -58,24 +78,146 @@ TDSBlock::TDSBlock(
 
   add(conv);
   if (lNormIncludeTime) {
-    add(LayerNorm(std::vector<int>{0, 1, 2}));
+    add(LayerNorm(std::vector<int>{0, 1, 2}, kLayerNormEps));
   } else {
-    add(LayerNorm(std::vector<int>{1, 2}));
+    add(LayerNorm(std::vector<int>{1, 2}, kLayerNormEps));
   }
   add(fc);
   if (lNormIncludeTime) {
-    add(LayerNorm(std::vector<int>{0, 1, 2}));
+    add(LayerNorm(std::vector<int>{0, 1, 2}, kLayerNormEps));
   } else {
-    add(LayerNorm(std::vector<int>{1, 2}));
+    add(LayerNorm(std::vector<int>{1, 2}, kLayerNormEps));
+  }
+}
+
+void TDSBlock::setFused(bool fused) {
+  fusedOps() = fused;
+}
+
+bool& TDSBlock::fusedOps() {
+  static bool fused = false;
+  return fused;
+}
+
+bool TDSBlock::fusable(const Variable& input) const {
+  if (!fusedOps() || input.type() != f32 || !isScalarLayerNorm(module(1)) ||
+      !isScalarLayerNorm(module(3))) {
+    return false;
   }
+  auto fc = std::dynamic_pointer_cast<Sequential>(module(2));
+  if (!fc || fc->modules().size() < 4) {
+    return false;
+  }
+  auto linear = fc->modules()[2];
+  return std::dynamic_pointer_cast<Linear>(linear) &&
+      linear->params().size() == 2 &&
+      std::dynamic_pointer_cast<ReLU>(fc->modules()[3]);
 }
 
 std::vector<Variable> TDSBlock::forward(const std::vector<Variable>& inputs) {
   auto out = inputs[0];
-  out = module(0)->forward({out})[0] + out;
+  if (!fusable(out)) {
+    out = module(0)->forward({out})[0] + out;
+    out = module(1)->forward({out})[0];
+    out = module(2)->forward({out})[0] + out;
+    return module(3)->forward({out});
+  }
+
+  auto norm = module(1);
+  out = residualLayerNorm(
+      module(0)->forward({out})[0],
+      out,
+      norm->param(0),
+      norm->param(1),
+      lNormIncludeTime_,
+      kLayerNormEps);
+
+  // Reorder, View, [Linear, ReLU, Dropout], Linear, View, Reorder, Dropout
+  auto fc = std::static_pointer_cast<Sequential>(module(2))->modules();
+  bool hasDropout = fc.size() > 4 && std::dynamic_pointer_cast<Dropout>(fc[4]);
+  bool fuseDropout = hasDropout && dropout_ >= 0;
+  auto hidden = fc[1]->forward(fc[0]->forward({out}))[0];
+  hidden = linearReluDropout(
+      hidden,
+      fc[2]->param(0),
+      fc[2]->param(1),
+      fuseDropout ? dropout_ : 0,
+      train_);
+  for (int i = fuseDropout ? 5 : 4; i < fc.size(); ++i) {
+    hidden = fc[i]->forward({hidden})[0];
+  }
+
+  norm = module(3);
+  out = residualLayerNorm(
+      hidden,
+      out,
+      norm->param(0),
+      norm->param(1),
+      lNormIncludeTime_,
+      kLayerNormEps);
+  return {out};
+}
+
+int TDSBlock::streamingDelay() const {
+  int kernelSize = param(0).dims(0);
+  return rightPadding_ == -1 ? (kernelSize - 1) / 2 : rightPadding_;
+}
+
+Variable TDSBlock::forwardStreaming(const Variable& input) {
+  if (isTrain() || lNormIncludeTime_) {
+    throw std::invalid_argument(
+        "[TDSBlock] streaming requires eval mode and a normalization "
+        "excluding time");
+  }
+  int kernelSize = param(0).dims(0);
+  int context = kernelSize - 1;
+  int delay = streamingDelay();
+  if (streamBuffer_.isempty() && context > 0) {
+    // The left padding of the convolution
+    auto dims = input.dims();
+    dims[0] = context;
+    streamBuffer_ = Variable(af::constant(0.0, dims, input.type()), false);
+  }
+  auto frames =
+      context > 0 ? concatenate({streamBuffer_, input}, 0) : input;
+  int nFrames = input.dims(0);
+  if (context > 0) {
+    streamBuffer_ = frames(af::seq(nFrames, nFrames + context - 1));
+  }
+
+  // The convolution of module(0) without its padding, as in `forward`
+  auto out = relu(conv2d(frames, param(0), param(1)));
+  out = out + frames(af::seq(context - delay, context - delay + nFrames - 1));
   out = module(1)->forward({out})[0];
   out = module(2)->forward({out})[0] + out;
-  return module(3)->forward({out});
+  out = module(3)->forward({out})[0];
+
+  // The first output frames of the stream are before its first input frame
+  int skip = std::min(nFrames, std::max(0, delay - streamFrames_));
+  streamFrames_ += nFrames;
+  if (skip == nFrames) {
+    return Variable();
+  }
+  return skip > 0 ? out(af::seq(skip, nFrames - 1)) : out;
+}
+
+Variable TDSBlock::finishStreaming() {
+  Variable out;
+  int delay = streamingDelay();
+  if (streamFrames_ > 0 && delay > 0) {
+    // The right padding of the convolution
+    auto dims = streamBuffer_.dims();
+    dims[0] = delay;
+    out = forwardStreaming(
+        Variable(af::constant(0.0, dims, streamBuffer_.type()), false));
+  }
+  resetStreaming();
+  return out;
+}
+
+void TDSBlock::resetStreaming() {
+  streamBuffer_ = Variable();
+  streamFrames_ = 0;
 }
 
 std::string TDSBlock::prettyString() const {
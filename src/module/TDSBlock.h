@@ -22,7 +22,31 @@ namespace w2l {
 class TDSBlock : public fl::Container {
  private:
   TDSBlock() = default;
-  FL_SAVE_LOAD_WITH_BASE(fl::Container)
+
+  int rightPadding_ = -1;
+  // Models saved before version 1 don't record it and can't be streamed
+  bool lNormIncludeTime_ = true;
+  // Models saved before version 2 don't record it: their dropout after the
+  // first linear layer then runs on its own
+  double dropout_ = -1;
+
+  // The last kernelSize - 1 input frames of the stream, and its length
+  fl::Variable streamBuffer_;
+  int streamFrames_ = 0;
+
+  FL_SAVE_LOAD_WITH_BASE(
+      fl::Container,
+      fl::versioned(rightPadding_, 1),
+      fl::versioned(lNormIncludeTime_, 1),
+      fl::versioned(dropout_, 2))
+
+  /* Frames by which the output of a stream lags its input */
+  int streamingDelay() const;
+
+  /* Whether `forward` can use the fused ops of module/FusedOps.h */
+  bool fusable(const fl::Variable& input) const;
+
+  static bool& fusedOps();
 
  public:
   /**
@@ -56,11 +80,48 @@ class TDSBlock : public fl::Container {
       int rightPadding = -1,
       bool lNormIncludeTime = true);
 
+  /**
+   * Runs the layers one by one. With setFused(true), for float32 inputs,
+   * runs each residual connection and the LayerNorm after it, and the first
+   * linear layer with its ReLU and dropout, as fused ops instead, unless some
+   * layers were replaced (e.g. quantized).
+   */
   std::vector<fl::Variable> forward(
       const std::vector<fl::Variable>& inputs) override;
+
+  /* Whether `forward` of all the blocks uses the fused ops, false by
+   * default */
+  static void setFused(bool fused);
+
+  /**
+   * Streaming inference, for blocks in eval mode normalizing each frame
+   * (`lNormIncludeTime` = `false`). Processes the next chunk of frames of the
+   * input of `forward`, T' x W x C x B, keeping its last `kernelSize - 1`
+   * frames for the convolution of the next chunk, so that the cost of a chunk
+   * doesn't depend on the length of the stream. The output lags the input by
+   * the right padding of the convolution: the output frames are the ones of
+   * `forward` whose convolution window the input so far covers, so a chunk
+   * shorter than the lag may return an empty Variable. The concatenation of the
+   * outputs of the chunks and of `finishStreaming` is the output of `forward`
+   * over the whole stream.
+   */
+  fl::Variable forwardStreaming(const fl::Variable& input);
+
+  /**
+   * Returns the last output frames of the stream, computed with the right
+   * padding of the convolution, and resets the streaming state. A model of
+   * several blocks streams these frames through the next blocks before
+   * finishing them.
+   */
+  fl::Variable finishStreaming();
+
+  /* Drops the state of the current stream */
+  void resetStreaming();
+
   std::string prettyString() const override;
 };
 
 } // namespace w2l
 
 CEREAL_REGISTER_TYPE(w2l::TDSBlock)
+CEREAL_CLASS_VERSION(w2l::TDSBlock, 2)
@@ -13,6 +13,7 @@
 #include "W2lModule.h"
 
 #include "common/FlashlightUtils.h"
+#include "module/CheckpointModule.h"
 #include "module/SpecAugment.h"
 #include "module/TDSBlock.h"
 
@@ -33,13 +34,11 @@ std::shared_ptr<Module> parseLines(
 
 namespace w2l {
 
-std::shared_ptr<Sequential> createW2lSeqModule(
+std::vector<std::string> readW2lArch(
     const std::string& archfile,
     int64_t nFeatures,
     int64_t nClasses) {
-  auto net = std::make_shared<Sequential>();
   auto layers = getFileContent(archfile);
-  int numLinesParsed = 0;
 
   // preprocess
   std::vector<std::string> processedLayers;
@@ -53,6 +52,16 @@ std::shared_ptr<Sequential> createW2lSeqModule(
     }
     processedLayers.emplace_back(lrepl);
   }
+  return processedLayers;
+}
+
+std::shared_ptr<Sequential> createW2lSeqModule(
+    const std::string& archfile,
+    int64_t nFeatures,
+    int64_t nClasses) {
+  auto net = std::make_shared<Sequential>();
+  auto processedLayers = readW2lArch(archfile, nFeatures, nClasses);
+  int numLinesParsed = 0;
 
   int lid = 0;
   while (lid < processedLayers.size()) {
@@ -405,6 +414,26 @@ std::shared_ptr<Module> parseLines(
     }
   }
 
+  /* ========== Activation checkpointing ========== */
+  if (params[0] == "CKPT") {
+    LOG_IF(FATAL, params.size() != 2) << "Failed parsing - " << line;
+    int numLayers = std::stoi(params[1]);
+    LOG_IF(FATAL, numLayers <= 0)
+        << "Invalid number of checkpointed layers: " << numLayers;
+
+    std::vector<std::shared_ptr<Module>> segment;
+    int offset = 1;
+    for (int i = 0; i < numLayers; ++i) {
+      LOG_IF(FATAL, lineIdx + offset >= lines.size())
+          << "Failed parsing Checkpoint block";
+      int numSubLines = 0;
+      segment.push_back(parseLines(lines, lineIdx + offset, numSubLines));
+      offset += numSubLines + 1;
+    }
+    numLinesParsed = offset - 1;
+    return std::make_shared<w2l::CheckpointModule>(segment);
+  }
+
   /* ========== Data Augmentation  ========== */
   if (params[0] == "SAUG") {
     LOG_IF(FATAL, params.size() != 7) << "Failed parsing - " << line;
@@ -13,6 +13,15 @@
 
 namespace w2l {
 
+/**
+ * The layers of an architecture file, one per line, without the comments and
+ * empty lines and with `NFEAT` and `NLABEL` replaced.
+ */
+std::vector<std::string> readW2lArch(
+    const std::string& archfile,
+    int64_t nFeatures,
+    int64_t nClasses);
+
 std::shared_ptr<fl::Sequential> createW2lSeqModule(
     const std::string& archfile,
     int64_t nFeatures,
@@ -0,0 +1,72 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "module/FusedOps.h"
+
+namespace w2l {
+namespace detail {
+
+namespace {
+
+/* The groups along the second dimension: inner x N x outer */
+af::array groupView(const af::array& x, int inner) {
+  auto outer = x.dims(3);
+  return af::moddims(x, inner, x.elements() / (inner * outer), outer);
+}
+
+} // namespace
+
+// The ArrayFire ops are as fast as a fused loop on the CPU
+
+void residualLayerNormForward(
+    const af::array& input,
+    const af::array& residual,
+    const af::array& weight,
+    const af::array& bias,
+    int inner,
+    float eps,
+    af::array& output,
+    af::array& mean,
+    af::array& rstd) {
+  auto x = groupView(input + residual, inner);
+  auto N = x.dims(1);
+  mean = af::mean(x, 1);
+  auto centered = x - af::tile(mean, 1, N);
+  rstd = 1.0 / af::sqrt(af::mean(centered * centered, 1) + eps);
+  output = centered * af::tile(rstd, 1, N) *
+          af::tile(weight, centered.dims()) +
+      af::tile(bias, centered.dims());
+  output = af::moddims(output, input.dims());
+}
+
+void residualLayerNormBackward(
+    const af::array& gradOutput,
+    const af::array& input,
+    const af::array& residual,
+    const af::array& weight,
+    const af::array& mean,
+    const af::array& rstd,
+    int inner,
+    af::array& gradInput,
+    af::array& gradWeight,
+    af::array& gradBias) {
+  auto x = groupView(input + residual, inner);
+  auto gy = groupView(gradOutput, inner);
+  auto N = x.dims(1);
+  auto xhat = (x - af::tile(mean, 1, N)) * af::tile(rstd, 1, N);
+  auto meanGy = af::mean(gy, 1);
+  auto meanGyXhat = af::mean(gy * xhat, 1);
+  gradInput = af::tile(rstd, 1, N) * af::tile(weight, x.dims()) *
+      (gy - af::tile(meanGy, 1, N) - xhat * af::tile(meanGyXhat, 1, N));
+  gradInput = af::moddims(gradInput, input.dims());
+  gradWeight = af::moddims(af::sum(af::flat(gy * xhat)), weight.dims());
+  gradBias = af::moddims(af::sum(af::flat(gy)), weight.dims());
+}
+
+} // namespace detail
+} // namespace w2l
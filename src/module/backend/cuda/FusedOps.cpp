@@ -0,0 +1,111 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "module/FusedOps.h"
+
+#include <flashlight/common/cuda.h>
+
+#include "libraries/module/cuda/ResidualLayerNorm.cuh"
+
+using ResidualLayerNorm = w2l::cuda::ResidualLayerNorm<float>;
+
+namespace w2l {
+namespace detail {
+
+void residualLayerNormForward(
+    const af::array& input,
+    const af::array& residual,
+    const af::array& weight,
+    const af::array& bias,
+    int inner,
+    float eps,
+    af::array& output,
+    af::array& mean,
+    af::array& rstd) {
+  int outer = input.dims(3);
+  int N = input.elements() / (inner * outer);
+  output = af::array(input.dims(), f32);
+  mean = af::array(inner, 1, outer, f32);
+  rstd = af::array(inner, 1, outer, f32);
+
+  {
+    fl::DevicePtr inputRaw(input);
+    fl::DevicePtr residualRaw(residual);
+    fl::DevicePtr weightRaw(weight);
+    fl::DevicePtr biasRaw(bias);
+    fl::DevicePtr outputRaw(output);
+    fl::DevicePtr meanRaw(mean);
+    fl::DevicePtr rstdRaw(rstd);
+
+    ResidualLayerNorm::forward(
+        inner,
+        N,
+        outer,
+        eps,
+        static_cast<const float*>(inputRaw.get()),
+        static_cast<const float*>(residualRaw.get()),
+        static_cast<const float*>(weightRaw.get()),
+        static_cast<const float*>(biasRaw.get()),
+        static_cast<float*>(outputRaw.get()),
+        static_cast<float*>(meanRaw.get()),
+        static_cast<float*>(rstdRaw.get()),
+        fl::cuda::getActiveStream());
+  }
+}
+
+void residualLayerNormBackward(
+    const af::array& gradOutput,
+    const af::array& input,
+    const af::array& residual,
+    const af::array& weight,
+    const af::array& mean,
+    const af::array& rstd,
+    int inner,
+    af::array& gradInput,
+    af::array& gradWeight,
+    af::array& gradBias) {
+  int outer = input.dims(3);
+  int N = input.elements() / (inner * outer);
+  gradInput = af::array(input.dims(), f32);
+  // Sums for each group, added up by ArrayFire
+  af::array groupGradWeight(inner * outer, f32);
+  af::array groupGradBias(inner * outer, f32);
+
+  {
+    fl::DevicePtr gradOutputRaw(gradOutput);
+    fl::DevicePtr inputRaw(input);
+    fl::DevicePtr residualRaw(residual);
+    fl::DevicePtr weightRaw(weight);
+    fl::DevicePtr meanRaw(mean);
+    fl::DevicePtr rstdRaw(rstd);
+    fl::DevicePtr gradInputRaw(gradInput);
+    fl::DevicePtr groupGradWeightRaw(groupGradWeight);
+    fl::DevicePtr groupGradBiasRaw(groupGradBias);
+
+    ResidualLayerNorm::backward(
+        inner,
+        N,
+        outer,
+        static_cast<const float*>(gradOutputRaw.get()),
+        static_cast<const float*>(inputRaw.get()),
+        static_cast<const float*>(residualRaw.get()),
+        static_cast<const float*>(weightRaw.get()),
+        static_cast<const float*>(meanRaw.get()),
+        static_cast<const float*>(rstdRaw.get()),
+        static_cast<float*>(gradInputRaw.get()),
+        static_cast<float*>(groupGradWeightRaw.get()),
+        static_cast<float*>(groupGradBiasRaw.get()),
+        fl::cuda::getActiveStream());
+  }
+
+  gradWeight = af::moddims(af::sum(groupGradWeight), weight.dims());
+  gradBias = af::moddims(af::sum(groupGradBias), weight.dims());
+}
+
+} // namespace detail
+} // namespace w2l
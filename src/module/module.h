@@ -8,7 +8,14 @@
 
 #pragma once
 
+#include "module/CheckpointModule.h"
 #include "module/ConvLmModule.h"
+#include "module/FusedOps.h"
+#include "module/InferenceOptimizer.h"
+#include "module/MixedPrecisionModule.h"
+#include "module/ModuleProfiler.h"
+#include "module/QuantizedModule.h"
 #include "module/SpecAugment.h"
+#include "module/StreamingW2lModule.h"
 #include "module/TDSBlock.h"
 #include "module/W2lModule.h"
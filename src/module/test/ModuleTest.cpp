@@ -6,6 +6,8 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <algorithm>
+
 #include <gtest/gtest.h>
 
 #include <arrayfire.h>
@@ -53,6 +55,137 @@ TEST(ModuleTest, StreamingTDSFwd) {
   ASSERT_EQ(output.dims(2), c);
 }
 
+TEST(ModuleTest, TDSStreamingFwd) {
+  int batchsize = 2;
+  int timesteps = 50;
+  int w = 4;
+  int c = 3;
+  int kw = 9;
+  auto input = Variable(af::randu(timesteps, w, c, batchsize), false);
+
+  for (int rPad : {-1, 0, 3, kw - 1}) {
+    auto tds = TDSBlock(
+        c, kw, w, 0 /* dropout */, 0 /* innerLinearDim */, rPad, false);
+    tds.eval();
+    auto output = tds.forward({input})[0];
+
+    // Chunks shorter and longer than the delay of the output
+    std::vector<Variable> outputs;
+    int start = 0;
+    for (int chunk = 1; start < timesteps; chunk = chunk % 7 + 1) {
+      int end = std::min(start + chunk, timesteps);
+      auto out = tds.forwardStreaming(input(af::seq(start, end - 1)));
+      if (!out.isempty()) {
+        outputs.push_back(out);
+      }
+      start = end;
+    }
+    auto out = tds.finishStreaming();
+    if (!out.isempty()) {
+      outputs.push_back(out);
+    }
+    auto streamed = concatenate(outputs, 0);
+
+    ASSERT_EQ(streamed.dims(), output.dims());
+    ASSERT_TRUE(allClose(streamed, output, 1e-5));
+  }
+
+  auto tds = TDSBlock(c, kw, w);
+  tds.eval();
+  ASSERT_THROW(tds.forwardStreaming(input), std::invalid_argument);
+}
+
+TEST(ModuleTest, FusedResidualLayerNorm) {
+  int T = 20, W = 4, C = 3, B = 2;
+  for (bool includeTime : {true, false}) {
+    auto norm = includeTime ? LayerNorm(std::vector<int>{0, 1, 2})
+                            : LayerNorm(std::vector<int>{1, 2});
+    norm.setParams(Variable(af::constant(1.5, 1), true), 0);
+    norm.setParams(Variable(af::constant(-0.5, 1), true), 1);
+    auto input = Variable(af::randu(T, W, C, B), true);
+    auto residual = Variable(af::randn(T, W, C, B), true);
+    auto gradOutput = af::randn(T, W, C, B);
+
+    auto expected = norm.forward(input + residual);
+    expected.backward(gradOutput);
+    auto expectedGrads = std::vector<af::array>{input.grad().array(),
+                                                residual.grad().array(),
+                                                norm.param(0).grad().array(),
+                                                norm.param(1).grad().array()};
+    input.zeroGrad();
+    residual.zeroGrad();
+    norm.zeroGrad();
+
+    auto output = residualLayerNorm(
+        input, residual, norm.param(0), norm.param(1), includeTime);
+    output.backward(gradOutput);
+    ASSERT_TRUE(allClose(output, expected, 1e-4));
+    ASSERT_TRUE(allClose(input.grad().array(), expectedGrads[0], 1e-4));
+    ASSERT_TRUE(allClose(residual.grad().array(), expectedGrads[1], 1e-4));
+    ASSERT_TRUE(allClose(norm.param(0).grad().array(), expectedGrads[2], 1e-3));
+    ASSERT_TRUE(allClose(norm.param(1).grad().array(), expectedGrads[3], 1e-3));
+  }
+}
+
+TEST(ModuleTest, FusedLinearReluDropout) {
+  int inDim = 12, outDim = 8, T = 10, B = 3;
+  auto linear = Linear(inDim, outDim);
+  auto input = Variable(af::randn(inDim, T, 1, B), true);
+  auto gradOutput = af::randn(outDim, T, 1, B);
+
+  auto expected = relu(linear.forward(input));
+  expected.backward(gradOutput);
+  auto expectedGrads = std::vector<af::array>{input.grad().array(),
+                                              linear.param(0).grad().array(),
+                                              linear.param(1).grad().array()};
+  input.zeroGrad();
+  linear.zeroGrad();
+
+  auto output = linearReluDropout(
+      input, linear.param(0), linear.param(1), 0.3, false /* train */);
+  output.backward(gradOutput);
+  ASSERT_EQ(output.dims(), expected.dims());
+  ASSERT_TRUE(allClose(output, expected, 1e-5));
+  ASSERT_TRUE(allClose(input.grad().array(), expectedGrads[0], 1e-4));
+  ASSERT_TRUE(allClose(linear.param(0).grad().array(), expectedGrads[1], 1e-4));
+  ASSERT_TRUE(allClose(linear.param(1).grad().array(), expectedGrads[2], 1e-4));
+
+  // The kept units are scaled, and only they pass the gradient
+  double ratio = 0.5;
+  auto relued = relu(linear.forward(input)).array();
+  auto dropped =
+      linearReluDropout(input, linear.param(0), linear.param(1), ratio, true);
+  auto kept = dropped.array() > 0;
+  ASSERT_TRUE(allClose(
+      dropped.array(), relued * kept.as(f32) / (1 - ratio), 1e-5));
+  linear.zeroGrad();
+  dropped.backward(af::constant(1, dropped.dims()));
+  auto keptPerUnit = af::sum(af::moddims(kept.as(f32), outDim, T * B), 1);
+  ASSERT_TRUE(allClose(
+      linear.param(1).grad().array(),
+      af::moddims(keptPerUnit, outDim) / (1 - ratio),
+      1e-4));
+}
+
+TEST(ModuleTest, TDSFusedMatchesLayers) {
+  int T = 30, W = 4, C = 5, B = 2;
+  TDSBlock::setFused(true);
+  for (bool includeTime : {true, false}) {
+    auto tds = TDSBlock(C, 5, W, 0.1, 0, -1, includeTime);
+    tds.eval();
+    auto input = Variable(af::randn(T, W, C, B), false);
+    auto output = tds.forward({input})[0];
+
+    // The layers one by one, as for a model whose layers were replaced
+    auto out = tds.module(0)->forward({input})[0] + input;
+    out = tds.module(1)->forward({out})[0];
+    out = tds.module(2)->forward({out})[0] + out;
+    out = tds.module(3)->forward({out})[0];
+    ASSERT_TRUE(allClose(output, out, 1e-4));
+  }
+  TDSBlock::setFused(false);
+}
+
 TEST(ModuleTest, SpecAugmentFwd) {
   SpecAugment specAug(0, 27, 2, 100, 0.2, 2);
   int T = 512, F = 80;
@@ -91,6 +224,61 @@ TEST(ModuleTest, SpecAugmentFwd) {
   ASSERT_GT(fZeros, 0);
 }
 
+TEST(ModuleTest, SpecAugmentBatch) {
+  SpecAugment specAug(0, 10, 1, 20, 1.0, 1);
+  int T = 100, F = 40, B = 16;
+  auto input = Variable(af::randu(T, F, 1, B) + 1, false);
+  specAug.train();
+  auto output = specAug(input).array();
+  ASSERT_EQ(output.dims(), input.dims());
+
+  // Each sample has its own masks
+  auto masked = (output == 0).as(f32);
+  auto maskedFrames = af::allTrue(masked, 1);
+  ASSERT_FALSE(af::allTrue<bool>(
+      maskedFrames == af::tile(maskedFrames(af::span, 0, 0, 0), 1, 1, 1, B)));
+  auto maskedChans = af::allTrue(masked, 0);
+  for (int b = 0; b < B; ++b) {
+    ASSERT_GT(af::count<int>(maskedFrames(af::span, 0, 0, b)), 0);
+    ASSERT_GT(af::count<int>(maskedChans(0, af::span, 0, b)), 0);
+  }
+
+  // Time warping only moves frames around
+  SpecAugment warp(5, 10, 0, 20, 1.0, 0);
+  warp.train();
+  auto warped = warp(input).array();
+  ASSERT_EQ(warped.dims(), input.dims());
+  ASSERT_GE(af::min<float>(warped), af::min<float>(input.array()) - 1e-5);
+  ASSERT_LE(af::max<float>(warped), af::max<float>(input.array()) + 1e-5);
+}
+
+TEST(ModuleTest, ProfileModule) {
+  auto net = std::make_shared<Sequential>();
+  net->add(Conv2D(40, 16, 3, 1));
+  net->add(ReLU());
+  net->add(Reorder(2, 0, 3, 1));
+  net->add(Linear(16, 8));
+  int T = 50, B = 2;
+
+  auto profiles = profileModule(net, af::dim4(T, 1, 40, B), 2);
+  ASSERT_EQ(profiles.size(), 4u);
+  ASSERT_EQ(profiles[0].outputDims, af::dim4(T - 2, 1, 16, B));
+  ASSERT_EQ(profiles[3].outputDims, af::dim4(8, T - 2, B));
+  ASSERT_EQ(profiles[0].numParams, 40 * 16 * 3 + 16);
+  ASSERT_EQ(profiles[1].numParams, 0);
+  ASSERT_EQ(profiles[3].activationBytes, 8 * (T - 2) * B * sizeof(float));
+  for (const auto& p : profiles) {
+    ASSERT_GE(p.fwdMs, 0);
+    ASSERT_GE(p.bwdMs, 0);
+  }
+  ASSERT_EQ(profiles[1].name, net->module(1)->prettyString());
+  // The params aren't left with gradients
+  for (const auto& p : net->params()) {
+    ASSERT_FALSE(p.isGradAvailable());
+  }
+  ASSERT_NE(profileTable(profiles).find("total"), std::string::npos);
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
 
@@ -6,6 +6,8 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <fstream>
+
 #include <gtest/gtest.h>
 
 #include <arrayfire.h>
@@ -44,6 +46,220 @@ TEST(W2lModuleTest, W2lSeqModule) {
   ASSERT_EQ(output.dims(), af::dim4(nclass, inputsteps, batchsize));
 }
 
+TEST(W2lModuleTest, StreamingW2lModule) {
+  const std::string archfile =
+      pathsConcat(archDir, "test_w2l_streaming_arch.txt");
+  int nchannel = 3;
+  int nclass = 5;
+  int batchsize = 2;
+  int inputsteps = 60;
+
+  auto model = createW2lSeqModule(archfile, nchannel, nclass);
+  StreamingW2lModule streaming(
+      model, readW2lArch(archfile, nchannel, nclass));
+  ASSERT_EQ(streaming.receptiveField(), 22);
+  ASSERT_EQ(streaming.stride(), 2);
+
+  auto input = af::randn(inputsteps, 1, nchannel, batchsize, f32);
+  auto output = model->forward(noGrad(input));
+
+  // Twice, since finish() resets the stream
+  for (int run = 0; run < 2; ++run) {
+    std::vector<Variable> outputs;
+    int start = 0;
+    for (int chunk = 1; start < inputsteps; chunk = chunk % 9 + 1) {
+      int end = std::min(start + chunk, inputsteps);
+      auto out = streaming.forward(noGrad(input(af::seq(start, end - 1))));
+      if (!out.isempty()) {
+        outputs.push_back(out);
+      }
+      start = end;
+    }
+    auto out = streaming.finish();
+    if (!out.isempty()) {
+      outputs.push_back(out);
+    }
+    auto streamed = concatenate(outputs, 1);
+
+    ASSERT_EQ(streamed.dims(), output.dims());
+    ASSERT_TRUE(allClose(streamed, output, 1e-5));
+  }
+
+  // Recurrent and residual layers need the whole input
+  const std::string rnnArchfile = pathsConcat(archDir, "test_w2l_arch.txt");
+  ASSERT_THROW(
+      StreamingW2lModule(
+          createW2lSeqModule(rnnArchfile, nchannel, nclass),
+          readW2lArch(rnnArchfile, nchannel, nclass)),
+      std::invalid_argument);
+}
+
+TEST(W2lModuleTest, InferenceOptimizer) {
+  const std::string archfile =
+      pathsConcat(archDir, "test_w2l_inference_arch.txt");
+  int nchannel = 3;
+  int nclass = 5;
+  int batchsize = 2;
+  int inputsteps = 40;
+
+  auto model = createW2lSeqModule(archfile, nchannel, nclass);
+  auto archLines = readW2lArch(archfile, nchannel, nclass);
+  ASSERT_EQ(model->modules().size(), 10);
+
+  // Non-trivial running statistics for the batch normalizations
+  model->train();
+  for (int i = 0; i < 3; ++i) {
+    model->forward(noGrad(af::randn(inputsteps, 1, nchannel, batchsize) + i));
+  }
+  model->eval();
+  auto input = af::randn(inputsteps, 1, nchannel, batchsize, f32);
+  auto output = model->forward(noGrad(input));
+
+  auto optimized = optimizeForInference(model, archLines);
+  // The batch normalizations and the dropout are gone
+  ASSERT_EQ(optimized->modules().size(), 7);
+  for (const auto& module : optimized->modules()) {
+    ASSERT_FALSE(std::dynamic_pointer_cast<WeightNorm>(module));
+    ASSERT_FALSE(std::dynamic_pointer_cast<BatchNorm>(module));
+  }
+
+  auto optimizedOutput = optimized->forward(noGrad(input));
+  ASSERT_EQ(optimizedOutput.dims(), output.dims());
+  ASSERT_TRUE(allClose(optimizedOutput, output, 1e-4));
+}
+
+TEST(W2lModuleTest, QuantizedModule) {
+  const std::string archfile =
+      pathsConcat(archDir, "test_w2l_inference_arch.txt");
+  int nchannel = 3;
+  int nclass = 5;
+  auto model = createW2lSeqModule(archfile, nchannel, nclass);
+  model->eval();
+  auto input = noGrad(af::randn(40, 1, nchannel, 2, f32));
+  auto output = model->forward(input);
+
+  auto fp16 = quantizeForInference(
+      createW2lSeqModule(archfile, nchannel, nclass), QuantizationType::FP16);
+  ASSERT_EQ(fp16->forward({input}).front().dims(), output.dims());
+
+  // The model is taken over by the quantized one
+  auto quantized = quantizeForInference(model, QuantizationType::INT8);
+  auto quantizedOutput = quantized->forward({input}).front();
+  ASSERT_EQ(quantizedOutput.dims(), output.dims());
+  ASSERT_TRUE(allClose(quantizedOutput, output, 5e-2));
+  ASSERT_EQ(
+      quantizeForInference(quantized, QuantizationType::NONE), quantized);
+
+  char* user = getenv("USER");
+  std::string userstr = user != nullptr ? std::string(user) : "unknown";
+  const std::string path = "/tmp/" + userstr + "_test_quantized.mdl";
+  save(path, quantized);
+  std::shared_ptr<Module> loaded;
+  load(path, loaded);
+  ASSERT_TRUE(allClose(loaded->forward({input}).front(), quantizedOutput));
+
+  ASSERT_THROW(parseQuantizationType("int4"), std::invalid_argument);
+}
+
+TEST(W2lModuleTest, MixedPrecisionModule) {
+  if (!af::isHalfAvailable(af::getDevice())) {
+    return;
+  }
+  const std::string archfile = pathsConcat(archDir, "test_w2l_arch.txt");
+  int nchannel = 4;
+  int nclass = 40;
+  auto model = createW2lSeqModule(archfile, nchannel, nclass);
+  model->eval();
+  auto input = noGrad(af::randn(100, 1, nchannel, 1, f32));
+  auto output = model->forward(input);
+
+  // The mixed-precision network shares the params of the model
+  auto mixed = toMixedPrecision(model);
+  ASSERT_EQ(mixed->params().size(), model->params().size());
+  auto mixedOutput = mixed->forward({input}).front();
+  ASSERT_EQ(mixedOutput.type(), f32);
+  ASSERT_TRUE(allClose(mixedOutput, output, 5e-2));
+
+  // The fp32 params get fp32 gradients
+  mixedOutput.backward();
+  for (const auto& param : mixed->params()) {
+    ASSERT_EQ(param.type(), f32);
+    ASSERT_TRUE(param.isGradAvailable());
+    ASSERT_EQ(param.grad().type(), f32);
+  }
+}
+
+TEST(W2lModuleTest, CheckpointModule) {
+  std::vector<std::shared_ptr<Module>> layers = {
+      std::make_shared<Linear>(8, 16),
+      std::make_shared<ReLU>(),
+      std::make_shared<Linear>(16, 4)};
+  auto seq = std::make_shared<Sequential>();
+  for (const auto& layer : layers) {
+    seq->add(layer);
+  }
+  // The checkpointed segment shares the params of the sequential one
+  auto checkpoint = std::make_shared<CheckpointModule>(layers);
+  ASSERT_EQ(checkpoint->params().size(), seq->params().size());
+
+  auto input = Variable(af::randn(8, 10), true);
+  auto output = seq->forward(input);
+  output.backward();
+  auto inputGrad = input.grad().array();
+  std::vector<af::array> paramGrads;
+  for (auto& param : seq->params()) {
+    paramGrads.push_back(param.grad().array());
+    param.zeroGrad();
+  }
+  input.zeroGrad();
+
+  auto ckptOutput = checkpoint->forward({input}).front();
+  ASSERT_TRUE(allClose(ckptOutput, output));
+  ckptOutput.backward();
+  ASSERT_TRUE(allClose(input.grad().array(), inputGrad));
+  auto params = checkpoint->params();
+  for (int i = 0; i < params.size(); ++i) {
+    ASSERT_TRUE(params[i].isGradAvailable());
+    ASSERT_TRUE(allClose(params[i].grad().array(), paramGrads[i]));
+  }
+}
+
+TEST(W2lModuleTest, CheckpointArch) {
+  char* user = getenv("USER");
+  std::string userstr = "unknown";
+  if (user != nullptr) {
+    userstr = std::string(user);
+  }
+  const std::string archfile = "/tmp/" + userstr + "_test_ckpt_arch.txt";
+  {
+    std::ofstream arch(archfile);
+    arch << "V -1 1 NFEAT 0\n"
+         << "CKPT 2\n"
+         << "RES 2 1 1\n"
+         << "C NFEAT NFEAT 3 1 -1\n"
+         << "R\n"
+         << "SKIP 0 2\n"
+         << "C NFEAT 8 3 1 -1\n"
+         << "RO 2 0 3 1\n"
+         << "L 8 NLABEL\n";
+  }
+  auto model = createW2lSeqModule(archfile, 4, 10);
+  ASSERT_EQ(model->modules().size(), 4);
+  auto checkpoint =
+      std::dynamic_pointer_cast<CheckpointModule>(model->module(1));
+  ASSERT_TRUE(checkpoint);
+  ASSERT_EQ(checkpoint->modules().size(), 2);
+  ASSERT_TRUE(std::dynamic_pointer_cast<Residual>(checkpoint->module(0)));
+
+  auto input = noGrad(af::randn(20, 1, 4, 2));
+  auto output = model->forward(input);
+  ASSERT_EQ(output.dims(), af::dim4(10, 20, 2));
+  output.backward();
+  for (const auto& param : model->params()) {
+    ASSERT_TRUE(param.isGradAvailable());
+  }
+}
+
 TEST(W2lModuleTest, Serialization) {
   char* user = getenv("USER");
   std::string userstr = "unknown";
@@ -68,6 +68,101 @@ TEST(W2lModuleTest, GCNN14BCrossEntropy) {
   ASSERT_EQ(output.dims(), af::dim4(nclass, inputlength, batchsize));
 }
 
+TEST(W2lModuleTest, GCNN14BIncrementalScores) {
+  const std::string archfile = pathsConcat(archDir, "gcnn_14B_lm_arch_ce.txt");
+  int nclass = 30;
+  int sampleSize = 20;
+
+  std::shared_ptr<fl::Module> model = createW2lSeqModule(archfile, 1, nclass);
+  model->eval();
+  auto fullScores = buildGetConvLmScoreFunction(model);
+  auto incrementalScores = buildIncrementalConvLmScoreFunction(model, 100);
+
+  // Two histories sharing their prefix, extended by a token at each call
+  std::vector<int> inputs(2 * sampleSize);
+  for (int t = 0; t < sampleSize; ++t) {
+    inputs[t] = t % nclass;
+    inputs[sampleSize + t] = t < 5 ? inputs[t] : (3 * t) % nclass;
+  }
+  for (int t = 0; t < sampleSize; ++t) {
+    std::vector<int> lastTokenPositions = {t, t};
+    auto expected = fullScores(inputs, lastTokenPositions, sampleSize, 2);
+    auto scores = incrementalScores(inputs, lastTokenPositions, sampleSize, 2);
+    ASSERT_EQ(scores.size(), 2);
+    for (int b = 0; b < 2; ++b) {
+      ASSERT_EQ(scores[b].size(), nclass);
+      for (int c = 0; c < nclass; ++c) {
+        ASSERT_NEAR(scores[b][c], expected[b][c], 1e-4);
+      }
+    }
+  }
+}
+
+TEST(W2lModuleTest, GCNN14BHistorySize) {
+  const std::string archfile = pathsConcat(archDir, "gcnn_14B_lm_arch_ce.txt");
+  int nclass = 30;
+
+  std::shared_ptr<fl::Module> model = createW2lSeqModule(archfile, 1, nclass);
+  model->eval();
+  int historySize = convLmHistorySize(model, -1);
+  ASSERT_GT(historySize, 1);
+
+  // A history longer than historySize scores as its last historySize tokens
+  int sampleSize = historySize + 10;
+  auto scoreFunc = buildGetConvLmScoreFunction(model);
+  std::vector<int> inputs(sampleSize);
+  for (int t = 0; t < sampleSize; ++t) {
+    inputs[t] = (5 * t + 1) % nclass;
+  }
+  std::vector<int> truncated(inputs.end() - historySize, inputs.end());
+  auto expected = scoreFunc(truncated, {historySize - 1}, historySize, 1);
+  auto scores = scoreFunc(inputs, {sampleSize - 1}, sampleSize, 1);
+  ASSERT_EQ(scores[0].size(), nclass);
+  for (int c = 0; c < nclass; ++c) {
+    ASSERT_NEAR(scores[0][c], expected[0][c], 1e-4);
+  }
+}
+
+TEST(W2lModuleTest, GCNN14BAdaptiveSoftmaxCandidateScores) {
+  const std::string archfile = pathsConcat(archDir, "gcnn_14B_lm_arch_as.txt");
+  int nclass = 30;
+  int sampleSize = 10;
+  int batchSize = 2;
+
+  auto model = createW2lSeqModule(archfile, 1, nclass);
+  model->add(std::make_shared<fl::AdaptiveSoftMax>(
+      4096, std::vector<int>{10, 20, nclass}));
+  model->eval();
+  auto fullScores = buildGetConvLmScoreFunction(model);
+  auto candidateScores = buildCandidateConvLmScoreFunction(model);
+
+  std::vector<int> inputs(sampleSize * batchSize);
+  for (int i = 0; i < inputs.size(); ++i) {
+    inputs[i] = (7 * i) % nclass;
+  }
+  std::vector<int> lastTokenPositions = {sampleSize - 1, 4};
+  // Candidates in the head and in both tail clusters, or none
+  std::vector<std::vector<int>> candidates = {{3, 12, 25, 29}, {}};
+  int shortlistSize = 5;
+  auto expected =
+      fullScores(inputs, lastTokenPositions, sampleSize, batchSize);
+  auto scores = candidateScores(
+      inputs,
+      lastTokenPositions,
+      candidates,
+      shortlistSize,
+      sampleSize,
+      batchSize);
+  ASSERT_EQ(scores.size(), batchSize);
+  for (int b = 0; b < batchSize; ++b) {
+    ASSERT_EQ(scores[b].size(), shortlistSize + candidates[b].size());
+    for (int j = 0; j < scores[b].size(); ++j) {
+      int token = j < shortlistSize ? j : candidates[b][j - shortlistSize];
+      ASSERT_NEAR(scores[b][j], expected[b][token], 1e-4);
+    }
+  }
+}
+
 TEST(W2lModuleTest, SerializationGCNN14BAdaptiveSoftmax) {
   char* user = getenv("USER");
   std::string userstr = "unknown";
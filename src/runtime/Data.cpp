@@ -8,8 +8,10 @@
 
 #include <glog/logging.h>
 
+#include "data/SyntheticDataset.h"
 #include "data/W2lBlobsDataset.h"
 #include "data/W2lListFilesDataset.h"
+#include "data/W2lStreamingDataset.h"
 #include "runtime/Data.h"
 
 #ifdef W2L_BUILD_FB_DEPENDENCIES
@@ -73,6 +75,57 @@ std::shared_ptr<W2lDataset> createDataset(
   return ds;
 }
 
+std::shared_ptr<W2lDataset> createStreamingDataset(
+    const std::string& path,
+    const DictionaryMap& dicts,
+    const LexiconMap& lexicon /* = LexiconMap() */,
+    int batchSize /* = 1 */,
+    int worldRank /* = 0 */,
+    int worldSize /* = 1 */,
+    bool fallback2Ltr /* = true */,
+    bool skipUnk /* = true */) {
+  if (FLAGS_everstoredb || FLAGS_blobdata) {
+    LOG(FATAL) << "--stream_buffer only streams list files";
+  }
+  return std::make_shared<W2lStreamingDataset>(
+      path,
+      dicts,
+      lexicon,
+      batchSize,
+      worldRank,
+      worldSize,
+      FLAGS_stream_buffer,
+      FLAGS_stream_bucket_batches,
+      FLAGS_stream_epoch_batches,
+      FLAGS_seed,
+      fallback2Ltr,
+      skipUnk,
+      FLAGS_datadir);
+}
+
+std::shared_ptr<W2lDataset> createSyntheticDataset(
+    const DictionaryMap& dicts,
+    int batchSize /* = 1 */,
+    int worldRank /* = 0 */,
+    int worldSize /* = 1 */) {
+  auto frames = split(',', FLAGS_synthetic_frames);
+  if (frames.size() != 2) {
+    LOG(FATAL) << "--synthetic_frames should be min,max, not "
+               << FLAGS_synthetic_frames;
+  }
+  return std::make_shared<SyntheticDataset>(
+      dicts,
+      FLAGS_synthetic_samples,
+      getSpeechFeatureSize(),
+      std::stoll(frames[0]),
+      std::stoll(frames[1]),
+      FLAGS_synthetic_framespertoken,
+      batchSize,
+      worldRank,
+      worldSize,
+      FLAGS_seed);
+}
+
 std::shared_ptr<fl::Dataset> loadDataset(
     const std::vector<std::string>& paths,
     const std::string& rootDir /*  = "" */,
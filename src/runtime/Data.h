@@ -36,4 +36,29 @@ std::shared_ptr<W2lDataset> createDataset(
     bool fallback2Ltr = true,
     bool skipUnk = true);
 
+/**
+ * Dataset streaming the list files of `path` through a shuffle buffer, as set
+ * by --stream_buffer, --stream_bucket_batches and --stream_epoch_batches (see
+ * W2lStreamingDataset).
+ */
+std::shared_ptr<W2lDataset> createStreamingDataset(
+    const std::string& path,
+    const DictionaryMap& dicts,
+    const LexiconMap& lexicon = LexiconMap(),
+    int batchSize = 1,
+    int worldRank = 0,
+    int worldSize = 1,
+    bool fallback2Ltr = true,
+    bool skipUnk = true);
+
+/**
+ * Dataset of the random samples of the shapes set by --synthetic_samples,
+ * --synthetic_frames and --synthetic_framespertoken, generated on the device.
+ */
+std::shared_ptr<W2lDataset> createSyntheticDataset(
+    const DictionaryMap& dicts,
+    int batchSize = 1,
+    int worldRank = 0,
+    int worldSize = 1);
+
 } // namespace w2l
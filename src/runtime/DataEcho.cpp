@@ -0,0 +1,78 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "runtime/DataEcho.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace w2l {
+
+namespace {
+
+// The loop is starved when it waits for more than this part of the time it
+// computes
+constexpr double kStarvedWait = 0.1;
+
+} // namespace
+
+DataEcho::DataEcho(int64_t maxFactor, int64_t window /* = 16 */)
+    : maxFactor_(maxFactor),
+      window_(window),
+      factor_(1),
+      batches_(0),
+      waitSec_(0),
+      computeSec_(0),
+      gets_(0),
+      readySum_(0) {
+  if (maxFactor_ < 1 || window_ < 1) {
+    throw std::invalid_argument("DataEcho: invalid factor or window");
+  }
+}
+
+bool DataEcho::add(
+    double waitSec,
+    double computeSec,
+    const BatchPrefetcher::Stats& prefetchStats) {
+  ++batches_;
+  waitSec_ += waitSec;
+  computeSec_ += computeSec;
+  // The stats are reset at each epoch
+  bool reset = prefetchStats.gets < lastStats_.gets;
+  gets_ += prefetchStats.gets - (reset ? 0 : lastStats_.gets);
+  readySum_ += prefetchStats.readySum - (reset ? 0 : lastStats_.readySum);
+  lastStats_ = prefetchStats;
+  if (batches_ < window_) {
+    return false;
+  }
+
+  if (computeSec_ > 0 && waitSec_ > kStarvedWait * computeSec_) {
+    // A batch takes about its wait and its echoes to load
+    double echoSec = computeSec_ / (batches_ * factor_);
+    double loadSec = (waitSec_ + computeSec_) / batches_;
+    factor_ = std::max<int64_t>(factor_, std::lround(loadSec / echoSec));
+  } else if (gets_ > 0 && readySum_ > gets_) {
+    // More than the batch requested is ready on average
+    --factor_;
+  }
+  factor_ = std::min(std::max<int64_t>(factor_, 1), maxFactor_);
+
+  batches_ = 0;
+  waitSec_ = 0;
+  computeSec_ = 0;
+  gets_ = 0;
+  readySum_ = 0;
+  return true;
+}
+
+void DataEcho::setFactor(int64_t factor) {
+  factor_ = std::min(std::max<int64_t>(factor, 1), maxFactor_);
+}
+
+} // namespace w2l
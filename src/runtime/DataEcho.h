@@ -0,0 +1,68 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include "data/BatchPrefetcher.h"
+
+namespace w2l {
+
+/**
+ * DataEcho chooses how many times the training loop uses each batch it loads
+ * (data echoing), so that the devices keep training while the data pipeline
+ * can't keep up with them. Each echo is a step of its own, and the network
+ * draws new SpecAugment masks for it.
+ *
+ * The factor is updated at the end of each window of `window` batches:
+ * - while the loop waits for the batches for more than a tenth of the time it
+ *   computes, it's raised to the ratio of the time a batch takes to load to
+ *   the time an echo takes to compute;
+ * - while the prefetcher holds batches loaded ahead, it's lowered by 1, until
+ *   the loop waits again.
+ * It stays within [1, maxFactor].
+ */
+class DataEcho {
+ public:
+  explicit DataEcho(int64_t maxFactor, int64_t window = 16);
+
+  /* The number of times to use the next batch */
+  int64_t factor() const {
+    return factor_;
+  }
+
+  /**
+   * Records a batch loaded, which was used factor() times: the seconds the
+   * loop waited for it and computed its echoes, and the stats of the
+   * prefetcher after it was loaded. Returns whether the factor was updated,
+   * at the end of a window.
+   */
+  bool add(
+      double waitSec,
+      double computeSec,
+      const BatchPrefetcher::Stats& prefetchStats);
+
+  /* Overrides the factor, e.g. with the one of another process */
+  void setFactor(int64_t factor);
+
+ private:
+  int64_t maxFactor_;
+  int64_t window_;
+  int64_t factor_;
+
+  // The current window, with the gets and ready batches of the prefetcher
+  int64_t batches_;
+  double waitSec_;
+  double computeSec_;
+  int64_t gets_;
+  int64_t readySum_;
+  BatchPrefetcher::Stats lastStats_;
+};
+
+} // namespace w2l
@@ -6,10 +6,25 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+
 #include <flashlight/distributed/distributed.h>
 
 #include "common/Defines.h"
 #include "runtime/Distributed.h"
+#include "runtime/Serial.h"
+
+namespace {
+
+// Size of the buffers in which the parameters are gathered
+constexpr int64_t kGatherBytes = 64 << 20;
+
+} // namespace
 
 namespace w2l {
 
@@ -35,4 +50,308 @@ void initDistributed(
   }
 }
 
+GradientCompression parseGradientCompression(const std::string& type) {
+  if (type == "none") {
+    return GradientCompression::NONE;
+  } else if (type == "fp16") {
+    return GradientCompression::FP16;
+  }
+  throw std::invalid_argument("Unknown gradient compression: " + type);
+}
+
+BucketedReducer::BucketedReducer(
+    double scale,
+    size_t bucketBytes,
+    GradientCompression compression /* = GradientCompression::NONE */,
+    std::shared_ptr<HierarchicalAllReduce> hierarchical /* = nullptr */)
+    : scale_(scale),
+      bucketBytes_(bucketBytes),
+      compression_(compression),
+      hierarchical_(std::move(hierarchical)) {}
+
+void BucketedReducer::add(fl::Variable& var) {
+  if (!current_.vars.empty() &&
+      current_.vars.front().type() != var.type()) {
+    flush();
+  }
+  current_.vars.push_back(var);
+  currentBytes_ += var.bytes();
+  if (currentBytes_ >= bucketBytes_) {
+    flush();
+  }
+}
+
+void BucketedReducer::flush() {
+  if (current_.vars.empty()) {
+    return;
+  }
+  int64_t nElements = 0;
+  for (const auto& var : current_.vars) {
+    nElements += var.elements();
+  }
+  // Padded to split evenly between the processes of a node
+  int64_t nPadded = nElements;
+  if (hierarchical_) {
+    int localSize = hierarchical_->localSize();
+    nPadded = (nElements + localSize - 1) / localSize * localSize;
+  }
+  current_.data = af::array(nPadded, current_.vars.front().type());
+  if (nPadded > nElements) {
+    current_.data(af::seq(nElements, nPadded - 1)) = 0;
+  }
+  int64_t offset = 0;
+  for (const auto& var : current_.vars) {
+    current_.data(af::seq(offset, offset + var.elements() - 1)) =
+        af::flat(var.array());
+    offset += var.elements();
+  }
+  if (compression_ == GradientCompression::FP16) {
+    // Scaled before the reduction so that the sum stays in the fp16 range
+    size_t index = pending_.size();
+    auto data = current_.data * scale_;
+    if (index < residuals_.size() &&
+        residuals_[index].elements() == data.elements()) {
+      data += residuals_[index];
+    }
+    current_.data = data.as(f16);
+    auto residual = data - current_.data.as(data.type());
+    if (index < residuals_.size()) {
+      residuals_[index] = residual;
+    } else {
+      residuals_.push_back(residual);
+    }
+  }
+  if (hierarchical_) {
+    hierarchical_->allReduce(current_.data);
+  } else {
+    fl::allReduce(current_.data, true /* async */);
+  }
+  pending_.push_back(std::move(current_));
+  current_ = Bucket();
+  currentBytes_ = 0;
+}
+
+void BucketedReducer::finalize() {
+  flush();
+  if (hierarchical_) {
+    hierarchical_->sync();
+  } else {
+    fl::syncDistributed();
+  }
+  for (auto& bucket : pending_) {
+    int64_t offset = 0;
+    for (auto& var : bucket.vars) {
+      auto reduced = bucket.data(af::seq(offset, offset + var.elements() - 1));
+      reduced = compression_ == GradientCompression::NONE
+          ? reduced * scale_
+          : reduced.as(var.type());
+      var.array() = af::moddims(reduced, var.dims());
+      offset += var.elements();
+    }
+  }
+  pending_.clear();
+}
+
+size_t measureBucketBytes() {
+  auto allReduceSeconds = [](int64_t bytes) {
+    af::array data = af::constant(1, bytes / sizeof(float), f32);
+    fl::allReduce(data);
+    fl::syncDistributed();
+    af::sync();
+    const int nIters = 5;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < nIters; ++i) {
+      fl::allReduce(data);
+    }
+    fl::syncDistributed();
+    af::sync();
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return elapsed.count() / nIters;
+  };
+  const double smallBytes = 1 << 20, largeBytes = 16 << 20;
+  double times[] = {allReduceSeconds(smallBytes),
+                    allReduceSeconds(largeBytes)};
+  // Summed over the ranks, which get the same buckets: only the ratios of
+  // the times matter
+  af::array timesArray(2, times);
+  fl::allReduce(timesArray);
+  timesArray.host(times);
+
+  double secondsPerByte =
+      std::max(times[1] - times[0], 1e-12) / (largeBytes - smallBytes);
+  double latency = std::max(times[0] - smallBytes * secondsPerByte, 0.0);
+  double bucketBytes = 9 * latency / secondsPerByte;
+  return std::min(std::max(bucketBytes, smallBytes), 4 * largeBytes);
+}
+
+std::string broadcastBytes(const std::string& data, int root) {
+  bool isRoot = fl::getWorldRank() == root;
+  af::array size =
+      af::constant(isRoot ? static_cast<int64_t>(data.size()) : 0, 1, s64);
+  fl::allReduce(size);
+  int64_t nBytes;
+  size.host(&nBytes);
+
+  // The bytes are sent as int32 words, which the zeros leave unchanged
+  std::string res = isRoot ? data : std::string(nBytes, '\0');
+  std::vector<int32_t> words(kGatherBytes / sizeof(int32_t));
+  for (int64_t begin = 0; begin < nBytes; begin += kGatherBytes) {
+    int64_t chunkBytes = std::min(kGatherBytes, nBytes - begin);
+    int64_t nWords = (chunkBytes + sizeof(int32_t) - 1) / sizeof(int32_t);
+    af::array chunk;
+    if (isRoot) {
+      words[nWords - 1] = 0;
+      std::memcpy(words.data(), res.data() + begin, chunkBytes);
+      chunk = af::array(nWords, words.data());
+    } else {
+      chunk = af::constant(0, nWords, s32);
+    }
+    fl::allReduce(chunk);
+    if (!isRoot) {
+      chunk.host(words.data());
+      std::memcpy(&res[begin], words.data(), chunkBytes);
+    }
+  }
+  return res;
+}
+
+ShardedOptimizer::ShardedOptimizer(
+    const std::vector<fl::Variable>& parameters,
+    OptimizerType type,
+    double learningRate,
+    double momentum /* = 0 */,
+    double beta1 /* = 0.9 */,
+    double beta2 /* = 0.999 */,
+    double rho /* = 0.9 */,
+    double epsilon /* = 1e-8 */,
+    double weightDecay /* = 0 */)
+    : fl::FirstOrderOptimizer(parameters, learningRate),
+      type_(static_cast<int>(type)),
+      momentum_(momentum),
+      beta1_(beta1),
+      beta2_(beta2),
+      rho_(rho),
+      eps_(epsilon),
+      wd_(weightDecay) {
+  partition();
+}
+
+void ShardedOptimizer::partition() {
+  int worldRank = fl::getWorldRank();
+  int worldSize = fl::getWorldSize();
+
+  std::vector<size_t> order(parameters_.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+    return parameters_[a].elements() > parameters_[b].elements();
+  });
+  std::vector<int64_t> loads(worldSize, 0);
+  owners_.assign(parameters_.size(), 0);
+  std::vector<fl::Variable> local;
+  for (auto i : order) {
+    int owner = std::min_element(loads.begin(), loads.end()) - loads.begin();
+    owners_[i] = owner;
+    loads[owner] += parameters_[i].elements();
+  }
+  for (size_t i = 0; i < parameters_.size(); ++i) {
+    if (owners_[i] == worldRank) {
+      local.push_back(parameters_[i]);
+    }
+  }
+
+  local_ = std::make_shared<FusedOptimizer>(
+      local,
+      static_cast<OptimizerType>(type_),
+      lr_,
+      momentum_,
+      beta1_,
+      beta2_,
+      rho_,
+      eps_,
+      wd_);
+}
+
+void ShardedOptimizer::step() {
+  if (!local_) {
+    partition();
+  }
+  local_->setLr(lr_);
+  local_->step();
+  gather();
+}
+
+void ShardedOptimizer::gather() {
+  // The other processes add zeros to the parameters of their owner
+  int worldRank = fl::getWorldRank();
+  size_t begin = 0;
+  while (begin < parameters_.size()) {
+    size_t end = begin;
+    int64_t nElements = 0;
+    while (end < parameters_.size() &&
+           (end == begin ||
+            (nElements + parameters_[end].elements()) * sizeof(float) <=
+                kGatherBytes)) {
+      nElements += parameters_[end++].elements();
+    }
+
+    af::array data = af::constant(0, nElements, f32);
+    int64_t offset = 0;
+    for (size_t i = begin; i < end; ++i) {
+      auto& param = parameters_[i];
+      if (owners_[i] == worldRank) {
+        data(af::seq(offset, offset + param.elements() - 1)) =
+            af::flat(param.array());
+      }
+      offset += param.elements();
+    }
+    fl::allReduce(data);
+    offset = 0;
+    for (size_t i = begin; i < end; ++i) {
+      auto& param = parameters_[i];
+      if (owners_[i] != worldRank) {
+        param.array() = af::moddims(
+            data(af::seq(offset, offset + param.elements() - 1)),
+            param.dims());
+      }
+      offset += param.elements();
+    }
+    begin = end;
+  }
+}
+
+std::string ShardedOptimizer::prettyString() const {
+  std::ostringstream ss;
+  ss << "Sharded" << (local_ ? local_->prettyString() : std::string());
+  ss << " (processes=" << fl::getWorldSize() << ")";
+  return ss.str();
+}
+
+std::string ShardedOptimizer::shardPath(const std::string& prefix) const {
+  return prefix + "-" + std::to_string(fl::getWorldRank()) + "-of-" +
+      std::to_string(fl::getWorldSize());
+}
+
+void ShardedOptimizer::saveShard(const std::string& prefix) {
+  if (!local_) {
+    partition();
+  }
+  W2lSerializer::save(shardPath(prefix), local_->getState());
+}
+
+void ShardedOptimizer::loadShard(const std::string& prefix) {
+  if (!local_) {
+    partition();
+  }
+  auto filepath = shardPath(prefix);
+  if (!fileExists(filepath)) {
+    LOG(WARNING) << "No optimizer states in " << filepath
+                 << ", starting from fresh states";
+    return;
+  }
+  FusedOptimizer::State state;
+  W2lSerializer::load(filepath, state);
+  local_->setState(state);
+}
+
 } // namespace w2l
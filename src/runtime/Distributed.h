@@ -8,7 +8,13 @@
 
 #pragma once
 
+#include <memory>
 #include <string>
+#include <vector>
+
+#include <flashlight/flashlight.h>
+
+#include "runtime/FusedOptimizer.h"
 
 namespace w2l {
 
@@ -17,4 +23,192 @@ void initDistributed(
     int worldSize,
     const std::string& rndvFilepath);
 
+enum class GradientCompression {
+  NONE = 0,
+  // fp16 all-reduce of the pre-scaled gradients, with the rounding error of
+  // each step added to the gradients of the next one (error feedback)
+  FP16 = 1,
+};
+
+/* Parses "none" or "fp16" */
+GradientCompression parseGradientCompression(const std::string& type);
+
+/**
+ * HierarchicalAllReduce sums arrays over all the processes in three steps:
+ * a reduce-scatter between the processes of a node (over NVLink), an
+ * all-reduce of each slice between the nodes, and an all-gather in the node.
+ * Each process then only sends 1/localSize of the data across nodes. The
+ * processes of a node are found from their host names, and all the nodes
+ * must run the same number of processes.
+ *
+ * The sums run on a stream of their own, after the work queued before on
+ * the active stream. Only the CUDA backend built with NCCL is supported,
+ * otherwise the constructor throws. It must be called by all the processes.
+ */
+class HierarchicalAllReduce {
+ public:
+  HierarchicalAllReduce();
+  ~HierarchicalAllReduce();
+
+  HierarchicalAllReduce(const HierarchicalAllReduce&) = delete;
+  HierarchicalAllReduce& operator=(const HierarchicalAllReduce&) = delete;
+
+  /**
+   * Starts the in-place sum of `data` (float32 or float16), whose number of
+   * elements must be a multiple of localSize(). `data` must be kept until
+   * sync().
+   */
+  void allReduce(af::array& data);
+
+  /* Makes the work queued next on the active stream wait for the sums */
+  void sync();
+
+  int localSize() const;
+
+  int nNodes() const;
+
+ private:
+  struct Impl;
+  std::unique_ptr<Impl> impl_;
+};
+
+/**
+ * Reduces the gradients in buckets while the backward runs. The gradients
+ * are added as the backward produces them, i.e. from the last layers to the
+ * first ones, and a bucket is all-reduced asynchronously as soon as it holds
+ * `bucketBytes`, so its communication overlaps the backward of the earlier
+ * layers. finalize() reduces the last bucket, waits for all of them and
+ * copies the reduced gradients back, scaled by `scale`.
+ *
+ * With a compression, the buckets are all-reduced in a smaller type. The
+ * buckets being the same at each step, the compression error of each bucket
+ * is kept and added to the bucket of the next step. With `hierarchical`, the
+ * buckets are all-reduced with it instead of flashlight's all-reduce.
+ */
+class BucketedReducer : public fl::Reducer {
+ public:
+  BucketedReducer(
+      double scale,
+      size_t bucketBytes,
+      GradientCompression compression = GradientCompression::NONE,
+      std::shared_ptr<HierarchicalAllReduce> hierarchical = nullptr);
+
+  void add(fl::Variable& var) override;
+
+  void finalize() override;
+
+  size_t bucketBytes() const {
+    return bucketBytes_;
+  }
+
+ private:
+  struct Bucket {
+    std::vector<fl::Variable> vars;
+    af::array data; // the flattened gradients, once flushed
+  };
+
+  double scale_;
+  size_t bucketBytes_;
+  GradientCompression compression_;
+  std::shared_ptr<HierarchicalAllReduce> hierarchical_;
+  // Compression error of each bucket of the last step
+  std::vector<af::array> residuals_;
+  Bucket current_;
+  size_t currentBytes_{0};
+  std::vector<Bucket> pending_;
+
+  /* Starts the all-reduce of the current bucket */
+  void flush();
+};
+
+/**
+ * Bucket size for which the latency of an all-reduce is about a tenth of its
+ * time, from the times of all-reduces of 1MB and 16MB, clamped to
+ * [1MB, 64MB]. The times are averaged over the ranks, which must all call it.
+ */
+size_t measureBucketBytes();
+
+/**
+ * Sends the bytes of `data` from the process `root` to all the others, and
+ * returns them (`data` is ignored on the other processes). The bytes are
+ * all-reduced in chunks, the other processes adding zeros, so it goes
+ * through the communicators set up by initDistributed(). It must be called
+ * by all the processes.
+ */
+std::string broadcastBytes(const std::string& data, int root);
+
+/**
+ * ShardedOptimizer partitions the optimizer states across the processes
+ * (ZeRO stage 1): each parameter is owned by one process, which alone keeps
+ * its states and updates it with a FusedOptimizer, and the updated parameters
+ * are then gathered from their owners. The parameters are assigned to the
+ * processes by decreasing size, each to the least loaded one, so the states
+ * take about 1/worldSize of their memory on each process.
+ *
+ * The states are not serialized with the optimizer: each process writes and
+ * reads its own shard next to a checkpoint with saveShard() / loadShard().
+ */
+class ShardedOptimizer : public fl::FirstOrderOptimizer {
+ public:
+  ShardedOptimizer(
+      const std::vector<fl::Variable>& parameters,
+      OptimizerType type,
+      double learningRate,
+      double momentum = 0,
+      double beta1 = 0.9,
+      double beta2 = 0.999,
+      double rho = 0.9,
+      double epsilon = 1e-8,
+      double weightDecay = 0);
+
+  void step() override;
+
+  std::string prettyString() const override;
+
+  /* Writes the states of this process to `prefix`-<rank>-of-<worldSize> */
+  void saveShard(const std::string& prefix);
+
+  /**
+   * Reads the states of this process written by saveShard(`prefix`). The
+   * states are left fresh if they were written by another number of
+   * processes.
+   */
+  void loadShard(const std::string& prefix);
+
+ private:
+  FL_SAVE_LOAD_WITH_BASE(
+      fl::FirstOrderOptimizer,
+      type_,
+      momentum_,
+      beta1_,
+      beta2_,
+      rho_,
+      eps_,
+      wd_)
+
+  ShardedOptimizer() = default;
+
+  int type_; // OptimizerType
+  float momentum_;
+  float beta1_;
+  float beta2_;
+  float rho_;
+  float eps_;
+  float wd_;
+
+  // Owner process of each parameter, and the optimizer of the parameters of
+  // this process, set up by the first step after a load
+  std::vector<int> owners_;
+  std::shared_ptr<FusedOptimizer> local_;
+
+  void partition();
+
+  /* Copies the parameters of each process to all the others */
+  void gather();
+
+  std::string shardPath(const std::string& prefix) const;
+};
+
 } // namespace w2l
+
+CEREAL_REGISTER_TYPE(w2l::ShardedOptimizer)
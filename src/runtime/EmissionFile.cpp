@@ -0,0 +1,313 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "runtime/EmissionFile.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+
+namespace w2l {
+
+namespace {
+
+/* Rounds to the nearest half, ties to even */
+uint16_t floatToHalf(float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  uint16_t sign = (bits >> 16) & 0x8000;
+  uint32_t absBits = bits & 0x7fffffff;
+  if (absBits >= 0x7f800000) { // inf, nan
+    return sign | 0x7c00 | (absBits > 0x7f800000 ? 0x200 : 0);
+  }
+  if (absBits >= 0x477ff000) { // rounds above 65504
+    return sign | 0x7c00;
+  }
+  if (absBits < 0x38800000) { // subnormal halves, in units of 2^-24
+    float absValue;
+    std::memcpy(&absValue, &absBits, sizeof(absValue));
+    return sign | static_cast<uint16_t>(std::nearbyint(absValue * 16777216.0f));
+  }
+  uint32_t mantissa = absBits & 0x7fffff;
+  uint32_t half = (((absBits >> 23) - 112) << 10) | (mantissa >> 13);
+  uint32_t rest = mantissa & 0x1fff;
+  if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) {
+    ++half; // may carry into the exponent, which is still the right rounding
+  }
+  return sign | half;
+}
+
+float halfToFloat(uint16_t half) {
+  uint32_t sign = static_cast<uint32_t>(half & 0x8000) << 16;
+  uint32_t exponent = (half >> 10) & 0x1f;
+  uint32_t mantissa = half & 0x3ff;
+  if (exponent == 0) {
+    float value = std::ldexp(static_cast<float>(mantissa), -24);
+    return sign ? -value : value;
+  }
+  uint32_t bits = sign | (mantissa << 13) |
+      (exponent == 0x1f ? 0x7f800000 : (exponent + 112) << 23);
+  float value;
+  std::memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+/* All the halves converted, so that reading a sample is a table lookup */
+const std::vector<float>& halfTable() {
+  static const std::vector<float> table = []() {
+    std::vector<float> values(1 << 16);
+    for (uint32_t h = 0; h < values.size(); ++h) {
+      values[h] = halfToFloat(h);
+    }
+    return values;
+  }();
+  return table;
+}
+
+} // namespace
+
+EmissionFileWriter::EmissionFileWriter(
+    const std::string& path,
+    int topK,
+    int blank,
+    size_t queueSize)
+    : path_(path),
+      file_(path, std::ios::binary | std::ios::trunc),
+      topK_(topK),
+      blank_(blank),
+      queue_(queueSize) {
+  if (!file_.is_open()) {
+    throw std::runtime_error("EmissionFileWriter: can't open " + path);
+  }
+  if (topK < 0) {
+    throw std::invalid_argument("EmissionFileWriter: topK must be >= 0");
+  }
+  writer_ = std::thread([this]() {
+    std::pair<std::vector<float>, int> sample;
+    while (queue_.pop(sample)) {
+      try {
+        write(sample.first, sample.second);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(errorMutex_);
+        error_ = std::current_exception();
+        // The following samples are dropped, add() throws the error
+        queue_.close();
+        break;
+      }
+    }
+  });
+}
+
+EmissionFileWriter::~EmissionFileWriter() {
+  queue_.close();
+  if (writer_.joinable()) {
+    writer_.join();
+  }
+}
+
+void EmissionFileWriter::add(std::vector<float> emission, int N) {
+  rethrowError();
+  if (topK_ > 0 &&
+      (N <= 0 || N > std::numeric_limits<uint16_t>::max() ||
+       emission.size() % N != 0)) {
+    throw std::invalid_argument(
+        "EmissionFileWriter: top-k emissions need their N, less than 65536");
+  }
+  if (!queue_.push(std::make_pair(std::move(emission), N))) {
+    rethrowError();
+    throw std::logic_error("EmissionFileWriter: add() after finish()");
+  }
+}
+
+void EmissionFileWriter::write(const std::vector<float>& emission, int N) {
+  buffer_.clear();
+  if (topK_ == 0) {
+    buffer_.resize(emission.size());
+    for (size_t i = 0; i < emission.size(); ++i) {
+      buffer_[i] = floatToHalf(emission[i]);
+    }
+  } else {
+    // Per frame: the number n of tokens kept, the score of the others, then
+    // n (token, score) pairs, best first
+    const int K = std::min(topK_, N);
+    std::vector<int> order(N);
+    for (size_t offset = 0; offset < emission.size(); offset += N) {
+      const float* frame = emission.data() + offset;
+      std::iota(order.begin(), order.end(), 0);
+      std::partial_sort(
+          order.begin(), order.begin() + K, order.end(), [&](int l, int r) {
+            return frame[l] > frame[r] || (frame[l] == frame[r] && l < r);
+          });
+      bool withBlank = blank_ >= 0 && blank_ < N &&
+          std::find(order.begin(), order.begin() + K, blank_) ==
+              order.begin() + K;
+      buffer_.push_back(K + withBlank);
+      buffer_.push_back(floatToHalf(K > 0 ? frame[order[K - 1]] : -INFINITY));
+      for (int i = 0; i < K; ++i) {
+        buffer_.push_back(order[i]);
+        buffer_.push_back(floatToHalf(frame[order[i]]));
+      }
+      if (withBlank) {
+        buffer_.push_back(blank_);
+        buffer_.push_back(floatToHalf(frame[blank_]));
+      }
+    }
+  }
+  file_.write(
+      reinterpret_cast<const char*>(buffer_.data()),
+      buffer_.size() * sizeof(uint16_t));
+  if (!file_) {
+    throw std::runtime_error("EmissionFileWriter: failed to write " + path_);
+  }
+  offsets_.push_back(size_);
+  size_ += buffer_.size();
+}
+
+void EmissionFileWriter::rethrowError() {
+  std::lock_guard<std::mutex> lock(errorMutex_);
+  if (error_) {
+    std::rethrow_exception(error_);
+  }
+}
+
+void EmissionFileWriter::finish(const EmissionSet& meta) {
+  queue_.close();
+  if (writer_.joinable()) {
+    writer_.join();
+  }
+  rethrowError();
+  if (meta.emissionT.size() != offsets_.size() || !meta.emissions.empty()) {
+    throw std::invalid_argument(
+        "EmissionFileWriter: the index doesn't match the emissions added");
+  }
+  file_.close();
+  if (!file_) {
+    throw std::runtime_error("EmissionFileWriter: failed to write " + path_);
+  }
+  auto offsets = offsets_;
+  offsets.push_back(size_);
+  W2lSerializer::save(
+      EmissionFileReader::indexPath(path_), offsets, meta, topK_);
+}
+
+EmissionFileReader::EmissionFileReader(const std::string& path) {
+  W2lSerializer::load(indexPath(path), offsets_, meta_, topK_);
+  if (offsets_.size() != meta_.emissionT.size() + 1) {
+    throw std::runtime_error("EmissionFileReader: invalid index for " + path);
+  }
+
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("EmissionFileReader: can't open " + path);
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0) {
+    close(fd);
+    throw std::runtime_error("EmissionFileReader: can't stat " + path);
+  }
+  bytes_ = info.st_size;
+  if (bytes_ != offsets_.back() * sizeof(uint16_t)) {
+    close(fd);
+    throw std::runtime_error(
+        "EmissionFileReader: size of " + path + " doesn't match its index");
+  }
+  if (bytes_ > 0) {
+    // Not prefaulted: the pages of a sample are read when it is
+    void* data = mmap(nullptr, bytes_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      close(fd);
+      throw std::runtime_error("EmissionFileReader: can't map " + path);
+    }
+    data_ = static_cast<const uint16_t*>(data);
+  }
+  close(fd);
+}
+
+EmissionFileReader::~EmissionFileReader() {
+  if (data_) {
+    munmap(const_cast<uint16_t*>(data_), bytes_);
+  }
+}
+
+std::vector<float> EmissionFileReader::emission(int idx) const {
+  if (topK_ == 0) {
+    const auto& table = halfTable();
+    const uint16_t* begin = halfEmission(idx);
+    const uint16_t* end = data_ + offsets_[idx + 1];
+    std::vector<float> values(end - begin);
+    for (size_t i = 0; i < values.size(); ++i) {
+      values[i] = table[begin[i]];
+    }
+    return values;
+  }
+
+  auto sparse = sparseEmission(idx);
+  std::vector<float> values(static_cast<size_t>(sparse.T) * sparse.N);
+  for (int t = 0; t < sparse.T; ++t) {
+    sparse.densify(t, values.data() + static_cast<size_t>(t) * sparse.N);
+  }
+  return values;
+}
+
+const uint16_t* EmissionFileReader::halfEmission(int idx) const {
+  if (idx < 0 || idx >= size()) {
+    throw std::out_of_range("EmissionFileReader: invalid sample index");
+  }
+  if (topK_ > 0) {
+    throw std::logic_error("EmissionFileReader: the file stores top-k tokens");
+  }
+  return data_ + offsets_[idx];
+}
+
+SparseEmissions EmissionFileReader::sparseEmission(int idx) const {
+  if (idx < 0 || idx >= size()) {
+    throw std::out_of_range("EmissionFileReader: invalid sample index");
+  }
+  if (topK_ == 0) {
+    throw std::logic_error("EmissionFileReader: the file stores all tokens");
+  }
+  const auto& table = halfTable();
+  const uint16_t* end = data_ + offsets_[idx + 1];
+  const int T = meta_.emissionT[idx];
+  SparseEmissions sparse;
+  sparse.N = meta_.emissionN;
+  std::vector<int> tokens;
+  std::vector<float> scores;
+  const uint16_t* frame = data_ + offsets_[idx];
+  for (int t = 0; t < T; ++t) {
+    if (end - frame < 2 || end - frame < 2 + 2 * frame[0]) {
+      throw std::runtime_error("EmissionFileReader: truncated top-k sample");
+    }
+    const int size = frame[0];
+    tokens.resize(size);
+    scores.resize(size);
+    for (int i = 0; i < size; ++i) {
+      tokens[i] = frame[2 + 2 * i];
+      if (tokens[i] >= sparse.N) {
+        throw std::runtime_error("EmissionFileReader: invalid top-k token");
+      }
+      scores[i] = table[frame[3 + 2 * i]];
+    }
+    sparse.addFrame(tokens.data(), scores.data(), size, table[frame[1]]);
+    frame += 2 + 2 * size;
+  }
+  if (frame != end) {
+    throw std::runtime_error("EmissionFileReader: invalid top-k sample");
+  }
+  return sparse;
+}
+
+} // namespace w2l
@@ -0,0 +1,137 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "libraries/common/BlockingQueue.h"
+#include "libraries/decoder/Utils.h"
+#include "runtime/Serial.h"
+
+namespace w2l {
+
+/**
+ * An emission file stores the emissions of a test set as half-precision
+ * floats, one sample after the other, in `path`; the targets, sample ids,
+ * transitions and flags are kept in an index, `path` + ".index", along with
+ * the offset of each sample. The index is small and read at once, while the
+ * emissions are memory-mapped and paged in when a sample is read, so decoding
+ * can start without reading the whole file and the samples can be read in any
+ * order.
+ *
+ * With `topK` > 0, only the `topK` best tokens of each frame (and `blank`, if
+ * >= 0) are stored, the other tokens being read back with the `topK`-th best
+ * score of the frame, as --emission_topk does. A frame then takes
+ * 2 + 2 * `topK` halves instead of N.
+ *
+ * The samples are converted and written by a background thread: add() only
+ * blocks while `queueSize` samples are waiting, so the memory used doesn't
+ * grow with the test set and the writes overlap the forward passes.
+ */
+class EmissionFileWriter {
+ public:
+  explicit EmissionFileWriter(
+      const std::string& path,
+      int topK = 0,
+      int blank = -1,
+      size_t queueSize = 16);
+
+  /* Stops the writer thread, the file is incomplete without finish() */
+  ~EmissionFileWriter();
+
+  EmissionFileWriter(const EmissionFileWriter&) = delete;
+  EmissionFileWriter& operator=(const EmissionFileWriter&) = delete;
+
+  /**
+   * Appends the T x N emission of a sample; `N` is only needed with `topK`.
+   * Throws the error of a previous write, if any.
+   */
+  void add(std::vector<float> emission, int N = 0);
+
+  /**
+   * Waits for the samples added, then writes the index: `meta` holds the
+   * targets, ids and sizes of the samples in the order they were added, and
+   * no emissions.
+   */
+  void finish(const EmissionSet& meta);
+
+ private:
+  std::string path_;
+  std::ofstream file_;
+  int topK_;
+  int blank_;
+  std::vector<uint64_t> offsets_; // in halves
+  uint64_t size_{0};
+  std::vector<uint16_t> buffer_;
+
+  BlockingQueue<std::pair<std::vector<float>, int>> queue_;
+  std::thread writer_;
+  std::mutex errorMutex_;
+  std::exception_ptr error_;
+
+  // Run by writer_ on the samples of the queue
+  void write(const std::vector<float>& emission, int N);
+  void rethrowError();
+};
+
+class EmissionFileReader {
+ public:
+  explicit EmissionFileReader(const std::string& path);
+
+  ~EmissionFileReader();
+
+  EmissionFileReader(const EmissionFileReader&) = delete;
+  EmissionFileReader& operator=(const EmissionFileReader&) = delete;
+
+  /* The index of the samples, whose `emissions` are empty */
+  const EmissionSet& meta() const {
+    return meta_;
+  }
+
+  int size() const {
+    return meta_.emissionT.size();
+  }
+
+  /* The emission of the sample `idx`, safe to call from several threads */
+  std::vector<float> emission(int idx) const;
+
+  /* The number of tokens stored per frame, 0 if all the N are */
+  int topK() const {
+    return topK_;
+  }
+
+  /**
+   * The T x N halves of the sample `idx`, which stay mapped with the reader,
+   * for a file written without `topK`
+   */
+  const uint16_t* halfEmission(int idx) const;
+
+  /* The stored tokens of the sample `idx`, for a file written with `topK` */
+  SparseEmissions sparseEmission(int idx) const;
+
+  static std::string indexPath(const std::string& path) {
+    return path + ".index";
+  }
+
+ private:
+  EmissionSet meta_;
+  std::vector<uint64_t> offsets_; // in halves, with the end of the file
+  int topK_{0};
+  const uint16_t* data_{nullptr};
+  size_t bytes_{0};
+};
+
+} // namespace w2l
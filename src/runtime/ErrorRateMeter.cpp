@@ -0,0 +1,139 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "runtime/ErrorRateMeter.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+namespace w2l {
+
+void ErrorRateMeter::add(
+    const std::vector<std::string>& hypothesis,
+    const std::vector<std::string>& reference) {
+  toIds(hypothesis, hypothesisIds_);
+  toIds(reference, referenceIds_);
+  add(hypothesisIds_, referenceIds_);
+}
+
+void ErrorRateMeter::add(
+    const std::vector<int>& hypothesis,
+    const std::vector<int>& reference) {
+  errors_ += distance(
+      hypothesis.data(),
+      hypothesis.size(),
+      reference.data(),
+      reference.size());
+  length_ += reference.size();
+}
+
+void ErrorRateMeter::add(const ErrorRateMeter& other) {
+  errors_ += other.errors_;
+  length_ += other.length_;
+}
+
+double ErrorRateMeter::value() const {
+  return length_ > 0 ? 100.0 * errors_ / length_ : 0.0;
+}
+
+void ErrorRateMeter::reset() {
+  errors_ = 0;
+  length_ = 0;
+}
+
+void ErrorRateMeter::toIds(
+    const std::vector<std::string>& tokens,
+    std::vector<int>& ids) {
+  ids.resize(tokens.size());
+  for (size_t i = 0; i < tokens.size(); ++i) {
+    if (!tokens_.contains(tokens[i])) {
+      tokens_.addEntry(tokens[i]);
+    }
+    ids[i] = tokens_.getIndex(tokens[i]);
+  }
+}
+
+int64_t
+ErrorRateMeter::distance(const int* a, int64_t n, const int* b, int64_t m) {
+  // The common prefix and suffix, most of a good hypothesis, cost nothing
+  while (n > 0 && m > 0 && a[0] == b[0]) {
+    ++a;
+    ++b;
+    --n;
+    --m;
+  }
+  while (n > 0 && m > 0 && a[n - 1] == b[m - 1]) {
+    --n;
+    --m;
+  }
+  if (n < m) {
+    std::swap(a, b);
+    std::swap(n, m);
+  }
+  if (m == 0) {
+    return n;
+  }
+
+  // The columns of the DP matrix over `b`, of m rows, are kept as bit
+  // vectors of their vertical deltas: +1 (Pv) or -1 (Mv), in blocks of 64
+  // rows, advanced by one column for each token of `a`. Peq has for each
+  // token of `b` the bits of the rows where it occurs.
+  const int64_t kBits = 64;
+  int64_t numBlocks = (m + kBits - 1) / kBits;
+  std::unordered_map<int, int64_t> symbols;
+  std::vector<uint64_t> peq;
+  for (int64_t i = 0; i < m; ++i) {
+    auto it = symbols.emplace(b[i], symbols.size()).first;
+    if (peq.size() < (it->second + 1) * numBlocks) {
+      peq.resize((it->second + 1) * numBlocks, 0);
+    }
+    peq[it->second * numBlocks + i / kBits] |= uint64_t(1) << (i % kBits);
+  }
+  std::vector<uint64_t> pv(numBlocks, ~uint64_t(0));
+  std::vector<uint64_t> mv(numBlocks, 0);
+  const std::vector<uint64_t> noMatch(numBlocks, 0);
+  const uint64_t highBit = uint64_t(1) << (kBits - 1);
+  const uint64_t lastBit = uint64_t(1) << ((m - 1) % kBits);
+
+  int64_t score = m;
+  for (int64_t j = 0; j < n; ++j) {
+    auto it = symbols.find(a[j]);
+    const uint64_t* eqs = it == symbols.end()
+        ? noMatch.data()
+        : peq.data() + it->second * numBlocks;
+    // Horizontal delta entering the block from above: the first row of the
+    // matrix is 0, 1, ..., n
+    int hin = 1;
+    for (int64_t k = 0; k < numBlocks; ++k) {
+      uint64_t eq = eqs[k];
+      uint64_t xv = eq | mv[k];
+      if (hin < 0) {
+        eq |= 1;
+      }
+      uint64_t xh = (((eq & pv[k]) + pv[k]) ^ pv[k]) | eq;
+      uint64_t ph = mv[k] | ~(xh | pv[k]);
+      uint64_t mh = pv[k] & xh;
+      uint64_t high = k == numBlocks - 1 ? lastBit : highBit;
+      int hout = (ph & high) ? 1 : ((mh & high) ? -1 : 0);
+      ph <<= 1;
+      mh <<= 1;
+      if (hin < 0) {
+        mh |= 1;
+      } else if (hin > 0) {
+        ph |= 1;
+      }
+      pv[k] = mh | ~(xv | ph);
+      mv[k] = ph & xv;
+      hin = hout;
+    }
+    score += hin;
+  }
+  return score;
+}
+
+} // namespace w2l
@@ -0,0 +1,70 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "libraries/common/Dictionary.h"
+
+namespace w2l {
+
+/**
+ * ErrorRateMeter accumulates the edit distance of hypotheses to their
+ * references, as the error rate fl::EditDistanceMeter reports, without the
+ * breakdown into deletions, insertions and substitutions. The tokens (words,
+ * letters) are mapped to integer ids through a dictionary of the meter, and
+ * the distance is computed by the bit-parallel algorithm of Myers (1999) in
+ * O(n * m / 64) rather than by a dynamic programming over the strings.
+ * A meter isn't thread-safe: the threads use one meter each, merged at the
+ * end with add(const ErrorRateMeter&).
+ */
+class ErrorRateMeter {
+ public:
+  void add(
+      const std::vector<std::string>& hypothesis,
+      const std::vector<std::string>& reference);
+
+  void add(
+      const std::vector<int>& hypothesis,
+      const std::vector<int>& reference);
+
+  /* Merges the counts of another meter */
+  void add(const ErrorRateMeter& other);
+
+  /* Error rate in % */
+  double value() const;
+
+  int64_t errors() const {
+    return errors_;
+  }
+
+  /* Total length of the references */
+  int64_t length() const {
+    return length_;
+  }
+
+  void reset();
+
+  /* Levenshtein distance between `a` and `b` */
+  static int64_t distance(const int* a, int64_t n, const int* b, int64_t m);
+
+ private:
+  int64_t errors_{0};
+  int64_t length_{0};
+
+  Dictionary tokens_;
+  std::vector<int> hypothesisIds_;
+  std::vector<int> referenceIds_;
+
+  void toIds(const std::vector<std::string>& tokens, std::vector<int>& ids);
+};
+
+} // namespace w2l
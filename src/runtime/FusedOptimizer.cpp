@@ -0,0 +1,99 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "runtime/FusedOptimizer.h"
+
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+
+namespace w2l {
+
+FusedOptimizer::FusedOptimizer(
+    const std::vector<fl::Variable>& parameters,
+    OptimizerType type,
+    double learningRate,
+    double momentum /* = 0 */,
+    double beta1 /* = 0.9 */,
+    double beta2 /* = 0.999 */,
+    double rho /* = 0.9 */,
+    double epsilon /* = 1e-8 */,
+    double weightDecay /* = 0 */)
+    : fl::FirstOrderOptimizer(parameters, learningRate),
+      type_(static_cast<int>(type)),
+      momentum_(momentum),
+      beta1_(beta1),
+      beta2_(beta2),
+      rho_(rho),
+      eps_(epsilon),
+      wd_(weightDecay) {
+  dim_t total = 0;
+  for (const auto& p : parameters_) {
+    if (p.type() != f32) {
+      throw std::invalid_argument("FusedOptimizer: parameters must be float32");
+    }
+    total += p.elements();
+  }
+
+  bool useState1 = type != OptimizerType::SGD || momentum_ != 0;
+  bool useState2 =
+      type == OptimizerType::ADAM || type == OptimizerType::ADADELTA;
+  if (useState1 && total > 0) {
+    state1_ = af::constant(0, total, f32);
+  }
+  if (useState2 && total > 0) {
+    state2_ = af::constant(0, total, f32);
+  }
+}
+
+void FusedOptimizer::setState(const State& state) {
+  if (state.state1.elements() != state1_.elements() ||
+      state.state2.elements() != state2_.elements()) {
+    throw std::invalid_argument("FusedOptimizer: mismatched state");
+  }
+  count_ = state.count;
+  state1_ = state.state1;
+  state2_ = state.state2;
+}
+
+OptimizerHyperParams FusedOptimizer::hyperParams() {
+  float lr = lr_;
+  if (static_cast<OptimizerType>(type_) == OptimizerType::ADAM) {
+    ++count_;
+    float correctedBias1 = 1 - std::pow(beta1_, count_);
+    float correctedBias2 = 1 - std::pow(beta2_, count_);
+    lr = lr_ * std::sqrt(correctedBias2) / correctedBias1;
+  }
+  return {lr, momentum_, beta1_, beta2_, rho_, eps_, wd_};
+}
+
+std::string FusedOptimizer::prettyString() const {
+  static const char* const kNames[] = {"SGD", "Adam", "RMSProp", "Adadelta"};
+  std::ostringstream ss;
+  ss << "Fused" << kNames[type_];
+  switch (static_cast<OptimizerType>(type_)) {
+    case OptimizerType::SGD:
+      if (momentum_ != 0) {
+        ss << " (momentum=" << momentum_ << ")";
+      }
+      break;
+    case OptimizerType::ADAM:
+      ss << " (beta1=" << beta1_ << ") (beta2=" << beta2_ << ")";
+      break;
+    case OptimizerType::RMSPROP:
+    case OptimizerType::ADADELTA:
+      ss << " (rho=" << rho_ << ")";
+      break;
+  }
+  if (wd_ != 0) {
+    ss << " (weight decay=" << wd_ << ")";
+  }
+  return ss.str();
+}
+
+} // namespace w2l
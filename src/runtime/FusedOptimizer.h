@@ -0,0 +1,93 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <flashlight/flashlight.h>
+
+#include "libraries/optimizer/Defines.h"
+
+namespace w2l {
+
+/**
+ * FusedOptimizer performs the update of the SGD, Adam, RMSProp or Adadelta
+ * flashlight optimizers, with the same hyper-parameters, for all its
+ * parameters at once: a step is a single multi-tensor kernel, instead of a few
+ * element-wise ops per parameter. The parameters are updated in place, and the
+ * optimizer states of all the parameters are each kept in one flat buffer.
+ * Only float32 parameters are supported.
+ */
+class FusedOptimizer : public fl::FirstOrderOptimizer {
+ public:
+  FusedOptimizer(
+      const std::vector<fl::Variable>& parameters,
+      OptimizerType type,
+      double learningRate,
+      double momentum = 0,
+      double beta1 = 0.9,
+      double beta2 = 0.999,
+      double rho = 0.9,
+      double epsilon = 1e-8,
+      double weightDecay = 0);
+
+  void step() override;
+
+  std::string prettyString() const override;
+
+  /* The optimizer states, which can be saved apart from the parameters */
+  struct State {
+    int count;
+    af::array state1;
+    af::array state2;
+
+    FL_SAVE_LOAD(count, state1, state2)
+  };
+
+  State getState() const {
+    return {count_, state1_, state2_};
+  }
+
+  /* Restores a state saved for the same parameters */
+  void setState(const State& state);
+
+ private:
+  FL_SAVE_LOAD_WITH_BASE(
+      fl::FirstOrderOptimizer,
+      type_,
+      momentum_,
+      beta1_,
+      beta2_,
+      rho_,
+      eps_,
+      wd_,
+      count_,
+      state1_,
+      state2_)
+
+  FusedOptimizer() = default;
+
+  int type_; // OptimizerType
+  float momentum_;
+  float beta1_;
+  float beta2_;
+  float rho_;
+  float eps_;
+  float wd_;
+  int count_{0}; // Steps done, for the bias correction of Adam
+
+  // The states of all the parameters, concatenated in the order of the
+  // parameters (empty if unused)
+  af::array state1_;
+  af::array state2_;
+
+  OptimizerHyperParams hyperParams();
+};
+
+} // namespace w2l
+
+CEREAL_REGISTER_TYPE(w2l::FusedOptimizer)
@@ -8,7 +8,10 @@
 
 #include "runtime/Helpers.h"
 
+#include <algorithm>
+#include <cmath>
 #include <random>
+#include <stdexcept>
 
 #include "common/FlashlightUtils.h"
 
@@ -31,4 +34,208 @@ std::vector<std::string> readSampleIds(const af::array& arr) {
   return afMatrixToStrings<int>(arr, -1);
 }
 
+std::vector<int> unpadEmissionSizes(
+    int T,
+    int B,
+    const std::vector<double>& inputSizes) {
+  if (!inputSizes.empty() && inputSizes.size() != B) {
+    throw std::invalid_argument("unpadEmissions: expected one size per sample");
+  }
+  double maxSize = inputSizes.empty()
+      ? 0
+      : *std::max_element(inputSizes.begin(), inputSizes.end());
+  std::vector<int> sizes(B, T);
+  if (maxSize > 0) {
+    for (int b = 0; b < B; ++b) {
+      int sampleT = std::ceil(T * inputSizes[b] / maxSize);
+      sizes[b] = std::min(std::max(sampleT, 1), T);
+    }
+  }
+  return sizes;
+}
+
+std::vector<af::array> unpadEmissions(
+    const af::array& emissions,
+    const std::vector<double>& inputSizes) {
+  int B = emissions.dims(2);
+  auto sizes = unpadEmissionSizes(emissions.dims(1), B, inputSizes);
+  std::vector<af::array> result;
+  for (int b = 0; b < B; ++b) {
+    result.push_back(emissions(af::span, af::seq(sizes[b]), b));
+  }
+  return result;
+}
+
+int64_t msToInputFrames(double ms) {
+  if (FLAGS_pow || FLAGS_mfsc || FLAGS_mfcc) {
+    return std::ceil(ms / FLAGS_framestridems);
+  }
+  return std::ceil(ms * FLAGS_samplerate / 1000.0);
+}
+
+af::array chunkedForward(
+    fl::Module& network,
+    const af::array& input,
+    int64_t chunkFrames,
+    int64_t overlapFrames,
+    int chunksPerBatch) {
+  int64_t T = input.dims(0);
+  if (chunkFrames <= 0 || T <= chunkFrames) {
+    return network.forward({fl::input(input)}).front().array();
+  }
+  if (input.dims(3) != 1) {
+    throw std::invalid_argument("chunkedForward: expected a single input");
+  }
+  overlapFrames = std::max<int64_t>(overlapFrames, 0);
+  chunksPerBatch = std::max(chunksPerBatch, 1);
+
+  // Every window is padded to the same size, so windows batch together
+  int64_t windowFrames = chunkFrames + 2 * overlapFrames;
+  int64_t nChunks = (T + chunkFrames - 1) / chunkFrames;
+  af::array result;
+  double ratio = 0; // emission frames per input frame
+  auto outputFrame = [&ratio](int64_t frame) {
+    return static_cast<int64_t>(std::round(frame * ratio));
+  };
+  for (int64_t first = 0; first < nChunks; first += chunksPerBatch) {
+    int64_t last = std::min(first + chunksPerBatch, nChunks);
+    af::array windows = af::constant(
+        0,
+        af::dim4(windowFrames, input.dims(1), input.dims(2), last - first),
+        input.type());
+    for (int64_t c = first; c < last; ++c) {
+      int64_t begin = std::max<int64_t>(c * chunkFrames - overlapFrames, 0);
+      int64_t end = std::min((c + 1) * chunkFrames + overlapFrames, T);
+      windows(af::seq(end - begin), af::span, af::span, c - first) =
+          input(af::seq(begin, end - 1), af::span, af::span, 0);
+    }
+    auto emissions = network.forward({fl::input(windows)}).front().array();
+    if (result.isempty()) {
+      ratio = static_cast<double>(emissions.dims(1)) / windowFrames;
+      result = af::constant(
+          0, af::dim4(emissions.dims(0), outputFrame(T)), emissions.type());
+    }
+
+    // The emissions of the frames of the chunk, without its context
+    for (int64_t c = first; c < last; ++c) {
+      int64_t chunkBegin = c * chunkFrames;
+      int64_t chunkEnd = std::min(chunkBegin + chunkFrames, T);
+      int64_t windowBegin = std::max<int64_t>(chunkBegin - overlapFrames, 0);
+      int64_t outBegin = outputFrame(chunkBegin);
+      int64_t length = std::min(
+          outputFrame(chunkEnd) - outBegin,
+          emissions.dims(1) - outputFrame(chunkBegin - windowBegin));
+      if (length <= 0) {
+        continue;
+      }
+      int64_t localBegin = outputFrame(chunkBegin - windowBegin);
+      result(af::span, af::seq(outBegin, outBegin + length - 1)) = emissions(
+          af::span,
+          af::seq(localBegin, localBegin + length - 1),
+          c - first);
+    }
+  }
+  return result;
+}
+
+std::vector<std::vector<int>> readBatchTargets(
+    const af::array& targets,
+    int padValue /* = kTargetPadValue */) {
+  auto values = afToVector<int>(targets);
+  int64_t L = targets.dims(0);
+  std::vector<std::vector<int>> result(targets.dims(1));
+  for (int64_t b = 0; b < result.size(); ++b) {
+    auto begin = values.begin() + b * L;
+    auto end = begin + L;
+    while (end != begin &&
+           (*(end - 1) == padValue || *(end - 1) == kTargetPadValue)) {
+      --end;
+    }
+    result[b].assign(begin, end);
+  }
+  return result;
+}
+
+double probeBatchFrames(
+    fl::Module& network,
+    fl::Module& criterion,
+    int featureSize,
+    int numClasses,
+    double maxFrames /* = 1e7 */) {
+  network.train();
+  criterion.train();
+  auto fits = [&](double frames) {
+    for (int batchSize : {1, 8}) {
+      int64_t T = msToInputFrames(frames * FLAGS_framestridems / batchSize);
+      bool fit = true;
+      try {
+        auto input = fl::input(
+            af::randn(T, featureSize, FLAGS_channels, batchSize));
+        auto output = network.forward({input}).front();
+        int64_t L = std::max<dim_t>(output.dims(1) / 2, 1);
+        auto target = (af::randu(L, batchSize) * (numClasses - 1)).as(s32);
+        auto loss = criterion.forward({output, fl::noGrad(target)}).front();
+        loss.backward();
+        af::sync();
+      } catch (const af::exception& ex) {
+        if (ex.err() != AF_ERR_NO_MEM) {
+          throw;
+        }
+        fit = false;
+      }
+      network.zeroGrad();
+      criterion.zeroGrad();
+      af::deviceGC();
+      if (!fit) {
+        return false;
+      }
+    }
+    return true;
+  };
+
+  double low = 0, high = 1000;
+  while (high < maxFrames && fits(high)) {
+    low = high;
+    high *= 2;
+  }
+  if (high >= maxFrames) {
+    if (fits(maxFrames)) {
+      return maxFrames;
+    }
+    high = maxFrames;
+  }
+  // low fits (or is 0) and high doesn't
+  for (int i = 0; i < 5 && low > 0; ++i) {
+    double middle = (low + high) / 2;
+    if (fits(middle)) {
+      low = middle;
+    } else {
+      high = middle;
+    }
+  }
+  return 0.9 * low;
+}
+
+std::vector<std::vector<af::array>> splitBatch(
+    const std::vector<af::array>& batch,
+    int nParts) {
+  int64_t B = batch[kInputIdx].dims(3);
+  nParts = std::min<int64_t>(nParts, B);
+  std::vector<std::vector<af::array>> parts(nParts);
+  for (int i = 0; i < nParts; ++i) {
+    af::seq samples(i * B / nParts, (i + 1) * B / nParts - 1);
+    for (size_t j = 0; j < batch.size(); ++j) {
+      const auto& array = batch[j];
+      if (array.isempty()) {
+        parts[i].push_back(array);
+      } else if (j == kInputIdx) {
+        parts[i].push_back(array(af::span, af::span, af::span, samples));
+      } else {
+        parts[i].push_back(array(af::span, samples));
+      }
+    }
+  }
+  return parts;
+}
+
 } // namespace w2l
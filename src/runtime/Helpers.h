@@ -32,4 +32,63 @@ getTrainEvalIds(int64_t dsSize, double pctTrainEval, int64_t seed);
 // Read sample ids from an `af::array`.
 std::vector<std::string> readSampleIds(const af::array& arr);
 
+// The number of emission frames of each sample of a batch of T emission frames
+// computed on padded inputs, assuming T proportional to the input size:
+// `inputSizes` are the sizes of the inputs of the batch, in any unit. The
+// frames are all T if empty.
+std::vector<int> unpadEmissionSizes(
+    int T,
+    int B,
+    const std::vector<double>& inputSizes);
+
+// The emissions N x T of the samples of a batch of emissions N x T x B
+// computed on padded inputs, cut to the frames of their inputs (see
+// `unpadEmissionSizes()`).
+std::vector<af::array> unpadEmissions(
+    const af::array& emissions,
+    const std::vector<double>& inputSizes);
+
+// Number of input frames in `ms` of audio: frames of features, or samples of
+// raw audio
+int64_t msToInputFrames(double ms);
+
+// The emissions N x T of `network` for a single input of T0 frames (the first
+// axis), computed on chunks of `chunkFrames` input frames so that memory is
+// bounded on long inputs. Each chunk is forwarded with `overlapFrames` frames
+// of context on each side, which are dropped from its emissions, and
+// `chunksPerBatch` chunks are forwarded at once. The network must map T0
+// input frames to T emission frames in a fixed ratio.
+af::array chunkedForward(
+    fl::Module& network,
+    const af::array& input,
+    int64_t chunkFrames,
+    int64_t overlapFrames,
+    int chunksPerBatch);
+
+// The targets of a batch L x B, without the trailing `padValue`s and
+// `kTargetPadValue`s appended for batching.
+std::vector<std::vector<int>> readBatchTargets(
+    const af::array& targets,
+    int padValue = kTargetPadValue);
+
+// The largest number of padded input frames per batch (as `--batchframes`)
+// for which a forward and a backward of `network` and `criterion` fit in the
+// device memory, probed on synthetic batches of `featureSize` features and
+// targets of `numClasses` classes: a single sample of all the frames, and 8
+// samples sharing them. The frames are doubled from 1000 while they fit, up
+// to `maxFrames`, then bisected; 90% of the largest frames which fit are
+// returned.
+double probeBatchFrames(
+    fl::Module& network,
+    fl::Module& criterion,
+    int featureSize,
+    int numClasses,
+    double maxFrames = 1e7);
+
+// Splits a batch of the dataset (see `kInputIdx`...) in `nParts` batches of
+// consecutive samples, or in single samples if it has fewer.
+std::vector<std::vector<af::array>> splitBatch(
+    const std::vector<af::array>& batch,
+    int nParts);
+
 } // namespace w2l
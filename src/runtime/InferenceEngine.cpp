@@ -0,0 +1,343 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "runtime/InferenceEngine.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <unordered_map>
+
+#include <gflags/gflags.h>
+
+#include "common/Defines.h"
+#include "common/Utils.h"
+#include "criterion/criterion.h"
+#include "data/Featurize.h"
+#include "libraries/common/WordUtils.h"
+#include "libraries/decoder/LexiconDecoder.h"
+#include "libraries/decoder/LexiconFreeDecoder.h"
+#include "libraries/lm/KenLM.h"
+#include "libraries/lm/ZeroLM.h"
+#include "runtime/Helpers.h"
+#include "runtime/Serial.h"
+
+namespace w2l {
+
+InferenceEngine::InferenceEngine(const InferenceOptions& options)
+    : options_(options) {
+  std::shared_ptr<SequenceCriterion> criterion;
+  std::unordered_map<std::string, std::string> cfg;
+  W2lSerializer::load(options_.am, cfg, network_, criterion);
+  network_->eval();
+  auto flags = cfg.find(kGflags);
+  if (flags == cfg.end()) {
+    throw std::invalid_argument(
+        "InferenceEngine: no flags in the model " + options_.am);
+  }
+  gflags::ReadFlagsFromString(flags->second, gflags::GetArgv0(), true);
+  // The cache is keyed by sample ids, which requests don't have
+  FLAGS_featurecache = "";
+
+  if (FLAGS_criterion == kCtcCriterion) {
+    options_.decoder.criterionType = CriterionType::CTC;
+  } else if (FLAGS_criterion == kAsgCriterion) {
+    options_.decoder.criterionType = CriterionType::ASG;
+    transitions_ = afToVector<float>(criterion->param(0).array());
+  } else {
+    throw std::invalid_argument(
+        "InferenceEngine: only CTC and ASG models are supported");
+  }
+
+  tokenDict_ = Dictionary(options_.tokens);
+  for (int64_t r = 1; r <= FLAGS_replabel; ++r) {
+    tokenDict_.addEntry(std::to_string(r));
+  }
+  if (FLAGS_criterion == kCtcCriterion) {
+    tokenDict_.addEntry(kBlankToken);
+  }
+  tokenDict_.freeze();
+  silIdx_ = tokenDict_.getIndex(FLAGS_wordseparator);
+  blankIdx_ = FLAGS_criterion == kCtcCriterion
+      ? tokenDict_.getIndex(kBlankToken)
+      : -1;
+
+  LexiconMap lexicon;
+  if (!options_.lexicon.empty()) {
+    lexicon = loadWords(options_.lexicon);
+    wordDict_ = createWordDict(lexicon);
+    wordDict_.freeze();
+  }
+  bool wordLm = options_.wordLm && !lexicon.empty();
+  unkWordIdx_ = wordLm ? wordDict_.getIndex(kUnkToken) : -1;
+
+  lm_ = std::make_shared<ZeroLM>();
+  if (!options_.lm.empty()) {
+    // Shared by the decoders, as in Decode
+    lm_ = std::make_shared<KenLM>(
+        options_.lm, wordLm ? wordDict_ : tokenDict_, FLAGS_lm_cache_size);
+  }
+
+  if (!lexicon.empty()) {
+    Trie trie(tokenDict_.indexSize(), silIdx_);
+    auto startState = lm_->start(false);
+    for (const auto& entry : lexicon) {
+      int usrIdx = wordDict_.getIndex(entry.first);
+      float score = -1;
+      if (wordLm) {
+        LMStatePtr dummyState;
+        std::tie(dummyState, score) = lm_->score(startState, usrIdx);
+      }
+      for (const auto& tokens : entry.second) {
+        trie.insert(tkn2Idx(tokens, tokenDict_, FLAGS_replabel), usrIdx, score);
+      }
+    }
+    trie.smear(options_.smearing);
+    trie_ = std::make_shared<FlatTrie>(trie);
+  }
+
+  for (int i = 0; i < std::max(options_.nDecoders, 1); ++i) {
+    decoders_.push_back(makeDecoder());
+  }
+  batcher_ = std::thread([this]() { runBatcher(); });
+}
+
+InferenceEngine::~InferenceEngine() {
+  {
+    std::lock_guard<std::mutex> lock(pendingMutex_);
+    stop_ = true;
+  }
+  pendingCv_.notify_all();
+  batcher_.join();
+}
+
+std::unique_ptr<Decoder> InferenceEngine::makeDecoder() const {
+  if (trie_) {
+    return std::unique_ptr<Decoder>(new LexiconDecoder(
+        options_.decoder,
+        trie_,
+        lm_,
+        silIdx_,
+        blankIdx_,
+        unkWordIdx_,
+        transitions_,
+        unkWordIdx_ < 0));
+  }
+  return std::unique_ptr<Decoder>(new LexiconFreeDecoder(
+      options_.decoder, lm_, silIdx_, blankIdx_, transitions_));
+}
+
+Transcription InferenceEngine::transcribe(const std::vector<float>& audio) {
+  auto emission = forward(audio);
+
+  std::unique_ptr<Decoder> decoder;
+  {
+    std::unique_lock<std::mutex> lock(decodersMutex_);
+    decodersCv_.wait(lock, [this]() { return !decoders_.empty(); });
+    decoder = std::move(decoders_.back());
+    decoders_.pop_back();
+  }
+  Transcription transcription;
+  try {
+    decoder->decode(emission.values.data(), emission.T, emission.N);
+    transcription = toTranscription(decoder->getBestHypothesis());
+  } catch (...) {
+    std::lock_guard<std::mutex> lock(decodersMutex_);
+    decoders_.push_back(std::move(decoder));
+    decodersCv_.notify_one();
+    throw;
+  }
+  {
+    std::lock_guard<std::mutex> lock(decodersMutex_);
+    decoders_.push_back(std::move(decoder));
+  }
+  decodersCv_.notify_one();
+  return transcription;
+}
+
+std::unique_ptr<InferenceEngine::Session> InferenceEngine::openSession() {
+  return std::unique_ptr<Session>(new Session(*this, makeDecoder()));
+}
+
+InferenceStats InferenceEngine::stats() const {
+  std::lock_guard<std::mutex> lock(pendingMutex_);
+  return stats_;
+}
+
+InferenceEngine::Emission InferenceEngine::forward(
+    std::vector<float> audio,
+    bool sessionChunk /* = false */) {
+  if (audio.empty()) {
+    throw std::invalid_argument("InferenceEngine: empty audio");
+  }
+  auto request = std::unique_ptr<Request>(new Request());
+  request->audio = std::move(audio);
+  request->sessionChunk = sessionChunk;
+  double delayMs = sessionChunk ? options_.sessionBatchDelayMs
+                                : options_.maxBatchDelayMs;
+  request->deadline = std::chrono::steady_clock::now() +
+      std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+          std::chrono::duration<double, std::milli>(delayMs));
+  auto emission = request->emission.get_future();
+  {
+    std::lock_guard<std::mutex> lock(pendingMutex_);
+    pending_.push_back(std::move(request));
+  }
+  pendingCv_.notify_one();
+  return emission.get();
+}
+
+void InferenceEngine::runBatcher() {
+  size_t maxBatchSize = std::max(options_.maxBatchSize, 1);
+  while (true) {
+    std::vector<std::unique_ptr<Request>> batch;
+    {
+      std::unique_lock<std::mutex> lock(pendingMutex_);
+      pendingCv_.wait(lock, [this]() { return stop_ || !pending_.empty(); });
+      if (pending_.empty()) {
+        return;
+      }
+      // The requests wait for others until the first of their deadlines,
+      // which a request arriving meanwhile may bring closer
+      while (!stop_ && pending_.size() < maxBatchSize) {
+        auto deadline = pending_.front()->deadline;
+        for (const auto& request : pending_) {
+          deadline = std::min(deadline, request->deadline);
+        }
+        if (pendingCv_.wait_until(lock, deadline) == std::cv_status::timeout) {
+          break;
+        }
+      }
+      while (!pending_.empty() && batch.size() < maxBatchSize) {
+        stats_.sessionChunks += pending_.front()->sessionChunk;
+        batch.push_back(std::move(pending_.front()));
+        pending_.pop_front();
+      }
+      ++stats_.batches;
+      stats_.requests += batch.size();
+    }
+    forwardBatch(batch);
+  }
+}
+
+void InferenceEngine::forwardBatch(
+    std::vector<std::unique_ptr<Request>>& batch) {
+  std::vector<Emission> emissions(batch.size());
+  try {
+    std::vector<W2lLoaderData> data(batch.size());
+    std::vector<double> sizes;
+    for (size_t b = 0; b < batch.size(); ++b) {
+      data[b].input = std::move(batch[b]->audio);
+      sizes.push_back(data[b].input.size());
+    }
+    auto feat = featurize(data, DictionaryMap());
+    auto input =
+        featurizeOnDevice(af::array(feat.inputDims, feat.input.data()));
+    auto output = network_->forward({fl::input(input)}).front().array();
+    auto unpadded = unpadEmissions(output, sizes);
+    for (size_t b = 0; b < batch.size(); ++b) {
+      emissions[b].N = unpadded[b].dims(0);
+      emissions[b].T = unpadded[b].dims(1);
+      emissions[b].values = afToVector<float>(unpadded[b]);
+    }
+  } catch (...) {
+    for (auto& request : batch) {
+      request->emission.set_exception(std::current_exception());
+    }
+    return;
+  }
+  for (size_t b = 0; b < batch.size(); ++b) {
+    batch[b]->emission.set_value(std::move(emissions[b]));
+  }
+}
+
+Transcription InferenceEngine::toTranscription(
+    const DecodeResult& result) const {
+  Transcription transcription;
+  transcription.score = result.score;
+  transcription.tokens = tknPrediction2Ltr(result.tokens, tokenDict_);
+  if (trie_) {
+    auto words = validateIdx(result.words, wordDict_.getIndex(kUnkToken));
+    transcription.words = wrdIdx2Wrd(words, wordDict_);
+  } else {
+    transcription.words = tkn2Wrd(transcription.tokens);
+  }
+  return transcription;
+}
+
+InferenceEngine::Session::Session(
+    InferenceEngine& engine,
+    std::unique_ptr<Decoder> decoder)
+    : engine_(engine), decoder_(std::move(decoder)) {
+  decoder_->decodeBegin();
+}
+
+InferenceEngine::Session::~Session() = default;
+
+void InferenceEngine::Session::feed(const float* audio, size_t size) {
+  if (finished_) {
+    throw std::logic_error("InferenceEngine::Session: fed after finish()");
+  }
+  buffer_.insert(buffer_.end(), audio, audio + size);
+  received_ += size;
+  auto chunk = msToInputFrames(engine_.options_.sessionChunkMs);
+  auto context = msToInputFrames(engine_.options_.sessionContextMs);
+  // A chunk is decoded once the context on its right is received
+  while (received_ - chunkBegin_ >= chunk + context) {
+    decodeChunk(chunkBegin_ + chunk);
+  }
+}
+
+Transcription InferenceEngine::Session::partial() const {
+  return engine_.toTranscription(decoder_->getBestHypothesis());
+}
+
+Transcription InferenceEngine::Session::finish() {
+  if (!finished_) {
+    if (received_ > chunkBegin_) {
+      decodeChunk(received_);
+    }
+    decoder_->decodeEnd();
+    finished_ = true;
+  }
+  return engine_.toTranscription(decoder_->getBestHypothesis());
+}
+
+void InferenceEngine::Session::decodeChunk(int64_t chunkEnd) {
+  auto context = msToInputFrames(engine_.options_.sessionContextMs);
+  int64_t windowBegin = std::max(chunkBegin_ - context, bufferBegin_);
+  int64_t windowEnd = std::min(chunkEnd + context, received_);
+  auto emission = engine_.forward(
+      std::vector<float>(
+          buffer_.begin() + (windowBegin - bufferBegin_),
+          buffer_.begin() + (windowEnd - bufferBegin_)),
+      true);
+
+  // The emissions of the chunk, without its context. The frames are rounded
+  // at their position in the stream, so that chunks don't skip or repeat any
+  double ratio = static_cast<double>(emission.T) / (windowEnd - windowBegin);
+  auto frame = [ratio](int64_t sample) {
+    return static_cast<int64_t>(std::round(sample * ratio));
+  };
+  int64_t localBegin = frame(chunkBegin_ - windowBegin);
+  int64_t length = std::min(
+      frame(chunkEnd) - frame(chunkBegin_), emission.T - localBegin);
+  // Not pruned: partial() and finish() return the whole transcription
+  if (length > 0) {
+    decoder_->decodeStep(
+        emission.values.data() + localBegin * emission.N, length, emission.N);
+  }
+
+  chunkBegin_ = chunkEnd;
+  // Only the left context of the next chunk is kept
+  int64_t keepFrom = std::max(chunkBegin_ - context, bufferBegin_);
+  buffer_.erase(buffer_.begin(), buffer_.begin() + (keepFrom - bufferBegin_));
+  bufferBegin_ = keepFrom;
+}
+
+} // namespace w2l
@@ -0,0 +1,180 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <flashlight/flashlight.h>
+
+#include "libraries/common/Dictionary.h"
+#include "libraries/decoder/Decoder.h"
+#include "libraries/decoder/Trie.h"
+#include "libraries/lm/LM.h"
+
+namespace w2l {
+
+struct InferenceOptions {
+  std::string am; // acoustic model saved by Train, with CTC or ASG
+  std::string tokens; // tokens dictionary of the acoustic model
+  std::string lexicon; // words and their spellings, empty to decode tokens
+  std::string lm; // KenLM model, empty for no LM
+  bool wordLm = true; // the LM scores words of the lexicon rather than tokens
+  SmearingMode smearing = SmearingMode::MAX;
+  // The criterion type is set from the acoustic model
+  DecoderOptions decoder;
+
+  int nDecoders = 1; // number of transcriptions decoded concurrently
+  int maxBatchSize = 8; // number of requests forwarded together
+  double maxBatchDelayMs = 5; // time a request may wait for others to batch
+  // Sessions forward the audio by chunks, with context on each side
+  double sessionChunkMs = 1000;
+  double sessionContextMs = 500;
+  // Time a session chunk may wait for the chunks of other sessions. Their
+  // windows have the same length, so they are batched without padding
+  double sessionBatchDelayMs = 20;
+};
+
+struct InferenceStats {
+  int64_t batches = 0; // forwards of the acoustic model
+  int64_t requests = 0; // transcriptions and session chunks forwarded
+  int64_t sessionChunks = 0;
+};
+
+struct Transcription {
+  std::vector<std::string> words;
+  std::vector<std::string> tokens;
+  double score = 0;
+};
+
+/**
+ * Transcribes raw audio with an acoustic model and a beam search decoder, for
+ * services which embed wav2letter. The engine loads the model, its flags and
+ * featurization, the LM and the lexicon trie once; they are read-only and
+ * shared by every request.
+ *
+ * transcribe() may be called from any number of threads. The audio of the
+ * concurrent requests is batched for the forward of the acoustic model, on a
+ * thread of the engine, and decoded on the calling threads by `nDecoders`
+ * decoders. A Session transcribes a stream of audio as it arrives; the chunks
+ * of all the active sessions are collected for up to `sessionBatchDelayMs`,
+ * forwarded in one batch, and their emissions scattered to the decoder of
+ * each session.
+ *
+ * The flags of the model (featurization, criterion, ...) are set globally when
+ * it is loaded, so a process holds engines of models trained with the same
+ * features only.
+ */
+class InferenceEngine {
+ public:
+  explicit InferenceEngine(const InferenceOptions& options);
+
+  ~InferenceEngine();
+
+  InferenceEngine(const InferenceEngine&) = delete;
+  InferenceEngine& operator=(const InferenceEngine&) = delete;
+
+  /* Transcribes single channel audio at the sample rate of the model */
+  Transcription transcribe(const std::vector<float>& audio);
+
+  class Session {
+   public:
+    ~Session();
+
+    /* Appends audio, and decodes the chunks it completes */
+    void feed(const float* audio, size_t size);
+
+    /* The best transcription of the audio decoded so far */
+    Transcription partial() const;
+
+    /* Decodes the rest of the audio; the session can't be fed anymore */
+    Transcription finish();
+
+   private:
+    friend class InferenceEngine;
+
+    Session(InferenceEngine& engine, std::unique_ptr<Decoder> decoder);
+
+    /* Decodes the chunk starting at `chunkBegin_`, ending at `chunkEnd` */
+    void decodeChunk(int64_t chunkEnd);
+
+    InferenceEngine& engine_;
+    std::unique_ptr<Decoder> decoder_;
+    std::vector<float> buffer_; // audio from `bufferBegin_`
+    int64_t bufferBegin_{0};
+    int64_t chunkBegin_{0}; // first sample not decoded
+    int64_t received_{0};
+    bool finished_{false};
+  };
+
+  /* A session with its own decoder; not thread-safe */
+  std::unique_ptr<Session> openSession();
+
+  /* Counters of the batches forwarded so far */
+  InferenceStats stats() const;
+
+ private:
+  struct Emission {
+    std::vector<float> values; // T x N
+    int T;
+    int N;
+  };
+
+  struct Request {
+    std::vector<float> audio;
+    std::promise<Emission> emission;
+    // Time until which the request may wait for others to batch
+    std::chrono::steady_clock::time_point deadline;
+    bool sessionChunk;
+  };
+
+  InferenceOptions options_;
+  std::shared_ptr<fl::Module> network_;
+  std::vector<float> transitions_;
+  Dictionary tokenDict_;
+  Dictionary wordDict_;
+  LMPtr lm_;
+  FlatTriePtr trie_;
+  int silIdx_;
+  int blankIdx_;
+  int unkWordIdx_;
+
+  // Requests waiting for the acoustic model
+  std::deque<std::unique_ptr<Request>> pending_;
+  mutable std::mutex pendingMutex_;
+  std::condition_variable pendingCv_;
+  bool stop_{false};
+  InferenceStats stats_;
+  std::thread batcher_;
+
+  // Decoders free for transcribe()
+  std::vector<std::unique_ptr<Decoder>> decoders_;
+  std::mutex decodersMutex_;
+  std::condition_variable decodersCv_;
+
+  std::unique_ptr<Decoder> makeDecoder() const;
+
+  /* The emission of `audio`, forwarded in a batch by the batcher */
+  Emission forward(std::vector<float> audio, bool sessionChunk = false);
+
+  void runBatcher();
+
+  void forwardBatch(std::vector<std::unique_ptr<Request>>& batch);
+
+  Transcription toTranscription(const DecodeResult& result) const;
+};
+
+} // namespace w2l
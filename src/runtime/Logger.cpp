@@ -8,7 +8,9 @@
 
 #include "Logger.h"
 
+#include <functional>
 #include <thread>
+#include <vector>
 
 #include <glog/logging.h>
 
@@ -16,6 +18,49 @@
 #include "common/FlashlightUtils.h"
 
 namespace w2l {
+
+namespace {
+
+/**
+ * Packs the values of several meters into one f64 buffer, so that they are
+ * all reduced by a single collective instead of one per meter. The s64
+ * values of the stat and count meters are exact in f64 up to 2^53.
+ */
+class MeterSyncBuffer {
+ public:
+  template <typename T>
+  void add(T& mtr) {
+    af::array arr = allreduceGet(mtr);
+    auto type = arr.type();
+    auto vals = afToVector<double>(arr.as(f64));
+    size_t offset = values_.size(), size = vals.size();
+    values_.insert(values_.end(), vals.begin(), vals.end());
+    setters_.emplace_back([&mtr, type, offset, size](
+                              const std::vector<double>& reduced) {
+      af::array val = af::array(size, reduced.data() + offset).as(type);
+      allreduceSet(mtr, val);
+    });
+  }
+
+  void sync() {
+    if (values_.empty()) {
+      return;
+    }
+    af::array arr(values_.size(), values_.data());
+    fl::allReduce(arr);
+    auto reduced = afToVector<double>(arr);
+    for (auto& set : setters_) {
+      set(reduced);
+    }
+  }
+
+ private:
+  std::vector<double> values_;
+  std::vector<std::function<void(const std::vector<double>&)>> setters_;
+};
+
+} // namespace
+
 std::pair<std::string, std::string> getStatus(
     TrainMeters& meters,
     int64_t epoch,
@@ -52,6 +97,7 @@ std::pair<std::string, std::string> getStatus(
   insertItem(
       "crit-fwd(ms)", format("%.2f", meters.critfwdtimer.value() * 1000));
   insertItem("bwd(ms)", format("%.2f", meters.bwdtimer.value() * 1000));
+  insertItem("comm(ms)", format("%.2f", meters.commtimer.value() * 1000));
   insertItem("optim(ms)", format("%.2f", meters.optimtimer.value() * 1000));
   insertItem("loss", format("%10.5f", meters.train.loss.value()[0]));
 
@@ -184,21 +230,27 @@ void allreduceSet(fl::TimeMeter& mtr, af::array& val) {
 
 template <>
 void syncMeter<TrainMeters>(TrainMeters& mtrs) {
-  syncMeter(mtrs.stats);
-  syncMeter(mtrs.runtime);
-  syncMeter(mtrs.timer);
-  syncMeter(mtrs.fwdtimer);
-  syncMeter(mtrs.critfwdtimer);
-  syncMeter(mtrs.bwdtimer);
-  syncMeter(mtrs.optimtimer);
-  syncMeter(mtrs.train.tknEdit);
-  syncMeter(mtrs.train.wrdEdit);
-  syncMeter(mtrs.train.loss);
+  if (!fl::isDistributedInit()) {
+    return;
+  }
+  MeterSyncBuffer buffer;
+  buffer.add(mtrs.stats);
+  buffer.add(mtrs.runtime);
+  buffer.add(mtrs.timer);
+  buffer.add(mtrs.fwdtimer);
+  buffer.add(mtrs.critfwdtimer);
+  buffer.add(mtrs.bwdtimer);
+  buffer.add(mtrs.commtimer);
+  buffer.add(mtrs.optimtimer);
+  buffer.add(mtrs.train.tknEdit);
+  buffer.add(mtrs.train.wrdEdit);
+  buffer.add(mtrs.train.loss);
   for (auto& v : mtrs.valid) {
-    syncMeter(v.second.tknEdit);
-    syncMeter(v.second.wrdEdit);
-    syncMeter(v.second.loss);
+    buffer.add(v.second.tknEdit);
+    buffer.add(v.second.wrdEdit);
+    buffer.add(v.second.loss);
   }
+  buffer.sync();
 }
 
 } // namespace w2l
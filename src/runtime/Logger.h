@@ -12,6 +12,7 @@
 
 #include <flashlight/flashlight.h>
 
+#include "ErrorRateMeter.h"
 #include "SpeechStatMeter.h"
 
 #define LOG_MASTER(lvl) LOG_IF(lvl, (fl::getWorldRank() == 0))
@@ -29,6 +30,7 @@ struct TrainMeters {
   fl::TimeMeter fwdtimer{true}; // includes network + criterion time
   fl::TimeMeter critfwdtimer{true};
   fl::TimeMeter bwdtimer{true}; // includes network + criterion time
+  fl::TimeMeter commtimer{true}; // part of bwd waiting for the reduction
   fl::TimeMeter optimtimer{true};
 
   DatasetMeters train;
@@ -39,10 +41,10 @@ struct TrainMeters {
 
 struct TestMeters {
   fl::TimeMeter timer;
-  fl::EditDistanceMeter werSlice;
-  fl::EditDistanceMeter wer;
-  fl::EditDistanceMeter lerSlice;
-  fl::EditDistanceMeter ler;
+  ErrorRateMeter werSlice;
+  ErrorRateMeter wer;
+  ErrorRateMeter lerSlice;
+  ErrorRateMeter ler;
 };
 
 std::pair<std::string, std::string> getStatus(
@@ -8,8 +8,16 @@
 
 #include "runtime/Optimizer.h"
 
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <unordered_map>
+
 #include <glog/logging.h>
 
+#include "runtime/Distributed.h"
+#include "runtime/FusedOptimizer.h"
+
 namespace w2l {
 
 std::shared_ptr<fl::FirstOrderOptimizer> initOptimizer(
@@ -28,8 +36,52 @@ std::shared_ptr<fl::FirstOrderOptimizer> initOptimizer(
     params.insert(params.end(), p.begin(), p.end());
   }
 
+  // The optimizers which have a multi-tensor step, for float32 params
+  const std::unordered_map<std::string, OptimizerType> fusedTypes = {
+      {kSGDoptimizer, OptimizerType::SGD},
+      {kAdamOptimizer, OptimizerType::ADAM},
+      {kRMSPropOptimizer, OptimizerType::RMSPROP},
+      {kAdadeltaOptimizer, OptimizerType::ADADELTA}};
+  auto fusedType = fusedTypes.find(optimizer);
+  bool canFuse = fusedType != fusedTypes.end();
+  for (const auto& p : params) {
+    canFuse = canFuse && p.type() == f32;
+  }
+  bool shard = FLAGS_shardoptim && fl::isDistributedInit() &&
+      fl::getWorldSize() > 1;
+  if (shard && !canFuse) {
+    LOG(WARNING) << "Optimizer " << optimizer << " is not sharded: only the "
+                 << "float32 SGD, Adam, RMSProp and Adadelta are";
+  }
+
   std::shared_ptr<fl::FirstOrderOptimizer> opt;
-  if (optimizer == kSGDoptimizer) {
+  if (canFuse && (shard || FLAGS_fuseoptim)) {
+    auto type = fusedType->second;
+    double fusedLr = type == OptimizerType::ADADELTA ? 1.0 : lr;
+    if (shard) {
+      opt = std::make_shared<ShardedOptimizer>(
+          params,
+          type,
+          fusedLr,
+          momentum,
+          FLAGS_adambeta1,
+          FLAGS_adambeta2,
+          FLAGS_optimrho,
+          FLAGS_optimepsilon,
+          weightdecay);
+    } else {
+      opt = std::make_shared<FusedOptimizer>(
+          params,
+          type,
+          fusedLr,
+          momentum,
+          FLAGS_adambeta1,
+          FLAGS_adambeta2,
+          FLAGS_optimrho,
+          FLAGS_optimepsilon,
+          weightdecay);
+    }
+  } else if (optimizer == kSGDoptimizer) {
     opt = std::make_shared<fl::SGDOptimizer>(params, lr, momentum, weightdecay);
   } else if (optimizer == kAdamOptimizer) {
     opt = std::make_shared<fl::AdamOptimizer>(
@@ -45,6 +97,17 @@ std::shared_ptr<fl::FirstOrderOptimizer> initOptimizer(
   } else if (optimizer == kAdadeltaOptimizer) {
     opt = std::make_shared<fl::AdadeltaOptimizer>(
         params, 1.0, FLAGS_optimrho, FLAGS_optimepsilon, weightdecay);
+  } else if (optimizer == kLambOptimizer) {
+    opt = std::make_shared<LambOptimizer>(
+        params,
+        lr,
+        FLAGS_adambeta1,
+        FLAGS_adambeta2,
+        FLAGS_optimepsilon,
+        weightdecay);
+  } else if (optimizer == kLarsOptimizer) {
+    opt = std::make_shared<LarsOptimizer>(
+        params, lr, momentum, FLAGS_larseta, weightdecay);
   } else {
     LOG(FATAL) << "Optimizer option " << optimizer << " not implemented";
   }
@@ -52,4 +115,172 @@ std::shared_ptr<fl::FirstOrderOptimizer> initOptimizer(
   return opt;
 }
 
+namespace {
+
+/* The L2 norm of `a`, as a 1-element array which stays on the device */
+af::array norm2(const af::array& a) {
+  return af::sqrt(af::sum(af::flat(a * a)));
+}
+
+/* `num / den` broadcast to `dims`, or 1 if either norm is 0 */
+af::array trustRatio(
+    const af::array& num,
+    const af::array& den,
+    const af::dim4& dims) {
+  auto ratio = af::select(num > 0 && den > 0, num / den, 1.0);
+  return af::tile(ratio, dims);
+}
+
+} // namespace
+
+LambOptimizer::LambOptimizer(
+    const std::vector<fl::Variable>& parameters,
+    double learningRate,
+    double beta1 /* = 0.9 */,
+    double beta2 /* = 0.999 */,
+    double epsilon /* = 1e-6 */,
+    double weightDecay /* = 0 */)
+    : fl::FirstOrderOptimizer(parameters, learningRate),
+      beta1_(beta1),
+      beta2_(beta2),
+      eps_(epsilon),
+      wd_(weightDecay) {
+  for (const auto& p : parameters_) {
+    biasedFirst_.push_back(af::constant(0, p.dims(), p.type()));
+    biasedSecond_.push_back(af::constant(0, p.dims(), p.type()));
+    biasedFirst_.back().eval();
+    biasedSecond_.back().eval();
+  }
+}
+
+void LambOptimizer::step() {
+  ++count_;
+  float correctedBias1 = 1 - std::pow(beta1_, count_);
+  float correctedBias2 = 1 - std::pow(beta2_, count_);
+
+  for (size_t i = 0; i < parameters_.size(); i++) {
+    if (!parameters_[i].isGradAvailable()) {
+      continue;
+    }
+
+    const af::array& grad = parameters_[i].grad().array();
+    af::array& data = parameters_[i].array();
+    af::array& biasedFirst = biasedFirst_[i];
+    af::array& biasedSecond = biasedSecond_[i];
+
+    biasedFirst = beta1_ * biasedFirst + (1 - beta1_) * grad;
+    biasedSecond = beta2_ * biasedSecond + (1 - beta2_) * grad * grad;
+    af::eval(biasedFirst);
+    af::eval(biasedSecond);
+
+    af::array update = (biasedFirst / correctedBias1) /
+        (af::sqrt(biasedSecond / correctedBias2) + eps_);
+    if (wd_ != 0) {
+      update = update + wd_ * data;
+    }
+    update.eval();
+    data = data - lr_ * trustRatio(norm2(data), norm2(update), data.dims()) *
+            update;
+    af::eval(data);
+  }
+}
+
+std::string LambOptimizer::prettyString() const {
+  std::ostringstream ss;
+  ss << "LAMB (beta1=" << beta1_ << ") (beta2=" << beta2_ << ")";
+  if (wd_ != 0) {
+    ss << " (weight decay=" << wd_ << ")";
+  }
+  return ss.str();
+}
+
+LarsOptimizer::LarsOptimizer(
+    const std::vector<fl::Variable>& parameters,
+    double learningRate,
+    double momentum /* = 0.9 */,
+    double eta /* = 0.001 */,
+    double weightDecay /* = 0 */)
+    : fl::FirstOrderOptimizer(parameters, learningRate),
+      mu_(momentum),
+      eta_(eta),
+      wd_(weightDecay) {
+  if (mu_ != 0) {
+    for (const auto& p : parameters_) {
+      velocities_.push_back(af::constant(0, p.dims(), p.type()));
+      velocities_.back().eval();
+    }
+  }
+}
+
+void LarsOptimizer::step() {
+  for (size_t i = 0; i < parameters_.size(); i++) {
+    if (!parameters_[i].isGradAvailable()) {
+      continue;
+    }
+
+    af::array grad = parameters_[i].grad().array();
+    af::array& data = parameters_[i].array();
+
+    af::array dataNorm = norm2(data);
+    af::array localLr = eta_ *
+        trustRatio(dataNorm, norm2(grad) + wd_ * dataNorm, data.dims());
+    if (wd_ != 0) {
+      grad = grad + wd_ * data;
+    }
+    grad = localLr * grad;
+    if (mu_ != 0) {
+      af::array& velocity = velocities_[i];
+      velocity = mu_ * velocity + grad;
+      af::eval(velocity);
+      grad = velocity;
+    }
+    data = data - lr_ * grad;
+    af::eval(data);
+  }
+}
+
+std::string LarsOptimizer::prettyString() const {
+  std::ostringstream ss;
+  ss << "LARS (eta=" << eta_ << ")";
+  if (mu_ != 0) {
+    ss << " (momentum=" << mu_ << ")";
+  }
+  if (wd_ != 0) {
+    ss << " (weight decay=" << wd_ << ")";
+  }
+  return ss.str();
+}
+
+DynamicLossScaler::DynamicLossScaler(
+    double initScale /* = 65536.0 */,
+    int growthInterval /* = 2000 */)
+    : scale_(initScale), growthInterval_(growthInterval) {}
+
+bool DynamicLossScaler::unscale(const std::vector<fl::Variable>& params) {
+  // Count the non-finite gradients on the device, with a single copy back
+  af::array nonFinite = af::constant(0, 1, u32);
+  for (const auto& p : params) {
+    if (p.isGradAvailable()) {
+      auto& grad = p.grad().array();
+      nonFinite += af::count(af::flat(af::isNaN(grad) || af::isInf(grad)));
+    }
+  }
+  if (nonFinite.scalar<unsigned>() > 0) {
+    scale_ = std::max(scale_ / 2, 1.0);
+    goodSteps_ = 0;
+    LOG(INFO) << "Gradient overflow, skipping the step and lowering the "
+              << "loss scale to " << scale_;
+    return false;
+  }
+  for (const auto& p : params) {
+    if (p.isGradAvailable()) {
+      p.grad().array() = p.grad().array() / scale_;
+    }
+  }
+  if (++goodSteps_ >= growthInterval_) {
+    scale_ *= 2;
+    goodSteps_ = 0;
+  }
+  return true;
+}
 } // namespace w2l
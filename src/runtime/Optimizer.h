@@ -20,4 +20,106 @@ std::shared_ptr<fl::FirstOrderOptimizer> initOptimizer(
     double lr,
     double momentum,
     double weightdecay);
+
+/**
+ * LAMB optimizer (You et al., 2019) for large batch training: the Adam update
+ * of each parameter, with the decoupled weight decay added, is scaled by the
+ * ratio of the norm of the parameter to the norm of the update, so that every
+ * layer moves by about `lr` times its own norm.
+ */
+class LambOptimizer : public fl::FirstOrderOptimizer {
+ public:
+  LambOptimizer(
+      const std::vector<fl::Variable>& parameters,
+      double learningRate,
+      double beta1 = 0.9,
+      double beta2 = 0.999,
+      double epsilon = 1e-6,
+      double weightDecay = 0);
+
+  void step() override;
+
+  std::string prettyString() const override;
+
+ private:
+  FL_SAVE_LOAD_WITH_BASE(
+      fl::FirstOrderOptimizer,
+      beta1_,
+      beta2_,
+      eps_,
+      wd_,
+      count_,
+      biasedFirst_,
+      biasedSecond_)
+
+  LambOptimizer() = default;
+
+  float beta1_;
+  float beta2_;
+  float eps_;
+  float wd_;
+  int count_{0};
+  std::vector<af::array> biasedFirst_;
+  std::vector<af::array> biasedSecond_;
+};
+
+/**
+ * LARS optimizer (You et al., 2017) for large batch training: SGD with
+ * momentum, where the learning rate of each parameter is scaled by
+ * `eta * |w| / (|g| + weightDecay * |w|)`.
+ */
+class LarsOptimizer : public fl::FirstOrderOptimizer {
+ public:
+  LarsOptimizer(
+      const std::vector<fl::Variable>& parameters,
+      double learningRate,
+      double momentum = 0.9,
+      double eta = 0.001,
+      double weightDecay = 0);
+
+  void step() override;
+
+  std::string prettyString() const override;
+
+ private:
+  FL_SAVE_LOAD_WITH_BASE(fl::FirstOrderOptimizer, mu_, eta_, wd_, velocities_)
+
+  LarsOptimizer() = default;
+
+  float mu_;
+  float eta_;
+  float wd_;
+  std::vector<af::array> velocities_;
+};
+
+/**
+ * Dynamic loss scaling for mixed-precision training: the loss is multiplied
+ * by scale() before the backward so that small fp16 gradients don't flush to
+ * zero. A step whose gradients overflow is skipped and halves the scale; the
+ * scale doubles after `growthInterval` steps without overflow.
+ */
+class DynamicLossScaler {
+ public:
+  explicit DynamicLossScaler(
+      double initScale = 65536.0,
+      int growthInterval = 2000);
+
+  double scale() const {
+    return scale_;
+  }
+
+  /**
+   * Divides the gradients of `params` by the scale. Returns false, and
+   * halves the scale, if they aren't all finite: the step must be skipped.
+   */
+  bool unscale(const std::vector<fl::Variable>& params);
+
+ private:
+  double scale_;
+  int growthInterval_;
+  int goodSteps_{0};
+};
 } // namespace w2l
+
+CEREAL_REGISTER_TYPE(w2l::LambOptimizer)
+CEREAL_REGISTER_TYPE(w2l::LarsOptimizer)
@@ -10,11 +10,326 @@
 
 #include "common/FlashlightUtils.h"
 
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
 #include <sstream>
+#include <unordered_set>
 
 namespace w2l {
 
+namespace {
+
+void writeFileAtomically(const std::string& filepath, const std::string& data) {
+  auto tmpPath = filepath + ".tmp";
+  {
+    std::ofstream file(tmpPath, std::ios::binary);
+    if (!file.is_open()) {
+      throw std::runtime_error("failed to open file for writing: " + tmpPath);
+    }
+    file.write(data.data(), data.size());
+    file.flush();
+    if (!file) {
+      throw std::runtime_error("failed to write file: " + tmpPath);
+    }
+  }
+  if (std::rename(tmpPath.c_str(), filepath.c_str()) != 0) {
+    throw std::runtime_error("failed to rename " + tmpPath + " to " + filepath);
+  }
+}
+
+constexpr uint64_t kShardBytes = 256 << 20;
+constexpr const char* kShardPrefix = "shard_";
+
+/**
+ * Maps the whole file read-only. The pages are read ahead in the background
+ * and faulted in as the tensors are copied, so that the copy of the first
+ * tensors overlaps the reads of the next ones.
+ */
+const char* mapFile(const std::string& path, size_t& size) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("failed to open shard for reading: " + path);
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0) {
+    close(fd);
+    throw std::runtime_error("failed to stat shard: " + path);
+  }
+  size = info.st_size;
+  if (size == 0) {
+    close(fd);
+    return nullptr;
+  }
+  void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    throw std::runtime_error("failed to map shard: " + path);
+  }
+  // Only a hint, the pages are read on demand without it
+  madvise(data, size, MADV_WILLNEED);
+  return static_cast<const char*>(data);
+}
+
+} // namespace
+
+namespace detail {
+
+std::string manifestPath(const std::string& dirpath) {
+  return pathsConcat(dirpath, "manifest.bin");
+}
+
+ShardSet writeShards(
+    const std::string& dirpath,
+    const std::vector<af::array>& arrays) {
+  dirCreate(dirpath);
+  // New names at each save, the ones of the current manifest stay readable
+  auto tag = std::to_string(
+      std::chrono::system_clock::now().time_since_epoch().count());
+  ShardSet shards;
+  std::ofstream file;
+  uint64_t offset = 0;
+  std::vector<char> host;
+  auto closeFile = [&]() {
+    file.close();
+    if (!file) {
+      throw std::runtime_error("failed to write shard " + shards.files.back());
+    }
+  };
+  for (const auto& array : arrays) {
+    if (!file.is_open() || offset >= kShardBytes) {
+      if (file.is_open()) {
+        closeFile();
+      }
+      shards.files.push_back(
+          kShardPrefix + tag +
+          format("_%03d.bin", static_cast<int>(shards.files.size())));
+      file.open(pathsConcat(dirpath, shards.files.back()), std::ios::binary);
+      if (!file.is_open()) {
+        throw std::runtime_error(
+            "failed to open shard for writing: " + shards.files.back());
+      }
+      offset = 0;
+    }
+    TensorShard tensor;
+    for (int i = 0; i < 4; ++i) {
+      tensor.dims.push_back(array.dims(i));
+    }
+    tensor.type = array.type();
+    tensor.file = shards.files.size() - 1;
+    tensor.offset = offset;
+    tensor.bytes = array.bytes();
+    if (tensor.bytes > 0) {
+      host.resize(tensor.bytes);
+      array.host(host.data());
+      file.write(host.data(), tensor.bytes);
+    }
+    offset += tensor.bytes;
+    shards.tensors.push_back(std::move(tensor));
+  }
+  if (file.is_open()) {
+    closeFile();
+  }
+  return shards;
+}
+
+std::vector<af::array> readShards(
+    const std::string& dirpath,
+    const ShardSet& shards) {
+  size_t nFiles = shards.files.size();
+  std::vector<const char*> data(nFiles, nullptr);
+  std::vector<size_t> sizes(nFiles, 0);
+  std::vector<std::exception_ptr> errors(nFiles);
+  std::vector<std::thread> threads;
+  for (size_t f = 0; f < nFiles; ++f) {
+    threads.emplace_back([&, f]() {
+      try {
+        data[f] = mapFile(pathsConcat(dirpath, shards.files[f]), sizes[f]);
+      } catch (...) {
+        errors[f] = std::current_exception();
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  auto unmapFile = [&](size_t f) {
+    if (data[f]) {
+      munmap(const_cast<char*>(data[f]), sizes[f]);
+      data[f] = nullptr;
+    }
+  };
+  auto unmapFiles = [&]() {
+    for (size_t f = 0; f < nFiles; ++f) {
+      unmapFile(f);
+    }
+  };
+  // A shard is unmapped once its last tensor is copied, so that the host
+  // memory used doesn't grow with the size of the model
+  std::vector<size_t> lastTensor(nFiles, 0);
+  for (size_t i = 0; i < shards.tensors.size(); ++i) {
+    auto file = shards.tensors[i].file;
+    if (file >= 0 && file < nFiles) {
+      lastTensor[file] = i;
+    }
+  }
+
+  std::vector<af::array> arrays;
+  try {
+    for (const auto& error : errors) {
+      if (error) {
+        std::rethrow_exception(error);
+      }
+    }
+    for (size_t i = 0; i < shards.tensors.size(); ++i) {
+      const auto& tensor = shards.tensors[i];
+      if (tensor.dims.size() != 4 || tensor.file < 0 || tensor.file >= nFiles ||
+          (tensor.bytes > 0 && !data[tensor.file]) ||
+          tensor.offset + tensor.bytes > sizes[tensor.file]) {
+        throw std::runtime_error("invalid tensor in the manifest");
+      }
+      af::dim4 dims(
+          tensor.dims[0], tensor.dims[1], tensor.dims[2], tensor.dims[3]);
+      af::array array(dims, static_cast<af::dtype>(tensor.type));
+      if (tensor.bytes != array.bytes()) {
+        throw std::runtime_error("invalid tensor size in the manifest");
+      }
+      if (tensor.bytes > 0) {
+        array.write(data[tensor.file] + tensor.offset, tensor.bytes, afHost);
+      }
+      arrays.push_back(array);
+      if (lastTensor[tensor.file] == i) {
+        unmapFile(tensor.file);
+      }
+    }
+  } catch (...) {
+    unmapFiles();
+    throw;
+  }
+  unmapFiles();
+  return arrays;
+}
+
+void writeManifest(
+    const std::string& dirpath,
+    const std::function<void(cereal::BinaryOutputArchive&)>& save) {
+  auto path = manifestPath(dirpath);
+  auto tmpPath = path + ".tmp";
+  {
+    std::ofstream file(tmpPath, std::ios::binary);
+    if (!file.is_open()) {
+      throw std::runtime_error("failed to open manifest for writing");
+    }
+    {
+      cereal::BinaryOutputArchive ar(file);
+      save(ar);
+    }
+    file.close();
+    if (!file) {
+      throw std::runtime_error("failed to write manifest");
+    }
+  }
+  if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+    throw std::runtime_error("failed to rename " + tmpPath + " to " + path);
+  }
+}
+
+void removeStaleShards(const std::string& dirpath, const ShardSet& shards) {
+  std::unordered_set<std::string> files(
+      shards.files.begin(), shards.files.end());
+  DIR* dir = opendir(dirpath.c_str());
+  if (!dir) {
+    return;
+  }
+  while (auto* entry = readdir(dir)) {
+    std::string name = entry->d_name;
+    if (name.compare(0, std::strlen(kShardPrefix), kShardPrefix) == 0 &&
+        files.find(name) == files.end()) {
+      std::remove(pathsConcat(dirpath, name).c_str());
+    }
+  }
+  closedir(dir);
+}
+
+} // namespace detail
+
+AsyncCheckpointWriter::AsyncCheckpointWriter()
+    : thread_(&AsyncCheckpointWriter::run, this) {}
+
+AsyncCheckpointWriter::~AsyncCheckpointWriter() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  thread_.join();
+}
+
+void AsyncCheckpointWriter::write(
+    const std::string& filepath,
+    std::shared_ptr<const std::string> snapshot) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    rethrowError();
+    queue_.emplace_back(filepath, std::move(snapshot));
+  }
+  cv_.notify_all();
+}
+
+void AsyncCheckpointWriter::wait() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_.wait(lock, [this]() { return queue_.empty() && !writing_; });
+  rethrowError();
+}
+
+void AsyncCheckpointWriter::rethrowError() {
+  if (error_) {
+    auto error = error_;
+    error_ = nullptr;
+    std::rethrow_exception(error);
+  }
+}
+
+void AsyncCheckpointWriter::run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    cv_.wait(lock, [this]() { return stop_ || !queue_.empty(); });
+    if (queue_.empty()) {
+      return; // stopped with no write left
+    }
+    auto item = std::move(queue_.front());
+    queue_.pop_front();
+    writing_ = true;
+    lock.unlock();
+    try {
+      retryWithBackoff(
+          std::chrono::seconds(1),
+          2.0,
+          6,
+          writeFileAtomically,
+          item.first,
+          *item.second); // max wait 31s
+    } catch (const std::exception& ex) {
+      LOG(ERROR) << "Error while writing " << item.first << ": " << ex.what();
+      lock.lock();
+      error_ = std::current_exception();
+      writing_ = false;
+      cv_.notify_all();
+      continue;
+    }
+    lock.lock();
+    writing_ = false;
+    cv_.notify_all();
+  }
+}
+
 std::string newRunPath(
     const std::string& root,
     const std::string& runname /* = "" */,
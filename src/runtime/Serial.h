@@ -8,6 +8,15 @@
 
 #pragma once
 
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <type_traits>
 #include <unordered_map>
 
 #include <flashlight/flashlight.h>
@@ -18,6 +27,76 @@
 
 namespace w2l {
 
+namespace detail {
+
+// Location of a tensor in the shards of a sharded checkpoint
+struct TensorShard {
+  std::vector<int64_t> dims;
+  int type; // af::dtype
+  int file; // index in ShardSet::files
+  uint64_t offset;
+  uint64_t bytes;
+
+  FL_SAVE_LOAD(dims, type, file, offset, bytes)
+};
+
+struct ShardSet {
+  std::vector<std::string> files;
+  std::vector<TensorShard> tensors;
+
+  FL_SAVE_LOAD(files, tensors)
+};
+
+/* Writes the raw data of `arrays` to new shard files in `dirpath` */
+ShardSet writeShards(
+    const std::string& dirpath,
+    const std::vector<af::array>& arrays);
+
+/**
+ * Memory-maps the shards in parallel and copies the tensors into arrays from
+ * their pages as they are read, unmapping each shard once copied
+ */
+std::vector<af::array> readShards(
+    const std::string& dirpath,
+    const ShardSet& shards);
+
+/* Writes the manifest of `dirpath` with `save` and renames it in place */
+void writeManifest(
+    const std::string& dirpath,
+    const std::function<void(cereal::BinaryOutputArchive&)>& save);
+
+/* Removes the shard files of `dirpath` which aren't in `shards` */
+void removeStaleShards(const std::string& dirpath, const ShardSet& shards);
+
+std::string manifestPath(const std::string& dirpath);
+
+inline void collectParams(std::vector<fl::Variable>& /* unused */) {}
+
+template <class T>
+typename std::enable_if<std::is_base_of<fl::Module, T>::value>::type
+addParams(std::vector<fl::Variable>& params, const std::shared_ptr<T>& module) {
+  if (module) {
+    auto moduleParams = module->params();
+    params.insert(params.end(), moduleParams.begin(), moduleParams.end());
+  }
+}
+
+template <class T>
+void addParams(std::vector<fl::Variable>& /* unused */, const T& /* unused */) {
+}
+
+/* The params of the `std::shared_ptr`s of modules among `args` */
+template <class T, class... Rest>
+void collectParams(
+    std::vector<fl::Variable>& params,
+    const T& arg,
+    const Rest&... rest) {
+  addParams(params, arg);
+  collectParams(params, rest...);
+}
+
+} // namespace detail
+
 struct W2lSerializer {
  public:
   template <class... Args>
@@ -31,13 +110,62 @@ struct W2lSerializer {
         args...); // max wait 31s
   }
 
+  /**
+   * Serializes `args` as save() does into a buffer in host memory, to be
+   * written by an AsyncCheckpointWriter
+   */
+  template <class... Args>
+  static std::shared_ptr<const std::string> snapshot(const Args&... args) {
+    std::ostringstream buffer(std::ios::binary);
+    {
+      cereal::BinaryOutputArchive ar(buffer);
+      ar(std::string(W2L_VERSION));
+      ar(args...);
+    }
+    return std::make_shared<const std::string>(buffer.str());
+  }
+
+  /**
+   * Loads `args` from a buffer written by snapshot(), e.g. into copies of the
+   * modules snapshotted
+   */
+  template <typename... Args>
+  static void loadSnapshot(const std::string& snapshot, Args&... args) {
+    std::istringstream buffer(snapshot, std::ios::binary);
+    cereal::BinaryInputArchive ar(buffer);
+    std::string version;
+    ar(version);
+    ar(args...);
+  }
+
+  /**
+   * Saves `args` as save() does, but to the directory `dirpath`: the params
+   * of the modules among `args` (`std::shared_ptr`s of `fl::Module`s) are
+   * written raw in shards of about 256MB, next to a manifest holding the rest
+   * with empty params. load() reads such a directory, memory-mapping the shards
+   * in parallel instead of reading one cereal stream. The manifest is
+   * replaced last and atomically, so an interrupted save leaves the previous
+   * checkpoint readable.
+   */
+  template <class... Args>
+  static void saveSharded(const std::string& dirpath, const Args&... args) {
+    retryWithBackoff(
+        std::chrono::seconds(1),
+        2.0,
+        6,
+        saveShardedImpl<Args...>,
+        dirpath,
+        args...); // max wait 31s
+  }
+
+  /* Loads a file written by save() or a directory written by saveSharded() */
   template <typename... Args>
   static void load(const std::string& filepath, Args&... args) {
     retryWithBackoff(
         std::chrono::seconds(1),
         2.0,
         6,
-        loadImpl<Args...>,
+        dirExists(filepath) ? loadShardedImpl<Args...> : loadImpl<Args...>,
         filepath,
         args...); // max wait 31s
   }
@@ -59,6 +187,78 @@ struct W2lSerializer {
     }
   }
 
+  template <typename... Args>
+  static void saveShardedImpl(const std::string& dirpath, const Args&... args) {
+    try {
+      std::vector<fl::Variable> params;
+      detail::collectParams(params, args...);
+      std::vector<af::array> arrays;
+      for (auto& param : params) {
+        arrays.push_back(param.array());
+      }
+      auto shards = detail::writeShards(dirpath, arrays);
+
+      // The manifest holds the modules with empty params
+      for (auto& param : params) {
+        param.array() = af::array();
+      }
+      auto restoreParams = [&]() {
+        for (size_t i = 0; i < params.size(); ++i) {
+          params[i].array() = arrays[i];
+        }
+      };
+      try {
+        detail::writeManifest(dirpath, [&](cereal::BinaryOutputArchive& ar) {
+          ar(std::string(W2L_VERSION));
+          ar(shards);
+          ar(args...);
+        });
+      } catch (...) {
+        restoreParams();
+        throw;
+      }
+      restoreParams();
+      detail::removeStaleShards(dirpath, shards);
+    } catch (const std::exception& ex) {
+      LOG(ERROR) << "Error while saving: " << ex.what() << "\n";
+      throw;
+    }
+  }
+
+  template <typename... Args>
+  static void loadShardedImpl(const std::string& dirpath, Args&... args) {
+    try {
+      std::ifstream file(detail::manifestPath(dirpath), std::ios::binary);
+      if (!file.is_open()) {
+        throw std::runtime_error("failed to open manifest for reading");
+      }
+      std::string version;
+      detail::ShardSet shards;
+      cereal::BinaryInputArchive ar(file);
+      ar(version);
+      ar(shards);
+      ar(args...);
+
+      std::vector<fl::Variable> params;
+      detail::collectParams(params, args...);
+      if (params.empty()) {
+        return; // e.g. only the config is read
+      }
+      if (params.size() != shards.tensors.size()) {
+        throw std::runtime_error(
+            "the checkpoint has " + std::to_string(shards.tensors.size()) +
+            " params but the modules have " + std::to_string(params.size()));
+      }
+      auto arrays = detail::readShards(dirpath, shards);
+      for (size_t i = 0; i < params.size(); ++i) {
+        params[i].array() = arrays[i];
+      }
+    } catch (const std::exception& ex) {
+      LOG(ERROR) << "Error while loading: " << ex.what() << "\n";
+      throw;
+    }
+  }
+
   template <typename... Args>
   static void loadImpl(const std::string& filepath, Args&... args) {
     try {
@@ -77,6 +277,44 @@ struct W2lSerializer {
   }
 };
 
+/**
+ * Writes the snapshots of W2lSerializer::snapshot() to files on a background
+ * thread, so that training goes on while a checkpoint is written. Each file is
+ * written to `filepath`.tmp and renamed, so that it's replaced atomically and
+ * a job killed while writing leaves the previous checkpoint intact. Writes are
+ * retried like W2lSerializer::save(); if they still fail, the error is
+ * rethrown by the next call to write() or wait().
+ */
+class AsyncCheckpointWriter {
+ public:
+  AsyncCheckpointWriter();
+
+  /* Waits for the pending writes */
+  ~AsyncCheckpointWriter();
+
+  /* Queues the write of `snapshot` to `filepath` */
+  void write(
+      const std::string& filepath,
+      std::shared_ptr<const std::string> snapshot);
+
+  /* Blocks until all queued writes are done */
+  void wait();
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::pair<std::string, std::shared_ptr<const std::string>>>
+      queue_;
+  bool writing_{false};
+  bool stop_{false};
+  std::exception_ptr error_;
+  // Last, to start once the members it uses are constructed
+  std::thread thread_;
+
+  void run();
+  void rethrowError();
+};
+
 // Convenience struct for serializing emissions and targets
 struct EmissionSet {
   std::vector<std::vector<float>> emissions;
@@ -0,0 +1,161 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "runtime/StreamingVad.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "common/Defines.h"
+#include "common/FlashlightUtils.h"
+#include "data/Featurize.h"
+#include "libraries/feature/Mfcc.h"
+#include "libraries/feature/Mfsc.h"
+
+namespace w2l {
+
+StreamingVad::StreamingVad(
+    std::shared_ptr<fl::Sequential> net,
+    const std::vector<std::string>& archLines,
+    int blankIdx,
+    const StreamingVadOptions& options)
+    : module_(std::move(net), archLines),
+      blankIdx_(blankIdx),
+      options_(options) {
+  if (FLAGS_channels != 1) {
+    throw std::invalid_argument("StreamingVad: single channel audio only");
+  }
+  if (options_.silenceThreshold < options_.speechThreshold) {
+    throw std::invalid_argument(
+        "StreamingVad: the silence threshold is below the speech threshold");
+  }
+  inputFrameMs_ = 1000.0 / FLAGS_samplerate;
+  if (FLAGS_pow || FLAGS_mfsc || FLAGS_mfcc) {
+    auto params = defineSpeechFeatureParams();
+    std::shared_ptr<PowerSpectrum<float>> featurizer;
+    if (FLAGS_mfcc) {
+      featurizer = std::make_shared<Mfcc<float>>(params);
+    } else if (FLAGS_mfsc) {
+      featurizer = std::make_shared<Mfsc<float>>(params);
+    } else {
+      featurizer = std::make_shared<PowerSpectrum<float>>(params);
+    }
+    featurizer_ = std::make_shared<StreamingFeaturizer<float>>(featurizer);
+    featSz_ = getSpeechFeatureSize();
+    inputFrameMs_ = FLAGS_framestridems;
+  }
+}
+
+std::vector<VadEvent> StreamingVad::feed(const float* audio, size_t size) {
+  std::vector<float> input(audio, audio + size);
+  if (featurizer_) {
+    input = featurizer_->apply(input);
+  }
+  auto frames = toInput(input);
+  if (frames.isempty()) {
+    return {};
+  }
+  return process(module_.forward(fl::Variable(frames, false)));
+}
+
+std::vector<VadEvent> StreamingVad::finish() {
+  std::vector<VadEvent> events;
+  if (featurizer_) {
+    auto frames = toInput(featurizer_->finish());
+    if (!frames.isempty()) {
+      events = process(module_.forward(fl::Variable(frames, false)));
+    }
+  }
+  auto last = process(module_.finish());
+  events.insert(events.end(), last.begin(), last.end());
+  if (inSpeech_) {
+    // The speech lasts until the end of the stream, even after a short silence
+    int64_t end = runStart_ >= 0 ? runStart_ : nFrames_;
+    events.push_back({VadEvent::Kind::SPEECH_END, frameMs(end)});
+  }
+
+  sum_ = sumSquares_ = 0;
+  count_ = 0;
+  nFrames_ = 0;
+  inSpeech_ = false;
+  runStart_ = -1;
+  return events;
+}
+
+double StreamingVad::maxLatencyMs() const {
+  double latency = module_.receptiveField() * inputFrameMs_;
+  if (featurizer_) {
+    // The frame, and the frames of the derivatives
+    latency += FLAGS_framesizems + 2 * FLAGS_devwin * FLAGS_framestridems;
+  }
+  return latency + std::max(options_.minSpeechMs, options_.minSilenceMs);
+}
+
+af::array StreamingVad::toInput(const std::vector<float>& features) {
+  int64_t T = features.size() / featSz_;
+  if (T == 0) {
+    return af::array();
+  }
+  // FEAT X FRAMES (Col Major) to FRAMES X FEAT, as featurize() does
+  auto input = af::array(featSz_, T, features.data()).T();
+  if (!options_.normalize) {
+    return input;
+  }
+  for (float value : features) {
+    sum_ += value;
+    sumSquares_ += static_cast<double>(value) * value;
+  }
+  count_ += features.size();
+  double mean = sum_ / count_;
+  double stddev = std::sqrt(std::max(sumSquares_ / count_ - mean * mean, 0.0));
+  if (stddev <= 0) {
+    stddev = 1;
+  }
+  return (input - mean) / stddev;
+}
+
+std::vector<VadEvent> StreamingVad::process(const fl::Variable& emissions) {
+  std::vector<VadEvent> events;
+  if (emissions.isempty()) {
+    return events;
+  }
+  auto blankProbs = afToVector<float>(
+      fl::softmax(emissions, 0).array().row(blankIdx_));
+  double minSpeechFrames = options_.minSpeechMs / frameMs(1);
+  double minSilenceFrames = options_.minSilenceMs / frameMs(1);
+  for (float prob : blankProbs) {
+    bool against = inSpeech_ ? prob > options_.silenceThreshold
+                             : prob < options_.speechThreshold;
+    bool agrees = inSpeech_ ? prob < options_.speechThreshold
+                            : prob > options_.silenceThreshold;
+    if (against && runStart_ < 0) {
+      runStart_ = nFrames_;
+    } else if (agrees) {
+      runStart_ = -1;
+    }
+    ++nFrames_;
+    if (runStart_ >= 0 &&
+        nFrames_ - runStart_ >=
+            (inSpeech_ ? minSilenceFrames : minSpeechFrames)) {
+      events.push_back(
+          {inSpeech_ ? VadEvent::Kind::SPEECH_END
+                     : VadEvent::Kind::SPEECH_START,
+           frameMs(runStart_)});
+      inSpeech_ = !inSpeech_;
+      runStart_ = -1;
+    }
+  }
+  return events;
+}
+
+double StreamingVad::frameMs(int64_t frame) const {
+  return frame * module_.stride() * inputFrameMs_;
+}
+
+} // namespace w2l
@@ -0,0 +1,108 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <flashlight/flashlight.h>
+
+#include "libraries/feature/StreamingFeaturizer.h"
+#include "module/StreamingW2lModule.h"
+
+namespace w2l {
+
+struct StreamingVadOptions {
+  // Frames with a blank probability below `speechThreshold` are speech, and
+  // above `silenceThreshold` silence; the ones in between continue the
+  // current state
+  double speechThreshold = 0.99;
+  double silenceThreshold = 0.999;
+  double minSpeechMs = 50; // speech this long starts a segment
+  double minSilenceMs = 300; // silence this long ends it
+  // Normalizes the input by the mean and deviation of the stream so far, as
+  // the training normalizes each utterance
+  bool normalize = true;
+};
+
+struct VadEvent {
+  enum class Kind { SPEECH_START, SPEECH_END };
+
+  Kind kind;
+  double timeMs; // from the start of the stream
+};
+
+/**
+ * Voice activity detection on live audio with a CTC acoustic model: the
+ * frames where the blank is unlikely are speech. The audio is featurized by a
+ * StreamingFeaturizer and forwarded by a StreamingW2lModule, so each frame is
+ * computed once, and the start and the end of the speech segments are
+ * reported as soon as they are decided, with hysteresis on the probability
+ * and on the durations. The features and the flags are the ones of the model,
+ * set globally when it is loaded.
+ *
+ * An event is reported at most maxLatencyMs() after the audio deciding it was
+ * fed, which is what a decoder gated by the VAD waits for.
+ */
+class StreamingVad {
+ public:
+  /**
+   * @param net The CTC acoustic model, set to eval mode
+   * @param archLines The lines of its architecture, see StreamingW2lModule
+   * @param blankIdx The index of the blank in its output
+   */
+  StreamingVad(
+      std::shared_ptr<fl::Sequential> net,
+      const std::vector<std::string>& archLines,
+      int blankIdx,
+      const StreamingVadOptions& options = StreamingVadOptions());
+
+  /* Consumes single channel audio; returns the events it decided */
+  std::vector<VadEvent> feed(const float* audio, size_t size);
+
+  /**
+   * Returns the last events of the stream, ending the open segment if any,
+   * and resets the stream
+   */
+  std::vector<VadEvent> finish();
+
+  bool inSpeech() const {
+    return inSpeech_;
+  }
+
+  /* Bound on the delay of the events: receptive field, features, durations */
+  double maxLatencyMs() const;
+
+ private:
+  StreamingW2lModule module_;
+  int blankIdx_;
+  StreamingVadOptions options_;
+  std::shared_ptr<StreamingFeaturizer<float>> featurizer_;
+  int64_t featSz_{1};
+  double inputFrameMs_;
+
+  // Sums of the input so far, to normalize it
+  double sum_{0};
+  double sumSquares_{0};
+  int64_t count_{0};
+
+  // The state of the hysteresis, over the output frames
+  int64_t nFrames_{0};
+  bool inSpeech_{false};
+  int64_t runStart_{-1}; // first frame of the run against the current state
+
+  af::array toInput(const std::vector<float>& features);
+
+  std::vector<VadEvent> process(const fl::Variable& emissions);
+
+  double frameMs(int64_t frame) const;
+};
+
+} // namespace w2l
@@ -0,0 +1,147 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "runtime/Tracer.h"
+
+#include <chrono>
+#include <sstream>
+#include <stdexcept>
+
+namespace w2l {
+
+namespace {
+
+/* Size of the buffered events above which they are written */
+constexpr size_t kFlushBytes = 1 << 20;
+
+int64_t nowMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+std::string escapeJson(const std::string& str) {
+  std::string escaped;
+  for (char c : str) {
+    if (c == '"' || c == '\\') {
+      escaped += '\\';
+      escaped += c;
+    } else if (c == '\n' || c == '\t') {
+      escaped += ' ';
+    } else {
+      escaped += c;
+    }
+  }
+  return escaped;
+}
+
+/* A short name for a layer: the first line of its description */
+std::string moduleName(const fl::Module& module) {
+  auto name = module.prettyString();
+  name = name.substr(0, name.find('\n'));
+  if (name.size() > 48) {
+    name = name.substr(0, 45) + "...";
+  }
+  return name;
+}
+
+} // namespace
+
+Tracer::Tracer(const std::string& path, int rank, bool syncDevice /* = true */)
+    : enabled_(!path.empty()), rank_(rank), syncDevice_(syncDevice) {
+  if (!enabled_) {
+    return;
+  }
+  file_.open(path, std::ios::out | std::ios::trunc);
+  if (!file_.is_open()) {
+    throw std::runtime_error("Tracer: can't open " + path);
+  }
+  // The closing bracket is optional in the array format, so the file is a
+  // valid trace after each flush
+  file_ << "[\n";
+  std::ostringstream meta;
+  meta << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << rank_
+       << ",\"tid\":0,\"args\":{\"name\":\"rank " << rank_ << "\"}}";
+  buffer_ = meta.str();
+  firstEvent_ = false;
+}
+
+Tracer::~Tracer() {
+  if (!enabled_) {
+    return;
+  }
+  while (!open_.empty()) {
+    end();
+  }
+  flush();
+  file_ << "\n]\n";
+}
+
+void Tracer::begin(const std::string& name) {
+  if (!enabled_) {
+    return;
+  }
+  open_.emplace_back(name, nowMicros());
+}
+
+void Tracer::end() {
+  if (!enabled_ || open_.empty()) {
+    return;
+  }
+  if (syncDevice_) {
+    af::sync();
+  }
+  auto end = nowMicros();
+  const auto& span = open_.back();
+  std::ostringstream event;
+  if (!firstEvent_) {
+    event << ",\n";
+  }
+  firstEvent_ = false;
+  event << "{\"name\":\"" << escapeJson(span.first)
+        << "\",\"ph\":\"X\",\"pid\":" << rank_ << ",\"tid\":0,\"ts\":"
+        << span.second << ",\"dur\":" << end - span.second;
+  if (syncDevice_) {
+    event << ",\"args\":{\"device_sync\":true}";
+  }
+  event << "}";
+  buffer_ += event.str();
+  open_.pop_back();
+  if (buffer_.size() > kFlushBytes) {
+    flush();
+  }
+}
+
+void Tracer::flush() {
+  if (!enabled_ || buffer_.empty()) {
+    return;
+  }
+  file_ << buffer_;
+  file_.flush();
+  buffer_.clear();
+}
+
+std::vector<fl::Variable> tracedForward(
+    fl::Module& net,
+    const std::vector<fl::Variable>& inputs,
+    Tracer& tracer) {
+  auto seq = dynamic_cast<fl::Sequential*>(&net);
+  if (!tracer.enabled() || !seq) {
+    return net.forward(inputs);
+  }
+  auto outputs = inputs;
+  int i = 0;
+  for (const auto& module : seq->modules()) {
+    Tracer::Span span(
+        tracer, "forward (" + std::to_string(i++) + ") " + moduleName(*module));
+    outputs = module->forward(outputs);
+  }
+  return outputs;
+}
+
+} // namespace w2l
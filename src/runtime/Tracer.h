@@ -0,0 +1,91 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <flashlight/flashlight.h>
+
+namespace w2l {
+
+/**
+ * Records nested spans of the training loop and writes them in the Chrome
+ * trace event format (chrome://tracing, Perfetto), one process per rank. The
+ * timestamps are wall-clock microseconds, so the traces of all the ranks can
+ * be loaded together to find the stragglers.
+ *
+ * With `syncDevice`, the device is synchronized at the end of each span so
+ * that the span covers the device work queued in it; such spans have a
+ * "device_sync" argument. A tracer with an empty path records nothing and
+ * costs a branch per call.
+ *
+ * The events are buffered and appended to the file by flush(), so a trace is
+ * readable before the end of the training.
+ */
+class Tracer {
+ public:
+  Tracer(const std::string& path, int rank, bool syncDevice = true);
+
+  ~Tracer();
+
+  bool enabled() const {
+    return enabled_;
+  }
+
+  void begin(const std::string& name);
+
+  /* Ends the last span begun */
+  void end();
+
+  /* The number of spans begun and not ended */
+  int depth() const {
+    return open_.size();
+  }
+
+  void flush();
+
+  /* A span from its construction to its destruction */
+  class Span {
+   public:
+    Span(Tracer& tracer, const std::string& name) : tracer_(tracer) {
+      tracer_.begin(name);
+    }
+
+    ~Span() {
+      tracer_.end();
+    }
+
+   private:
+    Tracer& tracer_;
+  };
+
+ private:
+  bool enabled_;
+  int rank_;
+  bool syncDevice_;
+  std::ofstream file_;
+  bool firstEvent_{true};
+  std::vector<std::pair<std::string, int64_t>> open_; // name, start (us)
+  std::string buffer_;
+};
+
+/**
+ * Forwards `net`, with a span per top-level module if it is a
+ * `fl::Sequential` and `tracer` is enabled.
+ */
+std::vector<fl::Variable> tracedForward(
+    fl::Module& net,
+    const std::vector<fl::Variable>& inputs,
+    Tracer& tracer);
+
+} // namespace w2l
@@ -0,0 +1,54 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "runtime/FusedOptimizer.h"
+
+#include <memory>
+
+#include "libraries/optimizer/cpu/MultiTensorStep.h"
+
+using MultiTensorStep = w2l::cpu::MultiTensorStep<float>;
+
+namespace w2l {
+
+void FusedOptimizer::step() {
+  int nTensors = parameters_.size();
+  if (nTensors == 0) {
+    return;
+  }
+
+  // On the CPU backend, the arrays are updated in host memory
+  std::vector<int64_t> sizes(nTensors);
+  std::vector<float*> params(nTensors);
+  std::vector<const float*> grads(nTensors, nullptr);
+  std::vector<std::unique_ptr<fl::DevicePtr>> raw;
+  for (int i = 0; i < nTensors; ++i) {
+    auto& p = parameters_[i];
+    sizes[i] = p.elements();
+    raw.emplace_back(new fl::DevicePtr(p.array()));
+    params[i] = static_cast<float*>(raw.back()->get());
+    if (p.isGradAvailable()) {
+      raw.emplace_back(new fl::DevicePtr(p.grad().array()));
+      grads[i] = static_cast<const float*>(raw.back()->get());
+    }
+  }
+  fl::DevicePtr state1Raw(state1_);
+  fl::DevicePtr state2Raw(state2_);
+
+  MultiTensorStep::compute(
+      static_cast<OptimizerType>(type_),
+      hyperParams(),
+      nTensors,
+      sizes.data(),
+      params.data(),
+      grads.data(),
+      static_cast<float*>(state1Raw.get()),
+      static_cast<float*>(state2Raw.get()));
+}
+
+} // namespace w2l
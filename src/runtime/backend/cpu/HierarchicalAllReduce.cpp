@@ -0,0 +1,36 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "runtime/Distributed.h"
+
+#include <stdexcept>
+
+namespace w2l {
+
+struct HierarchicalAllReduce::Impl {};
+
+HierarchicalAllReduce::HierarchicalAllReduce() {
+  throw std::runtime_error(
+      "HierarchicalAllReduce requires the CUDA backend built with NCCL");
+}
+
+HierarchicalAllReduce::~HierarchicalAllReduce() = default;
+
+void HierarchicalAllReduce::allReduce(af::array& /* unused */) {}
+
+void HierarchicalAllReduce::sync() {}
+
+int HierarchicalAllReduce::localSize() const {
+  return 1;
+}
+
+int HierarchicalAllReduce::nNodes() const {
+  return 1;
+}
+
+} // namespace w2l
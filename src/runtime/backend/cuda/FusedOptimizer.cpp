@@ -0,0 +1,64 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "runtime/FusedOptimizer.h"
+
+#include <memory>
+
+#include <flashlight/common/cuda.h>
+
+#include "criterion/backend/cuda/WorkspacePool.h"
+#include "libraries/optimizer/cuda/MultiTensorStep.cuh"
+
+using MultiTensorStep = w2l::cuda::MultiTensorStep<float>;
+
+namespace w2l {
+
+void FusedOptimizer::step() {
+  int nTensors = parameters_.size();
+  if (nTensors == 0) {
+    return;
+  }
+
+  std::vector<int64_t> sizes(nTensors);
+  std::vector<float*> params(nTensors);
+  std::vector<const float*> grads(nTensors, nullptr);
+  // Keep the arrays locked until the step is queued
+  std::vector<std::unique_ptr<fl::DevicePtr>> raw;
+  for (int i = 0; i < nTensors; ++i) {
+    auto& p = parameters_[i];
+    sizes[i] = p.elements();
+    raw.emplace_back(new fl::DevicePtr(p.array()));
+    params[i] = static_cast<float*>(raw.back()->get());
+    if (p.isGradAvailable()) {
+      raw.emplace_back(new fl::DevicePtr(p.grad().array()));
+      grads[i] = static_cast<const float*>(raw.back()->get());
+    }
+  }
+
+  auto stream = fl::cuda::getActiveStream();
+  auto workspace = WorkspacePool::get().acquire(
+      MultiTensorStep::getWorkspaceSize(nTensors, sizes.data()), stream);
+  fl::DevicePtr workspaceRaw(*workspace);
+  fl::DevicePtr state1Raw(state1_);
+  fl::DevicePtr state2Raw(state2_);
+
+  MultiTensorStep::compute(
+      static_cast<OptimizerType>(type_),
+      hyperParams(),
+      nTensors,
+      sizes.data(),
+      params.data(),
+      grads.data(),
+      static_cast<float*>(state1Raw.get()),
+      static_cast<float*>(state2Raw.get()),
+      workspaceRaw.get(),
+      stream);
+}
+
+} // namespace w2l
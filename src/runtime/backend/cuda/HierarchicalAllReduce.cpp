@@ -0,0 +1,198 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "runtime/Distributed.h"
+
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <cuda_runtime.h>
+#include <flashlight/common/cuda.h>
+#include <nccl.h>
+
+namespace {
+
+void ncclCheck(ncclResult_t result) {
+  if (result != ncclSuccess) {
+    throw std::runtime_error(
+        std::string("HierarchicalAllReduce: ") + ncclGetErrorString(result));
+  }
+}
+
+void cudaCheck(cudaError_t error) {
+  if (error != cudaSuccess) {
+    throw std::runtime_error(
+        std::string("HierarchicalAllReduce: ") + cudaGetErrorString(error));
+  }
+}
+
+/**
+ * All-gathers one double per process through flashlight's all-reduce, the
+ * other processes adding zeros
+ */
+std::vector<double> allGather(double value, int worldRank, int worldSize) {
+  std::vector<double> values(worldSize, 0);
+  values[worldRank] = value;
+  af::array data(worldSize, values.data());
+  fl::allReduce(data);
+  data.host(values.data());
+  return values;
+}
+
+/**
+ * The NCCL id of group `group` among `nGroups`, created by the process for
+ * which `isRoot` and sent to all the processes through flashlight's
+ * all-reduce. All the processes must call it.
+ */
+ncclUniqueId exchangeId(int nGroups, int group, bool isRoot) {
+  constexpr size_t kIdBytes = sizeof(ncclUniqueId);
+  std::vector<double> bytes(nGroups * kIdBytes, 0);
+  if (isRoot) {
+    ncclUniqueId id;
+    ncclCheck(ncclGetUniqueId(&id));
+    auto* raw = reinterpret_cast<const unsigned char*>(&id);
+    for (size_t i = 0; i < kIdBytes; ++i) {
+      bytes[group * kIdBytes + i] = raw[i];
+    }
+  }
+  af::array data(bytes.size(), bytes.data());
+  fl::allReduce(data);
+  data.host(bytes.data());
+
+  ncclUniqueId id;
+  auto* raw = reinterpret_cast<unsigned char*>(&id);
+  for (size_t i = 0; i < kIdBytes; ++i) {
+    raw[i] = static_cast<unsigned char>(bytes[group * kIdBytes + i]);
+  }
+  return id;
+}
+
+} // namespace
+
+namespace w2l {
+
+struct HierarchicalAllReduce::Impl {
+  int localRank;
+  int localSize;
+  int node;
+  int nNodes;
+  ncclComm_t localComm;
+  ncclComm_t crossComm; // with the same local rank on the other nodes
+  cudaStream_t stream;
+  cudaEvent_t event;
+};
+
+HierarchicalAllReduce::HierarchicalAllReduce() : impl_(new Impl()) {
+  int worldRank = fl::getWorldRank();
+  int worldSize = fl::getWorldSize();
+
+  // The processes of a node are the ones with the same host name, the
+  // nodes are ordered by their first process
+  char hostname[256] = {0};
+  gethostname(hostname, sizeof(hostname) - 1);
+  double hostHash = std::hash<std::string>()(hostname) & 0xFFFFFFFF;
+  auto hosts = allGather(hostHash, worldRank, worldSize);
+  std::vector<double> nodeHosts;
+  std::vector<int> nodeSizes;
+  for (int rank = 0; rank < worldSize; ++rank) {
+    auto it = std::find(nodeHosts.begin(), nodeHosts.end(), hosts[rank]);
+    int node = it - nodeHosts.begin();
+    if (it == nodeHosts.end()) {
+      nodeHosts.push_back(hosts[rank]);
+      nodeSizes.push_back(0);
+    }
+    if (rank == worldRank) {
+      impl_->node = node;
+      impl_->localRank = nodeSizes[node];
+    }
+    ++nodeSizes[node];
+  }
+  impl_->nNodes = nodeHosts.size();
+  impl_->localSize = nodeSizes.front();
+  if (std::any_of(nodeSizes.begin(), nodeSizes.end(), [&](int size) {
+        return size != impl_->localSize;
+      })) {
+    throw std::runtime_error(
+        "HierarchicalAllReduce: the nodes must run the same number of "
+        "processes");
+  }
+
+  auto localId =
+      exchangeId(impl_->nNodes, impl_->node, impl_->localRank == 0);
+  auto crossId =
+      exchangeId(impl_->localSize, impl_->localRank, impl_->node == 0);
+  ncclCheck(ncclCommInitRank(
+      &impl_->localComm, impl_->localSize, localId, impl_->localRank));
+  ncclCheck(ncclCommInitRank(
+      &impl_->crossComm, impl_->nNodes, crossId, impl_->node));
+  cudaCheck(cudaStreamCreateWithFlags(&impl_->stream, cudaStreamNonBlocking));
+  cudaCheck(
+      cudaEventCreateWithFlags(&impl_->event, cudaEventDisableTiming));
+}
+
+HierarchicalAllReduce::~HierarchicalAllReduce() {
+  cudaStreamSynchronize(impl_->stream);
+  ncclCommDestroy(impl_->localComm);
+  ncclCommDestroy(impl_->crossComm);
+  cudaEventDestroy(impl_->event);
+  cudaStreamDestroy(impl_->stream);
+}
+
+void HierarchicalAllReduce::allReduce(af::array& data) {
+  ncclDataType_t type;
+  if (data.type() == f32) {
+    type = ncclFloat;
+  } else if (data.type() == f16) {
+    type = ncclHalf;
+  } else {
+    throw std::invalid_argument(
+        "HierarchicalAllReduce: data must be float32 or float16");
+  }
+  if (data.elements() % impl_->localSize != 0) {
+    throw std::invalid_argument(
+        "HierarchicalAllReduce: size must be a multiple of localSize()");
+  }
+
+  size_t chunk = data.elements() / impl_->localSize;
+  fl::DevicePtr dataRaw(data);
+  // After the work computing `data`
+  cudaCheck(cudaEventRecord(impl_->event, fl::cuda::getActiveStream()));
+  cudaCheck(cudaStreamWaitEvent(impl_->stream, impl_->event, 0));
+
+  auto* all = static_cast<char*>(dataRaw.get());
+  auto* mine = all + impl_->localRank * chunk * af::getSizeOf(data.type());
+  ncclCheck(ncclReduceScatter(
+      all, mine, chunk, type, ncclSum, impl_->localComm, impl_->stream));
+  if (impl_->nNodes > 1) {
+    ncclCheck(ncclAllReduce(
+        mine, mine, chunk, type, ncclSum, impl_->crossComm, impl_->stream));
+  }
+  ncclCheck(ncclAllGather(
+      mine, all, chunk, type, impl_->localComm, impl_->stream));
+}
+
+void HierarchicalAllReduce::sync() {
+  cudaCheck(cudaEventRecord(impl_->event, impl_->stream));
+  cudaCheck(
+      cudaStreamWaitEvent(fl::cuda::getActiveStream(), impl_->event, 0));
+}
+
+int HierarchicalAllReduce::localSize() const {
+  return impl_->localSize;
+}
+
+int HierarchicalAllReduce::nNodes() const {
+  return impl_->nNodes;
+}
+
+} // namespace w2l
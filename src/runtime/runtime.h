@@ -9,8 +9,14 @@
 #pragma once
 
 #include "runtime/Data.h"
+#include "runtime/DataEcho.h"
 #include "runtime/Distributed.h"
+#include "runtime/EmissionFile.h"
+#include "runtime/FusedOptimizer.h"
 #include "runtime/Helpers.h"
+#include "runtime/InferenceEngine.h"
 #include "runtime/Logger.h"
 #include "runtime/Optimizer.h"
 #include "runtime/Serial.h"
+#include "runtime/StreamingVad.h"
+#include "runtime/Tracer.h"
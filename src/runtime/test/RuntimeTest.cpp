@@ -7,6 +7,12 @@
  */
 
 #include <stdint.h>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <random>
+#include <thread>
 #include <unordered_map>
 
 #include <gmock/gmock.h>
@@ -14,9 +20,19 @@
 
 #include <flashlight/flashlight.h>
 
+#include "criterion/criterion.h"
 #include "module/module.h"
+#include "runtime/DataEcho.h"
+#include "runtime/EmissionFile.h"
+#include "runtime/ErrorRateMeter.h"
+#include "runtime/FusedOptimizer.h"
+#include "runtime/Helpers.h"
+#include "runtime/InferenceEngine.h"
+#include "runtime/Optimizer.h"
 #include "runtime/Serial.h"
 #include "runtime/SpeechStatMeter.h"
+#include "runtime/StreamingVad.h"
+#include "runtime/Tracer.h"
 
 using namespace w2l;
 
@@ -69,6 +85,573 @@ TEST(RuntimeTest, LoadAndSave) {
   }
 }
 
+TEST(RuntimeTest, AsyncCheckpoint) {
+  std::unordered_map<std::string, std::string> config({{"lr", "0.1"}});
+  fl::Sequential model;
+  model.add(fl::Conv2D(4, 6, 2, 1));
+  model.add(fl::GatedLinearUnit(2));
+  model.add(fl::Linear(3, 5));
+
+  auto params = model.params();
+  for (auto& param : params) {
+    param = fl::Variable(param.array().copy(), param.isCalcGrad());
+  }
+  {
+    AsyncCheckpointWriter writer;
+    auto snapshot = W2lSerializer::snapshot(config, model);
+    // The snapshot is independent of later updates of the params
+    model.param(0).array() += 1;
+    writer.write(kPath, snapshot);
+    writer.wait();
+  }
+  std::ifstream tmpFile(kPath + ".tmp");
+  ASSERT_FALSE(tmpFile.good());
+
+  fl::Sequential modelload;
+  std::unordered_map<std::string, std::string> configload;
+  W2lSerializer::load(kPath, configload, modelload);
+  EXPECT_THAT(config, ::testing::ContainerEq(configload));
+  ASSERT_EQ(params.size(), modelload.params().size());
+  for (int i = 0; i < params.size(); ++i) {
+    ASSERT_TRUE(afEqual(params[i], modelload.param(i)));
+  }
+}
+
+TEST(RuntimeTest, SnapshotCopy) {
+  std::unordered_map<std::string, std::string> config({{"lr", "0.1"}});
+  auto model = std::make_shared<fl::Sequential>();
+  model->add(fl::Linear(3, 5));
+  model->add(fl::ReLU());
+  auto snapshot = W2lSerializer::snapshot(config, model);
+
+  // The copy doesn't share the params of the model
+  std::unordered_map<std::string, std::string> configcopy;
+  std::shared_ptr<fl::Sequential> modelcopy;
+  W2lSerializer::loadSnapshot(*snapshot, configcopy, modelcopy);
+  EXPECT_THAT(config, ::testing::ContainerEq(configcopy));
+  ASSERT_TRUE(modelcopy);
+  auto in = fl::Variable(af::randu(3, 4), false);
+  ASSERT_TRUE(afEqual(model->forward(in), modelcopy->forward(in)));
+  modelcopy->param(0).array() += 1;
+  ASSERT_FALSE(afEqual(model->forward(in), modelcopy->forward(in)));
+}
+
+TEST(RuntimeTest, ShardedCheckpoint) {
+  const std::string dirpath = "/tmp/test_sharded";
+  std::unordered_map<std::string, std::string> config({{"lr", "0.1"}});
+  auto model = std::make_shared<fl::Sequential>();
+  model->add(fl::Conv2D(4, 6, 2, 1));
+  model->add(fl::GatedLinearUnit(2));
+  model->add(fl::Linear(3, 5));
+  auto criterion = std::make_shared<fl::Linear>(5, 2, false);
+
+  // Saved twice: the second save replaces the shards of the first
+  W2lSerializer::saveSharded(dirpath, config, model, criterion);
+  W2lSerializer::saveSharded(dirpath, config, model, criterion);
+  ASSERT_TRUE(dirExists(dirpath));
+  // The params of the saved modules are restored
+  ASSERT_EQ(model->param(0).dims(), af::dim4(2, 1, 4, 6));
+
+  std::shared_ptr<fl::Sequential> modelload;
+  std::shared_ptr<fl::Linear> criterionload;
+  std::unordered_map<std::string, std::string> configload;
+  W2lSerializer::load(dirpath, configload, modelload, criterionload);
+  EXPECT_THAT(config, ::testing::ContainerEq(configload));
+  ASSERT_EQ(model->prettyString(), modelload->prettyString());
+  ASSERT_EQ(model->params().size(), modelload->params().size());
+  for (int i = 0; i < model->params().size(); ++i) {
+    ASSERT_TRUE(afEqual(model->param(i), modelload->param(i)));
+  }
+  ASSERT_TRUE(afEqual(criterion->param(0), criterionload->param(0)));
+
+  model->eval();
+  modelload->eval();
+  auto in = fl::Variable(af::randu(10, 1, 4), false);
+  ASSERT_TRUE(afEqual(model->forward(in), modelload->forward(in)));
+}
+
+TEST(RuntimeTest, DynamicLossScaler) {
+  DynamicLossScaler scaler(8.0, 2);
+  auto param = fl::Variable(af::constant(1, 3), true);
+  auto setGrad = [&](float value) {
+    param.zeroGrad();
+    param.addGrad(fl::Variable(af::constant(value, 3), false));
+  };
+
+  setGrad(16);
+  ASSERT_TRUE(scaler.unscale({param}));
+  ASSERT_TRUE(af::allTrue<bool>(param.grad().array() == 2));
+  ASSERT_EQ(scaler.scale(), 8.0);
+
+  // An overflow skips the step and halves the scale
+  setGrad(std::numeric_limits<float>::infinity());
+  ASSERT_FALSE(scaler.unscale({param}));
+  ASSERT_EQ(scaler.scale(), 4.0);
+
+  // The scale doubles after 2 steps without overflow
+  setGrad(4);
+  ASSERT_TRUE(scaler.unscale({param}));
+  setGrad(4);
+  ASSERT_TRUE(scaler.unscale({param}));
+  ASSERT_EQ(scaler.scale(), 8.0);
+}
+
+TEST(RuntimeTest, FusedOptimizer) {
+  auto makeParams = []() {
+    af::setSeed(1);
+    return std::vector<fl::Variable>{fl::Variable(af::randu(5, 3), true),
+                                     fl::Variable(af::randu(7), true),
+                                     fl::Variable(af::randu(2, 2), true)};
+  };
+  auto setGrads = [](std::vector<fl::Variable>& params, int step) {
+    for (int i = 0; i < params.size(); ++i) {
+      params[i].zeroGrad();
+      // The last parameter has no gradient on odd steps
+      if (i < 2 || step % 2 == 0) {
+        auto grad = af::sin(params[i].array() * (step + i + 1));
+        params[i].addGrad(fl::Variable(grad, false));
+      }
+    }
+  };
+
+  using MakeOptimizer = std::function<std::shared_ptr<fl::FirstOrderOptimizer>(
+      const std::vector<fl::Variable>&)>;
+  auto check = [&](const MakeOptimizer& makeReference, OptimizerType type) {
+    auto expected = makeParams();
+    auto actual = makeParams();
+    auto reference = makeReference(expected);
+    FusedOptimizer fused(actual, type, 0.1, 0.5, 0.9, 0.99, 0.8, 1e-6, 0.01);
+    for (int step = 0; step < 4; ++step) {
+      setGrads(expected, step);
+      setGrads(actual, step);
+      reference->step();
+      fused.step();
+    }
+    for (int i = 0; i < expected.size(); ++i) {
+      ASSERT_TRUE(fl::allClose(expected[i].array(), actual[i].array(), 1e-5));
+    }
+  };
+
+  check(
+      [](const std::vector<fl::Variable>& params) {
+        return std::make_shared<fl::SGDOptimizer>(params, 0.1, 0.5, 0.01);
+      },
+      OptimizerType::SGD);
+  check(
+      [](const std::vector<fl::Variable>& params) {
+        return std::make_shared<fl::AdamOptimizer>(
+            params, 0.1, 0.9, 0.99, 1e-6, 0.01);
+      },
+      OptimizerType::ADAM);
+  check(
+      [](const std::vector<fl::Variable>& params) {
+        return std::make_shared<fl::RMSPropOptimizer>(
+            params, 0.1, 0.8, 1e-6, 0.01);
+      },
+      OptimizerType::RMSPROP);
+  check(
+      [](const std::vector<fl::Variable>& params) {
+        return std::make_shared<fl::AdadeltaOptimizer>(
+            params, 0.1, 0.8, 1e-6, 0.01);
+      },
+      OptimizerType::ADADELTA);
+}
+
+TEST(RuntimeTest, LayerwiseOptimizers) {
+  // A layer moves by about lr times its norm, whatever the gradient scale
+  auto checkStep = [](fl::FirstOrderOptimizer& opt,
+                      fl::Variable& param,
+                      float expectedRatio) {
+    auto before = param.array().copy();
+    param.zeroGrad();
+    param.addGrad(fl::Variable(af::randu(param.dims()) * 1000, false));
+    opt.step();
+    float moved = af::norm(param.array() - before) / af::norm(before);
+    ASSERT_NEAR(moved, expectedRatio, 1e-4);
+  };
+
+  auto lambParam = fl::Variable(af::randu(6, 4) + 1, true);
+  LambOptimizer lamb({lambParam}, 0.01);
+  checkStep(lamb, lambParam, 0.01);
+
+  auto larsParam = fl::Variable(af::randu(6, 4) + 1, true);
+  LarsOptimizer lars({larsParam}, 0.1, 0.0, 0.02);
+  checkStep(lars, larsParam, 0.1 * 0.02);
+}
+
+TEST(RuntimeTest, Tracer) {
+  const std::string path = "/tmp/test_trace.json";
+  {
+    Tracer tracer(path, 3);
+    ASSERT_TRUE(tracer.enabled());
+    auto net = std::make_shared<fl::Sequential>();
+    net->add(fl::Linear(4, 4));
+    net->add(fl::ReLU());
+    {
+      Tracer::Span span(tracer, "step");
+      auto output = tracedForward(*net, {fl::input(af::randn(4, 2))}, tracer);
+      ASSERT_EQ(output.front().dims(), af::dim4(4, 2));
+    }
+    tracer.flush();
+    tracer.begin("unfinished \"span\"");
+  }
+  std::ifstream file(path);
+  std::string trace(
+      (std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  ASSERT_EQ(trace.front(), '[');
+  ASSERT_EQ(trace.substr(trace.size() - 2), "]\n");
+  ASSERT_THAT(trace, ::testing::HasSubstr("\"name\":\"step\""));
+  ASSERT_THAT(trace, ::testing::HasSubstr("\"name\":\"forward (0) Linear"));
+  ASSERT_THAT(trace, ::testing::HasSubstr("\"name\":\"forward (1) ReLU"));
+  ASSERT_THAT(trace, ::testing::HasSubstr("unfinished \\\"span\\\""));
+  ASSERT_THAT(trace, ::testing::HasSubstr("\"pid\":3"));
+
+  Tracer disabled("", 0);
+  ASSERT_FALSE(disabled.enabled());
+  disabled.begin("ignored");
+  disabled.end();
+}
+
+TEST(RuntimeTest, EmissionFile) {
+  const std::string path = "/tmp/test.emissions";
+  std::vector<std::vector<float>> emissions = {
+      {0.5, -1.25, 3.0, 1e-6, -65504.0, 70000.0},
+      {},
+      {0.1, -0.2, 1e5, -1e-8}};
+  EmissionSet meta;
+  {
+    EmissionFileWriter writer(path);
+    for (int i = 0; i < emissions.size(); ++i) {
+      writer.add(emissions[i]);
+      meta.emissionT.push_back(emissions[i].size() / 2);
+      meta.sampleIds.push_back("sample" + std::to_string(i));
+      meta.wordTargets.push_back({"word"});
+      meta.tokenTargets.push_back({i});
+    }
+    meta.emissionN = 2;
+    meta.gflags = "--flag=1";
+    writer.finish(meta);
+  }
+
+  EmissionFileReader reader(path);
+  ASSERT_EQ(reader.size(), 3);
+  ASSERT_EQ(reader.meta().sampleIds, meta.sampleIds);
+  ASSERT_EQ(reader.meta().tokenTargets, meta.tokenTargets);
+  ASSERT_EQ(reader.meta().emissionT, meta.emissionT);
+  ASSERT_EQ(reader.meta().gflags, meta.gflags);
+  ASSERT_TRUE(reader.meta().emissions.empty());
+  // In reverse order: samples are read independently
+  for (int i = emissions.size() - 1; i >= 0; --i) {
+    auto emission = reader.emission(i);
+    ASSERT_EQ(emission.size(), emissions[i].size());
+    for (int j = 0; j < emission.size(); ++j) {
+      float expected = emissions[i][j];
+      if (std::abs(expected) > 65504) {
+        ASSERT_TRUE(std::isinf(emission[j]));
+        ASSERT_EQ(emission[j] > 0, expected > 0);
+      } else {
+        // half precision: 11 significant bits, subnormals below 2^-14
+        ASSERT_NEAR(emission[j], expected, std::abs(expected) / 1024 + 1e-7);
+      }
+    }
+  }
+  ASSERT_THROW(reader.emission(3), std::out_of_range);
+  // The decoders convert the mapped halves themselves
+  ASSERT_EQ(reader.topK(), 0);
+  std::vector<float> converted(emissions[0].size());
+  halvesToFloats(reader.halfEmission(0), converted.size(), converted.data());
+  ASSERT_EQ(converted, reader.emission(0));
+  ASSERT_THROW(reader.sparseEmission(0), std::logic_error);
+
+  EmissionSet mismatched = meta;
+  mismatched.emissionT.pop_back();
+  EmissionFileWriter writer(path + ".other");
+  ASSERT_THROW(writer.finish(mismatched), std::invalid_argument);
+}
+
+TEST(RuntimeTest, EmissionFileTopK) {
+  const std::string path = "/tmp/test_topk.emissions";
+  // 2 samples of N = 4 tokens, blank = 3
+  std::vector<std::vector<float>> emissions = {
+      {1.0, 4.0, 2.0, -1.0, 0.5, 0.25, 3.0, 2.0},
+      {-2.0, -3.0, -1.0, 0.0}};
+  std::vector<std::vector<float>> expected = {
+      {2.0, 4.0, 2.0, -1.0, 2.0, 2.0, 3.0, 2.0},
+      {-1.0, -1.0, -1.0, 0.0}};
+  EmissionSet meta;
+  {
+    EmissionFileWriter writer(path, 2, 3, 1);
+    for (int i = 0; i < emissions.size(); ++i) {
+      writer.add(emissions[i], 4);
+      meta.emissionT.push_back(emissions[i].size() / 4);
+      meta.sampleIds.push_back("sample" + std::to_string(i));
+      meta.wordTargets.push_back({});
+      meta.tokenTargets.push_back({});
+    }
+    ASSERT_THROW(writer.add({1.0, 2.0, 3.0}, 4), std::invalid_argument);
+    meta.emissionN = 4;
+    writer.finish(meta);
+    ASSERT_THROW(writer.add(emissions[0], 4), std::logic_error);
+  }
+
+  EmissionFileReader reader(path);
+  ASSERT_EQ(reader.size(), 2);
+  for (int i = 0; i < emissions.size(); ++i) {
+    ASSERT_EQ(reader.emission(i), expected[i]);
+  }
+  // The stored tokens, best first and then the blank
+  auto sparse = reader.sparseEmission(0);
+  ASSERT_EQ(sparse.T, 2);
+  ASSERT_EQ(sparse.N, 4);
+  ASSERT_EQ(sparse.tokens, (std::vector<int>{1, 2, 3, 2, 3}));
+  ASSERT_EQ(sparse.floors, (std::vector<float>{2.0, 2.0}));
+  ASSERT_THROW(reader.halfEmission(0), std::logic_error);
+}
+
+TEST(RuntimeTest, UnpadBatch) {
+  auto emissions = af::randu(3, 10, 2);
+  auto unpadded = unpadEmissions(emissions, {4.0, 8.0});
+  ASSERT_EQ(unpadded.size(), 2);
+  ASSERT_EQ(unpadded[0].dims(), af::dim4(3, 5));
+  ASSERT_EQ(unpadded[1].dims(), af::dim4(3, 10));
+  ASSERT_TRUE(af::allTrue<bool>(
+      unpadded[0] == emissions(af::span, af::seq(5), 0)));
+  ASSERT_TRUE(
+      af::allTrue<bool>(unpadded[1] == emissions(af::span, af::span, 1)));
+  // Without the sizes, the emissions aren't cut
+  ASSERT_EQ(unpadEmissions(emissions, {})[0].dims(), af::dim4(3, 10));
+  ASSERT_THROW(unpadEmissions(emissions, {1.0}), std::invalid_argument);
+
+  std::vector<int> padded = {1, 2, -1, -1, 3, 4, 5, 9, 6, 9, 9, 9};
+  auto targets = readBatchTargets(af::array(4, 3, padded.data()), 9);
+  ASSERT_EQ(targets.size(), 3);
+  ASSERT_EQ(targets[0], std::vector<int>({1, 2}));
+  ASSERT_EQ(targets[1], std::vector<int>({3, 4, 5}));
+  ASSERT_EQ(targets[2], std::vector<int>({6}));
+}
+
+TEST(RuntimeTest, ChunkedForward) {
+  // Halves the frames and puts the time on the second axis, as emissions
+  fl::Sequential net;
+  net.add(fl::Pool2D(2, 1, 2, 1));
+  net.add(fl::Reorder(1, 0, 3, 2));
+  auto input = af::randn(24, 3);
+  auto expected = net.forward({fl::input(input)}).front().array();
+  ASSERT_EQ(expected.dims(), af::dim4(3, 12));
+
+  auto chunked = chunkedForward(net, input, 4, 2, 2);
+  ASSERT_EQ(chunked.dims(), expected.dims());
+  ASSERT_TRUE(af::allTrue<bool>(chunked == expected));
+  // A last chunk shorter than the others
+  chunked = chunkedForward(net, input, 10, 2, 8);
+  ASSERT_TRUE(af::allTrue<bool>(chunked == expected));
+  // Short inputs aren't chunked
+  chunked = chunkedForward(net, input, 24, 2, 8);
+  ASSERT_TRUE(af::allTrue<bool>(chunked == expected));
+}
+
+TEST(RuntimeTest, InferenceEngine) {
+  FLAGS_criterion = kCtcCriterion;
+  FLAGS_mfsc = FLAGS_mfcc = FLAGS_pow = false;
+  FLAGS_channels = 1;
+  FLAGS_replabel = 0;
+  FLAGS_wordseparator = "|";
+  FLAGS_samplerate = 16000;
+  const std::string tokensPath = "/tmp/test_engine_tokens.txt";
+  const std::string amPath = "/tmp/test_engine_am.bin";
+  {
+    std::ofstream tokens(tokensPath);
+    tokens << "a\nb\n|\n";
+  }
+  // Frame-wise, from raw audio to the emissions of 3 tokens and the blank
+  auto net = std::make_shared<fl::Sequential>();
+  net->add(fl::Reorder(1, 0, 3, 2));
+  net->add(fl::Linear(1, 4));
+  std::shared_ptr<SequenceCriterion> criterion =
+      std::make_shared<ConnectionistTemporalClassificationCriterion>();
+  std::unordered_map<std::string, std::string> cfg = {
+      {kGflags, serializeGflags()}};
+  W2lSerializer::save(amPath, cfg, net, criterion);
+
+  InferenceOptions options;
+  options.am = amPath;
+  options.tokens = tokensPath;
+  options.decoder =
+      DecoderOptions(10, 4, 100, 0, 0, 0, 0, 0, false, CriterionType::CTC);
+  options.nDecoders = 2;
+  options.maxBatchSize = 4;
+  options.sessionChunkMs = 1; // 16 samples
+  options.sessionContextMs = 0.5;
+  InferenceEngine engine(options);
+
+  auto audio = afToVector<float>(af::randn(100));
+  auto expected = engine.transcribe(audio);
+  ASSERT_FALSE(expected.tokens.empty());
+
+  // Concurrent requests are batched, padded, and transcribed the same
+  std::vector<Transcription> results(6);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < results.size(); ++i) {
+    threads.emplace_back([&, i]() {
+      std::vector<float> input(audio.begin(), audio.end() - 10 * (i % 2));
+      results[i] = engine.transcribe(input);
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (int i = 0; i < results.size(); i += 2) {
+    ASSERT_EQ(results[i].tokens, expected.tokens);
+    ASSERT_EQ(results[i].words, expected.words);
+    ASSERT_EQ(results[i + 1].tokens, results[1].tokens);
+  }
+
+  // The chunks of a frame-wise model have the same emissions
+  auto session = engine.openSession();
+  for (int begin = 0; begin < audio.size(); begin += 7) {
+    session->feed(
+        audio.data() + begin, std::min<size_t>(7, audio.size() - begin));
+  }
+  auto streamed = session->finish();
+  ASSERT_EQ(streamed.tokens, expected.tokens);
+  ASSERT_NEAR(streamed.score, expected.score, 1e-3);
+  ASSERT_THROW(session->feed(audio.data(), 1), std::logic_error);
+
+  // The chunks of concurrent sessions are forwarded together
+  options.sessionBatchDelayMs = 200;
+  InferenceEngine batching(options);
+  std::vector<Transcription> sessionResults(4);
+  threads.clear();
+  for (int i = 0; i < sessionResults.size(); ++i) {
+    threads.emplace_back([&, i]() {
+      auto s = batching.openSession();
+      for (int begin = 0; begin < audio.size(); begin += 16) {
+        s->feed(
+            audio.data() + begin, std::min<size_t>(16, audio.size() - begin));
+      }
+      sessionResults[i] = s->finish();
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (const auto& result : sessionResults) {
+    ASSERT_EQ(result.tokens, expected.tokens);
+  }
+  auto stats = batching.stats();
+  ASSERT_EQ(stats.requests, stats.sessionChunks);
+  ASSERT_LT(stats.batches, stats.sessionChunks);
+}
+
+TEST(RuntimeTest, StreamingVad) {
+  FLAGS_mfsc = FLAGS_mfcc = FLAGS_pow = false;
+  FLAGS_channels = 1;
+  FLAGS_samplerate = 1000; // a frame per ms
+  // The blank (1) is likely for silent audio, the token (0) for loud audio
+  std::vector<float> weight = {1, -1}, bias = {0, 5};
+  auto net = std::make_shared<fl::Sequential>();
+  net->add(fl::Reorder(1, 0, 3, 2));
+  net->add(fl::Linear(
+      fl::Variable(af::array(2, 1, weight.data()), false),
+      fl::Variable(af::array(2, bias.data()), false)));
+  StreamingVadOptions options;
+  options.speechThreshold = 0.9;
+  options.silenceThreshold = 0.99;
+  options.minSpeechMs = 20;
+  options.minSilenceMs = 100;
+  options.normalize = false;
+  StreamingVad vad(net, {"RO 1 0 3 2", "L 1 2"}, 1, options);
+
+  std::vector<float> audio(900, 0.0);
+  std::fill(audio.begin() + 200, audio.begin() + 400, 10.0);
+  std::vector<VadEvent> events;
+  for (size_t begin = 0; begin < audio.size(); begin += 37) {
+    auto chunk = vad.feed(
+        audio.data() + begin, std::min<size_t>(37, audio.size() - begin));
+    events.insert(events.end(), chunk.begin(), chunk.end());
+    // Decided within the latency bound
+    if (begin >= 200 + 20) {
+      ASSERT_TRUE(vad.inSpeech() || begin >= 400);
+    }
+  }
+  ASSERT_FALSE(vad.inSpeech());
+  ASSERT_TRUE(vad.finish().empty());
+  ASSERT_EQ(events.size(), 2);
+  ASSERT_EQ(events[0].kind, VadEvent::Kind::SPEECH_START);
+  ASSERT_NEAR(events[0].timeMs, 200, 1e-6);
+  ASSERT_EQ(events[1].kind, VadEvent::Kind::SPEECH_END);
+  ASSERT_NEAR(events[1].timeMs, 400, 1e-6);
+
+  // The segment open at the end of the stream ends with it
+  events = vad.feed(audio.data() + 200, 200);
+  auto last = vad.finish();
+  events.insert(events.end(), last.begin(), last.end());
+  ASSERT_EQ(events.size(), 2);
+  ASSERT_NEAR(events[0].timeMs, 0, 1e-6);
+  ASSERT_EQ(events[1].kind, VadEvent::Kind::SPEECH_END);
+  ASSERT_NEAR(events[1].timeMs, 200, 1e-6);
+}
+
+TEST(RuntimeTest, DataEcho) {
+  DataEcho echo(4, 4);
+  ASSERT_EQ(echo.factor(), 1);
+  BatchPrefetcher::Stats stats;
+  auto load = [&stats](int64_t ready) {
+    ++stats.gets;
+    stats.readySum += ready;
+    return stats;
+  };
+
+  // Batches taking 3 times as long to load as to compute
+  for (int i = 0; i < 3; ++i) {
+    ASSERT_FALSE(echo.add(0.2, 0.1, load(0)));
+  }
+  ASSERT_TRUE(echo.add(0.2, 0.1, load(0)));
+  ASSERT_EQ(echo.factor(), 3);
+
+  // Batches loaded ahead: the factor goes down by 1
+  for (int i = 0; i < 4; ++i) {
+    echo.add(0, 0.3, load(2));
+  }
+  ASSERT_EQ(echo.factor(), 2);
+
+  // The stats reset, with no batch ahead
+  stats = BatchPrefetcher::Stats();
+  for (int i = 0; i < 4; ++i) {
+    echo.add(0, 0.2, load(1));
+  }
+  ASSERT_EQ(echo.factor(), 2);
+
+  // At most maxFactor
+  for (int i = 0; i < 4; ++i) {
+    echo.add(10, 0.2, load(0));
+  }
+  ASSERT_EQ(echo.factor(), 4);
+
+  echo.setFactor(0);
+  ASSERT_EQ(echo.factor(), 1);
+  ASSERT_THROW(DataEcho(0), std::invalid_argument);
+}
+
+TEST(RuntimeTest, SplitBatch) {
+  std::vector<af::array> batch(kNumDataIdx);
+  batch[kInputIdx] = af::randu(10, 3, 1, 5);
+  batch[kTargetIdx] = af::randu(4, 5);
+  batch[kSampleIdx] = af::randu(2, 5);
+
+  auto parts = splitBatch(batch, 2);
+  ASSERT_EQ(parts.size(), 2);
+  ASSERT_EQ(parts[0][kInputIdx].dims(), af::dim4(10, 3, 1, 2));
+  ASSERT_EQ(parts[1][kInputIdx].dims(), af::dim4(10, 3, 1, 3));
+  ASSERT_EQ(parts[1][kTargetIdx].dims(), af::dim4(4, 3));
+  ASSERT_TRUE(parts[1][kWordIdx].isempty());
+  ASSERT_TRUE(af::allTrue<bool>(
+      parts[1][kTargetIdx] == batch[kTargetIdx](af::span, af::seq(2, 4))));
+
+  // At most one part per sample
+  ASSERT_EQ(splitBatch(batch, 8).size(), 5);
+}
+
 TEST(RuntimeTest, TestCleanFilepath) {
   auto s = cleanFilepath("timit/train.\\mymodel");
 #ifdef _WIN32
@@ -78,6 +661,48 @@ TEST(RuntimeTest, TestCleanFilepath) {
 #endif
 }
 
+TEST(RuntimeTest, ErrorRateMeter) {
+  // Same distances as fl::EditDistanceMeter
+  std::mt19937 rng(0);
+  for (int t = 0; t < 200; ++t) {
+    // References of up to 3 blocks of 64 tokens, hypotheses close to them
+    std::vector<int> ref(1 + rng() % 200), hyp;
+    for (auto& token : ref) {
+      token = rng() % 5;
+    }
+    for (auto token : ref) {
+      auto op = rng() % 10;
+      if (op == 0) {
+        continue; // deletion
+      }
+      hyp.push_back(op == 1 ? rng() % 5 : token);
+      if (op == 2) {
+        hyp.push_back(rng() % 5); // insertion
+      }
+    }
+    fl::EditDistanceMeter expected;
+    expected.add(hyp, ref);
+    w2l::ErrorRateMeter meter;
+    meter.add(hyp, ref);
+    ASSERT_NEAR(meter.value(), expected.value()[0], 1e-6);
+  }
+
+  w2l::ErrorRateMeter words, other;
+  words.add(
+      std::vector<std::string>{"the", "cat", "sat"},
+      std::vector<std::string>{"the", "cat", "sat", "down"});
+  ASSERT_EQ(words.errors(), 1);
+  ASSERT_EQ(words.length(), 4);
+  other.add(
+      std::vector<std::string>{"a", "dog"},
+      std::vector<std::string>{"the", "dog"});
+  other.add(std::vector<std::string>{"x"}, std::vector<std::string>{});
+  words.add(other);
+  ASSERT_EQ(words.errors(), 3);
+  ASSERT_EQ(words.length(), 6);
+  ASSERT_NEAR(words.value(), 50.0, 1e-6);
+}
+
 TEST(RuntimeTest, SpeechStatMeter) {
   w2l::SpeechStatMeter meter;
   std::array<int, 5> a{1, 2, 3, 4, 5};
@@ -0,0 +1,385 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/**
+ * Aligns the transcriptions of a dataset to their audio with an ASG or a CTC
+ * model, and writes the timings of their tokens and words as CTM files:
+ * - `<outpath>/align-<world_rank>.tkn.ctm`: a line per token of each sample
+ * - `<outpath>/align-<world_rank>.ctm`: a line per word of each sample
+ * Each line is `<sample id> 1 <start (s)> <duration (s)> <token or word>`.
+ *
+ * The alignment is the best path of the emissions through the target (for
+ * ASG, with the transitions of the model; for CTC, with blanks between the
+ * tokens), computed for whole batches (--am_batchframes) on --nthread_am
+ * GPUs, while --nthread_writer threads format and write the timings of the
+ * previous ones. Large lists are split between processes with --world_rank
+ * and --world_size.
+ */
+
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <flashlight/flashlight.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "common/Defines.h"
+#include "common/FlashlightUtils.h"
+#include "common/Transforms.h"
+#include "common/Utils.h"
+#include "criterion/criterion.h"
+#include "libraries/common/BlockingQueue.h"
+#include "libraries/common/Dictionary.h"
+#include "module/module.h"
+#include "runtime/runtime.h"
+
+namespace {
+
+DEFINE_string(outpath, "", "Output directory of the CTM files");
+DEFINE_int32(
+    nthread_writer,
+    2,
+    "Number of threads formatting and writing the timings, while the GPUs "
+    "align the next batches");
+
+// Extensions of the output files
+const std::string kTokenCtmExt = ".tkn.ctm";
+const std::string kWordCtmExt = ".ctm";
+
+// What the GPU workers hand to the writers for a sample
+struct AlignResult {
+  std::string sampleId;
+  std::vector<int> path; // class of each frame
+  double frameMs; // duration of a frame of the emissions
+};
+
+// A token of the alignment, over frames [start, end)
+struct Segment {
+  int token;
+  int start;
+  int end;
+};
+
+// The tokens of a path: its runs of frames of a class, but the blanks
+std::vector<Segment> pathSegments(const std::vector<int>& path, int blank) {
+  std::vector<Segment> segments;
+  for (int t = 0; t < path.size(); ++t) {
+    if (t > 0 && path[t] == path[t - 1]) {
+      segments.back().end = t + 1;
+    } else {
+      segments.push_back({path[t], t, t + 1});
+    }
+  }
+  auto isBlank = [blank](const Segment& s) {
+    return s.token < 0 || s.token == blank;
+  };
+  segments.erase(
+      std::remove_if(segments.begin(), segments.end(), isBlank),
+      segments.end());
+  return segments;
+}
+
+void writeCtmLine(
+    std::ostream& out,
+    const std::string& sampleId,
+    const Segment& segment,
+    double frameMs,
+    const std::string& text) {
+  out << sampleId << " 1 " << std::fixed << std::setprecision(3)
+      << segment.start * frameMs / 1000 << " "
+      << (segment.end - segment.start) * frameMs / 1000 << " " << text
+      << "\n";
+}
+
+} // namespace
+
+using namespace w2l;
+
+int main(int argc, char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  google::InstallFailureSignalHandler();
+  std::string exec(argv[0]);
+  std::vector<std::string> argvs;
+  for (int i = 0; i < argc; i++) {
+    argvs.emplace_back(argv[i]);
+  }
+  gflags::SetUsageMessage(
+      "Usage: \n " + exec + " [data_path] [dataset_name] [flags]");
+  if (argc <= 1) {
+    LOG(FATAL) << gflags::ProgramUsage();
+  }
+
+  /* ===================== Parse Options ===================== */
+  LOG(INFO) << "Parsing command line flags";
+  gflags::ParseCommandLineFlags(&argc, &argv, false);
+  auto flagsfile = FLAGS_flagsfile;
+  if (!flagsfile.empty()) {
+    LOG(INFO) << "Reading flags from file " << flagsfile;
+    gflags::ReadFromFlagsFile(flagsfile, argv[0], true);
+  }
+
+  /* ===================== Create Network ===================== */
+  std::shared_ptr<fl::Module> network;
+  std::shared_ptr<SequenceCriterion> criterion;
+  std::unordered_map<std::string, std::string> cfg;
+  LOG(INFO) << "[Network] Reading acoustic model from " << FLAGS_am;
+  W2lSerializer::load(FLAGS_am, cfg, network, criterion);
+  network->eval();
+  criterion->eval();
+
+  LOG(INFO) << "[Network] " << network->prettyString();
+  LOG(INFO) << "[Criterion] " << criterion->prettyString();
+  LOG(INFO) << "[Network] Number of params: " << numTotalParams(network);
+
+  auto flags = cfg.find(kGflags);
+  if (flags == cfg.end()) {
+    LOG(FATAL) << "[Network] Invalid config loaded from " << FLAGS_am;
+  }
+  LOG(INFO) << "[Network] Updating flags from config file: " << FLAGS_am;
+  gflags::ReadFlagsFromString(flags->second, gflags::GetArgv0(), true);
+
+  // override with user-specified flags
+  gflags::ParseCommandLineFlags(&argc, &argv, false);
+  if (!flagsfile.empty()) {
+    gflags::ReadFromFlagsFile(flagsfile, argv[0], true);
+  }
+
+  LOG(INFO) << "Gflags after parsing \n" << serializeGflags("; ");
+
+  /* ===================== Create Dictionary ===================== */
+  auto dictPath = pathsConcat(FLAGS_tokensdir, FLAGS_tokens);
+  if (dictPath.empty() || !fileExists(dictPath)) {
+    throw std::runtime_error(
+        "Invalid dictionary filepath specified " + dictPath);
+  }
+  Dictionary tokenDict(dictPath);
+  // Setup-specific modifications
+  for (int64_t r = 1; r <= FLAGS_replabel; ++r) {
+    tokenDict.addEntry(std::to_string(r));
+  }
+  // ctc expects the blank label last
+  if (FLAGS_criterion == kCtcCriterion) {
+    tokenDict.addEntry(kBlankToken);
+  } else if (FLAGS_criterion != kAsgCriterion) {
+    LOG(FATAL) << "ASG or CTC-trained model required for forced alignment.";
+  }
+  if (FLAGS_eostoken) {
+    tokenDict.addEntry(kEosToken);
+  }
+  tokenDict.freeze();
+
+  int numClasses = tokenDict.indexSize();
+  LOG(INFO) << "Number of classes (network): " << numClasses;
+
+  Dictionary wordDict;
+  LexiconMap lexicon;
+  if (!FLAGS_lexicon.empty()) {
+    lexicon = loadWords(FLAGS_lexicon, FLAGS_maxword);
+    wordDict = createWordDict(lexicon);
+    wordDict.freeze();
+    LOG(INFO) << "Number of words: " << wordDict.indexSize();
+    wordDict.setDefaultIndex(wordDict.getIndex(kUnkToken));
+  }
+
+  DictionaryMap dicts = {{kTargetIdx, tokenDict}, {kWordIdx, wordDict}};
+
+  /* ===================== Create Dataset ===================== */
+  // Each process runs a shard of the list, --world_rank of --world_size, and
+  // aligns it on --nthread_am GPUs, which split the shard again
+  if (FLAGS_nthread_am < 1 || FLAGS_nthread_am > af::getDeviceCount()) {
+    LOG(FATAL) << "FLAGS_nthread_am should be between 1 and the number of "
+               << "visible GPUs";
+  }
+  // Batches of samples of similar durations with --am_batchframes, or single
+  // samples. The packing flag of the training doesn't apply.
+  FLAGS_batchframes = FLAGS_am_batchframes;
+  int nShards = FLAGS_world_size * FLAGS_nthread_am;
+  std::vector<std::shared_ptr<W2lDataset>> datasets;
+  int64_t nSamples = 0;
+  for (int i = 0; i < FLAGS_nthread_am; ++i) {
+    datasets.push_back(createDataset(
+        FLAGS_test,
+        dicts,
+        lexicon,
+        1,
+        FLAGS_world_rank * FLAGS_nthread_am + i,
+        nShards));
+    nSamples += datasets.back()->numSamples();
+  }
+  LOG(INFO) << "[Dataset] Dataset loaded, " << nSamples << " samples in "
+            << "shard " << FLAGS_world_rank << " of " << FLAGS_world_size;
+
+  /* ===================== Align ===================== */
+  // The GPUs only forward the batches and align them; the timings are
+  // formatted and written by --nthread_writer threads meanwhile
+  const bool isCtc = FLAGS_criterion == kCtcCriterion;
+  int blank = isCtc ? tokenDict.getIndex(kBlankToken) : -1;
+  // Input frames are frames of features, or samples of raw audio
+  double inputFrameMs = FLAGS_pow || FLAGS_mfsc || FLAGS_mfcc
+      ? FLAGS_framestridems
+      : 1000.0 / FLAGS_samplerate;
+  BlockingQueue<AlignResult> results(FLAGS_emission_queue_size);
+  std::atomic<int> nRunningProducers(FLAGS_nthread_am);
+  std::atomic<int> nQueued(0);
+
+  auto runAm = [&](int wid) {
+    af::setDevice(wid);
+    auto localNetwork = network;
+    auto localCriterion = criterion;
+    if (wid != 0) {
+      std::unordered_map<std::string, std::string> dummyCfg;
+      W2lSerializer::load(FLAGS_am, dummyCfg, localNetwork, localCriterion);
+      localNetwork->eval();
+      localCriterion->eval();
+    }
+    af::array trans;
+    if (!isCtc) {
+      trans = localCriterion->param(0).array().as(f32);
+    }
+    auto& ds = datasets[wid];
+    bool stop = false;
+    for (int64_t idx = 0; idx < ds->size() && !stop; ++idx) {
+      auto batch = ds->get(idx);
+      auto emissions = localNetwork->forward({fl::input(batch[kInputIdx])})
+                           .front()
+                           .array()
+                           .as(f32);
+      int T = emissions.dims(1);
+      int B = emissions.dims(2);
+      if (isCtc) {
+        emissions = fl::logSoftmax(fl::Variable(emissions, false), 0).array();
+      }
+      // The frames of each sample, and the stride of the network
+      auto sizes = unpadEmissionSizes(T, B, ds->getSampleDurations(idx));
+      double frameMs = inputFrameMs * batch[kInputIdx].dims(0) / T;
+      auto path = afToVector<int>(forcedAlignmentPath(
+          emissions, batch[kTargetIdx], trans, af::array(B, sizes.data())));
+      auto sampleIds = readSampleIds(batch[kSampleIdx]);
+      for (int b = 0; b < B; ++b) {
+        if (FLAGS_maxload > 0 && nQueued++ >= FLAGS_maxload) {
+          stop = true;
+          break;
+        }
+        AlignResult result;
+        result.sampleId = std::move(sampleIds[b]);
+        auto samplePath = path.begin() + b * T;
+        result.path.assign(samplePath, samplePath + sizes[b]);
+        result.frameMs = frameMs;
+        if (!results.push(std::move(result))) {
+          stop = true;
+          break;
+        }
+      }
+    }
+  };
+
+  auto outBase =
+      pathsConcat(FLAGS_outpath, "align-" + std::to_string(FLAGS_world_rank));
+  std::ofstream tokenCtm(outBase + kTokenCtmExt);
+  std::ofstream wordCtm(outBase + kWordCtmExt);
+  if (!tokenCtm.is_open() || !wordCtm.is_open()) {
+    LOG(FATAL) << "Cannot open the CTM files " << outBase << "*";
+  }
+  std::mutex ctmMutex;
+
+  auto runWriter = [&]() {
+    AlignResult result;
+    while (results.pop(result)) {
+      std::ostringstream tokenLines, wordLines;
+      auto segments = pathSegments(result.path, blank);
+      if (segments.empty()) {
+        LOG(WARNING) << "[Align] Empty alignment for " << result.sampleId;
+      }
+
+      // Words are the tokens between the word separators, or beginning with
+      // the separator for word pieces
+      std::vector<int> wordTokens;
+      Segment word{-1, 0, 0};
+      auto flushWord = [&]() {
+        auto letters = tknTarget2Ltr(wordTokens, tokenDict);
+        if (!letters.empty()) {
+          writeCtmLine(
+              wordLines,
+              result.sampleId,
+              word,
+              result.frameMs,
+              join("", letters));
+        }
+        wordTokens.clear();
+      };
+      for (const auto& segment : segments) {
+        auto entry = tokenDict.getEntry(segment.token);
+        writeCtmLine(
+            tokenLines, result.sampleId, segment, result.frameMs, entry);
+        if (entry == FLAGS_wordseparator) {
+          flushWord();
+          continue;
+        }
+        const auto& sep = FLAGS_wordseparator;
+        if (FLAGS_usewordpiece && !sep.empty() &&
+            entry.compare(0, sep.size(), sep) == 0) {
+          flushWord();
+        }
+        if (wordTokens.empty()) {
+          word.start = segment.start;
+        }
+        wordTokens.push_back(segment.token);
+        word.end = segment.end;
+      }
+      flushWord();
+
+      std::lock_guard<std::mutex> lock(ctmMutex);
+      tokenCtm << tokenLines.str();
+      wordCtm << wordLines.str();
+    }
+  };
+
+  auto timer = fl::TimeMeter();
+  timer.resume();
+  std::vector<std::thread> writers;
+  for (int i = 0; i < std::max(FLAGS_nthread_writer, 1); ++i) {
+    writers.emplace_back(runWriter);
+  }
+  std::vector<std::thread> producers;
+  for (int wid = 0; wid < FLAGS_nthread_am; ++wid) {
+    producers.emplace_back([&, wid]() {
+      try {
+        runAm(wid);
+      } catch (const std::exception& exc) {
+        LOG(FATAL) << "Exception in alignment worker " << wid << "\n"
+                   << exc.what();
+      }
+      // The last producer lets the writers drain the queue and stop
+      if (--nRunningProducers == 0) {
+        results.close();
+      }
+    });
+  }
+  for (auto& thread : producers) {
+    thread.join();
+  }
+  for (auto& thread : writers) {
+    thread.join();
+  }
+  tokenCtm.close();
+  wordCtm.close();
+  LOG(INFO) << "[Align] Processed the shard in " << timer.value() << "s, "
+            << "blocked in the queue: forward "
+            << results.pushWaitSeconds() << "s, writers "
+            << results.popWaitSeconds() << "s";
+
+  return 0;
+}
@@ -0,0 +1,138 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/**
+ * Rewrites the network of an acoustic model for inference (see
+ * module/InferenceOptimizer.h): weight normalizations are merged into the
+ * weights, batch normalizations are folded into the preceding convolutions
+ * and dropouts are removed. With --amquantize=fp16 or int8, the weights of the
+ * linear and convolution layers are then stored in fp16 or in int8 with a scale
+ * per output channel (see module/QuantizedModule.h).
+ *
+ * The model is saved with its config and criterion to --outpath and can be
+ * given to Test and Decode as --am in place of the original model. The
+ * architecture is read from the --archdir and --arch flags of the model, which
+ * can be overridden on the command line. The optimizer states of a training
+ * checkpoint are never read nor saved. With --sharded, --outpath is a
+ * directory whose params are memory-mapped when loaded (see
+ * W2lSerializer::saveSharded()), which is the fastest to start.
+ */
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include <flashlight/flashlight.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "common/Defines.h"
+#include "common/FlashlightUtils.h"
+#include "criterion/criterion.h"
+#include "data/Featurize.h"
+#include "libraries/common/Dictionary.h"
+#include "module/module.h"
+#include "runtime/runtime.h"
+
+namespace {
+
+DEFINE_string(outpath, "", "Output path of the optimized model");
+DEFINE_bool(
+    sharded,
+    false,
+    "save the optimized model as a directory of a manifest and raw param "
+    "shards, memory-mapped when loaded");
+
+} // namespace
+
+using namespace w2l;
+
+int main(int argc, char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  google::InstallFailureSignalHandler();
+  gflags::SetUsageMessage(
+      "Usage: OptimizeForInference --am=[model] --outpath=[optimized model]");
+  if (argc <= 1) {
+    LOG(FATAL) << gflags::ProgramUsage();
+  }
+
+  /* ===================== Parse Options ===================== */
+  gflags::ParseCommandLineFlags(&argc, &argv, false);
+  auto flagsfile = FLAGS_flagsfile;
+  if (!flagsfile.empty()) {
+    gflags::ReadFromFlagsFile(flagsfile, argv[0], true);
+  }
+  if (FLAGS_outpath.empty()) {
+    LOG(FATAL) << gflags::ProgramUsage();
+  }
+
+  /* ===================== Load Network ===================== */
+  std::shared_ptr<fl::Module> network;
+  std::shared_ptr<SequenceCriterion> criterion;
+  std::unordered_map<std::string, std::string> cfg;
+  LOG(INFO) << "[Network] Reading acoustic model from " << FLAGS_am;
+  W2lSerializer::load(FLAGS_am, cfg, network, criterion);
+
+  auto flags = cfg.find(kGflags);
+  if (flags == cfg.end()) {
+    LOG(FATAL) << "[Network] Invalid config loaded from " << FLAGS_am;
+  }
+  gflags::ReadFlagsFromString(flags->second, gflags::GetArgv0(), true);
+
+  // override with user-specified flags
+  gflags::ParseCommandLineFlags(&argc, &argv, false);
+  if (!flagsfile.empty()) {
+    gflags::ReadFromFlagsFile(flagsfile, argv[0], true);
+  }
+  w2l::handleDeprecatedFlags();
+
+  auto seq = std::dynamic_pointer_cast<fl::Sequential>(network);
+  if (!seq) {
+    LOG(FATAL) << "[Network] Only sequential networks can be optimized";
+  }
+
+  /* ===================== Read Architecture ===================== */
+  // The number of classes only replaces NLABEL, as in Train
+  auto dictPath = pathsConcat(FLAGS_tokensdir, FLAGS_tokens);
+  if (dictPath.empty() || !fileExists(dictPath)) {
+    throw std::runtime_error("Invalid dictionary filepath specified.");
+  }
+  Dictionary tokenDict(dictPath);
+  for (int64_t r = 1; r <= FLAGS_replabel; ++r) {
+    tokenDict.addEntry(std::to_string(r));
+  }
+  if (FLAGS_criterion == kCtcCriterion) {
+    tokenDict.addEntry(kBlankToken);
+  }
+  if (FLAGS_eostoken) {
+    tokenDict.addEntry(kEosToken);
+  }
+  int numClasses = tokenDict.indexSize();
+
+  auto archfile = pathsConcat(FLAGS_archdir, FLAGS_arch);
+  LOG(INFO) << "Loading architecture file from " << archfile;
+  auto archLines = readW2lArch(archfile, getSpeechFeatureSize(), numClasses);
+
+  /* ===================== Optimize ===================== */
+  LOG(INFO) << "[Network] Number of params: " << numTotalParams(seq) << ", "
+            << seq->modules().size() << " layers";
+  auto optimized = optimizeForInference(seq, archLines);
+  network = quantizeForInference(
+      optimized, parseQuantizationType(FLAGS_amquantize));
+  LOG(INFO) << "[Optimized Network] " << network->prettyString();
+  LOG(INFO) << "[Optimized Network] " << optimized->modules().size()
+            << " layers";
+
+  if (FLAGS_sharded) {
+    W2lSerializer::saveSharded(FLAGS_outpath, cfg, network, criterion);
+  } else {
+    W2lSerializer::save(FLAGS_outpath, cfg, network, criterion);
+  }
+  LOG(INFO) << "[Optimized Network] Saved to " << FLAGS_outpath;
+  return 0;
+}
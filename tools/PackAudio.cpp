@@ -0,0 +1,79 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/**
+ * Packs the samples of a list file into audio packs (see data/AudioPack.h),
+ * which can be given to the datasets in place of the list file.
+ *
+ * Usage: PackAudio [list file] [output prefix] [samples per pack]
+ * The packs are written to [output prefix]-00000.pack, -00001.pack, ... and
+ * their comma separated paths are printed.
+ */
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "data/AudioPack.h"
+#include "libraries/common/Utils.h"
+
+using namespace w2l;
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    std::cerr << "Usage: " << argv[0]
+              << " [list file] [output prefix] [samples per pack]"
+              << std::endl;
+    return 1;
+  }
+  std::string listFile = argv[1];
+  std::string prefix = argv[2];
+  int64_t packSize = argc > 3 ? std::stoll(argv[3]) : 100000;
+  if (packSize <= 0) {
+    std::cerr << "Invalid number of samples per pack" << std::endl;
+    return 1;
+  }
+
+  std::ifstream infile(listFile);
+  if (!infile) {
+    std::cerr << "Could not read file '" << listFile << "'" << std::endl;
+    return 1;
+  }
+
+  // [utterance id] [audio file (full path)] [audio length] [word transcripts]
+  std::unique_ptr<AudioPackWriter> writer;
+  std::vector<std::string> packs;
+  std::string line;
+  while (std::getline(infile, line)) {
+    auto tokens = splitOnWhitespace(line, true);
+    if (tokens.size() < 3) {
+      std::cerr << "Cannot parse " << line << std::endl;
+      return 1;
+    }
+    if (!writer || writer->size() >= packSize) {
+      char suffix[16];
+      std::snprintf(suffix, sizeof(suffix), "-%05zu.pack", packs.size());
+      packs.push_back(prefix + suffix);
+      writer.reset(); // closes the previous pack
+      writer.reset(new AudioPackWriter(packs.back()));
+    }
+    writer->add(
+        tokens[0],
+        tokens[1],
+        std::stod(tokens[2]),
+        std::vector<std::string>(tokens.begin() + 3, tokens.end()));
+  }
+  if (writer) {
+    writer->close();
+  }
+  std::cout << join(",", packs) << std::endl;
+  return 0;
+}
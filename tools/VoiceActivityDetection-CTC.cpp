@@ -22,13 +22,20 @@
  *   acoustic model output only (output in .tsc file for each sample).
  * - Frame wise token emissions based on the most-likely token emitted for each
  *   chunk, (output in .fwt file for each sample).
+ *
+ * The samples are forwarded by batches (--am_batchframes) on --nthread_am
+ * GPUs, while --nthread_writer threads score and write the results of the
+ * previous ones. Large lists are split between processes with --world_rank
+ * and --world_size.
  */
 
 #include <stdlib.h>
+#include <atomic>
 #include <cmath>
 #include <fstream>
 #include <iomanip>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <flashlight/flashlight.h>
@@ -39,6 +46,7 @@
 #include "common/FlashlightUtils.h"
 #include "common/Transforms.h"
 #include "criterion/criterion.h"
+#include "libraries/common/BlockingQueue.h"
 #include "libraries/common/Dictionary.h"
 #include "libraries/lm/KenLM.h"
 #include "module/module.h"
@@ -51,6 +59,11 @@ DEFINE_double(
     0.99,
     "Blank probability threshold at which a frame is deemed voice-inactive");
 DEFINE_string(outpath, "", "Output path for generated results files");
+DEFINE_int32(
+    nthread_writer,
+    2,
+    "Number of threads scoring the transcripts with the LM and writing the "
+    "results files, while the GPUs forward the next batches");
 
 // Extensions for each output file
 const std::string kVadExt = ".vad";
@@ -58,6 +71,13 @@ const std::string kFrameWiseTokensExt = ".fwt";
 const std::string kWordPieceTranscriptExt = ".tsc";
 const std::string kPerplexityPctSpeechExt = ".sts";
 
+// What the GPU workers hand to the writers for a sample
+struct VadResult {
+  std::string sampleId;
+  std::vector<int> tokenPrediction;
+  std::vector<float> blankProbs; // per frame
+};
+
 } // namespace
 
 using namespace w2l;
@@ -132,6 +152,7 @@ int main(int argc, char** argv) {
   if (FLAGS_eostoken) {
     tokenDict.addEntry(kEosToken);
   }
+  tokenDict.freeze();
 
   int numClasses = tokenDict.indexSize();
   LOG(INFO) << "Number of classes (network): " << numClasses;
@@ -141,6 +162,7 @@ int main(int argc, char** argv) {
   if (!FLAGS_lexicon.empty()) {
     lexicon = loadWords(FLAGS_lexicon, FLAGS_maxword);
     wordDict = createWordDict(lexicon);
+    wordDict.freeze();
     LOG(INFO) << "Number of words: " << wordDict.indexSize();
     wordDict.setDefaultIndex(wordDict.getIndex(kUnkToken));
   }
@@ -148,8 +170,30 @@ int main(int argc, char** argv) {
   DictionaryMap dicts = {{kTargetIdx, tokenDict}, {kWordIdx, wordDict}};
 
   /* ===================== Create Dataset ===================== */
-  auto ds = createDataset(FLAGS_test, dicts, lexicon, 1, 0, 1);
-  LOG(INFO) << "[Dataset] Dataset loaded.";
+  // Each process runs a shard of the list, --world_rank of --world_size, and
+  // forwards it on --nthread_am GPUs, which split the shard again
+  if (FLAGS_nthread_am < 1 || FLAGS_nthread_am > af::getDeviceCount()) {
+    LOG(FATAL) << "FLAGS_nthread_am should be between 1 and the number of "
+               << "visible GPUs";
+  }
+  // Batches of samples of similar durations with --am_batchframes, or single
+  // samples. The packing flag of the training doesn't apply.
+  FLAGS_batchframes = FLAGS_am_batchframes;
+  int nShards = FLAGS_world_size * FLAGS_nthread_am;
+  std::vector<std::shared_ptr<W2lDataset>> datasets;
+  int64_t nSamples = 0;
+  for (int i = 0; i < FLAGS_nthread_am; ++i) {
+    datasets.push_back(createDataset(
+        FLAGS_test,
+        dicts,
+        lexicon,
+        1,
+        FLAGS_world_rank * FLAGS_nthread_am + i,
+        nShards));
+    nSamples += datasets.back()->numSamples();
+  }
+  LOG(INFO) << "[Dataset] Dataset loaded, " << nSamples << " samples in "
+            << "shard " << FLAGS_world_rank << " of " << FLAGS_world_size;
 
   /* ===================== Build LM ===================== */
   std::shared_ptr<LM> lm;
@@ -165,80 +209,151 @@ int main(int argc, char** argv) {
   }
 
   /* ===================== Test ===================== */
-  int cnt = 0;
-  for (auto& sample : *ds) {
-    auto rawEmission = network->forward({fl::input(sample[kInputIdx])}).front();
-    auto sampleId = readSampleIds(sample[kSampleIdx]).front();
-    LOG(INFO) << "Processing sample ID " << sampleId << std::endl;
-
-    // Hypothesis
-    auto tokenPrediction =
-        afToVector<int>(criterion->viterbiPath(rawEmission.array()));
-    auto letterPrediction = tknPrediction2Ltr(tokenPrediction, tokenDict);
-    std::vector<std::string> wordPrediction = tkn2Wrd(letterPrediction);
-
-    // LM score
-    float lmScore = 0;
-    auto inState = lm->start(0);
-    for (const auto& word : wordPrediction) {
-      auto lmReturn = lm->score(inState, wordDict.getIndex(word));
-      inState = lmReturn.first;
-      lmScore += lmReturn.second;
+  // The GPUs only forward the batches and compute the blank probabilities and
+  // best paths of their samples; the LM scores and the files are written by
+  // --nthread_writer threads meanwhile
+  int blank = tokenDict.getIndex(kBlankToken);
+  BlockingQueue<VadResult> results(FLAGS_emission_queue_size);
+  std::atomic<int> nRunningProducers(FLAGS_nthread_am);
+  std::atomic<int> nQueued(0);
+
+  auto runAm = [&](int wid) {
+    af::setDevice(wid);
+    auto localNetwork = network;
+    auto localCriterion = criterion;
+    if (wid != 0) {
+      std::unordered_map<std::string, std::string> dummyCfg;
+      W2lSerializer::load(FLAGS_am, dummyCfg, localNetwork, localCriterion);
+      localNetwork->eval();
+      localCriterion->eval();
     }
-    auto lmReturn = lm->finish(inState);
-    lmScore += lmReturn.second;
-
-    // Determine results basename. In case the sample id contains an extension,
-    // else a noop
-    auto baseName = pathsConcat(
-        FLAGS_outpath, sampleId.substr(0, sampleId.find_last_of(".")));
-
-    // Output chunk-level word piece outputs (or blanks)
-    std::ofstream wpOutStream(baseName + kFrameWiseTokensExt);
-    for (auto token : tokenPrediction) {
-      wpOutStream << tokenDict.getEntry(token) << " ";
-    }
-    wpOutStream << std::endl;
-    wpOutStream.close();
-
-    int blank = tokenDict.getIndex(kBlankToken);
-    int N = rawEmission.dims(0);
-    int T = rawEmission.dims(1);
-    float vadFrameCnt = 0;
-    auto emissions = afToVector<float>(softmax(rawEmission, 0).array());
-    for (int i = 0; i < T; i++) {
-      if (emissions[i * N + blank] < FLAGS_vadthreshold) {
-        vadFrameCnt += 1;
+    auto& ds = datasets[wid];
+    bool stop = false;
+    for (int64_t idx = 0; idx < ds->size() && !stop; ++idx) {
+      auto batch = ds->get(idx);
+      auto batchEmission =
+          localNetwork->forward({fl::input(batch[kInputIdx])}).front();
+      auto rawEmissions =
+          unpadEmissions(batchEmission.array(), ds->getSampleDurations(idx));
+      auto sampleIds = readSampleIds(batch[kSampleIdx]);
+      for (int b = 0; b < rawEmissions.size(); ++b) {
+        if (FLAGS_maxload > 0 && nQueued++ >= FLAGS_maxload) {
+          stop = true;
+          break;
+        }
+        const auto& rawEmission = rawEmissions[b];
+        VadResult result;
+        result.sampleId = std::move(sampleIds[b]);
+        result.tokenPrediction =
+            afToVector<int>(localCriterion->viterbiPath(rawEmission));
+        // Only the blank row of the probabilities leaves the device
+        result.blankProbs = afToVector<float>(
+            fl::softmax(fl::Variable(rawEmission, false), 0)
+                .array()
+                .row(blank));
+        if (!results.push(std::move(result))) {
+          stop = true;
+          break;
+        }
       }
     }
+  };
+
+  auto runWriter = [&]() {
+    VadResult result;
+    while (results.pop(result)) {
+      auto letterPrediction =
+          tknPrediction2Ltr(result.tokenPrediction, tokenDict);
+      std::vector<std::string> wordPrediction = tkn2Wrd(letterPrediction);
+
+      // LM score
+      float lmScore = 0;
+      auto inState = lm->start(0);
+      for (const auto& word : wordPrediction) {
+        auto lmReturn = lm->score(inState, wordDict.getIndex(word));
+        inState = lmReturn.first;
+        lmScore += lmReturn.second;
+      }
+      auto lmReturn = lm->finish(inState);
+      lmScore += lmReturn.second;
 
-    // Output chunk-level VAD probabilities
-    std::ofstream vadProbOutStream(baseName + kVadExt);
-    for (int i = 0; i < T; i++) {
-      vadProbOutStream << std::setprecision(4) << emissions[i * N + blank]
-                       << " ";
-    }
-    vadProbOutStream << std::endl;
-    vadProbOutStream.close();
-
-    // Word-piece transcript
-    std::ofstream tScriptOutStream(baseName + kWordPieceTranscriptExt);
-    tScriptOutStream << join("", letterPrediction) << std::endl;
-    tScriptOutStream.close();
-
-    // Perplexity under the given LM and % of audio containing speech given VAD
-    // threshold
-    std::ofstream statsOutStream(baseName + kPerplexityPctSpeechExt);
-    statsOutStream << sampleId << " "
-                   << std::pow(10.0, -lmScore / wordPrediction.size()) << " "
-                   << vadFrameCnt / T << std::endl;
-    statsOutStream.close();
-
-    ++cnt;
-    if (cnt == FLAGS_maxload) {
-      break;
+      // Determine results basename. In case the sample id contains an
+      // extension, else a noop
+      const auto& sampleId = result.sampleId;
+      auto baseName = pathsConcat(
+          FLAGS_outpath, sampleId.substr(0, sampleId.find_last_of(".")));
+
+      // Output chunk-level word piece outputs (or blanks)
+      std::ofstream wpOutStream(baseName + kFrameWiseTokensExt);
+      for (auto token : result.tokenPrediction) {
+        wpOutStream << tokenDict.getEntry(token) << " ";
+      }
+      wpOutStream << std::endl;
+      wpOutStream.close();
+
+      const auto& blankProbs = result.blankProbs;
+      int T = blankProbs.size();
+      float vadFrameCnt = 0;
+      for (int i = 0; i < T; i++) {
+        if (blankProbs[i] < FLAGS_vadthreshold) {
+          vadFrameCnt += 1;
+        }
+      }
+
+      // Output chunk-level VAD probabilities
+      std::ofstream vadProbOutStream(baseName + kVadExt);
+      for (int i = 0; i < T; i++) {
+        vadProbOutStream << std::setprecision(4) << blankProbs[i] << " ";
+      }
+      vadProbOutStream << std::endl;
+      vadProbOutStream.close();
+
+      // Word-piece transcript
+      std::ofstream tScriptOutStream(baseName + kWordPieceTranscriptExt);
+      tScriptOutStream << join("", letterPrediction) << std::endl;
+      tScriptOutStream.close();
+
+      // Perplexity under the given LM and % of audio containing speech given
+      // VAD threshold
+      std::ofstream statsOutStream(baseName + kPerplexityPctSpeechExt);
+      statsOutStream << sampleId << " "
+                     << std::pow(10.0, -lmScore / wordPrediction.size())
+                     << " " << vadFrameCnt / T << std::endl;
+      statsOutStream.close();
     }
+  };
+
+  auto timer = fl::TimeMeter();
+  timer.resume();
+  std::vector<std::thread> writers;
+  for (int i = 0; i < std::max(FLAGS_nthread_writer, 1); ++i) {
+    writers.emplace_back(runWriter);
+  }
+  std::vector<std::thread> producers;
+  for (int wid = 0; wid < FLAGS_nthread_am; ++wid) {
+    producers.emplace_back([&, wid]() {
+      try {
+        runAm(wid);
+      } catch (const std::exception& exc) {
+        LOG(FATAL) << "Exception in VAD worker " << wid << "\n"
+                   << exc.what();
+      }
+      // The last producer lets the writers drain the queue and stop
+      if (--nRunningProducers == 0) {
+        results.close();
+      }
+    });
+  }
+  for (auto& thread : producers) {
+    thread.join();
+  }
+  for (auto& thread : writers) {
+    thread.join();
   }
+  LOG(INFO) << "[VAD] Processed the shard in " << timer.value() << "s, "
+            << "blocked in the queue: forward "
+            << results.pushWaitSeconds() << "s, writers "
+            << results.popWaitSeconds() << "s";
 
   return 0;
 }